@@ -0,0 +1,3 @@
+#include "lasagna.h"
+#include "sparse.h"
+#include "mat_io.h"
@@ -0,0 +1,69 @@
+#ifndef __AUTOSELECT__
+#define __AUTOSELECT__
+
+#include "common.h"
+#include <unistd.h>
+#include "evolver_common.h"
+#include "evolver_radau5.h"
+#include "evolver_exprb.h"
+#include "sparse.h"
+#include "qke_equations.h"
+
+#define _SELECT_WRAPPERS_ 5       /** Candidates: dense, blocked dense, sparse, supernodal, SuperLU */
+#define _SELECT_FLOP_RATIO_ 20.0  /** Candidates with this many times the flops of the cheapest are not probed */
+#define _SELECT_PROBE_FLOPS_ 1e10 /** Nor those whose probe has more flops than this */
+#define _SELECT_REPEATS_ 3        /** Refactorisations timed by the probe */
+#define _SELECT_SOLVES_ 3         /** Solves per factorisation in the cost of a step */
+#define _SELECT_MEMORY_MARGIN_ 1.3 /** Factor on the memory of the run predicted by lasagna_select_memory */
+
+/** Symbolic analysis of the Jacobian pattern of a run: sp_amd on A+A^T
+    and the column counts of its Cholesky factor, which estimate nnz(L)
+    and nnz(U) and the flops of an LU decomposition with little pivoting. */
+struct lasagna_pattern{
+  int n;
+  int nnz;
+  int rowmax;   //Entries in the longest row
+  int numjac;   //Is the Jacobian computed by numjac?
+  int low_memory; //Sparse wrapper in its low_memory mode?
+  double lnz;   //nnz(L), diagonal included, the same for U
+  double flops; //Of one sparse LU decomposition
+  double base;  //MB resident before the run
+};
+
+/** A linalg_wrapper for an evolver, and what it is predicted to cost. */
+struct lasagna_candidate{
+  int wrapper;
+  int available; //Built into this code?
+  double memory; //Predicted peak of the run, MB
+  double flops;  //Of the factorisations of one step
+  double seconds; //Of the factorisations and solves of one step, from the probe, -1 if not probed
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int lasagna_select(qke_param *pqke,
+		     double *y,
+		     int runs,
+		     ErrorMsg error_message);
+  int lasagna_select_pattern(qke_param *pqke,
+			     struct lasagna_pattern *pattern,
+			     ErrorMsg error_message);
+  double lasagna_select_memory(struct lasagna_pattern *pattern,
+			       int evolver,
+			       int wrapper);
+  double lasagna_select_limit(qke_param *pqke,
+			      int runs);
+  int lasagna_select_probe(qke_param *pqke,
+			   double *y,
+			   struct lasagna_candidate *candidate,
+			   int candidates,
+			   ErrorMsg error_message);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,14 +4,20 @@
 
 #include "common.h"
 #include "arrays.h"
+#define _DOF_TABLE_SIZE_ 1024 /** Buckets of the uniform log(T) index of the DoF table */
 struct background_structure{
   double *T;       //Temperature array
   double *dof_array;     //DoF spline array
   int ndof;        //Entries in DoF spline array
   char dof_filename[_FILENAMESIZE_]; //File where data is read..
-  int klo;         //Last interpolation indices in dof_array
-  int khi;
   int Tdir;        //1 for increasing, -1 for decreasing.
+  /** Spline interval of the lower edge of each bucket of a uniform grid in
+      log(T), so that background_getdof finds its interval in constant time.
+      Read-only after background_init_dof. */
+  int *dof_index;
+  double logT_min;
+  double dlogT_inv; //One over the bucket width in log(T)
+  int shared;      //_TRUE_ if the table is a copy of the pointers of another structure
 };
 
 /**
@@ -0,0 +1,62 @@
+#ifndef __BUDGET__
+#define __BUDGET__
+
+#include "common.h"
+
+/** The nproc cores of a sweep, shared out between the runs going at the
+    same time. A run gets an equal part of the free cores when it starts,
+    at least one, and once no runs of the level are waiting, the runs still
+    going take the cores of the runs that have finished. With pin, the cores
+    are CPUs of the process, taken from one NUMA node where possible, and
+    the thread of a run is pinned to its CPUs. */
+struct lasagna_budget{
+  int nproc;    //Cores of the sweep
+  int threads;  //Runs at a time, sweep_threads
+  int active;   //Runs going
+  int waiting;  //Runs of the level not started yet
+  int free;     //Cores not held by a run
+  int pin;      //Pin the runs to their CPUs?
+  int *cpu;     //CPU ids, nproc of them if pin
+  int *node;    //NUMA node of each CPU
+  int *owner;   //Run holding each CPU, -1 if free
+  int nodes;
+};
+
+/** Cores held by one run, and how the run uses them: numjac evaluates
+    numjac column groups at a time, each derivs call with rhs_threads. */
+struct lasagna_share{
+  struct lasagna_budget *budget;
+  int run;
+  int cores;
+  int numjac;
+  int rhs_threads;
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int lasagna_budget_init(struct lasagna_budget *budget,
+			  int nproc,
+			  int threads,
+			  int pin,
+			  ErrorMsg error_message);
+  int lasagna_budget_free(struct lasagna_budget *budget);
+  int lasagna_budget_level(struct lasagna_budget *budget,
+			   int runs);
+  int lasagna_budget_acquire(struct lasagna_budget *budget,
+			     int run,
+			     int rhs_threads,
+			     struct lasagna_share *share);
+  int lasagna_budget_grow(struct lasagna_share *share);
+  int lasagna_budget_release(struct lasagna_share *share);
+  int lasagna_budget_cpus(struct lasagna_share *share,
+			  char *list,
+			  int length);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,6 +22,10 @@
 
 #define _ERRORMSGSIZE_ 2048 /**< generic error messages are cut beyond this number of characters */
 typedef char ErrorMsg[_ERRORMSGSIZE_]; /**< Generic error messages (there is such a field in each structure) */
+/** Characters left in an ErrorMsg for the message of a callee, after the text of the
+    macros below with the strings text1 and text2 in it, so that the callee's message is
+    cut where the ErrorMsg ends */
+#define _ERRORMSG_LEFT_(text1,text2) ((int) (_ERRORMSGSIZE_-sizeof(text1)-sizeof(text2)-48))
 #define _FILENAMESIZE_ 40 /**< size of the string read in each line of the file (extra characters not taken into account) */
 typedef char FileName[_FILENAMESIZE_];
 
@@ -32,6 +36,9 @@ typedef char FileName[_FILENAMESIZE_];
 #define _TOLVAR_ 100. /**< The minimum allowed variation is the machine precision times this number */
 #define _HUGE_ 1.e99
 #define _CORES_ 4
+#ifndef _LASAGNA_VERSION_
+#define _LASAGNA_VERSION_ "1.0" /**< Code version, set by the Makefile from git */
+#endif
 
 #define min(a,b) (((a)<(b)) ? (a) : (b) ) /**< the usual "min" function */
 #define max(a,b) (((a)<(b)) ? (b) : (a) ) /**< the usual "max" function */
@@ -44,8 +51,11 @@ typedef char FileName[_FILENAMESIZE_];
   do {									\
     if (function == _FAILURE_) {					\
       ErrorMsg Transmit_Error_Message;					\
-      sprintf(Transmit_Error_Message,"%s(L:%d) : error in %s;\n=>%s",	\
-	      __func__,__LINE__,#function,error_message_from_function);	\
+      snprintf(Transmit_Error_Message,_ERRORMSGSIZE_,			\
+	       "%s(L:%d) : error in %s;\n=>%.*s",				\
+	       __func__,__LINE__,#function,				\
+	       _ERRORMSG_LEFT_(__func__,#function),			\
+	       error_message_from_function);				\
       sprintf(error_message_output,"%s",Transmit_Error_Message);	\
       return _FAILURE_;							\
     }									\
@@ -60,8 +70,11 @@ typedef char FileName[_FILENAMESIZE_];
     if (abort == _FALSE_) {						\
       if (function == _FAILURE_) {					\
 	ErrorMsg Transmit_Error_Message;				\
-	sprintf(Transmit_Error_Message,"%s(L:%d) : error in %s;\n=>%s",	\
-		__func__,__LINE__,#function,error_message_from_function); \
+	snprintf(Transmit_Error_Message,_ERRORMSGSIZE_,			\
+		 "%s(L:%d) : error in %s;\n=>%.*s",			\
+		 __func__,__LINE__,#function,				\
+		 _ERRORMSG_LEFT_(__func__,#function),			\
+		 error_message_from_function);				\
 	sprintf(error_message_output,"%s",Transmit_Error_Message);	\
 	abort=_TRUE_;							\
       }									\
@@ -76,14 +89,13 @@ typedef char FileName[_FILENAMESIZE_];
 		   args...)						\
   do {									\
     if (condition) {							\
-      ErrorMsg Transmit_Error_Message;					\
       ErrorMsg Optional_arguments;					\
-      sprintf(Transmit_Error_Message,					\
-	      "%s(L:%d) : condition (%s) is true",			\
-	      __func__,__LINE__,#condition);				\
-      sprintf(Optional_arguments,args);					\
-      sprintf(error_message_output,"%s; %s",				\
-	      Transmit_Error_Message, Optional_arguments);		\
+      snprintf(Optional_arguments,_ERRORMSGSIZE_,args);			\
+      snprintf(error_message_output,_ERRORMSGSIZE_,			\
+	       "%s(L:%d) : condition (%s) is true; %.*s",		\
+	       __func__,__LINE__,#condition,				\
+	       _ERRORMSG_LEFT_(__func__,#condition),			\
+	       Optional_arguments);					\
       return _FAILURE_;							\
     }									\
   } while(0);
@@ -95,14 +107,13 @@ typedef char FileName[_FILENAMESIZE_];
 		   args...)						\
   do {									\
     if (_TRUE_) {							\
-      ErrorMsg Transmit_Error_Message;					\
       ErrorMsg Optional_arguments;					\
-      sprintf(Transmit_Error_Message,					\
-	      "%s(L:%d) : error",					\
-	      __func__,__LINE__);					\
-      sprintf(Optional_arguments,args);					\
-      sprintf(error_message_output,"%s; %s",				\
-	      Transmit_Error_Message, Optional_arguments);		\
+      snprintf(Optional_arguments,_ERRORMSGSIZE_,args);			\
+      snprintf(error_message_output,_ERRORMSGSIZE_,			\
+	       "%s(L:%d) : error; %.*s",					\
+	       __func__,__LINE__,					\
+	       _ERRORMSG_LEFT_(__func__,""),				\
+	       Optional_arguments);					\
       return _FAILURE_;							\
     }									\
   } while(0);
@@ -114,14 +125,13 @@ typedef char FileName[_FILENAMESIZE_];
   do {									\
     if (abort == _FALSE_) {						\
       if (condition) {							\
-	ErrorMsg Transmit_Error_Message;				\
 	ErrorMsg Optional_arguments;					\
-	sprintf(Transmit_Error_Message,					\
-		"%s(L:%d) : condition (%s) is true",			\
-		__func__,__LINE__,#condition);				\
-	sprintf(Optional_arguments,args);				\
-	sprintf(error_message_output,"%s; %s",				\
-		Transmit_Error_Message, Optional_arguments);		\
+	snprintf(Optional_arguments,_ERRORMSGSIZE_,args);		\
+	snprintf(error_message_output,_ERRORMSGSIZE_,			\
+		 "%s(L:%d) : condition (%s) is true; %.*s",		\
+		 __func__,__LINE__,#condition,				\
+		 _ERRORMSG_LEFT_(__func__,#condition),			\
+		 Optional_arguments);					\
 	abort=_TRUE_;							\
       }									\
     }									\
@@ -220,6 +230,11 @@ enum evolver_type {
 typedef enum _LinAlgWrapper{
   LINALG_WRAPPER_DENSE_NR,
   LINALG_WRAPPER_SPARSE,
-  LINALG_WRAPPER_SUPERLU} LinAlgWrapper;
+  LINALG_WRAPPER_SUPERLU,
+  LINALG_WRAPPER_SUPERNODAL,
+  LINALG_WRAPPER_GMRES,
+  LINALG_WRAPPER_DENSE,
+  LINALG_WRAPPER_CUDA,
+  LINALG_WRAPPER_BLOCK} LinAlgWrapper;
 
 #endif
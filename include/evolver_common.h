@@ -4,6 +4,64 @@
 #include "common.h"
 #define TINY 1e-50
 #include "multimatrix.h"
+/** Entries of EvolverOptions.Stats filled by the sparse linalg wrapper: */
+#define _STAT_REFACTOR_ 6          /** Factorisations reusing the pivot sequence */
+#define _STAT_FULL_LU_ 7           /** Factorisations with pivot search */
+#define _STAT_REFACTOR_REJECTED_ 8 /** Refactorisations rejected as unstable */
+#define _STAT_REFINE_ 9            /** Refinement steps of mixed precision solves */
+#define _STAT_REFINE_FALLBACK_ 10  /** Mixed precision solves redone in double */
+#define _STAT_JAC_UPDATE_ 11       /** Secant updates of the Jacobian, ndf15 */
+#define _STAT_JAC_UPDATE_FALLBACK_ 12 /** Jacobians recomputed after an update did not help */
+#define _STAT_EVENTS_ 13           /** Events located, see EvolverOptions.Events */
+#define _EVOLVER_STATS_ 14         /** Length of EvolverOptions.Stats */
+#define _NUMJAC_BATCH_ 16          /** Column groups per derivs_batch call in numjac */
+#define _LINALG_FROM_SCRATCH_ 2    /** linalg_factorise flag: pivot search, drop kept pivots */
+#define _CHECKPOINT_NDF15_ 1       /** Evolver ids in the checkpoint header */
+#define _CHECKPOINT_RADAU5_ 2
+#define _EVENT_ITER_MAX_ 100       /** Root-finding iterations per event */
+/** Phases of EvolverOptions.Time, see evolver_timed: */
+#define _TIME_DERIVS_ 0            /** derivs and derivs_split outside the Jacobian */
+#define _TIME_JACOBIAN_ 1          /** evolver_jacobian, numjac or analytic */
+#define _TIME_FACTORISE_ 2         /** linalg_factorise */
+#define _TIME_SOLVE_ 3             /** linalg_solve and linalg_solve_many */
+#define _TIME_OUTPUT_ 4            /** output and print_variables */
+#define _EVOLVER_TIMERS_ 5         /** Length of EvolverOptions.Time */
+
+/** Hot-path timing. With -D _TIMING and options->Timing == _TRUE_, 
+    evolver_timed runs the statement and adds its wall time to
+    options->Time[phase] and one call to options->TimeCalls[phase].
+    Without _TIMING it is the statement alone, so builds without the flag
+    pay nothing. evolver_tic and evolver_toc do the same around a block,
+    for a clock started and stopped by hand. */
+#ifdef _TIMING
+#define evolver_tic(on) (((on) == _TRUE_) ? evolver_clock() : 0.0)
+#define evolver_toc(on,time,calls,t0)		\
+  do{						\
+    if ((on) == _TRUE_){			\
+      (time) += evolver_clock()-(t0);		\
+      (calls)++;				\
+    }						\
+  }while(0)
+#define evolver_timed(options,phase,...)				\
+  do{									\
+    double _timed_t0 = evolver_tic((options)->Timing);			\
+    __VA_ARGS__;							\
+    evolver_toc((options)->Timing,(options)->Time[phase],		\
+		(options)->TimeCalls[phase],_timed_t0);			\
+  }while(0)
+#else
+#define evolver_tic(on) 0.0
+#define evolver_toc(on,time,calls,t0) do{}while(0)
+#define evolver_timed(options,phase,...) do{ __VA_ARGS__; }while(0)
+#endif
+
+/** State of the progress file between its updates: */
+struct evolver_progress{
+  double start;   //Wall clock of the start of the evolver
+  double last;    //Of the last update
+  double t_last;  //t at the last update
+  int stats_last[5]; //Stats[0..4] at the last update
+};
 
 typedef struct _EvolverOptions{
   int tres;             /**If t_vec!=NULL, length of t_vec.
@@ -12,21 +70,127 @@ typedef struct _EvolverOptions{
   double RelTol;
   int * used_in_output; /**Which indices are required in output? */
   double * t_vec;       /**Output at specified points */
-  int Stats[10]; /** Evolver statistics */
+  int Stats[_EVOLVER_STATS_]; /** Evolver statistics */
   int Flags[10]; /** Can for instance be used for communication between evolver
 		     and linalg wrapper, or different instances of the wrapper. */
   int Cores;     /** Number of cores available for linalg_wrapper */
+  int DerivsThreads; /** Threads used inside one derivs call. numjac then
+			 runs Cores/DerivsThreads column groups at a time. */
   int EvolverVerbose;  /** Level of output from evolver. */
   int LinAlgVerbose;   /** Level of output from linalg wrapper. */
-  /** Pointers to the 4 linear algebra wrapper functions: */
+  /** Pointers to the 5 linear algebra wrapper functions: */
   int (*linalg_initialise)(MultiMatrix *, struct _EvolverOptions *, void **, ErrorMsg);
   int (*linalg_finalise)(void *, ErrorMsg);
   int (*linalg_factorise)(void *, int, ErrorMsg);
   int (*linalg_solve)(MultiMatrix *, MultiMatrix *, void *, ErrorMsg);
+  /** As linalg_solve, for many rows of B in one pass over the factors: */
+  int (*linalg_solve_many)(MultiMatrix *, MultiMatrix *, void *, ErrorMsg);
   /** Pointers to the evolver utility functions:*/
   int (*output)(double t, double *y, double *dy, int i, void *p, ErrorMsg err);
   int (*print_variables)(double t, double *y, double *dy, void *p, ErrorMsg err);
   int (*stop_function)(double t, double *y, double *dy, void *p, ErrorMsg err);
+  /** Events, ndf15 and radau5. If Events>0, event_function fills
+      value[0..Events-1] at (t,y), and event e is where value[e] changes
+      sign. It is located by root-finding on the dense output of the step,
+      so between the step endpoints where stop_function is called. Only
+      sign changes along the integration in event_direction[e] count: +1
+      from negative to positive, -1 from positive to negative and 0 both
+      ways (all 0 if NULL). event_action, if set, is called at each event,
+      in the order in which they occur. If event_terminal[e] is _TRUE_ (none
+      if NULL), the integration ends at the first such event, with the last
+      output call and y_inout at the event. */
+  int Events;
+  int (*event_function)(double t, double *y, double *value, void *p, ErrorMsg err);
+  int (*event_action)(double t, double *y, int event, void *p, ErrorMsg err);
+  int *event_direction;
+  int *event_terminal;
+  /** Optional copy and free of the derivs workspace. If both are set and
+      Cores>1, numjac evaluates column groups in parallel, one private
+      copy of the workspace per thread. */
+  int (*derivs_workspace_copy)(void *p, void **p_copy, ErrorMsg err);
+  int (*derivs_workspace_free)(void *p_copy, ErrorMsg err);
+  /** Optional evaluation of derivs at the m states y[0..m-1], giving the
+      same dy[k] as m calls of derivs. If set, a serial numjac evaluates
+      its column groups _NUMJAC_BATCH_ at a time. */
+  int (*derivs_batch)(double t, double **y, double **dy, int m, void *p, ErrorMsg err);
+  /** Optional analytic Jacobian. It must fill the values of J at (t,y) for
+      the pattern in J, using the same indexing of y and fval=f(t,y) as
+      derivs, and add the number of derivs calls it made to *nfe.
+      If NULL, the Jacobian is computed by numjac. */
+  int (*jacobian)(double t, double *y, double *fval, MultiMatrix *J,
+		  int *nfe, void *p, ErrorMsg err);
+  int JacobianCheck; /** If _TRUE_, compare jacobian with numjac at every call. */
+  /** ndf15 only. If JacobianUpdates>0, a Newton iteration that converges
+      too slowly first tries a sparse rank-1 (Schubert) update of J from its
+      last two iterates, and only computes a new Jacobian if the iteration
+      is still too slow. At most JacobianUpdates updates are made between
+      two computed Jacobians. */
+  int JacobianUpdates;
+  /** IMEX splitting, Rosenbrock-W evolver only. If derivs_split is set, it
+      fills f_implicit and f_explicit with f_implicit+f_explicit = derivs,
+      and the iteration matrix is built from jacobian_implicit, the
+      Jacobian of f_implicit, called with fval=f_implicit. f_explicit then
+      only enters through the stages, as in a linearly implicit IMEX
+      method. */
+  int (*derivs_split)(double t, double *y, double *f_implicit, double *f_explicit,
+		      void *p, ErrorMsg err);
+  int (*jacobian_implicit)(double t, double *y, double *fval, MultiMatrix *J,
+			   int *nfe, void *p, ErrorMsg err);
+  /** Block wrapper: Blocks blocks of BlockSize equations each, listed block
+      by block in BlockIndex. The other equations are the border. */
+  int Blocks;
+  int BlockSize;
+  int *BlockIndex;
+  char *SymbolicCache; /** Directory for the sparse symbolic-analysis cache, or NULL. */
+  int MixedPrecision; /** Sparse wrapper: solve with single precision factors and
+			  at most this many refinement steps, 0 for double only. */
+  int LowMemory;      /** Sparse wrapper: size the factors from the symbolic analysis
+			  and keep no level or split copies of them, for the
+			  smallest peak memory at some cost in speed. */
+  int ComplexAsReal;  /** radau5: solve the complex system as a real one of twice the
+			  size, so real only kernels are used for both matrices. */
+  void *LinAlgShared; /** GPU wrapper: batch shared with the other runs of a sweep,
+			  see linalg_cuda_batch_alloc. NULL for a batch of one. */
+  /** Tangent-linear mode, ndf15 only. If not NULL, tangent[0..neq-1] is a
+      vector v integrated along y with v' = J v, using the Jacobian and the
+      factorisation of the corrector. It holds v(t_final) on return, and
+      tangent_output holds v at the output point during each output and
+      stop_function call. With Tangents>1, both hold Tangents vectors of
+      neq entries each, solved together by linalg_solve_many. */
+  double *tangent;
+  double *tangent_output;
+  int Tangents;
+  /** If TangentQR>0, the tangents are orthonormalised by Gram-Schmidt in 
+      the inner product sum_i tangent_weight[i]^2 x_i y_i (1 if NULL) after
+      every TangentQR accepted steps, and scaled back to their norms at t_ini.
+      tangent_growth[j] then accumulates log of the scale factor of tangent j,
+      so log|v_j(t)| is tangent_growth[j] + log of the norm of v_j. */
+  int TangentQR;
+  double *tangent_weight;
+  double *tangent_growth;
+  /** Checkpointing, ndf15 and radau5. If CheckpointInterval>0, the state
+      of the integration is written to CheckpointFile after every 
+      CheckpointInterval accepted steps. checkpoint_state then writes the 
+      state of the caller with restore=_FALSE_. If Restart is _TRUE_, the
+      integration continues from CheckpointFile instead of starting at 
+      t_ini, and checkpoint_state reads with restore=_TRUE_. The iteration
+      matrix is factorised from scratch at every checkpoint, so a restarted
+      run takes the same steps as one that was not interrupted. */
+  char *CheckpointFile;
+  int CheckpointInterval;
+  int Restart;
+  int (*checkpoint_state)(FILE *file, int restore, void *p, ErrorMsg err);
+  /** Step history, ndf15 only. If not NULL, tnew, h, k, y and the backward
+      differences of the components in used_in_output are appended to 
+      HistoryFile after every accepted step, so the dense output can be
+      evaluated at any t after the run, see ndf15_history_eval. */
+  char *HistoryFile;
+  /** Warm start, ndf15 with a context only. If _TRUE_, and the context
+      has the start of an earlier run, the integration starts with the
+      Jacobian and the first step size of that run instead of computing
+      them at t_ini. The Jacobian is then not current, so it is computed
+      at the first Newton iteration that converges too slowly. */
+  int WarmStart;
   /** Jacobian specific stuff:*/
   int use_sparse;
   int *Ai;
@@ -35,13 +199,41 @@ typedef struct _EvolverOptions{
       calculate numjac twice each time it is called.**/
   int J_pointer_flag;
   MultiMatrix *J_pointer;
+  /** Timing, see evolver_timed. Time and TimeCalls are zeroed by
+      DefaultEvolverOptions only, so they add up over segments of a run. */
+  int Timing;
+  double Time[_EVOLVER_TIMERS_];
+  int TimeCalls[_EVOLVER_TIMERS_];
+  /** Progress file, rewritten every ProgressInterval seconds of wall clock
+      during the run, see evolver_progress. NULL for none. */
+  char *ProgressFile;
+  double ProgressInterval;
+  int ProgressIndex;     /** y[ProgressIndex]*ProgressScale is reported as "L", -1 for none */
+  double ProgressScale;
+  struct evolver_progress Progress;
 } EvolverOptions;
 
+/** Values and roots of the event functions in one step: */
+struct evolver_events{
+  int n;
+  size_t neq;
+  double *g_left;   //Values at the start of the step
+  double *g_right;  //Values at the end of the step
+  double *g;        //Values during root-finding
+  double *t_root;   //Located events of the step
+  int *found;
+  double *y;        //Dense output at the current point of the root-finding
+  double t_event;   //Terminal event, if evolver_events_locate returned stop
+  double *y_event;
+};
+
 struct numjac_workspace{
   /* Allocate vectors and matrices: */
   double *jacvec;
   int *col_group;
   int max_group; /*Number of columngroups -1 */
+  int *group_ptr; /*Columns of group g are group_col[group_ptr[g]..group_ptr[g+1]-1] */
+  int *group_col;
   double *yscale;
   double *del;
   double * Difmax;
@@ -53,18 +245,76 @@ struct numjac_workspace{
   double * yydel;
   double * tmp;
 
-  double **ydel_Fdel;
+  double **ydel_Fdel; /*Dense Jacobians only, the sparse ones use one group at a time */
 
   int * logj;
   int * Rowmax;
+
+  /* Threaded evaluation of column groups: */
+  size_t neq;
+  int threads;
+  void **derivs_workspace; /* [0] is the callers workspace, the rest are copies */
+  double **yydel_thread;
+  double **ffdel_thread;
+  int (*derivs_workspace_free)(void *, ErrorMsg);
+
+  /* Batched evaluation of column groups: */
+  int (*derivs_batch)(double, double **, double **, int, void *, ErrorMsg);
+  double *ybatch;   /* _NUMJAC_BATCH_ states of length neq */
+  double *fbatch;
+  double **ybatch_ptr;
+  double **fbatch_ptr;
 };
 
+  int DefaultEvolverOptions(EvolverOptions *opt, LinAlgWrapper linalg);
   int initialize_numjac_workspace(MultiMatrix *J, void ** numjac_workspace, ErrorMsg error_message);
   int uninitialize_numjac_workspace(void * numjac_workspace);
+  int evolver_jacobian(int (*derivs)(double x,double * y,double * dy,void * parameters_and_workspace,ErrorMsg error_message),
+		       double t, double *y, double *fval, MultiMatrix *J, void* numjac_workspace,
+		       double thresh, size_t neq, int *nfe, EvolverOptions *options,
+		       void * parameters_and_workspace_for_derivs, ErrorMsg error_message);
+  int initialize_numjac_threads(void *numjac_workspace, EvolverOptions *options,
+				void * parameters_and_workspace_for_derivs,
+				ErrorMsg error_message);
+  int reset_numjac_workspace(void *numjac_workspace, EvolverOptions *options,
+			     void * parameters_and_workspace_for_derivs,
+			     ErrorMsg error_message);
+  int refresh_numjac_threads(void *numjac_workspace, EvolverOptions *options,
+			     void * parameters_and_workspace_for_derivs,
+			     ErrorMsg error_message);
+  int evolver_events_init(struct evolver_events *events, EvolverOptions *options,
+			  size_t neq, ErrorMsg error_message);
+  int evolver_events_free(struct evolver_events *events);
+  int evolver_events_locate(struct evolver_events *events, EvolverOptions *options,
+			    double t_left, double t_right,
+			    int (*interp)(double t, double *y, void *interp_data),
+			    void *interp_data, void * parameters_and_workspace_for_derivs,
+			    int *stop, ErrorMsg error_message);
+  int evolver_checkpoint_due(EvolverOptions *options, int steps, int *last_checkpoint);
+  int evolver_checkpoint_open(EvolverOptions *options, int evolver, size_t neq,
+			      int restore, FILE **file, ErrorMsg error_message);
+  int evolver_checkpoint_io(FILE *file, void *ptr, size_t size, size_t count,
+			    int restore, ErrorMsg error_message);
+  int evolver_checkpoint_close(EvolverOptions *options, FILE *file, int restore,
+			       void * parameters_and_workspace_for_derivs,
+			       ErrorMsg error_message);
   int numjac(int (*derivs)(double x,double * y,double * dy,void * parameters_and_workspace,ErrorMsg error_message),
 	     double t, double *y, double *fval, MultiMatrix *J, void* numjac_workspace,
 	     double thresh, size_t neq, int *nfe,
 	     void * parameters_and_workspace_for_derivs, ErrorMsg error_message);
+  int evolver_sparsity_pattern(int (*derivs)(double x,double * y,double * dy,void * parameters_and_workspace,ErrorMsg error_message),
+			       void * parameters_and_workspace_for_derivs,
+			       double *t_sample, int samples, double *y0, size_t neq,
+			       double thresh, int pad, unsigned int seed,
+			       int **Ap, int **Ai, ErrorMsg error_message);
+  double evolver_clock(void);
+  double evolver_peak_memory(void);
+  int evolver_progress_start(EvolverOptions *options, double t, double tfinal, double *y);
+  int evolver_progress(EvolverOptions *options, double t, double tfinal, double h,
+		       int order, double *y, int force);
+  int evolver_timing_report(EvolverOptions *options, double total,
+			    int extra, char **extra_name, double *extra_time,
+			    int *extra_calls, char *filename, ErrorMsg error_message);
 
 
 
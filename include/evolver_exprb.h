@@ -0,0 +1,64 @@
+#ifndef __EXPRB__
+#define __EXPRB__
+#include "common.h"
+#include "evolver_common.h"
+#include "evolver_radau5.h"
+#include "evolver_rosw.h"
+#include "linalg_wrapper_dense.h"
+/**************************************************************/
+
+#define _EXPRB_KRYLOV_MAX_ 30 /** Largest Krylov subspace of a phi-function */
+#define _EXPRB_PHI_MAX_ 4     /** phi_0..phi_3, and phi_4 for the error estimate */
+
+/** Workspace of the Krylov approximation of phi_k(h J) b. */
+struct exprb_krylov{
+  size_t neq;
+  double *V;      //Arnoldi basis, _EXPRB_KRYLOV_MAX_+1 vectors of neq
+  double *H;      //Hessenberg matrix, column-major with leading dimension _EXPRB_KRYLOV_MAX_+1
+  double *A;      //Augmented matrix and its exponential, and work space for expm
+  double *work;
+  int *ipiv;
+  int vectors;    //Krylov vectors built, summed over all calls
+  int first[_EXPRB_PHI_MAX_]; //First dimension tried for phi_k, from the last call
+  int largest;    //Largest dimension of the current step
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int evolver_exprb(int (*derivs)(double x,double * y,double * dy,
+				  void * parameters_and_workspace, ErrorMsg error_message),
+		    void * parameters_and_workspace_for_derivs,
+		    double t0,
+		    double tfinal,
+		    double * y_inout,
+		    size_t neq,
+		    EvolverOptions *options,
+		    ErrorMsg error_message);
+  int exprb_matvec(MultiMatrix *J,
+		   double *x,
+		   double *y);
+  int exprb_phi(MultiMatrix *J,
+		double h,
+		int k,
+		double *b,
+		double *phib,
+		double tol,
+		struct exprb_krylov *kry,
+		int *converged);
+  int exprb_expm(double *A,
+		 int n,
+		 double *work,
+		 int *ipiv);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**************************************************************/
+
+#endif
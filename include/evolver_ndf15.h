@@ -4,6 +4,58 @@
 #include "evolver_common.h"
 /**************************************************************/
 
+/** Start of a run, kept for options->WarmStart: the first Jacobian that
+    the run computed, and the size of its first accepted step. */
+struct ndf15_warm_start{
+  size_t nvals;  /** Values in Jval, 0 if none */
+  double *Jval;
+  double absh;   /** 0 if no step was accepted */
+};
+
+/** Storage for evolver_ndf15 which can be reused by consecutive integrations
+    of systems with the same size, pattern and linalg wrapper. */
+struct ndf15_context{
+  size_t neq;
+  int use_sparse;
+  void *buffer; /** Work vectors and the backward differences. */
+  MultiMatrix J, A, RHS, DEL;
+  double *Jval, *Aval;
+  void *linalg_workspace_A, *nj_ws;
+  int (*linalg_initialise)(MultiMatrix *, EvolverOptions *, void **, ErrorMsg);
+  int (*linalg_finalise)(void *, ErrorMsg);
+  int runs; /** Number of integrations done with the context. */
+  struct ndf15_warm_start warm; /** Start of the last run */
+};
+
+/** A step history written by evolver_ndf15 with options->HistoryFile.
+    The steps are indexed by ndf15_history_open, and the record of the
+    step that covers the requested t is read by ndf15_history_eval. */
+struct ndf15_history{
+  FILE *file;
+  int n;          /** Stored components */
+  int *components;/** Their indices in y, from 0 */
+  double t0;
+  int steps;
+  double *tnew;   /** End of each step */
+  double *h;      /** Signed step size */
+  int *k;         /** Order */
+  long *offset;   /** Offset of y and dif of each step in the file */
+  int current;    /** Step in ynew and dif, -1 if none */
+  double *ynew;   /** From 1, as in evolver_ndf15 */
+  double **dif;
+  int *index;
+};
+
+/** The dense output of an accepted step, for evolver_events_locate. */
+struct ndf15_dense{
+  double tnew;
+  double h;
+  double *ynew;   /** From 1, as in evolver_ndf15 */
+  double **dif;
+  int k;
+  int *index;     /** All _TRUE_ */
+  size_t neq;
+};
 
 /**
  * Boilerplate for C++
@@ -14,8 +66,25 @@ extern "C" {
   int interp_from_dif(double tinterp,double tnew,double *ynew,double h,double **dif,int k, double *yinterp,
 		      double *ypinterp, double *yppinterp, int* index, size_t neq, int output);
   int update_linear_system_ndf15(MultiMatrix *J, MultiMatrix *A, double hinvGak);
+  int ndf15_jacobian_product(MultiMatrix *J, double *x, double *Jx);
+  int ndf15_jacobian_secant(MultiMatrix *J, double *s, double *d, double *work);
+  int ndf15_tangent_output(double tinterp, double tnew, double *vnew, double h, double **difv,
+			   int k, int *index, size_t neq, double *tangent_output);
+  int ndf15_event_interp(double t, double *y, void *dense);
+  double ndf15_tangent_dot(double *x, double *y, double *weight, size_t neq);
+  int ndf15_tangent_orthonormalise(double *v, double **difv, size_t neq, int tangents,
+				   double *weight, double *norm0, double *growth);
   int adjust_stepsize(double **dif, double abshdivabshlast, size_t neq,int k);
   void eqvec(double *datavec,double *emptyvec, int n);  
+  void ndf15_predict(double **dif, double *y, double *G, double invGak, int k, size_t neq,
+		     double *psi, double *pred, double *ynew);
+  double ndf15_weights(double *y, double *ynew, double threshold, double *invwt,
+		       double *difkp1, size_t neq);
+  void ndf15_newton_rhs(double *psi, double *difkp1, double *f0, double hinvGak,
+			double *rhs, size_t neq);
+  double ndf15_newton_update(double *del, double *invwt, double *pred, double *difkp1,
+			     double *ynew, size_t neq);
+  void ndf15_dif_update(double **dif, double *difkp1, int k, size_t neq);
   int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 				  void * parameters_and_workspace, ErrorMsg error_message),
 		    void * parameters_and_workspace_for_derivs,
@@ -25,6 +94,43 @@ extern "C" {
 		    size_t neq, 
 		    EvolverOptions *options,
 		    ErrorMsg error_message);
+  int evolver_ndf15_context(int (*derivs)(double x,double * y,double * dy,
+					  void * parameters_and_workspace, ErrorMsg error_message),
+			    void * parameters_and_workspace_for_derivs,
+			    double t_ini,
+			    double t_final,
+			    double * y_inout, 
+			    size_t neq, 
+			    EvolverOptions *options,
+			    struct ndf15_context *context,
+			    ErrorMsg error_message);
+  int ndf15_context_create(struct ndf15_context **context,
+			   size_t neq,
+			   EvolverOptions *options,
+			   ErrorMsg error_message);
+  int ndf15_context_reset(struct ndf15_context *context,
+			  EvolverOptions *options,
+			  void * parameters_and_workspace_for_derivs,
+			  ErrorMsg error_message);
+  int ndf15_context_destroy(struct ndf15_context *context,
+			    ErrorMsg error_message);
+  int ndf15_warm_start_copy(struct ndf15_warm_start *to,
+			    struct ndf15_warm_start *from,
+			    ErrorMsg error_message);
+  int ndf15_warm_start_free(struct ndf15_warm_start *warm);
+  int ndf15_history_create(FILE **file, char *filename, int *index, size_t neq,
+			   double t0, ErrorMsg error_message);
+  int ndf15_history_step(FILE *file, double tnew, double h, int k, double *ynew,
+			 double **dif, int *index, size_t neq, ErrorMsg error_message);
+  int ndf15_history_open(struct ndf15_history *history, char *filename,
+			 ErrorMsg error_message);
+  int ndf15_history_eval(struct ndf15_history *history, double t, double *y,
+			 double *dy, ErrorMsg error_message);
+  int ndf15_history_close(struct ndf15_history *history);
+  int ndf15_checkpoint(FILE *file, int restore, struct ndf15_context *context,
+		       EvolverOptions *options, double *dstate, int *istate, double *y,
+		       double *f0, double **dif, double *v, double **difv,
+		       ErrorMsg error_message);
 
 #ifdef __cplusplus
 }
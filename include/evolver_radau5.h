@@ -5,6 +5,39 @@
 #include "evolver_common.h"
 /**************************************************************/
 
+/** Storage for evolver_radau5 which can be reused by consecutive integrations
+    of systems with the same size, pattern and linalg wrapper. */
+struct radau5_context{
+  size_t neq;
+  int use_sparse;
+  double *W, *dW_buf, *Y0pZ, *Fi, *Zlast, *rhs_buf, *err_buf, *diff_buf;
+  double *vec_buf; /** xtemp, ytemp, ynew, f0, ylast, ftmp, dfdt and delta_w. */
+  double complex *rhs_cx_buf, *delta_w_cx_buf;
+  MultiMatrix J, A, Z, RHS, RHS_CX, DIFF, DW, DW_CX, ERR;
+  double *Jval, *Aval;
+  double complex *Zval;
+  /** With options->ComplexAsReal, Z is instead the real matrix of 2neq
+      equations [alpha/h-J -beta/h; beta/h alpha/h-J], see
+      update_linear_system_radau5_real, and the complex right hand sides
+      are solved through RHS_RE and DW_RE. */
+  int real_form;
+  int *Zr_Ai, *Zr_Ap;
+  double *Zr_val, *rhs_re_buf, *dw_re_buf;
+  MultiMatrix RHS_RE, DW_RE;
+  void *linalg_workspace_A, *linalg_workspace_Z, *nj_ws;
+  int (*linalg_initialise)(MultiMatrix *, EvolverOptions *, void **, ErrorMsg);
+  int (*linalg_finalise)(void *, ErrorMsg);
+  int runs; /** Number of integrations done with the context. */
+};
+
+/** The dense output of an accepted step, for evolver_events_locate. */
+struct radau5_dense{
+  double t;
+  double h;
+  double *y0;
+  double *Z;
+  size_t neq;
+};
 
 /**
  * Boilerplate for C++
@@ -21,10 +54,45 @@ extern "C" {
 		     size_t neq, 
 		     EvolverOptions *options,
 		     ErrorMsg error_message);
+  int evolver_radau5_context(int (*derivs)(double x,double * y,double * dy,
+					   void * parameters_and_workspace, ErrorMsg error_message),
+			     void * parameters_and_workspace_for_derivs,
+			     double t0,
+			     double tfinal,
+			     double * y_inout, 
+			     size_t neq, 
+			     EvolverOptions *options,
+			     struct radau5_context *context,
+			     ErrorMsg error_message);
+  int radau5_context_create(struct radau5_context **context,
+			    size_t neq,
+			    EvolverOptions *options,
+			    ErrorMsg error_message);
+  int radau5_context_reset(struct radau5_context *context,
+			   EvolverOptions *options,
+			   void * parameters_and_workspace_for_derivs,
+			   ErrorMsg error_message);
+  int radau5_context_destroy(struct radau5_context *context,
+			     ErrorMsg error_message);
+  int radau5_checkpoint(FILE *file, int restore, struct radau5_context *context,
+			EvolverOptions *options, double *dstate, int *istate, double *y0,
+			double *f0, double *ylast, ErrorMsg error_message);
+  int radau5_factorise(struct radau5_context *context,
+		       double h,
+		       int flag,
+		       EvolverOptions *options,
+		       ErrorMsg error_message);
+  int radau5_solve_stages(struct radau5_context *context,
+			  EvolverOptions *options,
+			  ErrorMsg error_message);
   int update_linear_system_radau5(MultiMatrix *J,
 				  MultiMatrix *A,
 				  MultiMatrix *Z,
 				  double hnew);
+  int update_linear_system_radau5_real(MultiMatrix *J,
+				       MultiMatrix *A,
+				       MultiMatrix *Z,
+				       double hnew);
   int transform_C_tensor_I(double *C, 
 			   int s,
 			   double *vec_in,
@@ -39,6 +107,7 @@ extern "C" {
 			  double *Fi,
 			  int *interpidx,
 			  size_t neq);
+  int radau5_event_interp(double t, double *y, void *dense);
   double norm_inf(double *y, 
 		  double *err_y, 
 		  double threshold,
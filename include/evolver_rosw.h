@@ -0,0 +1,46 @@
+#ifndef __ROSW__
+#define __ROSW__
+#include "common.h"
+#include "evolver_common.h"
+#include "evolver_radau5.h"
+/**************************************************************/
+
+#define _ROSW_STAGES_ 4 /** Stages of ROS34PW2 */
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int evolver_rosw(int (*derivs)(double x,double * y,double * dy,
+				 void * parameters_and_workspace, ErrorMsg error_message),
+		   void * parameters_and_workspace_for_derivs,
+		   double t0,
+		   double tfinal,
+		   double * y_inout,
+		   size_t neq,
+		   EvolverOptions *options,
+		   ErrorMsg error_message);
+  int update_linear_system_rosw(MultiMatrix *J,
+				MultiMatrix *A,
+				double diagonal);
+  int dense_output_rosw(double tinterp,
+			double *yi,
+			double t0,
+			double h,
+			double *y0,
+			double *f0,
+			double *y1,
+			double *f1,
+			int *interpidx,
+			size_t neq);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**************************************************************/
+
+#endif
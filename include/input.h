@@ -6,6 +6,7 @@
 #include "common.h"
 #include "parser.h"
 #include "qke_equations.h"
+#include "background.h"
 
 /* macro for reading parameter values with routines from the parser */
 #define lasagna_read_double(name,destination)				\
@@ -143,6 +144,82 @@ extern "C" {
 		 ErrorMsg errmsg
 		 );
 
+  int input_init_shared(
+			struct file_content * pfc,
+			qke_param *pqke,
+			const struct background_structure *pbs,
+			ErrorMsg errmsg
+			);
+
+  int input_sweep_init(
+		       int argc, 
+		       char **argv,
+		       struct file_content * pfc,
+		       struct sweep_content * psw,
+		       struct background_structure *pbs,
+		       int *threads,
+		       int *nproc,
+		       int *pin,
+		       ErrorMsg errmsg
+		       );
+
+  int input_sweep_run(
+		      const struct file_content * pfc,
+		      const struct sweep_content * psw,
+		      int run,
+		      const struct background_structure *pbs,
+		      qke_param *pqke,
+		      ErrorMsg errmsg
+		      );
+
+  int input_sweep_log_open(
+			   struct file_content * pfc,
+			   struct sweep_content * psw,
+			   FILE **log_file,
+			   ErrorMsg errmsg
+			   );
+
+  int input_result_key(
+		       qke_param *pqke,
+		       char *key
+		       );
+
+  int input_result_cache_read(
+			      qke_param *pqke,
+			      char *key,
+			      int *steps,
+			      double *T_end,
+			      double *L_end,
+			      int *diverged
+			      );
+
+  int input_result_cache_write(
+			       qke_param *pqke,
+			       char *key,
+			       int steps,
+			       double T_end,
+			       double L_end,
+			       int diverged,
+			       double wall_time
+			       );
+
+  int input_copy_file(
+		      char *from,
+		      char *to
+		      );
+
+  int input_sweep_log_write(
+			    FILE *log_file,
+			    struct sweep_content * psw,
+			    int run,
+			    int status,
+			    int budget_exceeded,
+			    int steps,
+			    double T_end,
+			    double L_end,
+			    double wall_time
+			    );
+
   int input_default_params(
 			   qke_param * pqke
 			   );
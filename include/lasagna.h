@@ -9,8 +9,14 @@
 #include "evolver_ndf15.h"
 #include "evolver_rk45.h"
 #include "evolver_radau5.h"
+#include "evolver_rosw.h"
+#include "evolver_exprb.h"
 #include "background.h"
 #include "qke_equations.h"
 #include "input.h"
+#include "sweep.h"
+#ifdef _CUDA
+#include "linalg_wrapper_cuda.h"
+#endif
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef __LASAGNA_BENCH__
+#define __LASAGNA_BENCH__
+
+#include "common.h"
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "evolver_common.h"
+#include "background.h"
+#include "qke_equations.h"
+#include "input.h"
+#include "sweep.h"
+
+#define _BENCH_OK_ 0      /** Status of a case: reached T_final */
+#define _BENCH_FAILED_ 1  /** lasagna_run failed */
+#define _BENCH_BUDGET_ 2  /** Stopped by run_time_budget */
+#define _BENCH_SKIPPED_ 3 /** Not run, see bench_dense_max and use_superlu */
+#define _BENCH_CRASHED_ 4 /** The process of the case died */
+
+/** One line of the benchmark report. The counts are EvolverOptions.Stats
+    of the run, the times its phases, see evolver_timed. */
+struct bench_row{
+  int evolver;
+  int wrapper;
+  int vres;
+  int status;
+  int steps;
+  int rhs;        //Stats[2]
+  int jacobians;  //Stats[3]
+  int lu;         //Stats[4]
+  double time[_EVOLVER_TIMERS_];
+  double total;   //Wall time of lasagna_run, seconds
+  double peak;    //Peak resident memory of the case, MB
+  double L_end;   //L at the end of the run
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int lasagna_bench_set(struct file_content *pfc,
+			char *name,
+			int value,
+			ErrorMsg error_message);
+  int lasagna_bench_case(struct lasagna_config *config,
+			 struct bench_row *row,
+			 ErrorMsg error_message);
+  int lasagna_bench_write(FILE *report,
+			  struct bench_row *row);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,12 +0,0 @@
-#ifndef __LASAGNA__
-#define __LASAGNA__
-
-#include "common.h"
-#ifdef _OPENMP
-#include "omp.h"
-#endif
-#include "evolver_ndf15.h"
-#include "evolver_rk45.h"
-#include "background.h"
-#include "qke_equations.h"
-#endif
@@ -0,0 +1,35 @@
+#ifndef __LASAGNA_MPI__
+#define __LASAGNA_MPI__
+
+#include "common.h"
+#include <mpi.h>
+#include "background.h"
+#include "qke_equations.h"
+#include "input.h"
+#include "sweep.h"
+
+#define _MPI_TAG_RESULT_ 1 /** Worker to rank 0: summary of the last run */
+#define _MPI_TAG_RUN_ 2    /** Rank 0 to worker: next run, -1 when done */
+#define _MPI_SUMMARY_ 8    /** run, status, budget_exceeded, steps, T_end, L_end, wall_time,
+			       diverged */
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int lasagna_mpi_failed(int run,
+			 int rank,
+			 int steps,
+			 double T_end);
+  int lasagna_mpi_master(struct lasagna_config *config,
+			 int size,
+			 ErrorMsg error_message);
+  int lasagna_mpi_worker(struct lasagna_config *config,
+			 ErrorMsg error_message);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,7 @@
 #include "common.h"
 #include <complex.h>
 #include "evolver_common.h"
+#include "sparse.h"
 typedef int int_t; /* default */
 #include "supermatrix.h"
 #include "slu_mt_util.h"
@@ -21,8 +22,16 @@ typedef struct {
   size_t neq;
   int *perm_r;
   int *perm_c;
+  int Cores;
+  int Verbose;
+  int *Stats;       /* EvolverOptions.Stats */
+  int Factorised;   /* Has perm_r been set by a factorisation? */
+  int Memory[3];    /* Storage for L values, U values and L subscripts, see sp_ienv */
 } SLU_structure;
 
+/** Set by the patched sp_ienv.c of SuperLUpatch.tar.gz: */
+extern int sp_ienv_memory[3];
+
 
 /**
  * Boilerplate for C++
@@ -44,6 +53,12 @@ extern "C" {
 			   MultiMatrix *X,
 			   void *linalg_workspace,
 			   ErrorMsg error_message);
+  int linalg_solve_many_SuperLU(MultiMatrix *B, 
+				MultiMatrix *X,
+				void *linalg_workspace,
+				ErrorMsg error_message);
+  int linalg_init_SuperLU(SLU_structure *ws, double diag_pivot_thresh);
+  int linalg_gstrf_SuperLU(SLU_structure *ws);
   
 
 #ifdef __cplusplus
@@ -0,0 +1,63 @@
+#ifndef __WRAPPER_BLOCK__ /* allow multiple inclusions */
+#define __WRAPPER_BLOCK__
+
+#include "common.h"
+#include "evolver_common.h"
+#include "linalg_wrapper_dense.h"
+
+/** Matrices that are block diagonal apart from a few border equations,
+    A = [B C; R D] with B = diag(B_0..B_{blocks-1}) after a permutation.
+    The blocks are the options->BlockSize equations listed for each block
+    in options->BlockIndex, and the border is every equation in no block.
+    Each block is factorised on its own, and the border is solved through
+    the Schur complement S = D - R B^{-1} C. Entries of A coupling two
+    different blocks are not used. */
+typedef struct {
+  MultiMatrix *A;  //Pointer to MultiMatrix A
+  int neq;
+  int blocks;      //Number of blocks
+  int size;        //Equations per block
+  int border;      //Equations in no block
+  int nblk;        //blocks*size
+  int *index;      //Equation of each block row, block by block
+  int *border_index; //Equation of each border row
+  int *block_of;   //Block of each equation, -1 on the border
+  int *position;   //Row of each equation in its block, or on the border
+  double *B;       //LU of the blocks, column-major, size*size each
+  int *ipiv;       //Row interchanges of the blocks, size each
+  double *Z;       //B^{-1} C, column-major, size*border for each block
+  double *R;       //Border rows, border x nblk row-major
+  double *S;       //LU of the Schur complement, column-major
+  int *spiv;
+  double *w;       //Block part of a right hand side
+  double *g;       //Border part
+  int threads;
+} BL_structure;
+
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int linalg_initialise_block(MultiMatrix *A,
+			      EvolverOptions *options,
+			      void **linalg_workspace,
+			      ErrorMsg error_message);
+  int linalg_finalise_block(void *linalg_workspace,
+			    ErrorMsg error_message);
+  int linalg_factorise_block(void *linalg_workspace,
+			     int has_changed_significantly,
+			     ErrorMsg error_message);
+  int linalg_solve_block(MultiMatrix *B,
+			 MultiMatrix *X,
+			 void *linalg_workspace,
+			 ErrorMsg error_message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __WRAPPER_CUDA__ /* allow multiple inclusions */
+#define __WRAPPER_CUDA__
+
+#include "common.h"
+#include <complex.h>
+#include <pthread.h>
+#include "evolver_common.h"
+#include "sparse.h"
+#include "linalg_wrapper_sparse.h"
+#include <cuda_runtime.h>
+#include <cusolverRf.h>
+
+#define _CUDA_REFACTOR_ 1 /** Request of a member: refactorise its matrix */
+#define _CUDA_SCRATCH_ 2  /** ... with a new pivot sequence from a host LU */
+#define _CUDA_SOLVE_ 4    /** ... solve with its right hand side */
+
+/** Iteration matrices of the runs of a sweep, factorised and solved on the
+    GPU by cusolverRf in batches. The members share the pattern, the
+    orderings and the pattern of L and U, which are set by a host LU of one
+    of them, and only their values and right hand sides are moved to and
+    from the device. A member posts its request and waits. The first waiting
+    member which finds the batch idle does the requests pending at that
+    moment in one batched call, so the runs are batched whenever they
+    factorise at the same time. A single run is a batch of one. */
+struct linalg_cuda_batch{
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  int capacity;         //Members at most
+  int busy;             //Is a member doing a batch?
+  int n;                //Pattern of the members, set by the first
+  int nnz;
+  int *Ap;
+  int *Ai;
+  int *Rp;              //The pattern in CSR, as cusolverRf wants it
+  int *Rj;
+  int *map;             //Ax index of each CSR entry
+  int *taken;           //taken[k]: is slot k used by a member?
+  int *request;         //Pending _CUDA_ flags of each slot
+  int *running;         //The requests done by the current batch
+  int *status;          //_SUCCESS_ or _FAILURE_ of the last request of each slot
+  int *new_pivots;      //Did the last refactorisation of the slot use a new host LU?
+  int *invalid;         //Zero pivot in the factors of the slot, new host LU needed
+  int *has_values;      //Have the values of the slot been set?
+  double **Ax;          //Values of each member, CSC
+  double **values;      //Values of each member at its last refactorisation, CSR
+  double **x;           //Right hand side and solution of each member
+  int setup;            //Has cusolverRfBatchSetupHost been called?
+  sp_num *N;            //Host LU for the pivot sequence
+  sp_mat *A;            //Its matrix, in the values of one of the slots
+  cusolverRfHandle_t handle;
+  int *d_Rp;            //Device copies of Rp, Rj and the permutations
+  int *d_Rj;
+  int *d_P;
+  int *d_Q;
+  double **d_values;    //Host array of device values, one per slot
+  double **d_x;         //Host array of device right hand sides
+  double *d_work;       //2*capacity*n, for cusolverRfBatchSolve
+  int *position;        //Zero pivots of each slot
+  int verbose;
+  ErrorMsg message;     //Error of the last failed batch
+};
+
+typedef struct {
+  struct linalg_cuda_batch *batch;
+  int own_batch;        //Is batch private, and freed with the workspace?
+  int slot;
+  int *Stats;
+  void *complex_ws;     //Sparse wrapper workspace for complex matrices
+} CUDA_structure;
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int linalg_initialise_cuda(MultiMatrix *A,
+			     EvolverOptions *options,
+			     void **linalg_workspace,
+			     ErrorMsg error_message);
+  int linalg_finalise_cuda(void *linalg_workspace,
+			   ErrorMsg error_message);
+  int linalg_factorise_cuda(void *linalg_workspace,
+			    int has_changed_significantly,
+			    ErrorMsg error_message);
+  int linalg_solve_cuda(MultiMatrix *B,
+			MultiMatrix *X,
+			void *linalg_workspace,
+			ErrorMsg error_message);
+  int linalg_solve_many_cuda(MultiMatrix *B,
+			     MultiMatrix *X,
+			     void *linalg_workspace,
+			     ErrorMsg error_message);
+  int linalg_cuda_batch_alloc(struct linalg_cuda_batch **batch,
+			      int capacity,
+			      ErrorMsg error_message);
+  int linalg_cuda_batch_free(struct linalg_cuda_batch *batch);
+  int linalg_cuda_batch_pattern(struct linalg_cuda_batch *batch,
+				SCCformat *Store,
+				int n,
+				ErrorMsg error_message);
+  int linalg_cuda_batch_join(struct linalg_cuda_batch *batch,
+			     SCCformat *Store,
+			     int n,
+			     int *slot,
+			     ErrorMsg error_message);
+  int linalg_cuda_batch_request(struct linalg_cuda_batch *batch,
+				int slot,
+				int request,
+				ErrorMsg error_message);
+  int linalg_cuda_batch_run(struct linalg_cuda_batch *batch,
+			    int *requests,
+			    ErrorMsg error_message);
+  int linalg_cuda_setup(struct linalg_cuda_batch *batch,
+			int slot,
+			ErrorMsg error_message);
+  int linalg_cuda_csc_to_csr(int n, int *Cp, int *Ci, double *Cx,
+			     int *Rp, int *Rj, double *Rx, int *map, int *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __WRAPPER_DENSE__ /* allow multiple inclusions */
+#define __WRAPPER_DENSE__
+
+#include "common.h"
+#include <complex.h>
+#include "evolver_common.h"
+
+/* Panel width of the blocked LU and row tile of the update: */
+#define _DENSE_NB_ 64
+#define _DENSE_MC_ 256
+
+typedef struct {
+  MultiMatrix *A;  //Pointer to MultiMatrix A
+  void *LU;        //LU decomposition, contiguous and column-major
+  int *ipiv;       //Row interchanges, row j was swapped with ipiv[j]
+  DataType Dtype;
+  int neq;
+} DN_structure;
+
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int linalg_initialise_dense(MultiMatrix *A, 
+			      EvolverOptions *options,
+			      void **linalg_workspace,
+			      ErrorMsg error_message);
+  int linalg_finalise_dense(void *linalg_workspace,
+			    ErrorMsg error_message);
+  int linalg_factorise_dense(void *linalg_workspace,
+			     int has_changed_significantly,
+			     ErrorMsg error_message);
+  int linalg_solve_dense(MultiMatrix *B, 
+			 MultiMatrix *X,
+			 void *linalg_workspace,
+			 ErrorMsg error_message);
+  int linalg_solve_many_dense(MultiMatrix *B, 
+			      MultiMatrix *X,
+			      void *linalg_workspace,
+			      ErrorMsg error_message);
+  
+  void dense_gemm_update(int m, int n, int k, double *A, int lda, 
+			 double *B, int ldb, double *C, int ldc);
+  void dense_gemm_update_cx(int m, int n, int k, double complex *A, int lda, 
+			    double complex *B, int ldb, double complex *C, int ldc);
+  int dense_lu(double *A, int n, int *ipiv);
+  int dense_lu_cx(double complex *A, int n, int *ipiv);
+  int dense_lu_solve(double *LU, int n, int *ipiv, double *X, int nrhs);
+  int dense_lu_solve_cx(double complex *LU, int n, int *ipiv, double complex *X, int nrhs);
+
+#ifdef _LAPACK
+  void dgetrf_(int *m, int *n, double *a, int *lda, int *ipiv, int *info);
+  void dgetrs_(char *trans, int *n, int *nrhs, double *a, int *lda, 
+	       int *ipiv, double *b, int *ldb, int *info);
+  void zgetrf_(int *m, int *n, double complex *a, int *lda, int *ipiv, int *info);
+  void zgetrs_(char *trans, int *n, int *nrhs, double complex *a, int *lda, 
+	       int *ipiv, double complex *b, int *ldb, int *info);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __WRAPPER_GMRES__ /* allow multiple inclusions */
+#define __WRAPPER_GMRES__
+#include "common.h"
+#include <complex.h>
+#include "evolver_common.h"
+#include "sparse.h"
+
+typedef struct {
+  sp_ilu *Preconditioner;
+  void *A;
+  void *Work;
+  DataType Dtype;
+  int FillLevel;    //k in ILU(k)
+  int Restart;      //m in GMRES(m)
+  int MaxIter;      //Iterations per solve
+  double Tolerance; //Relative residual
+  int Factorised;   //_FALSE_ if the last ILU broke down
+  int Solves;
+  int Unconverged;
+  long Iterations;
+  int Verbose;
+} GM_structure;
+
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int linalg_initialise_gmres(MultiMatrix *A,
+			      EvolverOptions *options,
+			      void **linalg_workspace,
+			      ErrorMsg error_message);
+  int linalg_finalise_gmres(void *linalg_workspace,
+			    ErrorMsg error_message);
+  int linalg_factorise_gmres(void *linalg_workspace,
+			     int has_changed_significantly,
+			     ErrorMsg error_message);
+  int linalg_solve_gmres(MultiMatrix *B, 
+			 MultiMatrix *X,
+			 void *linalg_workspace,
+			 ErrorMsg error_message);
+  
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,6 +13,28 @@ typedef struct {
   int Factorised;
   int RefactorCount;
   int RefactorMax;
+  double RefactorPivotTolerance; //Smallest 1/max|L_ij| accepted by sp_refactor
+  double RefactorGrowth; //Largest pivot growth accepted, relative to GrowthRef
+  double GrowthRef; //max|U_ij|/max|A_ij| after the last sp_ludcmp
+  int *Stats;       //EvolverOptions.Stats, for the refactor/decompose counts
+  void *ManyWork;   //Interleaved right hand sides for linalg_solve_many_sparse
+  size_t ManyWorkSize;
+  sp_lev *Levels;   //Level sets for parallel solves, NULL if serial
+  int Cores;
+  int UseLevels;
+  int Verbose;
+  unsigned int PatternHash; //sp_pattern_hash of A
+  char CacheFile[_FILENAMESIZE_+32]; //Symbolic-analysis cache, "" if not used
+  int CachedPivots; //Next factorisation tries the pivot sequence from CacheFile
+  int WriteCache;   //Write CacheFile after the next sp_ludcmp
+  int RefineMax;    //Refinement steps of the mixed precision solves, 0 if not used
+  double RefineTol; //Refinement stops when max|dx_i| <= RefineTol*max|x_i|
+  void *Lsgl;       //Single precision values of L and U, on the pattern in
+  void *Usgl;       //SparseNumerical
+  size_t SglSize;   //Entries allocated in Lsgl and Usgl
+  void *RefineWork; //Residual and correction of the refinement
+  sp_split_cx *Split; //Complex factors with split real and imaginary parts, NULL if not used
+  int LowMemory;    //Compact factors, and neither Levels nor Split, see EvolverOptions
 } SP_structure;
 
 
@@ -32,10 +54,17 @@ extern "C" {
   int linalg_factorise_sparse(void *linalg_workspace,
 			      int has_changed_significantly,
 			      ErrorMsg error_message);
+  int linalg_levels_sparse(SP_structure *ws, ErrorMsg error_message);
+  int linalg_demote_sparse(SP_structure *ws, ErrorMsg error_message);
+  int linalg_refine_sparse(SP_structure *ws, void *b, void *x);
   int linalg_solve_sparse(MultiMatrix *B, 
 			  MultiMatrix *X,
 			  void *linalg_workspace,
 			  ErrorMsg error_message);
+  int linalg_solve_many_sparse(MultiMatrix *B, 
+			       MultiMatrix *X,
+			       void *linalg_workspace,
+			       ErrorMsg error_message);
   
 
 #ifdef __cplusplus
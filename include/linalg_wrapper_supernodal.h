@@ -0,0 +1,48 @@
+#ifndef __WRAPPER_SUPERNODAL__ /* allow multiple inclusions */
+#define __WRAPPER_SUPERNODAL__
+#include "common.h"
+#include <complex.h>
+#include "evolver_common.h"
+#include "sparse.h"
+
+typedef struct {
+  void *SparseNumerical;
+  sp_super *Supernodal;
+  void *A;
+  DataType Dtype;
+  double PivotTolerance;
+  int MaxSupernode;
+  double SupernodeRelax;
+  int Factorised;
+  int RefactorCount;
+  int Verbose;
+} SN_structure;
+
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int linalg_initialise_supernodal(MultiMatrix *A,
+				   EvolverOptions *options,
+				   void **linalg_workspace,
+				   ErrorMsg error_message);
+  int linalg_finalise_supernodal(void *linalg_workspace,
+				 ErrorMsg error_message);
+  int linalg_factorise_supernodal(void *linalg_workspace,
+				  int has_changed_significantly,
+				  ErrorMsg error_message);
+  int linalg_solve_supernodal(MultiMatrix *B, 
+			      MultiMatrix *X,
+			      void *linalg_workspace,
+			      ErrorMsg error_message);
+  
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
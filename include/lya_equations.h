@@ -7,14 +7,24 @@
 #include "background.h"
 #include "qke_equations.h"
 #include "mat_io.h"
+#include "mat_writer.h"
 #include "multimatrix.h"
 
 typedef struct lya_param_structure{
   FILE *tmp;
   char output_filename[_FILENAMESIZE_]; //Where to write output.
+  char symbolic_cache[_FILENAMESIZE_]; //Directory for cached sparse LU analysis, "" if none.
   int evolver;   //Which time integrator to use
   LinAlgWrapper LinearAlgebraWrapper; //Wrapper for LU-decompositions
   int nproc;     //Number of cores available.
+  int rhs_threads; //Threads used inside one lya_derivs call, 1 is serial.
+  int mixed_precision; //Refinement steps of single precision sparse solves, 0 is off.
+  int low_memory; //Sparse factors sized for the smallest peak memory?
+  double progress_interval; //Seconds between updates of the progress file, 0 for none.
+  int output_buffer; //Slices buffered for the output thread, 0 writes in the evolver thread.
+  int output_mmap; //Store the output directly in the mapped output file?
+  int output_compress; //zlib level for miCOMPRESSED output, 0 for none.
+  int output_chunk; //Output points per block of a growable output file, 0 for one block.
   int verbose;   //Level of output
   int fixed_grid;//Fixed grid?
   int Nres;      //Number of resinances
@@ -22,6 +32,11 @@ typedef struct lya_param_structure{
   int Tres;      //Entries in time/Temperature vector.
   int is_electron; //True if we have electron neutrino, False otherwise.
   int guess_exists;
+  int warm_start;    //Start the parametrisation Newton solve from the last solution?
+  int sparse_newton; //Solve the parametrisation with Newton_sparse instead of Newton?
+  double T_guess;    //Temperature of the last parametrisation solve
+  int param_cache_current; //Cache entry the grid was taken from, -1 if none
+  int param_cache_next;    //Cache entry to overwrite next
   double rtol;   //Relative tolerance of integrator
   double abstol; //Absolute tolerance of integrator
   double alpha;  //Sampling density aound resonances (0=most dense, 1=uniform)
@@ -29,25 +44,12 @@ typedef struct lya_param_structure{
   double T_initial; //Initial temperature
   double T_final; //Final temperature
   double *Tvec;  //Temperature vector (Tvec[Tres])
-  double *xi;    //Resonances in v-space.
-  double *ui;    //Resonances in u-space, ui[Nres]
-  double *vi;
-  double *duidT; //Partial derivative of resonances in u-space.
-  double *dvidT; //Partial derivative of resonances in v-space.
-  double *duidx; //Partial derivative of u wrt x
-  double *dxidT; //Partial derivative of resonances in x space.
-  double *a;     //a and b parameters controlling the parametrisation.
-  double b;
-  double *y_0;   //Workspace for lya_derivs, for Newton method.
-  double *maxstep;
+  qke_scratch ws; //Arrays written by derivs, private to a copy of the workspace
+  double b;      //b parameter controlling the parametrisation, see ws.a
   int vres;      //Number of momentum bins in v-space. (Resolution)
   double v_left;    //Boundaries of v, usually just 0 and 1.
   double v_right;
-  double *v_grid;  //v_grid[vres]
-  double *u_grid;
-  double *x_grid;
-  double *dvdu_grid;
-  double *dudT_grid;
+  qke_advection adv; //dudT*dvdu*drho/dv, set up by init_lya_param
   double n_plus;
   double xmin;     //minimum value of x=p/T considered
   double xmax;     //Maximum value of x=p/T considered
@@ -74,9 +76,6 @@ typedef struct lya_param_structure{
   double L_final; //Final value of abs(L)
   double trigger_dLdT_over_L;
   double C_alpha;
-  double **mat;      //(Nres+2)x(Nres+2) matrix used in more than one occasion for solving linear systems.
-  double *vv;        //Workarray for LU decomposition.
-  int *indx;         //Permutation vector for LU decomposition.
   int *Ai;  //Row indices of jacobian
   int *Ap;  //Column indices of jacobian
   struct background_structure pbs;
@@ -85,6 +84,7 @@ typedef struct lya_param_structure{
   double V1;
   double VL;
   double g_alpha; //1 for muon/tau, 1+4sec²(theta_w)/n_plus for e.
+  mat_writer writer; //Open output file, from lya_init_output
   int Pa_plus_handle; //Position of given matrix in output file
   int Pa_minus_handle; //Position of given matrix in output file
   int Ps_plus_handle; //Position of given matrix in output file
@@ -121,6 +121,13 @@ typedef struct lya_param_structure{
   int v_handle;
   int I_handle;
   MultiMatrix **J_pp;
+  int tangent_linear; //Integrate v in the tangent-linear mode of ndf15 instead of in y?
+  int lyapunov_vectors; //Number of tangents in the tangent-linear mode.
+  int lyapunov_qr;    //Gram-Schmidt of the tangents every lyapunov_qr steps, 0 for never.
+  double *tangent;    //The tangents at the output point from ndf15, L entry scaled as in y
+  double *v_out;      //v with the L entry unscaled, from lya_lyapunov_vector
+  double *tangent_weight; //Weights making the ndf15 inner product that of v_out
+  double *tangent_growth; //log of the norm removed from each tangent by Gram-Schmidt
 } lya_param;
 
 /**
@@ -134,10 +141,15 @@ extern "C" {
   int init_lya_param(lya_param *plya);
   //Free:
   int free_lya_param(lya_param *plya);
+  //Private copies for threaded numjac:
+  int lya_copy_workspace(void *param, void **param_copy, ErrorMsg error_message);
+  int lya_free_workspace(void *param_copy, ErrorMsg error_message);
   //Set or copy initial conditions:
   int lya_initial_conditions(double Ti, double *y, lya_param *plya);
   //Handle binary output:
   int lya_init_output(lya_param *plya);
+  double *lya_lyapunov_vector(double *y, int vector, lya_param *plya);
+  double lya_information_lost(double *y, int vector, lya_param *plya);
   int lya_store_output(double t,
 		       double *y,
 		       double *dy,
@@ -157,6 +169,25 @@ extern "C" {
 		 double *dy, 
 		 void *plya, 
 		 ErrorMsg error_message);
+  int lya_derivs_batch(double T, 
+		       double **y, 
+		       double **dy, 
+		       int m,
+		       void *plya, 
+		       ErrorMsg error_message);
+  int lya_derivs_setup(double T, 
+		       double L, 
+		       lya_param *plya,
+		       double *H,
+		       double *mu_div_T,
+		       ErrorMsg error_message);
+  int lya_derivs_state(double T, 
+		       double *y, 
+		       double *dy, 
+		       double H,
+		       double mu_div_T,
+		       lya_param *plya,
+		       ErrorMsg error_message);
 
   int lya_print_L(double t,
 		  double *y,
@@ -194,6 +225,9 @@ extern "C" {
 				    double *I_rho_ss,
 				    ErrorMsg error_message);
   int lya_get_parametrisation(double T,lya_param *plya, ErrorMsg error_message);
+  int lya_parametrisation_cached(double T, double L, lya_param *plya, ErrorMsg error_message);
+  int lya_param_cache_copy(double *entry, lya_param *plya, int store);
+  int lya_param_cache_clear(lya_param *plya);
   int lya_get_partial_derivatives(double T,
 				  double L,
 				  double dLdT,
@@ -202,6 +236,7 @@ extern "C" {
   int lya_u_of_x(double x, double *u, double *dudx, lya_param *param);
   int lya_x_of_u(double u, double *x, lya_param *param);
   int lya_nonlinear_rhs(double *y, double *Fy, void *param);
+  int lya_nonlinear_rhs_sparse_jac(double *y, double *Jx, void *param);
   int lya_derivs_test_partial(double T, 
 			      double *y, 
 			      double *dy, 
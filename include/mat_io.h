@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include <stdint.h>
+#include <zlib.h>
 
 #define MAT_NO_HANDLE -1
 /** MATLAB array classes: */
@@ -18,6 +19,7 @@
 #define miSINGLE 7
 #define miDOUBLE 9
 #define miMATRIX 14
+#define miCOMPRESSED 15
 #define miCHAR -1 //This is not at matlab storage type.
 
 /** Macro for updating output file: */
@@ -70,9 +72,36 @@ extern "C" {
 		    int *cols,
 		    int *rows,
 		    int *data_type);
+  int mat_read_element(char *filename, 
+		       char *matrix_name, 
+		       void **data_ptr,
+		       int *cols,
+		       int *rows,
+		       int *data_type);
+  int mat_type_byte_size(int data_type);
   int mat_goto_matrix(FILE *mat_file,
+		      char *filename,
 		      char *matrix_name,
 		      int *beginning_of_matrix);
+  int mat_match_matrix(FILE *mat_file,
+		       char *matrix_name,
+		       int start_data_element,
+		       int *matrix_found,
+		       uint32_t *matrix_size);
+  int mat_toc_create(char *filename);
+  int mat_toc_add(char *filename,
+		  char *matrix_name,
+		  int start_data_element,
+		  int data_type,
+		  int rows,
+		  int cols);
+  int mat_toc_lookup(char *filename,
+		     char *matrix_name,
+		     int *beginning_of_matrix);
+  int mat_inflate_element(FILE *mat_file,
+			  int start_data_element,
+			  char *buffer,
+			  size_t bytes);
 
 
   /** Remember that data is stored in subsequent columns. 
@@ -0,0 +1,123 @@
+#ifndef _MAT_WRITER_
+#define _MAT_WRITER_
+
+#include "common.h"
+#include "mat_io.h"
+#include <pthread.h>
+
+#define _MAT_WRITER_FILE_ 0        /** Write the file with fwrite */
+#define _MAT_WRITER_MMAP_ 1        /** Store the slices in the mapped file */
+#define _MAT_WRITER_COMPRESSED_ 2  /** Deflate the matrices into miCOMPRESSED elements */
+#define _MAT_WRITER_CHUNKED_ 3     /** Append the matrices in blocks of columns */
+#define _MAT_WRITER_CHUNK_ 65536   /** Deflate output buffer in bytes */
+
+/** One element of the file, with its deflate stream in the compressed
+    mode. Offsets are in the uncompressed layout made by mat_add_matrix. */
+typedef struct mat_stream_structure{
+  long start;       //Offset of the miMATRIX tag
+  long data;        //Offset of the data, the handle from mat_add_matrix
+  long end;         //Offset after the element
+  long size;        //Bytes of data without padding
+  char *name;       //Name without the block number
+  int block;        //Block of columns, 0 for the elements made by the caller
+  int data_type;
+  int rows;
+  int cols;
+  long written;     //Bytes of data stored by mat_writer_put
+  int next;         //Element with the next block of columns, -1 if none
+  long position;    //Next offset to deflate, -1 before the stream is started
+  z_stream zs;
+  int chunks;       //Pieces of deflated output in the spool file
+  int chunks_max;
+  long *chunk_offset;
+  size_t *chunk_size;
+  uint32_t compressed; //Total deflated bytes
+} mat_stream;
+
+/** Writer for the time slices of a MAT file made by mat_io. The file is
+    kept open for the whole run. Each slice is a list of segments that
+    go to byte offsets given by mat_add_matrix handles. With slots>0 the
+    slices are copied into a ring buffer and written by a background
+    thread. With slots=0 they are written at once. In the mmap mode the
+    preallocated file is mapped and the slices are stored directly. In
+    the compressed mode every element gets a deflate stream that the 
+    slices are fed to, and mat_writer_close replaces the file by one 
+    with miCOMPRESSED elements. In the chunked mode the matrices hold a
+    block of columns. A full block is continued in a new element named
+    <name>_<k> at the end of the file, and mat_writer_close trims the
+    last block to the columns written. */
+typedef struct mat_writer_structure{
+  FILE *mat_file;     //NULL when closed
+  int mode;           //_MAT_WRITER_FILE_, _MAT_WRITER_MMAP_ or _MAT_WRITER_COMPRESSED_
+  char filename[_FILENAMESIZE_];
+  char *map;          //The mapped file in the mmap mode, NULL otherwise
+  size_t map_size;    //Size of the mapping in bytes
+  int level;          //zlib compression level
+  FILE *spool;        //Deflated output until mat_writer_close
+  long spool_size;
+  int nstreams;       //Elements in the file
+  mat_stream *stream;
+  long block_start;   //Offset of the first element of the last block
+  int blocks;         //Blocks of columns in the chunked mode
+  long file_end;
+  unsigned char *zbuf; //_MAT_WRITER_CHUNK_ bytes of deflate output
+  int slots;          //Slices in the ring buffer, 0 writes in the caller
+  int max_segments;   //Segments per slice
+  size_t max_bytes;   //Bytes per slice
+  char *data;         //slots*max_bytes bytes of copied data
+  long *seg_offset;   //slots*max_segments file offsets
+  size_t *seg_size;   //slots*max_segments segment sizes
+  int *nseg;          //Segments in each slot
+  size_t *used;       //Bytes used in each slot
+  int head;           //Slot being filled by the caller
+  int tail;           //Next slot to be written by the thread
+  int count;          //Slices waiting for the thread
+  int stop;           //Set by mat_writer_close
+  int status;         //_FAILURE_ if a write has failed
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond_data;  //A slice has been committed or stop is set
+  pthread_cond_t cond_space; //A slot has been written
+} mat_writer;
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int mat_writer_open(mat_writer *writer,
+		      char *filename,
+		      int slots,
+		      int max_segments,
+		      size_t max_bytes,
+		      int mode,
+		      int level,
+		      ErrorMsg error_message);
+  int mat_writer_begin(mat_writer *writer);
+  int mat_writer_put(mat_writer *writer,
+		     void *ptr,
+		     int *handle,
+		     int size_element,
+		     int entries);
+  int mat_writer_commit(mat_writer *writer);
+  int mat_writer_sync(mat_writer *writer);
+  int mat_writer_close(mat_writer *writer);
+  int mat_writer_segment(mat_writer *writer, long offset, char *data, size_t size);
+  int mat_writer_write_slot(mat_writer *writer, int slot);
+  int mat_writer_scan(mat_writer *writer, ErrorMsg error_message);
+  int mat_writer_deflate(mat_writer *writer, mat_stream *ms, char *data, 
+			 size_t size, int flush);
+  int mat_writer_deflate_file(mat_writer *writer, mat_stream *ms, long end);
+  int mat_writer_deflate_zeros(mat_writer *writer, mat_stream *ms, long end);
+  int mat_writer_finish(mat_writer *writer);
+  int mat_writer_chunk(mat_writer *writer, int *handle, size_t size);
+  int mat_writer_grow(mat_writer *writer);
+  int mat_writer_trim(mat_writer *writer);
+  int mat_writer_toc(mat_writer *writer);
+  void *mat_writer_thread(void *arg);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
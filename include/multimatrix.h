@@ -79,6 +79,8 @@ extern "C" {
   int DestroyMultiMatrix(MultiMatrix *A);
   size_t GetByteSize(DataType Dtype);
   int PrintMultiMatrix(MultiMatrix *A, char* name);
+  int ZeroMultiMatrix(MultiMatrix *A);
+  int AddToMultiMatrixEntry(MultiMatrix *A, int row, int col, double value);
 #ifdef __cplusplus
 }
 #endif
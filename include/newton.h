@@ -2,8 +2,30 @@
 #define __NWT__
 #include "common.h"
 #include "linalg_wrapper_dense_NR.h"
+#include "sparse.h"
 /**************************************************************/
 
+#define _NEWTON_REUSE_ 1e-2    /** The LU is kept while max|J-J_LU|/max|J_LU| stays below this */
+#define _NEWTON_ARMIJO_ 1e-4   /** Sufficient decrease of |F|^2 in the line search */
+#define _NEWTON_BACKTRACK_ 8   /** Halvings of the step in the line search */
+#define _NEWTON_PIVOT_RATIO_ 1e-2 /** Smallest 1/max|L_ij| accepted from sp_refactor */
+
+/** Workspace of Newton_sparse, owned by the caller and allocated once for a
+    Jacobian pattern, so that Newton_sparse itself allocates nothing. */
+struct newton_workspace{
+  int n;
+  sp_mat *J;       //The Jacobian, on the pattern given to newton_workspace_alloc
+  sp_num *N;       //Its LU decomposition
+  int pivots;      //Does N hold a pivot sequence from this call?
+  double *Jlu;     //The values of J at the last factorisation
+  double *F;       //F(y)
+  double *Ftrial;  //F at the point tried by the line search
+  double *dy;      //The Newton step
+  double *ytrial;
+  int lu;          //Factorisations, for statistics
+  int reused;      //Iterations that kept the LU
+};
+
 /**
  * Boilerplate for C++
  */
@@ -20,6 +42,24 @@ int Newton(int (*vecfun)(double * y, double * Fy, void *param),
 	   int maxiter,
 	   size_t neq,
 	   ErrorMsg error_message);
+int Newton_sparse(int (*vecfun)(double * y, double * Fy, void *param),
+		  int (*jacfun)(double * y, double * Jx, void *param),
+		  double *y0,
+		  void *param,
+		  double *maxstep,
+		  double rtol,
+		  int *iter,
+		  int maxiter,
+		  struct newton_workspace *ws,
+		  ErrorMsg error_message);
+int newton_workspace_alloc(struct newton_workspace **ws,
+			   int n,
+			   int *Ap,
+			   int *Ai,
+			   ErrorMsg error_message);
+int newton_workspace_free(struct newton_workspace *ws);
+int newton_factorise(struct newton_workspace *ws,
+		     ErrorMsg error_message);
 int jacobian_for_Newton(int (*vecfun)(double * y, double * Fy, void *param),
 			double *y0,
 			double *Fval,
@@ -17,6 +17,20 @@ struct file_content {
   short * read;    /**< set to _TRUE_ if this parameter is effectively read */
 };
 
+/* a set of runs made from a file_content where some values are sweeps, 
+   logspace(a,b,n), linspace(a,b,n) or values(x1,x2,...), with an optional
+   minus sign in front. The runs are all combinations of the swept values,
+   with the first swept parameter in the file changing fastest */
+struct sweep_content {
+  int dimensions;   /**< number of swept parameters */
+  int * entry;      /**< their index in the file_content */
+  int * size;       /**< number of values of each */
+  double ** values; /**< list of (size) values of each */
+  short * logarithmic; /**< _TRUE_ for a logspace sweep */
+  int runs;         /**< product of the sizes, 1 without sweeps */
+  int refine;       /**< levels of midpoints added by parser_sweep_refine */
+};
+
 /**************************************************************/
 
 /*
@@ -108,6 +122,39 @@ int parser_cat(
 	       ErrorMsg errmsg
 	       );
 
+int parser_sweep_values(
+			char * value,
+			int * size,
+			double ** pointer_to_list,
+			short * logarithmic,
+			int * found,
+			ErrorMsg errmsg
+			);
+
+int parser_sweep_init(
+		      struct file_content * pfc,
+		      struct sweep_content * psw,
+		      ErrorMsg errmsg
+		      );
+
+int parser_sweep_run(
+		     const struct file_content * pfc,
+		     const struct sweep_content * psw,
+		     int run,
+		     struct file_content * pfc_run,
+		     ErrorMsg errmsg
+		     );
+
+int parser_sweep_refine(
+			struct sweep_content * psw,
+			int levels,
+			ErrorMsg errmsg
+			);
+
+int parser_sweep_free(
+		      struct sweep_content * psw
+		      );
+
 #ifdef __cplusplus
 }
 #endif
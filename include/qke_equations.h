@@ -5,21 +5,129 @@
 #include "newton.h"
 #include "background.h"
 #include "mat_io.h"
+#include "mat_writer.h"
+#include "parser.h"
+#include <time.h>
+#define _RHS_BLOCK_ 256 /** Bins per partial sum in qke_moments, a power of two */
+#define _QKE_MOMENTS_ 6   /** Number of moments computed by qke_moments */
+#define _PARAM_CACHE_ 4   /** Entries in the (T,L) cache of the parametrisation */
+#define _QKE_STOPFACTOR_ 2.0 /** Growth of |L| over max_old that qke_stop_at_divL takes as divergence */
+/** The events of qke_event_values, with the events parameter: */
+#define _QKE_EVENT_L_FINAL_ 0    /** |L| reaches L_final */
+#define _QKE_EVENT_DIVL_ 1       /** |L| passes _QKE_STOPFACTOR_*max_old */
+#define _QKE_EVENT_BREAKPOINT_ 2 /** T passes the breakpoint of qke_stop_at_divL */
+#define _QKE_EVENTS_ 3
 /**************************************************************/
+/** The advection term dudT*dvdu*drho/dv on one field rho[0..vres-1] as a
+    banded operator. Rows at least nbnd bins from the ends use the centred
+    interior stencil, the nbnd rows at each end use the lower order stencils
+    of drhodv that fit inside the grid. */
+typedef struct qke_advection_structure{
+  int vres;
+  int stencil;  //Interior stencil of drhodv: 21, 51 or 71
+  int nbnd;     //Half width of the interior stencil
+  int nbands;   //Number of diagonals, 2*nbnd+1
+  double delta_v;
+  double *val;  //DIA format, val[b*vres+i] multiplies rho[i+b-nbnd] in row i. Units of 1/delta_v.
+} qke_advection;
+
+/** The arrays that derivs writes to, so that every thread needs its own
+    set. They are carved out of one block by qke_scratch_alloc, and
+    qke_scratch_copy copies them as a unit. The rest of qke_param and
+    lya_param is either read only in derivs and shared by the copies of
+    qke_copy_workspace and lya_copy_workspace, or a scalar copied with the
+    structure. lya_param uses the first vres of rhs_work, 3 moments per
+    block of rhs_partial and no grid_table. */
+typedef struct qke_scratch_structure{
+  void *block;   //All arrays below, doubles first, then the rows of mat and indx
+  size_t size;   //Bytes in block
+  int Nres;
+  int vres;
+  double *xi;    //Resonances in v-space.
+  double *ui;    //Resonances in u-space, ui[Nres]
+  double *vi;
+  double *duidT; //Partial derivative of resonances in u-space.
+  double *dvidT; //Partial derivative of resonances in v-space.
+  double *duidx; //Partial derivative of u wrt x
+  double *dxidT; //Partial derivative of resonances in x space.
+  double *a;     //a parameters controlling the parametrisation, b is in qke_param.
+  double *y_0;   //Workspace for qke_derivs, for Newton method.
+  double *maxstep;
+  double *vv;        //Workarray for LU decomposition.
+  double *v_grid;  //v_grid[vres]
+  double *u_grid;
+  double *x_grid;
+  double *dvdu_grid;
+  double *dudT_grid;
+  double *rhs_work; //exp(x-mu/T), exp(x+mu/T) and dudT*dvdu, for qke_derivs
+  double *rhs_partial; //Partial sums of qke_moments, _QKE_MOMENTS_ per block
+  double *grid_table; //exp(x), 1/(1+exp(x)) and C_alpha*G_F^2*x on x_grid
+  double *param_cache; //_PARAM_CACHE_ entries of T, L, xi, ui, duidx, vi, a, b, u_grid, x_grid
+  double **mat;      //(Nres+2)x(Nres+2) matrix used in more than one occasion for solving linear systems.
+  int *indx;         //Permutation vector for LU decomposition.
+  struct newton_workspace *newton; //Newton_sparse for the parametrisation, made by its first call, not in block
+} qke_scratch;
+
 typedef struct qke_param_structure{
   FILE *tmp;
   char output_filename[_FILENAMESIZE_]; //Where to write output.
   char parameter_filename[_FILENAMESIZE_];
+  char symbolic_cache[_FILENAMESIZE_]; //Directory for cached sparse LU analysis, "" if none.
+  char result_cache[_FILENAMESIZE_]; //Directory for results of earlier runs, "" if none.
   int evolver;   //Which time integrator to use
+  int imex;      //Advection terms explicit, local terms implicit? Rosenbrock-W only.
+  int radau5_real; //Solve the complex radau5 system as a real one of twice the size?
   LinAlgWrapper LinearAlgebraWrapper; //Wrapper for LU-decompositions
+  int evolver_auto; //evolver = -1: chosen by lasagna_select before the run?
+  int linalg_auto;  //linalg_wrapper = -1: chosen by lasagna_select before the run?
+  double memory_limit; //MB a run may use, 0 for the memory of the machine, see lasagna_select.
   int nproc;     //Number of cores available.
+  int rhs_threads; //Threads used inside one qke_derivs call, 1 is serial.
+  void *share;     //Cores of the run in a sweep, struct lasagna_share, or NULL.
   int verbose;   //Level of output
   int fixed_grid;//Fixed grid?
+  int grid_switch; //Go on on the fixed grid when the resonances have left the moving one?
+  int switch_pending; //Set by qke_switch_check when the run should go on on the fixed grid.
+  int analytic_jacobian;//0: numjac, 1: qke_jacobian, 2: qke_jacobian checked against numjac
+  int jacobian_updates; //Secant updates of J between two computed Jacobians in ndf15, 0 is off.
+  int detect_pattern; //T samples for qke_detect_pattern, 0 keeps the pattern of init_qke_param.
+  int pattern_pad;    //Columns added on each side of the detected entries.
+  int events;    //Locate the stops on the dense output of ndf15 or radau5, see qke_event_values?
+  int event_direction[_QKE_EVENTS_]; //For EvolverOptions.event_direction
+  int event_terminal[_QKE_EVENTS_];  //For EvolverOptions.event_terminal
+  int mixed_precision; //Refinement steps of single precision sparse solves, 0 is off.
+  int low_memory; //Sparse factors sized for the smallest peak memory?
+  int output_buffer; //Slices buffered for the output thread, 0 writes in the evolver thread.
+  int output_mmap; //Store the output directly in the mapped output file?
+  int output_compress; //zlib level for miCOMPRESSED output, 0 for none.
+  int output_chunk; //Output points per block of a growable output file, 0 for one block.
+  int checkpoint_interval; //Accepted steps between checkpoints, 0 for none.
+  int restart;   //Continue from the checkpoint of an earlier run?
+  char output_fields[_ARGUMENT_LENGTH_MAX_]; //Fields stored at each output point, "all" for every field.
+  int output_bin_stride; //Store every output_bin_stride'th momentum bin.
+  int output_nbins;  //Momentum bins stored of each field.
+  int *output_bins;  //Their indices, NULL for all vres bins.
+  int output_nmoments; //Moments of qke_moments stored in "moments".
+  int *output_moments; //Their indices, NULL for none.
+  double *output_work; //The selected bins of one field.
+  double *output_full; //One field interpolated to vres_full bins, on a coarser grid level.
+  int store_history; //Write the ndf15 step history to <output_filename>.hist?
+  int store_output; //Keep the output file after a successful run?
+  int sweep_warm_start; //Start ndf15 from the last run of a sweep?
   int Nres;      //Number of resinances
   size_t neq;       //Number of equations
   int Tres;      //Entries in time/Temperature vector.
   int is_electron; //True if we have electron neutrino, False otherwise.
   int guess_exists;
+  int warm_start;    //Start the parametrisation Newton solve from the last solution?
+  int sparse_newton; //Solve the parametrisation with Newton_sparse instead of Newton?
+  double T_guess;    //Temperature of the last parametrisation solve
+  int param_cache_current; //Cache entry the grid was taken from, -1 if none
+  int param_cache_next;    //Cache entry to overwrite next
+  int timing;              //Time the evolver phases, see evolver_timed?
+  double progress_interval; //Seconds between updates of the progress file, 0 for none.
+  double param_time;       //Seconds in get_parametrisation on cache misses, this workspace only
+  int param_solves;        //Its calls
   double rtol;   //Relative tolerance of integrator
   double abstol; //Absolute tolerance of integrator
   double alpha;  //Sampling density aound resonances (0=most dense, 1=uniform)
@@ -27,25 +135,19 @@ typedef struct qke_param_structure{
   double T_initial; //Initial temperature
   double T_final; //Final temperature
   double *Tvec;  //Temperature vector (Tvec[Tres])
-  double *xi;    //Resonances in v-space.
-  double *ui;    //Resonances in u-space, ui[Nres]
-  double *vi;
-  double *duidT; //Partial derivative of resonances in u-space.
-  double *dvidT; //Partial derivative of resonances in v-space.
-  double *duidx; //Partial derivative of u wrt x
-  double *dxidT; //Partial derivative of resonances in x space.
-  double *a;     //a and b parameters controlling the parametrisation.
-  double b;
-  double *y_0;   //Workspace for qke_derivs, for Newton method.
-  double *maxstep;
+  qke_scratch ws; //Arrays written by derivs, private to a copy of the workspace
+  double b;      //b parameter controlling the parametrisation, see ws.a
   int vres;      //Number of momentum bins in v-space. (Resolution)
+  int vres_full; //vres of grid level 0, the bins of the output.
+  int grid_levels; //Coarser grid levels of an adaptive grid, each halving vres-1. 0 is off.
+  int grid_level;  //Current level, vres=(vres_full-1)/2^grid_level+1.
+  double grid_tol; //Bound on qke_grid_indicator for the adaptive grid.
+  int grid_next;   //Next output point where the grid is checked, or the grid switch.
+  int grid_pending; //Level asked for by qke_grid_check, -1 if none.
   double v_left;    //Boundaries of v, usually just 0 and 1.
   double v_right;
-  double *v_grid;  //v_grid[vres]
-  double *u_grid;
-  double *x_grid;
-  double *dvdu_grid;
-  double *dudT_grid;
+  qke_advection adv; //dudT*dvdu*drho/dv, set up by init_qke_param
+  int grid_table_valid; //_FALSE_ when x_grid has changed since qke_grid_table
   double n_plus;
   double xmin;     //minimum value of x=p/T considered
   double xmax;     //Maximum value of x=p/T considered
@@ -72,9 +174,6 @@ typedef struct qke_param_structure{
   double L_final; //Final value of abs(L)
   double trigger_dLdT_over_L;
   double C_alpha;
-  double **mat;      //(Nres+2)x(Nres+2) matrix used in more than one occasion for solving linear systems.
-  double *vv;        //Workarray for LU decomposition.
-  int *indx;         //Permutation vector for LU decomposition.
   int *Ai;  //Row indices of jacobian
   int *Ap;  //Column indices of jacobian
   struct background_structure pbs;
@@ -83,6 +182,7 @@ typedef struct qke_param_structure{
   double V1;
   double VL;
   double g_alpha; //1 for muon/tau, 1+4sec²(theta_w)/n_plus for e.
+  mat_writer writer; //Open output file, from qke_init_output
   int Pa_plus_handle; //Position of given matrix in output file
   int Pa_minus_handle; //Position of given matrix in output file
   int Ps_plus_handle; //Position of given matrix in output file
@@ -105,12 +205,23 @@ typedef struct qke_param_structure{
   int V1_handle; //Position of given matrix in output file
   int Vx_handle; //Position of given matrix in output file
   int VL_handle; //Position of given matrix in output file
+  int moments_handle; //Position of given matrix in output file
   // parameters for the qke_stop_at_divL function.
   double T_wait;
   double max_old; //Contains the over all maximal value L has attained.
   double max_cur; //Contains the maximal value of L for the oscillation and the sign.
   int should_break; //Flag indicating that the evolver should soon break.
   double breakpoint; //The value of T, where the evolver should break.
+  int cross_found;   //Set by qke_event_action when |L| passed the bound in the last step.
+  double T_cross;    //The T where it did.
+  // parameters for the qke_stop_at_budget function.
+  double time_budget; //Wall clock seconds for the run, 0 for no limit.
+  time_t run_start;   //Start of the integration.
+  int budget_exceeded; //Set when qke_stop_at_budget has stopped the run.
+  double T_stop;      //T where a stop function stopped the run.
+  int steps_reached;  //Accepted steps, counted by qke_stop_at_budget.
+  double T_reached;   //T at the end of the last of them.
+  double L_reached;   //L there.
 } qke_param;
 
 /**
@@ -121,12 +232,38 @@ extern "C" {
 #endif
   //Initialise:
   int init_qke_param(qke_param *pqke);
+  int init_qke_param_fixed_grid(qke_param *pqke);
+  int qke_init_grid(qke_param *pqke);
+  int qke_fixed_grid_pattern(qke_param *pqke);
   //Free:
   int free_qke_param(qke_param *pqke);
+  int qke_free_grid(qke_param *pqke);
+  //Adaptive momentum grid:
+  int qke_grid_interpolate(double *from, int n_from, double *to, int n_to);
+  int qke_regrid(qke_param *pqke, int level, double **y, ErrorMsg error_message);
+  double qke_grid_indicator(double *y, qke_param *pqke);
+  int qke_grid_check(double t, double *y, qke_param *pqke);
+  //Switch from the moving to the fixed grid:
+  int qke_switch_check(double t, double *y, qke_param *pqke);
+  int qke_switch_grid(qke_param *pqke, double T, double *y, ErrorMsg error_message);
+  //Private copies for threaded numjac:
+  int qke_scratch_alloc(qke_scratch *ws, int Nres, int vres);
+  int qke_scratch_resize(qke_scratch *ws, int vres);
+  int qke_scratch_copy(qke_scratch *from, qke_scratch *to);
+  int qke_scratch_free(qke_scratch *ws);
+  int qke_copy_workspace(void *param, void **param_copy, ErrorMsg error_message);
+  int qke_free_workspace(void *param_copy, ErrorMsg error_message);
+  int qke_detect_pattern(qke_param *pqke, double T_start, double *y, ErrorMsg error_message);
   //Set or copy initial conditions:
   int qke_initial_conditions(double Ti, double *y, qke_param *pqke);
   //Handle binary output:
   int qke_init_output(qke_param *pqke);
+  int qke_checkpoint_state(FILE *file, int restore, void *param, ErrorMsg error_message);
+  int qke_output_selection(qke_param *pqke, ErrorMsg error_message);
+  int qke_output_field(qke_param *pqke, char *name);
+  int qke_output_indices(qke_param *pqke, int *interp_idx);
+  int qke_add_output_field(qke_param *pqke, char *name, int Tres, int *handle);
+  int qke_put_output_field(qke_param *pqke, double *data, int *handle);
   int qke_store_output(double t,
 		       double *y,
 		       double *dy,
@@ -156,17 +293,60 @@ extern "C" {
 		       double *dy,
 		       void *param,
 		       ErrorMsg error_message);
+  int qke_stop_at_budget(double t,
+			 double *y,
+			 double *dy,
+			 void *param,
+			 ErrorMsg error_message);
   int qke_stop_at_trigger(double t,
 			  double *y,
 			  double *dy,
 			  void *param,
 			  ErrorMsg error_message);
+  int qke_events(qke_param *pqke);
+  int qke_event_values(double t,
+		       double *y,
+		       double *value,
+		       void *param,
+		       ErrorMsg error_message);
+  int qke_event_action(double t,
+		       double *y,
+		       int event,
+		       void *param,
+		       ErrorMsg error_message);
   //QKE derivs:
   int qke_derivs(double T, 
 		 double *y, 
 		 double *dy, 
 		 void *pqke, 
 		 ErrorMsg error_message);
+  int qke_derivs_split(double T, 
+		       double *y, 
+		       double *f_implicit, 
+		       double *f_explicit, 
+		       void *param,
+		       ErrorMsg error_message);
+  int qke_imex_blocks(qke_param *pqke, int *block_index);
+  int qke_derivs_batch(double T, 
+		       double **y, 
+		       double **dy, 
+		       int m,
+		       void *pqke, 
+		       ErrorMsg error_message);
+  int qke_derivs_setup(double T, 
+		       double L, 
+		       qke_param *pqke,
+		       double *H,
+		       double *mu_div_T,
+		       ErrorMsg error_message);
+  int qke_derivs_state(double T, 
+		       double *y, 
+		       double *dy, 
+		       double *dy_explicit,
+		       double H,
+		       double mu_div_T,
+		       qke_param *pqke,
+		       ErrorMsg error_message);
 
   int qke_derivs_fixed_grid(double T, 
 			    double *y, 
@@ -191,6 +371,9 @@ extern "C" {
 				double *I_f0,
 				ErrorMsg error_message);
   int get_parametrisation(double T,qke_param *pqke, ErrorMsg error_message);
+  int qke_parametrisation_cached(double T, double L, qke_param *pqke, ErrorMsg error_message);
+  int qke_param_cache_copy(double *entry, qke_param *pqke, int store);
+  int qke_param_cache_clear(qke_param *pqke);
   int get_partial_derivatives(double T,
 			      double L,
 			      double dLdT,
@@ -199,7 +382,39 @@ extern "C" {
   int u_of_x(double x, double *u, double *dudx, qke_param *param);
   int x_of_u(double u, double *x, qke_param *param);
   int nonlinear_rhs(double *y, double *Fy, void *param);
+  int nonlinear_rhs_sparse_jac(double *y, double *Jx, void *param);
+  int parametrisation_pattern(int Nres, int *Ap, int *Ai);
+  int parametrisation_jacobian(int Nres, double alpha, double *y, double *Jx);
+  int parametrisation_newton_alloc(int Nres,
+				   struct newton_workspace **ws,
+				   ErrorMsg error_message);
+  int qke_grid_table(qke_param *pqke);
+  int qke_moments(double *y, qke_param *pqke, double *moment, ErrorMsg error_message);
+  int qke_advection_init(qke_advection *adv, int vres, int stencil, 
+			 double delta_v);
+  int qke_advection_free(qke_advection *adv);
+  int qke_advection_row_stencil(qke_advection *adv, int i);
+  int qke_advection_apply(qke_advection *adv, double *rho, double *drho, 
+			  double *dudTdvdu);
+  int qke_advection_jacobian(qke_advection *adv, MultiMatrix *J, int index,
+			     double *dudTdvdu);
   double drhodv(double *rho, double delta_v, int index, int stencil_method);
+  int drhodv_stencil(int stencil_method, int *offset, double *weight);
+  //Analytic jacobian for EvolverOptions.jacobian:
+  int qke_jacobian(double T, 
+		   double *y, 
+		   double *fval,
+		   MultiMatrix *J,
+		   int *nfe,
+		   void *param,
+		   ErrorMsg error_message);
+  int qke_jacobian_implicit(double T, 
+			    double *y, 
+			    double *fval,
+			    MultiMatrix *J,
+			    int *nfe,
+			    void *param,
+			    ErrorMsg error_message);
   int qke_derivs_test_partial(double T, 
 			      double *y, 
 			      double *dy, 
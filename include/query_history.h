@@ -0,0 +1 @@
+#include "evolver_ndf15.h"
@@ -31,8 +31,71 @@ typedef struct sparse_numerical{
 	int *q;			/* Column permutation */
 	int *wamd;		/* Work array for sp_amd */
 	double *w;		/* Work array for sp_lu */
+	double *rs;		/* Row scales 1/max_j|A_ij| of sp_ludcmp, for its choice of pivots */
+	int *xipack;	/* Compact storage, see sp_num_alloc_sized: the reach sets one after the other, */
+	int xicap;		/* with room for xicap indices, */
+	int *xiwork;	/* and the reach of one column in sp_ludcmp. NULL if not compact. */
 } sp_num;
 
+typedef struct sparse_levels{
+	/* Level sets and row storage of the factors in a sp_num, for parallel solves: */
+	int n;			/* Matrix assumed square, [nxn] */
+	int nlevL;		/* Number of levels in L */
+	int nlevU;		/* Number of levels in U */
+	int *Llev_p;	/* Llev_i[Llev_p[l]..Llev_p[l+1]-1] are the rows of L in level l. */
+	int *Llev_i;
+	int *Ulev_p;	/* Same for U, where level 0 is the last row. */
+	int *Ulev_i;
+	int *Lrp;		/* Strictly lower part of L by rows: */
+	int *Lrj;
+	double *Lrx;
+	int *Lmap;		/* Lrx[p] = L->Ax[Lmap[p]] */
+	int *Urp;		/* Strictly upper part of U by rows: */
+	int *Urj;
+	double *Urx;
+	int *Umap;		/* Urx[p] = U->Ax[Umap[p]] */
+	double *Udiag;	/* Diagonal of U. */
+	int *level;		/* Work array */
+	int Lcap, Ucap;	/* Allocated sizes of Lrj/Lrx/Lmap and Urj/Urx/Umap */
+} sp_lev;
+
+typedef struct sparse_supernodal{
+	/* Supernodal form of the factors in a sp_num, for refactorization and solve: */
+	int n;			/* Matrix assumed square, [nxn] */
+	int nsuper;		/* Number of supernodes */
+	int *super;		/* super[s]..super[s+1]-1 are the columns in supernode s. */
+	int *col_super;	/* col_super[j] is the supernode holding column j. */
+	int *Rp;		/* Ri[Rp[s]..Rp[s+1]-1] are the rows of supernode s, diagonal block first. */
+	int *Ri;
+	int *Lxp;		/* Lx[Lxp[s]..Lxp[s+1]-1] is the dense column major block of supernode s. */
+	double *Lx;
+	int *Up;		/* Strictly upper part of U with sorted row indices. */
+	int *Ui;
+	double *Ux;
+	double *Udiag;	/* Diagonal of U. */
+	int *Segp;		/* Seg_s[Segp[t]..Segp[t+1]-1] are the supernodes updating supernode t, */
+	int *Seg_s;
+	int *Seg_k;		/* and Seg_k holds the first column used from each of them. */
+	int maxcols;	/* Largest number of columns in a supernode */
+	double *W;		/* Dense panel [n x maxcols] for the columns of one supernode */
+	int *mark;		/* Work arrays */
+	double *w;
+	int Ricap, Lxcap, Ucap, Segcap, Wcap; /* Allocated sizes of Ri, Lx, Ui/Ux, Seg_s/Seg_k and W */
+} sp_super;
+
+typedef struct sparse_ilu{
+	/* Incomplete LU factorization ILU(k), stored by rows: */
+	int n;			/* Matrix assumed square, [nxn] */
+	int nnz;		/* Number of entries in L and U together */
+	int *Rp;		/* Rp[0..n]. Row i is Rj[Rp[i]..Rp[i+1]-1], sorted. */
+	int *Rj;		/* Column indices. */
+	int *diag;		/* diag[i] is the position of the diagonal of row i. */
+	int *Amap;		/* Position of the entry in the CSC matrix A, -1 for fill. */
+	int *iw;		/* Work array, -1 on entry and exit. */
+	double *Rx;		/* Values for real matrices, strict L (unit diagonal) and U. */
+	double complex *Rz;	/* Values for complex matrices. */
+} sp_ilu;
+
 typedef struct sparse_matrix_complex{
 	/* Sparse matrix in compressed column form: */
 	int ncols;		/* Number of columns */
@@ -55,8 +118,26 @@ typedef struct sparse_numerical_complex{
 	int *q;			/* Column permutation */
 	int *wamd;		/* Work array for sp_amd */
 	double complex *w;		/* Work array for sp_lu */
+	double *rs;		/* Row scales, as in sp_num */
+	int *xipack;	/* Compact storage, as in sp_num */
+	int xicap;
+	int *xiwork;
 } sp_num_cx;
 
+typedef struct sparse_split_complex{
+	/* Values of the factors in a sp_num_cx, with real and imaginary parts in
+	   separate arrays so that the updates vectorise. The pattern is the one
+	   of N->L and N->U, with permuted row indices. */
+	int n;
+	int nnz;		/* Entries of A */
+	int size;		/* Entries allocated in each of Lre, Lim, Ure and Uim */
+	double *Lre, *Lim;	/* Values of L, on the pattern of N->L */
+	double *Ure, *Uim;	/* Values of U, on the pattern of N->U */
+	double *Are, *Aim;	/* A, split by sp_refactor_split_cx */
+	double amax;		/* max|A_ij|, for sp_factor_stability_split_cx */
+	double *wre, *wim;	/* Work arrays, [n] */
+} sp_split_cx;
+
 
 /**
  * Boilerplate for C++
@@ -68,7 +149,14 @@ extern "C" {
   int sp_mat_alloc(sp_mat** A, int ncols, int nrows, int maxnz, ErrorMsg error_message);
   int sp_mat_free(sp_mat *A);
   int sp_num_alloc(sp_num** N, int n,ErrorMsg error_message);
+  int sp_num_alloc_sized(sp_num** N, int n, int lnz, ErrorMsg error_message);
   int sp_num_free(sp_num *N);
+  int sp_num_reserve(sp_num *N, int lnz, int unz);
+  int sp_grow(int size, int need, int most);
+  int sp_mat_grow(void **Ax, void **Ai, size_t size, int maxnz);
+  int sp_reach_reserve(int n, int ncols, int *topvec, int **xi, int **xipack, 
+		       int *xicap, int need);
+  void sp_reach_pack(int n, int ncols, int *topvec, int **xi, int *xipack);
   int reachr(int Gncol, 
 	     int *Bp, 
 	     int *Bi, 
@@ -78,21 +166,80 @@ extern "C" {
   int sp_splsolve(sp_mat *G, sp_mat *B, int k, int*xik, int top, double *x, int *pinv);
   int sp_ludcmp(sp_num *N, sp_mat *A, double pivtol);
   int sp_lusolve(sp_num *N, double *b, double *x);
+  int sp_lusolve_many(sp_num *N, double *b, double *x, double *w, int k);
   int sp_refactor(sp_num *N, sp_mat *A);
+  int sp_pivots_ok(sp_num *N, double pivtol);
+  int sp_factor_stability(sp_num *N, sp_mat *A, double *growth, double *pivot_ratio);
+  int sp_lu_demote(sp_num *N, float *Lx, float *Ux);
+  int sp_lusolve_sgl(sp_num *N, float *Lx, float *Ux, double *b, double *x);
+  int sp_residual(sp_mat *A, double *x, double *b, double *r);
+  unsigned int sp_pattern_hash(int n, int *Ap, int *Ai);
+  int sp_symbolic_write(char *filename, unsigned int hash, int n, int nnz, 
+			int *q, int *pinv, int *p, int *topvec, int **xi, 
+			int lnz, int unz);
+  int sp_symbolic_read(char *filename, unsigned int hash, int n, int nnz, 
+		       int *q, int *pinv, int *p, int *topvec, int **xi, 
+		       int **xipack, int *xicap, int *lnz, int *unz);
+  int sp_lev_alloc(sp_lev** V, int n, ErrorMsg error_message);
+  int sp_lev_free(sp_lev *V);
+  int sp_lev_sets(int n, int nlev, int *level, int *lev_p, int *lev_i);
+  int sp_lev_analyse(sp_lev *V, sp_num *N, ErrorMsg error_message);
+  int sp_lev_update(sp_lev *V, sp_num *N);
+  int sp_lusolve_levels(sp_lev *V, sp_num *N, double *b, double *x, int threads);
+  int sp_super_alloc(sp_super** S, int n, ErrorMsg error_message);
+  int sp_super_free(sp_super *S);
+  int sp_super_symbolic(sp_super *S, sp_num *N, int maxsuper, double relax, ErrorMsg error_message);
+  int sp_super_refactor(sp_super *S, sp_num *N, sp_mat *A);
+  void sp_dense_update(int nrow, int ncol, int nk, double *B, int ldb, 
+		       double *X, int ldx, double *Y, int *R, int ldy);
+  int sp_super_lusolve(sp_super *S, sp_num *N, double *b, double *x);
+  int sp_ilu_symbolic(sp_ilu **M, int n, int *Ap, int *Ai, int fill, 
+		      int is_complex, ErrorMsg error_message);
+  int sp_ilu_free(sp_ilu *M);
+  int sp_ilu_factor(sp_ilu *M, double *Ax);
+  int sp_ilu_solve(sp_ilu *M, double *x);
+  int sp_gmres(sp_mat *A, sp_ilu *M, double *b, double *x, int m, int maxit, 
+	       double tol, double *work, int *iter);
   int column_grouping(sp_mat *G, int *col_g, int *col_wi);
   int column_grouping2(sp_mat *G, int *col_g, int *col_wi);
+  int get_column_grouping(int *Ap, int *Ai, size_t neq, int *col_g, int *filled);
   int sp_amd(int *Cp, int *Ci, int n, int cnzmax, int *P, int *W);
   int sp_wclear(int mark, int lemax, int *w, int n);
   int sp_tdfs(int j, int k, int *head, const int *next, int *post, int *stack);
+  int sp_symbolic_fill(int *Cp, int *Ci, int n, int *P, int *W);
+  int sp_symbolic_colcount(int *Cp, int *Ci, int n, int *P, int *W, int *count);
 
   int sp_mat_alloc_cx(sp_mat_cx** A, int ncols, int nrows, int maxnz, ErrorMsg error_message);
   int sp_mat_free_cx(sp_mat_cx *A);
   int sp_num_alloc_cx(sp_num_cx** N, int n,ErrorMsg error_message);
+  int sp_num_alloc_sized_cx(sp_num_cx** N, int n, int lnz, ErrorMsg error_message);
   int sp_num_free_cx(sp_num_cx *N);
+  int sp_num_reserve_cx(sp_num_cx *N, int lnz, int unz);
   int sp_splsolve_cx(sp_mat_cx *G, sp_mat_cx *B, int k, int*xik, int top, double complex *x, int *pinv);
   int sp_ludcmp_cx(sp_num_cx *N, sp_mat_cx *A, double pivtol);
   int sp_lusolve_cx(sp_num_cx *N, double complex *b, double complex *x);
+  int sp_lusolve_many_cx(sp_num_cx *N, double complex *b, double complex *x,
+			 double complex *w, int k);
   int sp_refactor_cx(sp_num_cx *N, sp_mat_cx *A);
+  int sp_pivots_ok_cx(sp_num_cx *N, double pivtol);
+  int sp_factor_stability_cx(sp_num_cx *N, sp_mat_cx *A, double *growth, double *pivot_ratio);
+  int sp_lu_demote_cx(sp_num_cx *N, float complex *Lx, float complex *Ux);
+  int sp_lusolve_sgl_cx(sp_num_cx *N, float complex *Lx, float complex *Ux,
+			double complex *b, double complex *x);
+  int sp_residual_cx(sp_mat_cx *A, double complex *x, double complex *b,
+		     double complex *r);
+  int sp_split_alloc_cx(sp_split_cx **S, int n, int nnz, ErrorMsg error_message);
+  int sp_split_free_cx(sp_split_cx *S);
+  int sp_split_from_cx(sp_split_cx *S, sp_num_cx *N, ErrorMsg error_message);
+  int sp_refactor_split_cx(sp_split_cx *S, sp_num_cx *N, sp_mat_cx *A);
+  int sp_factor_stability_split_cx(sp_split_cx *S, sp_num_cx *N, double *growth,
+				   double *pivot_ratio);
+  int sp_lusolve_split_cx(sp_split_cx *S, sp_num_cx *N, double complex *b,
+			  double complex *x);
+  int sp_ilu_factor_cx(sp_ilu *M, double complex *Ax);
+  int sp_ilu_solve_cx(sp_ilu *M, double complex *x);
+  int sp_gmres_cx(sp_mat_cx *A, sp_ilu *M, double complex *b, double complex *x, 
+		  int m, int maxit, double tol, double complex *work, int *iter);
   int get_pattern_A_plus_AT(int *Ap, 
 			    int *Ai, 
 			    int n, 
@@ -100,6 +247,12 @@ extern "C" {
 			    int **Ci, 
 			    ErrorMsg error_message);
   
+/* Length of the work array of sp_gmres and sp_gmres_cx: */
+#define _SP_GMRES_WORK_(n,m) (((m)+3)*(n)+((m)+1)*(m)+4*(m)+1)
+/* Format version of the files written by sp_symbolic_write: */
+#define _SP_CACHE_VERSION_ 1
+/* Minimum average number of rows per level and thread for sp_lusolve_levels: */
+#define _SP_LEVEL_WIDTH_ 4
 #define SPFLIP(i) (-(i)-2)
 #define SPUNFLIP(i) (((i)<0) ? SPFLIP(i) : (i))
 #define SPMARKED(w,j) (w[j] < 0)
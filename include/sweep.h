@@ -0,0 +1,134 @@
+#ifndef __SWEEP__
+#define __SWEEP__
+
+#include "common.h"
+#include "evolver_common.h"
+#include "evolver_ndf15.h"
+#include "evolver_rk45.h"
+#include "evolver_radau5.h"
+#include "evolver_rosw.h"
+#include "evolver_exprb.h"
+#include "background.h"
+#include "qke_equations.h"
+#include "input.h"
+#include "budget.h"
+#include "autoselect.h"
+
+/** Configuration of a sweep, read once and not changed by the runs, so
+    any number of threads can do runs from it at the same time. Each run
+    makes its own qke_param from it. */
+struct lasagna_config{
+  struct file_content fc;                //The parameter file
+  struct sweep_content sweep;            //Its sweeps
+  struct background_structure background; //DoF table, shared by the runs
+  int threads;                           //sweep_threads
+  int nproc;                             //Cores of the sweep, nproc
+  int pin;                               //pin_threads
+};
+
+/** State kept by a thread of a sweep between its runs: the ndf15 context,
+    with its own copy of the pattern, and the options that the linalg 
+    workspace of the context refers to. */
+struct lasagna_worker{
+  EvolverOptions options;
+  struct ndf15_context *context; //NULL until the first ndf15 run
+  size_t neq;
+  int *Ap;
+  int *Ai;
+  /** With sweep_warm_start, the start of the run that finished last, shared by
+      the workers of a sweep. NULL if each worker uses its own last run. */
+  struct ndf15_warm_start *latest;
+  /** Shared state of the linalg wrapper of the workers of a sweep, passed
+      to the wrapper as EvolverOptions.LinAlgShared. NULL if not shared. */
+  void *linalg_shared;
+  /** Cores shared by the workers of a sweep. NULL if each run uses nproc. */
+  struct lasagna_budget *budget;
+  /** evolver and linalg_wrapper chosen by lasagna_select for the first run
+      of the worker, if chosen. */
+  int chosen;
+  int evolver;
+  LinAlgWrapper wrapper;
+};
+
+/** Summary of a run for the sweep log. */
+struct lasagna_result{
+  int status;          //_SUCCESS_ or _FAILURE_
+  int budget_exceeded; //Stopped by run_time_budget?
+  int diverged;        //Stopped by qke_stop_at_divL?
+  int steps;           //Accepted steps
+  double T_end;        //T_final, or T where a stop function stopped the run
+  double L_end;        //For a failed run, both at its last accepted step
+  double wall_time;    //Seconds
+  int cores;           //Cores of the run at its end, see lasagna_budget
+  int rhs_threads;     //Threads of its derivs calls at its end
+};
+
+#define _OUTCOME_NONE_ 0   /** Not done */
+#define _OUTCOME_QUEUED_ 1 /** In the current level */
+#define _OUTCOME_FAILED_ 2 /** Failed, or stopped by run_time_budget */
+
+/** Adaptive sampling of a sweep refined by sweep_refine: the coarse grid is
+    done first, and each level then adds the points of the cells of the 
+    last level whose corners do not all have the same outcome. */
+struct lasagna_sampler{
+  int level;    //0 for the coarse grid
+  int *outcome; //Of each run of the sweep, see lasagna_sampler_result
+  int *runs;    //Runs of the current level
+  int count;    //Their number, 0 when the sweep is done
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int lasagna_config_init(int argc,
+			  char **argv,
+			  struct lasagna_config *config,
+			  ErrorMsg error_message);
+  int lasagna_config_free(struct lasagna_config *config);
+  int lasagna_run(const struct lasagna_config *config,
+		  int run,
+		  struct lasagna_worker *worker,
+		  struct lasagna_result *result,
+		  ErrorMsg error_message);
+  int lasagna_worker_init(struct lasagna_worker *worker);
+  int lasagna_worker_context(struct lasagna_worker *worker,
+			     qke_param *pqke,
+			     ErrorMsg error_message);
+  int lasagna_evolve_adaptive(struct lasagna_worker *worker,
+			      qke_param *pqke,
+			      double **y,
+			      int **interp_idx,
+			      ErrorMsg error_message);
+  int lasagna_evolve_switch(struct lasagna_worker *worker,
+			    qke_param *pqke,
+			    int (*generic_evolver)(),
+			    double *y,
+			    ErrorMsg error_message);
+  int lasagna_stop_at_budget(double t,
+			     double *y,
+			     double *dy,
+			     void *param,
+			     ErrorMsg error_message);
+  int lasagna_worker_free(struct lasagna_worker *worker,
+			  ErrorMsg error_message);
+  int lasagna_sampler_init(struct sweep_content *psw,
+			   struct lasagna_sampler *sampler,
+			   ErrorMsg error_message);
+  int lasagna_sampler_result(struct lasagna_sampler *sampler,
+			     int run,
+			     int status,
+			     int budget_exceeded,
+			     int diverged,
+			     double L_end);
+  int lasagna_sampler_next_level(struct sweep_content *psw,
+				 struct lasagna_sampler *sampler,
+				 ErrorMsg error_message);
+  int lasagna_sampler_free(struct lasagna_sampler *sampler);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
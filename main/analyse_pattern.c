@@ -0,0 +1,132 @@
+#include "analyse_pattern.h"
+/** Analysis of the Jacobian pattern of a parameter file, before a run:
+    analyse_pattern <parameter file> [MAT file]
+    The pattern gets the ordering of the sparse wrapper, sp_amd on A+A^T,
+    and one LU with sp_ludcmp. The values are set so that the matrix is 
+    diagonally dominant by columns, as I-h*gamma*J is for small steps, so
+    the pivots are on the diagonal and nnz(L+U) is the fill of the 
+    ordering. Pivots off the diagonal in a run add to it. The pattern, the orderings, the factors and the numjac 
+    column groups are written to the MAT file, output/pattern.mat if not
+    given. */
+int main(int argc, char *argv[]){
+  qke_param qke_struct;
+  ErrorMsg error_message;
+  sp_mat *A;
+  sp_num *N;
+  int *Cp, *Ci, *col_g, *filled, *urow;
+  int n, nnz, j, p, groups, missing_diagonal, handle;
+  int lnz, unz, lk;
+  double flops, dense_memory, fitted_memory, stats[9];
+  char *outf = (argc > 2 ? argv[2] : "output/pattern.mat");
+
+  if (argc < 2){
+    printf("Usage: %s <parameter file> [MAT file]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (input_init_from_arguments(2,argv,&qke_struct,error_message) == _FAILURE_){
+    printf("\n\nError running input_init_from_arguments\n=>%s\n",error_message);
+    return _FAILURE_;
+  }
+  n = qke_struct.neq;
+  nnz = qke_struct.Ap[n];
+
+  //Matrix with the pattern, dominated by the diagonal in each column:
+  if ((sp_mat_alloc(&A,n,n,nnz,error_message) == _FAILURE_)||
+      (sp_num_alloc(&N,n,error_message) == _FAILURE_)){
+    printf("Error: %s\n",error_message);
+    return _FAILURE_;
+  }
+  missing_diagonal = n;
+  for (j=0; j<=n; j++)
+    A->Ap[j] = qke_struct.Ap[j];
+  for (j=0; j<n; j++){
+    for (p=A->Ap[j]; p<A->Ap[j+1]; p++){
+      A->Ai[p] = qke_struct.Ai[p];
+      if (A->Ai[p] == j){
+	A->Ax[p] = A->Ap[j+1]-A->Ap[j]+1.0;
+	missing_diagonal--;
+      }
+      else
+	A->Ax[p] = -1.0;
+    }
+  }
+
+  //Ordering and LU as in linalg_wrapper_sparse:
+  if (get_pattern_A_plus_AT(A->Ap,A->Ai,n,&Cp,&Ci,error_message) == _FAILURE_){
+    printf("Error: %s\n",error_message);
+    return _FAILURE_;
+  }
+  sp_amd(Cp,Ci,n,Cp[n],N->q,N->wamd);
+  if (sp_ludcmp(N,A,0.1) == _FAILURE_){
+    printf("The pattern is structurally singular.\n");
+    return _FAILURE_;
+  }
+  lnz = N->L->Ap[n];
+  unz = N->U->Ap[n];
+
+  //Flops of the factorisation from the column counts of L and the row counts of U:
+  urow = calloc(n,sizeof(int));
+  for (p=0; p<unz; p++)
+    urow[N->U->Ai[p]]++;
+  for (j=0, flops=0.0; j<n; j++){
+    lk = N->L->Ap[j+1]-N->L->Ap[j]-1;
+    flops += lk+2.0*lk*(urow[j]-1);
+  }
+
+  //Column groups of numjac:
+  col_g = malloc(sizeof(int)*n);
+  filled = malloc(sizeof(int)*n);
+  groups = get_column_grouping(qke_struct.Ap,qke_struct.Ai,n,col_g,filled)+1;
+
+  //Memory of the factors as sp_num_alloc sizes them, and as they fit:
+  dense_memory = 2.0*(n*(n+1.0)/2.0)*(sizeof(double)+sizeof(int))+
+    n*(double) n*sizeof(int);
+  fitted_memory = (lnz+unz)*(sizeof(double)+sizeof(int))+
+    (lnz+unz)*(double) sizeof(int);
+
+  printf("Equations:                   %d\n",n);
+  printf("nnz(A):                      %d (%.3g%% of n^2)\n",nnz,100.0*nnz/n/(double) n);
+  printf("Missing diagonal entries:    %d\n",missing_diagonal);
+  printf("nnz(L+U):                    %d (fill factor %.3g)\n",lnz+unz-n,(lnz+unz-n)/(double) nnz);
+  printf("Flops per factorisation:     %.4g\n",flops);
+  printf("Flops per solve:             %.4g\n",2.0*(lnz+unz));
+  printf("numjac column groups:        %d (derivs calls per Jacobian)\n",groups);
+  printf("Factors as allocated:        %.4g MB\n",dense_memory/1048576.0);
+  printf("Factors and reach, fitted:   %.4g MB\n",fitted_memory/1048576.0);
+
+  stats[0] = n; stats[1] = nnz; stats[2] = lnz; stats[3] = unz; stats[4] = flops;
+  stats[5] = 2.0*(lnz+unz); stats[6] = groups; stats[7] = dense_memory;
+  stats[8] = fitted_memory;
+  mat_create_file(outf);
+  mat_add_matrix(outf,"stats",miDOUBLE,1,9,&handle);
+  mat_add_matrix(outf,"Ap",miINT32,1,n+1,&handle);
+  mat_add_matrix(outf,"Ai",miINT32,1,nnz,&handle);
+  mat_add_matrix(outf,"amd_order",miINT32,1,n,&handle);
+  mat_add_matrix(outf,"pivot_order",miINT32,1,n,&handle);
+  mat_add_matrix(outf,"Lp",miINT32,1,n+1,&handle);
+  mat_add_matrix(outf,"Li",miINT32,1,lnz,&handle);
+  mat_add_matrix(outf,"Up",miINT32,1,n+1,&handle);
+  mat_add_matrix(outf,"Ui",miINT32,1,unz,&handle);
+  mat_add_matrix(outf,"col_group",miINT32,1,n,&handle);
+  mat_write_data(outf,"stats",stats,0,9);
+  mat_write_data(outf,"Ap",qke_struct.Ap,0,n+1);
+  mat_write_data(outf,"Ai",qke_struct.Ai,0,nnz);
+  mat_write_data(outf,"amd_order",N->q,0,n);
+  mat_write_data(outf,"pivot_order",N->p,0,n);
+  mat_write_data(outf,"Lp",N->L->Ap,0,n+1);
+  mat_write_data(outf,"Li",N->L->Ai,0,lnz);
+  mat_write_data(outf,"Up",N->U->Ap,0,n+1);
+  mat_write_data(outf,"Ui",N->U->Ai,0,unz);
+  mat_write_data(outf,"col_group",col_g,0,n);
+  printf("Pattern, orderings and factors written to %s.\n",outf);
+
+  free(Cp);
+  free(Ci);
+  free(urow);
+  free(col_g);
+  free(filled);
+  sp_mat_free(A);
+  sp_num_free(N);
+  free_qke_param(&qke_struct);
+  return _SUCCESS_;
+}
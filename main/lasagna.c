@@ -6,121 +6,127 @@
 #include "lasagna.h"
 #include <time.h>
 int main(int argc, char **argv) {
-  qke_param qke_struct;
-  double *y_inout;
-  int *interp_idx;
+  struct lasagna_config config;
+  struct lasagna_worker *workers;
+  struct lasagna_sampler sampler;
+  struct ndf15_warm_start latest={0,NULL,0.0};
+  struct lasagna_budget budget;
   ErrorMsg error_message;
-  int i;
-  int func_return;
-  clock_t start, end;
-  double cpu_time_used, elapsed;
-  time_t wtime1, wtime2;
+  int i, threads, next=0, failures=0;
+  FILE *sweep_log=NULL;
+#ifdef _CUDA
+  struct linalg_cuda_batch *gpu_batch=NULL;
+#endif
 
-  EvolverOptions options;
-  extern int evolver_radau5();
-  extern int evolver_ndf15(); 	
-  extern int evolver_rkdp45(); 	
-  int (*generic_evolver)();  
-
-  func_return = input_init_from_arguments(argc, 
-					  argv,
-					  &qke_struct,
-					  error_message);
-  if (func_return == _FAILURE_){
-    printf("\n\nError running input_init_from_arguments\n=>%s\n",error_message);
+  if (lasagna_config_init(argc, argv, &config, error_message) == _FAILURE_){
+    printf("\n\nError running lasagna_config_init\n=>%s\n",error_message);
     return _FAILURE_;
   }
-
-  //Dump jacobian pattern:
-  FILE *jacfile=fopen("jac_anal_Ap.dat","w");
-  for (i=0; i<=qke_struct.neq; i++) fprintf(jacfile,"%d ",qke_struct.Ap[i]);
-  fclose(jacfile);
-  jacfile=fopen("jac_anal_Ai.dat","w");
-  for (i=0; i<qke_struct.Ap[qke_struct.neq]; i++) fprintf(jacfile,"%d ",qke_struct.Ai[i]);
-  fclose(jacfile);
-
-  //  return 0;
-
-  /** Do stuff */
-  y_inout = calloc(qke_struct.neq,sizeof(double));
-  interp_idx = malloc(sizeof(int)*qke_struct.neq);
-  for(i=0; i<qke_struct.neq; i++)
-    interp_idx[i] = 1;
-
-  if(qke_struct.evolver == 0){
-    generic_evolver = evolver_radau5;
+  threads = config.threads;
+  if (config.sweep.runs > 1){
+    if (config.sweep.refine > 0)
+      printf("Sweep on a grid of %d runs, refined %d times, %d at a time.\n",
+	     config.sweep.runs,config.sweep.refine,threads);
+    else
+      printf("Sweep of %d runs, %d at a time.\n",config.sweep.runs,threads);
+    if (input_sweep_log_open(&(config.fc), &(config.sweep), &sweep_log,
+			     error_message) == _FAILURE_){
+      printf("\n\nError running input_sweep_log_open\n=>%s\n",error_message);
+      return _FAILURE_;
+    }
   }
-  else if (qke_struct.evolver == 2){
-    printf("Runge-Kutta evolver\n");
-    generic_evolver = evolver_rkdp45;
+  if (lasagna_sampler_init(&(config.sweep), &sampler, error_message) == _FAILURE_){
+    printf("\n\nError running lasagna_sampler_init\n=>%s\n",error_message);
+    return _FAILURE_;
   }
-  else{
-    generic_evolver = evolver_ndf15;
+  /** The nproc cores are shared by the threads of the sweep, which then
+      start numjac and derivs teams of their own: */
+  if (lasagna_budget_init(&budget, config.nproc, threads, config.pin, error_message) == _FAILURE_){
+    printf("\n\nError running lasagna_budget_init\n=>%s\n",error_message);
+    return _FAILURE_;
   }
-  qke_initial_conditions(qke_struct.T_initial, 
-			 y_inout, 
-			 &qke_struct);
-
-
-  qke_init_output(&qke_struct);
-
-  //Handle options:
-  DefaultEvolverOptions(&options,qke_struct.LinearAlgebraWrapper);
-  options.used_in_output=interp_idx;
-  options.RelTol = qke_struct.rtol;
-  options.AbsTol = qke_struct.abstol;
-  options.t_vec = qke_struct.Tvec; 
-  options.tres = qke_struct.Tres;
-  options.Ap = qke_struct.Ap;
-  options.Ai = qke_struct.Ai;
-  options.output = qke_store_output;
-  //  options.print_variables = qke_print_L;
-  //  options.stop_function = qke_stop_at_L;
-  if(qke_struct.T_wait >=0) options.stop_function = qke_stop_at_divL;
-  options.EvolverVerbose=qke_struct.verbose;
-  options.Cores = qke_struct.nproc;
-
-  printf("theta: %g\n",qke_struct.theta_zero);
-  start = clock();  
-  time(&wtime1);
-  if (qke_struct.fixed_grid == 0){
-    func_return = generic_evolver(qke_derivs,
-				  &qke_struct,
-				  qke_struct.T_initial,
-				  qke_struct.T_final,
-				  y_inout, 
-				  qke_struct.neq, 
-				  &(options),
-				  error_message);
+#ifdef _OPENMP
+  if (threads > 1)
+    omp_set_max_active_levels(3);
+#endif
+  workers = calloc(threads,sizeof(struct lasagna_worker));
+  for (i=0; i<threads; i++){
+    lasagna_worker_init(workers+i);
+    workers[i].latest = &latest;
+    workers[i].budget = &budget;
   }
-  else{
-    func_return = generic_evolver(qke_derivs_fixed_grid,
-				  &qke_struct,
-				  qke_struct.T_initial,
-				  qke_struct.T_final,
-				  y_inout, 
-				  qke_struct.neq, 
-				  &(options),
-				  error_message);
+#ifdef _CUDA
+  /** With the GPU wrapper, the iteration matrices of the threads are
+      factorised together: */
+  if (threads > 1){
+    if (linalg_cuda_batch_alloc(&gpu_batch, threads, error_message) == _FAILURE_){
+      printf("\n\nError running linalg_cuda_batch_alloc\n=>%s\n",error_message);
+      return _FAILURE_;
+    }
+    for (i=0; i<threads; i++)
+      workers[i].linalg_shared = gpu_batch;
   }
-  end = clock();
-  time(&wtime2);  
-  cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-  printf("CPU time used: %g minutes.\n",cpu_time_used/60);
-  elapsed = difftime(wtime2,wtime1);
-  printf("Wall clock time used: %g minutes.\n",elapsed/60);
-      
-  
-  free(y_inout);
-  free(interp_idx);
-  free_qke_param(&qke_struct);
-
-
-  if (func_return == _FAILURE_){
-    printf("%s\n",error_message);
-    return _FAILURE_;
+#endif
+  /** The runs share the configuration. Each thread has its
+      own worker, and takes the next run of the level from the queue when it
+      is done, so slow points do not hold up the others. The next level of
+      sweep_refine depends on the outcomes of the whole level: */
+  while (sampler.count > 0){
+    next = 0;
+    lasagna_budget_level(&budget, sampler.count);
+#pragma omp parallel num_threads(threads) if(threads>1) reduction(+:failures)
+    {
+      struct lasagna_worker *worker=workers;
+      struct lasagna_result result;
+      ErrorMsg run_message;
+      int run;
+#ifdef _OPENMP
+      worker = workers+omp_get_thread_num();
+#endif
+      for (;;){
+#pragma omp atomic capture
+	run = next++;
+	if (run >= sampler.count)
+	  break;
+	run = sampler.runs[run];
+	if (lasagna_run(&config, run, worker, &result, run_message) == _FAILURE_){
+	  printf("%s\n",run_message);
+	  if (config.sweep.runs > 1)
+	    printf("Run %d of the sweep failed.\n",run);
+	  failures++;
+	}
+	lasagna_sampler_result(&sampler, run, result.status, result.budget_exceeded,
+			       result.diverged, result.L_end);
+	if (sweep_log != NULL){
+#pragma omp critical(lasagna_sweep_log)
+	  input_sweep_log_write(sweep_log, &(config.sweep), run, result.status,
+				result.budget_exceeded, result.steps, result.T_end,
+				result.L_end, result.wall_time);
+	}
+      }
+    }
+    if (lasagna_sampler_next_level(&(config.sweep), &sampler, error_message) == _FAILURE_){
+      printf("\n\nError running lasagna_sampler_next_level\n=>%s\n",error_message);
+      return _FAILURE_;
+    }
+    if (sampler.count > 0)
+      printf("Refinement level %d: %d runs.\n",sampler.level,sampler.count);
   }
-  else{
+  for (i=0; i<threads; i++)
+    lasagna_worker_free(workers+i, error_message);
+  free(workers);
+#ifdef _CUDA
+  if (gpu_batch != NULL)
+    linalg_cuda_batch_free(gpu_batch);
+#endif
+  lasagna_sampler_free(&sampler);
+  lasagna_budget_free(&budget);
+  ndf15_warm_start_free(&latest);
+  if (sweep_log != NULL)
+    fclose(sweep_log);
+  lasagna_config_free(&config);
+  if (failures > 0)
+    return _FAILURE_;
+  else
     return _SUCCESS_;
-  }
 }
@@ -67,6 +67,7 @@ int main(int argc, char **argv) {
   options.EvolverVerbose=4;
   options.EvolverVerbose=qke_struct.verbose;
   options.Cores = qke_struct.nproc;
+  options.DerivsThreads = qke_struct.rhs_threads;
 
   printf("is_electron = %d. _TRUE_=%d\n",qke_struct.is_electron,_TRUE_);
   start = clock();  
@@ -0,0 +1,248 @@
+/** @file lasagna_bench.c
+ * Benchmark of the evolvers and linear algebra wrappers on one QKE problem:
+ *   lasagna_bench bench.ini
+ * does the run of the parameter file for every evolver in bench_evolvers,
+ * linalg_wrapper in bench_wrappers and vres in bench_vres, each case in a
+ * process of its own, and writes one line per case to bench_report. The
+ * columns do not change, so the reports of two versions of the code can
+ * be compared line by line.
+ * With bench_L_tol above 0, the final L of every case is compared with the
+ * first case of its vres, and the benchmark fails if they differ by more
+ * than bench_L_tol relative to that L, or if a case is not ok (failed,
+ * crashed or over run_time_budget). The first of bench_evolvers is then
+ * the reference, see make bench_exprb.
+ */
+
+#include "lasagna_bench.h"
+int main(int argc, char **argv) {
+  struct lasagna_config config;
+  struct bench_row row;
+  FileArg report_name;
+  FILE *report;
+  ErrorMsg error_message;
+  int *evolvers, *wrappers, *vres, *has_ref;
+  int n_evolvers, n_wrappers, n_vres, dense_max=800, deviating=0;
+  int e, w, v, found;
+  double L_tol=0.0, *L_ref;
+
+  if (lasagna_config_init(argc, argv, &config, error_message) == _FAILURE_){
+    printf("\n\nError running lasagna_config_init\n=>%s\n",error_message);
+    return _FAILURE_;
+  }
+  if (config.sweep.runs > 1){
+    printf("The benchmark problem in %s is a sweep.\n",config.fc.filename);
+    return _FAILURE_;
+  }
+  if ((parser_read_list_of_integers(&(config.fc),"bench_evolvers",&n_evolvers,
+				    &evolvers,&found,error_message) == _FAILURE_)||
+      (found == _FALSE_)||
+      (parser_read_list_of_integers(&(config.fc),"bench_wrappers",&n_wrappers,
+				    &wrappers,&found,error_message) == _FAILURE_)||
+      (found == _FALSE_)||
+      (parser_read_list_of_integers(&(config.fc),"bench_vres",&n_vres,
+				    &vres,&found,error_message) == _FAILURE_)||
+      (found == _FALSE_)){
+    printf("%s needs bench_evolvers, bench_wrappers and bench_vres.\n",config.fc.filename);
+    return _FAILURE_;
+  }
+  strcpy(report_name,"output/bench.txt");
+  if ((parser_read_int(&(config.fc),"bench_dense_max",&dense_max,&found,
+		       error_message) == _FAILURE_)||
+      (parser_read_string(&(config.fc),"bench_report",&report_name,&found,
+			  error_message) == _FAILURE_)||
+      (parser_read_double(&(config.fc),"bench_L_tol",&L_tol,&found,
+			  error_message) == _FAILURE_)){
+    printf("\n\nError reading %s\n=>%s\n",config.fc.filename,error_message);
+    return _FAILURE_;
+  }
+  report = fopen(report_name,"w");
+  if (report == NULL){
+    printf("Could not open %s.\n",report_name);
+    return _FAILURE_;
+  }
+  fprintf(report,"#lasagna %s, %s, nproc %d\n",_LASAGNA_VERSION_,config.fc.filename,config.nproc);
+  fprintf(report,"#%-7s %-8s %5s %-7s %8s %9s %6s %6s %10s %10s %10s %10s %10s %10s %9s %17s\n",
+	  "evolver","wrapper","vres","status","steps","rhs","jac","lu","derivs","jacobian",
+	  "factorise","solve","output","total","peak_MB","L_end");
+  fflush(report);
+  has_ref = calloc(n_vres,sizeof(int));
+  L_ref = calloc(n_vres,sizeof(double));
+
+  for (e=0; e<n_evolvers; e++){
+    for (w=0; w<n_wrappers; w++){
+      for (v=0; v<n_vres; v++){
+	memset(&row,0,sizeof(struct bench_row));
+	row.evolver = evolvers[e];
+	row.wrapper = wrappers[w];
+	row.vres = vres[v];
+	row.status = _BENCH_SKIPPED_;
+#ifndef _SUPERLU
+	if (row.wrapper == LINALG_WRAPPER_SUPERLU){
+	  lasagna_bench_write(report,&row);
+	  continue;
+	}
+#endif
+	if ((row.wrapper == LINALG_WRAPPER_DENSE_NR)&&(row.vres > dense_max)){
+	  lasagna_bench_write(report,&row);
+	  continue;
+	}
+	printf("Benchmark: evolver %d, linalg_wrapper %d, vres %d.\n",
+	       row.evolver,row.wrapper,row.vres);
+	if ((lasagna_bench_set(&(config.fc),"evolver",row.evolver,error_message) == _FAILURE_)||
+	    (lasagna_bench_set(&(config.fc),"linalg_wrapper",row.wrapper,error_message) == _FAILURE_)||
+	    (lasagna_bench_set(&(config.fc),"vres",row.vres,error_message) == _FAILURE_)||
+	    (lasagna_bench_set(&(config.fc),"timing",_TRUE_,error_message) == _FAILURE_)||
+	    (lasagna_bench_case(&config,&row,error_message) == _FAILURE_)){
+	  printf("\n\nError running the benchmark\n=>%s\n",error_message);
+	  return _FAILURE_;
+	}
+	lasagna_bench_write(report,&row);
+	if (L_tol <= 0.0)
+	  continue;
+	if (row.status != _BENCH_OK_){
+	  printf("This case did not finish, so its L_end is not compared.\n");
+	  deviating++;
+	}
+	else if (has_ref[v] == _FALSE_){
+	  has_ref[v] = _TRUE_;
+	  L_ref[v] = row.L_end;
+	}
+	else if (fabs(row.L_end-L_ref[v]) > L_tol*fabs(L_ref[v])){
+	  printf("L_end %.10e of this case differs from %.10e by more than bench_L_tol.\n",
+		 row.L_end,L_ref[v]);
+	  deviating++;
+	}
+      }
+    }
+  }
+  fclose(report);
+  printf("Benchmark written to %s.\n",report_name);
+  free(evolvers);
+  free(wrappers);
+  free(vres);
+  free(has_ref);
+  free(L_ref);
+  lasagna_config_free(&config);
+  if (deviating > 0){
+    printf("%d cases did not finish or differ from the first case of their vres in L_end.\n",
+	   deviating);
+    return _FAILURE_;
+  }
+  return _SUCCESS_;
+}
+
+int lasagna_bench_set(struct file_content *pfc,
+		      char *name,
+		      int value,
+		      ErrorMsg error_message){
+  /** Sets an integer parameter of the problem. It has to be in the file,
+      since the file_content has no room for more. */
+  int i;
+  for (i=0; i<pfc->size; i++){
+    if (strcmp(pfc->name[i],name) == 0){
+      sprintf(pfc->value[i],"%d",value);
+      return _SUCCESS_;
+    }
+  }
+  sprintf(error_message,"%s is not set in %s.",name,pfc->filename);
+  return _FAILURE_;
+}
+
+int lasagna_bench_case(struct lasagna_config *config,
+		       struct bench_row *row,
+		       ErrorMsg error_message){
+  /** Does the run of config in a child process, so that every case starts
+      from the same state and has a peak memory of its own, and a case that
+      crashes does not end the benchmark. The child sends its row back
+      through a pipe, and the peak memory comes from wait4. */
+  struct lasagna_worker worker;
+  struct lasagna_result result;
+  struct bench_row child;
+  struct rusage usage;
+  ErrorMsg run_message;
+  double start;
+  int fd[2], status, i;
+  ssize_t got;
+  pid_t pid;
+
+  lasagna_test(pipe(fd) != 0, error_message, "Could not open a pipe for the benchmark.");
+  fflush(stdout);
+  pid = fork();
+  lasagna_test(pid < 0, error_message, "Could not fork the benchmark case.");
+  if (pid == 0){
+    close(fd[0]);
+    child = *row;
+    lasagna_worker_init(&worker);
+    start = evolver_clock();
+    if (lasagna_run(config, 0, &worker, &result, run_message) == _FAILURE_){
+      printf("%s\n",run_message);
+      child.status = _BENCH_FAILED_;
+    }
+    else if (result.budget_exceeded == _TRUE_)
+      child.status = _BENCH_BUDGET_;
+    else
+      child.status = _BENCH_OK_;
+    child.total = evolver_clock()-start;
+    child.steps = worker.options.Stats[0];
+    child.L_end = result.L_end;
+    child.rhs = worker.options.Stats[2];
+    child.jacobians = worker.options.Stats[3];
+    child.lu = worker.options.Stats[4];
+    for (i=0; i<_EVOLVER_TIMERS_; i++)
+      child.time[i] = worker.options.Time[i];
+    got = write(fd[1],&child,sizeof(struct bench_row));
+    close(fd[1]);
+    fflush(stdout);
+    _exit(got == sizeof(struct bench_row) ? 0 : 1);
+  }
+  close(fd[1]);
+  got = read(fd[0],&child,sizeof(struct bench_row));
+  close(fd[0]);
+  lasagna_test(wait4(pid,&status,0,&usage) != pid, error_message,
+	       "Lost the process of the benchmark case.");
+  if ((got == sizeof(struct bench_row))&&WIFEXITED(status)&&(WEXITSTATUS(status) == 0))
+    *row = child;
+  else
+    row->status = _BENCH_CRASHED_;
+  row->peak = usage.ru_maxrss/1024.0;
+  return _SUCCESS_;
+}
+
+int lasagna_bench_write(FILE *report,
+			struct bench_row *row){
+  /** Writes the row to the report and to stdout. Cases that did not run
+      have - in the columns of the run. */
+  char *evolver[5] = {"radau5","ndf15","rkdp45","rosw","exprb"};
+  char *wrapper[8] = {"dense","sparse","SuperLU","supnodal","gmres","lapack","cuda","block"};
+  char *status[5] = {"ok","failed","budget","skipped","crashed"};
+  char line[_LINE_LENGTH_MAX_];
+  int i, n;
+
+  n = sprintf(line,"%-8s %-8s %5d %-7s",
+	      ((row->evolver >= 0)&&(row->evolver < 5) ? evolver[row->evolver] : "?"),
+	      ((row->wrapper >= 0)&&(row->wrapper < 8) ? wrapper[row->wrapper] : "?"),
+	      row->vres,status[row->status]);
+  if ((row->status == _BENCH_SKIPPED_)||(row->status == _BENCH_CRASHED_)){
+    n += sprintf(line+n," %8s %9s %6s %6s","-","-","-","-");
+    for (i=0; i<=_EVOLVER_TIMERS_; i++)
+      n += sprintf(line+n," %10s","-");
+  }
+  else{
+    n += sprintf(line+n," %8d %9d %6d %6d",row->steps,row->rhs,row->jacobians,row->lu);
+    for (i=0; i<_EVOLVER_TIMERS_; i++)
+      n += sprintf(line+n," %10.3f",row->time[i]);
+    n += sprintf(line+n," %10.3f",row->total);
+  }
+  if (row->status == _BENCH_SKIPPED_)
+    n += sprintf(line+n," %9s","-");
+  else
+    n += sprintf(line+n," %9.1f",row->peak);
+  if ((row->status == _BENCH_SKIPPED_)||(row->status == _BENCH_CRASHED_))
+    sprintf(line+n," %17s","-");
+  else
+    sprintf(line+n," %17.10e",row->L_end);
+  fprintf(report,"%s\n",line);
+  fflush(report);
+  printf("%s\n",line);
+  return _SUCCESS_;
+}
@@ -16,6 +16,7 @@ int main(int argc, char **argv) {
   time_t wtime1, wtime2;
 
   EvolverOptions options;
+  char progress_file[_FILENAMESIZE_+10];
   extern int evolver_radau5();
   extern int evolver_ndf15(); 	
   extern int evolver_rkdp45(); 	
@@ -42,7 +43,7 @@ int main(int argc, char **argv) {
   //  return 0;
 
   /** Do stuff */
-  y_inout = calloc(2*lya_struct.neq,sizeof(double));
+  y_inout = calloc((1+lya_struct.lyapunov_vectors)*lya_struct.neq,sizeof(double));
   interp_idx = malloc(sizeof(int)*2*lya_struct.neq);
   for(i=0; i<2*lya_struct.neq; i++)
     interp_idx[i] = 1;
@@ -63,7 +64,8 @@ int main(int argc, char **argv) {
 			    &lya_struct);
 
 
-  lya_init_output(&lya_struct);
+  if (lya_init_output(&lya_struct) == _FAILURE_)
+    return _FAILURE_;
 
   //Handle options:
   DefaultEvolverOptions(&options,lya_struct.LinearAlgebraWrapper);
@@ -80,7 +82,31 @@ int main(int argc, char **argv) {
   if(lya_struct.T_wait >= 0)  options.stop_function = lya_stop_at_divL;
   options.EvolverVerbose=lya_struct.verbose;
   options.Cores = lya_struct.nproc;
-  options.J_pointer_flag = _TRUE_;
+  options.DerivsThreads = lya_struct.rhs_threads;
+  options.derivs_workspace_copy = lya_copy_workspace;
+  options.derivs_batch = lya_derivs_batch;
+  options.derivs_workspace_free = lya_free_workspace;
+  if (lya_struct.tangent_linear == _TRUE_){
+    options.tangent = y_inout+lya_struct.neq;
+    options.tangent_output = lya_struct.tangent;
+    options.Tangents = lya_struct.lyapunov_vectors;
+    options.TangentQR = lya_struct.lyapunov_qr;
+    options.tangent_weight = lya_struct.tangent_weight;
+    options.tangent_growth = lya_struct.tangent_growth;
+  }
+  else
+    options.J_pointer_flag = _TRUE_;
+  if (lya_struct.symbolic_cache[0] != '\0')
+    options.SymbolicCache = lya_struct.symbolic_cache;
+  options.MixedPrecision = lya_struct.mixed_precision;
+  options.LowMemory = lya_struct.low_memory;
+  if (lya_struct.progress_interval > 0.0){
+    sprintf(progress_file,"%s.progress",lya_struct.output_filename);
+    options.ProgressFile = progress_file;
+    options.ProgressInterval = lya_struct.progress_interval;
+    options.ProgressIndex = lya_struct.index_L;
+    options.ProgressScale = _L_SCALE_;
+  }
   lya_struct.J_pp = &(options.J_pointer);
 
   printf("theta: %g\n",lya_struct.theta_zero);
@@ -91,16 +117,23 @@ int main(int argc, char **argv) {
 				lya_struct.T_initial,
 				lya_struct.T_final,
 				y_inout, 
-				2*lya_struct.neq, 
+				(lya_struct.tangent_linear == _TRUE_ ? 1 : 2)*lya_struct.neq, 
 				&(options),
 				error_message);
 
+  //Write the buffered output points, also when a stop function has fired:
+  if ((mat_writer_close(&(lya_struct.writer)) == _FAILURE_)&&
+      (func_return == _SUCCESS_)){
+    sprintf(error_message,"Writing to %s failed.",lya_struct.output_filename);
+    func_return = _FAILURE_;
+  }
   end = clock();
   time(&wtime2);  
   cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
   printf("CPU time used: %g minutes.\n",cpu_time_used/60);
   elapsed = difftime(wtime2,wtime1);
   printf("Wall clock time used: %g minutes.\n",elapsed/60);
+  printf("Peak memory: %.1f MB.\n",evolver_peak_memory());
       
   
   free(y_inout);
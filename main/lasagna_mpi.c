@@ -0,0 +1,178 @@
+/** @file lasagna_mpi.c 
+ * MPI driver for sweeps: rank 0 hands out the runs of the sweep one at a
+ * time and collects their summaries in <output_filename>.sweep, the other
+ * ranks do the runs. With sweep_refine, rank 0 hands out the runs one level
+ * at a time. The status of a run in the table is ok, budget or failed. A
+ * failed run has the steps, T_end and L_end of its last accepted step, or
+ * - for T_end and L_end if it failed before its first one.
+ */
+ 
+#include "lasagna_mpi.h"
+int main(int argc, char **argv) {
+  struct lasagna_config config;
+  ErrorMsg error_message;
+  int rank, size, func_return;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  if (lasagna_config_init(argc, argv, &config, error_message) == _FAILURE_){
+    if (rank == 0)
+      printf("\n\nError running lasagna_config_init\n=>%s\n",error_message);
+    MPI_Finalize();
+    return _FAILURE_;
+  }
+  if (rank == 0){
+    if (config.sweep.refine > 0)
+      printf("Sweep on a grid of %d runs, refined %d times, on %d ranks.\n",
+	     config.sweep.runs,config.sweep.refine,max(size-1,1));
+    else
+      printf("Sweep of %d runs on %d ranks.\n",config.sweep.runs,max(size-1,1));
+    func_return = lasagna_mpi_master(&config, size, error_message);
+  }
+  else
+    func_return = lasagna_mpi_worker(&config, error_message);
+  if (func_return == _FAILURE_)
+    printf("Rank %d: %s\n",rank,error_message);
+
+  lasagna_config_free(&config);
+  MPI_Finalize();
+  return func_return;
+}
+
+int lasagna_mpi_failed(int run,
+		       int rank,
+		       int steps,
+		       double T_end){
+  /** Reports a failed run of the sweep on rank 0, with the T of its last
+      accepted step. */
+  if (steps == 0)
+    printf("Run %d of the sweep failed on rank %d, before its first step.\n",run,rank);
+  else
+    printf("Run %d of the sweep failed on rank %d after %d steps, at T=%g.\n",
+	   run,rank,steps,T_end);
+  return _SUCCESS_;
+}
+
+int lasagna_mpi_master(struct lasagna_config *config,
+		       int size,
+		       ErrorMsg error_message){
+  /** Gives the next run to the rank that reports back, until all runs are
+      done. A single rank does all runs itself. The ranks that report back
+      while the runs of a level are still out wait for the next level. */
+  double summary[_MPI_SUMMARY_];
+  struct lasagna_worker worker;
+  struct lasagna_result result;
+  struct lasagna_sampler sampler;
+  MPI_Status status;
+  FILE *sweep_log;
+  int *idle;
+  struct file_content *pfc=&(config->fc);
+  struct sweep_content *psw=&(config->sweep);
+  int i, run, next=0, pending=0, waiting=0, active=size-1, failures=0;
+
+  lasagna_call(input_sweep_log_open(pfc, psw, &sweep_log, error_message),
+	       error_message, error_message);
+  lasagna_call(lasagna_sampler_init(psw, &sampler, error_message),
+	       error_message, error_message);
+  if (size == 1){
+    lasagna_worker_init(&worker);
+    while (sampler.count > 0){
+      for (i=0; i<sampler.count; i++){
+	run = sampler.runs[i];
+	if (lasagna_run(config, run, &worker, &result, error_message) == _FAILURE_){
+	  printf("%s\n",error_message);
+	  lasagna_mpi_failed(run, 0, result.steps, result.T_end);
+	  failures++;
+	}
+	lasagna_sampler_result(&sampler, run, result.status, result.budget_exceeded,
+			       result.diverged, result.L_end);
+	input_sweep_log_write(sweep_log, psw, run, result.status,
+			      result.budget_exceeded, result.steps, result.T_end,
+			      result.L_end, result.wall_time);
+      }
+      lasagna_call(lasagna_sampler_next_level(psw, &sampler, error_message),
+		   error_message, error_message);
+    }
+    lasagna_call(lasagna_worker_free(&worker, error_message),
+		 error_message, error_message);
+  }
+  lasagna_alloc(idle, sizeof(int)*size, error_message);
+  while (active > 0){
+    MPI_Recv(summary, _MPI_SUMMARY_, MPI_DOUBLE, MPI_ANY_SOURCE, _MPI_TAG_RESULT_,
+	     MPI_COMM_WORLD, &status);
+    if (summary[0] >= 0){
+      pending--;
+      if ((int)summary[1] == _FAILURE_){
+	lasagna_mpi_failed((int)summary[0], status.MPI_SOURCE, (int)summary[3], summary[4]);
+	failures++;
+      }
+      lasagna_sampler_result(&sampler, (int)summary[0], (int)summary[1], (int)summary[2],
+			     (int)summary[7], summary[5]);
+      input_sweep_log_write(sweep_log, psw, (int)summary[0], (int)summary[1],
+			    (int)summary[2], (int)summary[3], summary[4],
+			    summary[5], summary[6]);
+    }
+    idle[waiting++] = status.MPI_SOURCE;
+    if ((next == sampler.count)&&(pending == 0)&&(sampler.count > 0)){
+      lasagna_call(lasagna_sampler_next_level(psw, &sampler, error_message),
+		   error_message, error_message);
+      next = 0;
+      if (sampler.count > 0)
+	printf("Refinement level %d: %d runs.\n",sampler.level,sampler.count);
+    }
+    while (waiting > 0){
+      if (next < sampler.count){
+	run = sampler.runs[next++];
+	pending++;
+      }
+      else if (sampler.count == 0){
+	run = -1;
+	active--;
+      }
+      else
+	break;
+      MPI_Send(&run, 1, MPI_INT, idle[--waiting], _MPI_TAG_RUN_, MPI_COMM_WORLD);
+    }
+  }
+  free(idle);
+  lasagna_sampler_free(&sampler);
+  fclose(sweep_log);
+  lasagna_test(failures > 0, error_message, "%d runs of the sweep failed.",failures);
+  return _SUCCESS_;
+}
+
+int lasagna_mpi_worker(struct lasagna_config *config,
+		       ErrorMsg error_message){
+  /** Asks rank 0 for runs and sends back their summaries. The ndf15
+      context, and with sweep_warm_start the start of the last run, is kept
+      between the runs. */
+  double summary[_MPI_SUMMARY_];
+  struct lasagna_worker worker;
+  struct lasagna_result result;
+  ErrorMsg run_message;
+  int run;
+
+  lasagna_worker_init(&worker);
+  summary[0] = -1;
+  for (;;){
+    MPI_Send(summary, _MPI_SUMMARY_, MPI_DOUBLE, 0, _MPI_TAG_RESULT_, MPI_COMM_WORLD);
+    MPI_Recv(&run, 1, MPI_INT, 0, _MPI_TAG_RUN_, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (run < 0)
+      break;
+    if (lasagna_run(config, run, &worker, &result, run_message) == _FAILURE_)
+      printf("Run %d: %s\n",run,run_message);
+    summary[0] = run;
+    summary[1] = result.status;
+    summary[2] = result.budget_exceeded;
+    summary[3] = result.steps;
+    summary[4] = result.T_end;
+    summary[5] = result.L_end;
+    summary[6] = result.wall_time;
+    summary[7] = result.diverged;
+  }
+  lasagna_call(lasagna_worker_free(&worker, error_message),
+	       error_message, error_message);
+  return _SUCCESS_;
+}
@@ -0,0 +1,56 @@
+#include "query_history.h"
+/** Evaluates the dense output of an ndf15 run at other points, from the
+    step history written with store_history = 1:
+    query_history <history file> <t_start> <t_end> <points> [output file]
+    writes t and the stored components of y at points values of t from 
+    t_start to t_end, one line each. The first line lists the indices of 
+    the components in y. */
+int main(int argc, char *argv[]){
+  struct ndf15_history history;
+  ErrorMsg error_message;
+  double t, t_start, t_end, *y, *dy;
+  int i, j, points;
+  FILE *datfile=stdout;
+
+  if (argc < 5){
+    printf("Usage: %s <history file> <t_start> <t_end> <points> [output file]\n",argv[0]);
+    return _FAILURE_;
+  }
+  t_start = atof(argv[2]);
+  t_end = atof(argv[3]);
+  points = atoi(argv[4]);
+  if (ndf15_history_open(&history,argv[1],error_message) == _FAILURE_){
+    printf("Error: %s\n",error_message);
+    return _FAILURE_;
+  }
+  if (argc > 5){
+    datfile = fopen(argv[5],"w");
+    if (datfile == NULL){
+      printf("Could not open file: %s for output!\n",argv[5]);
+      return _FAILURE_;
+    }
+  }
+  y = malloc(sizeof(double)*history.n);
+  dy = malloc(sizeof(double)*history.n);
+  fprintf(datfile,"%% t");
+  for (j=0; j<history.n; j++)
+    fprintf(datfile," y[%d]",history.components[j]);
+  fprintf(datfile,"\n");
+  for (i=0; i<points; i++){
+    t = (points > 1 ? t_start+(t_end-t_start)*i/(points-1.0) : t_start);
+    if (ndf15_history_eval(&history,t,y,dy,error_message) == _FAILURE_){
+      printf("Error: %s\n",error_message);
+      return _FAILURE_;
+    }
+    fprintf(datfile,"%.16e",t);
+    for (j=0; j<history.n; j++)
+      fprintf(datfile," %.16e",y[j]);
+    fprintf(datfile,"\n");
+  }
+  if (datfile != stdout)
+    fclose(datfile);
+  free(y);
+  free(dy);
+  ndf15_history_close(&history);
+  return _SUCCESS_;
+}
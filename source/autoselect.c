@@ -0,0 +1,393 @@
+/** @file autoselect.c
+ * Choice of evolver and linalg_wrapper before a run. With linalg_wrapper
+ * = -1, the wrappers built into the code are ranked by a symbolic analysis
+ * of the Jacobian pattern, which predicts the peak memory of the run and
+ * the flops of its factorisations, and those that fit in memory_limit are
+ * timed on the Jacobian of the initial state if that is quick, see
+ * _SELECT_PROBE_FLOPS_. Otherwise the one with the fewest flops is taken.
+ * With evolver = -1, the run
+ * is done by ndf15, or by exprb, which needs no factorisation, if ndf15 does
+ * not fit with any wrapper. With memory_limit set, a run with a fixed
+ * choice stops before it starts if it is predicted not to fit.
+ */
+#include "autoselect.h"
+
+int lasagna_select(qke_param *pqke,
+		   double *y,
+		   int runs,
+		   ErrorMsg error_message){
+  /** Sets pqke->evolver and pqke->LinearAlgebraWrapper if they are to be
+      chosen, and prints the predicted peak memory of the run. runs is the
+      number of runs sharing the memory of the machine. y is the initial
+      state, for the Jacobian of the probe. */
+  struct lasagna_pattern pattern;
+  struct lasagna_candidate candidate[_SELECT_WRAPPERS_];
+  EvolverOptions options;
+  LinAlgWrapper wrapper[_SELECT_WRAPPERS_]={LINALG_WRAPPER_SPARSE,
+					    LINALG_WRAPPER_SUPERNODAL,
+					    LINALG_WRAPPER_SUPERLU,
+					    LINALG_WRAPPER_DENSE_NR,
+					    LINALG_WRAPPER_DENSE};
+  char *name[8]={"dense","sparse","SuperLU","supernodal","gmres","lapack","cuda","block"};
+  double limit, flops_min=-1.0, best_seconds=-1.0, memory=0.0;
+  int candidates=0, fitting=0, probes=0, best=-1, fallback, i;
+  int evolver=pqke->evolver;
+
+  //The IMEX mode has a linear algebra of its own:
+  if (pqke->imex == _TRUE_)
+    return _SUCCESS_;
+  limit = lasagna_select_limit(pqke, runs);
+  lasagna_call(lasagna_select_pattern(pqke, &pattern, error_message),
+	       error_message, error_message);
+  /** ndf15 may give way to exprb unless the run needs what only ndf15 or
+      radau5 do: */
+  fallback = ((pqke->evolver_auto == _TRUE_)&&(pqke->events == _FALSE_)&&
+	      (pqke->checkpoint_interval == 0)&&(pqke->restart == _FALSE_)&&
+	      (pqke->store_history == _FALSE_)&&(pqke->grid_levels == 0)&&
+	      (pqke->sweep_warm_start == _FALSE_));
+
+  if ((evolver == 1)||(evolver == 0)||(evolver == 3)){
+    for (i=0; i<_SELECT_WRAPPERS_; i++){
+      if ((pqke->linalg_auto == _FALSE_)&&(wrapper[i] != pqke->LinearAlgebraWrapper))
+	continue;
+      DefaultEvolverOptions(&options, wrapper[i]);
+      candidate[candidates].wrapper = wrapper[i];
+      candidate[candidates].available = (options.linalg_initialise != NULL ? _TRUE_ : _FALSE_);
+      candidate[candidates].memory = lasagna_select_memory(&pattern, evolver, wrapper[i]);
+      if ((wrapper[i] == LINALG_WRAPPER_DENSE_NR)||(wrapper[i] == LINALG_WRAPPER_DENSE))
+	candidate[candidates].flops = 2.0/3.0*pattern.n*pattern.n*(double) pattern.n;
+      else
+	candidate[candidates].flops = pattern.flops;
+      //radau5 factorises a complex matrix as well, at four times the flops of the real one:
+      if (evolver == 0)
+	candidate[candidates].flops *= 5.0;
+      candidate[candidates].seconds = -1.0;
+      if ((candidate[candidates].available == _TRUE_)&&(candidate[candidates].memory <= limit)){
+	fitting++;
+	if ((flops_min < 0.0)||(candidate[candidates].flops < flops_min))
+	  flops_min = candidate[candidates].flops;
+      }
+      candidates++;
+    }
+    //The probe, if there is a choice:
+    if ((pqke->linalg_auto == _TRUE_)&&(fitting > 1)){
+      for (i=0; i<candidates; i++){
+	if ((candidate[i].available == _TRUE_)&&(candidate[i].memory <= limit)&&
+	    (candidate[i].flops <= _SELECT_FLOP_RATIO_*flops_min)&&
+	    ((_SELECT_REPEATS_+1)*candidate[i].flops <= _SELECT_PROBE_FLOPS_)){
+	  candidate[i].seconds = 0.0;
+	  probes++;
+	}
+      }
+      if (probes > 1){
+	lasagna_call(lasagna_select_probe(pqke, y, candidate, candidates, error_message),
+		     error_message, error_message);
+      }
+      else{
+	for (i=0; i<candidates; i++)
+	  candidate[i].seconds = -1.0;
+      }
+    }
+    //The fastest of those probed, or without a probe the fewest flops:
+    for (i=0; i<candidates; i++){
+      if ((candidate[i].available == _FALSE_)||(candidate[i].memory > limit))
+	continue;
+      if ((best == -1)||
+	  ((candidate[i].seconds >= 0.0)&&
+	   ((best_seconds < 0.0)||(candidate[i].seconds < best_seconds)))||
+	  ((candidate[i].seconds < 0.0)&&(best_seconds < 0.0)&&
+	   (candidate[i].flops < candidate[best].flops))){
+	best = i;
+	best_seconds = candidate[i].seconds;
+      }
+    }
+    if (pqke->verbose > 0){
+      printf("%-11s %10s %12s %12s\n","wrapper","peak_MB","flops/step","s/step");
+      for (i=0; i<candidates; i++){
+	printf("%-11s %10.1f %12.3e",name[candidate[i].wrapper],candidate[i].memory,candidate[i].flops);
+	if (candidate[i].available == _FALSE_)
+	  printf(" %12s\n","not built");
+	else if (candidate[i].seconds >= 0.0)
+	  printf(" %12.4e\n",candidate[i].seconds);
+	else
+	  printf(" %12s\n","-");
+      }
+    }
+    if (best >= 0){
+      pqke->LinearAlgebraWrapper = candidate[best].wrapper;
+      memory = candidate[best].memory;
+    }
+    else if (fallback == _TRUE_){
+      printf("The factorisations of %s do not fit in %.0f MB, so the run uses exprb.\n",
+	     (evolver == 0 ? "radau5" : "ndf15"),limit);
+      evolver = 4;
+    }
+    else{
+      for (i=0, memory=-1.0; i<candidates; i++)
+	if ((candidate[i].available == _TRUE_)&&((memory < 0.0)||(candidate[i].memory < memory)))
+	  memory = candidate[i].memory;
+      sprintf(error_message,"The predicted peak memory of the run, %.0f MB, is above the limit of %.0f MB.",
+	      memory,limit);
+      return _FAILURE_;
+    }
+  }
+  if ((evolver == 2)||(evolver == 4)){
+    //exprb only keeps J, in the storage of the wrapper, and sparse is the smaller:
+    if ((evolver == 4)&&(pqke->linalg_auto == _TRUE_))
+      pqke->LinearAlgebraWrapper = LINALG_WRAPPER_SPARSE;
+    memory = lasagna_select_memory(&pattern, evolver, pqke->LinearAlgebraWrapper);
+    lasagna_test(memory > limit, error_message,
+		 "The predicted peak memory of the run, %.0f MB, is above the limit of %.0f MB.",
+		 memory,limit);
+  }
+  pqke->evolver = evolver;
+  if ((pqke->verbose > 0)||(pqke->evolver_auto == _TRUE_)||(pqke->linalg_auto == _TRUE_))
+    printf("Evolver %d, linalg_wrapper %d: predicted peak memory %.1f MB of %.0f MB.\n",
+	   pqke->evolver,pqke->LinearAlgebraWrapper,memory,limit);
+  return _SUCCESS_;
+}
+
+int lasagna_select_pattern(qke_param *pqke,
+			   struct lasagna_pattern *pattern,
+			   ErrorMsg error_message){
+  /** The ordering of the sparse wrapper, sp_amd on A+A^T, and the column
+      counts of the Cholesky factor of A+A^T in that order. The resident
+      memory of the process is read from /proc, Linux only, and is 0
+      elsewhere. */
+  int n=pqke->neq, *Cp, *Ci, *P, *W, *count, k;
+  long pages;
+  FILE *statm;
+
+  pattern->n = n;
+  pattern->nnz = pqke->Ap[n];
+  pattern->numjac = (pqke->analytic_jacobian != 1 ? _TRUE_ : _FALSE_);
+  pattern->low_memory = pqke->low_memory;
+  lasagna_call(get_pattern_A_plus_AT(pqke->Ap, pqke->Ai, n, &Cp, &Ci, error_message),
+	       error_message, error_message);
+  lasagna_alloc(P,sizeof(int)*(n+1),error_message);
+  lasagna_alloc(W,sizeof(int)*8*(n+1),error_message);
+  lasagna_alloc(count,sizeof(int)*n,error_message);
+  sp_amd(Cp, Ci, n, Cp[n], P, W);
+  //sp_amd works in the pattern, so it is made again:
+  free(Cp);
+  free(Ci);
+  lasagna_call(get_pattern_A_plus_AT(pqke->Ap, pqke->Ai, n, &Cp, &Ci, error_message),
+	       error_message, error_message);
+  pattern->lnz = sp_symbolic_colcount(Cp, Ci, n, P, W, count);
+  for (k=0, pattern->flops=0.0; k<n; k++)
+    pattern->flops += (count[k]-1.0)*(2.0*count[k]-1.0);
+  //The longest row of the Jacobian:
+  memset(count,0,sizeof(int)*n);
+  for (k=0; k<pattern->nnz; k++)
+    count[pqke->Ai[k]]++;
+  for (k=0, pattern->rowmax=0; k<n; k++)
+    pattern->rowmax = max(pattern->rowmax,count[k]);
+  free(Cp);
+  free(Ci);
+  free(P);
+  free(W);
+  free(count);
+
+  pattern->base = 0.0;
+  statm = fopen("/proc/self/statm","r");
+  if (statm != NULL){
+    if (fscanf(statm,"%*s %ld",&pages) == 1)
+      pattern->base = pages*(double) sysconf(_SC_PAGESIZE)/1048576.0;
+    fclose(statm);
+  }
+  return _SUCCESS_;
+}
+
+double lasagna_select_memory(struct lasagna_pattern *pattern,
+			     int evolver,
+			     int wrapper){
+  /** Predicted peak of the run in MB: the resident memory before it, the
+      Jacobian in the storage of the wrapper with the copies of its pattern
+      and the numjac work of a dense one, and for the evolvers
+      that factorise, the iteration matrices and their factors, one real
+      for ndf15 and Rosenbrock-W, and a complex one as well for radau5. The
+      factors have the nnz of the symbolic analysis; a matrix with much
+      pivoting has more. _SELECT_MEMORY_MARGIN_ covers what is left out. */
+  double n=pattern->n, nnz=pattern->nnz, lnz=pattern->lnz, fill=2.0*lnz-n;
+  double bytes, size, page=sysconf(_SC_PAGESIZE);
+  int dense=((wrapper == LINALG_WRAPPER_DENSE_NR)||(wrapper == LINALG_WRAPPER_DENSE));
+  int systems, k;
+
+  //State vectors and the work of the evolver:
+  bytes = 32.0*sizeof(double)*n;
+  if (evolver == 2)
+    return (pattern->base+_SELECT_MEMORY_MARGIN_*bytes/1048576.0);
+  //J, and the pattern in qke_param, the worker and the ndf15 context:
+  if (dense)
+    bytes += sizeof(double)*n*n+3.0*sizeof(int)*nnz;
+  else
+    bytes += (sizeof(double)+3.0*sizeof(int))*nnz;
+  //numjac writes the columns of a dense Jacobian in an n by n array, the
+  //sparse one is scattered a group at a time:
+  if ((pattern->numjac == _TRUE_)&&(dense))
+    bytes += sizeof(double)*n*n;
+  if (evolver == 4)
+    return (pattern->base+_SELECT_MEMORY_MARGIN_*
+	    (bytes+sizeof(double)*n*(_EXPRB_KRYLOV_MAX_+_EXPRB_PHI_MAX_+2))/1048576.0);
+  systems = (evolver == 0 ? 2 : 1);
+  for (k=0; k<systems; k++){
+    size = (k == 0 ? sizeof(double) : sizeof(double complex));
+    switch (wrapper){
+    case (LINALG_WRAPPER_DENSE_NR):
+    case (LINALG_WRAPPER_DENSE):
+      //The matrix and its LU:
+      bytes += 2.0*size*n*n;
+      break;
+    case (LINALG_WRAPPER_SUPERLU):
+      //The matrix, its column permuted copy, and L and U as sized by the wrapper:
+      bytes += 2.0*(size+sizeof(int))*nnz+6.0*(size+sizeof(int))*lnz+2.0*sizeof(int)*lnz;
+      break;
+    case (LINALG_WRAPPER_SUPERNODAL):
+      //As sparse, and the dense blocks of the real factors:
+      if (k == 0)
+	bytes += size*fill;
+      // fall through
+    default:
+      //The matrix, L+U and the reach of each column, a page at least
+      //unless the reach is packed by low_memory:
+      bytes += (size+sizeof(int))*(nnz+fill)+sizeof(int)*fill;
+      if ((wrapper != LINALG_WRAPPER_SPARSE)||(pattern->low_memory == _FALSE_))
+	bytes += n*page;
+      //The sparse wrapper has the complex matrix and factors split as well:
+      if ((wrapper == LINALG_WRAPPER_SPARSE)&&(k == 1)&&(pattern->low_memory == _FALSE_))
+	bytes += size*(nnz+fill);
+      break;
+    }
+  }
+  return (pattern->base+_SELECT_MEMORY_MARGIN_*bytes/1048576.0);
+}
+
+double lasagna_select_limit(qke_param *pqke,
+			    int runs){
+  /** memory_limit, or the memory of the machine shared by the runs going
+      at the same time, in MB. */
+  double pages=sysconf(_SC_PHYS_PAGES), page=sysconf(_SC_PAGESIZE);
+
+  if (pqke->memory_limit > 0.0)
+    return pqke->memory_limit;
+  return (pages*page/1048576.0/max(runs,1));
+}
+
+int lasagna_select_probe(qke_param *pqke,
+			 double *y,
+			 struct lasagna_candidate *candidate,
+			 int candidates,
+			 ErrorMsg error_message){
+  /** Times the candidates with seconds=0 on the iteration matrices of the
+      Jacobian at y, gamma/h-J and, for radau5, (alpha+i*beta)/h-J, with h a
+      hundredth of the run. A step costs a refactorisation and
+      _SELECT_SOLVES_ solves of each matrix, and the first factorisation is
+      not counted, as it is done once per pattern by most wrappers. */
+  EvolverOptions options;
+  MultiMatrix J, A[2], B[2], X[2];
+  void *linalg_workspace;
+  double *Jx, *fval, h, t0, t1;
+  void *values[2], *dense[2], *b[2], *x[2];
+  int n=pqke->neq, nnz=pqke->Ap[n], systems=(pqke->evolver == 0 ? 2 : 1);
+  int nfe=0, i, j, k, p, s;
+  size_t size;
+
+  lasagna_calloc(Jx,nnz,sizeof(double),error_message);
+  lasagna_alloc(fval,sizeof(double)*n,error_message);
+  lasagna_alloc(values[0],sizeof(double)*nnz,error_message);
+  lasagna_alloc(values[1],sizeof(double complex)*nnz,error_message);
+  lasagna_call(CreateMatrix_SCC(&J,L_DBL,n,n,nnz,pqke->Ai,pqke->Ap,Jx,error_message),
+	       error_message,error_message);
+  lasagna_call(qke_jacobian(pqke->T_initial,y,fval,&J,&nfe,pqke,error_message),
+	       error_message,error_message);
+  lasagna_call(CreateMatrix_SCC(&(A[0]),L_DBL,n,n,nnz,pqke->Ai,pqke->Ap,values[0],error_message),
+	       error_message,error_message);
+  lasagna_call(CreateMatrix_SCC(&(A[1]),L_DBL_CX,n,n,nnz,pqke->Ai,pqke->Ap,values[1],error_message),
+	       error_message,error_message);
+  h = fabs(pqke->T_final-pqke->T_initial)/100.0;
+  update_linear_system_radau5(&J,&(A[0]),&(A[1]),h);
+  for (s=0; s<2; s++){
+    size = (s == 0 ? sizeof(double) : sizeof(double complex));
+    lasagna_calloc(b[s],n+1,size,error_message);
+    lasagna_calloc(x[s],n+1,size,error_message);
+    for (i=1; i<=n; i++){
+      if (s == 0)
+	((double *) b[s])[i] = 1.0;
+      else
+	((double complex *) b[s])[i] = 1.0;
+    }
+    lasagna_call(CreateMatrix_DNR(&(B[s]),(s == 0 ? L_DBL : L_DBL_CX),1,n,b[s],error_message),
+		 error_message,error_message);
+    lasagna_call(CreateMatrix_DNR(&(X[s]),(s == 0 ? L_DBL : L_DBL_CX),1,n,x[s],error_message),
+		 error_message,error_message);
+  }
+
+  for (k=0; k<candidates; k++){
+    if (candidate[k].seconds != 0.0)
+      continue;
+    DefaultEvolverOptions(&options, candidate[k].wrapper);
+    options.EvolverVerbose = 0;
+    options.LinAlgVerbose = 0;
+    options.Cores = pqke->nproc;
+    options.MixedPrecision = pqke->mixed_precision;
+    options.LowMemory = pqke->low_memory;
+    options.Ap = pqke->Ap;
+    options.Ai = pqke->Ai;
+    for (s=0; s<systems; s++){
+      dense[s] = NULL;
+      if (options.use_sparse == _FALSE_){
+	//The dense wrappers get the matrix in dense row major storage:
+	size = (s == 0 ? sizeof(double) : sizeof(double complex));
+	lasagna_calloc(dense[s],(size_t) n*n+1,size,error_message);
+	for (j=0; j<n; j++){
+	  for (p=pqke->Ap[j]; p<pqke->Ap[j+1]; p++){
+	    if (s == 0)
+	      ((double *) dense[s])[1+pqke->Ai[p]*n+j] = ((double *) values[s])[p];
+	    else
+	      ((double complex *) dense[s])[1+pqke->Ai[p]*n+j] = ((double complex *) values[s])[p];
+	  }
+	}
+	DestroyMultiMatrix(&(A[s]));
+	lasagna_call(CreateMatrix_DNR(&(A[s]),(s == 0 ? L_DBL : L_DBL_CX),n,n,dense[s],error_message),
+		     error_message,error_message);
+      }
+      lasagna_call(options.linalg_initialise(&(A[s]),&options,&linalg_workspace,error_message),
+		   error_message,error_message);
+      lasagna_call(options.linalg_factorise(linalg_workspace,_LINALG_FROM_SCRATCH_,error_message),
+		   error_message,error_message);
+      t0 = evolver_clock();
+      for (i=0; i<_SELECT_REPEATS_; i++)
+	lasagna_call(options.linalg_factorise(linalg_workspace,_FALSE_,error_message),
+		     error_message,error_message);
+      for (i=0; i<_SELECT_REPEATS_*_SELECT_SOLVES_; i++)
+	lasagna_call(options.linalg_solve(&(B[s]),&(X[s]),linalg_workspace,error_message),
+		     error_message,error_message);
+      t1 = evolver_clock();
+      candidate[k].seconds += (t1-t0)/_SELECT_REPEATS_;
+      lasagna_call(options.linalg_finalise(linalg_workspace,error_message),
+		   error_message,error_message);
+      if (dense[s] != NULL){
+	DestroyMultiMatrix(&(A[s]));
+	free(dense[s]);
+	lasagna_call(CreateMatrix_SCC(&(A[s]),(s == 0 ? L_DBL : L_DBL_CX),n,n,nnz,
+				      pqke->Ai,pqke->Ap,values[s],error_message),
+		     error_message,error_message);
+      }
+    }
+    //A probe of no time at all still counts as probed:
+    candidate[k].seconds = max(candidate[k].seconds,TINY);
+  }
+
+  DestroyMultiMatrix(&J);
+  for (s=0; s<2; s++){
+    DestroyMultiMatrix(&(A[s]));
+    DestroyMultiMatrix(&(B[s]));
+    DestroyMultiMatrix(&(X[s]));
+    free(values[s]);
+    free(b[s]);
+    free(x[s]);
+  }
+  free(Jx);
+  free(fval);
+  return _SUCCESS_;
+}
@@ -1,16 +1,22 @@
 #include "background.h"
 int background_free_dof(struct background_structure *pbs){
+  if (pbs->shared == _TRUE_)
+    return _SUCCESS_;
   free(pbs->T);
   free(pbs->dof_array);
+  free(pbs->dof_index);
   return _SUCCESS_;
 }
 
 int background_init_dof(struct background_structure *pbs){
   double tmp1,tmp2,tmp3;
+  double logT_max, dlogT, T;
+  int k;
   FILE *datafile;
   int row,status,tablesize,firstrow=0,header_found;
   char tmpstring[256];
   char *ptr_string=tmpstring;
+  pbs->shared = _FALSE_;
   datafile = fopen(pbs->dof_filename,"r");
   if (datafile==NULL) printf("Null...\n");
   // Find size of table:
@@ -37,8 +43,6 @@ int background_init_dof(struct background_structure *pbs){
   }
   tablesize -= firstrow;
   pbs->ndof = tablesize;
-  pbs->klo = 0;
-  pbs->khi = pbs->ndof-1;
   //Allocate T andy:
   pbs->T = malloc(sizeof(double)*tablesize);
   pbs->dof_array = malloc(sizeof(double)*tablesize*2*2);
@@ -63,6 +67,25 @@ int background_init_dof(struct background_structure *pbs){
   else
     pbs->Tdir=-1;    
   fclose(datafile);
+
+  /** Index the spline intervals on a uniform grid in log(T). The data 
+      ends at T=0, so the grid starts at the smallest positive temperature: */
+  pbs->logT_min = _HUGE_;
+  logT_max = -_HUGE_;
+  for (row=0; row<tablesize; row++){
+    if (pbs->T[row] > 0.0){
+      pbs->logT_min = min(pbs->logT_min,log(pbs->T[row]));
+      logT_max = max(logT_max,log(pbs->T[row]));
+    }
+  }
+  dlogT = (logT_max-pbs->logT_min)/_DOF_TABLE_SIZE_;
+  pbs->dlogT_inv = 1.0/dlogT;
+  pbs->dof_index = malloc(sizeof(int)*_DOF_TABLE_SIZE_);
+  for (row=0, k=0; row<_DOF_TABLE_SIZE_; row++){
+    T = exp(pbs->logT_min+row*dlogT);
+    for (k=0; (k<tablesize-2)&&((pbs->T[k+1]-T)*pbs->Tdir<=0.0); k++);
+    pbs->dof_index[row] = k;
+  }
   return _SUCCESS_;
 }
 
@@ -71,31 +94,45 @@ int background_getdof(double T,
 		      double *sqrtg, 
 		      double *gentr, 
 		      struct background_structure *pbs){
-  /** Interpolation table for the square root of radiation dof and entropy dof as a funtion of the temperature T in GeV */
+  /** Interpolation table for the square root of radiation dof and entropy dof as a funtion of the temperature T in GeV.
+      The spline interval is taken from dof_index and moved at most a step
+      or two, so the result is the one of arrays_spline_interpolate. 
+      Does not modify pbs. */
   int n=pbs->ndof;
+  int k, klo, khi, bucket;
+  double *xa=pbs->T, h, a, b, u;
+  double *y2;
+
+  u = (T > 0.0) ? (log(T)-pbs->logT_min)*pbs->dlogT_inv : -1.0;
+  if ((u < 0.0)||(u >= _DOF_TABLE_SIZE_)||
+      ((T-xa[0])*pbs->Tdir<=0.0)||((xa[n-1]-T)*pbs->Tdir<=0.0)){
+    //Outside the index, use the spline directly:
+    klo = 0;
+    khi = n-1;
+    if (sqrtg!=NULL)
+      arrays_spline_interpolate(xa,pbs->dof_array,pbs->dof_array+n,
+				n,pbs->Tdir,T,sqrtg,&klo,&khi);
+    if (gentr!=NULL)
+      arrays_spline_interpolate(xa,pbs->dof_array+2*n,pbs->dof_array+3*n,
+				n,pbs->Tdir,T,gentr,&klo,&khi);
+    return _SUCCESS_;
+  }
+  bucket = (int) u;
+  k = pbs->dof_index[bucket];
+  while ((k > 0)&&((xa[k]-T)*pbs->Tdir > 0.0)) k--;
+  while ((k < n-2)&&((xa[k+1]-T)*pbs->Tdir <= 0.0)) k++;
+  h = xa[k+1]-xa[k];
+  a = (xa[k+1]-T)/h;
+  b = (T-xa[k])/h;
   if (sqrtg!=NULL){
-    arrays_spline_interpolate(pbs->T,
-			      pbs->dof_array,
-			      pbs->dof_array+n,
-			      n,
-			      pbs->Tdir,
-			      T,
-			      sqrtg,
-			      &(pbs->klo),
-			      &(pbs->khi));
+    y2 = pbs->dof_array+n;
+    *sqrtg = a*pbs->dof_array[k]+b*pbs->dof_array[k+1] + 
+      ((a*a*a-a)*y2[k]+(b*b*b-b)*y2[k+1])*(h*h)/6.0;
   }
   if (gentr!=NULL){
-    arrays_spline_interpolate(pbs->T,
-			      pbs->dof_array+2*n,
-			      pbs->dof_array+3*n,
-			      n,
-			      pbs->Tdir,
-			      T,
-			      gentr,
-			      &(pbs->klo),
-			      &(pbs->khi));
+    y2 = pbs->dof_array+3*n;
+    *gentr = a*pbs->dof_array[2*n+k]+b*pbs->dof_array[2*n+k+1] + 
+      ((a*a*a-a)*y2[k]+(b*b*b-b)*y2[k+1])*(h*h)/6.0;
   }
- return _SUCCESS_;
+  return _SUCCESS_;
 }
-
-
@@ -0,0 +1,259 @@
+/** @file budget.c
+ * Sharing the cores of a sweep between its runs, and inside each run
+ * between numjac and derivs, see struct lasagna_budget.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#include <dirent.h>
+#endif
+#include "budget.h"
+
+int lasagna_budget_init(struct lasagna_budget *budget,
+			int nproc,
+			int threads,
+			int pin,
+			ErrorMsg error_message){
+  /** The CPUs are the first nproc of the affinity mask of the process, and
+      their NUMA nodes are read from /sys. Without nproc CPUs, or off Linux,
+      the runs are not pinned. */
+  int c, count=0, node;
+#ifdef __linux__
+  cpu_set_t mask;
+  DIR *dir;
+  struct dirent *entry;
+  char name[64];
+#endif
+
+  budget->nproc = max(1,nproc);
+  budget->threads = max(1,threads);
+  budget->active = 0;
+  budget->waiting = 0;
+  budget->free = budget->nproc;
+  budget->pin = _FALSE_;
+  budget->cpu = NULL;
+  budget->node = NULL;
+  budget->owner = NULL;
+  budget->nodes = 1;
+  if (pin == _FALSE_)
+    return _SUCCESS_;
+#ifdef __linux__
+  lasagna_alloc(budget->cpu,sizeof(int)*budget->nproc,error_message);
+  lasagna_alloc(budget->node,sizeof(int)*budget->nproc,error_message);
+  lasagna_alloc(budget->owner,sizeof(int)*budget->nproc,error_message);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &mask) == 0){
+    for (c=0; (c<CPU_SETSIZE)&&(count<budget->nproc); c++){
+      if (CPU_ISSET(c, &mask) == 0)
+	continue;
+      budget->cpu[count] = c;
+      budget->node[count] = 0;
+      budget->owner[count] = -1;
+      sprintf(name,"/sys/devices/system/cpu/cpu%d",c);
+      dir = opendir(name);
+      if (dir != NULL){
+	while ((entry = readdir(dir)) != NULL){
+	  if (sscanf(entry->d_name,"node%d",&node) == 1){
+	    budget->node[count] = node;
+	    budget->nodes = max(budget->nodes,node+1);
+	  }
+	}
+	closedir(dir);
+      }
+      count++;
+    }
+  }
+  if (count == budget->nproc)
+    budget->pin = _TRUE_;
+  else
+    printf("Only %d CPUs for nproc=%d, the threads are not pinned.\n",count,budget->nproc);
+#else
+  printf("Pinning threads needs Linux, the threads are not pinned.\n");
+#endif
+  return _SUCCESS_;
+}
+
+int lasagna_budget_free(struct lasagna_budget *budget){
+  free(budget->cpu);
+  free(budget->node);
+  free(budget->owner);
+  return _SUCCESS_;
+}
+
+int lasagna_budget_level(struct lasagna_budget *budget,
+			 int runs){
+  /** A new level of the sweep with runs runs waiting. */
+#pragma omp critical(lasagna_budget)
+  budget->waiting = runs;
+  return _SUCCESS_;
+}
+
+static void lasagna_budget_take(struct lasagna_budget *budget,
+				int run,
+				int count){
+  /** Gives count free CPUs to run, from the node with most free CPUs, or
+      the node the run already has CPUs on if it has as many. */
+  int c, n, best, take;
+  int free_on[budget->nodes], held_on[budget->nodes];
+
+  while (count > 0){
+    for (n=0; n<budget->nodes; n++){
+      free_on[n] = 0;
+      held_on[n] = 0;
+    }
+    for (c=0; c<budget->nproc; c++){
+      if (budget->owner[c] == -1)
+	free_on[budget->node[c]]++;
+      else if (budget->owner[c] == run)
+	held_on[budget->node[c]]++;
+    }
+    best = 0;
+    for (n=1; n<budget->nodes; n++){
+      if ((free_on[n] > free_on[best])||
+	  ((free_on[n] == free_on[best])&&(held_on[n] > held_on[best])))
+	best = n;
+    }
+    if (free_on[best] == 0)
+      return;
+    take = min(count,free_on[best]);
+    for (c=0; (c<budget->nproc)&&(take>0); c++){
+      if ((budget->owner[c] == -1)&&(budget->node[c] == best)){
+	budget->owner[c] = run;
+	take--;
+	count--;
+      }
+    }
+  }
+}
+
+static void lasagna_budget_pin(struct lasagna_budget *budget,
+			       int run){
+  /** Pins the calling thread to the CPUs of run. OpenMP teams it starts
+      later get the same CPUs. */
+#ifdef __linux__
+  cpu_set_t mask;
+  int c;
+
+  CPU_ZERO(&mask);
+  for (c=0; c<budget->nproc; c++){
+    if (budget->owner[c] == run)
+      CPU_SET(budget->cpu[c], &mask);
+  }
+  if (CPU_COUNT(&mask) > 0)
+    sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+#endif
+}
+
+int lasagna_budget_acquire(struct lasagna_budget *budget,
+			   int run,
+			   int rhs_threads,
+			   struct lasagna_share *share){
+  /** Cores for run: the free cores are divided between the runs that can
+      start now, this one included. rhs_threads is the number of threads
+      of each derivs call asked for in the parameter file, and numjac gets
+      the rest. */
+  int starting;
+
+#pragma omp critical(lasagna_budget)
+  {
+    budget->waiting = max(0,budget->waiting-1);
+    starting = max(1,min(budget->threads-budget->active,budget->waiting+1));
+    share->cores = max(1,budget->free/starting);
+    budget->free = max(0,budget->free-share->cores);
+    budget->active++;
+    if (budget->pin == _TRUE_){
+      lasagna_budget_take(budget, run, share->cores);
+      lasagna_budget_pin(budget, run);
+    }
+  }
+  share->budget = budget;
+  share->run = run;
+  share->rhs_threads = max(1,min(rhs_threads,share->cores));
+  share->numjac = max(1,share->cores/share->rhs_threads);
+  return _SUCCESS_;
+}
+
+int lasagna_budget_grow(struct lasagna_share *share){
+  /** Called by a run between its steps. When no runs are waiting, it takes
+      its part of the free cores, which go to the derivs calls, since the
+      numjac threads are fixed for the run. Returns _TRUE_ if the run got
+      more cores. */
+  struct lasagna_budget *budget=share->budget;
+  int waiting, free, extra=0;
+
+#pragma omp atomic read
+  waiting = budget->waiting;
+#pragma omp atomic read
+  free = budget->free;
+  if ((waiting > 0)||(free == 0))
+    return _FALSE_;
+#pragma omp critical(lasagna_budget)
+  {
+    if ((budget->waiting == 0)&&(budget->free > 0)){
+      extra = (budget->free+budget->active-1)/budget->active;
+      extra = min(extra,budget->free);
+      budget->free -= extra;
+      if (budget->pin == _TRUE_){
+	lasagna_budget_take(budget, share->run, extra);
+	lasagna_budget_pin(budget, share->run);
+      }
+    }
+  }
+  if (extra == 0)
+    return _FALSE_;
+  share->cores += extra;
+  share->rhs_threads = max(share->rhs_threads,share->cores/share->numjac);
+  return _TRUE_;
+}
+
+int lasagna_budget_release(struct lasagna_share *share){
+  struct lasagna_budget *budget=share->budget;
+  int c;
+
+#pragma omp critical(lasagna_budget)
+  {
+    budget->free = min(budget->nproc,budget->free+share->cores);
+    budget->active--;
+    if (budget->pin == _TRUE_){
+      for (c=0; c<budget->nproc; c++){
+	if (budget->owner[c] == share->run)
+	  budget->owner[c] = -1;
+      }
+    }
+  }
+  return _SUCCESS_;
+}
+
+int lasagna_budget_cpus(struct lasagna_share *share,
+			char *list,
+			int length){
+  /** Writes the CPUs of the run, e.g. " on CPUs 4-7 (node 1)", to list, or
+      nothing if the runs are not pinned. */
+  struct lasagna_budget *budget=share->budget;
+  int c, first=-1, last=-1, node=-1, used=0;
+
+  list[0] = '\0';
+  if (budget->pin == _FALSE_)
+    return _SUCCESS_;
+  used += snprintf(list+used,length-used," on CPUs");
+#pragma omp critical(lasagna_budget)
+  {
+    for (c=0; c<budget->nproc; c++){
+      if (budget->owner[c] == share->run){
+	if ((first >= 0)&&(budget->cpu[c] == last+1)){
+	  last = budget->cpu[c];
+	}
+	else{
+	  if ((first >= 0)&&(used < length))
+	    used += snprintf(list+used,length-used,(first==last ? " %d" : " %d-%d"),first,last);
+	  first = last = budget->cpu[c];
+	}
+	node = (node == -1 || node == budget->node[c]) ? budget->node[c] : -2;
+      }
+    }
+    if ((first >= 0)&&(used < length))
+      used += snprintf(list+used,length-used,(first==last ? " %d" : " %d-%d"),first,last);
+  }
+  if ((node >= 0)&&(used < length))
+    snprintf(list+used,length-used," (node %d)",node);
+  return _SUCCESS_;
+}
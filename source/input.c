@@ -1,4 +1,5 @@
 #include "input.h"
+#include <unistd.h>
 int input_init_from_arguments(int argc, 
 			      char **argv,
 			      qke_param *pqke,
@@ -29,12 +30,345 @@ int input_init_from_arguments(int argc,
   return _SUCCESS_;
 }
 
+int input_sweep_init(int argc, 
+		     char **argv,
+		     struct file_content *pfc,
+		     struct sweep_content *psw,
+		     struct background_structure *pbs,
+		     int *threads,
+		     int *nproc,
+		     int *pin,
+		     ErrorMsg errmsg){
+  /** Reads the parameter file once, expands its sweeps into the runs of
+      psw, and loads the DoF table that all runs share. With sweep_refine,
+      the runs are those of the refined grid. */
+  int flag1, int1, levels=0;
+  char string1[_ARGUMENT_LENGTH_MAX_];
+  pfc->size = 0;
+
+  lasagna_test(argc>2, 
+	       errmsg,
+	       "Too many input arguments to LASAGNA!");
+
+  if (argc==2){
+    lasagna_call(parser_read_file(argv[1],pfc,errmsg),
+		 errmsg,
+		 errmsg);
+  }
+  lasagna_call(parser_sweep_init(pfc,psw,errmsg),errmsg,errmsg);
+  lasagna_read_int("sweep_refine",levels);
+  lasagna_call(parser_sweep_refine(psw,levels,errmsg),errmsg,errmsg);
+  *threads = 1;
+  lasagna_read_int("sweep_threads",*threads);
+  *threads = max(1,min(*threads,psw->runs));
+  *nproc = 1;
+  lasagna_read_int("nproc",*nproc);
+  *pin = _FALSE_;
+  lasagna_read_int("pin_threads",*pin);
+  strncpy(pbs->dof_filename,"dsdofHP_B.dat",_FILENAMESIZE_);
+  lasagna_read_string("dof_filename",pbs->dof_filename);
+  background_init_dof(pbs);
+  return _SUCCESS_;
+}
+
+int input_sweep_run(const struct file_content *pfc,
+		    const struct sweep_content *psw,
+		    int run,
+		    const struct background_structure *pbs,
+		    qke_param *pqke,
+		    ErrorMsg errmsg){
+  /** Initialises pqke for one run of the sweep. With more than one run,
+      the number of the run is added to output_filename, before .mat. */
+  struct file_content fc_run;
+  char *extension, suffix[16];
+
+  lasagna_call(parser_sweep_run(pfc,psw,run,&fc_run,errmsg),errmsg,errmsg);
+  if (pfc->size > 0)
+    strcpy(pqke->parameter_filename,pfc->filename);
+  lasagna_call(input_init_shared(&fc_run,
+				 pqke,
+				 pbs,
+				 errmsg),
+	       errmsg,
+	       errmsg);
+  lasagna_call(parser_free(&fc_run),errmsg,errmsg);
+  if (psw->runs > 1){
+    sprintf(suffix,"_%d",run);
+    lasagna_test(strlen(pqke->output_filename)+strlen(suffix) >= _FILENAMESIZE_,
+		 errmsg,"Output filename %s is too long for a sweep.",pqke->output_filename);
+    extension = strstr(pqke->output_filename,".mat");
+    if (extension == NULL)
+      strcat(pqke->output_filename,suffix);
+    else{
+      memmove(extension+strlen(suffix),extension,strlen(extension)+1);
+      memcpy(extension,suffix,strlen(suffix));
+    }
+  }
+  return _SUCCESS_;
+}
+
+int input_sweep_log_open(struct file_content *pfc,
+			 struct sweep_content *psw,
+			 FILE **log_file,
+			 ErrorMsg errmsg){
+  /** Opens the log of a sweep, output_filename with .sweep instead of
+      .mat, and writes its header. The runs are added as they finish. */
+  int flag1, d;
+  char string1[_ARGUMENT_LENGTH_MAX_];
+  char filename[_FILENAMESIZE_], *extension;
+
+  strcpy(filename,"output/dump.mat");
+  lasagna_read_string("output_filename",filename);
+  extension = strstr(filename,".mat");
+  if (extension != NULL)
+    *extension = '\0';
+  lasagna_test(strlen(filename)+strlen(".sweep") >= _FILENAMESIZE_,
+	       errmsg,"Output filename %s is too long for a sweep.",filename);
+  strcat(filename,".sweep");
+  *log_file = fopen(filename,"w");
+  lasagna_test(*log_file == NULL,errmsg,"Could not open %s.",filename);
+  fprintf(*log_file,"#run status steps T_end L_end wall_time");
+  for (d=0; d<psw->dimensions; d++)
+    fprintf(*log_file," %s",pfc->name[psw->entry[d]]);
+  fprintf(*log_file,"\n");
+  fflush(*log_file);
+  return _SUCCESS_;
+}
+
+int input_sweep_log_write(FILE *log_file,
+			  struct sweep_content *psw,
+			  int run,
+			  int status,
+			  int budget_exceeded,
+			  int steps,
+			  double T_end,
+			  double L_end,
+			  double wall_time){
+  /** Adds a finished run to the log of the sweep. A failed run has the T
+      and L of its last accepted step, or - for both without one. */
+  int d, stride=1;
+
+  fprintf(log_file,"%d %s %d ",run,
+	  (status == _FAILURE_ ? "failed" : (budget_exceeded == _TRUE_ ? "budget" : "ok")),
+	  steps);
+  if ((status == _FAILURE_)&&(steps == 0))
+    fprintf(log_file,"- - %g",wall_time);
+  else
+    fprintf(log_file,"%.10e %.10e %g",T_end,L_end,wall_time);
+  for (d=0; d<psw->dimensions; d++){
+    fprintf(log_file," %.17g",psw->values[d][(run/stride)%psw->size[d]]);
+    stride *= psw->size[d];
+  }
+  fprintf(log_file,"\n");
+  fflush(log_file);
+  return _SUCCESS_;
+}
+
+static unsigned long long input_hash(unsigned long long hash,
+				     const void *data,
+				     size_t size){
+  /** 64 bit FNV-1a of size bytes at data, continuing from hash. */
+  const unsigned char *byte=data;
+  size_t i;
+
+  for (i=0; i<size; i++){
+    hash ^= byte[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+int input_result_key(qke_param *pqke,
+		     char *key){
+  /** Writes the key of the run in pqke in the result cache to key, 16 hex
+      digits. It is a hash of the code version and of the parsed parameters
+      that change the result or the output file. The number of cores, the
+      verbosity, the output buffering, checkpoints and the time budget do not
+      change them and are left out, so a run can be taken from the cache
+      with other settings of those. */
+  unsigned long long hash=14695981039346656037ULL;
+  int fields[23];
+  double values[18];
+
+  hash = input_hash(hash,_LASAGNA_VERSION_,strlen(_LASAGNA_VERSION_)+1);
+  hash = input_hash(hash,pqke->pbs.dof_filename,strlen(pqke->pbs.dof_filename)+1);
+  hash = input_hash(hash,pqke->output_fields,strlen(pqke->output_fields)+1);
+  fields[0] = (pqke->evolver_auto == _TRUE_ ? -1 : pqke->evolver);
+  fields[1] = (pqke->linalg_auto == _TRUE_ ? -1 : (int) pqke->LinearAlgebraWrapper);
+  fields[2] = pqke->Tres;
+  fields[3] = pqke->vres;
+  fields[4] = pqke->is_electron;
+  fields[5] = pqke->fixed_grid;
+  fields[6] = pqke->warm_start;
+  fields[7] = pqke->analytic_jacobian;
+  fields[8] = pqke->mixed_precision;
+  fields[9] = pqke->output_compress;
+  fields[10] = pqke->output_chunk;
+  fields[11] = pqke->output_bin_stride;
+  fields[12] = pqke->output_nbins;
+  fields[13] = pqke->grid_levels;
+  fields[14] = pqke->imex;
+  fields[15] = pqke->radau5_real;
+  fields[16] = pqke->jacobian_updates;
+  fields[17] = pqke->events;
+  fields[18] = pqke->detect_pattern;
+  fields[19] = pqke->pattern_pad;
+  fields[20] = pqke->grid_switch;
+  fields[21] = pqke->low_memory;
+  fields[22] = pqke->sparse_newton;
+  hash = input_hash(hash,fields,sizeof(fields));
+  if (pqke->output_bins != NULL)
+    hash = input_hash(hash,pqke->output_bins,sizeof(int)*pqke->output_nbins);
+  hash = input_hash(hash,&(pqke->output_nmoments),sizeof(int));
+  if (pqke->output_moments != NULL)
+    hash = input_hash(hash,pqke->output_moments,sizeof(int)*pqke->output_nmoments);
+  values[0] = pqke->xext;
+  values[1] = pqke->xmin;
+  values[2] = pqke->xmax;
+  values[3] = pqke->T_initial;
+  values[4] = pqke->T_final;
+  values[5] = pqke->T_wait;
+  values[6] = pqke->v_left;
+  values[7] = pqke->v_right;
+  values[8] = pqke->rtol;
+  values[9] = pqke->abstol;
+  values[10] = pqke->rs;
+  values[11] = pqke->alpha;
+  values[12] = pqke->L_initial;
+  values[13] = pqke->L_final;
+  values[14] = pqke->delta_m2;
+  values[15] = pqke->theta_zero;
+  values[16] = pqke->trigger_dLdT_over_L;
+  values[17] = pqke->grid_tol;
+  hash = input_hash(hash,values,sizeof(values));
+  sprintf(key,"%016llx",hash);
+  return _SUCCESS_;
+}
+
+int input_copy_file(char *from,
+		    char *to){
+  /** Copies the file from to the file to. */
+  FILE *in, *out;
+  char buffer[65536];
+  size_t count;
+  int status=_SUCCESS_;
+
+  in = fopen(from,"rb");
+  if (in == NULL)
+    return _FAILURE_;
+  out = fopen(to,"wb");
+  if (out == NULL){
+    fclose(in);
+    return _FAILURE_;
+  }
+  while ((count = fread(buffer,1,sizeof(buffer),in)) > 0){
+    if (fwrite(buffer,1,count,out) != count){
+      status = _FAILURE_;
+      break;
+    }
+  }
+  if (ferror(in))
+    status = _FAILURE_;
+  fclose(in);
+  if (fclose(out) != 0)
+    status = _FAILURE_;
+  return status;
+}
+
+int input_result_cache_read(qke_param *pqke,
+			    char *key,
+			    int *steps,
+			    double *T_end,
+			    double *L_end,
+			    int *diverged){
+  /** Looks up the run with key in the result cache. The summary is
+      run_<key>.res and the output file run_<key>.mat, with its index
+      run_<key>.mat.toc if there is one. If the run stores its output, the
+      output file is copied to output_filename. Returns _FALSE_ on a miss. */
+  FILE *res;
+  char name[_FILENAMESIZE_+32], target[_FILENAMESIZE_+4];
+  int found;
+
+  sprintf(name,"%s/run_%s.res",pqke->result_cache,key);
+  res = fopen(name,"r");
+  if (res == NULL)
+    return _FALSE_;
+  found = fscanf(res,"%d %lf %lf %d",steps,T_end,L_end,diverged);
+  fclose(res);
+  if (found != 4)
+    return _FALSE_;
+  if (pqke->store_output == _TRUE_){
+    sprintf(name,"%s/run_%s.mat",pqke->result_cache,key);
+    if (input_copy_file(name,pqke->output_filename) == _FAILURE_)
+      return _FALSE_;
+    sprintf(target,"%s.toc",pqke->output_filename);
+    remove(target);
+    strcat(name,".toc");
+    input_copy_file(name,target);
+  }
+  return _TRUE_;
+}
+
+int input_result_cache_write(qke_param *pqke,
+			     char *key,
+			     int steps,
+			     double T_end,
+			     double L_end,
+			     int diverged,
+			     double wall_time){
+  /** Stores a finished run under key in the result cache, see
+      input_result_cache_read. The summary is written last and renamed into
+      place, so runs reading the cache at the same time see the whole entry
+      or nothing. */
+  FILE *res;
+  char name[_FILENAMESIZE_+32], temp[_FILENAMESIZE_+64], source[_FILENAMESIZE_+4];
+  static int written=0;
+  int count;
+
+  if (pqke->store_output == _TRUE_){
+    sprintf(name,"%s/run_%s.mat",pqke->result_cache,key);
+    if (input_copy_file(pqke->output_filename,name) == _FAILURE_)
+      return _FAILURE_;
+    sprintf(source,"%s.toc",pqke->output_filename);
+    strcat(name,".toc");
+    remove(name);
+    input_copy_file(source,name);
+  }
+  sprintf(name,"%s/run_%s.res",pqke->result_cache,key);
+#pragma omp atomic capture
+  count = written++;
+  sprintf(temp,"%s.%d.%d",name,(int)getpid(),count);
+  res = fopen(temp,"w");
+  if (res == NULL)
+    return _FAILURE_;
+  fprintf(res,"%d %.17e %.17e %d\n",steps,T_end,L_end,diverged);
+  fprintf(res,"#steps T_end L_end diverged, %s, %g s\n",_LASAGNA_VERSION_,wall_time);
+  if (fclose(res) != 0){
+    remove(temp);
+    return _FAILURE_;
+  }
+  if (rename(temp,name) != 0){
+    remove(temp);
+    return _FAILURE_;
+  }
+  return _SUCCESS_;
+}
+
 int input_init(struct file_content *pfc,
 	       qke_param *pqke,
 	       ErrorMsg errmsg){
+  return input_init_shared(pfc,pqke,NULL,errmsg);
+}
+
+int input_init_shared(struct file_content *pfc,
+		      qke_param *pqke,
+		      const struct background_structure *pbs,
+		      ErrorMsg errmsg){
+  /** As input_init, but with pbs!=NULL the DoF table of pbs is used
+      instead of reading dof_filename. */
   int flag1,flag2;
   double param1,param2;
-  int int1;
+  int int1, entries_read;
   char string1[_ARGUMENT_LENGTH_MAX_];
 
   //Read default values:
@@ -48,7 +382,17 @@ int input_init(struct file_content *pfc,
   lasagna_read_double("xmax",pqke->xmax);
   lasagna_read_int("evolver",pqke->evolver);	
   lasagna_read_int("linalg_wrapper",pqke->LinearAlgebraWrapper);
+  //-1 is chosen before the run by lasagna_select, the stiff defaults stand in for the tests below:
+  pqke->evolver_auto = (pqke->evolver == -1 ? _TRUE_ : _FALSE_);
+  if (pqke->evolver_auto == _TRUE_)
+    pqke->evolver = 1;
+  pqke->linalg_auto = ((int) pqke->LinearAlgebraWrapper == -1 ? _TRUE_ : _FALSE_);
+  if (pqke->linalg_auto == _TRUE_)
+    pqke->LinearAlgebraWrapper = LINALG_WRAPPER_SPARSE;
+  lasagna_read_double("memory_limit",pqke->memory_limit);
   lasagna_read_int("nproc",pqke->nproc);
+  lasagna_read_int("rhs_threads",pqke->rhs_threads);
+  pqke->rhs_threads = max(1,min(pqke->rhs_threads,pqke->nproc));
   lasagna_read_int("verbose",pqke->verbose);
   lasagna_read_double("T_initial",pqke->T_initial);
   lasagna_read_double("T_final",pqke->T_final);
@@ -75,14 +419,93 @@ int input_init(struct file_content *pfc,
   else
     printf("Flavour of active species: Muon/Tau\n");
   lasagna_read_int("fixed_grid", pqke->fixed_grid);
+  lasagna_read_int("grid_switch", pqke->grid_switch);
+  lasagna_read_int("warm_start", pqke->warm_start);
+  lasagna_read_int("sparse_newton", pqke->sparse_newton);
+  lasagna_read_int("analytic_jacobian", pqke->analytic_jacobian);
+  lasagna_read_int("jacobian_updates", pqke->jacobian_updates);
+  lasagna_read_int("imex", pqke->imex);
+  lasagna_read_int("radau5_real", pqke->radau5_real);
+  lasagna_read_string("symbolic_cache", pqke->symbolic_cache);
+  lasagna_read_string("result_cache", pqke->result_cache);
+  lasagna_read_int("mixed_precision", pqke->mixed_precision);
+  lasagna_read_int("low_memory", pqke->low_memory);
+  lasagna_read_int("output_buffer", pqke->output_buffer);
+  lasagna_read_int("output_mmap", pqke->output_mmap);
+  lasagna_read_int("output_compress", pqke->output_compress);
+  lasagna_read_int("output_chunk", pqke->output_chunk);
+  lasagna_read_int("checkpoint_interval", pqke->checkpoint_interval);
+  lasagna_read_int("restart", pqke->restart);
+  lasagna_read_string("output_fields", pqke->output_fields);
+  lasagna_read_int("output_bin_stride", pqke->output_bin_stride);
+  lasagna_call(parser_read_list_of_integers(pfc,"output_bins",&entries_read,
+					    &(pqke->output_bins),&flag1,errmsg),
+	       errmsg,errmsg);
+  if (flag1 == _TRUE_)
+    pqke->output_nbins = entries_read;
+  lasagna_call(parser_read_list_of_integers(pfc,"output_moments",&entries_read,
+					    &(pqke->output_moments),&flag1,errmsg),
+	       errmsg,errmsg);
+  if (flag1 == _TRUE_)
+    pqke->output_nmoments = entries_read;
+  lasagna_read_int("store_history", pqke->store_history);
+  lasagna_read_int("store_output", pqke->store_output);
+  lasagna_read_int("timing", pqke->timing);
+  lasagna_read_double("progress_interval", pqke->progress_interval);
+  lasagna_read_int("sweep_warm_start", pqke->sweep_warm_start);
+  lasagna_read_int("grid_levels", pqke->grid_levels);
+  lasagna_read_int("detect_pattern", pqke->detect_pattern);
+  lasagna_read_int("pattern_pad", pqke->pattern_pad);
+  lasagna_test((pqke->detect_pattern > 0)&&(pqke->grid_levels > 0),
+	       errmsg,
+	       "detect_pattern does not follow the grid levels of grid_levels.");
+  lasagna_read_double("grid_tol", pqke->grid_tol);
+  lasagna_read_double("run_time_budget", pqke->time_budget);
+  lasagna_read_int("events", pqke->events);
+  lasagna_test((pqke->events == _TRUE_)&&(pqke->evolver >= 2),
+	       errmsg,
+	       "events need the ndf15 or radau5 evolver.");
+  lasagna_test(((pqke->checkpoint_interval > 0)||(pqke->restart == _TRUE_))&&
+	       ((pqke->output_compress > 0)||(pqke->output_chunk > 0)||(pqke->evolver >= 2)),
+	       errmsg,
+	       "Checkpoints need the ndf15 or radau5 evolver and an output file without compression or chunks.");
+  lasagna_test((pqke->store_history == _TRUE_)&&((pqke->evolver != 1)||(pqke->restart == _TRUE_)),
+	       errmsg,"The step history needs the ndf15 evolver and a run that is not a restart.");
+  lasagna_test((pqke->grid_levels > 0)&&
+	       ((pqke->evolver != 1)||(pqke->fixed_grid != 0)||(pqke->checkpoint_interval > 0)||
+		(pqke->restart == _TRUE_)||(pqke->store_history == _TRUE_)),
+	       errmsg,
+	       "The adaptive grid needs the ndf15 evolver on the moving grid, without checkpoints or step history.");
+  lasagna_test((pqke->grid_switch == _TRUE_)&&
+	       ((pqke->fixed_grid != 0)||(pqke->evolver == 2)||(pqke->imex == _TRUE_)||
+		(pqke->grid_levels > 0)||(pqke->checkpoint_interval > 0)||
+		(pqke->restart == _TRUE_)||(pqke->store_history == _TRUE_)||
+		(pqke->sweep_warm_start == _TRUE_)),
+	       errmsg,
+	       "grid_switch needs the moving grid and another evolver than Runge-Kutta, without IMEX, grid_levels, checkpoints, step history or sweep_warm_start.");
+  lasagna_test((pqke->imex == _TRUE_)&&((pqke->evolver != 3)||(pqke->fixed_grid != 0)),
+	       errmsg,
+	       "The IMEX mode needs the Rosenbrock-W evolver on the moving grid.");
+  lasagna_test((pqke->grid_levels < 0)||(pqke->grid_levels > 16)||
+	       ((pqke->grid_levels > 0)&&(((pqke->vres-1)%(1<<pqke->grid_levels) != 0)||
+					  ((pqke->vres-1)/(1<<pqke->grid_levels)+1 < 9))),
+	       errmsg,
+	       "With grid_levels=%d, vres-1 must be a multiple of 2^grid_levels and the coarsest grid needs at least 9 bins.",
+	       pqke->grid_levels);
 
   //Initialise background somewhere
-  background_init_dof(&(pqke->pbs));
+  if (pbs == NULL)
+    background_init_dof(&(pqke->pbs));
+  else{
+    pqke->pbs = *pbs;
+    pqke->pbs.shared = _TRUE_;
+  }
   //Initialise rest of pqke somewhere
   if (pqke->fixed_grid == 0)
     init_qke_param(pqke);
   else 
     init_qke_param_fixed_grid(pqke);
+  lasagna_call(qke_output_selection(pqke,errmsg),errmsg,errmsg);
   return _SUCCESS_;
 }
 
@@ -94,9 +517,48 @@ int input_default_params(qke_param *pqke){
   pqke->xmax = 100.0; //100.0;
   pqke->evolver = 1;
   pqke->LinearAlgebraWrapper = LINALG_WRAPPER_SPARSE;
+  pqke->evolver_auto = _FALSE_;
+  pqke->linalg_auto = _FALSE_;
+  pqke->memory_limit = 0.0;
   pqke->nproc = 1;
+  pqke->rhs_threads = 1;
+  pqke->share = NULL;
   pqke->verbose = 4;
   pqke->fixed_grid = 0;
+  pqke->grid_switch = 0;
+  pqke->warm_start = _FALSE_;
+  pqke->sparse_newton = _FALSE_;
+  pqke->analytic_jacobian = 0;
+  pqke->jacobian_updates = 0;
+  pqke->imex = 0;
+  pqke->radau5_real = 0;
+  pqke->mixed_precision = 0;
+  pqke->low_memory = _FALSE_;
+  pqke->output_buffer = 4;
+  pqke->output_mmap = _FALSE_;
+  pqke->output_compress = 0;
+  pqke->output_chunk = 0;
+  pqke->checkpoint_interval = 0;
+  pqke->restart = _FALSE_;
+  strcpy(pqke->output_fields,"all");
+  pqke->output_bin_stride = 1;
+  pqke->output_nbins = 0;
+  pqke->output_bins = NULL;
+  pqke->output_nmoments = 0;
+  pqke->output_moments = NULL;
+  pqke->store_history = _FALSE_;
+  pqke->store_output = _TRUE_;
+  pqke->timing = _FALSE_;
+  pqke->progress_interval = 0.0;
+  pqke->sweep_warm_start = _FALSE_;
+  pqke->grid_levels = 0;
+  pqke->detect_pattern = 0;
+  pqke->pattern_pad = 0;
+  pqke->grid_tol = 0.1;
+  pqke->time_budget = 0.0;
+  pqke->events = _FALSE_;
+  pqke->budget_exceeded = _FALSE_;
+  pqke->steps_reached = 0;
   pqke->Nres = 2;
   pqke->T_initial = 0.025;
   pqke->T_final = 0.010;
@@ -107,6 +569,8 @@ int input_default_params(qke_param *pqke){
   pqke->v_left = 0.0;
   pqke->vres = 200;
   strcpy(pqke->output_filename,"output/dump.mat");
+  pqke->symbolic_cache[0] = '\0';
+  pqke->result_cache[0] = '\0';
   /** We must have non-zero alpha, otherwise the matrix for 
       solving for dvidT becomes singular.
   */
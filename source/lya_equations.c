@@ -5,37 +5,15 @@
 #include "lya_equations.h"
 int init_lya_param(lya_param *plya){
   int i,j,k,idx,nz;
-  size_t neq;
+  size_t neq, nsys;
   double k1,k2;
   double Nres, vres, Tres;
   int **J;
-  ErrorMsg errmsg;
-  lya_param *paw_derivs;
-  double *Ax;
   Nres = plya->Nres;
   vres = plya->vres;
   Tres = plya->Tres;
   plya->Tvec = malloc(sizeof(double)*Tres);
-  plya->xi = malloc(sizeof(double)*Nres);
-  plya->ui = malloc(sizeof(double)*Nres);
-  plya->vi = malloc(sizeof(double)*Nres);
-  plya->duidT = malloc(sizeof(double)*Nres);
-  plya->dvidT = malloc(sizeof(double)*Nres);
-  plya->duidx = malloc(sizeof(double)*Nres);
-  plya->dxidT = malloc(sizeof(double)*Nres);
-  plya->a = malloc(sizeof(double)*Nres);
-  plya->y_0 = malloc(sizeof(double)*(1+Nres));
-  plya->maxstep = malloc(sizeof(double)*(1+Nres));
-  plya->x_grid = malloc(sizeof(double)*vres);
-  plya->u_grid = malloc(sizeof(double)*vres);
-  plya->v_grid = malloc(sizeof(double)*vres);
-  plya->dvdu_grid = malloc(sizeof(double)*vres);
-  plya->dudT_grid = malloc(sizeof(double)*vres);
-  plya->mat = malloc(sizeof(double*)*(Nres+2));
-  for (i=0; i<(Nres+2); i++) 
-    plya->mat[i] = malloc(sizeof(double)*(Nres + 2));
-  plya->vv = malloc(sizeof(double)*(Nres + 2));
-  plya->indx = malloc(sizeof(int)*(Nres + 2));
+  qke_scratch_alloc(&(plya->ws),Nres,vres);
 
   //Do some calculations for the u(x) mapping:
   k1 = plya->xmin/plya->xext;
@@ -45,13 +23,16 @@ int init_lya_param(lya_param *plya){
 
   //Some secondary initialisations:
   for(i=0; i<vres; i++){
-    plya->v_grid[i] = plya->v_left+
+    plya->ws.v_grid[i] = plya->v_left+
       i*(plya->v_right-plya->v_left)/(vres-1.0); 
   }
   for(i=0; i<Tres; i++){
     plya->Tvec[i] = plya->T_initial+
       i*(plya->T_final-plya->T_initial)/(Tres-1.0); 
   }
+  qke_advection_init(&(plya->adv),vres,21,plya->ws.v_grid[1]-plya->ws.v_grid[0]);
+  plya->writer.mat_file = NULL;
+  plya->writer.status = _SUCCESS_;
   if (plya->is_electron == _TRUE_){
      plya->C_alpha = 1.27;
   }
@@ -59,6 +40,7 @@ int init_lya_param(lya_param *plya){
      plya->C_alpha = 0.92;
   }
   plya->guess_exists = _FALSE_;
+  lya_param_cache_clear(plya);
   
   //Set up the indices:
   idx = 0;
@@ -86,6 +68,22 @@ int init_lya_param(lya_param *plya){
   plya->neq = neq;
   plya->index_v = neq;
 
+  //The tangent-linear mode only evolves the first neq equations:
+  nsys = (plya->tangent_linear == _TRUE_) ? neq : 2*neq;
+  plya->tangent = NULL;
+  plya->v_out = NULL;
+  plya->tangent_weight = NULL;
+  plya->tangent_growth = NULL;
+  if (plya->tangent_linear == _TRUE_){
+    plya->tangent = malloc(sizeof(double)*neq*plya->lyapunov_vectors);
+    plya->v_out = malloc(sizeof(double)*neq);
+    plya->tangent_weight = malloc(sizeof(double)*neq);
+    plya->tangent_growth = calloc(plya->lyapunov_vectors,sizeof(double));
+    for (i=0; i<neq; i++)
+      plya->tangent_weight[i] = 1.0;
+    plya->tangent_weight[plya->index_L] = _L_SCALE_;
+  }
+
   //Pattern for Jacobi matrix:
   plya->Ap = malloc(sizeof(int)*(2*neq+1));
   plya->Ai = malloc(sizeof(int)*2*neq*2*neq);
@@ -121,15 +119,15 @@ int init_lya_param(lya_param *plya){
   //Loop over grid:
   for (j=0; j<vres; j++){
     //F-Pa_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Pa_plus+j][plya->index_Pa_plus+k] = 1;
     J[plya->index_Pa_plus+j][plya->index_Py_plus+j] = 1;
     //F-Pa_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Pa_minus+j][plya->index_Pa_minus+k] = 1;
     J[plya->index_Pa_minus+j][plya->index_Py_minus+j] = 1;
     //F-Ps_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Ps_plus+j][plya->index_Ps_plus+k] = 1;
     J[plya->index_Ps_plus+j][plya->index_Py_plus+j] = 1;
     //R_nus_plus dependence:
@@ -138,13 +136,13 @@ int init_lya_param(lya_param *plya){
       J[plya->index_Ps_plus+j][plya->index_Ps_plus+k] = 1;
     }
     //F-Ps_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Ps_minus+j][plya->index_Ps_minus+k] = 1;
     J[plya->index_Ps_minus+j][plya->index_Py_minus+j] = 1;
     //R_nus_minus dependence:
     J[plya->index_Ps_minus+j][plya->index_Pa_minus+j] = 1;
     //F-Px_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Px_plus+j][plya->index_Px_plus+k] = 1;
     J[plya->index_Px_plus+j][plya->index_L] = 1;
     for (k=0; k<vres; k++)
@@ -152,7 +150,7 @@ int init_lya_param(lya_param *plya){
     J[plya->index_Px_plus+j][plya->index_Py_plus+j] = 1;
     J[plya->index_Px_plus+j][plya->index_Py_minus+j] = 1;
     //F-Px_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Px_minus+j][plya->index_Px_minus+k] = 1;
     J[plya->index_Px_minus+j][plya->index_L] = 1;
     for (k=0; k<vres; k++)
@@ -160,7 +158,7 @@ int init_lya_param(lya_param *plya){
     J[plya->index_Px_minus+j][plya->index_Py_plus+j] = 1;
     J[plya->index_Px_minus+j][plya->index_Py_minus+j] = 1;
     //F-Py_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Py_plus+j][plya->index_Py_plus+k] = 1;
     J[plya->index_Py_plus+j][plya->index_L] = 1;
     for (k=0; k<vres; k++)
@@ -170,7 +168,7 @@ int init_lya_param(lya_param *plya){
     J[plya->index_Py_plus+j][plya->index_Px_minus+j] = 1;
     J[plya->index_Py_plus+j][plya->index_Py_plus+j] = 1;
     //F-Py_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Py_minus+j][plya->index_Py_minus+k] = 1;
     J[plya->index_Py_minus+j][plya->index_L] = 1;
     J[plya->index_Py_minus+j][plya->index_Pa_minus+j] = 1;
@@ -201,15 +199,15 @@ int init_lya_param(lya_param *plya){
   //Loop over grid:
   for (j=0; j<vres; j++){
     //F-Pa_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Pa_plus+j+neq][plya->index_Pa_plus+k+neq] = 1;
     J[plya->index_Pa_plus+j+neq][plya->index_Py_plus+j+neq] = 1;
     //F-Pa_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Pa_minus+j+neq][plya->index_Pa_minus+k+neq] = 1;
     J[plya->index_Pa_minus+j+neq][plya->index_Py_minus+j+neq] = 1;
     //F-Ps_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Ps_plus+j+neq][plya->index_Ps_plus+k+neq] = 1;
     J[plya->index_Ps_plus+j+neq][plya->index_Py_plus+j+neq] = 1;
     //R_nus_plus dependence:
@@ -218,13 +216,13 @@ int init_lya_param(lya_param *plya){
       J[plya->index_Ps_plus+j+neq][plya->index_Ps_plus+k+neq] = 1;
     }
     //F-Ps_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Ps_minus+j+neq][plya->index_Ps_minus+k+neq] = 1;
     J[plya->index_Ps_minus+j+neq][plya->index_Py_minus+j+neq] = 1;
     //R_nus_minus dependence:
     J[plya->index_Ps_minus+j+neq][plya->index_Pa_minus+j+neq] = 1;
     //F-Px_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Px_plus+j+neq][plya->index_Px_plus+k+neq] = 1;
     J[plya->index_Px_plus+j+neq][plya->index_L+neq] = 1;
     for (k=0; k<vres; k++)
@@ -232,7 +230,7 @@ int init_lya_param(lya_param *plya){
     J[plya->index_Px_plus+j+neq][plya->index_Py_plus+j+neq] = 1;
     J[plya->index_Px_plus+j+neq][plya->index_Py_minus+j+neq] = 1;
     //F-Px_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Px_minus+j+neq][plya->index_Px_minus+k+neq] = 1;
     J[plya->index_Px_minus+j+neq][plya->index_L+neq] = 1;
     for (k=0; k<vres; k++)
@@ -240,7 +238,7 @@ int init_lya_param(lya_param *plya){
     J[plya->index_Px_minus+j+neq][plya->index_Py_plus+j+neq] = 1;
     J[plya->index_Px_minus+j+neq][plya->index_Py_minus+j+neq] = 1;
     //F-Py_plus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Py_plus+j+neq][plya->index_Py_plus+k+neq] = 1;
     J[plya->index_Py_plus+j+neq][plya->index_L+neq] = 1;
     for (k=0; k<vres; k++)
@@ -250,7 +248,7 @@ int init_lya_param(lya_param *plya){
     J[plya->index_Py_plus+j+neq][plya->index_Px_minus+j+neq] = 1;
     J[plya->index_Py_plus+j+neq][plya->index_Py_plus+j+neq] = 1;
     //F-Py_minus[j] dependence:
-    for (k=max(0,j-1); k<min(vres,j+2); k++)
+    for (k=max(0,j-plya->adv.nbnd); k<min(vres,j+plya->adv.nbnd+1); k++)
       J[plya->index_Py_minus+j+neq][plya->index_Py_minus+k+neq] = 1;
     J[plya->index_Py_minus+j+neq][plya->index_L+neq] = 1;
     J[plya->index_Py_minus+j+neq][plya->index_Pa_minus+j+neq] = 1;
@@ -265,8 +263,8 @@ int init_lya_param(lya_param *plya){
   //Store pattern in sparse column compressed form:
   plya->Ap[0] = 0;
   nz = 0;
-  for (i=0; i<2*neq; i++){
-    for (j=0; j<2*neq; j++){
+  for (i=0; i<nsys; i++){
+    for (j=0; j<nsys; j++){
       if (J[j][i] == 1){
 	plya->Ai[nz] = j;
 	nz++;
@@ -287,45 +285,57 @@ int init_lya_param(lya_param *plya){
 };
 
 int free_lya_param(lya_param *plya){
-  int i;
-  free(plya->xi);
-  free(plya->ui);
-  free(plya->vi);
   free(plya->Tvec);
-  free(plya->duidT);
-  free(plya->dvidT);
-  free(plya->duidx);
-  free(plya->dxidT);
-  free(plya->a);
-  free(plya->y_0);
-  free(plya->maxstep);
-  free(plya->x_grid);
-  free(plya->u_grid);
-  free(plya->v_grid);
-  free(plya->dvdu_grid);
-  free(plya->dudT_grid);
-  for (i=0; i<(plya->Nres+2); i++) 
-    free(plya->mat[i]);
-  free(plya->mat);
-  free(plya->vv);
-  free(plya->indx);
+  qke_scratch_free(&(plya->ws));
+  qke_advection_free(&(plya->adv));
+  mat_writer_close(&(plya->writer));
   free(plya->Ap);
   free(plya->Ai);
+  free(plya->tangent);
+  free(plya->v_out);
+  free(plya->tangent_weight);
+  free(plya->tangent_growth);
   background_free_dof(&(plya->pbs));
        
   return _SUCCESS_;
 };
 
 
+int lya_copy_workspace(void *param, void **param_copy, ErrorMsg error_message){
+  /** Make a copy of plya with private scratch arrays, so that derivs can
+      be called on it from another thread. Tables that are only read by
+      derivs (Tvec, Ai, Ap and the dof table in pbs) are shared, the arrays
+      derivs writes to are in plya->ws. */
+  lya_param *plya=param;
+  lya_param *pcopy;
+
+  lasagna_alloc(pcopy,sizeof(lya_param),error_message);
+  *pcopy = *plya;
+  lasagna_test(qke_scratch_copy(&(plya->ws),&(pcopy->ws)) == _FAILURE_,error_message,
+	       "Could not allocate the private workspace of a thread.");
+  *param_copy = pcopy;
+  return _SUCCESS_;
+}
+
+int lya_free_workspace(void *param_copy, ErrorMsg error_message){
+  /** Free a copy made by lya_copy_workspace. */
+  lya_param *pcopy=param_copy;
+  qke_scratch_free(&(pcopy->ws));
+  free(pcopy);
+  return _SUCCESS_;
+}
+
+
 int lya_initial_conditions(double Ti, double *y, lya_param *plya){
   /** Set initial conditions at temperature Ti: */
-  int i;
+  int i,j;
+  unsigned int seed;
   ErrorMsg error_message;
   double x, L, n_plus=2.0;
-  double Vx,D,Vz,Vz_bar,Px,Py,Px_bar,Py_bar,v_length_sq;
+  double Vx,D,Vz,Vz_bar,Px,Py,Px_bar,Py_bar,v_length_sq,*v;
 
   //Assuming y is calloc'ed -- dangerous, better to zero it.
-  for (i=0; i<plya->neq*2; i++) y[i] = 0.0;
+  for (i=0; i<plya->neq*(1+plya->lyapunov_vectors); i++) y[i] = 0.0;
 
   L = plya->L_initial;
   //Set standard equilibrium initial conditions:
@@ -345,6 +355,7 @@ int lya_initial_conditions(double Ti, double *y, lya_param *plya){
   plya->V1 = -7.0*_PI_*_PI_/(45.0*sqrt(2.0))*
     _G_F_/_M_Z_/_M_Z_*pow(Ti,5)*n_plus*plya->g_alpha;
 
+  lya_param_cache_clear(plya);
   lya_get_resonances_xi(Ti,L,plya);  
   //Get new x_grid
   lasagna_call(lya_get_parametrisation(Ti,
@@ -354,7 +365,7 @@ int lya_initial_conditions(double Ti, double *y, lya_param *plya){
   
 
   for (i=0; i<plya->vres; i++){
-    x = plya->x_grid[i];
+    x = plya->ws.x_grid[i];
     Vx = plya->Vx/x;
     Vz = plya->V0/x + plya->V1*x + plya->VL;
     Vz_bar = plya->V0/x + plya->V1*x - plya->VL;
@@ -373,15 +384,23 @@ int lya_initial_conditions(double Ti, double *y, lya_param *plya){
  
   }
 
-  //Pick a random vector using the provided seed and normalize it.
-  srand(plya->lyapunov_seed);
-  v_length_sq = 0;
-  for(i=plya->neq; i<2*plya->neq; i++){
-    y[i] = rand();
-    v_length_sq += y[i]*y[i];
+  //Pick a random vector using the provided seed and normalize it. The
+  //state of the generator is local, so runs in other threads do not change it.
+  //Vector j of the tangent-linear mode uses the seed lyapunov_seed+j.
+  for (j=0; j<plya->lyapunov_vectors; j++){
+    seed = plya->lyapunov_seed+j;
+    v = y+plya->index_v+j*plya->neq;
+    v_length_sq = 0;
+    for(i=0; i<plya->neq; i++){
+      v[i] = rand_r(&seed);
+      v_length_sq += v[i]*v[i];
+    }
+    for(i=0; i<plya->neq; i++)
+      v[i] /= sqrt(v_length_sq)*plya->v_scale;
+    //ndf15 integrates the tangent in the scaled variables of y:
+    if (plya->tangent_linear == _TRUE_)
+      v[plya->index_L] /= _L_SCALE_;
   }
-  for(i=plya->neq; i<2*plya->neq; i++)
-    y[i] /= sqrt(v_length_sq)*plya->v_scale;
   /*
   for(i=plya->neq; i<2*plya->neq; i++)
     y[i] = 0;
@@ -397,12 +416,25 @@ int lya_initial_conditions(double Ti, double *y, lya_param *plya){
 
 int lya_init_output(lya_param *plya){
   int Tres=plya->Tres;
+  int mode;
   int vres=plya->vres;
   int Nres=plya->Nres;
   int handle;
   double tmp_array[3];
   int32_t tmp_array_int[3];
   char *outf=plya->output_filename;
+  ErrorMsg error_message;
+  //Output mode. Chunked matrices start with one block of columns:
+  if (plya->output_compress > 0)
+    mode = _MAT_WRITER_COMPRESSED_;
+  else if (plya->output_chunk > 0)
+    mode = _MAT_WRITER_CHUNKED_;
+  else if (plya->output_mmap == _TRUE_)
+    mode = _MAT_WRITER_MMAP_;
+  else
+    mode = _MAT_WRITER_FILE_;
+  if (mode == _MAT_WRITER_CHUNKED_)
+    Tres = min(Tres,plya->output_chunk);
   //Initialises the output file and stores parameters
   mat_create_file(outf);
   //Add matrices that are defined on momentum grid:
@@ -425,7 +457,7 @@ int lya_init_output(lya_param *plya){
   //Add other matrices:
   mat_add_matrix(outf,"L_vec",miDOUBLE,Tres,1,&(plya->L_handle));
   mat_add_matrix(outf,"T_vec",miDOUBLE,Tres,1,&(plya->T_handle));
-  mat_add_matrix(outf,"I_vec",miDOUBLE,Tres,1,&(plya->I_handle));
+  mat_add_matrix(outf,"I_vec",miDOUBLE,Tres,plya->lyapunov_vectors,&(plya->I_handle));
   mat_add_matrix(outf,"I_conserved",miDOUBLE,Tres,1,&(plya->I_conserved_handle));
   mat_add_matrix(outf,"V0_vec",miDOUBLE,Tres,1,&(plya->V0_handle));
   mat_add_matrix(outf,"V1_vec",miDOUBLE,Tres,1,&(plya->V1_handle));
@@ -454,10 +486,43 @@ int lya_init_output(lya_param *plya){
   mat_write_data(outf,"xmin_xext_xmax",tmp_array,0,3);
   tmp_array[0] = plya->alpha; tmp_array[1] = plya->rs;
   mat_write_data(outf,"alpha_rs",tmp_array,0,2);
+  //Keep the file open for lya_store_output:
+  if (mat_writer_open(&(plya->writer),outf,plya->output_buffer,32,
+		      sizeof(double)*(11*vres+4*Nres+8+plya->lyapunov_vectors+plya->neq),
+		      mode,plya->output_compress,error_message) == _FAILURE_){
+    printf("%s\n",error_message);
+    return _FAILURE_;
+  }
   return _SUCCESS_;
 }
 
 
+double *lya_lyapunov_vector(double *y, int vector, lya_param *plya){
+  /** The Lyapunov vector v, with the L entry in units of L: the last neq
+      entries of y, or tangent number vector from ndf15 in the 
+      tangent-linear mode. */
+  int i;
+  if (plya->tangent_linear == _FALSE_)
+    return y+plya->index_v;
+  for (i=0; i<plya->neq; i++)
+    plya->v_out[i] = plya->tangent[vector*plya->neq+i];
+  plya->v_out[plya->index_L] *= _L_SCALE_;
+  return plya->v_out;
+}
+
+double lya_information_lost(double *y, int vector, lya_param *plya){
+  /** Bits of information lost along Lyapunov vector number vector,
+      including the growth removed by the Gram-Schmidt of ndf15. */
+  int i;
+  double v_length_sq=0, *v;
+  v = lya_lyapunov_vector(y,vector,plya);
+  for(i=0; i<plya->neq; i++)
+    v_length_sq += v[i]*v[i];
+  if (plya->tangent_growth == NULL)
+    return log(sqrt(v_length_sq)*plya->v_scale)/log(2);
+  return (log(sqrt(v_length_sq)*plya->v_scale)+plya->tangent_growth[vector])/log(2);
+}
+
 int lya_store_output(double T,
 			    double *y,
 			    double *dy,
@@ -468,14 +533,15 @@ int lya_store_output(double T,
   int vres=plya->vres;
   int Nres=plya->Nres;
   int i;
-  double x,xp1,f0,f0p1,Pa_minus,Ps_minus,Ps_minusp1,Pa_minusp1,I_PaPs,L,Ilost,v_length_sq; 
-  FILE *mat_file;
+  double x,xp1,f0,f0p1,Pa_minus,Ps_minus,Ps_minusp1,Pa_minusp1,I_PaPs,L;
+  double Ilost[plya->lyapunov_vectors];
+  mat_writer *mw=&(plya->writer);
   /** Calculate integrated quantities for convenience: */
  
   I_PaPs = 0.0;
   for (i=0; i<plya->vres-1; i++){
-    x = plya->x_grid[i];
-    xp1 = plya->x_grid[i+1];
+    x = plya->ws.x_grid[i];
+    xp1 = plya->ws.x_grid[i+1];
     f0 = 1.0/(1.0+exp(x));
     f0p1 = 1.0/(1.0+exp(xp1));
     Ps_minus = y[plya->index_Py_minus+i];
@@ -485,45 +551,45 @@ int lya_store_output(double T,
     I_PaPs += 0.5*(xp1-x)*(x*x*f0*(Ps_minus+Pa_minus)+
 			   xp1*xp1*f0p1*(Ps_minusp1+Pa_minusp1));
   }
-  //Calculate the information lost:
-  v_length_sq = 0;
-  for(i=plya->neq; i<2*plya->neq; i++)
-    v_length_sq += y[i]*y[i];
-  Ilost = log(sqrt(v_length_sq)*plya->v_scale)/log(2);
+  //Calculate the information lost along each vector:
+  for (i=0; i<plya->lyapunov_vectors; i++)
+    Ilost[i] = lya_information_lost(y,i,plya);
 
   //printf("Storing output at index: %d\n",index_t);
-  mat_file = fopen(plya->output_filename,"r+b");
+  lasagna_test(mat_writer_begin(mw)==_FAILURE_,error_message,
+	       "Writing to %s failed.",plya->output_filename);
   //Write stuff from y_vector:
   L = y[plya->index_L]*_L_SCALE_;
-  mat_write_fast(&L,plya->L_handle,8,1);
-  mat_write_fast(y+plya->index_Pa_plus,plya->Pa_plus_handle,8,vres);
-  mat_write_fast(y+plya->index_Pa_minus,plya->Pa_minus_handle,8,vres);
-  mat_write_fast(y+plya->index_Ps_plus,plya->Ps_plus_handle,8,vres);
-  mat_write_fast(y+plya->index_Ps_minus,plya->Ps_minus_handle,8,vres);
-  mat_write_fast(y+plya->index_Px_plus,plya->Px_plus_handle,8,vres);
-  mat_write_fast(y+plya->index_Px_minus,plya->Px_minus_handle,8,vres);
-  mat_write_fast(y+plya->index_Py_plus,plya->Py_plus_handle,8,vres);
-  mat_write_fast(y+plya->index_Py_minus,plya->Py_minus_handle,8,vres);
+  mat_writer_put(mw,&L,&(plya->L_handle),8,1);
+  mat_writer_put(mw,y+plya->index_Pa_plus,&(plya->Pa_plus_handle),8,vres);
+  mat_writer_put(mw,y+plya->index_Pa_minus,&(plya->Pa_minus_handle),8,vres);
+  mat_writer_put(mw,y+plya->index_Ps_plus,&(plya->Ps_plus_handle),8,vres);
+  mat_writer_put(mw,y+plya->index_Ps_minus,&(plya->Ps_minus_handle),8,vres);
+  mat_writer_put(mw,y+plya->index_Px_plus,&(plya->Px_plus_handle),8,vres);
+  mat_writer_put(mw,y+plya->index_Px_minus,&(plya->Px_minus_handle),8,vres);
+  mat_writer_put(mw,y+plya->index_Py_plus,&(plya->Py_plus_handle),8,vres);
+  mat_writer_put(mw,y+plya->index_Py_minus,&(plya->Py_minus_handle),8,vres);
   //Write stuff from structure:
-  mat_write_fast(plya->x_grid,plya->x_grid_handle,8,vres);
-  mat_write_fast(plya->u_grid,plya->u_grid_handle,8,vres);
-  mat_write_fast(plya->v_grid,plya->v_grid_handle,8,vres);
-  mat_write_fast(plya->xi,plya->xi_handle,8,Nres);
-  mat_write_fast(plya->ui,plya->ui_handle,8,Nres);
-  mat_write_fast(plya->vi,plya->vi_handle,8,Nres);
-  mat_write_fast(&(I_PaPs),plya->I_conserved_handle,8,1);
-  mat_write_fast(&(plya->V0),plya->V0_handle,8,1);
-  mat_write_fast(&(plya->V1),plya->V1_handle,8,1);
-  mat_write_fast(&(plya->Vx),plya->Vx_handle,8,1);
-  mat_write_fast(&(plya->VL),plya->VL_handle,8,1);
-  mat_write_fast(&(plya->b),plya->b_a_vec_handle,8,1);
-  mat_write_fast(&Ilost,plya->I_handle,8,1);
-  mat_write_fast(y+plya->index_v,plya->v_handle,8,plya->neq);
-  mat_write_fast(plya->vi,plya->b_a_vec_handle,8,Nres);//Wrong
+  mat_writer_put(mw,plya->ws.x_grid,&(plya->x_grid_handle),8,vres);
+  mat_writer_put(mw,plya->ws.u_grid,&(plya->u_grid_handle),8,vres);
+  mat_writer_put(mw,plya->ws.v_grid,&(plya->v_grid_handle),8,vres);
+  mat_writer_put(mw,plya->ws.xi,&(plya->xi_handle),8,Nres);
+  mat_writer_put(mw,plya->ws.ui,&(plya->ui_handle),8,Nres);
+  mat_writer_put(mw,plya->ws.vi,&(plya->vi_handle),8,Nres);
+  mat_writer_put(mw,&(I_PaPs),&(plya->I_conserved_handle),8,1);
+  mat_writer_put(mw,&(plya->V0),&(plya->V0_handle),8,1);
+  mat_writer_put(mw,&(plya->V1),&(plya->V1_handle),8,1);
+  mat_writer_put(mw,&(plya->Vx),&(plya->Vx_handle),8,1);
+  mat_writer_put(mw,&(plya->VL),&(plya->VL_handle),8,1);
+  mat_writer_put(mw,&(plya->b),&(plya->b_a_vec_handle),8,1);
+  mat_writer_put(mw,Ilost,&(plya->I_handle),8,plya->lyapunov_vectors);
+  mat_writer_put(mw,lya_lyapunov_vector(y,0,plya),&(plya->v_handle),8,plya->neq);
+  mat_writer_put(mw,plya->ws.vi,&(plya->b_a_vec_handle),8,Nres);//Wrong
 
   //Write temperature at last so we know that everything has been written:
-  mat_write_fast(&T,plya->T_handle,8,1);
-  fclose(mat_file);
+  mat_writer_put(mw,&T,&(plya->T_handle),8,1);
+  lasagna_test(mat_writer_commit(mw)==_FAILURE_,error_message,
+	       "Writing to %s failed.",plya->output_filename);
   return _SUCCESS_;
 };
 
@@ -534,13 +600,13 @@ int lya_print_variables(double T,
 			ErrorMsg error_message){
   
   lya_param *plya=param;
-  int idx=53,i;
+  int idx=53;
   double x,Vx,V0,V1,VL;
   double D,Gamma;
   double Pa_plus, Pa_minus, Ps_plus, Ps_minus, Px_plus, Px_minus;
   double Py_plus, Py_minus;
-  double Ilost, v_length_sq;
-  x = plya->x_grid[idx];
+  double Ilost;
+  x = plya->ws.x_grid[idx];
   Vx = plya->Vx/x;
   V0 = plya->V0/x;
   V1 = plya->V1*x;
@@ -558,11 +624,7 @@ int lya_print_variables(double T,
   Py_minus = y[plya->index_Py_minus+idx];
 
   //Calculate the information lost:
-  v_length_sq = 0;
-  for(i=plya->neq; i<2*plya->neq; i++)
-    v_length_sq += y[i]*y[i];
-  Ilost = log(sqrt(v_length_sq)*plya->v_scale)/log(2);
-
+  Ilost = lya_information_lost(y,0,plya);
 
   fprintf(stderr,
 	  "%.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e\n",
@@ -597,47 +659,143 @@ int lya_derivs(double T,
 	       void *param,
 	       ErrorMsg error_message){
   lya_param *plya=param;
-  double L;
-  int i, j;
-  double *v_grid=plya->v_grid;
-  double *dvdu_grid=plya->dvdu_grid;
-  double *dudT_grid=plya->dudT_grid;
-  double gentr,H;
-  double Vx, VL;
-  double x;
-  double Gamma, D, V0, V1, Pa_plus, Pa_minus, Ps_plus, Ps_minus;
-  double Px_plus, Px_minus, Py_plus, Py_minus, f0,  mu_div_T;
-  double feq_plus, feq_minus, I_VxPy_minus, I_f0Pa_plus, I_rho_ss;
-  double dudTdvdu, delta_v;
-  double rs;
-  int idx, stencil_method;
+  double H, mu_div_T;
+
+  lasagna_call(lya_derivs_setup(T,
+				y[plya->index_L]*_L_SCALE_,
+				plya,
+				&H,
+				&mu_div_T,
+				error_message),
+	       error_message,error_message);
+  lasagna_call(lya_derivs_state(T,
+				y,
+				dy,
+				H,
+				mu_div_T,
+				plya,
+				error_message),
+	       error_message,error_message);
+  return _SUCCESS_;
+}
+
+int lya_derivs_batch(double T, 
+		     double **y, 
+		     double **dy, 
+		     int m,
+		     void *param,
+		     ErrorMsg error_message){
+  /** As qke_derivs_batch: the setup is shared by all states with the L
+      of y[0], the other states are evaluated on their own. */
+  lya_param *plya=param;
+  double H, mu_div_T;
+  int k;
+
+  lasagna_call(lya_derivs_setup(T,
+				y[0][plya->index_L]*_L_SCALE_,
+				plya,
+				&H,
+				&mu_div_T,
+				error_message),
+	       error_message,error_message);
+  for (k=0; k<m; k++){
+    if (y[k][plya->index_L] != y[0][plya->index_L])
+      continue;
+    lasagna_call(lya_derivs_state(T,
+				  y[k],
+				  dy[k],
+				  H,
+				  mu_div_T,
+				  plya,
+				  error_message),
+		 error_message,error_message);
+  }
+  for (k=1; k<m; k++){
+    if (y[k][plya->index_L] == y[0][plya->index_L])
+      continue;
+    lasagna_call(lya_derivs(T,
+			    y[k],
+			    dy[k],
+			    plya,
+			    error_message),
+		 error_message,error_message);
+  }
+  return _SUCCESS_;
+}
+
+int lya_derivs_setup(double T, 
+		     double L, 
+		     lya_param *plya,
+		     double *H,
+		     double *mu_div_T,
+		     ErrorMsg error_message){
+  /** The part of lya_derivs that depends on T and L only. */
+  double gentr;
   double n_plus = 2.0;
-  double dLdT;
-  int nnz, i_Ap;
-  SCCformat *J_SCC;
-  DNRformat *J_DNR;
+
   if (plya->is_electron==_TRUE_)
     plya->g_alpha = 1.0+4.0/((1.0-_SIN2_THETA_W_)*n_plus);
   else
     plya->g_alpha = 1.0;
-  L = y[plya->index_L]*_L_SCALE_;
   
   /** Calculate 'scalar' potentials Vx, V0, VL
       (not momentum dependent): */
   plya->VL = sqrt(2.0)*_G_F_*2.0*_ZETA3_*pow(T,3)/_PI_/_PI_*L;
-  VL = plya->VL;
   plya->Vx = plya->delta_m2/(2.0*T)*sin(2.0*plya->theta_zero);
   plya->V0 = -plya->delta_m2/(2.0*T)*cos(2.0*plya->theta_zero);
   plya->V1 = -7.0*_PI_*_PI_/(45.0*sqrt(2.0))*
     _G_F_/_M_Z_/_M_Z_*pow(T,5)*n_plus*plya->g_alpha;
 
-  lya_get_resonances_xi(T,L,plya);
-  
-  //Get new x_grid
-  lasagna_call(lya_get_parametrisation(T,
-				   plya, 
-				   error_message),
+  //Get new x_grid, or the one from an earlier call with this T and L:
+  lasagna_call(lya_parametrisation_cached(T,
+					  L,
+					  plya, 
+					  error_message),
 	       error_message,error_message);
+
+  //Get degrees of freedom from background:
+  background_getdof(T,NULL,&gentr,&(plya->pbs));
+  /** Use Friedmann equation in radiation dominated universe: 
+      (The radiation approximation breaks down long before there 
+      is a difference in g and gS) */  
+  *H = sqrt(8.0*pow(_PI_,3)*gentr/90.0)*T*T/_M_PL_;
+
+  //Solving mu from L, using the chebyshev cubic root:
+  *mu_div_T = -2*_PI_/sqrt(3.0)*
+    sinh(1.0/3.0*asinh(-18.0*sqrt(3.0)*_ZETA3_*L/pow(_PI_,3)));
+  return _SUCCESS_;
+}
+
+int lya_derivs_state(double T, 
+		     double *y, 
+		     double *dy, 
+		     double H,
+		     double mu_div_T,
+		     lya_param *plya,
+		     ErrorMsg error_message){
+  /** The part of lya_derivs that depends on the state y, after 
+      lya_derivs_setup has been called with the L of y. */
+  double L;
+  int i, j;
+  double *dvdu_grid=plya->ws.dvdu_grid;
+  double *dudT_grid=plya->ws.dudT_grid;
+  double Vx, VL;
+  double x;
+  double Gamma, D, V0, V1, Pa_plus, Pa_minus, Ps_plus, Ps_minus;
+  double Px_plus, Px_minus, Py_plus, Py_minus, f0;
+  double feq_plus, feq_minus, I_VxPy_minus, I_f0Pa_plus, I_rho_ss;
+  double rs;
+  int idx;
+  int index_field[8]={plya->index_Pa_plus, plya->index_Pa_minus,
+		      plya->index_Ps_plus, plya->index_Ps_minus,
+		      plya->index_Px_plus, plya->index_Px_minus,
+		      plya->index_Py_plus, plya->index_Py_minus};
+  double dLdT;
+  SCCformat *J_SCC;
+  DNRformat *J_DNR;
+
+  L = y[plya->index_L]*_L_SCALE_;
+  VL = plya->VL;
   
   //Get integrated quantities
   lasagna_call(lya_get_integrated_quantities(y,
@@ -647,13 +805,6 @@ int lya_derivs(double T,
 					 &I_rho_ss,
 					 error_message),
 	       error_message,error_message);
-   
-  //Get degrees of freedom from background:
-  background_getdof(T,NULL,&gentr,&(plya->pbs));
-  /** Use Friedmann equation in radiation dominated universe: 
-      (The radiation approximation breaks down long before there 
-      is a difference in g and gS) */  
-  H = sqrt(8.0*pow(_PI_,3)*gentr/90.0)*T*T/_M_PL_;
 
   dLdT = -1.0/(8.0*H*T*_ZETA3_)*I_VxPy_minus;
   
@@ -667,14 +818,15 @@ int lya_derivs(double T,
 
   /** Calculate RHS: */
   dy[plya->index_L] = dLdT/_L_SCALE_;
-  //Solving mu from L, using the chebyshev cubic root:
-  mu_div_T = -2*_PI_/sqrt(3.0)*
-    sinh(1.0/3.0*asinh(-18.0*sqrt(3.0)*_ZETA3_*L/pow(_PI_,3)));
   
-  /** All quantities defined on the grid: */
-  delta_v = v_grid[1]-v_grid[0];
+  /** All quantities defined on the grid. The bins are independent, so
+      they are shared out over rhs_threads threads: */
+#pragma omp parallel for num_threads(plya->rhs_threads) if(plya->rhs_threads>1) \
+  private(x,Vx,V0,V1,Gamma,D,Pa_plus,Pa_minus,Ps_plus,Ps_minus,Px_plus,Px_minus, \
+	  Py_plus,Py_minus,rs,feq_plus,feq_minus,f0,idx) \
+  schedule(static)
   for (i=0; i<plya->vres; i++){
-    x = plya->x_grid[i];
+    x = plya->ws.x_grid[i];
     Vx = plya->Vx/x;
     V0 = plya->V0/x;
     V1 = plya->V1*x;
@@ -703,67 +855,60 @@ int lya_derivs(double T,
 
     f0 = 1.0/(1.0+exp(x));
 
-    dudTdvdu = dudT_grid[i]*dvdu_grid[i];
-
-
-    //Define index steps for calculating derivatives:
-    if (i==0)
-      stencil_method = 12; //First order, forward   12
-    else if (i==plya->vres-1)
-      stencil_method = 10; //First order, backwards 10
-    else if ((i==plya->vres-2)||(i==1))
-      stencil_method = 21; //Second order, centered 21
-    else
-      stencil_method = 21; //Fifth order, centered  51
-    
+    plya->ws.rhs_work[i] = dudT_grid[i]*dvdu_grid[i];
 
     idx = plya->index_Pa_plus+i;
-    dy[idx] = -1.0/(H*T)*(Vx*Py_plus+Gamma*(2.0*feq_plus/f0-Pa_plus))+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+    dy[idx] = -1.0/(H*T)*(Vx*Py_plus+Gamma*(2.0*feq_plus/f0-Pa_plus));
 
     idx = plya->index_Pa_minus+i;
-    dy[idx] = -1.0/(H*T)*(Vx*Py_minus+Gamma*(2.0*feq_minus/f0-Pa_minus))+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+    dy[idx] = -1.0/(H*T)*(Vx*Py_minus+Gamma*(2.0*feq_minus/f0-Pa_minus));
 
     idx = plya->index_Ps_plus+i;
     dy[idx] = 1.0/(H*T)*(Vx*Py_plus - rs*Gamma*(1.0/(6.0*_ZETA3_)*I_rho_ss*
-						feq_plus-0.5*f0*Ps_plus)) +
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+						feq_plus-0.5*f0*Ps_plus));
 
     idx = plya->index_Ps_minus+i;
     dy[idx] = 1.0/(H*T)*(Vx*Py_minus-rs*Gamma*f0*
-			 (1.0-0.5*(Pa_minus+Ps_minus))) +
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+			 (1.0-0.5*(Pa_minus+Ps_minus)));
 
     idx = plya->index_Px_plus+i;
-    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_plus+VL*Py_minus+D*Px_plus)+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_plus+VL*Py_minus+D*Px_plus);
 
     idx = plya->index_Px_minus+i;
-    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_minus+VL*Py_plus+D*Px_minus)+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_minus+VL*Py_plus+D*Px_minus);
 
     idx = plya->index_Py_plus+i;
     dy[idx] = 1.0/(H*T)*
-      (-(V0+V1)*Px_plus-VL*Px_minus+0.5*Vx*(Pa_plus-Ps_plus)+D*Py_plus)+ 
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+      (-(V0+V1)*Px_plus-VL*Px_minus+0.5*Vx*(Pa_plus-Ps_plus)+D*Py_plus);
    
     idx = plya->index_Py_minus+i;
     dy[idx] = 1.0/(H*T)*
-      (-(V0+V1)*Px_minus-VL*Px_plus+0.5*Vx*(Pa_minus-Ps_minus)+D*Py_minus)+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
+      (-(V0+V1)*Px_minus-VL*Px_plus+0.5*Vx*(Pa_minus-Ps_minus)+D*Py_minus);
+  }
+  /** Advection terms dudT*dvdu*drhodv through the banded operator: */
+#pragma omp parallel for num_threads(plya->rhs_threads) if(plya->rhs_threads>1) \
+  private(idx) schedule(static)
+  for (j=0; j<8; j++){
+    idx = index_field[j];
+    qke_advection_apply(&(plya->adv), y+idx, dy+idx, plya->ws.rhs_work);
   }
 
   
   /*
-    Calculate dv/dT = J*v.
+    Calculate dv/dT = J*v. The evolver does this in the tangent-linear mode.
   */
+  if (plya->tangent_linear == _TRUE_)
+    return _SUCCESS_;
 
   //Scale the L-component of v:
   y[plya->neq] /= _L_SCALE_;
   switch(plya->LinearAlgebraWrapper){
   case LINALG_WRAPPER_SPARSE:
   case LINALG_WRAPPER_SUPERLU:
+  case LINALG_WRAPPER_SUPERNODAL:
+  case LINALG_WRAPPER_GMRES:
+  case LINALG_WRAPPER_CUDA:
+  case LINALG_WRAPPER_BLOCK:
 
     J_SCC = (SCCformat *) ((**(plya->J_pp)).Store);
 
@@ -779,6 +924,7 @@ int lya_derivs(double T,
     break;
 
   case LINALG_WRAPPER_DENSE_NR:
+  case LINALG_WRAPPER_DENSE:
     J_DNR = (DNRformat *) ((**(plya->J_pp)).Store);
     for(i=0; i<plya->neq; i++){
       dy[i+plya->neq]=0.0;
@@ -812,8 +958,8 @@ int lya_derivs(double T,
 int lya_get_resonances_xi(double T, 
 		      double L,
 		      lya_param *plya){
-  double *xi=plya->xi;
-  double x0, x0b,A;
+  double *xi=plya->ws.xi;
+  double x0,A;
   int i;
 
   x0 = sqrt(fabs(plya->V0/plya->V1));
@@ -847,7 +993,7 @@ int lya_get_resonances_dxidT(double T,
 			 double dLdT,
 			 lya_param *plya){
   double x0, A,A2;
-  double *dxidT=plya->dxidT;
+  double *dxidT=plya->ws.dxidT;
   double F;
   double one_plus_dlogLdlogT;
   int i;
@@ -882,7 +1028,7 @@ int lya_get_resonances_dxidT(double T,
   }
   //Make it selfconsistent:
   for (i=0; i<plya->Nres; i++){
-    if(plya->xi[i]>=(plya->xmax-1e-12)){
+    if(plya->ws.xi[i]>=(plya->xmax-1e-12)){
       dxidT[i] = 0.0;
     }
   }
@@ -912,8 +1058,8 @@ int lya_nonlinear_rhs(double *y, double *Fy, void *param){
   double b=y[0];
   double *vi=y+1;
   double alpha = plya->alpha;
-  double *ui=plya->ui;
-  double *a=plya->a;
+  double *ui=plya->ws.ui;
+  double *a=plya->ws.a;
   int i,n=plya->Nres;
 
   for (i=0; i<n; i++){
@@ -950,14 +1096,18 @@ int lya_nonlinear_rhs_jac(double *y, double **jac, void *param){
   return _SUCCESS_;
 }
 
+int lya_nonlinear_rhs_sparse_jac(double *y, double *Jx, void *param){
+  lya_param *plya=param;
+  return parametrisation_jacobian(plya->Nres,plya->alpha,y,Jx);
+}
+
 int lya_stop_at_divL(double t,
 		     double *y,
 		     double *dy,
 		     void *param,
 		     ErrorMsg error_message){
   lya_param *plya=param;
-  double L, T, stopfactor,v_length_sq;
-  int i;
+  double L, T, stopfactor;
   stopfactor = 2;
   L = y[plya->index_L]*_L_SCALE_;
   T = t;
@@ -981,10 +1131,7 @@ int lya_stop_at_divL(double t,
     else if(T<plya->breakpoint)
       return _TRUE_;
   }
-  v_length_sq = 0;
-  for(i=plya->neq; i<2*plya->neq; i++)
-    v_length_sq += y[i]*y[i];
-  if(sqrt(v_length_sq)*plya->v_scale > pow(2,plya->I_stop)){
+  if(lya_information_lost(y,0,plya) > plya->I_stop){
     printf("The information loss is larger than %g bits. Calculation stopped.\n",plya->I_stop);
     return _TRUE_;
   }
@@ -1009,52 +1156,145 @@ int lya_get_integrated_quantities(double *y,
 			      double *I_f0Pa_plus,
 			      double *I_rho_ss,
 			      ErrorMsg error_message){
-  int i;
+  int i, iblock, nblock;
   double w_trapz, x, x2, f0, Vx;
   double Py_minus, Pa_plus, Ps_plus_Ps_minus;
+  double *sum;
 			      
-  /** Integrated quantities needed. We integrate in x space: */
+  /** Integrated quantities needed. We integrate in x space, summing blocks
+      of _RHS_BLOCK_ bins and adding the blocks in order, so the result does
+      not depend on the number of threads: */
+  nblock = (plya->vres+_RHS_BLOCK_-1)/_RHS_BLOCK_;
+#pragma omp parallel for num_threads(plya->rhs_threads) if(plya->rhs_threads>1) \
+  private(i,sum,w_trapz,x,x2,f0,Vx,Py_minus,Pa_plus,Ps_plus_Ps_minus) schedule(static)
+  for (iblock=0; iblock<nblock; iblock++){
+    sum = plya->ws.rhs_partial+3*iblock;
+    sum[0] = 0.0;
+    sum[1] = 0.0;
+    sum[2] = 0.0;
+    for (i=iblock*_RHS_BLOCK_; i<min((iblock+1)*_RHS_BLOCK_,plya->vres); i++){
+      if (i==0)
+	w_trapz = 0.5*(plya->ws.x_grid[i+1]-plya->ws.x_grid[i]);
+      else if (i==plya->vres-1)
+	w_trapz = 0.5*(plya->ws.x_grid[i]-plya->ws.x_grid[i-1]);
+      else
+	w_trapz = 0.5*(plya->ws.x_grid[i+1]-plya->ws.x_grid[i-1]);
+      x = plya->ws.x_grid[i];
+      x2 = x*x;
+      f0 = 1.0/(1.0+exp(x));
+      Vx = plya->Vx/x;
+      Py_minus = y[plya->index_Py_minus+i];
+      Pa_plus = y[plya->index_Pa_plus+i];
+      Ps_plus_Ps_minus = (y[plya->index_Ps_plus+i] + y[plya->index_Ps_minus+i]);
+      
+      sum[0] += w_trapz*(x2*f0*Vx*Py_minus);
+      sum[1] += w_trapz*(x2*f0*Pa_plus);
+      sum[2] += w_trapz*(x2*f0*Ps_plus_Ps_minus); //From equation 2.18 in KS01.
+    }
+  }
   *I_VxPy_minus = 0.0;
   *I_f0Pa_plus = 0.0;
   *I_rho_ss = 0.0;
-  for (i=0; i<plya->vres; i++){
-    if (i==0)
-      w_trapz = 0.5*(plya->x_grid[i+1]-plya->x_grid[i]);
-    else if (i==plya->vres-1)
-      w_trapz = 0.5*(plya->x_grid[i]-plya->x_grid[i-1]);
+  for (iblock=0; iblock<nblock; iblock++){
+    sum = plya->ws.rhs_partial+3*iblock;
+    *I_VxPy_minus += sum[0];
+    *I_f0Pa_plus += sum[1];
+    *I_rho_ss += sum[2];
+  }
+  return _SUCCESS_;
+}
+
+int lya_parametrisation_cached(double T, 
+			      double L, 
+			      lya_param *plya, 
+			      ErrorMsg error_message){
+  /** lya_get_resonances_xi and lya_get_parametrisation memoised on (T,L). numjac calls derivs
+      with the same T and L for all column groups but the one holding L,
+      and the grid already in plya is then used as it is. */
+  int len=3+5*plya->Nres+2*plya->vres;
+  int k;
+  double *entry;
+
+  k = plya->param_cache_current;
+  if ((k>=0)&&(plya->ws.param_cache[k*len]==T)&&(plya->ws.param_cache[k*len+1]==L))
+    return _SUCCESS_;
+  for (k=0; k<_PARAM_CACHE_; k++){
+    entry = plya->ws.param_cache+k*len;
+    if ((entry[0]==T)&&(entry[1]==L)){
+      lya_param_cache_copy(entry,plya,_FALSE_);
+      plya->param_cache_current = k;
+      return _SUCCESS_;
+    }
+  }
+  lya_get_resonances_xi(T,L,plya);
+  lasagna_call(lya_get_parametrisation(T,
+				   plya, 
+				   error_message),
+	       error_message,error_message);
+  k = plya->param_cache_next;
+  plya->param_cache_next = (k+1)%_PARAM_CACHE_;
+  entry = plya->ws.param_cache+k*len;
+  entry[0] = T;
+  entry[1] = L;
+  lya_param_cache_copy(entry,plya,_TRUE_);
+  plya->param_cache_current = k;
+  return _SUCCESS_;
+}
+
+int lya_param_cache_copy(double *entry, lya_param *plya, int store){
+  /** Copies the parametrisation to (store=_TRUE_) or from a cache entry. */
+  int Nres=plya->Nres, vres=plya->vres;
+  double *v[5]={plya->ws.xi, plya->ws.ui, plya->ws.duidx, plya->ws.vi, plya->ws.a};
+  int i;
+
+  entry += 2;
+  for (i=0; i<5; i++){
+    if (store == _TRUE_)
+      memcpy(entry+i*Nres,v[i],sizeof(double)*Nres);
     else
-      w_trapz = 0.5*(plya->x_grid[i+1]-plya->x_grid[i-1]);
-    x = plya->x_grid[i];
-    x2 = x*x;
-    f0 = 1.0/(1.0+exp(x));
-    Vx = plya->Vx/x;
-    Py_minus = y[plya->index_Py_minus+i];
-    Pa_plus = y[plya->index_Pa_plus+i];
-    Ps_plus_Ps_minus = (y[plya->index_Ps_plus+i] + y[plya->index_Ps_minus+i]);
-      
-    *I_VxPy_minus += w_trapz*(x2*f0*Vx*Py_minus);
-    *I_f0Pa_plus += w_trapz*(x2*f0*Pa_plus);
-    *I_rho_ss += w_trapz*(x2*f0*Ps_plus_Ps_minus); //From equation 2.18 in KS01.
+      memcpy(v[i],entry+i*Nres,sizeof(double)*Nres);
+  }
+  entry += 5*Nres;
+  if (store == _TRUE_){
+    entry[0] = plya->b;
+    memcpy(entry+1,plya->ws.u_grid,sizeof(double)*vres);
+    memcpy(entry+1+vres,plya->ws.x_grid,sizeof(double)*vres);
   }
+  else{
+    plya->b = entry[0];
+    memcpy(plya->ws.u_grid,entry+1,sizeof(double)*vres);
+    memcpy(plya->ws.x_grid,entry+1+vres,sizeof(double)*vres);
+  }
+  return _SUCCESS_;
+}
+
+int lya_param_cache_clear(lya_param *plya){
+  /** Empties the cache, the keys are set to the impossible T=-1. */
+  int len=3+5*plya->Nres+2*plya->vres;
+  int k;
+  for (k=0; k<_PARAM_CACHE_; k++)
+    plya->ws.param_cache[k*len] = -1.0;
+  plya->param_cache_current = -1;
+  plya->param_cache_next = 0;
   return _SUCCESS_;
 }
 
 int lya_get_parametrisation(double T,lya_param *plya, ErrorMsg error_message){
   double alpha=plya->alpha;
-  double *maxstep=plya->maxstep;;
-  double *y_0=plya->y_0;
-  double *ui=plya->ui;
-  double *vi=plya->vi;
-  double *x_grid=plya->x_grid;
-  double *u_grid=plya->u_grid;
-  double *v_grid=plya->v_grid;
+  double *maxstep=plya->ws.maxstep;;
+  double *y_0=plya->ws.y_0;
+  double *ui=plya->ws.ui;
+  double *vi=plya->ws.vi;
+  double *x_grid=plya->ws.x_grid;
+  double *u_grid=plya->ws.u_grid;
+  double *v_grid=plya->ws.v_grid;
   double tol_newton=1e-12;
   double wi;
   int i,j;
   int niter;
 
   for (i=0; i<plya->Nres; i++){
-    lya_u_of_x(plya->xi[i],ui+i,plya->duidx+i,plya);
+    lya_u_of_x(plya->ws.xi[i],ui+i,plya->ws.duidx+i,plya);
   }
   
   //Establish guess and set maximum steps for Newton method:
@@ -1062,7 +1302,7 @@ int lya_get_parametrisation(double T,lya_param *plya, ErrorMsg error_message){
       on the derivative function to give exactly the same output for the same
       inputs, so making a non-deterministic guess here spoils this!
   */
-  if (1==1){//(plya->guess_exists == _FALSE_){
+  if ((plya->warm_start == _FALSE_)||(plya->guess_exists == _FALSE_)){
     y_0[0] = 1.0 - alpha;
     maxstep[0] = 100.0;
     for (i=1; i<=plya->Nres; i++){
@@ -1071,52 +1311,73 @@ int lya_get_parametrisation(double T,lya_param *plya, ErrorMsg error_message){
     }
   }
   else{
-    //We can make a more realistic guess:
+    /** We can make a more realistic guess from the last solution, with
+	vi moved along dvidT. Only used if warm_start is set, see above. */
     y_0[0] = plya->b;
     maxstep[0] = 100.0;
     for (i=1; i<=plya->Nres; i++){
-      y_0[i] = vi[i-1];
+      y_0[i] = vi[i-1]+plya->ws.dvidT[i-1]*(T-plya->T_guess);
       maxstep[i] = 0.1;
     }
   }
   //Find parametrisation parameters vi, a and b using Newton:
-  lasagna_call(Newton(lya_nonlinear_rhs,
-		      lya_nonlinear_rhs_jac,
-		      y_0,
-		      plya,
-		      maxstep,
-		      tol_newton,
-		      &niter,
-		      100,
-		      plya->Nres+1,
-		      error_message),
-	       error_message,error_message);
+  if (plya->sparse_newton == _TRUE_){
+    if (plya->ws.newton == NULL)
+      lasagna_call(parametrisation_newton_alloc(plya->Nres,&(plya->ws.newton),error_message),
+		   error_message,error_message);
+    lasagna_call(Newton_sparse(lya_nonlinear_rhs,
+			       lya_nonlinear_rhs_sparse_jac,
+			       y_0,
+			       plya,
+			       maxstep,
+			       tol_newton,
+			       &niter,
+			       100,
+			       plya->ws.newton,
+			       error_message),
+		 error_message,error_message);
+  }
+  else{
+    lasagna_call(Newton(lya_nonlinear_rhs,
+			lya_nonlinear_rhs_jac,
+			y_0,
+			plya,
+			maxstep,
+			tol_newton,
+			&niter,
+			100,
+			plya->Nres+1,
+			error_message),
+		 error_message,error_message);
+  }
   plya->guess_exists = _TRUE_;
+  plya->T_guess = T;
+  plya->param_cache_current = -1;
   plya->b = y_0[0];
   for (i=0; i<plya->Nres; i++){
     vi[i] = y_0[i+1];
-    plya->a[i] = ui[i]-alpha*vi[i];
+    plya->ws.a[i] = ui[i]-alpha*vi[i];
   }
 
   //Now update grids:
-  /** Find the splitting of v and store it temporarily in plya->indx.
+  /** Find the splitting of v and store it temporarily in plya->ws.indx.
       We use the fact that v is uniform.
   */
-  plya->indx[0] = 0;
-  plya->indx[plya->Nres] = plya->vres;
+  plya->ws.indx[0] = 0;
+  plya->ws.indx[plya->Nres] = plya->vres;
   for (i=1; i<plya->Nres; i++){
     wi = 0.5*(vi[i-1]+vi[i]); //Weighted average
-    plya->indx[i] = (int)((wi-plya->v_left)/(v_grid[1]-v_grid[0]));
-    if (plya->indx[i]<plya->indx[i-1])
-      plya->indx[i] = plya->indx[i-1];
+    plya->ws.indx[i] = (int)((wi-plya->v_left)/(v_grid[1]-v_grid[0]));
+    if (plya->ws.indx[i]<plya->ws.indx[i-1])
+      plya->ws.indx[i] = plya->ws.indx[i-1];
   }
   // Now loop over resonances:
   for (i=0; i<plya->Nres; i++){
-    if (plya->indx[i]==plya->indx[i+1])
+    if (plya->ws.indx[i]==plya->ws.indx[i+1])
       continue;
     //Loop over each segment:
-    for (j=plya->indx[i]; j<plya->indx[i+1]; j++){
-      u_grid[j] = alpha*v_grid[j]+plya->a[i]+plya->b*pow(v_grid[j]-vi[i],3);
+    for (j=plya->ws.indx[i]; j<plya->ws.indx[i+1]; j++){
+      u_grid[j] = alpha*v_grid[j]+plya->ws.a[i]+plya->b*pow(v_grid[j]-vi[i],3);
       lya_x_of_u(u_grid[j],&(x_grid[j]),plya);
     }
   }
@@ -1133,13 +1394,13 @@ int lya_get_partial_derivatives(double T,
   double u1, v1, vN;
   double gamma_j, beta_j, wi;
   double alpha=plya->alpha;
-  double *dvidT=plya->dvidT;
-  double *duidT=plya->duidT;
-  double *v_grid=plya->v_grid;
-  double *ui=plya->ui;
-  double *vi=plya->vi;
-  double *dvdu_grid=plya->dvdu_grid;
-  double *dudT_grid=plya->dudT_grid;
+  double *dvidT=plya->ws.dvidT;
+  double *duidT=plya->ws.duidT;
+  double *v_grid=plya->ws.v_grid;
+  double *ui=plya->ws.ui;
+  double *vi=plya->ws.vi;
+  double *dvdu_grid=plya->ws.dvdu_grid;
+  double *dudT_grid=plya->ws.dudT_grid;
   double dbdT,daidT;
   double lu_sgn;
 
@@ -1150,11 +1411,11 @@ int lya_get_partial_derivatives(double T,
 
   //Set partial derivatives of ui with respect to T:
   for (i=0; i<plya->Nres; i++){ 
-    plya->duidT[i]=plya->duidx[i]*plya->dxidT[i];
+    plya->ws.duidT[i]=plya->ws.duidx[i]*plya->ws.dxidT[i];
   }
   for(j=0; j<plya->Nres; j++){
     for(i=0; i<plya->Nres; i++){
-        plya->mat[j+1][i+1] = 0.0;
+        plya->ws.mat[j+1][i+1] = 0.0;
     }
   }
   u1 = ui[0];
@@ -1165,42 +1426,42 @@ int lya_get_partial_derivatives(double T,
     /** Enter non-zero entries in A: */
     gamma_j = 0.25*pow(vi[j+1]/v1-vi[j]/v1,3)*(2.0*alpha-3.0*u1/v1);
     beta_j = alpha + 0.75*plya->b*pow(vi[j+1]-vi[j],2);
-    plya->mat[j+1][1] = gamma_j;
-    plya->mat[j+1][j+1] -= beta_j;
-    plya->mat[j+1][j+2] += beta_j;
+    plya->ws.mat[j+1][1] = gamma_j;
+    plya->ws.mat[j+1][j+1] -= beta_j;
+    plya->ws.mat[j+1][j+2] += beta_j;
     /** Setup RHS: */
     dvidT[j] = duidT[j+1]-duidT[j]-0.25*pow(vi[j+1]/v1-vi[j]/v1,3)*duidT[0];
   }
-  plya->mat[plya->Nres][1] = -pow((1.0-vN)/v1,3)*(2.0*alpha-3.0*u1/v1);
-  plya->mat[plya->Nres][plya->Nres] = alpha+3.0*plya->b*pow(1.0-vN,2);
+  plya->ws.mat[plya->Nres][1] = -pow((1.0-vN)/v1,3)*(2.0*alpha-3.0*u1/v1);
+  plya->ws.mat[plya->Nres][plya->Nres] = alpha+3.0*plya->b*pow(1.0-vN,2);
   dvidT[plya->Nres-1] = duidT[plya->Nres-1]+pow((1.0-vN)/v1,3)*duidT[0];
 
   //LU decomposition of matrix:
-  lasagna_call(ludcmp(plya->mat,plya->Nres,plya->indx,&lu_sgn,plya->vv),
+  lasagna_call(ludcmp(plya->ws.mat,plya->Nres,plya->ws.indx,&lu_sgn,plya->ws.vv),
 	       error_message,error_message);
-  lasagna_call(lubksb(plya->mat,plya->Nres,plya->indx,dvidT-1),
+  lasagna_call(lubksb(plya->ws.mat,plya->Nres,plya->ws.indx,dvidT-1),
 	       error_message,error_message);
 
   /** Calculate x and u on the v-grid along with derivatives dvdu and dudT:*/
   dbdT = (duidT[0]+(2.0*alpha-3.0*u1/v1)*dvidT[0])/pow(v1,3);
-  /** Find the splitting of v and store it temporarily in plya->indx.
+  /** Find the splitting of v and store it temporarily in plya->ws.indx.
       We use the fact that v is uniform.
   */
-  plya->indx[0] = 0;
-  plya->indx[plya->Nres] = plya->vres;
+  plya->ws.indx[0] = 0;
+  plya->ws.indx[plya->Nres] = plya->vres;
   for (i=1; i<plya->Nres; i++){
     wi = 0.5*(vi[i-1]+vi[i]); //Weighted average
-    plya->indx[i] = (int)((wi-plya->v_left)/(v_grid[1]-v_grid[0]));
-    if (plya->indx[i]<plya->indx[i-1])
-      plya->indx[i] = plya->indx[i-1];
+    plya->ws.indx[i] = (int)((wi-plya->v_left)/(v_grid[1]-v_grid[0]));
+    if (plya->ws.indx[i]<plya->ws.indx[i-1])
+      plya->ws.indx[i] = plya->ws.indx[i-1];
   }
 
   // Now loop over resonances:
   for (i=0; i<plya->Nres; i++){
-    if (plya->indx[i]==plya->indx[i+1])
+    if (plya->ws.indx[i]==plya->ws.indx[i+1])
       continue;
     //Loop over each segment:
-    for (j=plya->indx[i]; j<plya->indx[i+1]; j++){
+    for (j=plya->ws.indx[i]; j<plya->ws.indx[i+1]; j++){
       daidT = duidT[i]-alpha*dvidT[i];
       dvdu_grid[j] = 1.0/(alpha+3.0*plya->b*pow(v_grid[j]-vi[i],2));
       dudT_grid[j] = daidT+dbdT*pow(v_grid[j]-vi[i],3)-
@@ -1211,24 +1472,24 @@ int lya_get_partial_derivatives(double T,
   /**
   fprintf(plya->tmp,"%.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e\n",
 	  T,
-	  plya->a[0],
-	  plya->a[1],
+	  plya->ws.a[0],
+	  plya->ws.a[1],
 	  duidT[0]-alpha*dvidT[0],
 	  duidT[1]-alpha*dvidT[1], 
 	  plya->b,
 	  dbdT,
-	  plya->xi[0],
-	  plya->xi[1],
-	  plya->dxidT[0], 
-	  plya->dxidT[1],
-	  plya->ui[0],
-	  plya->ui[1],
-	  plya->duidT[0],
-	  plya->duidT[1],
-	  plya->vi[0],
-	  plya->vi[1],
-	  plya->dvidT[0],
-	  plya->dvidT[1]);
+	  plya->ws.xi[0],
+	  plya->ws.xi[1],
+	  plya->ws.dxidT[0], 
+	  plya->ws.dxidT[1],
+	  plya->ws.ui[0],
+	  plya->ws.ui[1],
+	  plya->ws.duidT[0],
+	  plya->ws.duidT[1],
+	  plya->ws.vi[0],
+	  plya->ws.vi[1],
+	  plya->ws.dvidT[0],
+	  plya->ws.dvidT[1]);
   */
 return _SUCCESS_;
 }
@@ -47,7 +47,12 @@ int lya_input_init(struct file_content *pfc,
   lasagna_read_double("xmax",plya->xmax);
   lasagna_read_int("evolver",plya->evolver);	
   lasagna_read_int("linalg_wrapper",plya->LinearAlgebraWrapper);
+  lasagna_test(((int) plya->LinearAlgebraWrapper < 0)||
+	       (plya->LinearAlgebraWrapper > LINALG_WRAPPER_BLOCK),errmsg,
+	       "Unknown linalg_wrapper %d.",(int) plya->LinearAlgebraWrapper);
   lasagna_read_int("nproc",plya->nproc);
+  lasagna_read_int("rhs_threads",plya->rhs_threads);
+  plya->rhs_threads = max(1,min(plya->rhs_threads,plya->nproc));
   lasagna_read_int("verbose",plya->verbose);
   lasagna_read_double("T_initial",plya->T_initial);
   lasagna_read_double("T_final",plya->T_final);
@@ -73,8 +78,25 @@ int lya_input_init(struct file_content *pfc,
   else
     printf("Flavour of active species: Muon/Tau\n");
   lasagna_read_int("fixed_grid", plya->fixed_grid);
+  lasagna_read_int("warm_start", plya->warm_start);
+  lasagna_read_int("sparse_newton", plya->sparse_newton);
+  lasagna_read_string("symbolic_cache", plya->symbolic_cache);
+  lasagna_read_int("mixed_precision", plya->mixed_precision);
+  lasagna_read_int("low_memory", plya->low_memory);
+  lasagna_read_double("progress_interval", plya->progress_interval);
+  lasagna_read_int("output_buffer", plya->output_buffer);
+  lasagna_read_int("output_mmap", plya->output_mmap);
+  lasagna_read_int("output_compress", plya->output_compress);
+  lasagna_read_int("output_chunk", plya->output_chunk);
   lasagna_read_int("lyapunov_seed",plya->lyapunov_seed);
   lasagna_read_double("v_scale",plya->v_scale);
+  lasagna_read_int("tangent_linear",plya->tangent_linear);
+  lasagna_read_int("lyapunov_vectors",plya->lyapunov_vectors);
+  lasagna_read_int("lyapunov_qr",plya->lyapunov_qr);
+  lasagna_test(plya->lyapunov_vectors<1,errmsg,"lyapunov_vectors must be at least 1.");
+  lasagna_test((plya->tangent_linear == _FALSE_)&&
+	       ((plya->lyapunov_vectors > 1)||(plya->lyapunov_qr > 0)),errmsg,
+	       "lyapunov_vectors and lyapunov_qr need tangent_linear = 1.");
   lasagna_read_double("T_wait",plya->T_wait);
   lasagna_read_double("I_stop",plya->I_stop);
 
@@ -96,8 +118,18 @@ int lya_input_default_params(lya_param *plya){
   plya->evolver = 1;
   plya->LinearAlgebraWrapper = LINALG_WRAPPER_SPARSE;
   plya->nproc = 1;
+  plya->rhs_threads = 1;
   plya->verbose = 4;
   plya->fixed_grid = 0;
+  plya->warm_start = _FALSE_;
+  plya->sparse_newton = _FALSE_;
+  plya->mixed_precision = 0;
+  plya->low_memory = _FALSE_;
+  plya->progress_interval = 0.0;
+  plya->output_buffer = 4;
+  plya->output_mmap = _FALSE_;
+  plya->output_compress = 0;
+  plya->output_chunk = 0;
   plya->Nres = 2;
   plya->T_initial = 0.025;
   plya->T_final = 0.010;
@@ -107,6 +139,7 @@ int lya_input_default_params(lya_param *plya){
   plya->v_left = 0.0;
   plya->vres = 200;
   strcpy(plya->output_filename,"output/dump.mat");
+  plya->symbolic_cache[0] = '\0';
   /** We must have non-zero alpha, otherwise the matrix for 
       solving for dvidT becomes singular.
   */
@@ -124,6 +157,9 @@ int lya_input_default_params(lya_param *plya){
   plya->trigger_dLdT_over_L = 1e100;
   plya->lyapunov_seed = 1;
   plya->v_scale = 1e10;
+  plya->tangent_linear = _FALSE_;
+  plya->lyapunov_vectors = 1;
+  plya->lyapunov_qr = 0;
   plya->T_wait = -1; //Deactivate stop_at_divL
   plya->I_stop = 100;
   return _SUCCESS_;
@@ -5,35 +5,13 @@
 #include "common.h"
 #include "qke_equations.h"
 int init_qke_param(qke_param *pqke){
-  int i,j,k,idx,nz,kmin,kmax;
-  size_t neq;
+  int i;
   double k1,k2;
-  double Nres, vres, Tres;
-  int **J;
+  double Nres, Tres;
   Nres = pqke->Nres;
-  vres = pqke->vres;
   Tres = pqke->Tres;
   pqke->Tvec = malloc(sizeof(double)*Tres);
-  pqke->xi = malloc(sizeof(double)*Nres);
-  pqke->ui = malloc(sizeof(double)*Nres);
-  pqke->vi = malloc(sizeof(double)*Nres);
-  pqke->duidT = malloc(sizeof(double)*Nres);
-  pqke->dvidT = malloc(sizeof(double)*Nres);
-  pqke->duidx = malloc(sizeof(double)*Nres);
-  pqke->dxidT = malloc(sizeof(double)*Nres);
-  pqke->a = malloc(sizeof(double)*Nres);
-  pqke->y_0 = malloc(sizeof(double)*(1+Nres));
-  pqke->maxstep = malloc(sizeof(double)*(1+Nres));
-  pqke->x_grid = malloc(sizeof(double)*vres);
-  pqke->u_grid = malloc(sizeof(double)*vres);
-  pqke->v_grid = malloc(sizeof(double)*vres);
-  pqke->dvdu_grid = malloc(sizeof(double)*vres);
-  pqke->dudT_grid = malloc(sizeof(double)*vres);
-  pqke->mat = malloc(sizeof(double*)*(Nres+2));
-  for (i=0; i<(Nres+2); i++) 
-    pqke->mat[i] = malloc(sizeof(double)*(Nres + 2));
-  pqke->vv = malloc(sizeof(double)*(Nres + 2));
-  pqke->indx = malloc(sizeof(int)*(Nres + 2));
+  qke_scratch_alloc(&(pqke->ws),Nres,pqke->vres);
 
   //Do some calculations for the u(x) mapping:
   k1 = pqke->xmin/pqke->xext;
@@ -42,14 +20,12 @@ int init_qke_param(qke_param *pqke){
   pqke->eps1 = k1*(1+pqke->eps2);
 
   //Some secondary initialisations:
-  for(i=0; i<vres; i++){
-    pqke->v_grid[i] = pqke->v_left+
-      i*(pqke->v_right-pqke->v_left)/(vres-1.0); 
-  }
   for(i=0; i<Tres; i++){
     pqke->Tvec[i] = pqke->T_initial+
       i*(pqke->T_final-pqke->T_initial)/(Tres-1.0); 
   }
+  pqke->writer.mat_file = NULL;
+  pqke->writer.status = _SUCCESS_;
   if (pqke->is_electron == _TRUE_){
      pqke->C_alpha = 1.27;
   }
@@ -57,6 +33,32 @@ int init_qke_param(qke_param *pqke){
      pqke->C_alpha = 0.92;
   }
   pqke->guess_exists = _FALSE_;
+  pqke->vres_full = pqke->vres;
+  pqke->grid_level = 0;
+  pqke->grid_next = 1;
+  pqke->grid_pending = -1;
+  pqke->switch_pending = _FALSE_;
+  pqke->param_time = 0.0;
+  pqke->param_solves = 0;
+  return qke_init_grid(pqke);
+};
+
+int qke_init_grid(qke_param *pqke){
+  /** The part of init_qke_param that depends on vres: the grid, the
+      advection operator, the indices in y and the Jacobian pattern. The
+      arrays of the grid are in pqke->ws, sized for vres by the caller. */
+  int i,j,k,idx,nz,kmin,kmax;
+  size_t neq;
+  double vres;
+  int **J;
+  vres = pqke->vres;
+  pqke->grid_table_valid = _FALSE_;
+  for(i=0; i<vres; i++){
+    pqke->ws.v_grid[i] = pqke->v_left+
+      i*(pqke->v_right-pqke->v_left)/(vres-1.0); 
+  }
+  qke_advection_init(&(pqke->adv),vres,51,pqke->ws.v_grid[1]-pqke->ws.v_grid[0]);
+  qke_param_cache_clear(pqke);
   
   //Set up the indices:
   idx = 0;
@@ -106,9 +108,9 @@ int init_qke_param(qke_param *pqke){
     J[pqke->index_L][pqke->index_Py_minus+i] = 1;
   //Loop over grid:
   for (j=0; j<vres; j++){
-    // The 51 stencil method uses two numbers on each side:
-    kmin = j-2;
-    kmax = j+3;
+    // The advection stencils use up to adv.nbnd numbers on each side:
+    kmin = j-pqke->adv.nbnd;
+    kmax = j+pqke->adv.nbnd+1;
     //F-Pa_plus[j] dependence:
     for (k=max(0,kmin); k<min(vres,kmax); k++)
       J[pqke->index_Pa_plus+j][pqke->index_Pa_plus+k] = 1;
@@ -191,65 +193,375 @@ int init_qke_param(qke_param *pqke){
   return _SUCCESS_;
 };
 
-int free_qke_param(qke_param *pqke){
+int qke_free_grid(qke_param *pqke){
+  /** Frees what qke_init_grid allocates. */
+  qke_advection_free(&(pqke->adv));
+  free(pqke->Ap);
+  free(pqke->Ai);
+  return _SUCCESS_;
+}
+
+int qke_grid_interpolate(double *from, 
+			 int n_from, 
+			 double *to, 
+			 int n_to){
+  /** Cubic Lagrange interpolation between two uniform grids over the same
+      v range. On nested grids the common points are copied exactly, so
+      coarsening is injection. */
+  int i, j, k;
+  double s, t, w[4];
+
+  if (n_from < 4){
+    for (i=0; i<n_to; i++)
+      to[i] = from[min(n_from-1,(i*(n_from-1))/max(1,n_to-1))];
+    return _SUCCESS_;
+  }
+  for (i=0; i<n_to; i++){
+    s = i*(n_from-1.0)/(n_to-1.0);
+    j = (int) s;
+    if (j == s){
+      to[i] = from[j];
+      continue;
+    }
+    j = min(max(j-1,0),n_from-4);
+    t = s-j;
+    w[0] = -(t-1.0)*(t-2.0)*(t-3.0)/6.0;
+    w[1] = t*(t-2.0)*(t-3.0)/2.0;
+    w[2] = -t*(t-1.0)*(t-3.0)/2.0;
+    w[3] = t*(t-1.0)*(t-2.0)/6.0;
+    to[i] = 0.0;
+    for (k=0; k<4; k++)
+      to[i] += w[k]*from[j+k];
+  }
+  return _SUCCESS_;
+}
+
+int qke_regrid(qke_param *pqke, 
+	       int level, 
+	       double **y, 
+	       ErrorMsg error_message){
+  /** Moves the run to grid level level, with (vres_full-1)/2^level+1 bins,
+      and remaps the state in *y, which is reallocated for the new neq. The
+      grids of the levels are nested, so the bins common to both grids keep
+      their values and the others are interpolated. */
+  int f, vres_old=pqke->vres, index_L_old=pqke->index_L;
+  int index_old[8]={pqke->index_Pa_plus,pqke->index_Pa_minus,pqke->index_Ps_plus,
+		    pqke->index_Ps_minus,pqke->index_Px_plus,pqke->index_Px_minus,
+		    pqke->index_Py_plus,pqke->index_Py_minus};
+  int *index_new[8]={&(pqke->index_Pa_plus),&(pqke->index_Pa_minus),&(pqke->index_Ps_plus),
+		     &(pqke->index_Ps_minus),&(pqke->index_Px_plus),&(pqke->index_Px_minus),
+		     &(pqke->index_Py_plus),&(pqke->index_Py_minus)};
+  double *y_old=*y, *y_new;
+
+  qke_free_grid(pqke);
+  pqke->vres = (pqke->vres_full-1)/(1<<level)+1;
+  pqke->grid_level = level;
+  lasagna_test(qke_scratch_resize(&(pqke->ws),pqke->vres) == _FAILURE_,error_message,
+	       "Could not allocate the workspace for vres=%d.",pqke->vres);
+  qke_init_grid(pqke);
+  lasagna_alloc(y_new,sizeof(double)*pqke->neq,error_message);
+  y_new[pqke->index_L] = y_old[index_L_old];
+  for (f=0; f<8; f++)
+    qke_grid_interpolate(y_old+index_old[f],vres_old,y_new+*(index_new[f]),pqke->vres);
+  free(y_old);
+  *y = y_new;
+  return _SUCCESS_;
+}
+
+double qke_grid_indicator(double *y, qke_param *pqke){
+  /** Error indicator of the momentum grid: the largest difference between
+      the 5 and 3 point stencils of drhodv relative to the largest
+      derivative, over the fields. The difference estimates the error of
+      the 3 point stencil, which drops by 4 when the grid is refined once.
+      Fields smaller than abstol are left out. */
+  int f, i, vres=pqke->vres;
+  int index[8]={pqke->index_Pa_plus,pqke->index_Pa_minus,pqke->index_Ps_plus,
+		pqke->index_Ps_minus,pqke->index_Px_plus,pqke->index_Px_minus,
+		pqke->index_Py_plus,pqke->index_Py_minus};
+  double delta_v=pqke->ws.v_grid[1]-pqke->ws.v_grid[0], d3, d5, dmax, emax, eta=0.0;
+  double *rho;
+
+  for (f=0; f<8; f++){
+    rho = y+index[f];
+    dmax = 0.0;
+    emax = 0.0;
+    for (i=2; i<vres-2; i++){
+      d5 = drhodv(rho,delta_v,i,51);
+      d3 = drhodv(rho,delta_v,i,21);
+      dmax = max(dmax,fabs(d5));
+      emax = max(emax,fabs(d5-d3));
+    }
+    eta = max(eta,emax/(dmax+pqke->abstol/(pqke->v_right-pqke->v_left)));
+  }
+  return eta;
+}
+
+int qke_grid_check(double t, 
+		   double *y, 
+		   qke_param *pqke){
+  /** Called after each step. At the first step past each output point,
+      asks for the next finer grid level if the indicator is above
+      grid_tol, or for the next coarser one if it is below grid_tol/8, which
+      leaves a factor 2 after the coarsening. Returns _TRUE_ and sets
+      grid_pending if the level should change. */
+  double tdir=(pqke->T_final > pqke->T_initial ? 1.0 : -1.0), eta;
+
+  if ((pqke->grid_next >= pqke->Tres)||((t-pqke->Tvec[pqke->grid_next])*tdir < 0.0))
+    return _FALSE_;
+  while ((pqke->grid_next < pqke->Tres)&&((t-pqke->Tvec[pqke->grid_next])*tdir >= 0.0))
+    pqke->grid_next++;
+  eta = qke_grid_indicator(y,pqke);
+  if ((eta > pqke->grid_tol)&&(pqke->grid_level > 0))
+    pqke->grid_pending = pqke->grid_level-1;
+  else if ((eta < pqke->grid_tol/8.0)&&(pqke->grid_level < pqke->grid_levels))
+    pqke->grid_pending = pqke->grid_level+1;
+  else
+    return _FALSE_;
+  if (pqke->verbose > 1)
+    printf("Grid indicator %g at T=%g: vres %d -> %d.\n",eta,t,pqke->vres,
+	   (pqke->vres_full-1)/(1<<pqke->grid_pending)+1);
+  return _TRUE_;
+}
+
+int qke_switch_check(double t, 
+		     double *y, 
+		     qke_param *pqke){
+  /** Called after each step on the moving grid with grid_switch. At the
+      first step past each output point, asks for the fixed grid when every
+      resonance is outside the u range of the grid and does not move back,
+      going by ui and duidT of the last derivs call. get_resonances_xi keeps
+      a resonance above the grid at xmax, where duidT is 0 and the grid
+      stops moving. Returns _TRUE_ and sets switch_pending then. */
+  double tdir=(pqke->T_final > pqke->T_initial ? 1.0 : -1.0), u_min, u_max, dudx;
   int i;
-  free(pqke->xi);
-  free(pqke->ui);
-  free(pqke->vi);
+
+  if ((pqke->grid_next >= pqke->Tres)||((t-pqke->Tvec[pqke->grid_next])*tdir < 0.0))
+    return _FALSE_;
+  while ((pqke->grid_next < pqke->Tres)&&((t-pqke->Tvec[pqke->grid_next])*tdir >= 0.0))
+    pqke->grid_next++;
+  u_of_x(pqke->xmin,&u_min,&dudx,pqke);
+  u_of_x(pqke->xmax,&u_max,&dudx,pqke);
+  for (i=0; i<pqke->Nres; i++){
+    if (!(((pqke->ws.ui[i] >= u_max)&&(pqke->ws.duidT[i]*tdir >= 0.0))||
+	  ((pqke->ws.ui[i] <= u_min)&&(pqke->ws.duidT[i]*tdir <= 0.0))))
+      return _FALSE_;
+  }
+  pqke->switch_pending = _TRUE_;
+  if (pqke->verbose > 1)
+    printf("The resonances have left the grid at T=%g.\n",t);
+  return _TRUE_;
+}
+
+int qke_switch_grid(qke_param *pqke, 
+		    double T, 
+		    double *y, 
+		    ErrorMsg error_message){
+  /** Moves the run from the moving grid to the fixed grid at T. The fixed
+      grid is the moving grid at T and the L of y, so the state keeps its
+      values bin by bin, and qke_derivs_fixed_grid goes on from there. The
+      Jacobian pattern becomes the one of the fixed grid, or is detected
+      again from T on with detect_pattern. */
+  double H, mu_div_T;
+
+  lasagna_call(qke_derivs_setup(T,
+				y[pqke->index_L]*_L_SCALE_,
+				pqke,
+				&H,
+				&mu_div_T,
+				error_message),
+	       error_message,error_message);
+  pqke->fixed_grid = _TRUE_;
+  pqke->switch_pending = _FALSE_;
+  pqke->grid_table_valid = _FALSE_;
+  free(pqke->Ap);
+  free(pqke->Ai);
+  qke_fixed_grid_pattern(pqke);
+  if (pqke->detect_pattern > 0){
+    lasagna_call(qke_detect_pattern(pqke, T, y, error_message),
+		 error_message,error_message);
+  }
+  printf("Switched to the fixed grid at T=%g, x from %g to %g.\n",
+	 T,pqke->ws.x_grid[0],pqke->ws.x_grid[pqke->vres-1]);
+  return _SUCCESS_;
+}
+
+int free_qke_param(qke_param *pqke){
   free(pqke->Tvec);
-  free(pqke->duidT);
-  free(pqke->dvidT);
-  free(pqke->duidx);
-  free(pqke->dxidT);
-  free(pqke->a);
-  free(pqke->y_0);
-  free(pqke->maxstep);
-  free(pqke->x_grid);
-  free(pqke->u_grid);
-  free(pqke->v_grid);
-  free(pqke->dvdu_grid);
-  free(pqke->dudT_grid);
-  for (i=0; i<(pqke->Nres+2); i++) 
-    free(pqke->mat[i]);
-  free(pqke->mat);
-  free(pqke->vv);
-  free(pqke->indx);
+  qke_scratch_free(&(pqke->ws));
+  free(pqke->output_bins);
+  free(pqke->output_moments);
+  free(pqke->output_work);
+  free(pqke->output_full);
+  qke_advection_free(&(pqke->adv));
+  mat_writer_close(&(pqke->writer));
   free(pqke->Ap);
   free(pqke->Ai);
   background_free_dof(&(pqke->pbs));
   return _SUCCESS_;
 };
 
+int qke_detect_pattern(qke_param *pqke, double T_start, double *y, ErrorMsg error_message){
+  /** Replaces the Jacobian pattern of init_qke_param by the one that
+      evolver_sparsity_pattern finds at detect_pattern temperatures from
+      T_start towards T_final, around the state y. derivs is called on a
+      copy of the workspace, so the caches of pqke are as before. */
+  void *pcopy;
+  double *T_sample;
+  int s, *Ap, *Ai, samples=pqke->detect_pattern;
+  size_t neq=pqke->neq;
+
+  lasagna_alloc(T_sample,sizeof(double)*samples,error_message);
+  for (s=0; s<samples; s++)
+    T_sample[s] = T_start+s*(pqke->T_final-T_start)/samples;
+  lasagna_call(qke_copy_workspace(pqke,&pcopy,error_message),
+	       error_message,error_message);
+  lasagna_call(evolver_sparsity_pattern((pqke->fixed_grid == 0 ? 
+					 qke_derivs : qke_derivs_fixed_grid),
+					pcopy,T_sample,samples,y,neq,
+					pqke->abstol/pqke->rtol,pqke->pattern_pad,1,
+					&Ap,&Ai,error_message),
+	       error_message,error_message);
+  lasagna_call(qke_free_workspace(pcopy,error_message),
+	       error_message,error_message);
+  printf("Detected Jacobian pattern: %d nonzeros, the built-in one has %d.\n",
+	 Ap[neq],pqke->Ap[neq]);
+  free(pqke->Ap);
+  free(pqke->Ai);
+  pqke->Ap = Ap;
+  pqke->Ai = Ai;
+  free(T_sample);
+  return _SUCCESS_;
+}
+
+static void *qke_scratch_take(char *block, size_t *used, size_t bytes){
+  /** The next bytes of block, or NULL when block is NULL and only the size
+      is counted. */
+  void *p=(block == NULL ? NULL : block+*used);
+  *used += bytes;
+  return p;
+}
+
+static size_t qke_scratch_layout(qke_scratch *ws, char *block){
+  /** Points the arrays of ws into block and returns the bytes they take.
+      With block NULL, only the bytes are counted. The arrays that only
+      depend on Nres come first, so that qke_scratch_resize can keep them,
+      and the doubles come before the pointers and ints, so that every
+      array is aligned. */
+  int i, Nres=ws->Nres, vres=ws->vres;
+  double **nres_arrays[8]={&(ws->xi),&(ws->ui),&(ws->vi),&(ws->duidT),
+			   &(ws->dvidT),&(ws->duidx),&(ws->dxidT),&(ws->a)};
+  double **vres_arrays[5]={&(ws->x_grid),&(ws->u_grid),&(ws->v_grid),
+			   &(ws->dvdu_grid),&(ws->dudT_grid)};
+  double *rows;
+  size_t used=0;
+
+  for (i=0; i<8; i++)
+    *(nres_arrays[i]) = qke_scratch_take(block,&used,sizeof(double)*Nres);
+  ws->y_0 = qke_scratch_take(block,&used,sizeof(double)*(Nres+1));
+  ws->maxstep = qke_scratch_take(block,&used,sizeof(double)*(Nres+1));
+  ws->vv = qke_scratch_take(block,&used,sizeof(double)*(Nres+2));
+  rows = qke_scratch_take(block,&used,sizeof(double)*(Nres+2)*(Nres+2));
+  for (i=0; i<5; i++)
+    *(vres_arrays[i]) = qke_scratch_take(block,&used,sizeof(double)*vres);
+  ws->rhs_work = qke_scratch_take(block,&used,sizeof(double)*3*vres);
+  ws->rhs_partial = qke_scratch_take(block,&used,sizeof(double)*_QKE_MOMENTS_*
+				     ((vres+_RHS_BLOCK_-1)/_RHS_BLOCK_));
+  ws->grid_table = qke_scratch_take(block,&used,sizeof(double)*3*vres);
+  ws->param_cache = qke_scratch_take(block,&used,sizeof(double)*_PARAM_CACHE_*
+				     (3+5*Nres+2*vres));
+  ws->mat = qke_scratch_take(block,&used,sizeof(double*)*(Nres+2));
+  ws->indx = qke_scratch_take(block,&used,sizeof(int)*(Nres+2));
+  if (block != NULL){
+    for (i=0; i<(Nres+2); i++)
+      ws->mat[i] = rows+i*(Nres+2);
+  }
+  return used;
+}
+
+int qke_scratch_alloc(qke_scratch *ws, int Nres, int vres){
+  /** Allocates the arrays of ws for Nres resonances and vres bins. */
+  ws->Nres = Nres;
+  ws->vres = vres;
+  ws->newton = NULL;
+  ws->size = qke_scratch_layout(ws,NULL);
+  ws->block = malloc(ws->size);
+  if (ws->block == NULL)
+    return _FAILURE_;
+  qke_scratch_layout(ws,ws->block);
+  return _SUCCESS_;
+}
+
+int qke_scratch_resize(qke_scratch *ws, int vres){
+  /** Sizes the arrays of ws for vres bins. The arrays that only depend
+      on Nres keep their values, the others are undefined. */
+  qke_scratch old=*ws;
+  size_t nres_bytes=(char *) old.x_grid-(char *) old.block;
+  if (qke_scratch_alloc(ws,old.Nres,vres) == _FAILURE_){
+    *ws = old;
+    return _FAILURE_;
+  }
+  memcpy(ws->block,old.block,nres_bytes);
+  ws->newton = old.newton;
+  free(old.block);
+  return _SUCCESS_;
+}
+
+int qke_scratch_copy(qke_scratch *from, qke_scratch *to){
+  /** Makes to a copy of from in a block of its own. The Newton_sparse
+      workspace is not copied, the copy makes its own at its first call.
+      The block holds the row pointers of mat, so they are pointed into the
+      new block again after the copy. */
+  if (qke_scratch_alloc(to,from->Nres,from->vres) == _FAILURE_)
+    return _FAILURE_;
+  memcpy(to->block,from->block,from->size);
+  qke_scratch_layout(to,to->block);
+  return _SUCCESS_;
+}
+
+int qke_scratch_free(qke_scratch *ws){
+  /** Frees what qke_scratch_alloc or qke_scratch_copy allocates. */
+  free(ws->block);
+  ws->block = NULL;
+  if (ws->newton != NULL)
+    newton_workspace_free(ws->newton);
+  ws->newton = NULL;
+  return _SUCCESS_;
+}
+
+int qke_copy_workspace(void *param, void **param_copy, ErrorMsg error_message){
+  /** Make a copy of pqke with private scratch arrays, so that derivs can
+      be called on it from another thread. Tables that are only read by
+      derivs (Tvec, Ai, Ap and the dof table in pbs) are shared, the arrays
+      derivs writes to are in pqke->ws. */
+  qke_param *pqke=param;
+  qke_param *pcopy;
+
+  lasagna_alloc(pcopy,sizeof(qke_param),error_message);
+  *pcopy = *pqke;
+  lasagna_test(qke_scratch_copy(&(pqke->ws),&(pcopy->ws)) == _FAILURE_,error_message,
+	       "Could not allocate the private workspace of a thread.");
+  *param_copy = pcopy;
+  return _SUCCESS_;
+}
+
+int qke_free_workspace(void *param_copy, ErrorMsg error_message){
+  /** Free a copy made by qke_copy_workspace. */
+  qke_param *pcopy=param_copy;
+  qke_scratch_free(&(pcopy->ws));
+  free(pcopy);
+  return _SUCCESS_;
+}
+
 int init_qke_param_fixed_grid(qke_param *pqke){
-  int i,j,k,idx,nz;
-  size_t neq;
+  int i,idx;
   double k1,k2;
   double Nres, vres, Tres;
-  int **J;
   Nres = pqke->Nres;
   vres = pqke->vres;
   Tres = pqke->Tres;
   pqke->Tvec = malloc(sizeof(double)*Tres);
-  pqke->xi = malloc(sizeof(double)*Nres);
-  pqke->ui = malloc(sizeof(double)*Nres);
-  pqke->vi = malloc(sizeof(double)*Nres);
-  pqke->duidT = malloc(sizeof(double)*Nres);
-  pqke->dvidT = malloc(sizeof(double)*Nres);
-  pqke->duidx = malloc(sizeof(double)*Nres);
-  pqke->dxidT = malloc(sizeof(double)*Nres);
-  pqke->a = malloc(sizeof(double)*Nres);
-  pqke->y_0 = malloc(sizeof(double)*(1+Nres));
-  pqke->maxstep = malloc(sizeof(double)*(1+Nres));
-  pqke->x_grid = malloc(sizeof(double)*vres);
-  pqke->u_grid = malloc(sizeof(double)*vres);
-  pqke->v_grid = malloc(sizeof(double)*vres);
-  pqke->dvdu_grid = malloc(sizeof(double)*vres);
-  pqke->dudT_grid = malloc(sizeof(double)*vres);
-  pqke->mat = malloc(sizeof(double*)*(Nres+2));
-  for (i=0; i<(Nres+2); i++) 
-    pqke->mat[i] = malloc(sizeof(double)*(Nres + 2));
-  pqke->vv = malloc(sizeof(double)*(Nres + 2));
-  pqke->indx = malloc(sizeof(int)*(Nres + 2));
+  qke_scratch_alloc(&(pqke->ws),Nres,vres);
+  pqke->grid_table_valid = _FALSE_;
 
   //Do some calculations for the u(x) mapping:
   k1 = pqke->xmin/pqke->xext;
@@ -259,13 +571,16 @@ int init_qke_param_fixed_grid(qke_param *pqke){
 
   //Some secondary initialisations:
   for(i=0; i<vres; i++){
-    pqke->v_grid[i] = pqke->v_left+
+    pqke->ws.v_grid[i] = pqke->v_left+
       i*(pqke->v_right-pqke->v_left)/(vres-1.0); 
   }
   for(i=0; i<Tres; i++){
     pqke->Tvec[i] = pqke->T_initial+
       i*(pqke->T_final-pqke->T_initial)/(Tres-1.0); 
   }
+  qke_advection_init(&(pqke->adv),vres,51,pqke->ws.v_grid[1]-pqke->ws.v_grid[0]);
+  pqke->writer.mat_file = NULL;
+  pqke->writer.status = _SUCCESS_;
   if (pqke->is_electron == _TRUE_){
      pqke->C_alpha = 1.27;
   }
@@ -273,6 +588,14 @@ int init_qke_param_fixed_grid(qke_param *pqke){
      pqke->C_alpha = 0.92;
   }
   pqke->guess_exists = _FALSE_;
+  pqke->vres_full = pqke->vres;
+  pqke->grid_level = 0;
+  pqke->grid_next = 1;
+  pqke->grid_pending = -1;
+  pqke->switch_pending = _FALSE_;
+  pqke->param_time = 0.0;
+  pqke->param_solves = 0;
+  qke_param_cache_clear(pqke);
   
   //Set up the indices:
   idx = 0;
@@ -296,8 +619,18 @@ int init_qke_param_fixed_grid(qke_param *pqke){
   idx +=pqke->vres;
 
   //Last thing to do:
-  neq = idx;
-  pqke->neq = neq;
+  pqke->neq = idx;
+
+  return qke_fixed_grid_pattern(pqke);
+};
+
+int qke_fixed_grid_pattern(qke_param *pqke){
+  /** The Jacobian pattern of qke_derivs_fixed_grid for the vres and the
+      indices in pqke. */
+  int i,j,k,nz;
+  size_t neq=pqke->neq;
+  int vres=pqke->vres;
+  int **J;
 
   //Pattern for Jacobi matrix:
   pqke->Ap = malloc(sizeof(int)*(neq+1));
@@ -384,14 +717,14 @@ int init_qke_param_fixed_grid(qke_param *pqke){
   free(J[0]);
   free(J);
   return _SUCCESS_;
-};
+}
 
 
 int get_resonances_xi(double T, 
 		      double L,
 		      qke_param *pqke){
-  double *xi=pqke->xi;
-  double x0, x0b,A;
+  double *xi=pqke->ws.xi;
+  double x0,A;
   int i;
 
   x0 = sqrt(fabs(pqke->V0/pqke->V1));
@@ -438,7 +771,7 @@ int get_resonances_dxidT(double T,
 			 double dLdT,
 			 qke_param *pqke){
   double x0, A,A2;
-  double *dxidT=pqke->dxidT;
+  double *dxidT=pqke->ws.dxidT;
   double F;
   double one_plus_dlogLdlogT;
   int i;
@@ -480,7 +813,7 @@ int get_resonances_dxidT(double T,
   */
   //Make it selfconsistent:
   for (i=0; i<pqke->Nres; i++){
-    if(pqke->xi[i]>=(pqke->xmax-1e-12)){
+    if(pqke->ws.xi[i]>=(pqke->xmax-1e-12)){
       dxidT[i] = 0.0;
     }
   }
@@ -510,8 +843,8 @@ int nonlinear_rhs(double *y, double *Fy, void *param){
   double b=y[0];
   double *vi=y+1;
   double alpha = pqke->alpha;
-  double *ui=pqke->ui;
-  double *a=pqke->a;
+  double *ui=pqke->ws.ui;
+  double *a=pqke->ws.a;
   int i,n=pqke->Nres;
 
   for (i=0; i<n; i++){
@@ -549,6 +882,65 @@ int nonlinear_rhs_jac(double *y, double **jac, void *param){
 }
 
 
+int nonlinear_rhs_sparse_jac(double *y, double *Jx, void *param){
+  qke_param *pqke=param;
+  return parametrisation_jacobian(pqke->Nres,pqke->alpha,y,Jx);
+}
+
+int parametrisation_pattern(int Nres, int *Ap, int *Ai){
+  /** Pattern of the Jacobian of nonlinear_rhs in compressed columns, with
+      3*Nres+1 entries. Column 0, of b, is full. Column c, of v_{c-1}, has
+      the two equations v_{c-1} appears in: rows 0 and 1 hold the ends of
+      the grid, row c+1 the match of segments c-1 and c. */
+  int c, p, n=Nres;
+  for (p=0; p<=n; p++)
+    Ai[p] = p;
+  Ap[0] = 0;
+  Ap[1] = p;
+  for (c=1; c<=n; c++){
+    if (c == 1) Ai[p++] = 0;
+    if (c == n) Ai[p++] = 1;
+    if (c >= 2) Ai[p++] = c;
+    if (c < n) Ai[p++] = c+1;
+    Ap[c+1] = p;
+  }
+  return _SUCCESS_;
+}
+
+int parametrisation_jacobian(int Nres, double alpha, double *y, double *Jx){
+  /** Values of the Jacobian of nonlinear_rhs at y, on the pattern of
+      parametrisation_pattern. The same as nonlinear_rhs_jac. */
+  double b=y[0], *vi=y+1;
+  int c, i, p, n=Nres;
+  Jx[0] = -pow(vi[0],3);
+  Jx[1] = pow(1.0-vi[n-1],3);
+  for (i=0; i<n-1; i++)
+    Jx[2+i] = 0.25*pow(vi[i+1]-vi[i],3);
+  p = n+1;
+  for (c=1; c<=n; c++){
+    if (c == 1) Jx[p++] = -alpha-3.0*b*vi[0]*vi[0];
+    if (c == n) Jx[p++] = -alpha-3.0*b*pow(1.0-vi[n-1],2);
+    if (c >= 2) Jx[p++] = alpha+0.75*b*pow(vi[c-1]-vi[c-2],2);
+    if (c < n) Jx[p++] = -alpha-0.75*b*pow(vi[c]-vi[c-1],2);
+  }
+  return _SUCCESS_;
+}
+
+int parametrisation_newton_alloc(int Nres,
+				 struct newton_workspace **ws,
+				 ErrorMsg error_message){
+  /** Workspace of Newton_sparse for the Nres+1 parametrisation equations. */
+  int *Ap, *Ai;
+  lasagna_alloc(Ap,sizeof(int)*(Nres+2),error_message);
+  lasagna_alloc(Ai,sizeof(int)*(3*Nres+1),error_message);
+  parametrisation_pattern(Nres,Ap,Ai);
+  lasagna_call(newton_workspace_alloc(ws,Nres+1,Ap,Ai,error_message),
+	       error_message,error_message);
+  free(Ap);
+  free(Ai);
+  return _SUCCESS_;
+}
+
 int qke_initial_conditions(double Ti, double *y, qke_param *pqke){
   /** Set initial conditions at temperature Ti: */
   int i;
@@ -577,8 +969,10 @@ int qke_initial_conditions(double Ti, double *y, qke_param *pqke){
   pqke->V1 = -7.0*_PI_*_PI_/(45.0*sqrt(2.0))*
     _G_F_/_M_Z_/_M_Z_*pow(Ti,5)*n_plus*pqke->g_alpha;
 
+  qke_param_cache_clear(pqke);
   get_resonances_xi(Ti,L,pqke);  
-  //Get new x_grid
+  //Get new x_grid, the grid table is rebuilt by the first derivs call:
+  pqke->grid_table_valid = _FALSE_;
   lasagna_call(get_parametrisation(Ti,
 				   pqke, 
 				   error_message),
@@ -586,7 +980,7 @@ int qke_initial_conditions(double Ti, double *y, qke_param *pqke){
   
 
   for (i=0; i<pqke->vres; i++){
-    x = pqke->x_grid[i];
+    x = pqke->ws.x_grid[i];
     Vx = pqke->Vx/x;
     Vz = pqke->V0/x + pqke->V1*x + pqke->VL;
     Vz_bar = pqke->V0/x + pqke->V1*x - pqke->VL;
@@ -609,11 +1003,13 @@ int qke_initial_conditions(double Ti, double *y, qke_param *pqke){
   pqke->max_cur = L;
   pqke->should_break = _FALSE_;
   pqke->breakpoint = 0;
+  pqke->cross_found = _FALSE_;
   return _SUCCESS_;
 };
 
 int qke_init_output(qke_param *pqke){
   int Tres=pqke->Tres;
+  int mode;
   int vres=pqke->vres;
   int Nres=pqke->Nres;
   int handle, f_size;
@@ -622,70 +1018,299 @@ int qke_init_output(qke_param *pqke){
   char *outf=pqke->output_filename;
   char *parameters;
   FILE *parameter_file;
-  //Initialises the output file and stores parameters
-  mat_create_file(outf);
-  //Add matrices that are defined on momentum grid:
-  mat_add_matrix(outf,"Pa_plus",miDOUBLE,Tres,vres,&(pqke->Pa_plus_handle));
-  mat_add_matrix(outf,"Pa_minus",miDOUBLE,Tres,vres,&(pqke->Pa_minus_handle));
-  mat_add_matrix(outf,"Ps_plus",miDOUBLE,Tres,vres,&(pqke->Ps_plus_handle));
-  mat_add_matrix(outf,"Ps_minus",miDOUBLE,Tres,vres,&(pqke->Ps_minus_handle));
-  mat_add_matrix(outf,"Px_plus",miDOUBLE,Tres,vres,&(pqke->Px_plus_handle));
-  mat_add_matrix(outf,"Px_minus",miDOUBLE,Tres,vres,&(pqke->Px_minus_handle));
-  mat_add_matrix(outf,"Py_plus",miDOUBLE,Tres,vres,&(pqke->Py_plus_handle));
-  mat_add_matrix(outf,"Py_minus",miDOUBLE,Tres,vres,&(pqke->Py_minus_handle));
-  mat_add_matrix(outf,"x_grid",miDOUBLE,Tres,vres,&(pqke->x_grid_handle));
-  mat_add_matrix(outf,"u_grid",miDOUBLE,Tres,vres,&(pqke->u_grid_handle));
-  mat_add_matrix(outf,"v_grid",miDOUBLE,Tres,vres,&(pqke->v_grid_handle));
-  //Add resonance dependent matrices:
-  mat_add_matrix(outf,"xi_vec",miDOUBLE,Tres,Nres,&(pqke->xi_handle));
-  mat_add_matrix(outf,"ui_vec",miDOUBLE,Tres,Nres,&(pqke->ui_handle));
-  mat_add_matrix(outf,"vi_vec",miDOUBLE,Tres,Nres,&(pqke->vi_handle));
-  mat_add_matrix(outf,"b_a_vec",miDOUBLE,Tres,(1+Nres),&(pqke->b_a_vec_handle));
-  //Add other matrices:
-  mat_add_matrix(outf,"L_vec",miDOUBLE,Tres,1,&(pqke->L_handle));
-  mat_add_matrix(outf,"T_vec",miDOUBLE,Tres,1,&(pqke->T_handle));
-  mat_add_matrix(outf,"I_conserved",miDOUBLE,Tres,1,&(pqke->I_conserved_handle));
-  mat_add_matrix(outf,"V0_vec",miDOUBLE,Tres,1,&(pqke->V0_handle));
-  mat_add_matrix(outf,"V1_vec",miDOUBLE,Tres,1,&(pqke->V1_handle));
-  mat_add_matrix(outf,"Vx_vec",miDOUBLE,Tres,1,&(pqke->Vx_handle));
-  mat_add_matrix(outf,"VL_vec",miDOUBLE,Tres,1,&(pqke->VL_handle));
-  //Add constant parameters:
-  mat_add_matrix(outf,"L_initial",miDOUBLE,1,1,&handle);
-  mat_add_matrix(outf,"delta_m2_theta_zero",miDOUBLE,1,2,&handle);
-  mat_add_matrix(outf,"is_electron",miINT32,1,1,&handle);
-  mat_add_matrix(outf,"Tres_vres",miINT32,1,2,&handle);
-  mat_add_matrix(outf,"xmin_xext_xmax",miDOUBLE,1,3,&handle);
-  mat_add_matrix(outf,"alpha_rs",miDOUBLE,1,2,&handle);
-  //Open parameter file and save it to the output file.
-  parameter_file = fopen(pqke->parameter_filename, "r");
-  if(parameter_file){
-    fseek(parameter_file,0,SEEK_END);
-    f_size = ftell(parameter_file);
-    fseek(parameter_file,0, SEEK_SET);
-    parameters = malloc(sizeof(char)*f_size);
-    fread(parameters, 1, f_size, parameter_file);
-    mat_add_matrix(outf,"parameters",miCHAR,strlen(parameters),1,&handle);
-    mat_write_data(outf,"parameters",parameters,0,strlen(parameters));
-  } else{
-    printf("Failed to open parameter file and write it to output file.\n");
-  }
-  //Write parameters and stuff we know in advance:
-  //Temperature - we could write it here, but its nice to have non-computed
-  //T values = 0:
-  //mat_write_data(outf,"T",pqke->Tvec,0,Tres);
-  tmp_array[0] = pqke->delta_m2; tmp_array[1] = pqke->theta_zero;
-  mat_write_data(outf,"delta_m2_theta_zero",&(tmp_array),0,2);
-  mat_write_data(outf,"is_electron",&(pqke->is_electron),0,1);
-  tmp_array_int[0]=pqke->Tres; tmp_array_int[1]=pqke->vres;
-  mat_write_data(outf,"Tres_vres",tmp_array_int,0,2);
-  tmp_array[0] = pqke->xmin; tmp_array[1] = pqke->xext; 
-  tmp_array[2] = pqke->xmax;
-  mat_write_data(outf,"xmin_xext_xmax",tmp_array,0,3);
-  tmp_array[0] = pqke->alpha; tmp_array[1] = pqke->rs;
-  mat_write_data(outf,"alpha_rs",tmp_array,0,2);
+  ErrorMsg error_message;
+  //Output mode. Chunked matrices start with one block of columns:
+  if (pqke->output_compress > 0)
+    mode = _MAT_WRITER_COMPRESSED_;
+  else if (pqke->output_chunk > 0)
+    mode = _MAT_WRITER_CHUNKED_;
+  else if (pqke->output_mmap == _TRUE_)
+    mode = _MAT_WRITER_MMAP_;
+  else
+    mode = _MAT_WRITER_FILE_;
+  if (mode == _MAT_WRITER_CHUNKED_)
+    Tres = min(Tres,pqke->output_chunk);
+  //On a restart the file and the handles are those of the checkpointed run:
+  if (pqke->restart == _FALSE_){
+    //Initialises the output file and stores parameters
+    mat_create_file(outf);
+    //Add matrices that are defined on momentum grid, the selected fields and bins:
+    qke_add_output_field(pqke,"Pa_plus",Tres,&(pqke->Pa_plus_handle));
+    qke_add_output_field(pqke,"Pa_minus",Tres,&(pqke->Pa_minus_handle));
+    qke_add_output_field(pqke,"Ps_plus",Tres,&(pqke->Ps_plus_handle));
+    qke_add_output_field(pqke,"Ps_minus",Tres,&(pqke->Ps_minus_handle));
+    qke_add_output_field(pqke,"Px_plus",Tres,&(pqke->Px_plus_handle));
+    qke_add_output_field(pqke,"Px_minus",Tres,&(pqke->Px_minus_handle));
+    qke_add_output_field(pqke,"Py_plus",Tres,&(pqke->Py_plus_handle));
+    qke_add_output_field(pqke,"Py_minus",Tres,&(pqke->Py_minus_handle));
+    qke_add_output_field(pqke,"x_grid",Tres,&(pqke->x_grid_handle));
+    qke_add_output_field(pqke,"u_grid",Tres,&(pqke->u_grid_handle));
+    qke_add_output_field(pqke,"v_grid",Tres,&(pqke->v_grid_handle));
+    //Add resonance dependent matrices:
+    mat_add_matrix(outf,"xi_vec",miDOUBLE,Tres,Nres,&(pqke->xi_handle));
+    mat_add_matrix(outf,"ui_vec",miDOUBLE,Tres,Nres,&(pqke->ui_handle));
+    mat_add_matrix(outf,"vi_vec",miDOUBLE,Tres,Nres,&(pqke->vi_handle));
+    mat_add_matrix(outf,"b_a_vec",miDOUBLE,Tres,(1+Nres),&(pqke->b_a_vec_handle));
+    //Add other matrices:
+    mat_add_matrix(outf,"L_vec",miDOUBLE,Tres,1,&(pqke->L_handle));
+    mat_add_matrix(outf,"T_vec",miDOUBLE,Tres,1,&(pqke->T_handle));
+    pqke->I_conserved_handle = MAT_NO_HANDLE;
+    if (qke_output_field(pqke,"I_conserved") == _TRUE_)
+      mat_add_matrix(outf,"I_conserved",miDOUBLE,Tres,1,&(pqke->I_conserved_handle));
+    mat_add_matrix(outf,"V0_vec",miDOUBLE,Tres,1,&(pqke->V0_handle));
+    mat_add_matrix(outf,"V1_vec",miDOUBLE,Tres,1,&(pqke->V1_handle));
+    mat_add_matrix(outf,"Vx_vec",miDOUBLE,Tres,1,&(pqke->Vx_handle));
+    mat_add_matrix(outf,"VL_vec",miDOUBLE,Tres,1,&(pqke->VL_handle));
+    pqke->moments_handle = MAT_NO_HANDLE;
+    if (pqke->output_nmoments > 0){
+      mat_add_matrix(outf,"moments",miDOUBLE,Tres,pqke->output_nmoments,&(pqke->moments_handle));
+      mat_add_matrix(outf,"moment_index",miINT32,1,pqke->output_nmoments,&handle);
+    }
+    if (pqke->output_bins != NULL)
+      mat_add_matrix(outf,"output_bins",miINT32,1,pqke->output_nbins,&handle);
+    //Add constant parameters:
+    mat_add_matrix(outf,"L_initial",miDOUBLE,1,1,&handle);
+    mat_add_matrix(outf,"delta_m2_theta_zero",miDOUBLE,1,2,&handle);
+    mat_add_matrix(outf,"is_electron",miINT32,1,1,&handle);
+    mat_add_matrix(outf,"Tres_vres",miINT32,1,2,&handle);
+    mat_add_matrix(outf,"xmin_xext_xmax",miDOUBLE,1,3,&handle);
+    mat_add_matrix(outf,"alpha_rs",miDOUBLE,1,2,&handle);
+    //Open parameter file and save it to the output file.
+    parameter_file = fopen(pqke->parameter_filename, "r");
+    if(parameter_file){
+      fseek(parameter_file,0,SEEK_END);
+      f_size = ftell(parameter_file);
+      fseek(parameter_file,0, SEEK_SET);
+      parameters = malloc(sizeof(char)*f_size);
+      f_size = fread(parameters, 1, f_size, parameter_file);
+      fclose(parameter_file);
+      mat_add_matrix(outf,"parameters",miCHAR,f_size,1,&handle);
+      mat_write_data(outf,"parameters",parameters,0,f_size);
+      free(parameters);
+    } else{
+      printf("Failed to open parameter file and write it to output file.\n");
+    }
+    //Write parameters and stuff we know in advance:
+    //Temperature - we could write it here, but its nice to have non-computed
+    //T values = 0:
+    //mat_write_data(outf,"T",pqke->Tvec,0,Tres);
+    tmp_array[0] = pqke->delta_m2; tmp_array[1] = pqke->theta_zero;
+    mat_write_data(outf,"delta_m2_theta_zero",&(tmp_array),0,2);
+    mat_write_data(outf,"is_electron",&(pqke->is_electron),0,1);
+    tmp_array_int[0]=pqke->Tres; tmp_array_int[1]=pqke->vres;
+    mat_write_data(outf,"Tres_vres",tmp_array_int,0,2);
+    tmp_array[0] = pqke->xmin; tmp_array[1] = pqke->xext; 
+    tmp_array[2] = pqke->xmax;
+    mat_write_data(outf,"xmin_xext_xmax",tmp_array,0,3);
+    tmp_array[0] = pqke->alpha; tmp_array[1] = pqke->rs;
+    mat_write_data(outf,"alpha_rs",tmp_array,0,2);
+    if (pqke->output_nmoments > 0)
+      mat_write_data(outf,"moment_index",pqke->output_moments,0,pqke->output_nmoments);
+    if (pqke->output_bins != NULL)
+      mat_write_data(outf,"output_bins",pqke->output_bins,0,pqke->output_nbins);
+  }
+  //Keep the file open for qke_store_output:
+  if (mat_writer_open(&(pqke->writer),outf,pqke->output_buffer,32,
+		      sizeof(double)*(11*vres+4*Nres+8+_QKE_MOMENTS_),
+		      mode,pqke->output_compress,error_message) == _FAILURE_){
+    printf("%s\n",error_message);
+    return _FAILURE_;
+  }
+  return _SUCCESS_;
+}
+
+
+int qke_checkpoint_state(FILE *file, int restore, void *param, ErrorMsg error_message){
+  /** Write or read the state of pqke that derivs, the output and the stop
+      function carry from one step to the next, and the output handles. 
+      The output written so far is flushed to the file first. */
+  qke_param *pqke=param;
+  int i, Nres=pqke->Nres, vres=pqke->vres, size[2], istate[5];
+  double dstate[10];
+  double *nres_vec[8]={pqke->ws.xi,pqke->ws.ui,pqke->ws.vi,pqke->ws.duidT,pqke->ws.dvidT,
+		       pqke->ws.duidx,pqke->ws.dxidT,pqke->ws.a};
+  double *vres_vec[5]={pqke->ws.x_grid,pqke->ws.u_grid,pqke->ws.v_grid,
+		       pqke->ws.dvdu_grid,pqke->ws.dudT_grid};
+  int *handle[23]={&(pqke->Pa_plus_handle),&(pqke->Pa_minus_handle),
+		   &(pqke->Ps_plus_handle),&(pqke->Ps_minus_handle),
+		   &(pqke->Px_plus_handle),&(pqke->Px_minus_handle),
+		   &(pqke->Py_plus_handle),&(pqke->Py_minus_handle),
+		   &(pqke->x_grid_handle),&(pqke->u_grid_handle),
+		   &(pqke->v_grid_handle),&(pqke->b_a_vec_handle),
+		   &(pqke->xi_handle),&(pqke->ui_handle),&(pqke->vi_handle),
+		   &(pqke->L_handle),&(pqke->T_handle),&(pqke->I_conserved_handle),
+		   &(pqke->V0_handle),&(pqke->V1_handle),&(pqke->Vx_handle),
+		   &(pqke->VL_handle),&(pqke->moments_handle)};
+
+  if (restore == _FALSE_){
+    lasagna_test(mat_writer_sync(&(pqke->writer))==_FAILURE_,error_message,
+		 "Writing to %s failed.",pqke->output_filename);
+    istate[0] = pqke->guess_exists; istate[1] = pqke->param_cache_current;
+    istate[2] = pqke->param_cache_next; istate[3] = pqke->grid_table_valid;
+    istate[4] = pqke->should_break;
+    dstate[0] = pqke->T_guess; dstate[1] = pqke->b; dstate[2] = pqke->n_plus;
+    dstate[3] = pqke->Vx; dstate[4] = pqke->V0; dstate[5] = pqke->V1; 
+    dstate[6] = pqke->VL; dstate[7] = pqke->max_old; dstate[8] = pqke->max_cur;
+    dstate[9] = pqke->breakpoint;
+  }
+  size[0] = Nres; size[1] = vres;
+  lasagna_call(evolver_checkpoint_io(file,size,sizeof(int),2,restore,error_message),
+	       error_message,error_message);
+  lasagna_test((size[0] != Nres)||(size[1] != vres),error_message,
+	       "The checkpoint has Nres=%d and vres=%d, not %d and %d.",
+	       size[0],size[1],Nres,vres);
+  lasagna_call(evolver_checkpoint_io(file,istate,sizeof(int),5,restore,error_message),
+	       error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(file,dstate,sizeof(double),10,restore,error_message),
+	       error_message,error_message);
+  for (i=0; i<23; i++)
+    lasagna_call(evolver_checkpoint_io(file,handle[i],sizeof(int),1,restore,error_message),
+		 error_message,error_message);
+  for (i=0; i<8; i++)
+    lasagna_call(evolver_checkpoint_io(file,nres_vec[i],sizeof(double),Nres,restore,error_message),
+		 error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(file,pqke->ws.y_0,sizeof(double),Nres+1,restore,error_message),
+	       error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(file,pqke->ws.maxstep,sizeof(double),Nres+1,restore,error_message),
+	       error_message,error_message);
+  for (i=0; i<5; i++)
+    lasagna_call(evolver_checkpoint_io(file,vres_vec[i],sizeof(double),vres,restore,error_message),
+		 error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(file,pqke->ws.param_cache,sizeof(double),
+				     _PARAM_CACHE_*(3+5*Nres+2*vres),restore,error_message),
+	       error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(file,pqke->ws.grid_table,sizeof(double),3*vres,restore,error_message),
+	       error_message,error_message);
+  for (i=0; i<(Nres+2); i++)
+    lasagna_call(evolver_checkpoint_io(file,pqke->ws.mat[i],sizeof(double),Nres+2,restore,error_message),
+		 error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(file,pqke->ws.vv,sizeof(double),Nres+2,restore,error_message),
+	       error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(file,pqke->ws.indx,sizeof(int),Nres+2,restore,error_message),
+	       error_message,error_message);
+  if (restore == _TRUE_){
+    pqke->guess_exists = istate[0]; pqke->param_cache_current = istate[1];
+    pqke->param_cache_next = istate[2]; pqke->grid_table_valid = istate[3];
+    pqke->should_break = istate[4];
+    pqke->T_guess = dstate[0]; pqke->b = dstate[1]; pqke->n_plus = dstate[2];
+    pqke->Vx = dstate[3]; pqke->V0 = dstate[4]; pqke->V1 = dstate[5];
+    pqke->VL = dstate[6]; pqke->max_old = dstate[7]; pqke->max_cur = dstate[8];
+    pqke->breakpoint = dstate[9];
+  }
   return _SUCCESS_;
 }
 
+int qke_output_selection(qke_param *pqke, ErrorMsg error_message){
+  /** Check the fields, bins and moments selected for the output, and make
+      the bin list for output_bin_stride>1. */
+  char *names[12]={"Pa_plus","Pa_minus","Ps_plus","Ps_minus","Px_plus","Px_minus",
+		   "Py_plus","Py_minus","x_grid","u_grid","v_grid","I_conserved"};
+  char list[_ARGUMENT_LENGTH_MAX_], *field;
+  int i, vres=pqke->vres;
+
+  if (strcmp(pqke->output_fields,"all") != 0){
+    strcpy(list,pqke->output_fields);
+    for (field=strtok(list,", "); field!=NULL; field=strtok(NULL,", ")){
+      for (i=0; (i<12)&&(strcmp(field,names[i])!=0); i++);
+      lasagna_test(i == 12,error_message,"Unknown output field %s.",field);
+    }
+  }
+  lasagna_test(pqke->output_bin_stride < 1,error_message,
+	       "output_bin_stride must be positive.");
+  if ((pqke->output_bins == NULL)&&(pqke->output_bin_stride > 1)){
+    pqke->output_nbins = (vres+pqke->output_bin_stride-1)/pqke->output_bin_stride;
+    lasagna_alloc(pqke->output_bins,sizeof(int)*pqke->output_nbins,error_message);
+    for (i=0; i<pqke->output_nbins; i++)
+      pqke->output_bins[i] = i*pqke->output_bin_stride;
+  }
+  if (pqke->output_bins == NULL)
+    pqke->output_nbins = vres;
+  for (i=0; i<pqke->output_nbins; i++)
+    lasagna_test((pqke->output_bins != NULL)&&
+		 ((pqke->output_bins[i] < 0)||(pqke->output_bins[i] >= vres)),
+		 error_message,"Output bin %d is outside the %d bins.",
+		 pqke->output_bins[i],vres);
+  for (i=0; i<pqke->output_nmoments; i++)
+    lasagna_test((pqke->output_moments[i] < 0)||(pqke->output_moments[i] >= _QKE_MOMENTS_),
+		 error_message,"Output moment %d is not one of 0-%d.",
+		 pqke->output_moments[i],_QKE_MOMENTS_-1);
+  lasagna_alloc(pqke->output_work,sizeof(double)*pqke->output_nbins,error_message);
+  pqke->output_full = NULL;
+  if (pqke->grid_levels > 0)
+    lasagna_alloc(pqke->output_full,sizeof(double)*vres,error_message);
+  return _SUCCESS_;
+}
+
+int qke_output_field(qke_param *pqke, char *name){
+  /** _TRUE_ if name is in the list output_fields, or the list is "all". */
+  char list[_ARGUMENT_LENGTH_MAX_], *field;
+  if (strcmp(pqke->output_fields,"all") == 0)
+    return _TRUE_;
+  strcpy(list,pqke->output_fields);
+  for (field=strtok(list,", "); field!=NULL; field=strtok(NULL,", ")){
+    if (strcmp(field,name) == 0)
+      return _TRUE_;
+  }
+  return _FALSE_;
+}
+
+int qke_output_indices(qke_param *pqke, int *interp_idx){
+  /** Flag the entries of y used by qke_store_output, so that the evolver
+      only interpolates those: L, the selected bins of the selected fields,
+      and all bins of the fields qke_moments reads if any moment is stored.
+      On a coarser grid level, all bins of the selected fields. */
+  char *names[8]={"Pa_plus","Pa_minus","Ps_plus","Ps_minus",
+		  "Px_plus","Px_minus","Py_plus","Py_minus"};
+  int index[8]={pqke->index_Pa_plus,pqke->index_Pa_minus,pqke->index_Ps_plus,
+		pqke->index_Ps_minus,pqke->index_Px_plus,pqke->index_Px_minus,
+		pqke->index_Py_plus,pqke->index_Py_minus};
+  int moments[8]={_TRUE_,_FALSE_,_TRUE_,_TRUE_,_FALSE_,_FALSE_,_FALSE_,_TRUE_};
+  int i, k, all;
+
+  for (i=0; i<pqke->neq; i++)
+    interp_idx[i] = _FALSE_;
+  interp_idx[pqke->index_L] = _TRUE_;
+  for (i=0; i<8; i++){
+    all = (moments[i] == _TRUE_)&&
+      ((qke_output_field(pqke,"I_conserved") == _TRUE_)||(pqke->output_nmoments > 0));
+    if ((all == _TRUE_)||
+	((pqke->vres != pqke->vres_full)&&(qke_output_field(pqke,names[i]) == _TRUE_))){
+      for (k=0; k<pqke->vres; k++)
+	interp_idx[index[i]+k] = _TRUE_;
+    }
+    else if (qke_output_field(pqke,names[i]) == _TRUE_){
+      for (k=0; k<pqke->output_nbins; k++)
+	interp_idx[index[i]+(pqke->output_bins == NULL ? k : pqke->output_bins[k])] = _TRUE_;
+    }
+  }
+  return _SUCCESS_;
+}
+
+int qke_add_output_field(qke_param *pqke, char *name, int Tres, int *handle){
+  /** Add the matrix of a field on the momentum grid with the selected bins,
+      or set the handle to MAT_NO_HANDLE if the field is not stored. */
+  *handle = MAT_NO_HANDLE;
+  if (qke_output_field(pqke,name) == _FALSE_)
+    return _SUCCESS_;
+  return mat_add_matrix(pqke->output_filename,name,miDOUBLE,Tres,pqke->output_nbins,handle);
+}
+
+int qke_put_output_field(qke_param *pqke, double *data, int *handle){
+  /** Add the selected bins of a field to the output slice. On a coarser
+      grid level, the field is first interpolated to the vres_full bins. */
+  int i;
+  if (*handle == MAT_NO_HANDLE)
+    return _SUCCESS_;
+  if (pqke->vres != pqke->vres_full){
+    qke_grid_interpolate(data,pqke->vres,pqke->output_full,pqke->vres_full);
+    data = pqke->output_full;
+  }
+  if (pqke->output_bins == NULL)
+    return mat_writer_put(&(pqke->writer),data,handle,8,pqke->vres_full);
+  for (i=0; i<pqke->output_nbins; i++)
+    pqke->output_work[i] = data[pqke->output_bins[i]];
+  return mat_writer_put(&(pqke->writer),pqke->output_work,handle,8,pqke->output_nbins);
+}
 
 int qke_store_output(double T,
 			    double *y,
@@ -694,59 +1319,61 @@ int qke_store_output(double T,
 			    void *param,
 			    ErrorMsg error_message){
   qke_param *pqke=param;
-  int vres=pqke->vres;
   int Nres=pqke->Nres;
   int i;
-  double x,xp1,f0,f0p1,Pa_minus,Ps_minus,Ps_minusp1,Pa_minusp1,I_PaPs,L; 
-  FILE *mat_file;
-  /** Calculate integrated quantities for convenience: */
- 
-  I_PaPs = 0.0;
-  for (i=0; i<pqke->vres-1; i++){
-    x = pqke->x_grid[i];
-    xp1 = pqke->x_grid[i+1];
-    f0 = 1.0/(1.0+exp(x));
-    f0p1 = 1.0/(1.0+exp(xp1));
-    Ps_minus = y[pqke->index_Py_minus+i];
-    Ps_minusp1 = y[pqke->index_Py_minus+i+1];
-    Pa_minus = y[pqke->index_Pa_plus+i];
-    Pa_minusp1 = y[pqke->index_Pa_plus+i+1];
-    I_PaPs += 0.5*(xp1-x)*(x*x*f0*(Ps_minus+Pa_minus)+
-			   xp1*xp1*f0p1*(Ps_minusp1+Pa_minusp1));
+  double moment[_QKE_MOMENTS_],stored[_QKE_MOMENTS_],I_PaPs=0.0,L; 
+  mat_writer *mw=&(pqke->writer);
+  /** The evolver stopped for a new grid and continues from here, so the
+      point is not an output point: */
+  if ((pqke->grid_pending >= 0)||(pqke->switch_pending == _TRUE_))
+    return _SUCCESS_;
+  /** Calculate integrated quantities for convenience, the trapezoidal
+      integral of x^2 f0 (Py_minus+Pa_plus): */
+  if ((pqke->I_conserved_handle != MAT_NO_HANDLE)||(pqke->output_nmoments > 0)){
+    lasagna_call(qke_moments(y,pqke,moment,error_message),
+		 error_message,error_message);
+    I_PaPs = moment[1]+moment[5];
+    for (i=0; i<pqke->output_nmoments; i++)
+      stored[i] = moment[pqke->output_moments[i]];
   }
 
   //printf("Storing output at index: %d\n",index_t);
-  mat_file = fopen(pqke->output_filename,"r+b");
+  lasagna_test(mat_writer_begin(mw)==_FAILURE_,error_message,
+	       "Writing to %s failed.",pqke->output_filename);
   //Write stuff from y_vector:
   L = y[pqke->index_L]*_L_SCALE_;
-  mat_write_fast(&L,pqke->L_handle,8,1);
-  mat_write_fast(y+pqke->index_Pa_plus,pqke->Pa_plus_handle,8,vres);
-  mat_write_fast(y+pqke->index_Pa_minus,pqke->Pa_minus_handle,8,vres);
-  mat_write_fast(y+pqke->index_Ps_plus,pqke->Ps_plus_handle,8,vres);
-  mat_write_fast(y+pqke->index_Ps_minus,pqke->Ps_minus_handle,8,vres);
-  mat_write_fast(y+pqke->index_Px_plus,pqke->Px_plus_handle,8,vres);
-  mat_write_fast(y+pqke->index_Px_minus,pqke->Px_minus_handle,8,vres);
-  mat_write_fast(y+pqke->index_Py_plus,pqke->Py_plus_handle,8,vres);
-  mat_write_fast(y+pqke->index_Py_minus,pqke->Py_minus_handle,8,vres);
+  mat_writer_put(mw,&L,&(pqke->L_handle),8,1);
+  qke_put_output_field(pqke,y+pqke->index_Pa_plus,&(pqke->Pa_plus_handle));
+  qke_put_output_field(pqke,y+pqke->index_Pa_minus,&(pqke->Pa_minus_handle));
+  qke_put_output_field(pqke,y+pqke->index_Ps_plus,&(pqke->Ps_plus_handle));
+  qke_put_output_field(pqke,y+pqke->index_Ps_minus,&(pqke->Ps_minus_handle));
+  qke_put_output_field(pqke,y+pqke->index_Px_plus,&(pqke->Px_plus_handle));
+  qke_put_output_field(pqke,y+pqke->index_Px_minus,&(pqke->Px_minus_handle));
+  qke_put_output_field(pqke,y+pqke->index_Py_plus,&(pqke->Py_plus_handle));
+  qke_put_output_field(pqke,y+pqke->index_Py_minus,&(pqke->Py_minus_handle));
   //Write stuff from structure:
-  mat_write_fast(pqke->x_grid,pqke->x_grid_handle,8,vres);
-  mat_write_fast(pqke->u_grid,pqke->u_grid_handle,8,vres);
-  mat_write_fast(pqke->v_grid,pqke->v_grid_handle,8,vres);
-  mat_write_fast(pqke->xi,pqke->xi_handle,8,Nres);
-  mat_write_fast(pqke->ui,pqke->ui_handle,8,Nres);
-  mat_write_fast(pqke->vi,pqke->vi_handle,8,Nres);
-  mat_write_fast(&(I_PaPs),pqke->I_conserved_handle,8,1);
-  mat_write_fast(&(pqke->V0),pqke->V0_handle,8,1);
-  mat_write_fast(&(pqke->V1),pqke->V1_handle,8,1);
-  mat_write_fast(&(pqke->Vx),pqke->Vx_handle,8,1);
-  mat_write_fast(&(pqke->VL),pqke->VL_handle,8,1);
-  mat_write_fast(&(pqke->b),pqke->b_a_vec_handle,8,1);
-  mat_write_fast(pqke->vi,pqke->b_a_vec_handle,8,Nres);//Wrong
+  qke_put_output_field(pqke,pqke->ws.x_grid,&(pqke->x_grid_handle));
+  qke_put_output_field(pqke,pqke->ws.u_grid,&(pqke->u_grid_handle));
+  qke_put_output_field(pqke,pqke->ws.v_grid,&(pqke->v_grid_handle));
+  mat_writer_put(mw,pqke->ws.xi,&(pqke->xi_handle),8,Nres);
+  mat_writer_put(mw,pqke->ws.ui,&(pqke->ui_handle),8,Nres);
+  mat_writer_put(mw,pqke->ws.vi,&(pqke->vi_handle),8,Nres);
+  if (pqke->I_conserved_handle != MAT_NO_HANDLE)
+    mat_writer_put(mw,&(I_PaPs),&(pqke->I_conserved_handle),8,1);
+  if (pqke->moments_handle != MAT_NO_HANDLE)
+    mat_writer_put(mw,stored,&(pqke->moments_handle),8,pqke->output_nmoments);
+  mat_writer_put(mw,&(pqke->V0),&(pqke->V0_handle),8,1);
+  mat_writer_put(mw,&(pqke->V1),&(pqke->V1_handle),8,1);
+  mat_writer_put(mw,&(pqke->Vx),&(pqke->Vx_handle),8,1);
+  mat_writer_put(mw,&(pqke->VL),&(pqke->VL_handle),8,1);
+  mat_writer_put(mw,&(pqke->b),&(pqke->b_a_vec_handle),8,1);
+  mat_writer_put(mw,pqke->ws.vi,&(pqke->b_a_vec_handle),8,Nres);//Wrong
   
 
   //Write temperature at last so we know that everything has been written:
-  mat_write_fast(&T,pqke->T_handle,8,1);
-  fclose(mat_file);
+  mat_writer_put(mw,&T,&(pqke->T_handle),8,1);
+  lasagna_test(mat_writer_commit(mw)==_FAILURE_,error_message,
+	       "Writing to %s failed.",pqke->output_filename);
   return _SUCCESS_;
 };
 
@@ -773,6 +1400,43 @@ int qke_stop_at_L(double t,
 };
 
 
+int qke_stop_at_budget(double t,
+		       double *y,
+		       double *dy,
+		       void *param,
+		       ErrorMsg error_message){
+  /** Stops the run when time_budget seconds have passed since run_start,
+      and otherwise applies qke_stop_at_divL if T_wait is set,
+      qke_grid_check with an adaptive grid and qke_switch_check with
+      grid_switch on the moving grid. It is called at the end of every
+      accepted step, so it also keeps the T and L reached there, which is
+      what is left of a run that fails later. */
+  qke_param *pqke=param;
+  pqke->steps_reached++;
+  pqke->T_reached = t;
+  pqke->L_reached = y[pqke->index_L]*_L_SCALE_;
+  if ((pqke->time_budget > 0.0)&&
+      (difftime(time(NULL),pqke->run_start) > pqke->time_budget)){
+    pqke->budget_exceeded = _TRUE_;
+    pqke->T_stop = t;
+    return _TRUE_;
+  }
+  if ((pqke->T_wait >= 0)&&(qke_stop_at_divL(t,y,dy,param,error_message) == _TRUE_)){
+    pqke->T_stop = t;
+    return _TRUE_;
+  }
+  if ((pqke->grid_levels > 0)&&(qke_grid_check(t,y,pqke) == _TRUE_)){
+    pqke->T_stop = t;
+    return _TRUE_;
+  }
+  if ((pqke->grid_switch == _TRUE_)&&(pqke->fixed_grid == 0)&&
+      (qke_switch_check(t,y,pqke) == _TRUE_)){
+    pqke->T_stop = t;
+    return _TRUE_;
+  }
+  return _FALSE_;
+}
+
 int qke_stop_at_divL(double t,
 		     double *y,
 		     double *dy,
@@ -780,9 +1444,11 @@ int qke_stop_at_divL(double t,
 		     ErrorMsg error_message){
   qke_param *pqke=param;
   double L, T, stopfactor;
-  stopfactor = 2;
+  int cross_found=pqke->cross_found;
+  stopfactor = _QKE_STOPFACTOR_;
   L = y[pqke->index_L]*_L_SCALE_;
   T = t;
+  pqke->cross_found = _FALSE_;
   // Check for sign change:
   if(L*pqke->max_cur < 0){
     pqke->max_old = max(pqke->max_old,fabs(pqke->max_cur));
@@ -793,8 +1459,14 @@ int qke_stop_at_divL(double t,
   if((fabs(L)>fabs(pqke->max_cur)) && (pqke->should_break==_FALSE_)){
     pqke->max_cur = L;
     if((fabs(pqke->max_cur) > pqke->max_old*stopfactor)){
-      pqke->breakpoint = T - pqke->T_wait;
+      //From the crossing itself, if qke_event_action has found it:
+      if (cross_found == _TRUE_)
+	pqke->breakpoint = pqke->T_cross - pqke->T_wait;
+      else
+	pqke->breakpoint = T - pqke->T_wait;
       pqke->should_break = _TRUE_;
+      if (T<pqke->breakpoint)
+	return _TRUE_;
     }
   }
   else if(pqke->should_break==_TRUE_){
@@ -807,6 +1479,61 @@ int qke_stop_at_divL(double t,
 };
 
 
+int qke_events(qke_param *pqke){
+  /** Directions and terminal flags of the events of qke_event_values. The
+      divergence itself only ends the run with T_wait = 0. */
+  pqke->event_direction[_QKE_EVENT_L_FINAL_] = 1;
+  pqke->event_terminal[_QKE_EVENT_L_FINAL_] = _TRUE_;
+  pqke->event_direction[_QKE_EVENT_DIVL_] = 1;
+  pqke->event_terminal[_QKE_EVENT_DIVL_] = (pqke->T_wait == 0.0 ? _TRUE_ : _FALSE_);
+  pqke->event_direction[_QKE_EVENT_BREAKPOINT_] = -1;
+  pqke->event_terminal[_QKE_EVENT_BREAKPOINT_] = _TRUE_;
+  return _SUCCESS_;
+}
+
+int qke_event_values(double t,
+		     double *y,
+		     double *value,
+		     void *param,
+		     ErrorMsg error_message){
+  /** qke_stop_at_L for L_final > 0, and the two conditions of
+      qke_stop_at_divL for T_wait >= 0, as functions that change sign at
+      the stop. The state of qke_stop_at_divL only changes between the
+      steps, so an inactive event keeps a constant sign during a step. */
+  qke_param *pqke=param;
+  double L=fabs(y[pqke->index_L]*_L_SCALE_);
+
+  value[_QKE_EVENT_L_FINAL_] = (pqke->L_final > 0.0 ? L - pqke->L_final : -1.0);
+  value[_QKE_EVENT_DIVL_] = -1.0;
+  value[_QKE_EVENT_BREAKPOINT_] = 1.0;
+  if (pqke->T_wait >= 0){
+    if (pqke->should_break == _FALSE_)
+      value[_QKE_EVENT_DIVL_] = L - _QKE_STOPFACTOR_*pqke->max_old;
+    else
+      value[_QKE_EVENT_BREAKPOINT_] = t - pqke->breakpoint;
+  }
+  return _SUCCESS_;
+}
+
+int qke_event_action(double t,
+		     double *y,
+		     int event,
+		     void *param,
+		     ErrorMsg error_message){
+  /** Keeps the T of the divergence for qke_stop_at_divL at the end of the
+      step, and the T of a terminal event for the sweep. */
+  qke_param *pqke=param;
+  if (event == _QKE_EVENT_DIVL_){
+    pqke->cross_found = _TRUE_;
+    pqke->T_cross = t;
+  }
+  if (pqke->event_terminal[event] == _TRUE_){
+    pqke->T_stop = t;
+    printf("Event %d at T=%.10e.\n",event,t);
+  }
+  return _SUCCESS_;
+}
+
 int qke_print_variables(double T,
 			double *y,
 			double *dy,
@@ -819,7 +1546,7 @@ int qke_print_variables(double T,
   double D,Gamma;
   double Pa_plus, Pa_minus, Ps_plus, Ps_minus, Px_plus, Px_minus;
   double Py_plus, Py_minus;
-  x = pqke->x_grid[idx];
+  x = pqke->ws.x_grid[idx];
   Vx = pqke->Vx/x;
   V0 = pqke->V0/x;
   V1 = pqke->V1*x;
@@ -881,57 +1608,208 @@ int get_integrated_quantities(double *y,
 			      double *I_rho_ss_bar,
 			      double *I_f0,
 			      ErrorMsg error_message){
-  int i;
-  double w_trapz, x, x2, f0, Vx;
-  double Py_minus, Pa_plus, Ps, Ps_bar;
+  double moment[_QKE_MOMENTS_];
 			      
   /** Integrated quantities needed. We integrate in x space: */
-  *I_VxPy_minus = 0.0;
-  *I_f0Pa_plus = 0.0;
-  *I_rho_ss = 0.0;
-  *I_rho_ss_bar = 0.0;
-  *I_f0 = 0.0;
-  for (i=0; i<pqke->vres; i++){
-    if (i==0)
-      w_trapz = 0.5*(pqke->x_grid[i+1]-pqke->x_grid[i]);
-    else if (i==pqke->vres-1)
-      w_trapz = 0.5*(pqke->x_grid[i]-pqke->x_grid[i-1]);
+  lasagna_call(qke_moments(y,pqke,moment,error_message),
+	       error_message,error_message);
+  *I_VxPy_minus = moment[0];
+  *I_f0Pa_plus = moment[1];
+  *I_rho_ss = moment[2];    //From equation 2.18 in Kainulainen2001.
+  *I_rho_ss_bar = moment[3];
+  *I_f0 = moment[4];
+  return _SUCCESS_;
+}
+
+int qke_moments(double *y,
+		qke_param *pqke,
+		double *moment,
+		ErrorMsg error_message){
+  /** The trapezoidal moments int x^2 f0 g dx of g = Vx*Py_minus, Pa_plus,
+      Ps_plus+Ps_minus, Ps_plus-Ps_minus, 1 and Py_minus in moment[0..5], in one
+      pass over y. A block of _RHS_BLOCK_ bins is summed pairwise, and the
+      blocks are added in order with compensation, so the result does not
+      depend on the number of threads. */
+  int vres=pqke->vres, nblock, iblock, i, k, m, n, len;
+  double *x_grid=pqke->ws.x_grid, *f0_grid, *sum;
+  double *Pa_plus=y+pqke->index_Pa_plus, *Py_minus=y+pqke->index_Py_minus;
+  double *Ps_plus=y+pqke->index_Ps_plus, *Ps_minus=y+pqke->index_Ps_minus;
+  double Vx=pqke->Vx, w, x, x2f0, c[_QKE_MOMENTS_], t;
+  
+  qke_grid_table(pqke);
+  f0_grid = pqke->ws.grid_table+vres;
+  nblock = (vres+_RHS_BLOCK_-1)/_RHS_BLOCK_;
+#pragma omp parallel for num_threads(pqke->rhs_threads) if(pqke->rhs_threads>1) \
+  private(i,k,m,n,len,sum,w,x,x2f0) schedule(static)
+  for (iblock=0; iblock<nblock; iblock++){
+    double term[_QKE_MOMENTS_][_RHS_BLOCK_];
+    n = min(_RHS_BLOCK_,vres-iblock*_RHS_BLOCK_);
+#pragma omp simd private(k,w,x,x2f0)
+    for (i=0; i<n; i++){
+      k = iblock*_RHS_BLOCK_+i;
+      w = 0.5*(x_grid[min(k+1,vres-1)]-x_grid[max(k-1,0)]);
+      x = x_grid[k];
+      x2f0 = w*x*x*f0_grid[k];
+      term[0][i] = x2f0*Vx/x*Py_minus[k];
+      term[1][i] = x2f0*Pa_plus[k];
+      term[2][i] = x2f0*(Ps_plus[k]+Ps_minus[k]);
+      term[3][i] = x2f0*(Ps_plus[k]-Ps_minus[k]);
+      term[4][i] = x2f0;
+      term[5][i] = x2f0*Py_minus[k];
+    }
+    //Pairwise summation, padded to a power of two:
+    for (len=1; len<n; len*=2);
+    for (m=0; m<_QKE_MOMENTS_; m++)
+      for (i=n; i<len; i++)
+	term[m][i] = 0.0;
+    for (; len>1; len/=2){
+      for (m=0; m<_QKE_MOMENTS_; m++){
+#pragma omp simd
+	for (i=0; i<len/2; i++)
+	  term[m][i] += term[m][i+len/2];
+      }
+    }
+    sum = pqke->ws.rhs_partial+_QKE_MOMENTS_*iblock;
+    for (m=0; m<_QKE_MOMENTS_; m++)
+      sum[m] = term[m][0];
+  }
+  //Neumaier summation over the blocks:
+  for (m=0; m<_QKE_MOMENTS_; m++){
+    moment[m] = 0.0;
+    c[m] = 0.0;
+  }
+  for (iblock=0; iblock<nblock; iblock++){
+    sum = pqke->ws.rhs_partial+_QKE_MOMENTS_*iblock;
+    for (m=0; m<_QKE_MOMENTS_; m++){
+      t = moment[m]+sum[m];
+      if (fabs(moment[m]) >= fabs(sum[m]))
+	c[m] += (moment[m]-t)+sum[m];
+      else
+	c[m] += (sum[m]-t)+moment[m];
+      moment[m] = t;
+    }
+  }
+  for (m=0; m<_QKE_MOMENTS_; m++)
+    moment[m] += c[m];
+  return _SUCCESS_;
+}
+
+int qke_grid_table(qke_param *pqke){
+  /** Builds the table of exp(x), f0 = 1/(1+exp(x)) and the x-dependent
+      part C_alpha*G_F^2*x of Gamma on x_grid, unless it is still valid.
+      get_parametrisation invalidates it when it moves the grid. */
+  double *exp_x=pqke->ws.grid_table, *f0_grid, *Gamma_x, x;
+  int i, vres=pqke->vres;
+  if (pqke->grid_table_valid == _TRUE_)
+    return _SUCCESS_;
+  f0_grid = exp_x+vres;
+  Gamma_x = f0_grid+vres;
+#pragma omp parallel for simd num_threads(pqke->rhs_threads) if(pqke->rhs_threads>1) \
+  private(x) schedule(static)
+  for (i=0; i<vres; i++){
+    x = pqke->ws.x_grid[i];
+    exp_x[i] = exp(x);
+    f0_grid[i] = 1.0/(1.0+exp(x));
+    Gamma_x[i] = pqke->C_alpha*_G_F_*_G_F_*x;
+  }
+  pqke->grid_table_valid = _TRUE_;
+  return _SUCCESS_;
+}
+
+int qke_parametrisation_cached(double T, 
+			      double L, 
+			      qke_param *pqke, 
+			      ErrorMsg error_message){
+  /** get_resonances_xi and get_parametrisation memoised on (T,L). numjac calls derivs
+      with the same T and L for all column groups but the one holding L,
+      and the grid already in pqke is then used as it is. */
+  int len=3+5*pqke->Nres+2*pqke->vres;
+  int k;
+  double *entry, t0;
+
+  k = pqke->param_cache_current;
+  if ((k>=0)&&(pqke->ws.param_cache[k*len]==T)&&(pqke->ws.param_cache[k*len+1]==L))
+    return _SUCCESS_;
+  for (k=0; k<_PARAM_CACHE_; k++){
+    entry = pqke->ws.param_cache+k*len;
+    if ((entry[0]==T)&&(entry[1]==L)){
+      qke_param_cache_copy(entry,pqke,_FALSE_);
+      pqke->param_cache_current = k;
+      return _SUCCESS_;
+    }
+  }
+  t0 = evolver_tic(pqke->timing);
+  get_resonances_xi(T,L,pqke);
+  lasagna_call(get_parametrisation(T,
+				   pqke, 
+				   error_message),
+	       error_message,error_message);
+  evolver_toc(pqke->timing,pqke->param_time,pqke->param_solves,t0);
+  k = pqke->param_cache_next;
+  pqke->param_cache_next = (k+1)%_PARAM_CACHE_;
+  entry = pqke->ws.param_cache+k*len;
+  entry[0] = T;
+  entry[1] = L;
+  qke_param_cache_copy(entry,pqke,_TRUE_);
+  pqke->param_cache_current = k;
+  return _SUCCESS_;
+}
+
+int qke_param_cache_copy(double *entry, qke_param *pqke, int store){
+  /** Copies the parametrisation to (store=_TRUE_) or from a cache entry. */
+  int Nres=pqke->Nres, vres=pqke->vres;
+  double *v[5]={pqke->ws.xi, pqke->ws.ui, pqke->ws.duidx, pqke->ws.vi, pqke->ws.a};
+  int i;
+
+  entry += 2;
+  for (i=0; i<5; i++){
+    if (store == _TRUE_)
+      memcpy(entry+i*Nres,v[i],sizeof(double)*Nres);
     else
-      w_trapz = 0.5*(pqke->x_grid[i+1]-pqke->x_grid[i-1]);
-    x = pqke->x_grid[i];
-    x2 = x*x;
-    f0 = 1.0/(1.0+exp(x));
-    Vx = pqke->Vx/x;
-    Py_minus = y[pqke->index_Py_minus+i];
-    Pa_plus = y[pqke->index_Pa_plus+i];
-    Ps = (y[pqke->index_Ps_plus+i] + y[pqke->index_Ps_minus+i]);
-    Ps_bar = (y[pqke->index_Ps_plus+i] - y[pqke->index_Ps_minus+i]);
-      
-    *I_VxPy_minus += w_trapz*(x2*f0*Vx*Py_minus);
-    *I_f0Pa_plus += w_trapz*(x2*f0*Pa_plus);
-    *I_rho_ss += w_trapz*(x2*f0*Ps);    //From equation 2.18 in Kainulainen2001.
-    *I_rho_ss_bar += w_trapz*(x2*f0*Ps_bar);
-    *I_f0 += w_trapz*(x2*f0);
+      memcpy(v[i],entry+i*Nres,sizeof(double)*Nres);
   }
+  entry += 5*Nres;
+  if (store == _TRUE_){
+    entry[0] = pqke->b;
+    memcpy(entry+1,pqke->ws.u_grid,sizeof(double)*vres);
+    memcpy(entry+1+vres,pqke->ws.x_grid,sizeof(double)*vres);
+  }
+  else{
+    pqke->b = entry[0];
+    memcpy(pqke->ws.u_grid,entry+1,sizeof(double)*vres);
+    memcpy(pqke->ws.x_grid,entry+1+vres,sizeof(double)*vres);
+    pqke->grid_table_valid = _FALSE_;
+  }
+  return _SUCCESS_;
+}
+
+int qke_param_cache_clear(qke_param *pqke){
+  /** Empties the cache, the keys are set to the impossible T=-1. */
+  int len=3+5*pqke->Nres+2*pqke->vres;
+  int k;
+  for (k=0; k<_PARAM_CACHE_; k++)
+    pqke->ws.param_cache[k*len] = -1.0;
+  pqke->param_cache_current = -1;
+  pqke->param_cache_next = 0;
   return _SUCCESS_;
 }
 
 int get_parametrisation(double T,qke_param *pqke, ErrorMsg error_message){
   double alpha=pqke->alpha;
-  double *maxstep=pqke->maxstep;;
-  double *y_0=pqke->y_0;
-  double *ui=pqke->ui;
-  double *vi=pqke->vi;
-  double *x_grid=pqke->x_grid;
-  double *u_grid=pqke->u_grid;
-  double *v_grid=pqke->v_grid;
+  double *maxstep=pqke->ws.maxstep;;
+  double *y_0=pqke->ws.y_0;
+  double *ui=pqke->ws.ui;
+  double *vi=pqke->ws.vi;
+  double *x_grid=pqke->ws.x_grid;
+  double *u_grid=pqke->ws.u_grid;
+  double *v_grid=pqke->ws.v_grid;
   double tol_newton=1e-12;
-  double wi;
+  double wi, x_old;
   int i,j;
   int niter;
 
   for (i=0; i<pqke->Nres; i++){
-    u_of_x(pqke->xi[i],ui+i,pqke->duidx+i,pqke);
+    u_of_x(pqke->ws.xi[i],ui+i,pqke->ws.duidx+i,pqke);
   }
   
   //Establish guess and set maximum steps for Newton method:
@@ -939,7 +1817,7 @@ int get_parametrisation(double T,qke_param *pqke, ErrorMsg error_message){
       on the derivative function to give exactly the same output for the same
       inputs, so making a non-deterministic guess here spoils this!
   */
-  if (1==1){//(pqke->guess_exists == _FALSE_){
+  if ((pqke->warm_start == _FALSE_)||(pqke->guess_exists == _FALSE_)){
     y_0[0] = 1.0 - alpha;
     maxstep[0] = 100.0;
     for (i=1; i<=pqke->Nres; i++){
@@ -948,53 +1826,76 @@ int get_parametrisation(double T,qke_param *pqke, ErrorMsg error_message){
     }
   }
   else{
-    //We can make a more realistic guess:
+    /** We can make a more realistic guess from the last solution, with
+	vi moved along dvidT. Only used if warm_start is set, see above. */
     y_0[0] = pqke->b;
     maxstep[0] = 100.0;
     for (i=1; i<=pqke->Nres; i++){
-      y_0[i] = vi[i-1];
+      y_0[i] = vi[i-1]+pqke->ws.dvidT[i-1]*(T-pqke->T_guess);
       maxstep[i] = 0.1;
     }
   }
   //Find parametrisation parameters vi, a and b using Newton:
-  lasagna_call(Newton(nonlinear_rhs,
-		      nonlinear_rhs_jac,
-		      y_0,
-		      pqke,
-		      maxstep,
-		      tol_newton,
-		      &niter,
-		      100,
-		      pqke->Nres+1,
-		      error_message),
-	       error_message,error_message);
+  if (pqke->sparse_newton == _TRUE_){
+    if (pqke->ws.newton == NULL)
+      lasagna_call(parametrisation_newton_alloc(pqke->Nres,&(pqke->ws.newton),error_message),
+		   error_message,error_message);
+    lasagna_call(Newton_sparse(nonlinear_rhs,
+			       nonlinear_rhs_sparse_jac,
+			       y_0,
+			       pqke,
+			       maxstep,
+			       tol_newton,
+			       &niter,
+			       100,
+			       pqke->ws.newton,
+			       error_message),
+		 error_message,error_message);
+  }
+  else{
+    lasagna_call(Newton(nonlinear_rhs,
+			nonlinear_rhs_jac,
+			y_0,
+			pqke,
+			maxstep,
+			tol_newton,
+			&niter,
+			100,
+			pqke->Nres+1,
+			error_message),
+		 error_message,error_message);
+  }
   pqke->guess_exists = _TRUE_;
+  pqke->T_guess = T;
+  pqke->param_cache_current = -1;
   pqke->b = y_0[0];
   for (i=0; i<pqke->Nres; i++){
     vi[i] = y_0[i+1];
-    pqke->a[i] = ui[i]-alpha*vi[i];
+    pqke->ws.a[i] = ui[i]-alpha*vi[i];
   }
 
   //Now update grids:
-  /** Find the splitting of v and store it temporarily in pqke->indx.
+  /** Find the splitting of v and store it temporarily in pqke->ws.indx.
       We use the fact that v is uniform.
   */
-  pqke->indx[0] = 0;
-  pqke->indx[pqke->Nres] = pqke->vres;
+  pqke->ws.indx[0] = 0;
+  pqke->ws.indx[pqke->Nres] = pqke->vres;
   for (i=1; i<pqke->Nres; i++){
     wi = 0.5*(vi[i-1]+vi[i]); //Weighted average
-    pqke->indx[i] = (int)((wi-pqke->v_left)/(v_grid[1]-v_grid[0]));
-    if (pqke->indx[i]<pqke->indx[i-1])
-      pqke->indx[i] = pqke->indx[i-1];
+    pqke->ws.indx[i] = (int)((wi-pqke->v_left)/(v_grid[1]-v_grid[0]));
+    if (pqke->ws.indx[i]<pqke->ws.indx[i-1])
+      pqke->ws.indx[i] = pqke->ws.indx[i-1];
   }
   // Now loop over resonances:
   for (i=0; i<pqke->Nres; i++){
-    if (pqke->indx[i]==pqke->indx[i+1])
+    if (pqke->ws.indx[i]==pqke->ws.indx[i+1])
       continue;
     //Loop over each segment:
-    for (j=pqke->indx[i]; j<pqke->indx[i+1]; j++){
-      u_grid[j] = alpha*v_grid[j]+pqke->a[i]+pqke->b*pow(v_grid[j]-vi[i],3);
+    for (j=pqke->ws.indx[i]; j<pqke->ws.indx[i+1]; j++){
+      u_grid[j] = alpha*v_grid[j]+pqke->ws.a[i]+pqke->b*pow(v_grid[j]-vi[i],3);
+      x_old = x_grid[j];
       x_of_u(u_grid[j],&(x_grid[j]),pqke);
+      if (x_grid[j] != x_old) pqke->grid_table_valid = _FALSE_;
     }
   }
 
@@ -1010,13 +1911,13 @@ int get_partial_derivatives(double T,
   double u1, v1, vN;
   double gamma_j, beta_j, wi;
   double alpha=pqke->alpha;
-  double *dvidT=pqke->dvidT;
-  double *duidT=pqke->duidT;
-  double *v_grid=pqke->v_grid;
-  double *ui=pqke->ui;
-  double *vi=pqke->vi;
-  double *dvdu_grid=pqke->dvdu_grid;
-  double *dudT_grid=pqke->dudT_grid;
+  double *dvidT=pqke->ws.dvidT;
+  double *duidT=pqke->ws.duidT;
+  double *v_grid=pqke->ws.v_grid;
+  double *ui=pqke->ws.ui;
+  double *vi=pqke->ws.vi;
+  double *dvdu_grid=pqke->ws.dvdu_grid;
+  double *dudT_grid=pqke->ws.dudT_grid;
   double dbdT,daidT;
   double lu_sgn;
 
@@ -1027,11 +1928,11 @@ int get_partial_derivatives(double T,
 
   //Set partial derivatives of ui with respect to T:
   for (i=0; i<pqke->Nres; i++){ 
-    pqke->duidT[i]=pqke->duidx[i]*pqke->dxidT[i];
+    pqke->ws.duidT[i]=pqke->ws.duidx[i]*pqke->ws.dxidT[i];
   }
   for(j=0; j<pqke->Nres; j++){
     for(i=0; i<pqke->Nres; i++){
-        pqke->mat[j+1][i+1] = 0.0;
+        pqke->ws.mat[j+1][i+1] = 0.0;
     }
   }
   u1 = ui[0];
@@ -1042,42 +1943,42 @@ int get_partial_derivatives(double T,
     /** Enter non-zero entries in A: */
     gamma_j = 0.25*pow(vi[j+1]/v1-vi[j]/v1,3)*(2.0*alpha-3.0*u1/v1);
     beta_j = alpha + 0.75*pqke->b*pow(vi[j+1]-vi[j],2);
-    pqke->mat[j+1][1] = gamma_j;
-    pqke->mat[j+1][j+1] -= beta_j;
-    pqke->mat[j+1][j+2] += beta_j;
+    pqke->ws.mat[j+1][1] = gamma_j;
+    pqke->ws.mat[j+1][j+1] -= beta_j;
+    pqke->ws.mat[j+1][j+2] += beta_j;
     /** Setup RHS: */
     dvidT[j] = duidT[j+1]-duidT[j]-0.25*pow(vi[j+1]/v1-vi[j]/v1,3)*duidT[0];
   }
-  pqke->mat[pqke->Nres][1] = -pow((1.0-vN)/v1,3)*(2.0*alpha-3.0*u1/v1);
-  pqke->mat[pqke->Nres][pqke->Nres] = alpha+3.0*pqke->b*pow(1.0-vN,2);
+  pqke->ws.mat[pqke->Nres][1] = -pow((1.0-vN)/v1,3)*(2.0*alpha-3.0*u1/v1);
+  pqke->ws.mat[pqke->Nres][pqke->Nres] = alpha+3.0*pqke->b*pow(1.0-vN,2);
   dvidT[pqke->Nres-1] = duidT[pqke->Nres-1]+pow((1.0-vN)/v1,3)*duidT[0];
 
   //LU decomposition of matrix:
-  lasagna_call(ludcmp(pqke->mat,pqke->Nres,pqke->indx,&lu_sgn,pqke->vv),
+  lasagna_call(ludcmp(pqke->ws.mat,pqke->Nres,pqke->ws.indx,&lu_sgn,pqke->ws.vv),
 	       error_message,error_message);
-  lasagna_call(lubksb(pqke->mat,pqke->Nres,pqke->indx,dvidT-1),
+  lasagna_call(lubksb(pqke->ws.mat,pqke->Nres,pqke->ws.indx,dvidT-1),
 	       error_message,error_message);
 
   /** Calculate x and u on the v-grid along with derivatives dvdu and dudT:*/
   dbdT = (duidT[0]+(2.0*alpha-3.0*u1/v1)*dvidT[0])/pow(v1,3);
-  /** Find the splitting of v and store it temporarily in pqke->indx.
+  /** Find the splitting of v and store it temporarily in pqke->ws.indx.
       We use the fact that v is uniform.
   */
-  pqke->indx[0] = 0;
-  pqke->indx[pqke->Nres] = pqke->vres;
+  pqke->ws.indx[0] = 0;
+  pqke->ws.indx[pqke->Nres] = pqke->vres;
   for (i=1; i<pqke->Nres; i++){
     wi = 0.5*(vi[i-1]+vi[i]); //Weighted average
-    pqke->indx[i] = (int)((wi-pqke->v_left)/(v_grid[1]-v_grid[0]));
-    if (pqke->indx[i]<pqke->indx[i-1])
-      pqke->indx[i] = pqke->indx[i-1];
+    pqke->ws.indx[i] = (int)((wi-pqke->v_left)/(v_grid[1]-v_grid[0]));
+    if (pqke->ws.indx[i]<pqke->ws.indx[i-1])
+      pqke->ws.indx[i] = pqke->ws.indx[i-1];
   }
 
   // Now loop over resonances:
   for (i=0; i<pqke->Nres; i++){
-    if (pqke->indx[i]==pqke->indx[i+1])
+    if (pqke->ws.indx[i]==pqke->ws.indx[i+1])
       continue;
     //Loop over each segment:
-    for (j=pqke->indx[i]; j<pqke->indx[i+1]; j++){
+    for (j=pqke->ws.indx[i]; j<pqke->ws.indx[i+1]; j++){
       daidT = duidT[i]-alpha*dvidT[i];
       dvdu_grid[j] = 1.0/(alpha+3.0*pqke->b*pow(v_grid[j]-vi[i],2));
       dudT_grid[j] = daidT+dbdT*pow(v_grid[j]-vi[i],3)-
@@ -1088,24 +1989,24 @@ int get_partial_derivatives(double T,
   /**
   fprintf(pqke->tmp,"%.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e %.16e\n",
 	  T,
-	  pqke->a[0],
-	  pqke->a[1],
+	  pqke->ws.a[0],
+	  pqke->ws.a[1],
 	  duidT[0]-alpha*dvidT[0],
 	  duidT[1]-alpha*dvidT[1], 
 	  pqke->b,
 	  dbdT,
-	  pqke->xi[0],
-	  pqke->xi[1],
-	  pqke->dxidT[0], 
-	  pqke->dxidT[1],
-	  pqke->ui[0],
-	  pqke->ui[1],
-	  pqke->duidT[0],
-	  pqke->duidT[1],
-	  pqke->vi[0],
-	  pqke->vi[1],
-	  pqke->dvidT[0],
-	  pqke->dvidT[1]);
+	  pqke->ws.xi[0],
+	  pqke->ws.xi[1],
+	  pqke->ws.dxidT[0], 
+	  pqke->ws.dxidT[1],
+	  pqke->ws.ui[0],
+	  pqke->ws.ui[1],
+	  pqke->ws.duidT[0],
+	  pqke->ws.duidT[1],
+	  pqke->ws.vi[0],
+	  pqke->ws.vi[1],
+	  pqke->ws.dvidT[0],
+	  pqke->ws.dvidT[1]);
   */
 return _SUCCESS_;
 }
@@ -1117,47 +2018,212 @@ int qke_derivs(double T,
 	       void *param,
 	       ErrorMsg error_message){
   qke_param *pqke=param;
-  double L;
-  int i;
-  double *v_grid=pqke->v_grid;
-  double *dvdu_grid=pqke->dvdu_grid;
-  double *dudT_grid=pqke->dudT_grid;
-  double gentr,H;
-  double Vx, VL;
-  double x;
-  double Gamma, D, V0, V1, Pa_plus, Pa_minus, Ps_plus, Ps_minus;
-  double Px_plus, Px_minus, Py_plus, Py_minus, f0,  mu_div_T;
-  double feq_plus, feq_minus, feq, feq_bar;
-  double I_VxPy_minus, I_f0Pa_plus, I_rho_ss, I_rho_ss_bar, I_f0;
-  double dudTdvdu, delta_v;
-  double rs;
-  int idx, stencil_method;
+  double H, mu_div_T;
+
+  lasagna_call(qke_derivs_setup(T,
+				y[pqke->index_L]*_L_SCALE_,
+				pqke,
+				&H,
+				&mu_div_T,
+				error_message),
+	       error_message,error_message);
+  lasagna_call(qke_derivs_state(T,
+				y,
+				dy,
+				NULL,
+				H,
+				mu_div_T,
+				pqke,
+				error_message),
+	       error_message,error_message);
+  return _SUCCESS_;
+}
+
+int qke_derivs_split(double T, 
+		     double *y, 
+		     double *f_implicit, 
+		     double *f_explicit, 
+		     void *param,
+		     ErrorMsg error_message){
+  /** qke_derivs split for the IMEX mode: the advection terms, which give
+      the wide bands of the Jacobian, in f_explicit, and the local terms 
+      and dL/dT in f_implicit. */
+  qke_param *pqke=param;
+  double H, mu_div_T;
+
+  lasagna_call(qke_derivs_setup(T,
+				y[pqke->index_L]*_L_SCALE_,
+				pqke,
+				&H,
+				&mu_div_T,
+				error_message),
+	       error_message,error_message);
+  lasagna_call(qke_derivs_state(T,
+				y,
+				f_implicit,
+				f_explicit,
+				H,
+				mu_div_T,
+				pqke,
+				error_message),
+	       error_message,error_message);
+  return _SUCCESS_;
+}
+
+int qke_imex_blocks(qke_param *pqke, int *block_index){
+  /** The 8 fields of each bin as the blocks of the block wrapper, which
+      leaves L as the border. block_index has 8*vres entries. */
+  int i, k;
+  int index_field[8]={pqke->index_Pa_plus, pqke->index_Pa_minus,
+		      pqke->index_Ps_plus, pqke->index_Ps_minus,
+		      pqke->index_Px_plus, pqke->index_Px_minus,
+		      pqke->index_Py_plus, pqke->index_Py_minus};
+  for (i=0; i<pqke->vres; i++)
+    for (k=0; k<8; k++)
+      block_index[8*i+k] = index_field[k]+i;
+  return _SUCCESS_;
+}
+
+int qke_derivs_batch(double T, 
+		     double **y, 
+		     double **dy, 
+		     int m,
+		     void *param,
+		     ErrorMsg error_message){
+  /** Evaluates qke_derivs for the m states y[0..m-1]. The setup only 
+      depends on T and L, so it is done once for all states with the L
+      of y[0]. The other states, usually none or one column group of 
+      numjac, are evaluated on their own afterwards. */
+  qke_param *pqke=param;
+  double H, mu_div_T;
+  int k;
+
+  lasagna_call(qke_derivs_setup(T,
+				y[0][pqke->index_L]*_L_SCALE_,
+				pqke,
+				&H,
+				&mu_div_T,
+				error_message),
+	       error_message,error_message);
+  for (k=0; k<m; k++){
+    if (y[k][pqke->index_L] != y[0][pqke->index_L])
+      continue;
+    lasagna_call(qke_derivs_state(T,
+				  y[k],
+				  dy[k],
+				  NULL,
+				  H,
+				  mu_div_T,
+				  pqke,
+				  error_message),
+		 error_message,error_message);
+  }
+  for (k=1; k<m; k++){
+    if (y[k][pqke->index_L] == y[0][pqke->index_L])
+      continue;
+    lasagna_call(qke_derivs(T,
+			    y[k],
+			    dy[k],
+			    pqke,
+			    error_message),
+		 error_message,error_message);
+  }
+  return _SUCCESS_;
+}
+
+int qke_derivs_setup(double T, 
+		     double L, 
+		     qke_param *pqke,
+		     double *H,
+		     double *mu_div_T,
+		     ErrorMsg error_message){
+  /** The part of qke_derivs that depends on T and L only: potentials, 
+      grid, Hubble rate, mu/T and the exponentials on the grid. */
+  double gentr;
   double n_plus = 2.0;
-  double dLdT;
+  double *x_grid=pqke->ws.x_grid, *exp_xm, *exp_xp, mu;
+  int i, vres=pqke->vres;
 
   if (pqke->is_electron==_TRUE_)
     pqke->g_alpha = 1.0+4.0/((1.0-_SIN2_THETA_W_)*n_plus);
   else
     pqke->g_alpha = 1.0;
   
-  L = y[pqke->index_L]*_L_SCALE_;
-  
   /** Calculate 'scalar' potentials Vx, V0, VL
       (not momentum dependent): */
   pqke->VL = sqrt(2.0)*_G_F_*2.0*_ZETA3_*pow(T,3)/_PI_/_PI_*L;
-  VL = pqke->VL;
   pqke->Vx = pqke->delta_m2/(2.0*T)*sin(2.0*pqke->theta_zero);
   pqke->V0 = -pqke->delta_m2/(2.0*T)*cos(2.0*pqke->theta_zero);
   pqke->V1 = -7.0*_PI_*_PI_/(45.0*sqrt(2.0))*
     _G_F_/_M_Z_/_M_Z_*pow(T,5)*n_plus*pqke->g_alpha;
 
-  get_resonances_xi(T,L,pqke);
-  
-  //Get new x_grid
-  lasagna_call(get_parametrisation(T,
-				   pqke, 
-				   error_message),
+  //Get new x_grid, or the one from an earlier call with this T and L:
+  lasagna_call(qke_parametrisation_cached(T,
+					  L,
+					  pqke, 
+					  error_message),
 	       error_message,error_message);
+
+  //Get degrees of freedom from background:
+  background_getdof(T,NULL,&gentr,&(pqke->pbs));
+  /** Use Friedmann equation in radiation dominated universe: 
+      (The radiation approximation breaks down long before there 
+      is a difference in g and gS) */  
+  *H = sqrt(8.0*pow(_PI_,3)*gentr/90.0)*T*T/_M_PL_;
+
+  //Solving mu from L, using the chebyshev cubic root:
+  mu = -2*_PI_/sqrt(3.0)*
+    sinh(1.0/3.0*asinh(-18.0*sqrt(3.0)*_ZETA3_*L/pow(_PI_,3)));
+  *mu_div_T = mu;
+
+  /** The exponentials are computed once per bin in a loop of their own, 
+      so it can use a vector exp. The terms that only depend on x are in 
+      the grid table: */
+  qke_grid_table(pqke);
+  exp_xm = pqke->ws.rhs_work;
+  exp_xp = exp_xm+vres;
+#pragma omp parallel for simd num_threads(pqke->rhs_threads) if(pqke->rhs_threads>1) \
+  schedule(static)
+  for (i=0; i<vres; i++){
+    exp_xm[i] = exp(x_grid[i]-mu);
+    exp_xp[i] = exp(x_grid[i]+mu);
+  }
+  return _SUCCESS_;
+}
+
+int qke_derivs_state(double T, 
+		     double *y, 
+		     double *dy, 
+		     double *dy_explicit,
+		     double H,
+		     double mu_div_T,
+		     qke_param *pqke,
+		     ErrorMsg error_message){
+  /** The part of qke_derivs that depends on the state y, after 
+      qke_derivs_setup has been called with the L of y. If dy_explicit
+      is not NULL, the advection terms go there instead of into dy. */
+  double L;
+  int i;
+  double *dvdu_grid=pqke->ws.dvdu_grid;
+  double *dudT_grid=pqke->ws.dudT_grid;
+  double Vx, VL;
+  double x;
+  double Gamma, D, V0, V1, Pa_plus, Pa_minus, Ps_plus, Ps_minus;
+  double Px_plus, Px_minus, Py_plus, Py_minus, f0;
+  double feq_plus, feq_minus, feq, feq_bar;
+  double I_VxPy_minus, I_f0Pa_plus, I_rho_ss, I_rho_ss_bar, I_f0;
+  double rs;
+  int idx, k, vres;
+  double dLdT;
+  double *x_grid, *exp_x, *f0_grid, *Gamma_x, *exp_xm, *exp_xp, *dudTdvdu_grid;
+  double T5, mu3, HTinv, c_ss, c_ss_bar;
+  int index_field[8]={pqke->index_Pa_plus, pqke->index_Pa_minus,
+		      pqke->index_Ps_plus, pqke->index_Ps_minus,
+		      pqke->index_Px_plus, pqke->index_Px_minus,
+		      pqke->index_Py_plus, pqke->index_Py_minus};
+
+  L = y[pqke->index_L]*_L_SCALE_;
+  VL = pqke->VL;
   
   //Get integrated quantities
   lasagna_call(get_integrated_quantities(y,
@@ -1170,13 +2236,6 @@ int qke_derivs(double T,
 					 error_message),
 	       error_message,error_message);
    
-  //Get degrees of freedom from background:
-  background_getdof(T,NULL,&gentr,&(pqke->pbs));
-  /** Use Friedmann equation in radiation dominated universe: 
-      (The radiation approximation breaks down long before there 
-      is a difference in g and gS) */  
-  H = sqrt(8.0*pow(_PI_,3)*gentr/90.0)*T*T/_M_PL_;
-
   dLdT = -1.0/(8.0*H*T*_ZETA3_)*I_VxPy_minus;
   
   //Get partial derivatives:
@@ -1189,18 +2248,44 @@ int qke_derivs(double T,
 
   /** Calculate RHS: */
   dy[pqke->index_L] = dLdT/_L_SCALE_;
-  //Solving mu from L, using the chebyshev cubic root:
-  mu_div_T = -2*_PI_/sqrt(3.0)*
-    sinh(1.0/3.0*asinh(-18.0*sqrt(3.0)*_ZETA3_*L/pow(_PI_,3)));
   
   /** All quantities defined on the grid: */
-  delta_v = v_grid[1]-v_grid[0];
-  for (i=0; i<pqke->vres; i++){
-    x = pqke->x_grid[i];
+  vres = pqke->vres;
+  x_grid = pqke->ws.x_grid;
+  exp_x = pqke->ws.grid_table;
+  f0_grid = exp_x+vres;
+  Gamma_x = f0_grid+vres;
+  exp_xm = pqke->ws.rhs_work;
+  exp_xp = exp_xm+vres;
+  dudTdvdu_grid = exp_xp+vres;
+  if (dy_explicit != NULL)
+    memset(dy_explicit,0,sizeof(double)*pqke->neq);
+  else
+    dy_explicit = dy;
+  T5 = pow(T,5);
+  mu3 = pow(mu_div_T,3);
+  HTinv = 1.0/(H*T);
+  rs = pqke->rs;
+  c_ss = 1.0/(4.0*I_f0)*I_rho_ss;
+  c_ss_bar = 1.0/(4.0*I_f0)*I_rho_ss_bar;
+  /** The passes below write disjoint bins, so they are shared out over
+      rhs_threads threads without changing the result: */
+#pragma omp parallel num_threads(pqke->rhs_threads) if(pqke->rhs_threads>1)
+  {
+#pragma omp for simd schedule(static)
+  for (i=0; i<vres; i++){
+    dudTdvdu_grid[i] = dudT_grid[i]*dvdu_grid[i];
+  }
+  /** Local terms, the advection terms are added below: */
+#pragma omp for private(x,Vx,V0,V1,Gamma,D,Pa_plus,Pa_minus,Ps_plus,Ps_minus,Px_plus, \
+			Px_minus,Py_plus,Py_minus,feq,feq_bar,feq_plus,feq_minus,f0) \
+  schedule(static)
+  for (i=0; i<vres; i++){
+    x = x_grid[i];
     Vx = pqke->Vx/x;
     V0 = pqke->V0/x;
     V1 = pqke->V1*x;
-    Gamma = pqke->C_alpha*_G_F_*_G_F_*x*pow(T,5);
+    Gamma = Gamma_x[i]*T5;
     D = 0.5*Gamma;
     
     Pa_plus = y[pqke->index_Pa_plus+i];
@@ -1212,80 +2297,39 @@ int qke_derivs(double T,
     Py_plus = y[pqke->index_Py_plus+i];
     Py_minus = y[pqke->index_Py_minus+i];
   
-    //Regulator for sterile population:
-    rs = pqke->rs;
     //Distributions:
-    feq = 1.0/(1.0+exp(x-mu_div_T));
-    feq_bar = 1.0/(1.0+exp(x+mu_div_T));
+    feq = 1.0/(1.0+exp_xm[i]);
+    feq_bar = 1.0/(1.0+exp_xp[i]);
     feq_plus = feq + feq_bar;
     //Use an expansion for feq_minus since mu_div_T is very small.
-    feq_minus = exp(x)*2*mu_div_T/(1+exp(x-mu_div_T))/(1+exp(x+mu_div_T));
+    feq_minus = exp_x[i]*2*mu_div_T/(1+exp_xm[i])/(1+exp_xp[i]);
     //Use the unexpanded expression if the error grows too large.
-    if(exp(x+mu_div_T)/6*pow(mu_div_T,3)/(1+exp(x-mu_div_T))/
-       (1+exp(x+mu_div_T))/feq_minus > 1e-10)
+    if(exp_xp[i]/6*mu3/(1+exp_xm[i])/(1+exp_xp[i])/feq_minus > 1e-10)
       feq_minus = feq - feq_bar;
 
-    f0 = 1.0/(1.0+exp(x));
-
-    dudTdvdu = dudT_grid[i]*dvdu_grid[i];
-
-    //Define index steps for calculating derivatives:
-    if (i==0)
-      stencil_method = 12; //First order, forward   12
-    else if (i==pqke->vres-1)
-      stencil_method = 10; //First order, backwards 10
-    else if ((i==pqke->vres-2)||(i==1))
-      stencil_method = 21; //Second order, centered 21
-    else
-      stencil_method = 51; //Fifth order, centered  51
-    /* Do not use higher order than 51.
-    else if ((i==pqke->vres-3)||(i==2))
-      stencil_method = 51; //Fifth order, centered  51
-    else if ((i==pqke->vres-3)||(i==2))
-      stencil_method = 71; //Seventh order, centered  71
-    else
-      stencil_method = 91; //Ninth order, centered  91
-    */
-    idx = pqke->index_Pa_plus+i;
-    dy[idx] = -1.0/(H*T)*(Vx*Py_plus+Gamma*(2.0*feq_plus/f0-Pa_plus))+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
-    idx = pqke->index_Pa_minus+i;
-    dy[idx] = -1.0/(H*T)*(Vx*Py_minus+Gamma*(2.0*feq_minus/f0-Pa_minus))+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
-    idx = pqke->index_Ps_plus+i;
-    dy[idx] = 1.0/(H*T)*(Vx*Py_plus -
-			 rs*Gamma*(1.0/(4.0*I_f0)*I_rho_ss*feq + 
-				   1.0/(4.0*I_f0)*I_rho_ss_bar*feq_bar -
-				   0.5*f0*Ps_plus)) +
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
-    idx = pqke->index_Ps_minus+i;
-    dy[idx] = 1.0/(H*T)*(Vx*Py_minus -
-			 rs*Gamma*(1.0/(4.0*I_f0)*I_rho_ss*feq - 
-				   1.0/(4.0*I_f0)*I_rho_ss_bar*feq_bar -
-				   0.5*f0*Ps_minus)) +
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
-    idx = pqke->index_Px_plus+i;
-    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_plus+VL*Py_minus+D*Px_plus)+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
-    idx = pqke->index_Px_minus+i;
-    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_minus+VL*Py_plus+D*Px_minus)+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
-    idx = pqke->index_Py_plus+i;
-    dy[idx] = 1.0/(H*T)*
-      (-(V0+V1)*Px_plus-VL*Px_minus+0.5*Vx*(Pa_plus-Ps_plus)+D*Py_plus)+ 
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
-    idx = pqke->index_Py_minus+i;
-    dy[idx] = 1.0/(H*T)*
-      (-(V0+V1)*Px_minus-VL*Px_plus+0.5*Vx*(Pa_minus-Ps_minus)+D*Py_minus)+
-      dudTdvdu*drhodv(y, delta_v, idx, stencil_method);
-
+    f0 = f0_grid[i];
+
+    dy[pqke->index_Pa_plus+i] = -HTinv*(Vx*Py_plus+Gamma*(2.0*feq_plus/f0-Pa_plus));
+    dy[pqke->index_Pa_minus+i] = -HTinv*(Vx*Py_minus+Gamma*(2.0*feq_minus/f0-Pa_minus));
+    dy[pqke->index_Ps_plus+i] = HTinv*(Vx*Py_plus -
+				       rs*Gamma*(c_ss*feq + c_ss_bar*feq_bar -
+						 0.5*f0*Ps_plus));
+    dy[pqke->index_Ps_minus+i] = HTinv*(Vx*Py_minus -
+					rs*Gamma*(c_ss*feq - c_ss_bar*feq_bar -
+						  0.5*f0*Ps_minus));
+    dy[pqke->index_Px_plus+i] = HTinv*((V0+V1)*Py_plus+VL*Py_minus+D*Px_plus);
+    dy[pqke->index_Px_minus+i] = HTinv*((V0+V1)*Py_minus+VL*Py_plus+D*Px_minus);
+    dy[pqke->index_Py_plus+i] = HTinv*
+      (-(V0+V1)*Px_plus-VL*Px_minus+0.5*Vx*(Pa_plus-Ps_plus)+D*Py_plus);
+    dy[pqke->index_Py_minus+i] = HTinv*
+      (-(V0+V1)*Px_minus-VL*Px_plus+0.5*Vx*(Pa_minus-Ps_minus)+D*Py_minus);
+  }
+  /** Advection terms dudT*dvdu*drhodv through the banded operator: */
+#pragma omp for private(idx) schedule(static)
+  for (k=0; k<8; k++){
+    idx = index_field[k];
+    qke_advection_apply(&(pqke->adv), y+idx, dy_explicit+idx, dudTdvdu_grid);
+  }
   }
   return _SUCCESS_;
 }
@@ -1298,10 +2342,10 @@ int qke_derivs_fixed_grid(double T,
   qke_param *pqke=param;
   double L;
   int i;
-  double *x_grid=pqke->x_grid;
+  double *x_grid=pqke->ws.x_grid;
   double gentr,H;
   double Vx, VL;
-  double x, w_trapz;
+  double x;
   double Gamma, D, V0, V1, n_plus;
   double f0,  mu_div_T;
   double Pa_plus,Pa_minus,Ps_plus,Ps_minus;
@@ -1309,8 +2353,10 @@ int qke_derivs_fixed_grid(double T,
   double feq_plus, feq_minus, feq, feq_bar;
   double I_VxPy_minus, I_f0Pa_plus, I_rho_ss, I_rho_ss_bar, I_f0;
   double rs;
-  int idx;
+  int vres;
   double dLdT;
+  double *exp_x, *f0_grid, *Gamma_x, *exp_xm, *exp_xp;
+  double T5, mu3, HTinv, c_ss, c_ss_bar;
  
   L = y[pqke->index_L]*_L_SCALE_;
 
@@ -1356,14 +2402,38 @@ int qke_derivs_fixed_grid(double T,
   mu_div_T = -2*_PI_/sqrt(3.0)*
     sinh(1.0/3.0*asinh(-18.0*sqrt(3.0)*_ZETA3_*L/pow(_PI_,3)));
   
-  /** All quantities defined on the grid: */
-  for (i=0; i<pqke->vres; i++){
+  /** All quantities defined on the grid. The grid never changes, so the
+      terms that only depend on x are taken from the grid table: */
+  vres = pqke->vres;
+  qke_grid_table(pqke);
+  exp_x = pqke->ws.grid_table;
+  f0_grid = exp_x+vres;
+  Gamma_x = f0_grid+vres;
+  exp_xm = pqke->ws.rhs_work;
+  exp_xp = exp_xm+vres;
+  T5 = pow(T,5);
+  mu3 = pow(mu_div_T,3);
+  HTinv = 1.0/(H*T);
+  rs = pqke->rs;
+  c_ss = 1.0/(4.0*I_f0)*I_rho_ss;
+  c_ss_bar = 1.0/(4.0*I_f0)*I_rho_ss_bar;
+#pragma omp parallel num_threads(pqke->rhs_threads) if(pqke->rhs_threads>1)
+  {
+#pragma omp for simd schedule(static)
+  for (i=0; i<vres; i++){
+    exp_xm[i] = exp(x_grid[i]-mu_div_T);
+    exp_xp[i] = exp(x_grid[i]+mu_div_T);
+  }
+#pragma omp for private(x,Vx,V0,V1,Gamma,D,Pa_plus,Pa_minus,Ps_plus,Ps_minus,Px_plus, \
+			Px_minus,Py_plus,Py_minus,feq,feq_bar,feq_plus,feq_minus,f0) \
+  schedule(static)
+  for (i=0; i<vres; i++){
     x = x_grid[i];
     Vx = pqke->Vx/x;
     V0 = pqke->V0/x;
     V1 = pqke->V1*x;
   
-    Gamma = pqke->C_alpha*_G_F_*_G_F_*x*pow(T,5);
+    Gamma = Gamma_x[i]*T5;
     D = 0.5*Gamma;
     
     Pa_plus = y[pqke->index_Pa_plus+i];
@@ -1375,54 +2445,138 @@ int qke_derivs_fixed_grid(double T,
     Py_plus = y[pqke->index_Py_plus+i];
     Py_minus = y[pqke->index_Py_minus+i];
    
-    //Regulator for sterile population:
-    rs = pqke->rs;
     //Distributions:
-    feq = 1.0/(1.0+exp(x-mu_div_T));
-    feq_bar = 1.0/(1.0+exp(x+mu_div_T));
-    feq_plus = feq + feq_bar;
+    feq = 1.0/(1.0+exp_xm[i]);
+    feq_bar = 1.0/(1.0+exp_xp[i]);
     feq_plus = feq + feq_bar;
     //Use an expansion for feq_minus since mu_div_T is very small.
-    feq_minus = exp(x)*2*mu_div_T/(1+exp(x-mu_div_T))/(1+exp(x+mu_div_T));
+    feq_minus = exp_x[i]*2*mu_div_T/(1+exp_xm[i])/(1+exp_xp[i]);
     //Use the unexpanded expression if the error grows too large.
-    if(exp(x+mu_div_T)/6*pow(mu_div_T,3)/(1+exp(x-mu_div_T))/
-       (1+exp(x+mu_div_T))/feq_minus > 1e-10)
+    if(exp_xp[i]/6*mu3/(1+exp_xm[i])/(1+exp_xp[i])/feq_minus > 1e-10)
       feq_minus = feq - feq_bar;
 
-    f0 = 1.0/(1.0+exp(x));
+    f0 = f0_grid[i];
     
-    idx = pqke->index_Pa_plus+i;
-    dy[idx] = -1.0/(H*T)*(Vx*Py_plus+Gamma*(2.0*feq_plus/f0-Pa_plus));
-
-    idx = pqke->index_Pa_minus+i;
-    dy[idx] = -1.0/(H*T)*(Vx*Py_minus+Gamma*(2.0*feq_minus/f0-Pa_minus));
+    dy[pqke->index_Pa_plus+i] = -HTinv*(Vx*Py_plus+Gamma*(2.0*feq_plus/f0-Pa_plus));
+    dy[pqke->index_Pa_minus+i] = -HTinv*(Vx*Py_minus+Gamma*(2.0*feq_minus/f0-Pa_minus));
+    dy[pqke->index_Ps_plus+i] = HTinv*(Vx*Py_plus -
+				       rs*Gamma*(c_ss*feq + c_ss_bar*feq_bar -
+						 0.5*f0*Ps_plus));
+    dy[pqke->index_Ps_minus+i] = HTinv*(Vx*Py_minus -
+					rs*Gamma*(c_ss*feq - c_ss_bar*feq_bar -
+						  0.5*f0*Ps_minus));
+    dy[pqke->index_Px_plus+i] = HTinv*((V0+V1)*Py_plus+VL*Py_minus+D*Px_plus);
+    dy[pqke->index_Px_minus+i] = HTinv*((V0+V1)*Py_minus+VL*Py_plus+D*Px_minus);
+    dy[pqke->index_Py_plus+i] = HTinv*
+      (-(V0+V1)*Px_plus-VL*Px_minus+0.5*Vx*(Pa_plus-Ps_plus)+D*Py_plus);
+    dy[pqke->index_Py_minus+i] = HTinv*
+      (-(V0+V1)*Px_minus-VL*Px_plus+0.5*Vx*(Pa_minus-Ps_minus)+D*Py_minus);
+  }
+  }
+  return _SUCCESS_;
+}
 
-    idx = pqke->index_Ps_plus+i;
-    dy[idx] = 1.0/(H*T)*(Vx*Py_plus -
-			 rs*Gamma*(1.0/(4.0*I_f0)*I_rho_ss*feq + 
-				   1.0/(4.0*I_f0)*I_rho_ss_bar*feq_bar -
-				   0.5*f0*Ps_plus));
+int qke_advection_init(qke_advection *adv, 
+		       int vres, 
+		       int stencil, 
+		       double delta_v){
+  /** Sets up the banded advection operator on vres bins with the interior
+      stencil 21, 51 or 71 of drhodv. The band values are taken from
+      drhodv_stencil, so qke_advection_jacobian and qke_advection_apply
+      agree with drhodv row by row. */
+  int i, k, n, offset[7];
+  double weight[7];
+  if ((stencil!=21)&&(stencil!=51)&&(stencil!=71))
+    return _FAILURE_;
+  adv->vres = vres;
+  adv->stencil = stencil;
+  adv->nbnd = (stencil-1)/20;
+  adv->nbands = 2*adv->nbnd+1;
+  adv->delta_v = delta_v;
+  adv->val = calloc(adv->nbands*vres,sizeof(double));
+  if (vres < 2) return _SUCCESS_;
+  for (i=0; i<vres; i++){
+    n = drhodv_stencil(qke_advection_row_stencil(adv,i),offset,weight);
+    for (k=0; k<n; k++)
+      adv->val[(offset[k]+adv->nbnd)*vres+i] += weight[k];
+  }
+  return _SUCCESS_;
+}
 
-    idx = pqke->index_Ps_minus+i;
-    dy[idx] = 1.0/(H*T)*(Vx*Py_minus -
-			 rs*Gamma*(1.0/(4.0*I_f0)*I_rho_ss*feq - 
-				   1.0/(4.0*I_f0)*I_rho_ss_bar*feq_bar -
-				   0.5*f0*Ps_minus));
+int qke_advection_free(qke_advection *adv){
+  free(adv->val);
+  return _SUCCESS_;
+}
 
-    idx = pqke->index_Px_plus+i;
-    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_plus+VL*Py_minus+D*Px_plus);
+int qke_advection_row_stencil(qke_advection *adv, int i){
+  /** Stencil of drhodv used in row i: first order at the end points and
+      the widest centred stencil that fits next to them. */
+  int d = min(i,adv->vres-1-i);
+  if (i==0)
+    return 12;
+  else if (i==adv->vres-1)
+    return 10;
+  else if (d >= adv->nbnd)
+    return adv->stencil;
+  else if (d == 1)
+    return 21;
+  else
+    return 51;
+}
 
-    idx = pqke->index_Px_minus+i;
-    dy[idx] = 1.0/(H*T)*((V0+V1)*Py_minus+VL*Py_plus+D*Px_minus);
+int qke_advection_apply(qke_advection *adv, 
+			double *rho, 
+			double *drho, 
+			double *dudTdvdu){
+  /** Adds dudTdvdu*drhodv to drho for one field rho[0..vres-1]. The
+      boundary rows go through drhodv, the interior rows through one
+      unrolled loop per stencil with the same arithmetic as drhodv. */
+  int i, vres=adv->vres, nbnd=adv->nbnd;
+  int imin=min(nbnd,vres), imax=max(nbnd,vres-nbnd);
+  double delta_v=adv->delta_v;
+  if (vres < 2) return _SUCCESS_;
+  for (i=0; i<imin; i++)
+    drho[i] += dudTdvdu[i]*
+      drhodv(rho,delta_v,i,qke_advection_row_stencil(adv,i));
+  for (i=imax; i<vres; i++)
+    drho[i] += dudTdvdu[i]*
+      drhodv(rho,delta_v,i,qke_advection_row_stencil(adv,i));
+  switch (adv->stencil){
+  case 21:
+#pragma omp simd
+    for (i=nbnd; i<vres-nbnd; i++)
+      drho[i] += dudTdvdu[i]*((rho[i+1]-rho[i-1])/(2.0*delta_v));
+    break;
+  case 51:
+#pragma omp simd
+    for (i=nbnd; i<vres-nbnd; i++)
+      drho[i] += dudTdvdu[i]*((-rho[i+2]+8.0*rho[i+1]
+			       -8.0*rho[i-1]+rho[i-2])/(12.0*delta_v));
+    break;
+  default:
+#pragma omp simd
+    for (i=nbnd; i<vres-nbnd; i++)
+      drho[i] += dudTdvdu[i]*((rho[i+3]-9.0*rho[i+2]+45.0*rho[i+1]
+			       -45.0*rho[i-1]+9.0*rho[i-2]-rho[i-3])/(60.0*delta_v));
+  }
+  return _SUCCESS_;
+}
 
-    idx = pqke->index_Py_plus+i;
-    dy[idx] = 1.0/(H*T)*
-      (-(V0+V1)*Px_plus-VL*Px_minus+0.5*Vx*(Pa_plus-Ps_plus)+D*Py_plus);
-    
-    idx = pqke->index_Py_minus+i;
-    dy[idx] = 1.0/(H*T)*
-      (-(V0+V1)*Px_minus-VL*Px_plus+0.5*Vx*(Pa_minus-Ps_minus)+D*Py_minus);
-    
+int qke_advection_jacobian(qke_advection *adv, 
+			   MultiMatrix *J, 
+			   int index, 
+			   double *dudTdvdu){
+  /** Adds the operator scaled by dudTdvdu to the diagonal block of J that
+      starts at (index,index). */
+  int b, i, off, vres=adv->vres;
+  double w;
+  for (b=0; b<adv->nbands; b++){
+    off = b-adv->nbnd;
+    for (i=max(0,-off); i<min(vres,vres-off); i++){
+      w = adv->val[b*vres+i];
+      if (w != 0.0)
+	AddToMultiMatrixEntry(J,index+i,index+i+off,dudTdvdu[i]*w/adv->delta_v);
+    }
   }
   return _SUCCESS_;
 }
@@ -1449,6 +2603,298 @@ double drhodv(double *rho, double delta_v, int index, int stencil_method){
 }
 
 
+int drhodv_stencil(int stencil_method, int *offset, double *weight){
+  /** Offsets and weights (in units of 1/delta_v) of the finite 
+      difference used by drhodv. Returns the number of points. */
+  int n;
+  if (stencil_method == 12){
+    n = 2;
+    offset[0] = 0; weight[0] = -1.0;
+    offset[1] = 1; weight[1] = 1.0;
+  }
+  else if (stencil_method == 10){
+    n = 2;
+    offset[0] = -1; weight[0] = -1.0;
+    offset[1] = 0; weight[1] = 1.0;
+  }
+  else if (stencil_method == 21){
+    n = 2;
+    offset[0] = -1; weight[0] = -0.5;
+    offset[1] = 1; weight[1] = 0.5;
+  }
+  else if (stencil_method == 51){
+    n = 4;
+    offset[0] = -2; weight[0] = 1.0/12.0;
+    offset[1] = -1; weight[1] = -8.0/12.0;
+    offset[2] = 1; weight[2] = 8.0/12.0;
+    offset[3] = 2; weight[3] = -1.0/12.0;
+  }
+  else if (stencil_method == 71){
+    n = 6;
+    offset[0] = -3; weight[0] = -1.0/60.0;
+    offset[1] = -2; weight[1] = 9.0/60.0;
+    offset[2] = -1; weight[2] = -45.0/60.0;
+    offset[3] = 1; weight[3] = 45.0/60.0;
+    offset[4] = 2; weight[4] = -9.0/60.0;
+    offset[5] = 3; weight[5] = 1.0/60.0;
+  }
+  else{
+    /** Same points as drhodv, so the last term shares offset +4 with
+	the first one: */
+    n = 7;
+    offset[0] = 4; weight[0] = 0.0;
+    offset[1] = 3; weight[1] = 32.0/840.0;
+    offset[2] = 2; weight[2] = -168.0/840.0;
+    offset[3] = 1; weight[3] = 672.0/840.0;
+    offset[4] = -1; weight[4] = -672.0/840.0;
+    offset[5] = -2; weight[5] = 168.0/840.0;
+    offset[6] = -3; weight[6] = -32.0/840.0;
+  }
+  return n;
+}
+
+static int qke_jacobian_terms(double T, 
+			      double *y, 
+			      MultiMatrix *J,
+			      int *nfe,
+			      qke_param *pqke,
+			      int implicit,
+			      ErrorMsg error_message);
+
+int qke_jacobian(double T, 
+		 double *y, 
+		 double *fval,
+		 MultiMatrix *J,
+		 int *nfe,
+		 void *param,
+		 ErrorMsg error_message){
+  /** fval is part of the jacobian callback, the analytic Jacobian does
+      not need it. */
+  (void) fval;
+  return qke_jacobian_terms(T,y,J,nfe,param,_FALSE_,error_message);
+}
+
+int qke_jacobian_implicit(double T, 
+			  double *y, 
+			  double *fval,
+			  MultiMatrix *J,
+			  int *nfe,
+			  void *param,
+			  ErrorMsg error_message){
+  /** Jacobian of f_implicit of qke_derivs_split, for the IMEX mode. */
+  (void) fval;
+  return qke_jacobian_terms(T,y,J,nfe,param,_TRUE_,error_message);
+}
+
+static int qke_jacobian_terms(double T, 
+			      double *y, 
+			      MultiMatrix *J,
+			      int *nfe,
+			      qke_param *pqke,
+			      int implicit,
+			      ErrorMsg error_message){
+  /** Analytic Jacobian of qke_derivs (or qke_derivs_fixed_grid if 
+      pqke->fixed_grid is set) on the pattern of J. The local terms and
+      the drhodv stencils are differentiated exactly. As in the pattern
+      set up by init_qke_param, the dependence of the grid velocity 
+      dudT*dvdu on dLdT is neglected. The L-column, where L enters through
+      the grid, VL and the chemical potential, is found by one forward 
+      difference, so a call costs two evaluations of derivs instead of 
+      one per column group. If implicit, the advection terms are left out
+      and the L-column is that of f_implicit of qke_derivs_split. */
+  int (*derivs)(double, double *, double *, void *, ErrorMsg);
+  size_t neq=pqke->neq;
+  int vres=pqke->vres;
+  int i, k, m, row;
+  int iL=pqke->index_L;
+  int iPa_plus=pqke->index_Pa_plus, iPa_minus=pqke->index_Pa_minus;
+  int iPs_plus=pqke->index_Ps_plus, iPs_minus=pqke->index_Ps_minus;
+  int iPx_plus=pqke->index_Px_plus, iPx_minus=pqke->index_Px_minus;
+  int iPy_plus=pqke->index_Py_plus, iPy_minus=pqke->index_Py_minus;
+  int index_list[8]={iPa_plus, iPa_minus, iPs_plus, iPs_minus,
+		     iPx_plus, iPx_minus, iPy_plus, iPy_minus};
+  double *ydel, *f0vec, *fdel, *fexp=NULL, *W, *dudTdvdu_grid=pqke->ws.rhs_work+2*vres;
+  double L, gentr, H, inv_HT, mu_div_T, del, dV1dn;
+  double x, Vx, V0, V1, VL, Gamma, D, f0, feq, feq_bar, rs, dV1;
+  double I_VxPy_minus, I_f0Pa_plus, I_rho_ss, I_rho_ss_bar, I_f0, w_trapz;
+  
+  if (pqke->fixed_grid == 0)
+    derivs = qke_derivs;
+  else
+    derivs = qke_derivs_fixed_grid;
+
+  lasagna_alloc(ydel,sizeof(double)*neq,error_message);
+  lasagna_alloc(f0vec,sizeof(double)*neq,error_message);
+  lasagna_alloc(fdel,sizeof(double)*neq,error_message);
+  lasagna_alloc(W,sizeof(double)*vres,error_message);
+  if (implicit == _TRUE_)
+    lasagna_alloc(fexp,sizeof(double)*neq,error_message);
+
+  //Make sure that grid and potentials in pqke belong to (T,y):
+  if (implicit == _TRUE_){
+    lasagna_call(qke_derivs_split(T,y,f0vec,fexp,pqke,error_message),
+		 error_message,error_message);
+  }
+  else{
+    lasagna_call(derivs(T,y,f0vec,pqke,error_message),
+		 error_message,error_message);
+  }
+  *nfe += 1;
+
+  L = y[iL]*_L_SCALE_;
+  VL = pqke->VL;
+  rs = pqke->rs;
+  background_getdof(T,NULL,&gentr,&(pqke->pbs));
+  H = sqrt(8.0*pow(_PI_,3)*gentr/90.0)*T*T/_M_PL_;
+  inv_HT = 1.0/(H*T);
+  mu_div_T = -2*_PI_/sqrt(3.0)*
+    sinh(1.0/3.0*asinh(-18.0*sqrt(3.0)*_ZETA3_*L/pow(_PI_,3)));
+  lasagna_call(get_integrated_quantities(y,
+					 pqke,
+					 &I_VxPy_minus,
+					 &I_f0Pa_plus,
+					 &I_rho_ss,
+					 &I_rho_ss_bar,
+					 &I_f0,
+					 error_message),
+	       error_message,error_message);
+  //Trapezoidal weights times x^2 f0, as in get_integrated_quantities:
+  for (k=0; k<vres; k++){
+    if (k==0)
+      w_trapz = 0.5*(pqke->ws.x_grid[k+1]-pqke->ws.x_grid[k]);
+    else if (k==vres-1)
+      w_trapz = 0.5*(pqke->ws.x_grid[k]-pqke->ws.x_grid[k-1]);
+    else
+      w_trapz = 0.5*(pqke->ws.x_grid[k+1]-pqke->ws.x_grid[k-1]);
+    x = pqke->ws.x_grid[k];
+    W[k] = w_trapz*x*x/(1.0+exp(x));
+  }
+  //V1 is proportional to n_plus*g_alpha, and d(n_plus*g_alpha)/dn_plus = 1:
+  dV1dn = -7.0*_PI_*_PI_/(45.0*sqrt(2.0))*_G_F_/_M_Z_/_M_Z_*pow(T,5);
+
+  lasagna_call(ZeroMultiMatrix(J),error_message,error_message);
+
+  //L row: dLdT = -1/(8HTzeta3)*I_VxPy_minus
+  for (k=0; k<vres; k++)
+    AddToMultiMatrixEntry(J,iL,iPy_minus+k,
+			  -inv_HT/(8.0*_ZETA3_)*W[k]*pqke->Vx/pqke->ws.x_grid[k]/_L_SCALE_);
+
+  for (i=0; i<vres; i++){
+    x = pqke->ws.x_grid[i];
+    Vx = pqke->Vx/x;
+    V0 = pqke->V0/x;
+    V1 = pqke->V1*x;
+    Gamma = pqke->C_alpha*_G_F_*_G_F_*x*pow(T,5);
+    D = 0.5*Gamma;
+    feq = 1.0/(1.0+exp(x-mu_div_T));
+    feq_bar = 1.0/(1.0+exp(x+mu_div_T));
+    f0 = 1.0/(1.0+exp(x));
+
+    row = iPa_plus+i;
+    AddToMultiMatrixEntry(J,row,row,Gamma*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPy_plus+i,-Vx*inv_HT);
+
+    row = iPa_minus+i;
+    AddToMultiMatrixEntry(J,row,row,Gamma*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPy_minus+i,-Vx*inv_HT);
+
+    row = iPs_plus+i;
+    AddToMultiMatrixEntry(J,row,iPy_plus+i,Vx*inv_HT);
+    AddToMultiMatrixEntry(J,row,row,0.5*rs*Gamma*f0*inv_HT);
+    if (rs != 0.0){
+      for (k=0; k<vres; k++){
+	AddToMultiMatrixEntry(J,row,iPs_plus+k,
+			      -rs*Gamma*inv_HT*W[k]/(4.0*I_f0)*(feq+feq_bar));
+	AddToMultiMatrixEntry(J,row,iPs_minus+k,
+			      -rs*Gamma*inv_HT*W[k]/(4.0*I_f0)*(feq-feq_bar));
+      }
+    }
+
+    row = iPs_minus+i;
+    AddToMultiMatrixEntry(J,row,iPy_minus+i,Vx*inv_HT);
+    AddToMultiMatrixEntry(J,row,row,0.5*rs*Gamma*f0*inv_HT);
+    if (rs != 0.0){
+      for (k=0; k<vres; k++){
+	AddToMultiMatrixEntry(J,row,iPs_plus+k,
+			      -rs*Gamma*inv_HT*W[k]/(4.0*I_f0)*(feq-feq_bar));
+	AddToMultiMatrixEntry(J,row,iPs_minus+k,
+			      -rs*Gamma*inv_HT*W[k]/(4.0*I_f0)*(feq+feq_bar));
+      }
+    }
+
+    row = iPx_plus+i;
+    AddToMultiMatrixEntry(J,row,row,D*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPy_plus+i,(V0+V1)*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPy_minus+i,VL*inv_HT);
+
+    row = iPx_minus+i;
+    AddToMultiMatrixEntry(J,row,row,D*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPy_minus+i,(V0+V1)*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPy_plus+i,VL*inv_HT);
+
+    row = iPy_plus+i;
+    AddToMultiMatrixEntry(J,row,row,D*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPx_plus+i,-(V0+V1)*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPx_minus+i,-VL*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPa_plus+i,0.5*Vx*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPs_plus+i,-0.5*Vx*inv_HT);
+
+    row = iPy_minus+i;
+    AddToMultiMatrixEntry(J,row,row,D*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPx_minus+i,-(V0+V1)*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPx_plus+i,-VL*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPa_minus+i,0.5*Vx*inv_HT);
+    AddToMultiMatrixEntry(J,row,iPs_minus+i,-0.5*Vx*inv_HT);
+
+    if (pqke->fixed_grid == 0){
+      dudTdvdu_grid[i] = pqke->ws.dudT_grid[i]*pqke->ws.dvdu_grid[i];
+    }
+    else{
+      //V1 depends on all of Pa_plus through n_plus:
+      for (k=0; k<vres; k++){
+	dV1 = x*dV1dn*W[k]/(3.0*_ZETA3_)*inv_HT;
+	AddToMultiMatrixEntry(J,iPx_plus+i,iPa_plus+k,dV1*y[iPy_plus+i]);
+	AddToMultiMatrixEntry(J,iPx_minus+i,iPa_plus+k,dV1*y[iPy_minus+i]);
+	AddToMultiMatrixEntry(J,iPy_plus+i,iPa_plus+k,-dV1*y[iPx_plus+i]);
+	AddToMultiMatrixEntry(J,iPy_minus+i,iPa_plus+k,-dV1*y[iPx_minus+i]);
+      }
+    }
+  }
+
+  if ((pqke->fixed_grid == 0)&&(implicit == _FALSE_)){
+    //Advection term dudT*dvdu*drhodv, same operator as qke_derivs:
+    for (m=0; m<8; m++)
+      qke_advection_jacobian(&(pqke->adv),J,index_list[m],dudTdvdu_grid);
+  }
+
+  //The L-column by a forward difference pointing into the region:
+  memcpy(ydel,y,sizeof(double)*neq);
+  del = sqrt(DBL_EPSILON)*max(fabs(y[iL]),1.0);
+  if (f0vec[iL] < 0.0)
+    del = -del;
+  ydel[iL] += del;
+  del = ydel[iL]-y[iL];
+  if (implicit == _TRUE_){
+    lasagna_call(qke_derivs_split(T,ydel,fdel,fexp,pqke,error_message),
+		 error_message,error_message);
+  }
+  else{
+    lasagna_call(derivs(T,ydel,fdel,pqke,error_message),
+		 error_message,error_message);
+  }
+  *nfe += 1;
+  for (row=0; row<neq; row++)
+    AddToMultiMatrixEntry(J,row,iL,(fdel[row]-f0vec[row])/del);
+
+  free(ydel);
+  free(f0vec);
+  free(fdel);
+  free(fexp);
+  free(W);
+  return _SUCCESS_;
+}
+
+
 int qke_derivs_test_partial(double T, 
 	       double *y, 
 	       double *dy, 
@@ -1486,11 +2932,11 @@ int qke_derivs_test_partial(double T,
 	       error_message,error_message);
 
   /** All quantities defined on the grid: */
-  delta_v = pqke->v_grid[1]-pqke->v_grid[0];
+  delta_v = pqke->ws.v_grid[1]-pqke->ws.v_grid[0];
   fprintf(stderr,"%.16e ",T);
   for (i=0; i<pqke->vres; i++){
-    x = pqke->x_grid[i];
-    dudTdvdu = pqke->dudT_grid[i]*pqke->dvdu_grid[i];
+    x = pqke->ws.x_grid[i];
+    dudTdvdu = pqke->ws.dudT_grid[i]*pqke->ws.dvdu_grid[i];
 
     //Define index steps for calculating derivatives:
     if (i==0)
@@ -1503,7 +2949,7 @@ int qke_derivs_test_partial(double T,
       stencil_method = 51; //Fifth order, centered  51
 
     dy[i] = dudTdvdu*drhodv(y, delta_v, i, stencil_method);
-    fprintf(stderr,"%.16e %.16e %.16e ",-dudTdvdu,x,pqke->dudT_grid[i]);
+    fprintf(stderr,"%.16e %.16e %.16e ",-dudTdvdu,x,pqke->ws.dudT_grid[i]);
     //fprintf(stderr,"%.16e ",drhodv(y, delta_v, i, stencil_method));
   }
   fprintf(stderr,"\n");
@@ -1532,7 +2978,7 @@ int qke_test_partial_output(double T,
   
   fprintf(output_file,"%.16e %.16e ",T*1e3, L);
   for (i=0; i<pqke->vres; i++){
-    fprintf(output_file,"%.16e %.16e ",pqke->x_grid[i],y[i]);
+    fprintf(output_file,"%.16e %.16e ",pqke->ws.x_grid[i],y[i]);
   }
   fprintf(output_file,"\n");
   fclose(output_file);
@@ -0,0 +1,701 @@
+/** @file sweep.c
+ * Runs of a parameter sweep, done by the workers of lasagna and
+ * lasagna_mpi.
+ */
+
+#include "sweep.h"
+#include <time.h>
+int lasagna_config_init(int argc,
+			char **argv,
+			struct lasagna_config *config,
+			ErrorMsg error_message){
+  /** Reads the parameter file in argv[1], see input_sweep_init. */
+  lasagna_call(input_sweep_init(argc, argv, &(config->fc), &(config->sweep),
+				&(config->background), &(config->threads), &(config->nproc),
+				&(config->pin), error_message),
+	       error_message, error_message);
+  return _SUCCESS_;
+}
+
+int lasagna_config_free(struct lasagna_config *config){
+  parser_sweep_free(&(config->sweep));
+  parser_free(&(config->fc));
+  background_free_dof(&(config->background));
+  return _SUCCESS_;
+}
+
+int lasagna_worker_init(struct lasagna_worker *worker){
+  /** A worker with no context, nothing chosen and nothing shared with
+      other workers (all pointers NULL). The callers set latest,
+      linalg_shared and budget afterwards if the workers of a sweep share
+      them. */
+  memset(worker,0,sizeof(struct lasagna_worker));
+  worker->chosen = _FALSE_;
+  return _SUCCESS_;
+}
+
+int lasagna_worker_context(struct lasagna_worker *worker,
+			   qke_param *pqke,
+			   ErrorMsg error_message){
+  /** Makes the ndf15 context of the worker fit the system in pqke. It is
+      kept while the pattern stays the same, and the context then points
+      to the copy of the pattern and to the options in the worker. */
+  size_t neq=pqke->neq;
+  int nnz=pqke->Ap[neq];
+
+  if ((worker->context != NULL)&&
+      ((worker->neq != neq)||(worker->Ap[neq] != nnz)||
+       (memcmp(worker->Ap,pqke->Ap,sizeof(int)*(neq+1)) != 0)||
+       (memcmp(worker->Ai,pqke->Ai,sizeof(int)*nnz) != 0)))
+    lasagna_call(lasagna_worker_free(worker, error_message),
+		 error_message, error_message);
+  if (worker->context == NULL){
+    worker->neq = neq;
+    lasagna_alloc(worker->Ap,sizeof(int)*(neq+1),error_message);
+    lasagna_alloc(worker->Ai,sizeof(int)*nnz,error_message);
+    memcpy(worker->Ap,pqke->Ap,sizeof(int)*(neq+1));
+    memcpy(worker->Ai,pqke->Ai,sizeof(int)*nnz);
+    worker->options.Ap = worker->Ap;
+    worker->options.Ai = worker->Ai;
+    lasagna_call(ndf15_context_create(&(worker->context), neq, &(worker->options),
+				      error_message),
+		 error_message, error_message);
+  }
+  worker->options.Ap = worker->Ap;
+  worker->options.Ai = worker->Ai;
+  return _SUCCESS_;
+}
+
+int lasagna_evolve_adaptive(struct lasagna_worker *worker,
+			    qke_param *pqke,
+			    double **y,
+			    int **interp_idx,
+			    ErrorMsg error_message){
+  /** ndf15 on the adaptive momentum grid of pqke. The evolver stops where
+      qke_grid_check asks for another grid level, the state is moved to it
+      by qke_regrid, and the evolver goes on from there with the output
+      points left and a context for the new pattern, so the pattern and the
+      sparse analysis are only rebuilt when the grid changes. Stats[0] is
+      the number of steps of all the pieces. */
+  EvolverOptions *options=&(worker->options);
+  double T_start=pqke->T_initial, tdir=(pqke->T_final > pqke->T_initial ? 1.0 : -1.0);
+  int next=0, steps=0, func_return;
+
+  while (_TRUE_){
+    options->t_vec = pqke->Tvec+next;
+    options->tres = pqke->Tres-next;
+    pqke->T_stop = pqke->T_final;
+    func_return = evolver_ndf15_context(qke_derivs,
+					pqke,
+					T_start,
+					pqke->T_final,
+					*y,
+					pqke->neq,
+					options,
+					worker->context,
+					error_message);
+    steps += options->Stats[0];
+    if ((func_return == _FAILURE_)||(pqke->grid_pending < 0))
+      break;
+    //The output points up to the stop have been written:
+    T_start = pqke->T_stop;
+    for (next=0; (next<pqke->Tres)&&((pqke->Tvec[next]-T_start)*tdir <= 0.0); next++);
+    lasagna_call(qke_regrid(pqke, pqke->grid_pending, y, error_message),
+		 error_message, error_message);
+    pqke->grid_pending = -1;
+    free(*interp_idx);
+    lasagna_alloc(*interp_idx, sizeof(int)*pqke->neq, error_message);
+    qke_output_indices(pqke, *interp_idx);
+    options->used_in_output = *interp_idx;
+    lasagna_call(lasagna_worker_context(worker, pqke, error_message),
+		 error_message, error_message);
+  }
+  options->Stats[0] = steps;
+  return func_return;
+}
+
+int lasagna_evolve_switch(struct lasagna_worker *worker,
+			  qke_param *pqke,
+			  int (*generic_evolver)(),
+			  double *y,
+			  ErrorMsg error_message){
+  /** The run on the moving grid, until qke_switch_check finds that the
+      resonances have left it. The state is moved to the fixed grid there by
+      qke_switch_grid, and the evolver goes on with qke_derivs_fixed_grid,
+      the output points left and the new pattern. ndf15 is called with the
+      context of the worker, the other evolvers with generic_evolver.
+      Stats[0] is the number of steps of both pieces. */
+  EvolverOptions *options=&(worker->options);
+  double T_start=pqke->T_initial, tdir=(pqke->T_final > pqke->T_initial ? 1.0 : -1.0);
+  int next=0, steps=0, func_return;
+  int (*derivs)(double, double *, double *, void *, ErrorMsg);
+
+  while (_TRUE_){
+    options->t_vec = pqke->Tvec+next;
+    options->tres = pqke->Tres-next;
+    pqke->T_stop = pqke->T_final;
+    derivs = (pqke->fixed_grid == 0 ? qke_derivs : qke_derivs_fixed_grid);
+    if (pqke->evolver == 1)
+      func_return = evolver_ndf15_context(derivs,
+					  pqke,
+					  T_start,
+					  pqke->T_final,
+					  y,
+					  pqke->neq,
+					  options,
+					  worker->context,
+					  error_message);
+    else
+      func_return = generic_evolver(derivs,
+				    pqke,
+				    T_start,
+				    pqke->T_final,
+				    y,
+				    pqke->neq,
+				    options,
+				    error_message);
+    steps += options->Stats[0];
+    if ((func_return == _FAILURE_)||(pqke->switch_pending == _FALSE_))
+      break;
+    //The output points up to the stop have been written:
+    T_start = pqke->T_stop;
+    for (next=0; (next<pqke->Tres)&&((pqke->Tvec[next]-T_start)*tdir <= 0.0); next++);
+    lasagna_call(qke_switch_grid(pqke, T_start, y, error_message),
+		 error_message, error_message);
+    options->Ap = pqke->Ap;
+    options->Ai = pqke->Ai;
+    options->derivs_batch = NULL;
+    if (pqke->evolver == 1){
+      lasagna_call(lasagna_worker_context(worker, pqke, error_message),
+		   error_message, error_message);
+    }
+  }
+  options->Stats[0] = steps;
+  return func_return;
+}
+
+int lasagna_stop_at_budget(double t,
+			   double *y,
+			   double *dy,
+			   void *param,
+			   ErrorMsg error_message){
+  /** qke_stop_at_budget for a run with a share of the cores of the sweep.
+      Between the steps, the run takes cores left by the runs that have
+      finished, for its derivs calls. */
+  qke_param *pqke=param;
+  struct lasagna_share *share=pqke->share;
+
+  if (lasagna_budget_grow(share) == _TRUE_)
+    pqke->rhs_threads = share->rhs_threads;
+  return qke_stop_at_budget(t, y, dy, param, error_message);
+}
+
+int lasagna_worker_free(struct lasagna_worker *worker,
+			ErrorMsg error_message){
+  if (worker->context != NULL){
+    lasagna_call(ndf15_context_destroy(worker->context, error_message),
+		 error_message, error_message);
+    free(worker->Ap);
+    free(worker->Ai);
+  }
+  worker->context = NULL;
+  return _SUCCESS_;
+}
+
+int lasagna_sampler_init(struct sweep_content *psw,
+			 struct lasagna_sampler *sampler,
+			 ErrorMsg error_message){
+  /** Queues the coarse grid, every 2^refine'th value of each sweep. Without
+      sweep_refine, this is all runs of the sweep. */
+  int run, d, stride, step=1<<psw->refine;
+
+  lasagna_alloc(sampler->outcome,sizeof(int)*psw->runs,error_message);
+  lasagna_alloc(sampler->runs,sizeof(int)*psw->runs,error_message);
+  sampler->level = 0;
+  sampler->count = 0;
+  for (run=0; run<psw->runs; run++){
+    sampler->outcome[run] = _OUTCOME_NONE_;
+    for (d=0, stride=1; d<psw->dimensions; d++){
+      if (((run/stride)%psw->size[d])%step != 0)
+	break;
+      stride *= psw->size[d];
+    }
+    if (d == psw->dimensions){
+      sampler->outcome[run] = _OUTCOME_QUEUED_;
+      sampler->runs[sampler->count++] = run;
+    }
+  }
+  return _SUCCESS_;
+}
+
+int lasagna_sampler_result(struct lasagna_sampler *sampler,
+			   int run,
+			   int status,
+			   int budget_exceeded,
+			   int diverged,
+			   double L_end){
+  /** The outcome of a run is the sign of L_end and whether qke_stop_at_divL
+      stopped it. Failed runs, and runs stopped by the time budget, have an
+      outcome of their own. */
+  if ((status == _FAILURE_)||(budget_exceeded == _TRUE_))
+    sampler->outcome[run] = _OUTCOME_FAILED_;
+  else
+    sampler->outcome[run] = _OUTCOME_FAILED_+1+(L_end < 0.0 ? 1 : 0)+
+      (diverged == _TRUE_ ? 2 : 0);
+  return _SUCCESS_;
+}
+
+static int lasagna_sampler_disagree(struct sweep_content *psw,
+				    struct lasagna_sampler *sampler,
+				    int *lower,
+				    int side){
+  /* _TRUE_ if the corners of the cell at lower are all done, and do not
+     all have the same outcome. */
+  int corner, d, stride, run, outcome=_OUTCOME_NONE_, differ=_FALSE_;
+
+  for (corner=0; corner<(1<<psw->dimensions); corner++){
+    for (d=0, stride=1, run=0; d<psw->dimensions; d++){
+      run += stride*(lower[d]+((corner>>d)&1)*(psw->size[d] > 1 ? side : 0));
+      stride *= psw->size[d];
+    }
+    if (sampler->outcome[run] <= _OUTCOME_QUEUED_)
+      return _FALSE_;
+    if (corner == 0)
+      outcome = sampler->outcome[run];
+    else if (sampler->outcome[run] != outcome)
+      differ = _TRUE_;
+  }
+  return differ;
+}
+
+int lasagna_sampler_next_level(struct sweep_content *psw,
+			       struct lasagna_sampler *sampler,
+			       ErrorMsg error_message){
+  /** Queues the points that halve the cells of the last level whose
+      corners disagree. A point on the face of a cell belongs to the 
+      neighbouring cells too, so each combination of lower corners is
+      tried. */
+  int run, d, stride, cell, valid, half, side;
+  int *index, *lower;
+
+  sampler->count = 0;
+  sampler->level++;
+  if (sampler->level > psw->refine)
+    return _SUCCESS_;
+  half = 1<<(psw->refine-sampler->level);
+  side = 2*half;
+  lasagna_alloc(index,sizeof(int)*(psw->dimensions+1),error_message);
+  lasagna_alloc(lower,sizeof(int)*(psw->dimensions+1),error_message);
+  for (run=0; run<psw->runs; run++){
+    if (sampler->outcome[run] != _OUTCOME_NONE_)
+      continue;
+    for (d=0, stride=1; d<psw->dimensions; d++){
+      index[d] = (run/stride)%psw->size[d];
+      if (index[d]%half != 0)
+	break;
+      stride *= psw->size[d];
+    }
+    if (d < psw->dimensions)
+      continue;
+    for (cell=0; cell<(1<<psw->dimensions); cell++){
+      valid = _TRUE_;
+      for (d=0; d<psw->dimensions; d++){
+	if (psw->size[d] == 1)
+	  lower[d] = 0;
+	else if (index[d]%side == 0)
+	  lower[d] = index[d]-((cell>>d)&1)*side;
+	else if (((cell>>d)&1) == 0)
+	  lower[d] = index[d]-half;
+	else
+	  valid = _FALSE_;
+	if ((lower[d] < 0)||(lower[d]+(psw->size[d] > 1 ? side : 0) >= psw->size[d]))
+	  valid = _FALSE_;
+      }
+      if ((valid == _TRUE_)&&
+	  (lasagna_sampler_disagree(psw, sampler, lower, side) == _TRUE_)){
+	sampler->outcome[run] = _OUTCOME_QUEUED_;
+	sampler->runs[sampler->count++] = run;
+	break;
+      }
+    }
+  }
+  free(index);
+  free(lower);
+  return _SUCCESS_;
+}
+
+int lasagna_sampler_free(struct lasagna_sampler *sampler){
+  free(sampler->outcome);
+  free(sampler->runs);
+  return _SUCCESS_;
+}
+
+int lasagna_run(const struct lasagna_config *config,
+		int run,
+		struct lasagna_worker *worker,
+		struct lasagna_result *result,
+		ErrorMsg error_message) {
+  /** Does run number run of the sweep in config with the worker, and
+      summarises it in result. Everything the run changes is in its own
+      qke_param, the worker and result, so threads with their own workers
+      can call it at the same time. With worker==NULL, the run has a worker
+      of its own. */
+  const struct sweep_content *psw=&(config->sweep);
+  struct lasagna_worker own;
+  qke_param qke_struct;
+  double *y_inout;
+  int *interp_idx, *block_index=NULL;
+  int i;
+  int func_return, cached;
+  char key[17];
+  char checkpoint_file[_FILENAMESIZE_+4], history_file[_FILENAMESIZE_+5];
+  char timing_file[_FILENAMESIZE_+12], *param_name="parametrisation";
+  char progress_file[_FILENAMESIZE_+10];
+  char cpus[_LINE_LENGTH_MAX_];
+  struct lasagna_share share;
+  clock_t start, end;
+  double cpu_time_used, elapsed, wall_start;
+  ErrorMsg timing_message;
+  time_t wtime1, wtime2;
+
+  EvolverOptions *options=&(worker->options);
+  extern int evolver_radau5();
+  extern int evolver_ndf15(); 	
+  extern int evolver_rkdp45(); 	
+  extern int evolver_rosw();
+  extern int evolver_exprb();
+  int (*generic_evolver)();  
+
+  if (worker == NULL){
+    lasagna_worker_init(&own);
+    func_return = lasagna_run(config, run, &own, result, error_message);
+    lasagna_worker_free(&own, error_message);
+    return func_return;
+  }
+  result->status = _FAILURE_;
+  result->budget_exceeded = _FALSE_;
+  result->diverged = _FALSE_;
+  result->steps = 0;
+  result->T_end = 0.0;
+  result->L_end = 0.0;
+  result->wall_time = 0.0;
+  result->cores = 0;
+  result->rhs_threads = 0;
+  func_return = input_sweep_run(&(config->fc),
+				psw,
+				run,
+				&(config->background),
+				&qke_struct,
+				error_message);
+  if (func_return == _FAILURE_)
+    return _FAILURE_;
+  if (psw->runs > 1)
+    printf("Run %d: output in %s.\n",run,qke_struct.output_filename);
+
+  /** A run already done with the same parameters is taken from the result
+      cache. Restarts, step histories and warm starts from the run before
+      depend on more than the parameters and are not cached. */
+  cached = ((qke_struct.result_cache[0] != '\0')&&(qke_struct.restart == _FALSE_)&&
+	    (qke_struct.store_history == _FALSE_)&&(qke_struct.sweep_warm_start == _FALSE_));
+  if (cached == _TRUE_){
+    input_result_key(&qke_struct, key);
+    if (input_result_cache_read(&qke_struct, key, &(result->steps), &(result->T_end),
+				&(result->L_end), &(result->diverged)) == _TRUE_){
+      printf("Run %d: taken from the result cache, key %s.\n",run,key);
+      result->status = _SUCCESS_;
+      free_qke_param(&qke_struct);
+      return _SUCCESS_;
+    }
+  }
+
+  /** Do stuff */
+  y_inout = calloc(qke_struct.neq,sizeof(double));
+  interp_idx = malloc(sizeof(int)*qke_struct.neq);
+  qke_output_indices(&qke_struct, interp_idx);
+
+  qke_initial_conditions(qke_struct.T_initial, 
+			 y_inout, 
+			 &qke_struct);
+  if ((qke_struct.detect_pattern > 0)&&
+      (qke_detect_pattern(&qke_struct, qke_struct.T_initial, y_inout, error_message) == _FAILURE_))
+    return _FAILURE_;
+
+  /** evolver and linalg_wrapper -1 are chosen by the first run of the
+      worker, and memory_limit is checked, before anything big is
+      allocated. The later runs of the worker keep the choice, since its
+      ndf15 context holds the linalg workspace. */
+  if ((worker->chosen == _TRUE_)&&
+      ((qke_struct.evolver_auto == _TRUE_)||(qke_struct.linalg_auto == _TRUE_))){
+    qke_struct.evolver = worker->evolver;
+    qke_struct.LinearAlgebraWrapper = worker->wrapper;
+  }
+  else if ((qke_struct.evolver_auto == _TRUE_)||(qke_struct.linalg_auto == _TRUE_)||
+	   (qke_struct.memory_limit > 0.0)){
+    if (lasagna_select(&qke_struct, y_inout, (worker->budget != NULL ? worker->budget->threads : 1),
+		       error_message) == _FAILURE_)
+      return _FAILURE_;
+    worker->chosen = _TRUE_;
+    worker->evolver = qke_struct.evolver;
+    worker->wrapper = qke_struct.LinearAlgebraWrapper;
+  }
+  if(qke_struct.evolver == 0){
+    generic_evolver = evolver_radau5;
+  }
+  else if (qke_struct.evolver == 2){
+    printf("Runge-Kutta evolver\n");
+    generic_evolver = evolver_rkdp45;
+  }
+  else if (qke_struct.evolver == 3){
+    printf("Rosenbrock-W evolver\n");
+    generic_evolver = evolver_rosw;
+  }
+  else if (qke_struct.evolver == 4){
+    printf("Exponential Rosenbrock evolver\n");
+    generic_evolver = evolver_exprb;
+  }
+  else{
+    //ndf15 is called with the context of the worker:
+    generic_evolver = evolver_ndf15;
+  }
+
+  //Dump jacobian pattern:
+  if (run == 0){
+    FILE *jacfile=fopen("jac_anal_Ap.dat","w");
+    for (i=0; i<=qke_struct.neq; i++) fprintf(jacfile,"%d ",qke_struct.Ap[i]);
+    fclose(jacfile);
+    jacfile=fopen("jac_anal_Ai.dat","w");
+    for (i=0; i<qke_struct.Ap[qke_struct.neq]; i++) fprintf(jacfile,"%d ",qke_struct.Ai[i]);
+    fclose(jacfile);
+  }
+
+
+  if (qke_init_output(&qke_struct) == _FAILURE_){
+    sprintf(error_message,"Could not create %s.",qke_struct.output_filename);
+    return _FAILURE_;
+  }
+
+  /** With a budget, the run gets its part of the cores of the sweep, and
+      nproc and rhs_threads are what it gets: */
+  if (worker->budget != NULL){
+    lasagna_budget_acquire(worker->budget, run, qke_struct.rhs_threads, &share);
+    qke_struct.nproc = share.cores;
+    qke_struct.rhs_threads = share.rhs_threads;
+    qke_struct.share = &share;
+    lasagna_budget_cpus(&share, cpus, _LINE_LENGTH_MAX_);
+    printf("Cores: %d of %d (numjac %d x derivs %d)%s.\n",share.cores,
+	   worker->budget->nproc,share.numjac,share.rhs_threads,cpus);
+  }
+
+  //Handle options:
+  if (qke_struct.imex == _TRUE_)
+    DefaultEvolverOptions(options,LINALG_WRAPPER_BLOCK);
+  else
+    DefaultEvolverOptions(options,qke_struct.LinearAlgebraWrapper);
+  options->used_in_output=interp_idx;
+  options->RelTol = qke_struct.rtol;
+  options->AbsTol = qke_struct.abstol;
+  options->t_vec = qke_struct.Tvec; 
+  options->tres = qke_struct.Tres;
+  options->Ap = qke_struct.Ap;
+  options->Ai = qke_struct.Ai;
+  options->output = qke_store_output;
+  //  options->print_variables = qke_print_L;
+  //  options->stop_function = qke_stop_at_L;
+  //Also without a stop, for the T and L reached by a run that fails:
+  options->stop_function = qke_stop_at_budget;
+  if (worker->budget != NULL)
+    options->stop_function = lasagna_stop_at_budget;
+  if (qke_struct.events == _TRUE_){
+    qke_events(&qke_struct);
+    options->Events = _QKE_EVENTS_;
+    options->event_function = qke_event_values;
+    options->event_action = qke_event_action;
+    options->event_direction = qke_struct.event_direction;
+    options->event_terminal = qke_struct.event_terminal;
+  }
+  options->EvolverVerbose=qke_struct.verbose;
+  options->Cores = qke_struct.nproc;
+  options->DerivsThreads = qke_struct.rhs_threads;
+  options->derivs_workspace_copy = qke_copy_workspace;
+  options->derivs_workspace_free = qke_free_workspace;
+  if (qke_struct.fixed_grid == 0)
+    options->derivs_batch = qke_derivs_batch;
+  if (qke_struct.analytic_jacobian > 0)
+    options->jacobian = qke_jacobian;
+  if (qke_struct.analytic_jacobian == 2)
+    options->JacobianCheck = _TRUE_;
+  options->JacobianUpdates = qke_struct.jacobian_updates;
+  if (qke_struct.imex == _TRUE_){
+    //The local terms of each bin are a block, see qke_imex_blocks:
+    options->derivs_split = qke_derivs_split;
+    options->jacobian_implicit = qke_jacobian_implicit;
+    options->Blocks = qke_struct.vres;
+    options->BlockSize = 8;
+    block_index = malloc(sizeof(int)*8*qke_struct.vres);
+    qke_imex_blocks(&qke_struct, block_index);
+    options->BlockIndex = block_index;
+  }
+  if (qke_struct.symbolic_cache[0] != '\0')
+    options->SymbolicCache = qke_struct.symbolic_cache;
+  options->MixedPrecision = qke_struct.mixed_precision;
+  options->LowMemory = qke_struct.low_memory;
+  options->ComplexAsReal = qke_struct.radau5_real;
+  options->LinAlgShared = worker->linalg_shared;
+  sprintf(checkpoint_file,"%s.chk",qke_struct.output_filename);
+  options->CheckpointFile = checkpoint_file;
+  options->CheckpointInterval = qke_struct.checkpoint_interval;
+  options->Restart = qke_struct.restart;
+  options->checkpoint_state = qke_checkpoint_state;
+  if (qke_struct.store_history == _TRUE_){
+    sprintf(history_file,"%s.hist",qke_struct.output_filename);
+    options->HistoryFile = history_file;
+  }
+
+  options->WarmStart = qke_struct.sweep_warm_start;
+  options->Timing = qke_struct.timing;
+  if (qke_struct.progress_interval > 0.0){
+    sprintf(progress_file,"%s.progress",qke_struct.output_filename);
+    options->ProgressFile = progress_file;
+    options->ProgressInterval = qke_struct.progress_interval;
+    options->ProgressIndex = qke_struct.index_L;
+    options->ProgressScale = _L_SCALE_;
+  }
+  if (qke_struct.evolver == 1){
+    func_return = lasagna_worker_context(worker, &qke_struct, error_message);
+    if ((func_return == _SUCCESS_)&&(qke_struct.sweep_warm_start == _TRUE_)&&
+	(worker->latest != NULL)){
+#pragma omp critical(lasagna_warm_start)
+      {
+	if (worker->latest->absh > 0.0)
+	  func_return = ndf15_warm_start_copy(&(worker->context->warm), worker->latest,
+					      error_message);
+      }
+    }
+    if (func_return == _FAILURE_){
+      if (worker->budget != NULL)
+	lasagna_budget_release(&share);
+      return _FAILURE_;
+    }
+  }
+
+  printf("theta: %g\n",qke_struct.theta_zero);
+  start = clock();  
+  wall_start = evolver_clock();
+  time(&wtime1);
+  qke_struct.run_start = wtime1;
+  qke_struct.T_stop = qke_struct.T_final;
+  if (qke_struct.grid_levels > 0){
+    func_return = lasagna_evolve_adaptive(worker, &qke_struct, &y_inout, &interp_idx,
+					  error_message);
+  }
+  else if (qke_struct.grid_switch == _TRUE_){
+    func_return = lasagna_evolve_switch(worker, &qke_struct, generic_evolver, y_inout,
+					error_message);
+  }
+  else if (qke_struct.evolver == 1){
+    func_return = evolver_ndf15_context((qke_struct.fixed_grid == 0 ? 
+					 qke_derivs : qke_derivs_fixed_grid),
+					&qke_struct,
+					qke_struct.T_initial,
+					qke_struct.T_final,
+					y_inout, 
+					qke_struct.neq, 
+					options,
+					worker->context,
+					error_message);
+  }
+  else if (qke_struct.fixed_grid == 0){
+    func_return = generic_evolver(qke_derivs,
+				  &qke_struct,
+				  qke_struct.T_initial,
+				  qke_struct.T_final,
+				  y_inout, 
+				  qke_struct.neq, 
+				  options,
+				  error_message);
+  }
+  else{
+    func_return = generic_evolver(qke_derivs_fixed_grid,
+				  &qke_struct,
+				  qke_struct.T_initial,
+				  qke_struct.T_final,
+				  y_inout, 
+				  qke_struct.neq, 
+				  options,
+				  error_message);
+  }
+  if ((func_return == _SUCCESS_)&&(qke_struct.evolver == 1)&&
+      (qke_struct.sweep_warm_start == _TRUE_)&&(worker->latest != NULL)){
+#pragma omp critical(lasagna_warm_start)
+    func_return = ndf15_warm_start_copy(worker->latest, &(worker->context->warm),
+					error_message);
+  }
+  //Write the buffered output points, also when a stop function has fired:
+  if ((mat_writer_close(&(qke_struct.writer)) == _FAILURE_)&&
+      (func_return == _SUCCESS_)){
+    sprintf(error_message,"Writing to %s failed.",qke_struct.output_filename);
+    func_return = _FAILURE_;
+  }
+  if (worker->budget != NULL){
+    lasagna_budget_release(&share);
+    if (share.cores > qke_struct.nproc)
+      printf("Cores at the end of the run: %d (derivs %d).\n",share.cores,share.rhs_threads);
+  }
+  end = clock();
+  time(&wtime2);  
+  cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
+  printf("CPU time used: %g minutes.\n",cpu_time_used/60);
+  elapsed = difftime(wtime2,wtime1);
+  printf("Wall clock time used: %g minutes.\n",elapsed/60);
+  printf("Peak memory: %.1f MB.\n",evolver_peak_memory());
+  if (qke_struct.budget_exceeded == _TRUE_)
+    printf("Time budget of %g s used, stopped at T=%g.\n",
+	   qke_struct.time_budget,qke_struct.T_stop);
+  if (qke_struct.timing == _TRUE_){
+    sprintf(timing_file,"%s.timing.json",qke_struct.output_filename);
+    if (evolver_timing_report(options, evolver_clock()-wall_start, 1, &param_name,
+			      &(qke_struct.param_time), &(qke_struct.param_solves),
+			      timing_file, timing_message) == _FAILURE_)
+      printf("Run %d: %s\n",run,timing_message);
+  }
+  result->status = func_return;
+  result->budget_exceeded = qke_struct.budget_exceeded;
+  result->diverged = ((qke_struct.budget_exceeded == _FALSE_)&&
+		      (qke_struct.T_stop != qke_struct.T_final));
+  result->steps = options->Stats[0];
+  result->T_end = qke_struct.T_stop;
+  result->L_end = y_inout[qke_struct.index_L]*_L_SCALE_;
+  if (func_return == _FAILURE_){
+    //y_inout is not the state of a failed run, its last accepted step is:
+    result->steps = qke_struct.steps_reached;
+    result->T_end = qke_struct.T_reached;
+    result->L_end = qke_struct.L_reached;
+  }
+  result->wall_time = elapsed;
+  result->cores = qke_struct.nproc;
+  result->rhs_threads = qke_struct.rhs_threads;
+  if (worker->budget != NULL){
+    result->cores = share.cores;
+    result->rhs_threads = share.rhs_threads;
+  }
+      
+  
+  free(y_inout);
+  free(interp_idx);
+  free(block_index);
+  if ((cached == _TRUE_)&&(func_return == _SUCCESS_)&&
+      (qke_struct.budget_exceeded == _FALSE_)&&
+      (input_result_cache_write(&qke_struct, key, result->steps, result->T_end,
+				result->L_end, result->diverged, elapsed) == _FAILURE_))
+    printf("Run %d could not be stored in the result cache %s.\n",run,qke_struct.result_cache);
+  if ((qke_struct.store_output == _FALSE_)&&(func_return == _SUCCESS_)){
+    remove(checkpoint_file);
+    sprintf(checkpoint_file,"%s.toc",qke_struct.output_filename);
+    remove(checkpoint_file);
+    remove(qke_struct.output_filename);
+  }
+  free_qke_param(&qke_struct);
+
+
+  return func_return;
+}
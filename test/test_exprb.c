@@ -0,0 +1,95 @@
+#include "common.h"
+#include "parser.h"
+#include "sweep.h"
+/** End to end test of the exponential Rosenbrock evolver:
+    test_exprb <parameter file> [vres]
+    does the run of the parameter file, with vres bins if given, once with
+    ndf15 and once with exprb, in the same way as lasagna does it. The test
+    fails if a run fails or stops before T_final, or if the final L of
+    exprb differs from that of ndf15 by more than _L_TOL_ relative to it.
+    The parameter file has to set evolver and vres. With nproc above 1
+    numjac evaluates the columns of the Jacobian on several threads, and
+    exprb computes a Jacobian at every step. See make check_exprb. */
+
+#define _L_TOL_ 0.05 /** Largest relative difference of the final L */
+
+static int test_set(struct file_content *pfc, char *name, int value){
+  /** Sets an integer parameter of the file, which has to be in it. */
+  int i;
+  for (i=0; i<pfc->size; i++){
+    if (strcmp(pfc->name[i],name) == 0){
+      sprintf(pfc->value[i],"%d",value);
+      return _SUCCESS_;
+    }
+  }
+  printf("%s is not set in %s.\n",name,pfc->filename);
+  return _FAILURE_;
+}
+
+static int test_run(struct lasagna_config *config,
+		    int evolver,
+		    double T_final,
+		    struct lasagna_result *result){
+  /** The run of config with evolver, _FAILURE_ if it did not reach
+      T_final. */
+  struct lasagna_worker worker;
+  ErrorMsg error_message;
+  int func_return;
+
+  if (test_set(&(config->fc),"evolver",evolver) == _FAILURE_)
+    return _FAILURE_;
+  lasagna_worker_init(&worker);
+  func_return = lasagna_run(config, 0, &worker, result, error_message);
+  lasagna_worker_free(&worker, error_message);
+  if (func_return == _FAILURE_){
+    printf("Evolver %d: %s\n",evolver,error_message);
+    return _FAILURE_;
+  }
+  if ((result->status != _SUCCESS_)||(result->budget_exceeded == _TRUE_)||
+      (result->T_end != T_final)){
+    printf("Evolver %d stopped at T=%g before T_final=%g.\n",evolver,result->T_end,T_final);
+    return _FAILURE_;
+  }
+  printf("Evolver %d: %d steps, L_end %.10e.\n",evolver,result->steps,result->L_end);
+  return _SUCCESS_;
+}
+
+int main(int argc, char **argv){
+  struct lasagna_config config;
+  struct lasagna_result ref, result;
+  ErrorMsg error_message;
+  double T_final;
+  int found, func_return=_SUCCESS_;
+
+  if (argc < 2){
+    printf("Usage: test_exprb <parameter file> [vres]\n");
+    return _FAILURE_;
+  }
+  if (lasagna_config_init(2, argv, &config, error_message) == _FAILURE_){
+    printf("\n\nError running lasagna_config_init\n=>%s\n",error_message);
+    return _FAILURE_;
+  }
+  if (config.sweep.runs > 1){
+    printf("The test problem in %s is a sweep.\n",config.fc.filename);
+    return _FAILURE_;
+  }
+  if (parser_read_double(&(config.fc),"T_final",&T_final,&found,error_message) == _FAILURE_){
+    printf("\n\nError reading %s\n=>%s\n",config.fc.filename,error_message);
+    return _FAILURE_;
+  }
+  if ((argc > 2)&&(test_set(&(config.fc),"vres",atoi(argv[2])) == _FAILURE_))
+    return _FAILURE_;
+
+  if ((test_run(&config, 1, T_final, &ref) == _FAILURE_)||
+      (test_run(&config, 4, T_final, &result) == _FAILURE_))
+    func_return = _FAILURE_;
+  else if (fabs(result.L_end-ref.L_end) > _L_TOL_*fabs(ref.L_end)){
+    printf("L_end of exprb differs from %.10e of ndf15 by more than %g.\n",
+	   ref.L_end,_L_TOL_);
+    func_return = _FAILURE_;
+  }
+  lasagna_config_free(&config);
+  if (func_return == _SUCCESS_)
+    printf("exprb agrees with ndf15.\n");
+  return func_return;
+}
@@ -47,8 +47,8 @@ int main() {
   Vr = 1.0;
   Vl = 0.0;
   for(i=0; i<qke_struct.vres; i++){
-    qke_struct.v_grid[i] = Vl+i*(Vr-Vl)/(qke_struct.vres-1);
-    printf("%g ",qke_struct.v_grid[i]);
+    qke_struct.ws.v_grid[i] = Vl+i*(Vr-Vl)/(qke_struct.vres-1);
+    printf("%g ",qke_struct.ws.v_grid[i]);
   }
   printf("\n");
   /** We must have non-zero alpha, otherwise the matrix for 
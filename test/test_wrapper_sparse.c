@@ -1,225 +1,433 @@
+#include "common.h"
+#include "evolver_common.h"
+#include "evolver_radau5.h"
 #include "multimatrix.h"
-#include "linalg_wrapper_SuperLU.h"
-#include "linalg_wrapper_sparse.h"
-
-int main(){
-  int nnz,readcount;
-  int cols=479;
-  int nsys=2;
-  int *Ai;
-  int *Ap;
-  double *Ax, *b, *x, *Axim;
-  double complex *Axz, *bz, *xz;
-  void *Adat, *Xdat, *Bdat;
-  FILE *myfile;
-  MultiMatrix A, B, X;
+#include "sparse.h"
+#include "mat_io.h"
+#include "qke_equations.h"
+#include "input.h"
+/** Micro-benchmark and regression test of the sparse LU in sparse.c:
+    test_wrapper_sparse <parameter file> [vres] [repeats] [MAT file]
+    test_wrapper_sparse <MAT file> [repeats]
+    The first form takes the Jacobian pattern of the parameter file, with
+    vres bins if given, and the values of qke_jacobian at the initial
+    conditions, and writes them to the MAT file (output/sparse_bench.mat
+    if not given) as Ap, Ai, Jx and h. The second form reads them back. A
+    MAT file of analyse_pattern has no Jx, and then gets values that are
+    dominant on the diagonal.
+    The systems are those of a radau5 step of h, gamma/h-J (real) and
+    (alpha+i*beta)/h-J (complex). sp_ludcmp, sp_refactor and sp_lusolve and
+    their _cx variants are timed on them, and so are the dense, sparse and
+    SuperLU wrappers. Each routine is called repeats times. The run fails if
+    the componentwise backward error of a solve is above _RESIDUAL_MAX_. */
+
+#define _DENSE_MAX_ 4000     /** Largest system given to the dense wrapper */
+/** Componentwise backward error above which a solve fails. A wrong solution
+    in some rows gives errors of order 1 there. The threshold pivoting of
+    sp_ludcmp (pivtol 0.1) gives 1e-12 to 2e-10 on the QKE matrices up to
+    vres 400, depending on the pivots, the dense wrapper 1e-13 or less. */
+#define _RESIDUAL_MAX_ 1e-8
+
+static double bench_residual(int n, int *Ap, int *Ai, void *Ax, void *x, void *b,
+			     int is_complex){
+  /** Componentwise backward error max_i |b-Ax|_i/(|A||x|+|b|)_i for A
+      in compressed columns. Every row is measured on its own scale, so a
+      wrong solution in the rows with small entries is not hidden by the
+      rows with large ones, as it is in the max norm of the QKE matrices. */
+  double complex *r, a, xj;
+  double *s, err=0.0;
+  int i, j, p;
+
+  r = malloc(sizeof(double complex)*n);
+  s = malloc(sizeof(double)*n);
+  for (i=0; i<n; i++){
+    r[i] = (is_complex == _TRUE_ ? ((double complex *) b)[i] : ((double *) b)[i]);
+    s[i] = cabs(r[i]);
+  }
+  for (j=0; j<n; j++){
+    xj = (is_complex == _TRUE_ ? ((double complex *) x)[j] : ((double *) x)[j]);
+    for (p=Ap[j]; p<Ap[j+1]; p++){
+      a = (is_complex == _TRUE_ ? ((double complex *) Ax)[p] : ((double *) Ax)[p]);
+      r[Ai[p]] -= a*xj;
+      s[Ai[p]] += cabs(a)*cabs(xj);
+    }
+  }
+  for (i=0; i<n; i++){
+    if (s[i] > 0.0)
+      err = max(err,cabs(r[i])/s[i]);
+    else if (cabs(r[i]) > 0.0)
+      err = max(err,1.0);
+  }
+  free(r);
+  free(s);
+  return err;
+}
+
+static void bench_print(char *routine, char *type, double seconds, int calls, double flops){
+  /** One line of the table: seconds per call, calls per second and, if
+      flops is above 0, MFlop/s for flops per call. */
+  printf("%-22s %-8s %14.6e %12.2f",routine,type,seconds/calls,calls/max(seconds,TINY));
+  if (flops > 0.0)
+    printf(" %10.1f\n",1e-6*flops*calls/max(seconds,TINY));
+  else
+    printf(" %10s\n","-");
+}
+
+static int bench_sparse_lu(int n, int *Ap, int *Ai, double *Ax, double complex *Az,
+			   int repeats, double *residual, ErrorMsg error_message){
+  /** Times sp_ludcmp, sp_refactor and sp_lusolve on Ax, and the _cx
+      and _split_cx variants on Az, with the ordering of the sparse wrapper,
+      sp_amd on A+A^T, and its pivot tolerance. */
+  sp_mat *A;
+  sp_mat_cx *Acx;
+  sp_num *N;
+  sp_num_cx *Ncx;
+  sp_split_cx *S;
+  int *Cp, *Ci, *urow, nnz=Ap[n], lnz, unz, lk, i, j, k;
+  double *b, *x, t0, flops, res;
+  double complex *bz, *xz;
+
+  lasagna_call(sp_mat_alloc(&A,n,n,nnz,error_message),error_message,error_message);
+  lasagna_call(sp_num_alloc(&N,n,error_message),error_message,error_message);
+  lasagna_call(sp_mat_alloc_cx(&Acx,n,n,nnz,error_message),error_message,error_message);
+  lasagna_call(sp_num_alloc_cx(&Ncx,n,error_message),error_message,error_message);
+  memcpy(A->Ap,Ap,sizeof(int)*(n+1));
+  memcpy(A->Ai,Ai,sizeof(int)*nnz);
+  memcpy(A->Ax,Ax,sizeof(double)*nnz);
+  memcpy(Acx->Ap,Ap,sizeof(int)*(n+1));
+  memcpy(Acx->Ai,Ai,sizeof(int)*nnz);
+  memcpy(Acx->Ax,Az,sizeof(double complex)*nnz);
+  lasagna_alloc(b,sizeof(double)*n,error_message);
+  lasagna_alloc(x,sizeof(double)*n,error_message);
+  lasagna_alloc(bz,sizeof(double complex)*n,error_message);
+  lasagna_alloc(xz,sizeof(double complex)*n,error_message);
+  for (i=0; i<n; i++){
+    b[i] = 1.0+i%7;
+    bz[i] = b[i]-I*(i%5);
+  }
+
+  t0 = evolver_clock();
+  lasagna_call(get_pattern_A_plus_AT(Ap,Ai,n,&Cp,&Ci,error_message),
+	       error_message,error_message);
+  sp_amd(Cp,Ci,n,Cp[n],N->q,N->wamd);
+  bench_print("sp_amd","pattern",evolver_clock()-t0,1,0.0);
+  memcpy(Ncx->q,N->q,sizeof(int)*n);
+  free(Cp);
+  free(Ci);
+
+  //Real:
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    lasagna_test(sp_ludcmp(N,A,0.1) == _FAILURE_, error_message,
+		 "sp_ludcmp: the matrix is singular.");
+  lnz = N->L->Ap[n];
+  unz = N->U->Ap[n];
+  //Flops from the column counts of L and the row counts of U, as in analyse_pattern:
+  lasagna_calloc(urow,n,sizeof(int),error_message);
+  for (k=0; k<unz; k++)
+    urow[N->U->Ai[k]]++;
+  for (j=0, flops=0.0; j<n; j++){
+    lk = N->L->Ap[j+1]-N->L->Ap[j]-1;
+    flops += lk+2.0*lk*(urow[j]-1);
+  }
+  free(urow);
+  bench_print("sp_ludcmp","real",evolver_clock()-t0,repeats,flops);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    lasagna_test(sp_refactor(N,A) == _FAILURE_, error_message,
+		 "sp_refactor: zero pivot.");
+  bench_print("sp_refactor","real",evolver_clock()-t0,repeats,flops);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    sp_lusolve(N,b,x);
+  bench_print("sp_lusolve","real",evolver_clock()-t0,repeats,2.0*(lnz+unz));
+  residual[0] = bench_residual(n,Ap,Ai,Ax,x,b,_FALSE_);
+  printf("Fill: nnz(A)=%d, nnz(L+U)=%d, fill factor %.3g.\n",nnz,lnz+unz-n,
+	 (lnz+unz-n)/(double) nnz);
+
+  //Complex, where a multiply-add is four real ones:
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    lasagna_test(sp_ludcmp_cx(Ncx,Acx,0.1) == _FAILURE_, error_message,
+		 "sp_ludcmp_cx: the matrix is singular.");
+  bench_print("sp_ludcmp_cx","complex",evolver_clock()-t0,repeats,4.0*flops);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    lasagna_test(sp_refactor_cx(Ncx,Acx) == _FAILURE_, error_message,
+		 "sp_refactor_cx: zero pivot.");
+  bench_print("sp_refactor_cx","complex",evolver_clock()-t0,repeats,4.0*flops);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    sp_lusolve_cx(Ncx,bz,xz);
+  lnz = Ncx->L->Ap[n];
+  unz = Ncx->U->Ap[n];
+  bench_print("sp_lusolve_cx","complex",evolver_clock()-t0,repeats,8.0*(lnz+unz));
+  res = bench_residual(n,Ap,Ai,Az,xz,bz,_TRUE_);
+  residual[0] = max(residual[0],res);
+
+  //Complex with split real and imaginary parts, on the pivot sequence above:
+  lasagna_call(sp_split_alloc_cx(&S,n,nnz,error_message),error_message,error_message);
+  lasagna_call(sp_split_from_cx(S,Ncx,error_message),error_message,error_message);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    sp_refactor_split_cx(S,Ncx,Acx);
+  bench_print("sp_refactor_split_cx","complex",evolver_clock()-t0,repeats,4.0*flops);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    sp_lusolve_split_cx(S,Ncx,bz,xz);
+  bench_print("sp_lusolve_split_cx","complex",evolver_clock()-t0,repeats,8.0*(lnz+unz));
+  res = bench_residual(n,Ap,Ai,Az,xz,bz,_TRUE_);
+  residual[0] = max(residual[0],res);
+  sp_split_free_cx(S);
+
+  sp_mat_free(A);
+  sp_num_free(N);
+  sp_mat_free_cx(Acx);
+  sp_num_free_cx(Ncx);
+  free(b);
+  free(x);
+  free(bz);
+  free(xz);
+  return _SUCCESS_;
+}
+
+static int bench_wrapper(LinAlgWrapper wrapper, char *name, MultiMatrix *A, int *Ap,
+			 int *Ai, void *Ax, int repeats, double *residual,
+			 ErrorMsg error_message){
+  /** Times a linalg wrapper on A: initialise, the first factorisation, the
+      later ones of a matrix with the same pattern, and solves. Ax holds
+      the values of A in compressed columns, for the residual. */
   EvolverOptions options;
-  ErrorMsg error_message;
-  int funcreturn;
-  DataType Dtype;
+  MultiMatrix B, X;
   void *linalg_workspace;
-  int i, loop, maxloop=4;
-  //Function pointers:
-  int (*linalg_initialise)(MultiMatrix *, EvolverOptions *, void **, ErrorMsg);
-  int (*linalg_finalise)(void *, ErrorMsg);
-  int (*linalg_factorise)(void *, ErrorMsg);
-  int (*linalg_solve)(MultiMatrix *, MultiMatrix *, void *, ErrorMsg);
-
-  DefaultEvolverOptions(&options);
-  options.Cores=4;
-
-  for (loop=0; loop<maxloop; loop++){
-    Dtype = L_DBL_CX;
-    switch (loop%4){
-    case (0):
-      Dtype = L_DBL;
-    case (1):
-      fprintf(stdout,"Testing SuperLU wrapper:\n");
-      linalg_initialise = &(linalg_initialise_SuperLU);
-      linalg_finalise = &(linalg_finalise_SuperLU);
-      linalg_factorise = &(linalg_factorise_SuperLU);
-      linalg_solve = &(linalg_solve_SuperLU);
-      break;      
-    case (2):
-      Dtype = L_DBL;
-    case (3):
-      fprintf(stdout,"Testing sparse wrapper:\n");
-      linalg_initialise = &(linalg_initialise_sparse);
-      linalg_finalise = &(linalg_finalise_sparse);
-      linalg_factorise = &(linalg_factorise_sparse);
-      linalg_solve = &(linalg_solve_sparse);
-      break;      
-    }
+  void *b, *x;
+  int n=A->ncol, i, k, is_complex=(A->Dtype == L_DBL_CX ? _TRUE_ : _FALSE_);
+  char *type=(is_complex == _TRUE_ ? "complex" : "real");
+  char routine[64];
+  double t0;
+  size_t size=GetByteSize(A->Dtype);
+
+  DefaultEvolverOptions(&options,wrapper);
+  options.EvolverVerbose = 0;
+  options.LinAlgVerbose = 0;
+  if (options.linalg_initialise == NULL){
+    printf("%-22s %-8s not in this build\n",name,type);
+    *residual = -1.0;
+    return _SUCCESS_;
+  }
+  lasagna_alloc(b,size*(n+1),error_message);
+  lasagna_alloc(x,size*(n+1),error_message);
+  for (i=0; i<n; i++){
+    if (is_complex == _TRUE_)
+      ((double complex *) b)[i+1] = 1.0+i%7-I*(i%5);
+    else
+      ((double *) b)[i+1] = 1.0+i%7;
+  }
+  lasagna_call(CreateMatrix_DNR(&B,A->Dtype,1,n,b,error_message),error_message,error_message);
+  lasagna_call(CreateMatrix_DNR(&X,A->Dtype,1,n,x,error_message),error_message,error_message);
 
-    switch(Dtype){
-    case (L_DBL):
-      printf("Testing double routines:\n");
-      break;
-    case (L_DBL_CX):
-      printf("Testing double complex routines:\n");
-      break;
+  t0 = evolver_clock();
+  lasagna_call(options.linalg_initialise(A,&options,&linalg_workspace,error_message),
+	       error_message,error_message);
+  sprintf(routine,"%s init",name);
+  bench_print(routine,type,evolver_clock()-t0,1,0.0);
+  t0 = evolver_clock();
+  lasagna_call(options.linalg_factorise(linalg_workspace,_LINALG_FROM_SCRATCH_,error_message),
+	       error_message,error_message);
+  sprintf(routine,"%s factorise",name);
+  bench_print(routine,type,evolver_clock()-t0,1,0.0);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    lasagna_call(options.linalg_factorise(linalg_workspace,_FALSE_,error_message),
+		 error_message,error_message);
+  sprintf(routine,"%s refactorise",name);
+  bench_print(routine,type,evolver_clock()-t0,repeats,0.0);
+  t0 = evolver_clock();
+  for (k=0; k<repeats; k++)
+    lasagna_call(options.linalg_solve(&B,&X,linalg_workspace,error_message),
+		 error_message,error_message);
+  sprintf(routine,"%s solve",name);
+  bench_print(routine,type,evolver_clock()-t0,repeats,0.0);
+  *residual = max(*residual,bench_residual(n,Ap,Ai,Ax,(char *) x+size,(char *) b+size,
+					   is_complex));
+  lasagna_call(options.linalg_finalise(linalg_workspace,error_message),
+	       error_message,error_message);
+  DestroyMultiMatrix(&B);
+  DestroyMultiMatrix(&X);
+  free(b);
+  free(x);
+  return _SUCCESS_;
+}
+
+int main(int argc, char *argv[]){
+  qke_param qke_struct;
+  struct file_content fc;
+  struct sweep_content sweep;
+  struct background_structure bs;
+  MultiMatrix J, A, Z, Adense, Zdense;
+  ErrorMsg error_message;
+  int *Ap, *Ai, n, nnz, repeats=10, vres=0, i, j, p, nfe=0, handle;
+  int cols, rows, type, threads, nproc, pin, found;
+  double *Jx, *Ax, *Adata, *y, *fval, *hptr, h=1.0, res, residual[4]={0.0,0.0,0.0,0.0};
+  double complex *Az, *Zdata;
+  char *outf="output/sparse_bench.mat";
+  char *name[4]={"sparse.c","dense","sparse","SuperLU"};
+
+  if (argc < 2){
+    printf("Usage: %s <parameter file> [vres] [repeats] [MAT file]\n",argv[0]);
+    printf("       %s <MAT file> [repeats]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (strstr(argv[1],".mat") != NULL){
+    if (argc > 2)
+      repeats = atoi(argv[2]);
+    if ((mat_read_data(argv[1],"Ap",(void **) &Ap,&cols,&rows,&type) == _FAILURE_)||
+	(type != miINT32)){
+      printf("No Ap in %s.\n",argv[1]);
+      return _FAILURE_;
     }
-    //Construct A:
-    //------------------------------------
-    Ap = malloc(sizeof(int)*(cols+1));
-    myfile = fopen("testlin_Ap.dat","r");
-    readcount=fread(Ap,sizeof(int),(cols+1),myfile);
-    printf("Read %d entries.\n",readcount);
-    fclose(myfile);
-    nnz = Ap[cols];
-
-
-    printf("nnz=%d\n",nnz);
-    Ai = malloc(sizeof(int)*nnz);
-    myfile = fopen("testlin_Ai.dat","r");
-    readcount=fread(Ai,sizeof(int),nnz,myfile);
-    printf("Read %d entries.\n",readcount);
-    fclose(myfile);
-
-    /** Debug region 
-    int *Cp, *Ci, i,j;
-    FILE *fI, *fJ;
-    get_pattern_A_plus_AT(Ap, Ai, cols, &Cp, &Ci, error_message);
-    fI = fopen("I.dat","w");
-    fJ = fopen("J.dat","w");
-
-    for (j=0; j<cols; j++){
-      for (i=Cp[j]; i<Cp[j+1]; i++){
-	fprintf(fI,"%d ",Ci[i]+1);
-	fprintf(fJ, "%d ",j+1);
-      }
+    n = cols*rows-1;
+    if ((mat_read_data(argv[1],"Ai",(void **) &Ai,&cols,&rows,&type) == _FAILURE_)||
+	(type != miINT32)||(cols*rows != Ap[n])){
+      printf("No Ai of %d entries in %s.\n",Ap[n],argv[1]);
+      return _FAILURE_;
     }
-    fclose(fI);
-    fclose(fJ);
-    return 0;
-    */
-
-    Ax = malloc(sizeof(double)*nnz);
-    Axim = malloc(sizeof(double)*nnz);
-    Axz = malloc(sizeof(double complex)*nnz);
-    b = malloc(sizeof(double)*(cols*nsys+1));
-    x = malloc(sizeof(double)*(cols*nsys+1));
-    bz = malloc(sizeof(double complex)*(cols*nsys+1));
-    xz = malloc(sizeof(double complex)*(cols*nsys+1));
-   
-    switch (Dtype){
-    case (L_DBL):
-      Adat = (void*) Ax;
-      Bdat = (void*) b;
-      Xdat = (void*) x;
-      break;
-    case (L_DBL_CX):
-      Adat = (void*) Axz;
-      Bdat = (void*) bz;
-      Xdat = (void*) xz;
-      break;
+    nnz = Ap[n];
+    if ((mat_read_data(argv[1],"Jx",(void **) &Jx,&cols,&rows,&type) == _FAILURE_)||
+	(type != miDOUBLE)||(cols*rows != nnz)){
+      printf("No Jx in %s, so the values are dominant on the diagonal.\n",argv[1]);
+      Jx = malloc(sizeof(double)*nnz);
+      for (j=0; j<n; j++)
+	for (p=Ap[j]; p<Ap[j+1]; p++)
+	  Jx[p] = (Ai[p] == j ? -(Ap[j+1]-Ap[j]+1.0) : 1.0);
     }
-    
-    CreateMatrix_DNR(&(B),
-		     Dtype, 
-		     nsys,
-		     cols,
-		     Bdat,
-		     error_message);
-    CreateMatrix_DNR(&(X),
-		     Dtype, 
-		     nsys,
-		     cols,
-		     Xdat,
-		     error_message);
-    CreateMatrix_SCC(&(A),
-		     Dtype,
-		     cols,
-		     cols,
-		     nnz,
-		     Ai,
-		     Ap,
-		     Adat,
-		     error_message);
-    
-    //Initialise solver:
-    funcreturn = linalg_initialise(&A,
-				   &options,
-				   &linalg_workspace,
-				   error_message);
-
-    myfile = fopen("testlin_Ax.dat","r");
-    readcount=fread(Ax,sizeof(double),nnz,myfile);
-    printf("Read %d entries.\n",readcount);
-    fclose(myfile);
-    if (Dtype==L_DBL_CX){
-      for (i=0; i<nnz; i++)
-	Axz[i] = Ax[i];
-      myfile = fopen("testlin_Azim.dat","r");
-      readcount=fread(Ax,sizeof(double),nnz,myfile);
-      printf("Read %d entries.\n",readcount);
-      fclose(myfile);
-      for (i=0; i<nnz; i++)
-	Axz[i] += I*Ax[i];
+    if (mat_read_data(argv[1],"h",(void **) &hptr,&cols,&rows,&type) == _SUCCESS_){
+      h = hptr[0];
+      free(hptr);
     }
-
-
-    switch (Dtype){
-    case (L_DBL):
-      myfile = fopen("testlin_bdense.dat","r");
-      readcount=fread(b,sizeof(double),(cols*nsys+1),myfile);
-      printf("Read %d entries from testlin_bdense.\n",readcount);
-      fclose(myfile);
-      break;
-    case (L_DBL_CX):
-      myfile = fopen("testlin_bzrdense.dat","r");
-      readcount=fread(b,sizeof(double),(cols*nsys+1),myfile);
-      printf("Read %d entries from testlin_bdense.\n",readcount);
-      fclose(myfile);
-      for (i=0; i<(cols*nsys+1); i++)
-	bz[i] = b[i];
-      myfile = fopen("testlin_bzidense.dat","r");
-      readcount=fread(b,sizeof(double),(cols*nsys+1),myfile);
-      printf("Read %d entries from testlin_bdense.\n",readcount);
-      fclose(myfile);
-      for (i=0; i<(cols*nsys+1); i++)
-	bz[i] += I*b[i];
-      break;
+  }
+  else{
+    if (argc > 2)
+      vres = atoi(argv[2]);
+    if (argc > 3)
+      repeats = atoi(argv[3]);
+    if (argc > 4)
+      outf = argv[4];
+    if (input_sweep_init(2,argv,&fc,&sweep,&bs,&threads,&nproc,&pin,error_message) == _FAILURE_){
+      printf("\n\nError running input_sweep_init\n=>%s\n",error_message);
+      return _FAILURE_;
     }
-
-    funcreturn = linalg_factorise(linalg_workspace,
-				  _TRUE_,
-				  error_message);
-    if (funcreturn==_FAILURE_){
-      printf("Error: %s\n",error_message);
+    if (vres > 0){
+      for (i=0, found=_FALSE_; i<fc.size; i++){
+	if (strcmp(fc.name[i],"vres") == 0){
+	  sprintf(fc.value[i],"%d",vres);
+	  found = _TRUE_;
+	}
+      }
+      if (found == _FALSE_){
+	printf("vres is not set in %s.\n",argv[1]);
+	return _FAILURE_;
+      }
+    }
+    if (input_sweep_run(&fc,&sweep,0,&bs,&qke_struct,error_message) == _FAILURE_){
+      printf("\n\nError running input_sweep_run\n=>%s\n",error_message);
       return _FAILURE_;
     }
-    funcreturn = linalg_solve(&B, 
-			      &X,
-			      linalg_workspace,
-			      error_message);
-    if (funcreturn==_FAILURE_){
-      printf("Error: %s\n",error_message);
+    n = qke_struct.neq;
+    nnz = qke_struct.Ap[n];
+    Ap = qke_struct.Ap;
+    Ai = qke_struct.Ai;
+    Jx = calloc(nnz,sizeof(double));
+    y = calloc(n,sizeof(double));
+    fval = malloc(sizeof(double)*n);
+    qke_initial_conditions(qke_struct.T_initial,y,&qke_struct);
+    CreateMatrix_SCC(&J,L_DBL,n,n,nnz,Ai,Ap,Jx,error_message);
+    if (qke_jacobian(qke_struct.T_initial,y,fval,&J,&nfe,&qke_struct,error_message) == _FAILURE_){
+      printf("\n\nError running qke_jacobian\n=>%s\n",error_message);
       return _FAILURE_;
     }
-  
-    PrintMultiMatrix(&X,"Solution vector:");
+    DestroyMultiMatrix(&J);
+    h = fabs(qke_struct.T_final-qke_struct.T_initial)/100.0;
+    mat_create_file(outf);
+    mat_add_matrix(outf,"Ap",miINT32,1,n+1,&handle);
+    mat_add_matrix(outf,"Ai",miINT32,1,nnz,&handle);
+    mat_add_matrix(outf,"Jx",miDOUBLE,1,nnz,&handle);
+    mat_add_matrix(outf,"h",miDOUBLE,1,1,&handle);
+    mat_write_data(outf,"Ap",Ap,0,n+1);
+    mat_write_data(outf,"Ai",Ai,0,nnz);
+    mat_write_data(outf,"Jx",Jx,0,nnz);
+    mat_write_data(outf,"h",&h,0,1);
+    printf("Jacobian at T=%g written to %s.\n",qke_struct.T_initial,outf);
+    free(y);
+    free(fval);
+  }
+  printf("%d equations, %d entries, h=%g, %d calls of each routine.\n",n,nnz,h,repeats);
 
+  //The radau5 systems of a step of h:
+  Ax = malloc(sizeof(double)*nnz);
+  Az = malloc(sizeof(double complex)*nnz);
+  CreateMatrix_SCC(&J,L_DBL,n,n,nnz,Ai,Ap,Jx,error_message);
+  CreateMatrix_SCC(&A,L_DBL,n,n,nnz,Ai,Ap,Ax,error_message);
+  CreateMatrix_SCC(&Z,L_DBL_CX,n,n,nnz,Ai,Ap,Az,error_message);
+  update_linear_system_radau5(&J,&A,&Z,h);
 
-    funcreturn = linalg_finalise(linalg_workspace,
-				 error_message);
-    if (funcreturn==_FAILURE_){
+  printf("%-22s %-8s %14s %12s %10s\n","routine","type","seconds/call","calls/s","MFlop/s");
+  if (bench_sparse_lu(n,Ap,Ai,Ax,Az,repeats,residual,error_message) == _FAILURE_){
+    printf("Error: %s\n",error_message);
+    return _FAILURE_;
+  }
+  if (n <= _DENSE_MAX_){
+    Adata = calloc(n*n+1,sizeof(double));
+    Zdata = calloc(n*n+1,sizeof(double complex));
+    for (j=0; j<n; j++){
+      for (p=Ap[j]; p<Ap[j+1]; p++){
+	Adata[1+Ai[p]*n+j] = Ax[p];
+	Zdata[1+Ai[p]*n+j] = Az[p];
+      }
+    }
+    CreateMatrix_DNR(&Adense,L_DBL,n,n,Adata,error_message);
+    CreateMatrix_DNR(&Zdense,L_DBL_CX,n,n,Zdata,error_message);
+    if ((bench_wrapper(LINALG_WRAPPER_DENSE_NR,name[1],&Adense,Ap,Ai,Ax,repeats,
+		       residual+1,error_message) == _FAILURE_)||
+	(bench_wrapper(LINALG_WRAPPER_DENSE_NR,name[1],&Zdense,Ap,Ai,Az,repeats,
+		       residual+1,error_message) == _FAILURE_)){
       printf("Error: %s\n",error_message);
       return _FAILURE_;
     }
-  
-
-    DestroyMultiMatrix(&A);
-    DestroyMultiMatrix(&B);
-    DestroyMultiMatrix(&X);
-    free(Ax);
-    free(b);
-    free(x);
-    free(Ap);
-    free(Ai);
-    free(Axz);
-    free(bz);
-    free(xz);
+    DestroyMultiMatrix(&Adense);
+    DestroyMultiMatrix(&Zdense);
+    free(Adata);
+    free(Zdata);
+  }
+  else
+    printf("%-22s %-8s skipped above %d equations\n",name[1],"",_DENSE_MAX_);
+  if ((bench_wrapper(LINALG_WRAPPER_SPARSE,name[2],&A,Ap,Ai,Ax,repeats,
+		     residual+2,error_message) == _FAILURE_)||
+      (bench_wrapper(LINALG_WRAPPER_SPARSE,name[2],&Z,Ap,Ai,Az,repeats,
+		     residual+2,error_message) == _FAILURE_)||
+      (bench_wrapper(LINALG_WRAPPER_SUPERLU,name[3],&A,Ap,Ai,Ax,repeats,
+		     residual+3,error_message) == _FAILURE_)||
+      (bench_wrapper(LINALG_WRAPPER_SUPERLU,name[3],&Z,Ap,Ai,Az,repeats,
+		     residual+3,error_message) == _FAILURE_)){
+    printf("Error: %s\n",error_message);
+    return _FAILURE_;
+  }
+
+  for (i=0, res=0.0; i<4; i++){
+    if (residual[i] >= 0.0)
+      printf("Backward error, %-9s %.3e\n",name[i],residual[i]);
+    res = max(res,residual[i]);
+  }
+  DestroyMultiMatrix(&J);
+  DestroyMultiMatrix(&A);
+  DestroyMultiMatrix(&Z);
+  free(Jx);
+  free(Ax);
+  free(Az);
+  if (res > _RESIDUAL_MAX_){
+    printf("FAILED: a backward error is above %g.\n",_RESIDUAL_MAX_);
+    return _FAILURE_;
   }
-  return 0;
+  printf("All backward errors below %g.\n",_RESIDUAL_MAX_);
+  return _SUCCESS_;
 }
@@ -1,4 +1,7 @@
 #include "evolver_common.h"
+#include "time.h"
+#include "sparse.h"
+#include <sys/resource.h>
 
 int DefaultEvolverOptions(EvolverOptions *opt, LinAlgWrapper linalg){
   int i;
@@ -7,15 +10,44 @@ int DefaultEvolverOptions(EvolverOptions *opt, LinAlgWrapper linalg){
   extern int linalg_factorise_dense_NR();
   extern int linalg_solve_dense_NR();
 
+  extern int linalg_initialise_dense();
+  extern int linalg_finalise_dense();
+  extern int linalg_factorise_dense();
+  extern int linalg_solve_dense();
+  extern int linalg_solve_many_dense();
+
   extern int linalg_initialise_sparse();
   extern int linalg_finalise_sparse();
   extern int linalg_factorise_sparse();
   extern int linalg_solve_sparse();
+  extern int linalg_solve_many_sparse();
+
+  extern int linalg_initialise_supernodal();
+  extern int linalg_finalise_supernodal();
+  extern int linalg_factorise_supernodal();
+  extern int linalg_solve_supernodal();
+
+  extern int linalg_initialise_gmres();
+  extern int linalg_finalise_gmres();
+  extern int linalg_factorise_gmres();
+  extern int linalg_solve_gmres();
 
   extern int linalg_initialise_SuperLU();
   extern int linalg_finalise_SuperLU();
   extern int linalg_factorise_SuperLU();
   extern int linalg_solve_SuperLU();
+  extern int linalg_solve_many_SuperLU();
+
+  extern int linalg_initialise_cuda();
+  extern int linalg_finalise_cuda();
+  extern int linalg_factorise_cuda();
+  extern int linalg_solve_cuda();
+  extern int linalg_solve_many_cuda();
+
+  extern int linalg_initialise_block();
+  extern int linalg_finalise_block();
+  extern int linalg_factorise_block();
+  extern int linalg_solve_block();
 
   opt->AbsTol=1e-6;
   opt->RelTol=1e-3;  
@@ -23,24 +55,76 @@ int DefaultEvolverOptions(EvolverOptions *opt, LinAlgWrapper linalg){
   opt->t_vec=NULL;
   opt->tres=1;
   opt->Cores=1;
+  opt->DerivsThreads=1;
   opt->EvolverVerbose=1; 
   opt->output=NULL;
   opt->print_variables=NULL;
   opt->stop_function=NULL;
-  for (i=0; i<10; i++){
+  opt->Events=0;
+  opt->event_function=NULL;
+  opt->event_action=NULL;
+  opt->event_direction=NULL;
+  opt->event_terminal=NULL;
+  opt->derivs_workspace_copy=NULL;
+  opt->derivs_workspace_free=NULL;
+  opt->derivs_batch=NULL;
+  opt->jacobian=NULL;
+  opt->derivs_split=NULL;
+  opt->jacobian_implicit=NULL;
+  opt->Blocks=0;
+  opt->BlockSize=0;
+  opt->BlockIndex=NULL;
+  opt->JacobianCheck=_FALSE_;
+  opt->JacobianUpdates=0;
+  opt->SymbolicCache=NULL;
+  opt->MixedPrecision=0;
+  opt->LowMemory=_FALSE_;
+  opt->ComplexAsReal=_FALSE_;
+  opt->LinAlgShared=NULL;
+  opt->tangent=NULL;
+  opt->tangent_output=NULL;
+  opt->Tangents=1;
+  opt->TangentQR=0;
+  opt->tangent_weight=NULL;
+  opt->tangent_growth=NULL;
+  opt->CheckpointFile=NULL;
+  opt->CheckpointInterval=0;
+  opt->Restart=_FALSE_;
+  opt->checkpoint_state=NULL;
+  opt->HistoryFile=NULL;
+  opt->WarmStart=_FALSE_;
+  for (i=0; i<_EVOLVER_STATS_; i++)
     opt->Stats[i]= 0;
+  for (i=0; i<10; i++)
     opt->Flags[i]= 0;
-  }
   opt->LinAlgVerbose=1;
   opt->Ap = NULL;
   opt->Ai = NULL;
   opt->J_pointer_flag = _FALSE_;
+  opt->Timing = _FALSE_;
+  for (i=0; i<_EVOLVER_TIMERS_; i++){
+    opt->Time[i] = 0.0;
+    opt->TimeCalls[i] = 0;
+  }
+  opt->ProgressFile = NULL;
+  opt->ProgressInterval = 0.0;
+  opt->ProgressIndex = -1;
+  opt->ProgressScale = 1.0;
   switch (linalg){
   case (LINALG_WRAPPER_DENSE_NR):
     opt->linalg_initialise=linalg_initialise_dense_NR;
     opt->linalg_finalise=linalg_finalise_dense_NR;
     opt->linalg_factorise=linalg_factorise_dense_NR;
     opt->linalg_solve=linalg_solve_dense_NR;
+    opt->linalg_solve_many=linalg_solve_dense_NR;
+    opt->use_sparse = _FALSE_;
+    break;
+  case (LINALG_WRAPPER_DENSE):
+    opt->linalg_initialise=linalg_initialise_dense;
+    opt->linalg_finalise=linalg_finalise_dense;
+    opt->linalg_factorise=linalg_factorise_dense;
+    opt->linalg_solve=linalg_solve_dense;
+    opt->linalg_solve_many=linalg_solve_many_dense;
     opt->use_sparse = _FALSE_;
     break;
   case (LINALG_WRAPPER_SPARSE):
@@ -48,6 +132,23 @@ int DefaultEvolverOptions(EvolverOptions *opt, LinAlgWrapper linalg){
     opt->linalg_finalise=linalg_finalise_sparse;
     opt->linalg_factorise=linalg_factorise_sparse;
     opt->linalg_solve=linalg_solve_sparse;
+    opt->linalg_solve_many=linalg_solve_many_sparse;
+    opt->use_sparse = _TRUE_;
+    break;
+  case (LINALG_WRAPPER_SUPERNODAL):
+    opt->linalg_initialise=linalg_initialise_supernodal;
+    opt->linalg_finalise=linalg_finalise_supernodal;
+    opt->linalg_factorise=linalg_factorise_supernodal;
+    opt->linalg_solve=linalg_solve_supernodal;
+    opt->linalg_solve_many=linalg_solve_supernodal;
+    opt->use_sparse = _TRUE_;
+    break;
+  case (LINALG_WRAPPER_GMRES):
+    opt->linalg_initialise=linalg_initialise_gmres;
+    opt->linalg_finalise=linalg_finalise_gmres;
+    opt->linalg_factorise=linalg_factorise_gmres;
+    opt->linalg_solve=linalg_solve_gmres;
+    opt->linalg_solve_many=linalg_solve_gmres;
     opt->use_sparse = _TRUE_;
     break;
 #ifdef _SUPERLU
@@ -56,14 +157,34 @@ int DefaultEvolverOptions(EvolverOptions *opt, LinAlgWrapper linalg){
     opt->linalg_finalise=linalg_finalise_SuperLU;
     opt->linalg_factorise=linalg_factorise_SuperLU;
     opt->linalg_solve=linalg_solve_SuperLU;
+    opt->linalg_solve_many=linalg_solve_many_SuperLU;
       opt->use_sparse = _TRUE_;
     break;
 #endif
+#ifdef _CUDA
+  case (LINALG_WRAPPER_CUDA):
+    opt->linalg_initialise=linalg_initialise_cuda;
+    opt->linalg_finalise=linalg_finalise_cuda;
+    opt->linalg_factorise=linalg_factorise_cuda;
+    opt->linalg_solve=linalg_solve_cuda;
+    opt->linalg_solve_many=linalg_solve_many_cuda;
+    opt->use_sparse = _TRUE_;
+    break;
+#endif
+  case (LINALG_WRAPPER_BLOCK):
+    opt->linalg_initialise=linalg_initialise_block;
+    opt->linalg_finalise=linalg_finalise_block;
+    opt->linalg_factorise=linalg_factorise_block;
+    opt->linalg_solve=linalg_solve_block;
+    opt->linalg_solve_many=linalg_solve_block;
+    opt->use_sparse = _TRUE_;
+    break;
   default:
     opt->linalg_initialise=NULL;
     opt->linalg_finalise=NULL;
     opt->linalg_factorise=NULL;
     opt->linalg_solve=NULL;
+    opt->linalg_solve_many=NULL;
     opt->use_sparse = _FALSE_;
     break;
   }
@@ -74,9 +195,144 @@ int DefaultEvolverOptions(EvolverOptions *opt, LinAlgWrapper linalg){
 
 /**********************************************************************/
 /* Here are some routines related to the calculation of the jacobian: */
-/* "numjac", "initialize_jacobian", "uninitialize_jacobian",					*/
+/* "evolver_jacobian", "numjac",                                      */
 /* "initialize_numjac_workspace", "uninitialize_numjac_workspace".		*/
 /**********************************************************************/
+int evolver_jacobian(int (*derivs)(double x, 
+				   double * y,
+				   double * dy, 
+				   void * parameters_and_workspace, 
+				   ErrorMsg error_message),
+		     double t, 
+		     double *y, 
+		     double *fval,
+		     MultiMatrix* J, 
+		     void *numjac_workspace,
+		     double thresh, 
+		     size_t neq, 
+		     int *nfe,
+		     EvolverOptions *options,
+		     void * parameters_and_workspace_for_derivs,
+		     ErrorMsg error_message){
+  /* Computes the jacobian using options->jacobian if it is available, and
+     numjac otherwise. y and fval are 1-based like in numjac. If
+     options->JacobianCheck is set, the analytic jacobian is compared with
+     numjac and the largest deviation is printed. The analytic values are
+     kept. The time spent is the _TIME_JACOBIAN_ phase. */
+  DNRformat *StoreDNR;
+  SCCformat *StoreSCC;
+  double *Ax, *Ax_analytic;
+  double maxdif, maxval;
+  int i, n, imax;
+  double t0 = evolver_tic(options->Timing);
+
+  if (options->jacobian == NULL){
+    lasagna_call(numjac(derivs,t,y,fval,J,numjac_workspace,thresh,neq,nfe,
+			parameters_and_workspace_for_derivs,error_message),
+		 error_message,error_message);
+    evolver_toc(options->Timing,options->Time[_TIME_JACOBIAN_],
+		options->TimeCalls[_TIME_JACOBIAN_],t0);
+    return _SUCCESS_;
+  }
+
+  lasagna_call(options->jacobian(t,y+1,fval+1,J,nfe,
+				 parameters_and_workspace_for_derivs,
+				 error_message),
+	       error_message,error_message);
+
+  if (options->JacobianCheck == _TRUE_){
+    if (J->Stype == L_SCC){
+      StoreSCC = J->Store;
+      Ax = StoreSCC->Ax;
+      n = StoreSCC->Ap[neq];
+    }
+    else{
+      StoreDNR = J->Store;
+      Ax = StoreDNR->Data;
+      n = neq*neq+1;
+    }
+    lasagna_alloc(Ax_analytic,sizeof(double)*n,error_message);
+    memcpy(Ax_analytic,Ax,sizeof(double)*n);
+    lasagna_call(numjac(derivs,t,y,fval,J,numjac_workspace,thresh,neq,nfe,
+			parameters_and_workspace_for_derivs,error_message),
+		 error_message,error_message);
+    maxdif = 0.0;
+    maxval = 0.0;
+    imax = 0;
+    for (i=0; i<n; i++){
+      maxval = max(maxval,fabs(Ax[i]));
+      if (fabs(Ax_analytic[i]-Ax[i]) > maxdif){
+	maxdif = fabs(Ax_analytic[i]-Ax[i]);
+	imax = i;
+      }
+    }
+    printf("Jacobian check at t=%g: max|J-J_numjac| = %g at entry %d (J=%g, J_numjac=%g), max|J_numjac| = %g.\n",
+	   t,maxdif,imax,Ax_analytic[imax],Ax[imax],maxval);
+    memcpy(Ax,Ax_analytic,sizeof(double)*n);
+    free(Ax_analytic);
+  }
+  evolver_toc(options->Timing,options->Time[_TIME_JACOBIAN_],
+	      options->TimeCalls[_TIME_JACOBIAN_],t0);
+  return _SUCCESS_;
+}
+
+static void numjac_column_in(struct numjac_workspace *nj_ws,
+			     int Stype,
+			     double *y,
+			     int j,
+			     double *yy){
+  /* The state at which derivs is evaluated for column j, in yy[1..neq]:
+     y plus del of column j-1 or of all the columns in group j-1. */
+  int i;
+  for(i=1;i<=nj_ws->neq;i++)
+    yy[i] = y[i];
+  if (Stype == L_SCC){
+    for(i=nj_ws->group_ptr[j-1];i<nj_ws->group_ptr[j];i++)
+      yy[nj_ws->group_col[i]+1] += nj_ws->del[nj_ws->group_col[i]+1];
+  }
+  else
+    yy[j] += nj_ws->del[j];
+}
+
+static void numjac_column_out(struct numjac_workspace *nj_ws,
+			      int Stype,
+			      int *Ap,
+			      int *Ai,
+			      double *Ax,
+			      double *fval,
+			      int j,
+			      double *ff){
+  /* Stores derivs at the state of column j, ff[1..neq]. The dense case
+     keeps it for the end of numjac. The sparse one forms the columns of
+     group j-1 of the jacobian and their max-value arrays right away. */
+  double Fdiff_absrm,Fdiff_new;
+  int i,k,col,row;
+  if (Stype == L_DNR){
+    for(i=1;i<=nj_ws->neq;i++) 
+      nj_ws->ydel_Fdel[i][j] = ff[i];
+    return;
+  }
+  for(k=nj_ws->group_ptr[j-1];k<nj_ws->group_ptr[j];k++){
+    col = nj_ws->group_col[k];
+    Fdiff_new = 0.0;
+    Fdiff_absrm = 0.0;
+    for(i=Ap[col];i<Ap[col+1];i++){
+      /* Loop over rows in the sparse matrix */
+      row = Ai[i]+1;
+      Fdiff_absrm = max(Fdiff_absrm,fabs(Fdiff_new));
+      Fdiff_new = ff[row]-fval[row];
+      if (fabs(Fdiff_new)>=Fdiff_absrm){
+	nj_ws->Rowmax[col+1] = row;
+	nj_ws->Difmax[col+1] = Fdiff_new;
+      }
+      /* Assign value to sparse rep of jacobian: */
+      Ax[i] = Fdiff_new/nj_ws->del[col+1];
+    }
+    /* The maximum numerical value of Fdel in true column col+1*/
+    nj_ws->absFdelRm[col+1] = fabs(ff[nj_ws->Rowmax[col+1]]);
+  }
+}
+
 int numjac(int (*derivs)(double x, 
 			 double * y,
 			 double * dy, 
@@ -99,15 +355,14 @@ int numjac(int (*derivs)(double x,
   struct numjac_workspace *nj_ws=numjac_workspace;
   double eps=DBL_EPSILON, br=pow(eps,0.875),bl=pow(eps,0.75),bu=pow(eps,0.25);
   double facmin=pow(eps,0.78),facmax=0.1;
-  int logjpos, pattern_broken;
+  int logjpos;
   double tmpfac,difmax2=0.,del2,ffscale;
-  int i,j,rowmax2;
+  int i,j,k,j0,mbatch,rowmax2;
   double maxval1,maxval2;
-  int colmax,group,row,nz,nz2;
+  int colmax=0;
   double Fdiff_absrm,Fdiff_new;
-  double **dFdy,*fac, *Ax;
+  double **dFdy=NULL,*fac, *Ax=NULL;
   int *Ap=NULL, *Ai=NULL;
-  FILE *jacfile;
   SCCformat *StoreSCC;
   DNRformat *StoreDNR;
 
@@ -155,45 +410,69 @@ int numjac(int (*derivs)(double x,
     Ap = StoreSCC->Ap;
     Ai = StoreSCC->Ai;
     Ax = (double*) StoreSCC->Ax;
-    //printf("Sparse calculation..neq=%d, has grouping=%d\n",neq,jac->has_grouping);
-    //printf("jac->pattern_supplied = %d\n",jac->pattern_supplied);
     colmax = nj_ws->max_group+1;
-    //printf("->groups=%d/%d.\n",colmax,neq);
-    for(j=1;j<=colmax;j++){
-      /*loop over groups */
-      group = j-1;
-      for(i=1;i<=neq;i++){
-	/*Add y-vector.. */
-	nj_ws->ydel_Fdel[i][j] = y[i];
-	/*Add del of all groupmembers:*/
-	if(nj_ws->col_group[i-1]==group) 
-	  nj_ws->ydel_Fdel[i][j] +=nj_ws->del[i];
-      }
-    }
     break;
   case(L_DNR):
     //Ordinary dense method
     StoreDNR = J->Store;
     dFdy = (double **)StoreDNR->Matrix; /* Assign pointer to dfdy directly for easier notation. */
-    //printf("Normal calculation...\n");
-    /*Normal calculation: */
     colmax = neq;
-    for(j=1;j<=neq;j++){
-      for(i=1;i<=neq;i++){
-	nj_ws->ydel_Fdel[i][j] = y[i];
-      }
-      nj_ws->ydel_Fdel[j][j] += nj_ws->del[j];
-    }
-
     break;
   }
 
   /* The next section should work regardless of sparse...*/
-  /* Evaluate the function at y+delta vectors:*/
-  for(j=1;j<=colmax;j++){
-    for(i=1;i<=neq;i++){
-      nj_ws->yydel[i] = nj_ws->ydel_Fdel[i][j];
+  /* Evaluate the function at y+delta vectors. Column j is a column of
+     the dense Jacobian, or group j-1 of the sparse one, which is scattered
+     into Ax at once:*/
+  if ((nj_ws->derivs_batch != NULL)&&(nj_ws->threads <= 1)){
+    /* Up to _NUMJAC_BATCH_ columns per call, so derivs can share the
+       work that does not depend on y: */
+    for(j0=1;j0<=colmax;j0+=_NUMJAC_BATCH_){
+      mbatch = min(_NUMJAC_BATCH_,colmax-j0+1);
+      for(k=0;k<mbatch;k++)
+	numjac_column_in(nj_ws,J->Stype,y,j0+k,nj_ws->ybatch_ptr[k]-1);
+      lasagna_call((*nj_ws->derivs_batch)(t,
+					  nj_ws->ybatch_ptr,
+					  nj_ws->fbatch_ptr,
+					  mbatch,
+					  parameters_and_workspace_for_derivs,
+					  error_message),
+		   error_message,error_message);
+      for(k=0;k<mbatch;k++)
+	numjac_column_out(nj_ws,J->Stype,Ap,Ai,Ax,fval,j0+k,nj_ws->fbatch_ptr[k]-1);
+    }
+    *nfe+=colmax;
+  }
+  else
+#ifdef _OPENMP
+  if (nj_ws->threads > 1){
+    /* The columns are independent, so each thread evaluates a contiguous
+       range of them using its own copy of the derivs workspace: */
+    int abort = _FALSE_;
+#pragma omp parallel for num_threads(nj_ws->threads) schedule(static)
+    for(j=1;j<=colmax;j++){
+      int tid = omp_get_thread_num();
+      double *yy = nj_ws->yydel_thread[tid];
+      double *ff = nj_ws->ffdel_thread[tid];
+      ErrorMsg thread_error_message;
+      if (abort == _TRUE_) continue;
+      numjac_column_in(nj_ws,J->Stype,y,j,yy);
+      lasagna_call_parallel((*derivs)(t,
+				      yy+1,
+				      ff+1,
+				      nj_ws->derivs_workspace[tid],
+				      thread_error_message),
+			    thread_error_message,error_message);
+      /* The groups have no column in common, so neither do the writes: */
+      numjac_column_out(nj_ws,J->Stype,Ap,Ai,Ax,fval,j,ff);
     }
+    if (abort == _TRUE_) return _FAILURE_;
+    *nfe+=colmax;
+  }
+  else
+#endif
+  for(j=1;j<=colmax;j++){
+    numjac_column_in(nj_ws,J->Stype,y,j,nj_ws->yydel);
     lasagna_call((*derivs)(t,
 			   nj_ws->yydel+1,
 			   nj_ws->ffdel+1,
@@ -202,40 +481,12 @@ int numjac(int (*derivs)(double x,
 		 error_message,error_message);
 
     *nfe+=1;
-    for(i=1;i<=neq;i++) 
-      nj_ws->ydel_Fdel[i][j] = nj_ws->ffdel[i];
+    numjac_column_out(nj_ws,J->Stype,Ap,Ai,Ax,fval,j,nj_ws->ffdel);
   }
 
-  switch(J->Stype){
-  case(L_SCC):
+  if (J->Stype == L_DNR){
     /*Using the Fdel array, form the jacobian and construct max-value arrays.
-      First we do it for the sparse case, then for the normal case:*/
-    /* Sparse case:*/
-    for(j=0;j<neq;j++){
-      /*Loop over columns, and assign corresponding group:*/
-      group = nj_ws->col_group[j];
-      Fdiff_new = 0.0;
-      Fdiff_absrm = 0.0;
-      
-      for(i=Ap[j];i<Ap[j+1];i++){
-	/* Loop over rows in the sparse matrix */
-	row = Ai[i]+1;
-	/* Do I want to construct the full jacobian? No, that is ugly..*/
-	Fdiff_absrm = max(Fdiff_absrm,fabs(Fdiff_new));
-	Fdiff_new = nj_ws->ydel_Fdel[row][group+1]-fval[row]; /*Remember to access the column of the corresponding group */
-	if (fabs(Fdiff_new)>=Fdiff_absrm){
-	  nj_ws->Rowmax[j+1] = row;
-	  nj_ws->Difmax[j+1] = Fdiff_new;
-	}
-	/* Assign value to sparse rep of jacobian: */
-	Ax[i] = Fdiff_new/nj_ws->del[j+1];
-      }
-      /* The maximum numerical value of Fdel in true column j+1*/
-      nj_ws->absFdelRm[j+1] = fabs(nj_ws->ydel_Fdel[nj_ws->Rowmax[j+1]][group+1]);
-    }
-    break;
-  case(L_DNR):
-    /*Normal case:*/
+      The sparse case was done by numjac_column_out:*/
     for(j=1;j<=neq;j++){
       Fdiff_new = 0.0;
       Fdiff_absrm = 0.0;
@@ -347,6 +598,94 @@ int numjac(int (*derivs)(double x,
   return _SUCCESS_;
 } /* End of numjac */
 
+int evolver_sparsity_pattern(int (*derivs)(double x,
+					   double * y,
+					   double * dy,
+					   void * parameters_and_workspace,
+					   ErrorMsg error_message),
+			     void * parameters_and_workspace_for_derivs,
+			     double *t_sample,
+			     int samples,
+			     double *y0,
+			     size_t neq,
+			     double thresh,
+			     int pad,
+			     unsigned int seed,
+			     int **Ap,
+			     int **Ai,
+			     ErrorMsg error_message){
+  /* Finds the pattern of the Jacobian of derivs by probing, for systems
+     without a hand-made one. At each t_sample, the state is y0 moved by a
+     random 1% of max(|y0_i|,thresh) in each component, and then each y_j
+     in turn by a further random 0.1%. Row i is in column j if f_i changes
+     at all, in any of the samples. The random state avoids couplings that
+     vanish at y0 by symmetry or because a component is zero. The pattern
+     gets the diagonal, and with pad>0 each entry (i,j) adds (i,j-pad)
+     to (i,j+pad) for stencils wider than the probes saw. *Ap and *Ai are
+     allocated here, in SCC form, for options->Ap and options->Ai. */
+  char *mark;
+  double *yb, *fb, *yp, *fp, scale, del;
+  int s, i, j, k, nz;
+
+  lasagna_test(samples < 1, error_message, "The pattern needs at least one sample.");
+  lasagna_calloc(mark,neq*neq,sizeof(char),error_message);
+  lasagna_alloc(yb,sizeof(double)*4*neq,error_message);
+  fb = yb+neq;
+  yp = fb+neq;
+  fp = yp+neq;
+  for (s=0; s<samples; s++){
+    for (i=0; i<neq; i++){
+      scale = max(fabs(y0[i]),thresh);
+      yb[i] = y0[i]+0.01*scale*(2.0*rand_r(&seed)/((double) RAND_MAX)-1.0);
+    }
+    lasagna_call((*derivs)(t_sample[s],yb,fb,parameters_and_workspace_for_derivs,
+			   error_message),
+		 error_message,error_message);
+    memcpy(yp,yb,sizeof(double)*neq);
+    for (j=0; j<neq; j++){
+      scale = max(fabs(yb[j]),thresh);
+      del = 0.001*scale*(1.0+rand_r(&seed)/((double) RAND_MAX));
+      yp[j] = yb[j]+del;
+      lasagna_call((*derivs)(t_sample[s],yp,fp,parameters_and_workspace_for_derivs,
+			     error_message),
+		   error_message,error_message);
+      yp[j] = yb[j];
+      for (i=0; i<neq; i++){
+	if (fp[i] != fb[i])
+	  mark[j*neq+i] = 1;
+      }
+    }
+  }
+  for (j=0; j<neq; j++)
+    mark[j*neq+j] = 1;
+  /** Padding, column j gets the rows of columns j-pad..j+pad, marked by 2: */
+  for (j=0; (pad>0)&&(j<neq); j++){
+    for (k=max(0,j-pad); k<min((int) neq,j+pad+1); k++){
+      for (i=0; (k!=j)&&(i<neq); i++){
+	if ((mark[k*neq+i] == 1)&&(mark[j*neq+i] == 0))
+	  mark[j*neq+i] = 2;
+      }
+    }
+  }
+  for (j=0, nz=0; j<neq*neq; j++)
+    if (mark[j] != 0) nz++;
+  lasagna_alloc(*Ap,sizeof(int)*(neq+1),error_message);
+  lasagna_alloc(*Ai,sizeof(int)*nz,error_message);
+  (*Ap)[0] = 0;
+  for (j=0, nz=0; j<neq; j++){
+    for (i=0; i<neq; i++){
+      if (mark[j*neq+i] != 0){
+	(*Ai)[nz] = i;
+	nz++;
+      }
+    }
+    (*Ap)[j+1] = nz;
+  }
+  free(mark);
+  free(yb);
+  return _SUCCESS_;
+}
+
 
 int initialize_numjac_workspace(MultiMatrix *J,
 				void **numjac_workspace,
@@ -370,11 +709,15 @@ int initialize_numjac_workspace(MultiMatrix *J,
   lasagna_alloc(nj_ws->yydel,sizeof(double)*neqp,error_message);
   lasagna_alloc(nj_ws->tmp,sizeof(double)*neqp,error_message);
 	
-  /* Allocate vector of pointers to rows of matrix.*/
-  lasagna_alloc(nj_ws->ydel_Fdel,sizeof(double*)*(neq+1),error_message); 
-  lasagna_alloc(nj_ws->ydel_Fdel[1],sizeof(double)*(neq*neq+1),error_message);
-  nj_ws->ydel_Fdel[0] = NULL;
-  for(i=2;i<=neq;i++) nj_ws->ydel_Fdel[i] = nj_ws->ydel_Fdel[i-1]+neq; /* Set row pointers... */ 
+  /* Allocate vector of pointers to rows of matrix. A sparse Jacobian
+     scatters each group as soon as it is evaluated, so it needs none: */
+  nj_ws->ydel_Fdel = NULL;
+  if (J->Stype==L_DNR){
+    lasagna_alloc(nj_ws->ydel_Fdel,sizeof(double*)*(neq+1),error_message); 
+    lasagna_alloc(nj_ws->ydel_Fdel[1],sizeof(double)*(neq*neq+1),error_message);
+    nj_ws->ydel_Fdel[0] = NULL;
+    for(i=2;i<=neq;i++) nj_ws->ydel_Fdel[i] = nj_ws->ydel_Fdel[i-1]+neq; /* Set row pointers... */ 
+  }
 	
   lasagna_alloc(nj_ws->logj,sizeof(int)*neqp,error_message);
   lasagna_alloc(nj_ws->Rowmax,sizeof(int)*neqp,error_message);
@@ -382,18 +725,152 @@ int initialize_numjac_workspace(MultiMatrix *J,
   /* Initialize jacvec to sqrt(eps):*/
   for (i=1;i<=neq;i++) nj_ws->jacvec[i]=1.490116119384765597872e-8;
   nj_ws->col_group = NULL;
+  nj_ws->group_ptr = NULL;
+  nj_ws->group_col = NULL;
   if (J->Stype==L_SCC){
     StoreSCC = J->Store;
     lasagna_alloc(nj_ws->col_group, sizeof(int)*neq, error_message);
     nj_ws->max_group = get_column_grouping(StoreSCC->Ap, StoreSCC->Ai, 
 					  neq, nj_ws->col_group, nj_ws->Rowmax);
+    /* The columns of each group, in increasing order: */
+    lasagna_calloc(nj_ws->group_ptr, nj_ws->max_group+2, sizeof(int), error_message);
+    lasagna_alloc(nj_ws->group_col, sizeof(int)*neq, error_message);
+    for (i=0; i<neq; i++)
+      nj_ws->group_ptr[nj_ws->col_group[i]+1]++;
+    for (i=0; i<=nj_ws->max_group; i++)
+      nj_ws->group_ptr[i+1] += nj_ws->group_ptr[i];
+    for (i=0; i<neq; i++)
+      nj_ws->group_col[nj_ws->group_ptr[nj_ws->col_group[i]]++] = i;
+    for (i=nj_ws->max_group; i>0; i--)
+      nj_ws->group_ptr[i] = nj_ws->group_ptr[i-1];
+    nj_ws->group_ptr[0] = 0;
   }
+  nj_ws->neq = neq;
+  nj_ws->threads = 1;
+  nj_ws->derivs_workspace = NULL;
+  nj_ws->derivs_batch = NULL;
+  nj_ws->ybatch = NULL;
+  nj_ws->yydel_thread = NULL;
+  nj_ws->ffdel_thread = NULL;
+  nj_ws->derivs_workspace_free = NULL;
   *numjac_workspace = (void *) nj_ws;
   return _SUCCESS_;
 }
 
+int initialize_numjac_threads(void *numjac_workspace,
+			      EvolverOptions *options,
+			      void * parameters_and_workspace_for_derivs,
+			      ErrorMsg error_message){
+  /* Prepare numjac for evaluating column groups on options->Cores threads.
+     Every thread but the first gets a private copy of the derivs workspace,
+     since derivs uses it as scratch space. Without OpenMP or without the
+     copy/free functions numjac stays serial. If derivs is threaded itself,
+     the cores are shared out: each column thread gets DerivsThreads. */
+  struct numjac_workspace * nj_ws = numjac_workspace;
+  int threads, tid;
+  size_t neqp = nj_ws->neq+1;
+
+  threads = options->Cores/max(options->DerivsThreads,1);
+#ifndef _OPENMP
+  threads = 1;
+#endif
+  if ((options->derivs_workspace_copy == NULL)||
+      (options->derivs_workspace_free == NULL))
+    threads = 1;
+  if (threads <= 1)
+    return _SUCCESS_;
+
+  lasagna_alloc(nj_ws->derivs_workspace,sizeof(void*)*threads,error_message);
+  lasagna_alloc(nj_ws->yydel_thread,sizeof(double*)*threads,error_message);
+  lasagna_alloc(nj_ws->ffdel_thread,sizeof(double*)*threads,error_message);
+  nj_ws->derivs_workspace[0] = parameters_and_workspace_for_derivs;
+  nj_ws->yydel_thread[0] = nj_ws->yydel;
+  nj_ws->ffdel_thread[0] = nj_ws->ffdel;
+  for (tid=1; tid<threads; tid++){
+    lasagna_call(options->derivs_workspace_copy(parameters_and_workspace_for_derivs,
+						&(nj_ws->derivs_workspace[tid]),
+						error_message),
+		 error_message,error_message);
+    lasagna_alloc(nj_ws->yydel_thread[tid],sizeof(double)*neqp,error_message);
+    lasagna_alloc(nj_ws->ffdel_thread[tid],sizeof(double)*neqp,error_message);
+  }
+  nj_ws->derivs_workspace_free = options->derivs_workspace_free;
+  nj_ws->threads = threads;
+#ifdef _OPENMP
+  if (options->DerivsThreads > 1)
+    omp_set_max_active_levels(max(omp_get_max_active_levels(),2));
+#endif
+  if (options->EvolverVerbose > 1)
+    printf("numjac: evaluating columns on %d threads.\n",threads);
+  return _SUCCESS_;
+}
+
+int reset_numjac_workspace(void *numjac_workspace,
+			   EvolverOptions *options,
+			   void * parameters_and_workspace_for_derivs,
+			   ErrorMsg error_message){
+  /* Prepares a numjac workspace for a new integration. The column grouping
+     only depends on the pattern and is kept, the increments are reset to
+     sqrt(eps) and the thread copies are taken again from the workspace of
+     the new integration. */
+  struct numjac_workspace * nj_ws = numjac_workspace;
+  int i;
+
+  for (i=1;i<=nj_ws->neq;i++) nj_ws->jacvec[i]=1.490116119384765597872e-8;
+  lasagna_call(refresh_numjac_threads(nj_ws, options,
+				      parameters_and_workspace_for_derivs,
+				      error_message),
+	       error_message,error_message);
+
+  nj_ws->derivs_batch = options->derivs_batch;
+  if ((nj_ws->derivs_batch != NULL)&&(nj_ws->ybatch == NULL)){
+    lasagna_alloc(nj_ws->ybatch,sizeof(double)*_NUMJAC_BATCH_*nj_ws->neq,error_message);
+    lasagna_alloc(nj_ws->fbatch,sizeof(double)*_NUMJAC_BATCH_*nj_ws->neq,error_message);
+    lasagna_alloc(nj_ws->ybatch_ptr,sizeof(double*)*_NUMJAC_BATCH_,error_message);
+    lasagna_alloc(nj_ws->fbatch_ptr,sizeof(double*)*_NUMJAC_BATCH_,error_message);
+    for (i=0; i<_NUMJAC_BATCH_; i++){
+      nj_ws->ybatch_ptr[i] = nj_ws->ybatch+i*nj_ws->neq;
+      nj_ws->fbatch_ptr[i] = nj_ws->fbatch+i*nj_ws->neq;
+    }
+  }
+  return _SUCCESS_;
+}
+
+int refresh_numjac_threads(void *numjac_workspace,
+			   EvolverOptions *options,
+			   void * parameters_and_workspace_for_derivs,
+			   ErrorMsg error_message){
+  /* Takes the thread copies of the derivs workspace again, so that they
+     start from the current state of the callers workspace. */
+  struct numjac_workspace * nj_ws = numjac_workspace;
+  int tid;
+
+  if (nj_ws->threads > 1){
+    for (tid=1; tid<nj_ws->threads; tid++){
+      lasagna_call(nj_ws->derivs_workspace_free(nj_ws->derivs_workspace[tid],error_message),
+		   error_message,error_message);
+      free(nj_ws->yydel_thread[tid]);
+      free(nj_ws->ffdel_thread[tid]);
+    }
+    free(nj_ws->derivs_workspace);
+    free(nj_ws->yydel_thread);
+    free(nj_ws->ffdel_thread);
+    nj_ws->threads = 1;
+    nj_ws->derivs_workspace = NULL;
+    nj_ws->yydel_thread = NULL;
+    nj_ws->ffdel_thread = NULL;
+  }
+  lasagna_call(initialize_numjac_threads(nj_ws, options,
+					 parameters_and_workspace_for_derivs,
+					 error_message),
+	       error_message,error_message);
+  return _SUCCESS_;
+}
+
 int uninitialize_numjac_workspace(void *numjac_workspace){
   struct numjac_workspace * nj_ws = numjac_workspace;
+  ErrorMsg error_message;
+  int tid;
   /* Deallocate vectors and matrices: */
   free(nj_ws->jacvec);
   free(nj_ws->yscale);
@@ -407,14 +884,430 @@ int uninitialize_numjac_workspace(void *numjac_workspace){
   free(nj_ws->yydel);
   free(nj_ws->tmp);
 
-  free(nj_ws->ydel_Fdel[1]);
-  free(nj_ws->ydel_Fdel);
+  if (nj_ws->ydel_Fdel != NULL){
+    free(nj_ws->ydel_Fdel[1]);
+    free(nj_ws->ydel_Fdel);
+  }
   free(nj_ws->logj);
   free(nj_ws->Rowmax);
 
-  if (nj_ws->col_group != NULL)
+  if (nj_ws->col_group != NULL){
     free(nj_ws->col_group);
+    free(nj_ws->group_ptr);
+    free(nj_ws->group_col);
+  }
+
+  if (nj_ws->ybatch != NULL){
+    free(nj_ws->ybatch);
+    free(nj_ws->fbatch);
+    free(nj_ws->ybatch_ptr);
+    free(nj_ws->fbatch_ptr);
+  }
+
+  if (nj_ws->threads > 1){
+    for (tid=1; tid<nj_ws->threads; tid++){
+      nj_ws->derivs_workspace_free(nj_ws->derivs_workspace[tid],error_message);
+      free(nj_ws->yydel_thread[tid]);
+      free(nj_ws->ffdel_thread[tid]);
+    }
+    free(nj_ws->derivs_workspace);
+    free(nj_ws->yydel_thread);
+    free(nj_ws->ffdel_thread);
+  }
 
   free(nj_ws);
   return _SUCCESS_;
 }
+
+/**********************************************************************/
+/* Events of ndf15 and radau5: "evolver_events_init",                 */
+/* "evolver_events_free", "evolver_events_locate".                    */
+/**********************************************************************/
+
+int evolver_events_init(struct evolver_events *events,
+			EvolverOptions *options,
+			size_t neq,
+			ErrorMsg error_message){
+  /* Sets events->n to 0 if there are no events. */
+  int n = max(options->Events,0);
+
+  events->n = n;
+  events->neq = neq;
+  if (n == 0)
+    return _SUCCESS_;
+  lasagna_test(options->event_function == NULL, error_message,
+	       "Events need options->event_function.");
+  lasagna_alloc(events->g_left,sizeof(double)*(4*n+2*neq),error_message);
+  events->g_right = events->g_left+n;
+  events->g = events->g_right+n;
+  events->t_root = events->g+n;
+  events->y = events->t_root+n;
+  events->y_event = events->y+neq;
+  lasagna_alloc(events->found,sizeof(int)*n,error_message);
+  return _SUCCESS_;
+}
+
+int evolver_events_free(struct evolver_events *events){
+  if (events->n == 0)
+    return _SUCCESS_;
+  free(events->g_left);
+  free(events->found);
+  return _SUCCESS_;
+}
+
+int evolver_events_locate(struct evolver_events *events,
+			  EvolverOptions *options,
+			  double t_left,
+			  double t_right,
+			  int (*interp)(double t, double *y, void *interp_data),
+			  void *interp_data,
+			  void * parameters_and_workspace_for_derivs,
+			  int *stop,
+			  ErrorMsg error_message){
+  /* Finds the events of the step from t_left to t_right, where interp
+     gives the dense output, by the Illinois variant of regula falsi.
+     The root is the first point found where the value has its new sign,
+     so an event is not found again in the next step. The events are then
+     handled in the order in which they occur, up to the first terminal
+     one, which is returned in t_event and y_event with stop=_TRUE_. */
+  int e, first, it, side, dir, n=events->n;
+  double a, b, c, ga, gb, gc, tol, tdir;
+  void *p = parameters_and_workspace_for_derivs;
+
+  *stop = _FALSE_;
+  if (n == 0)
+    return _SUCCESS_;
+  tdir = (t_right > t_left ? 1.0 : -1.0);
+  tol = max(4.0*DBL_EPSILON*max(fabs(t_left),fabs(t_right)),
+	    1e-12*fabs(t_right-t_left));
+  lasagna_call(interp(t_left,events->y,interp_data),error_message,error_message);
+  lasagna_call(options->event_function(t_left,events->y,events->g_left,p,error_message),
+	       error_message,error_message);
+  lasagna_call(interp(t_right,events->y,interp_data),error_message,error_message);
+  lasagna_call(options->event_function(t_right,events->y,events->g_right,p,error_message),
+	       error_message,error_message);
+  for (e=0; e<n; e++){
+    events->found[e] = _FALSE_;
+    dir = (options->event_direction == NULL ? 0 : options->event_direction[e]);
+    ga = events->g_left[e];
+    gb = events->g_right[e];
+    if (!(((dir >= 0)&&(ga < 0.0)&&(gb >= 0.0))||((dir <= 0)&&(ga > 0.0)&&(gb <= 0.0))))
+      continue;
+    /** [a,b] keeps the sign change, with b on the side of the new sign: */
+    a = t_left;
+    b = t_right;
+    side = 0;
+    for (it=0; (it<_EVENT_ITER_MAX_)&&(gb != 0.0)&&(fabs(b-a) > tol); it++){
+      c = b-gb*(b-a)/(gb-ga);
+      if (!((c-a)*tdir > 0.0)||!((b-c)*tdir > 0.0))
+	c = 0.5*(a+b);
+      lasagna_call(interp(c,events->y,interp_data),error_message,error_message);
+      lasagna_call(options->event_function(c,events->y,events->g,p,error_message),
+		   error_message,error_message);
+      gc = events->g[e];
+      if (gc*gb > 0.0){
+	b = c;
+	gb = gc;
+	if (side == -1)
+	  ga *= 0.5;
+	side = -1;
+      }
+      else if (gc*ga > 0.0){
+	a = c;
+	ga = gc;
+	if (side == 1)
+	  gb *= 0.5;
+	side = 1;
+      }
+      else{
+	b = c;
+	gb = 0.0;
+      }
+    }
+    events->t_root[e] = b;
+    events->found[e] = _TRUE_;
+  }
+  /** Handle the events in order: */
+  for (;;){
+    first = -1;
+    for (e=0; e<n; e++){
+      if ((events->found[e] == _TRUE_)&&
+	  ((first == -1)||((events->t_root[e]-events->t_root[first])*tdir < 0.0)))
+	first = e;
+    }
+    if (first == -1)
+      break;
+    events->found[first] = _FALSE_;
+    options->Stats[_STAT_EVENTS_]++;
+    if (options->EvolverVerbose > 1)
+      printf("Event %d at t=%.16e.\n",first,events->t_root[first]);
+    lasagna_call(interp(events->t_root[first],events->y,interp_data),
+		 error_message,error_message);
+    if (options->event_action != NULL){
+      lasagna_call(options->event_action(events->t_root[first],events->y,first,p,
+					 error_message),
+		   error_message,error_message);
+    }
+    if ((options->event_terminal != NULL)&&(options->event_terminal[first] == _TRUE_)){
+      events->t_event = events->t_root[first];
+      memcpy(events->y_event,events->y,sizeof(double)*events->neq);
+      *stop = _TRUE_;
+      break;
+    }
+  }
+  return _SUCCESS_;
+}
+
+/**********************************************************************/
+/* Checkpoints of ndf15 and radau5: "evolver_checkpoint_due",         */
+/* "evolver_checkpoint_open", "evolver_checkpoint_io",                */
+/* "evolver_checkpoint_close".                                        */
+/**********************************************************************/
+
+int evolver_checkpoint_due(EvolverOptions *options, int steps, int *last_checkpoint){
+  /* _TRUE_ when steps accepted steps is a new multiple of CheckpointInterval. */
+  if ((options->CheckpointInterval <= 0)||(options->CheckpointFile == NULL)||
+      (steps == *last_checkpoint)||(steps%options->CheckpointInterval != 0))
+    return _FALSE_;
+  *last_checkpoint = steps;
+  return _TRUE_;
+}
+
+int evolver_checkpoint_open(EvolverOptions *options,
+			    int evolver,
+			    size_t neq,
+			    int restore,
+			    FILE **file,
+			    ErrorMsg error_message){
+  /* Opens CheckpointFile for reading, or CheckpointFile.tmp for writing,
+     and handles the header: a magic string, the evolver and neq. */
+  char magic[8]="LASAGNA", header[8], *filename;
+  int evolver_file;
+  size_t neq_file;
+
+  lasagna_test(options->CheckpointFile == NULL, error_message,
+	       "No checkpoint file is set.");
+  lasagna_alloc(filename,strlen(options->CheckpointFile)+5,error_message);
+  sprintf(filename,(restore == _TRUE_ ? "%s" : "%s.tmp"),options->CheckpointFile);
+  *file = fopen(filename,(restore == _TRUE_ ? "rb" : "wb"));
+  lasagna_test(*file == NULL, error_message,"Could not open %s.",filename);
+  free(filename);
+  if (restore == _FALSE_){
+    lasagna_call(evolver_checkpoint_io(*file,magic,1,8,_FALSE_,error_message),
+		 error_message,error_message);
+    lasagna_call(evolver_checkpoint_io(*file,&evolver,sizeof(int),1,_FALSE_,error_message),
+		 error_message,error_message);
+    lasagna_call(evolver_checkpoint_io(*file,&neq,sizeof(size_t),1,_FALSE_,error_message),
+		 error_message,error_message);
+    return _SUCCESS_;
+  }
+  lasagna_call(evolver_checkpoint_io(*file,header,1,8,_TRUE_,error_message),
+	       error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(*file,&evolver_file,sizeof(int),1,_TRUE_,error_message),
+	       error_message,error_message);
+  lasagna_call(evolver_checkpoint_io(*file,&neq_file,sizeof(size_t),1,_TRUE_,error_message),
+	       error_message,error_message);
+  lasagna_test(memcmp(header,magic,8) != 0, error_message,
+	       "%s is not a checkpoint file.",options->CheckpointFile);
+  lasagna_test(evolver_file != evolver, error_message,
+	       "%s was written by another evolver.",options->CheckpointFile);
+  lasagna_test(neq_file != neq, error_message,
+	       "%s has %zu equations, not %zu.",options->CheckpointFile,neq_file,neq);
+  return _SUCCESS_;
+}
+
+int evolver_checkpoint_io(FILE *file,
+			  void *ptr,
+			  size_t size,
+			  size_t count,
+			  int restore,
+			  ErrorMsg error_message){
+  size_t done;
+  if (restore == _TRUE_)
+    done = fread(ptr,size,count,file);
+  else
+    done = fwrite(ptr,size,count,file);
+  lasagna_test(done != count, error_message,
+	       "Checkpoint %s failed.",(restore == _TRUE_ ? "read" : "write"));
+  return _SUCCESS_;
+}
+
+int evolver_checkpoint_close(EvolverOptions *options,
+			     FILE *file,
+			     int restore,
+			     void * parameters_and_workspace_for_derivs,
+			     ErrorMsg error_message){
+  /* Adds the state of the caller and closes the file. A written checkpoint
+     replaces CheckpointFile only when it is complete. */
+  char *filename;
+  int status;
+
+  if (options->checkpoint_state != NULL)
+    lasagna_call(options->checkpoint_state(file,restore,
+					   parameters_and_workspace_for_derivs,
+					   error_message),
+		 error_message,error_message);
+  status = fclose(file);
+  if (restore == _TRUE_)
+    return _SUCCESS_;
+  lasagna_alloc(filename,strlen(options->CheckpointFile)+5,error_message);
+  sprintf(filename,"%s.tmp",options->CheckpointFile);
+  lasagna_test(status != 0, error_message,"Could not write %s.",filename);
+  lasagna_test(rename(filename,options->CheckpointFile) != 0, error_message,
+	       "Could not rename %s.",filename);
+  free(filename);
+  if (options->EvolverVerbose > 1)
+    printf("Checkpoint written to %s.\n",options->CheckpointFile);
+  return _SUCCESS_;
+}
+
+/**********************************************************************/
+/* Timing of the hot paths: "evolver_clock", "evolver_timing_report". */
+/**********************************************************************/
+double evolver_clock(void){
+  /** Seconds on a monotonic clock, for differences only. */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+1e-9*ts.tv_nsec;
+}
+
+double evolver_peak_memory(void){
+  /** Peak resident memory of the process so far, in MB. */
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF,&usage) != 0)
+    return -1.0;
+#ifdef __APPLE__
+  return usage.ru_maxrss/1048576.0;
+#else
+  return usage.ru_maxrss/1024.0;
+#endif
+}
+
+int evolver_progress_start(EvolverOptions *options,
+			   double t,
+			   double tfinal,
+			   double *y){
+  /** Called by the evolvers when they start. Writes the progress file at
+      once, so that it exists from the first step. */
+  int i;
+
+  if ((options->ProgressFile == NULL)||(options->ProgressInterval <= 0.0))
+    return _SUCCESS_;
+  options->Progress.start = evolver_clock();
+  options->Progress.last = options->Progress.start;
+  options->Progress.t_last = t;
+  for (i=0; i<5; i++)
+    options->Progress.stats_last[i] = options->Stats[i];
+  return evolver_progress(options, t, tfinal, 0.0, 0, y, _TRUE_);
+}
+
+int evolver_progress(EvolverOptions *options,
+		     double t,
+		     double tfinal,
+		     double h,
+		     int order,
+		     double *y,
+		     int force){
+  /** Called by the evolvers after each accepted step. Every
+      ProgressInterval seconds, or if force, the progress file is rewritten
+      with one JSON object: t, L, the step size h and the order of the
+      method, the steps, rejected steps, Jacobians and LU decompositions
+      so far, and per second since the last update, and the time left at
+      the pace in t of the last interval. Between the updates it costs one
+      read of the clock. The file is written under another name and
+      renamed, so a reader never sees half of it. y is 0-based. */
+  double now, wall, rate, eta;
+  char tmp_name[_FILENAMESIZE_+20];
+  FILE *file;
+  int *stats=options->Stats, i;
+
+  if ((options->ProgressFile == NULL)||(options->ProgressInterval <= 0.0))
+    return _SUCCESS_;
+  now = evolver_clock();
+  if ((force == _FALSE_)&&(now-options->Progress.last < options->ProgressInterval))
+    return _SUCCESS_;
+  wall = max(now-options->Progress.last,TINY);
+  rate = fabs(t-options->Progress.t_last)/wall;
+  eta = (rate > 0.0 ? fabs(tfinal-t)/rate : -1.0);
+
+  sprintf(tmp_name,"%s.tmp",options->ProgressFile);
+  file = fopen(tmp_name,"w");
+  if (file == NULL)
+    return _SUCCESS_;
+  fprintf(file,"{\"t\": %.10e, \"t_final\": %.10e",t,tfinal);
+  if (options->ProgressIndex >= 0)
+    fprintf(file,", \"L\": %.10e",y[options->ProgressIndex]*options->ProgressScale);
+  fprintf(file,", \"h\": %.6e, \"order\": %d",h,order);
+  fprintf(file,", \"steps\": %d, \"rejected\": %d, \"rhs\": %d, \"jacobians\": %d, \"lu\": %d",
+	  stats[0],stats[1],stats[2],stats[3],stats[4]);
+  fprintf(file,", \"steps_per_s\": %.4g, \"rejected_per_s\": %.4g",
+	  (stats[0]-options->Progress.stats_last[0])/wall,
+	  (stats[1]-options->Progress.stats_last[1])/wall);
+  fprintf(file,", \"jacobians_per_s\": %.4g, \"lu_per_s\": %.4g",
+	  (stats[3]-options->Progress.stats_last[3])/wall,
+	  (stats[4]-options->Progress.stats_last[4])/wall);
+  fprintf(file,", \"wall\": %.3f, \"eta\": %.1f, \"updated\": %ld}\n",
+	  now-options->Progress.start,eta,(long) time(NULL));
+  fclose(file);
+  rename(tmp_name,options->ProgressFile);
+
+  options->Progress.last = now;
+  options->Progress.t_last = t;
+  for (i=0; i<5; i++)
+    options->Progress.stats_last[i] = stats[i];
+  return _SUCCESS_;
+}
+
+int evolver_timing_report(EvolverOptions *options,
+			  double total,
+			  int extra,
+			  char **extra_name,
+			  double *extra_time,
+			  int *extra_calls,
+			  char *filename,
+			  ErrorMsg error_message){
+  /** Prints the phases of options->Time against the wall time total of
+      the run, and writes them as JSON to filename unless it is NULL.
+      "other" is the time outside the phases: step size control, the
+      vector passes of the evolver and stop_function. The extra phases
+      are timed by the caller inside derivs, also the calls made for the
+      Jacobian, so they are listed below derivs and not counted again. */
+  char *name[_EVOLVER_TIMERS_] = {"derivs","jacobian","factorise","solve","output"};
+  FILE *file;
+  double sum, other;
+  int i, j;
+
+  for (i=0, sum=0.0; i<_EVOLVER_TIMERS_; i++)
+    sum += options->Time[i];
+  other = max(0.0,total-sum);
+  printf("Timing:      phase       calls     seconds   share\n");
+  for (i=0; i<_EVOLVER_TIMERS_; i++){
+    printf("%17s %11d %11.4f %6.1f%%\n",name[i],options->TimeCalls[i],
+	   options->Time[i],100.0*options->Time[i]/max(total,TINY));
+    if (i == _TIME_DERIVS_)
+      for (j=0; j<extra; j++)
+	printf("%17s %11d %11.4f %6.1f%%\n",extra_name[j],extra_calls[j],
+	       extra_time[j],100.0*extra_time[j]/max(total,TINY));
+  }
+  printf("%17s %11s %11.4f %6.1f%%\n","other","",other,100.0*other/max(total,TINY));
+  printf("%17s %11s %11.4f\n","total","",total);
+
+  if (filename == NULL)
+    return _SUCCESS_;
+  file = fopen(filename,"w");
+  lasagna_test(file == NULL, error_message, "Could not open %s.",filename);
+  fprintf(file,"{\n  \"total\": %.6e,\n  \"phases\": [\n",total);
+  for (i=0; i<_EVOLVER_TIMERS_; i++)
+    fprintf(file,"    {\"name\": \"%s\", \"calls\": %d, \"seconds\": %.6e},\n",
+	    name[i],options->TimeCalls[i],options->Time[i]);
+  for (i=0; i<extra; i++)
+    fprintf(file,"    {\"name\": \"%s\", \"calls\": %d, \"seconds\": %.6e, \"nested\": true},\n",
+	    extra_name[i],extra_calls[i],extra_time[i]);
+  fprintf(file,"    {\"name\": \"other\", \"calls\": 0, \"seconds\": %.6e}\n  ],\n",other);
+  fprintf(file,"  \"stats\": [");
+  for (i=0; i<_EVOLVER_STATS_; i++)
+    fprintf(file,"%d%s",options->Stats[i],(i < _EVOLVER_STATS_-1 ? ", " : "]\n"));
+  fprintf(file,"}\n");
+  lasagna_test(fclose(file) != 0, error_message, "Could not write %s.",filename);
+  return _SUCCESS_;
+}
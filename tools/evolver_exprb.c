@@ -0,0 +1,553 @@
+#include "evolver_exprb.h"
+/**
+   Exponential Rosenbrock method exprb32 of Hochbruck, Ostermann and
+   Schweitzer (2009), order 3 with the exponential Rosenbrock-Euler method
+   of order 2 embedded:
+     U     = y + h phi_1(hJ) f(t,y) + h^2 phi_2(hJ) v,
+     y_new = U + 2h phi_3(hJ) g(t+h,U),
+   with v = df/dt and g(t,u) = f(t,u)-f(t,y)-J(u-y)-(t'-t)v the part of f
+   that is not linear. The linear part, and so the fast rotation of Px and
+   Py, is propagated exactly. The phi-functions act on vectors through a
+   Krylov subspace of J in its sparse (or dense) storage, so no linear
+   systems are solved. 2h phi_3(hJ) g is the error estimate.
+
+   J and v are computed again at the start of every accepted step. The
+   order and the error estimate assume that J and v are those of (t,y): with
+   an older J, g is not small and the estimate does not see the error this
+   gives. A rejected step is retried with the same J and v. A step is also
+   rejected if a Krylov approximation has not converged in
+   _EXPRB_KRYLOV_MAX_ vectors. f, v and J are checked when J is computed:
+   a Krylov approximation of a NaN never converges, and the run would
+   otherwise end in halvings of the step down to the smallest one.
+*/
+
+static int exprb_finite(double *x, size_t n){
+  /** _TRUE_ if no entry of x is NaN or infinite. */
+  size_t i;
+  for (i=0; i<n; i++)
+    if (isfinite(x[i]) == 0)
+      return _FALSE_;
+  return _TRUE_;
+}
+
+static void exprb_matmul(double *A, double *B, double *C, int n){
+  /** C = A B, column-major n x n. */
+  int i, j, k;
+  double b;
+  for (j=0; j<n; j++){
+    for (i=0; i<n; i++)
+      C[i+j*n] = 0.0;
+    for (k=0; k<n; k++){
+      b = B[k+j*n];
+      for (i=0; i<n; i++)
+	C[i+j*n] += A[i+k*n]*b;
+    }
+  }
+}
+
+int exprb_expm(double *A,
+	       int n,
+	       double *work,
+	       int *ipiv){
+  /** exp(A) in place for the column-major n x n matrix A, by the (6,6)
+      Pade approximant with scaling and squaring. work has 4*n*n entries. */
+  double c[7]={1.0, 0.5, 5.0/44.0, 1.0/66.0, 1.0/792.0, 1.0/15840.0, 1.0/665280.0};
+  double *P=work, *Q=work+n*n, *N=work+2*n*n, *D=work+3*n*n, *swap;
+  double norm, row, scale;
+  int i, j, k, s=0;
+
+  norm = 0.0;
+  for (i=0; i<n; i++){
+    row = 0.0;
+    for (j=0; j<n; j++)
+      row += fabs(A[i+j*n]);
+    norm = max(norm,row);
+  }
+  while ((norm > 0.5)&&(s < 64)){
+    norm *= 0.5;
+    s++;
+  }
+  scale = ldexp(1.0,-s);
+  for (i=0; i<n*n; i++){
+    A[i] *= scale;
+    N[i] = c[1]*A[i];
+    D[i] = -c[1]*A[i];
+    P[i] = A[i];
+  }
+  for (i=0; i<n; i++){
+    N[i+i*n] += 1.0;
+    D[i+i*n] += 1.0;
+  }
+  for (k=2; k<=6; k++){
+    exprb_matmul(P,A,Q,n);
+    swap = P; P = Q; Q = swap;
+    for (i=0; i<n*n; i++){
+      N[i] += c[k]*P[i];
+      D[i] += (k%2 == 0 ? c[k] : -c[k])*P[i];
+    }
+  }
+  dense_lu(D, n, ipiv);
+  dense_lu_solve(D, n, ipiv, N, n);
+  for (k=0; k<s; k++){
+    exprb_matmul(N,N,P,n);
+    swap = N; N = P; P = swap;
+  }
+  memcpy(A,N,sizeof(double)*n*n);
+  return _SUCCESS_;
+}
+
+int exprb_matvec(MultiMatrix *J,
+		 double *x,
+		 double *y){
+  /** y = J x for J in SCC or DNR storage, x and y 0-based. */
+  size_t neq=J->ncol;
+  SCCformat *StoreSCC;
+  DNRformat *StoreDNR;
+  double **Jmat, *Ax, xj;
+  int *Ap, *Ai, i, j, p;
+
+  switch(J->Stype){
+  case(L_SCC):
+    StoreSCC = J->Store;
+    Ap = StoreSCC->Ap; Ai = StoreSCC->Ai; Ax = StoreSCC->Ax;
+    for (i=0; i<neq; i++)
+      y[i] = 0.0;
+    for (j=0; j<neq; j++){
+      xj = x[j];
+      if (xj == 0.0)
+	continue;
+      for (p=Ap[j]; p<Ap[j+1]; p++)
+	y[Ai[p]] += Ax[p]*xj;
+    }
+    break;
+  case(L_DNR):
+    StoreDNR = J->Store;
+    Jmat = (double **) StoreDNR->Matrix;
+    for (i=1; i<=neq; i++){
+      y[i-1] = 0.0;
+      for (j=1; j<=neq; j++)
+	y[i-1] += Jmat[i][j]*x[j-1];
+    }
+    break;
+  }
+  return _SUCCESS_;
+}
+
+int exprb_phi(MultiMatrix *J,
+	      double h,
+	      int k,
+	      double *b,
+	      double *phib,
+	      double tol,
+	      struct exprb_krylov *kry,
+	      int *converged){
+  /** phib = phi_k(hJ) b for k>=1 from the Arnoldi process on J and b.
+      phi_k(h H_m) e_1 of the Hessenberg matrix H_m is the column m+k-1 of
+      the exponential of [h H_m e_1 0; 0 0 I; 0 0 0] of size m+k+1, whose
+      last column gives phi_{k+1} for the error estimate
+      beta |h h_{m+1,m}| |e_m' phi_{k+1}(h H_m) e_1| of Saad (1992). Each
+      try costs an exponential of the small matrix, so it is first tried at
+      kry->first[k], one less than the dimension that converged for phi_k
+      in the last call, and then after every 4 vectors. *converged is _TRUE_
+      if it is below tol, otherwise phib is the approximation in
+      _EXPRB_KRYLOV_MAX_ vectors. */
+  size_t neq=kry->neq;
+  int ld=_EXPRB_KRYLOV_MAX_+1, i, j, m=0, na, breakdown, tries=0;
+  double beta, hnext, dot, err, *V=kry->V, *H=kry->H, *A=kry->A, *w;
+
+  beta = 0.0;
+  for (i=0; i<neq; i++)
+    beta += b[i]*b[i];
+  beta = sqrt(beta);
+  *converged = _TRUE_;
+  if (beta == 0.0){
+    for (i=0; i<neq; i++)
+      phib[i] = 0.0;
+    return _SUCCESS_;
+  }
+  for (i=0; i<neq; i++)
+    V[i] = b[i]/beta;
+  for (j=0; j<_EXPRB_KRYLOV_MAX_; j++){
+    w = V+(j+1)*neq;
+    exprb_matvec(J,V+j*neq,w);
+    //Modified Gram-Schmidt:
+    for (m=0; m<=j; m++){
+      dot = 0.0;
+      for (i=0; i<neq; i++)
+	dot += w[i]*V[m*neq+i];
+      H[m+j*ld] = dot;
+      for (i=0; i<neq; i++)
+	w[i] -= dot*V[m*neq+i];
+    }
+    hnext = 0.0;
+    for (i=0; i<neq; i++)
+      hnext += w[i]*w[i];
+    hnext = sqrt(hnext);
+    H[j+1+j*ld] = hnext;
+    m = j+1;
+    breakdown = (fabs(h)*hnext <= 1e-12);
+    if (breakdown == _FALSE_)
+      for (i=0; i<neq; i++)
+	w[i] /= hnext;
+    if ((breakdown == _FALSE_)&&(m < _EXPRB_KRYLOV_MAX_)&&
+	((m < kry->first[k])||((m-kry->first[k])%4 != 0)))
+      continue;
+    tries++;
+    na = m+k+1;
+    for (i=0; i<na*na; i++)
+      A[i] = 0.0;
+    for (j=0; j<m; j++)
+      for (i=0; i<=min(j+1,m-1); i++)
+	A[i+j*na] = h*H[i+j*ld];
+    A[m*na] = 1.0;
+    for (i=0; i<k; i++)
+      A[(m+i)+(m+i+1)*na] = 1.0;
+    exprb_expm(A, na, kry->work, kry->ipiv);
+    if (breakdown == _TRUE_)
+      err = 0.0;
+    else
+      err = beta*fabs(h*hnext*A[(m-1)+(m+k)*na]);
+    if ((err <= tol)||(m == _EXPRB_KRYLOV_MAX_)){
+      *converged = (err <= tol ? _TRUE_ : _FALSE_);
+      kry->first[k] = (tries == 1 ? max(1,m-1) : m);
+      break;
+    }
+    j = m-1;
+  }
+  kry->vectors += m;
+  kry->largest = max(kry->largest,m);
+  for (i=0; i<neq; i++)
+    phib[i] = 0.0;
+  for (j=0; j<m; j++){
+    dot = beta*A[j+(m+k-1)*na];
+    for (i=0; i<neq; i++)
+      phib[i] += dot*V[j*neq+i];
+  }
+  return _SUCCESS_;
+}
+
+static int exprb_jacobian(int (*derivs)(double x,double * y,double * dy,
+					void * parameters_and_workspace, ErrorMsg error_message),
+			  void * parameters_and_workspace_for_derivs,
+			  double t,
+			  double absh,
+			  int tdir,
+			  double *y,
+			  double *f0,
+			  double *ftmp,
+			  double *dfdt,
+			  MultiMatrix *J,
+			  double *Jval,
+			  size_t nvals,
+			  void *nj_ws,
+			  size_t neq,
+			  EvolverOptions *options,
+			  ErrorMsg error_message){
+  /** J and v = df/dt at (t,y), f0 is f(t,y). Jval are the nvals values
+      of J. */
+  int i, nfenj=0;
+  double tdel;
+
+  lasagna_call(evolver_jacobian(derivs,
+				t,
+				y-1,
+				f0-1,
+				J,
+				nj_ws,
+				options->AbsTol,
+				neq,
+				&nfenj,
+				options,
+				parameters_and_workspace_for_derivs,
+				error_message),
+	       error_message, error_message);
+  options->Stats[3] += 1;
+  options->Stats[2] += nfenj;
+  tdel = (t + tdir*min(sqrt(DBL_EPSILON)*max(fabs(t),fabs(t+tdir*absh)),absh)) - t;
+  evolver_timed(options,_TIME_DERIVS_,
+		lasagna_call((*derivs)(t+tdel,
+				       y,
+				       ftmp,
+				       parameters_and_workspace_for_derivs,
+				       error_message),
+			     error_message, error_message));
+  options->Stats[2] += 1;
+  for (i=0; i<neq; i++)
+    dfdt[i] = (ftmp[i]-f0[i])/tdel;
+  lasagna_test((exprb_finite(f0,neq) == _FALSE_)||(exprb_finite(dfdt,neq) == _FALSE_)||
+	       (exprb_finite(Jval,nvals) == _FALSE_),
+	       error_message,"f, df/dt or the Jacobian is not finite at t=%g.",t);
+  return _SUCCESS_;
+}
+
+int evolver_exprb(int (*derivs)(double x,double * y,double * dy,
+				void * parameters_and_workspace, ErrorMsg error_message),
+		  void * parameters_and_workspace_for_derivs,
+		  double t0,
+		  double tfinal,
+		  double * y_inout,
+		  size_t neq,
+		  EvolverOptions *options,
+		  ErrorMsg error_message){
+
+  /** Handle options: */
+  int *interpidx, *stepstat, verbose, tres;
+  double abstol, rtol, *t_vec;
+  int (*output)(double t, double *y, double *dy, int i, void *p, ErrorMsg err);
+  int (*print_variables)(double t, double *y, double *dy, void *p, ErrorMsg err);
+  int (*stop_function)(double t, double *y, double *dy, void *p, ErrorMsg err);
+  interpidx = options->used_in_output; stepstat = &(options->Stats[0]);
+  verbose = options->EvolverVerbose; tres = options->tres; abstol = options->AbsTol;
+  rtol = options->RelTol; t_vec = options->t_vec;
+  output = options->output; print_variables=options->print_variables;
+  stop_function = options->stop_function;
+  lasagna_test(options->tangent != NULL, error_message,
+	       "The tangent-linear mode is only implemented in ndf15.");
+  lasagna_test(options->Events > 0, error_message,
+	       "Events are only located by ndf15 and radau5.");
+  lasagna_test(options->J_pointer_flag == _TRUE_, error_message,
+	       "The Lyapunov vector is not implemented in the exponential evolver.");
+  lasagna_test((options->CheckpointInterval > 0)||(options->Restart == _TRUE_),
+	       error_message,"The exponential evolver does not write checkpoints.");
+
+  /* Step size control: */
+  double safety=0.9, fac_min=0.2, fac_max=5.0;
+  double threshold = abstol/rtol;
+
+  int tdir, next=0, i, converged, last_failed=_FALSE_;
+  double t, h, absh, abshmin, ti, rh, norm_err, fac, tol;
+  double *f0, *f1, *ynew, *ytemp, *ftmp, *dfdt, *err, *w1, *w2, *U, *swap;
+  double *vec_buf, *Jval;
+  MultiMatrix J;
+  void *nj_ws;
+  int *Ai, *Ap, nnz;
+  size_t nvals;
+  struct exprb_krylov kry;
+
+  /* f0, f1, ynew, ytemp, ftmp, dfdt, err, w1, w2 and U: */
+  lasagna_alloc(vec_buf, sizeof(double)*10*neq, error_message);
+  f0 = vec_buf; f1 = f0+neq; ynew = f1+neq; ytemp = ynew+neq; ftmp = ytemp+neq;
+  dfdt = ftmp+neq; err = dfdt+neq; w1 = err+neq; w2 = w1+neq; U = w2+neq;
+  kry.neq = neq;
+  kry.vectors = 0;
+  for (i=0; i<_EXPRB_PHI_MAX_; i++)
+    kry.first[i] = 4;
+  lasagna_alloc(kry.V, sizeof(double)*(_EXPRB_KRYLOV_MAX_+1)*neq, error_message);
+  lasagna_calloc(kry.H, (_EXPRB_KRYLOV_MAX_+1)*_EXPRB_KRYLOV_MAX_, sizeof(double),
+		 error_message);
+  i = _EXPRB_KRYLOV_MAX_+_EXPRB_PHI_MAX_+1;
+  lasagna_alloc(kry.A, sizeof(double)*i*i, error_message);
+  lasagna_alloc(kry.work, sizeof(double)*4*i*i, error_message);
+  lasagna_alloc(kry.ipiv, sizeof(int)*i, error_message);
+
+  /** Initialise MultiMatrix J in the storage of the linalg wrapper: */
+  if (options->use_sparse == _TRUE_){
+    Ai=options->Ai; Ap=options->Ap;
+    nnz = Ap[neq];
+    nvals = nnz;
+    lasagna_calloc(Jval, nnz, sizeof(double), error_message);
+    lasagna_call(CreateMatrix_SCC(&J,L_DBL,neq, neq, nnz, Ai, Ap, Jval, error_message),
+		 error_message, error_message);
+  }
+  else{
+    nvals = neq*neq+1;
+    lasagna_calloc(Jval, nvals, sizeof(double), error_message);
+    lasagna_call(CreateMatrix_DNR(&J,L_DBL,neq, neq, Jval, error_message),
+		 error_message, error_message);
+  }
+  lasagna_call(initialize_numjac_workspace(&J, &nj_ws, error_message),
+	       error_message, error_message);
+  lasagna_call(reset_numjac_workspace(nj_ws, options, parameters_and_workspace_for_derivs,
+				      error_message),
+	       error_message, error_message);
+  for (i=0; i<_EVOLVER_STATS_; i++) stepstat[i] = 0;
+
+  if ((tfinal-t0)>0)
+    tdir = 1;
+  else
+    tdir = -1;
+  t = t0;
+  evolver_timed(options,_TIME_DERIVS_,
+		lasagna_call((*derivs)(t,
+				       y_inout,
+				       f0,
+				       parameters_and_workspace_for_derivs,
+				       error_message),
+			     error_message, error_message));
+  stepstat[2]++;
+  if (t_vec != NULL){
+    //Output at t_vec, the first point may be t0:
+    for (next=0; (next<tres)&&((t_vec[next]-t0)*tdir<0.0); next++);
+    if ((next<tres)&&(t_vec[next] == t0)){
+      evolver_timed(options,_TIME_OUTPUT_,
+		    lasagna_call((*output)(t0,y_inout,f0,next,
+					   parameters_and_workspace_for_derivs,
+					   error_message),error_message,error_message));
+      next++;
+    }
+  }
+
+  /** Initial step from the size of f: */
+  absh = 0.1*fabs(tfinal-t0);
+  rh = norm_inf(y_inout, f0, threshold, neq)/(0.8*pow(rtol,1.0/3.0));
+  if (absh*rh > 1.0)
+    absh = 1.0/rh;
+  absh = max(absh, 16.0*fabs(t)*DBL_EPSILON);
+  lasagna_call(exprb_jacobian(derivs, parameters_and_workspace_for_derivs, t, absh, tdir,
+			      y_inout, f0, ftmp, dfdt, &J, Jval, nvals, nj_ws, neq, options,
+			      error_message),
+	       error_message, error_message);
+
+  lasagna_call(evolver_progress_start(options, t, tfinal, y_inout), error_message, error_message);
+
+  //Main loop:
+  while ((tfinal-t)*tdir>0.0){
+    abshmin = 16.0*fabs(t)*DBL_EPSILON;
+    lasagna_test(absh<abshmin, error_message,
+		 "Step size too small in evolver_exprb at t=%g!. |h|=%g < |hmin|=%g",
+		 t, absh, abshmin);
+    /* Stretch the step if within 10% of tfinal-t. */
+    if (1.1*absh >= fabs(tfinal-t))
+      absh = fabs(tfinal-t);
+    h = tdir*absh;
+    /** The Krylov errors, multiplied by h, h^2 and 2h in y, are kept below
+	a tenth of the absolute tolerance, so they do not enter the
+	estimate of the error of the method: */
+    tol = 0.1*abstol;
+    kry.largest = 0;
+    lasagna_call(exprb_phi(&J, h, 1, f0, w1, tol/absh, &kry, &converged),
+		 error_message, error_message);
+    if (converged == _TRUE_)
+      lasagna_call(exprb_phi(&J, h, 2, dfdt, w2, tol/(absh*absh), &kry, &converged),
+		   error_message, error_message);
+    if (converged == _TRUE_){
+      for (i=0; i<neq; i++){
+	U[i] = y_inout[i]+h*w1[i]+h*h*w2[i];
+	ytemp[i] = U[i]-y_inout[i];
+      }
+      evolver_timed(options,_TIME_DERIVS_,
+		    lasagna_call((*derivs)(t+h,
+					   U,
+					   ftmp,
+					   parameters_and_workspace_for_derivs,
+					   error_message),
+				 error_message, error_message));
+      stepstat[2]++;
+      //g(t+h,U) in ftmp:
+      exprb_matvec(&J, ytemp, err);
+      for (i=0; i<neq; i++)
+	ftmp[i] -= f0[i]+err[i]+h*dfdt[i];
+      lasagna_call(exprb_phi(&J, h, 3, ftmp, w1, tol/(2.0*absh), &kry, &converged),
+		   error_message, error_message);
+    }
+    if (converged == _FALSE_){
+      //The step is too long for the Krylov subspace:
+      stepstat[1]++;
+      last_failed = _TRUE_;
+      absh *= 0.5;
+      continue;
+    }
+    for (i=0; i<neq; i++){
+      err[i] = 2.0*h*w1[i];
+      ynew[i] = U[i]+err[i];
+    }
+    norm_err = norm_inf(ynew, err, threshold, neq);
+    fac = safety*pow(rtol/max(norm_err,1e-10*rtol),1.0/3.0);
+    if (norm_err > rtol){
+      //Step rejected:
+      stepstat[1]++;
+      last_failed = _TRUE_;
+      absh *= max(fac_min,min(fac,0.9));
+      continue;
+    }
+    //Step accepted:
+    stepstat[0]++;
+    if (verbose>1)
+      printf("%.16e %.16e\n",t,h);
+    evolver_timed(options,_TIME_DERIVS_,
+		  lasagna_call((*derivs)(t+h,
+					 ynew,
+					 f1,
+					 parameters_and_workspace_for_derivs,
+					 error_message),
+			       error_message, error_message));
+    stepstat[2]++;
+    /**  Output, with the cubic Hermite interpolation of evolver_rosw:  */
+    if (t_vec==NULL){
+      //Refinement output:
+      for (i=1; i<=tres; i++){
+	ti = t+i/((double) tres)*h;
+	dense_output_rosw(ti, ytemp, t, h, y_inout, f0, ynew, f1, interpidx, neq);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(ti,ytemp,f1,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+      }
+    }
+    else{
+      while((next<tres)&&((t+h-t_vec[next])*tdir >= 0.0)){
+	dense_output_rosw(t_vec[next], ytemp, t, h, y_inout, f0, ynew, f1, interpidx, neq);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(t_vec[next],ytemp,f1,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+	next++;
+      }
+    }
+    t += h;
+    memcpy(y_inout, ynew, sizeof(double)*neq);
+    swap = f0; f0 = f1; f1 = swap;
+    if (print_variables != NULL){
+      evolver_timed(options,_TIME_OUTPUT_,
+		    lasagna_call((*print_variables)(t,
+						    y_inout,
+						    f0,
+						    parameters_and_workspace_for_derivs,
+						    error_message),
+				 error_message,error_message));
+    }
+    fac = max(fac_min,min(fac,(last_failed == _TRUE_ ? 1.0 : fac_max)));
+    /* Near the largest Krylov subspace, a longer step would be rejected: */
+    if (4*kry.largest > 3*_EXPRB_KRYLOV_MAX_)
+      fac = min(fac,1.0);
+    absh *= fac;
+    last_failed = _FALSE_;
+    if (options->ProgressInterval > 0.0)
+      evolver_progress(options, t, tfinal, tdir*absh, 3, y_inout, _FALSE_);
+    /* Perhaps use stop function: */
+    if (stop_function != NULL){
+      if (stop_function(t,y_inout,f0,parameters_and_workspace_for_derivs,
+			error_message) == _TRUE_){      //Stop condition
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(t,y_inout,f0,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+	printf("Stop condition met...\n");
+	break;
+      }
+    }
+    //J and v at the start of the next step:
+    if ((tfinal-t)*tdir>0.0)
+      lasagna_call(exprb_jacobian(derivs, parameters_and_workspace_for_derivs, t, absh, tdir,
+				  y_inout, f0, ftmp, dfdt, &J, Jval, nvals, nj_ws, neq,
+				  options, error_message),
+		   error_message, error_message);
+  }
+  printf("\n End of evolver. Next=%d, t=%e.",next,t);
+  printf("\n Statistics: [%d %d %d %d %d %d] \n",stepstat[0],stepstat[1],
+	 stepstat[2],stepstat[3],stepstat[4],stepstat[5]);
+  if (verbose > 1)
+    printf(" Krylov vectors: %d, %.1f per step.\n",kry.vectors,
+	   kry.vectors/((double) max(1,stepstat[0]+stepstat[1])));
+
+  uninitialize_numjac_workspace(nj_ws);
+  DestroyMultiMatrix(&J);
+  free(Jval);
+  free(vec_buf);
+  free(kry.V);
+  free(kry.H);
+  free(kry.A);
+  free(kry.work);
+  free(kry.ipiv);
+  return _SUCCESS_;
+}
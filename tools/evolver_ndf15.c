@@ -34,6 +34,12 @@
 	stepstat[3] = Number of Jacobians computed.
 	stepstat[4] = Number of LU decompositions.
 	stepstat[5] = Number of linear solves.
+	The sparse linalg wrapper also counts its factorisations in
+	stepstat[6-8], see _STAT_REFACTOR_ in evolver_common.h.
+	With options->JacobianUpdates, stepstat[_STAT_JAC_UPDATE_] counts the
+	secant updates of the Jacobian and stepstat[_STAT_JAC_UPDATE_FALLBACK_]
+	the Jacobians computed because an update did not restore convergence.
+	With options->Events, stepstat[_STAT_EVENTS_] counts the events found.
 	If ppt->perturbations_verbose > 2, this statistic is printed at the end of
 	each call to evolver.
 	
@@ -54,6 +60,38 @@
 	structure of the equations are nearly optimal for the LU decomposition, so we don't
 	want to mess it up by too many row permutations if we can avoid it. This is also why
 	do not use any column permutation to pre-order the matrix.
+
+	Tangent-linear mode:
+	If options->tangent is set, a tangent vector v with v' = J v is carried
+	along with y. After each accepted step the NDF formula for v is solved
+	with the Jacobian and the factorisation the corrector used for y. The 
+	equation is linear, so this takes one linear solve and no extra calls 
+	to derivs. v has its own backward differences, but does not take part 
+	in the error control.
+	With options->Tangents > 1, the tangents are solved together with
+	linalg_solve_many. The equation is linear, so a linear combination of
+	tangents is a tangent, with the same combination of backward differences.
+	The periodic Gram-Schmidt of options->TangentQR therefore acts on v and
+	its differences alike.
+
+	Secant updates:
+	With options->JacobianUpdates>0, the Newton iterates ynew_m and
+	f(tnew,ynew_m) at the same tnew give the secant pair s = ynew_m-ynew_m-1,
+	d = f_m-f_m-1 for free. When the iteration is too slow with an old
+	Jacobian, J is first corrected by the sparse rank-1 update of Schubert,
+	see ndf15_jacobian_secant, and numjac is only called if the retry is
+	too slow as well.
+
+	Checkpoints:
+	With options->CheckpointInterval>0 the state at the end of every 
+	CheckpointInterval steps is written to options->CheckpointFile, see ndf15_checkpoint, and with
+	options->Restart the integration continues from it without a new
+	initial step or Jacobian.
+
+	Step history:
+	With options->HistoryFile the interpolation data of every accepted
+	step is appended to the file, so the output can be evaluated at other
+	points after the run with ndf15_history_eval.
 */
 #include "common.h"
 #include "evolver_ndf15.h"
@@ -68,12 +106,159 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 		  size_t neq, 
 		  EvolverOptions *options,
 		  ErrorMsg error_message){
+  /* One integration with a private context. */
+  struct ndf15_context *context;
+
+  lasagna_call(ndf15_context_create(&context, neq, options, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_ndf15_context(derivs, parameters_and_workspace_for_derivs,
+				     t0, tfinal, y_inout, neq, options, context,
+				     error_message),
+	       error_message, error_message);
+  lasagna_call(ndf15_context_destroy(context, error_message),
+	       error_message, error_message);
+  return _SUCCESS_;
+}
+
+int ndf15_context_create(struct ndf15_context **context,
+			 size_t neq,
+			 EvolverOptions *options,
+			 ErrorMsg error_message){
+  /* Allocates the work vectors, the Jacobian and iteration matrices, the
+     linalg workspace and the numjac workspace for systems of size neq with
+     the pattern and linalg wrapper in options. The symbolic analysis done
+     by linalg_initialise is kept for every integration using the context. */
+  struct ndf15_context *ctx;
+  int *Ai, *Ap, nnz;
+  size_t neqp=neq+1;
+
+  lasagna_alloc(ctx, sizeof(struct ndf15_context), error_message);
+  ctx->neq = neq;
+  ctx->use_sparse = options->use_sparse;
+  ctx->linalg_initialise = options->linalg_initialise;
+  ctx->linalg_finalise = options->linalg_finalise;
+  ctx->runs = 0;
+  ctx->warm.nvals = 0;
+  ctx->warm.Jval = NULL;
+  ctx->warm.absh = 0.0;
+
+  lasagna_alloc(ctx->buffer,
+		19*neqp*sizeof(double)
+		+neqp*sizeof(int)
+		+neqp*sizeof(double*)
+		+(7*neq+1)*sizeof(double),
+		error_message);
+
+  /** Initialise MultiMatrix J, A and the linear method: */
+  if (options->use_sparse == _TRUE_){
+    printf("Use Sparse\n");
+    Ai=options->Ai; Ap=options->Ap;
+    nnz = Ap[neq];
+
+    lasagna_calloc(ctx->Jval, nnz, sizeof(double), error_message);
+    lasagna_alloc(ctx->Aval, sizeof(double)*nnz, error_message);
+    lasagna_call(CreateMatrix_SCC(&(ctx->J),L_DBL,neq, neq, nnz, Ai, Ap, ctx->Jval, error_message),
+		 error_message, error_message);
+    lasagna_call(CreateMatrix_SCC(&(ctx->A),L_DBL,neq, neq, nnz, Ai, Ap, ctx->Aval, error_message),
+		 error_message, error_message);
+  }
+  else{
+    printf("Use dense\n");
+    lasagna_calloc(ctx->Jval, (neq*neq+1), sizeof(double), error_message);
+    lasagna_alloc(ctx->Aval, sizeof(double)*(neq*neq+1), error_message);
+    lasagna_call(CreateMatrix_DNR(&(ctx->J),L_DBL,neq, neq, ctx->Jval, error_message),
+		 error_message, error_message);
+    lasagna_call(CreateMatrix_DNR(&(ctx->A),L_DBL,neq, neq, ctx->Aval, error_message),
+		 error_message, error_message);
+  }
+  lasagna_call(ctx->linalg_initialise(&(ctx->A), options, &(ctx->linalg_workspace_A),error_message),
+	       error_message, error_message);
+  /* rhs and del are the 7th and 10th vector of the buffer: */
+  lasagna_call(CreateMatrix_DNR(&(ctx->RHS), L_DBL, 1, neq, (double*)ctx->buffer+6*neqp, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&(ctx->DEL), L_DBL, 1, neq, (double*)ctx->buffer+9*neqp, error_message),
+	       error_message, error_message);
+
+  /* Initialize workspace for numjac: */
+  lasagna_call(initialize_numjac_workspace(&(ctx->J), &(ctx->nj_ws),error_message),
+	       error_message,error_message);
+  *context = ctx;
+  return _SUCCESS_;
+}
+
+int ndf15_context_reset(struct ndf15_context *context,
+			EvolverOptions *options,
+			void * parameters_and_workspace_for_derivs,
+			ErrorMsg error_message){
+  /* Prepares the context for a new integration: numjac forgets its
+     increments and takes fresh thread copies of the derivs workspace. */
+  lasagna_test((context->use_sparse != options->use_sparse)||
+	       (context->linalg_initialise != options->linalg_initialise),
+	       error_message,
+	       "The ndf15 context was created for a different linalg wrapper.");
+  lasagna_call(reset_numjac_workspace(context->nj_ws, options,
+				      parameters_and_workspace_for_derivs,
+				      error_message),
+	       error_message,error_message);
+  return _SUCCESS_;
+}
+
+int ndf15_context_destroy(struct ndf15_context *context,
+			  ErrorMsg error_message){
+  free(context->buffer);
+  DestroyMultiMatrix(&(context->J));
+  DestroyMultiMatrix(&(context->A));
+  DestroyMultiMatrix(&(context->DEL));
+  DestroyMultiMatrix(&(context->RHS));
+  lasagna_call(context->linalg_finalise(context->linalg_workspace_A, error_message),
+	       error_message, error_message);
+  free(context->Jval);
+  free(context->Aval);
+  ndf15_warm_start_free(&(context->warm));
+  uninitialize_numjac_workspace(context->nj_ws);
+  free(context);
+  return _SUCCESS_;
+}
+
+int ndf15_warm_start_copy(struct ndf15_warm_start *to,
+			  struct ndf15_warm_start *from,
+			  ErrorMsg error_message){
+  /* Copies the start of a run, for instance between the contexts of the
+     workers of a sweep. */
+  if (to->nvals != from->nvals){
+    ndf15_warm_start_free(to);
+    if (from->nvals > 0)
+      lasagna_alloc(to->Jval, sizeof(double)*from->nvals, error_message);
+    to->nvals = from->nvals;
+  }
+  if (from->nvals > 0)
+    memcpy(to->Jval, from->Jval, sizeof(double)*from->nvals);
+  to->absh = from->absh;
+  return _SUCCESS_;
+}
+
+int ndf15_warm_start_free(struct ndf15_warm_start *warm){
+  free(warm->Jval);
+  warm->Jval = NULL;
+  warm->nvals = 0;
+  warm->absh = 0.0;
+  return _SUCCESS_;
+}
+
+int evolver_ndf15_context(int (*derivs)(double x,double * y,double * dy,
+					void * parameters_and_workspace, ErrorMsg error_message),
+			  void * parameters_and_workspace_for_derivs,
+			  double t0,
+			  double tfinal,
+			  double * y_inout, 
+			  size_t neq, 
+			  EvolverOptions *options,
+			  struct ndf15_context *context,
+			  ErrorMsg error_message){
 	
   /** Handle options: */
   int *interpidx, *used_in_output, *stepstat, verbose, tres; 
   double abstol, rtol, *t_vec;
-  int (*linalg_initialise)(MultiMatrix *, EvolverOptions *, void **, ErrorMsg);
-  int (*linalg_finalise)(void *, ErrorMsg);
   int (*linalg_factorise)(void *, int, ErrorMsg);
   int (*linalg_solve)(MultiMatrix *, MultiMatrix *, void *, ErrorMsg);
   int (*output)(double t, double *y, double *dy, int i, void *p, ErrorMsg err);
@@ -82,11 +267,9 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
   used_in_output = options->used_in_output; stepstat = &(options->Stats[0]);
   verbose = options->EvolverVerbose; tres = options->tres; abstol = options->AbsTol; 
   rtol = options->RelTol; t_vec = options->t_vec; 
-  linalg_initialise = options->linalg_initialise; linalg_finalise = options->linalg_finalise;
   linalg_factorise = options->linalg_factorise; linalg_solve = options->linalg_solve;
   output = options->output; print_variables=options->print_variables; 
   stop_function = options->stop_function;
-  int *Ai, *Ap, nnz;
 
   /* Constants: */
   double G[5]={1.0,3.0/2.0,11.0/6.0,25.0/12.0,137.0/60.0};
@@ -96,46 +279,65 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
   double threshold = abstol/rtol;
 	
   /* Logicals: */
-  int Jcurrent,new_jacobian, havrate,done,at_hmin,nofailed,gotynew,tooslow;
+  int Jcurrent,new_jacobian, havrate=_FALSE_,done,at_hmin,nofailed,gotynew,tooslow;
+  int have_secant=_FALSE_,secant_tried=_FALSE_,event_stop=_FALSE_;
 	
   /* Storage: */
   double *f0,*y,*wt,*ddfddt,*pred,*ynew,*invwt,*rhs,*psi,*difkp1,*del,*yinterp;
   double *tempvec1,*tempvec2,*ypinterp,*yppinterp;
+  double *fprev,*sec_s,*sec_d,*sec_w;
   double **dif;
 	
   /* Method variables: */
   double t,ti,tnew=0;
-  double rh,htspan,absh,hmin,hmax,h,tdel;
-  double abshlast,hinvGak,minnrm,oldnrm=0.,newnrm;
+  double rh,htspan,absh=0.0,hmin=0.0,hmax,h,tdel;
+  double abshlast=0.,hinvGak=0.,minnrm,oldnrm=0.,newnrm;
   double err,hopt,errkm1,hkm1,errit,rate=0.,temp,errkp1,hkp1,maxtmp;
-  int k,klast,nconhk,iter,next=0,kopt,tdir;
+  int k=1,klast=1,nconhk=0,iter,next=0,kopt,tdir,jac_updates=0;
 	
   /* Misc: */
   int nfenj,j,ii,jj, numidx;
   size_t neqp=neq+1;
 
+  /* Events: */
+  struct evolver_events events;
+  struct ndf15_dense dense;
+
+  /* Checkpoints: */
+  double dstate[5];
+  int istate[7], last_checkpoint;
+  FILE *checkpoint_file;
+  FILE *history_file=NULL;
+
+  /* Warm start: */
+  int warm_start, record_jacobian;
+  size_t nvals;
+
+  /* Tangent-linear mode: */
+  double *tangent, *v=NULL, *vnew=NULL, *tdifkp1=NULL, **difv=NULL;
+  double *vt, *tnorm0=NULL, *tb=NULL, *tx=NULL;
+  int *tidx=NULL, tv, ntan=1;
+  MultiMatrix TRHS, TDEL;
+  int (*linalg_solve_many)(MultiMatrix *, MultiMatrix *, void *, ErrorMsg)=NULL;
+
   /* Matrices for jacobian and linearisation: */
-  MultiMatrix J, A, RHS, DEL;
-  double *Jval, *Aval;
+  MultiMatrix *J, *A, *RHS, *DEL;
   void *linalg_workspace_A, *nj_ws;
   double **Matrix;
   DNRformat *StoreDNR;
 
-  /** Allocate memory . */
-  void * buffer;
-  int buffer_size;
-
-  buffer_size=
-    15*neqp*sizeof(double)
-    +neqp*sizeof(int)
-    +neqp*sizeof(double*)
-    +(7*neq+1)*sizeof(double);
-
-  lasagna_alloc(buffer,
-	      buffer_size,
-	      error_message);
+  /** Take the storage from the context: */
+  lasagna_test(neq != context->neq, error_message,
+	       "The ndf15 context is for %zu equations, not %zu.",context->neq,neq);
+  lasagna_call(ndf15_context_reset(context, options, parameters_and_workspace_for_derivs,
+				   error_message),
+	       error_message, error_message);
+  context->runs++;
+  J = &(context->J); A = &(context->A);
+  RHS = &(context->RHS); DEL = &(context->DEL);
+  linalg_workspace_A = context->linalg_workspace_A; nj_ws = context->nj_ws;
 
-  f0       =(double*)buffer;
+  f0       =(double*)context->buffer;
   wt       =f0+neqp;
   ddfddt   =wt+neqp;
   pred     =ddfddt+neqp;
@@ -150,8 +352,12 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
   yppinterp=ypinterp+neqp;
   tempvec1 =yppinterp+neqp;
   tempvec2 =tempvec1+neqp;
+  fprev    =tempvec2+neqp;
+  sec_s    =fprev+neqp;
+  sec_d    =sec_s+neqp;
+  sec_w    =sec_d+neqp;
 
-  interpidx=(int*)(tempvec2+neqp);
+  interpidx=(int*)(sec_w+neqp);
 
   dif      =(double**)(interpidx+neqp);
   dif[1]   =(double*)(dif+neqp);
@@ -164,67 +370,72 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
     }
   }
 
-  /* 	lasagna_alloc(f0,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(wt,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(ddfddt,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(pred,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(y,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(invwt,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(rhs,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(psi,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(difkp1,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(del,sizeof(double)*neqp,error_message); */ 
-  /* 	lasagna_alloc(yinterp,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(ypinterp,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(yppinterp,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(tempvec1,sizeof(double)*neqp,error_message); */
-  /* 	lasagna_alloc(tempvec2,sizeof(double)*neqp,error_message); */
-	
-  /* 	lasagna_alloc(interpidx,sizeof(int)*neqp,error_message); */
-	
-  /* Allocate vector of pointers to rows of dif:*/
-  /* 	lasagna_alloc(dif,sizeof(double*)*neqp,error_message);  */
-  /* 	lasagna_calloc(dif[1],(7*neq+1),sizeof(double),error_message); */
-  /* 	dif[0] = NULL; */
-  /* 	for(j=2;j<=neq;j++) dif[j] = dif[j-1]+7; */ /* Set row pointers... */ 
- 
   /*Set pointers:*/
   ynew = y_inout-1; /* This way y_inout is always up to date. */
 
-  /** Initialise MultiMatrix J, A and the linear method: */
-  if (options->use_sparse == _TRUE_){
-    printf("Use Sparse\n");
-    Ai=options->Ai; Ap=options->Ap;
-    nnz = Ap[neq];
-
-    lasagna_calloc(Jval, nnz, sizeof(double), error_message);
-    lasagna_alloc(Aval, sizeof(double)*nnz, error_message);
-    lasagna_call(CreateMatrix_SCC(&(J),L_DBL,neq, neq, nnz, Ai, Ap, Jval, error_message),
-		 error_message, error_message);
-    lasagna_call(CreateMatrix_SCC(&(A),L_DBL,neq, neq, nnz, Ai, Ap, Aval, error_message),
-		 error_message, error_message);
+  tangent = options->tangent;
+  if (tangent != NULL){
+    lasagna_test(options->tangent_output == NULL, error_message,
+		 "The tangent-linear mode needs options->tangent_output.");
+    ntan = max(options->Tangents,1);
+    lasagna_test((options->TangentQR > 0)&&(options->tangent_growth == NULL), error_message,
+		 "TangentQR needs options->tangent_growth.");
+    lasagna_test(options->JacobianUpdates > 0, error_message,
+		 "The tangent-linear mode needs the exact Jacobian, not JacobianUpdates.");
+    /* Tangent tv is v+tv*neqp, with its differences in difv+tv*neqp: */
+    lasagna_alloc(v, (ntan*(3*neqp+7*neq+1)+1+(ntan > 1 ? 2*(ntan*neq+1) : 0))*sizeof(double)
+		  +ntan*neqp*sizeof(double*)+neqp*sizeof(int),
+		  error_message);
+    vnew = v+ntan*neqp;
+    tdifkp1 = vnew+ntan*neqp;
+    /* The differences of all tangents, then tnorm0, for ndf15_checkpoint: */
+    tnorm0 = tdifkp1+ntan*neqp+ntan*7*neq+1;
+    tb = tnorm0+ntan;
+    tx = tb+(ntan > 1 ? ntan*neq+1 : 0);
+    difv = (double**)(tx+(ntan > 1 ? ntan*neq+1 : 0));
+    tidx = (int*)(difv+ntan*neqp);
+    for (tv=0; tv<ntan; tv++){
+      difv[tv*neqp] = NULL;
+      difv[tv*neqp+1] = tdifkp1+ntan*neqp+tv*7*neq;
+      for(j=2;j<=neq;j++) difv[tv*neqp+j] = difv[tv*neqp+j-1]+7;
+      vt = v+tv*neqp;
+      for (j=1; j<=neq; j++){
+	vt[j] = tangent[tv*neq+j-1];
+	for (ii=1;ii<=7;ii++) difv[tv*neqp+j][ii]=0.;
+      }
+      /* Gram-Schmidt scales each tangent back to its norm at t0: */
+      tnorm0[tv] = sqrt(ndf15_tangent_dot(vt, vt, options->tangent_weight, neq));
+      lasagna_test((options->TangentQR > 0)&&(tnorm0[tv] == 0.0), error_message,
+		   "Tangent %d is zero.",tv);
+      if ((options->TangentQR > 0)&&(options->Restart == _FALSE_))
+	options->tangent_growth[tv] = 0.0;
+    }
+    for (j=1; j<=neq; j++) tidx[j] = _TRUE_;
+    linalg_solve_many = (options->linalg_solve_many != NULL ? options->linalg_solve_many :
+			 linalg_solve);
+    if (ntan > 1){
+      lasagna_call(CreateMatrix_DNR(&TRHS, L_DBL, ntan, neq, tb, error_message),
+		   error_message, error_message);
+      lasagna_call(CreateMatrix_DNR(&TDEL, L_DBL, ntan, neq, tx, error_message),
+		   error_message, error_message);
+    }
   }
-  else{
-    printf("Use dense\n");
-    lasagna_calloc(Jval, (neq*neq+1), sizeof(double), error_message);
-    lasagna_alloc(Aval, sizeof(double)*(neq*neq+1), error_message);
-    lasagna_call(CreateMatrix_DNR(&(J),L_DBL,neq, neq, Jval, error_message),
-		 error_message, error_message);
-    lasagna_call(CreateMatrix_DNR(&(A),L_DBL,neq, neq, Aval, error_message),
-		 error_message, error_message);
+
+  if(options->J_pointer_flag ==  _TRUE_) options->J_pointer = J;
+
+  /* The Jacobian of the run is only needed at the start of the next one,
+     and a tangent or J_pointer needs the current Jacobian from the start: */
+  nvals = (context->use_sparse == _TRUE_ ? options->Ap[neq] : neq*neq+1);
+  record_jacobian = ((options->WarmStart == _TRUE_)&&(tangent == NULL)&&
+		     (options->J_pointer_flag == _FALSE_)&&(options->Restart == _FALSE_));
+  warm_start = ((record_jacobian == _TRUE_)&&(context->warm.absh > 0.0)&&
+		(context->warm.nvals == nvals));
+  if ((record_jacobian == _TRUE_)&&(context->warm.nvals != nvals)){
+    ndf15_warm_start_free(&(context->warm));
+    lasagna_alloc(context->warm.Jval, sizeof(double)*nvals, error_message);
+    context->warm.nvals = nvals;
   }
-  if(options->J_pointer_flag ==  _TRUE_) options->J_pointer = &(J);
-  lasagna_call(linalg_initialise(&A, options, &linalg_workspace_A,error_message),
-	       error_message, error_message);
-  lasagna_call(CreateMatrix_DNR(&(RHS), L_DBL, 1, neq, rhs, error_message),
-	       error_message, error_message);
-  lasagna_call(CreateMatrix_DNR(&(DEL), L_DBL, 1, neq, del, error_message),
-	       error_message, error_message);
 
-  /* Initialize workspace for numjac: */
-  lasagna_call(initialize_numjac_workspace(&J, &nj_ws,error_message),
-	       error_message,error_message);
-	
   /* Initialize some method parameters:*/
   for(ii=0;ii<5;ii++){
     invGa[ii] = 1.0/(G[ii]*(1.0 - alpha[ii]));
@@ -255,6 +466,18 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
     //Do output at specified locations
     for(next=0; (t_vec[next]-t0)*tdir<0.0; next++);
   }
+
+  lasagna_test((options->Events > 0)&&(tangent != NULL), error_message,
+	       "The tangent-linear mode does not stop at events.");
+  lasagna_call(evolver_events_init(&events, options, neq, error_message),
+	       error_message, error_message);
+  if (events.n > 0){
+    lasagna_alloc(dense.index, sizeof(int)*neqp, error_message);
+    for (j=1; j<=neq; j++) dense.index[j] = _TRUE_;
+    dense.ynew = ynew;
+    dense.dif = dif;
+    dense.neq = neq;
+  }
  	
   if (verbose > 3){
     numidx=0;
@@ -267,126 +490,202 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
   htspan = fabs(tfinal-t0);
   hmax = htspan/10.0;
 
-  for(ii=0;ii<6;ii++) stepstat[ii] = 0;
-  
-  lasagna_call((*derivs)(t0,
-			 y+1,
-			 f0+1,
-			 parameters_and_workspace_for_derivs,
-			 error_message),
-	       error_message,error_message);
-  stepstat[2] +=1;
-
-  t = t0;
-  nfenj=0;
-  lasagna_call(numjac((*derivs),
-		      t,
-		      y,
-		      f0,
-		      &J,
-		      nj_ws,
-		      abstol,
-		      neq,
-		      &nfenj,
-		      parameters_and_workspace_for_derivs,
-		      error_message),
-	       error_message,error_message);  
-  if(options->J_pointer_flag == _TRUE_){
-    // Setting jacvec to default value.
-    for(j=1;j<=neq;j++) ((struct numjac_workspace*) nj_ws)->jacvec[j]=1.490116119384765597872e-8;
-    // Calling derivs and numjac to ensure a updated Jacobian.
-    lasagna_call((*derivs)(t0,
-			   y+1,
-			   f0+1,
-			   parameters_and_workspace_for_derivs,
-			   error_message),
-		 error_message,error_message);
+  if (options->HistoryFile != NULL){
+    lasagna_test(options->Restart == _TRUE_, error_message,
+		 "A step history can not be continued from a checkpoint.");
+    lasagna_call(ndf15_history_create(&history_file, options->HistoryFile, interpidx, neq,
+				      t0, error_message),
+		 error_message, error_message);
+  }
+
+  for(ii=0;ii<_EVOLVER_STATS_;ii++) stepstat[ii] = 0;
+  last_checkpoint = 0;
+  done = _FALSE_;
+  at_hmin = _FALSE_;
+
+  if (options->Restart == _TRUE_){
+    /* Continue from the end of a step of an earlier run: */
+    lasagna_call(evolver_checkpoint_open(options, _CHECKPOINT_NDF15_, neq, _TRUE_,
+					 &checkpoint_file, error_message),
+		 error_message, error_message);
+    lasagna_call(ndf15_checkpoint(checkpoint_file, _TRUE_, context, options, dstate, istate,
+				  y, f0, dif, v, difv, error_message),
+		 error_message, error_message);
+    lasagna_call(evolver_checkpoint_close(options, checkpoint_file, _TRUE_,
+					  parameters_and_workspace_for_derivs, error_message),
+		 error_message, error_message);
+    t = dstate[0]; absh = dstate[1]; abshlast = dstate[2]; hinvGak = dstate[3]; rate = dstate[4];
+    k = istate[0]; klast = istate[1]; nconhk = istate[2]; havrate = istate[3];
+    at_hmin = istate[4]; next = istate[5]; jac_updates = istate[6];
+    last_checkpoint = stepstat[0];
+    eqvec(y,ynew,neq);
+    lasagna_call(refresh_numjac_threads(nj_ws, options, parameters_and_workspace_for_derivs,
+					error_message),
+		 error_message, error_message);
+    update_linear_system_ndf15(J, A, hinvGak);
+    evolver_timed(options,_TIME_FACTORISE_,
+		  lasagna_call(linalg_factorise(linalg_workspace_A, _LINALG_FROM_SCRATCH_, error_message),
+			       error_message, error_message));
+    stepstat[4] += 1;
+    Jcurrent = _FALSE_;
+    new_jacobian = _FALSE_;
+  }
+  else{
+
+    evolver_timed(options,_TIME_DERIVS_,
+		  lasagna_call((*derivs)(t0,
+					 y+1,
+					 f0+1,
+					 parameters_and_workspace_for_derivs,
+					 error_message),
+			       error_message,error_message));
     stepstat[2] +=1;
-    lasagna_call(numjac((*derivs),
+
+    t = t0;
+    nfenj=0;
+    hmin = 16.0*DBL_EPSILON*fabs(t);
+  }
+  if (warm_start == _TRUE_){
+    /* Start with the Jacobian and step size of the last run: */
+    memcpy(context->Jval, context->warm.Jval, sizeof(double)*nvals);
+    Jcurrent = _FALSE_;
+    new_jacobian = _TRUE_;
+    absh = min(hmax, max(context->warm.absh, hmin));
+    h = tdir * absh;
+  }
+  else if (options->Restart == _FALSE_){
+    lasagna_call(evolver_jacobian((*derivs),
 			t,
 			y,
 			f0,
-			&J,
+			J,
 			nj_ws,
 			abstol,
 			neq,
 			&nfenj,
+			options,
 			parameters_and_workspace_for_derivs,
 			error_message),
-		 error_message,error_message);
+		 error_message,error_message);  
+    if(options->J_pointer_flag == _TRUE_){
+      // Setting jacvec to default value.
+      for(j=1;j<=neq;j++) ((struct numjac_workspace*) nj_ws)->jacvec[j]=1.490116119384765597872e-8;
+      // Calling derivs and numjac to ensure a updated Jacobian.
+      evolver_timed(options,_TIME_DERIVS_,
+		    lasagna_call((*derivs)(t0,
+					   y+1,
+					   f0+1,
+					   parameters_and_workspace_for_derivs,
+					   error_message),
+				 error_message,error_message));
+      stepstat[2] +=1;
+      lasagna_call(evolver_jacobian((*derivs),
+			  t,
+			  y,
+			  f0,
+			  J,
+			  nj_ws,
+			  abstol,
+			  neq,
+			  &nfenj,
+			  options,
+			  parameters_and_workspace_for_derivs,
+			  error_message),
+		   error_message,error_message);
+      stepstat[3] += 1;
+    }
     stepstat[3] += 1;
-  }
-  stepstat[3] += 1;
-  stepstat[2] += nfenj;
-  Jcurrent = _TRUE_; 
-  new_jacobian = _TRUE_;
-	
-  hmin = 16.0*DBL_EPSILON*fabs(t);
-  /*Calculate initial step */
-  rh = 0.0;
-
-  for(jj=1;jj<=neq;jj++){
-    wt[jj] = max(fabs(y[jj]),threshold);
-    /*printf("wt: %4.8f \n",wt[jj]);*/
-    rh = max(rh,1.25/sqrt(rtol)*fabs(f0[jj]/wt[jj]));
-    //printf("Index: %d, rh=%e\n",jj,1.25/sqrt(rtol)*fabs(f0[jj]/wt[jj]));
-  }
-  
-  absh = min(hmax, htspan);
-  if (absh * rh > 1.0) absh = 1.0 / rh;
-	
-  absh = max(absh, hmin);
-  h = tdir * absh;
-  tdel = (t + tdir*min(sqrt(DBL_EPSILON)*max(fabs(t),fabs(t+h)),absh)) - t;
-
-  lasagna_call((*derivs)(t+tdel,y+1,tempvec1+1,parameters_and_workspace_for_derivs,error_message),
-	     error_message,error_message);
-  stepstat[2] += 1;
-
-  /*I assume that a full jacobi matrix is always calculated in the beginning...*/
-  //Must do something here:
-  switch(J.Stype){
-  case(L_DNR):
-    StoreDNR = (DNRformat *) J.Store;
-    Matrix = (double **) StoreDNR->Matrix;
-    for(ii=1;ii<=neq;ii++){
-      ddfddt[ii]=0.0;
-      for(jj=1;jj<=neq;jj++){
-	ddfddt[ii]+=(Matrix[ii][jj])*f0[jj];
-      }
+    stepstat[2] += nfenj;
+    Jcurrent = _TRUE_; 
+    new_jacobian = _TRUE_;
+    if (record_jacobian == _TRUE_){
+      memcpy(context->warm.Jval, context->Jval, sizeof(double)*nvals);
+      record_jacobian = _FALSE_;
     }
+	
+    /*Calculate initial step */
     rh = 0.0;
-    for(ii=1;ii<=neq;ii++){
-      ddfddt[ii] += (tempvec1[ii] - f0[ii]) / tdel;
-      rh = max(rh,1.25*sqrt(0.5*fabs(ddfddt[ii]/wt[ii])/rtol));
+
+    for(jj=1;jj<=neq;jj++){
+      wt[jj] = max(fabs(y[jj]),threshold);
+      /*printf("wt: %4.8f \n",wt[jj]);*/
+      rh = max(rh,1.25/sqrt(rtol)*fabs(f0[jj]/wt[jj]));
+      //printf("Index: %d, rh=%e\n",jj,1.25/sqrt(rtol)*fabs(f0[jj]/wt[jj]));
     }
+  
     absh = min(hmax, htspan);
     if (absh * rh > 1.0) absh = 1.0 / rh;
+	
     absh = max(absh, hmin);
     h = tdir * absh;
-    break;
-  }  
-  /* Done calculating initial step
-     Get ready to do the loop:*/
-  k = 1;			/*start at order 1 with BDF1	*/
-  klast = k;
-  abshlast = absh;
-
-  for(ii=1;ii<=neq;ii++) dif[ii][1] = h*f0[ii];
+    tdel = (t + tdir*min(sqrt(DBL_EPSILON)*max(fabs(t),fabs(t+h)),absh)) - t;
+
+    evolver_timed(options,_TIME_DERIVS_,
+		  lasagna_call((*derivs)(t+tdel,y+1,tempvec1+1,parameters_and_workspace_for_derivs,error_message),
+			     error_message,error_message));
+    stepstat[2] += 1;
+
+    /*I assume that a full jacobi matrix is always calculated in the beginning...*/
+    //Must do something here:
+    switch(J->Stype){
+    case(L_DNR):
+      StoreDNR = (DNRformat *) J->Store;
+      Matrix = (double **) StoreDNR->Matrix;
+      for(ii=1;ii<=neq;ii++){
+	ddfddt[ii]=0.0;
+	for(jj=1;jj<=neq;jj++){
+	  ddfddt[ii]+=(Matrix[ii][jj])*f0[jj];
+	}
+      }
+      rh = 0.0;
+      for(ii=1;ii<=neq;ii++){
+	ddfddt[ii] += (tempvec1[ii] - f0[ii]) / tdel;
+	rh = max(rh,1.25*sqrt(0.5*fabs(ddfddt[ii]/wt[ii])/rtol));
+      }
+      absh = min(hmax, htspan);
+      if (absh * rh > 1.0) absh = 1.0 / rh;
+      absh = max(absh, hmin);
+      h = tdir * absh;
+      break;
+    case(L_SCC):
+      /* No second derivative estimate, keep the step found above. */
+      break;
+    }  
+  }
+  if (options->Restart == _FALSE_){
+    /* Done calculating initial step
+       Get ready to do the loop:*/
+    k = 1;			/*start at order 1 with BDF1	*/
+    klast = k;
+    abshlast = absh;
+
+    for(ii=1;ii<=neq;ii++) dif[ii][1] = h*f0[ii];
+    if (tangent != NULL){
+      for (tv=0; tv<ntan; tv++){
+	ndf15_jacobian_product(J, v+tv*neqp, tdifkp1);
+	for(ii=1;ii<=neq;ii++) difv[tv*neqp+ii][1] = h*tdifkp1[ii];
+      }
+    }
 	
-  hinvGak = h*invGa[k-1];
-  nconhk = 0; 	/*steps taken with current h and k*/
+    hinvGak = h*invGa[k-1];
+    nconhk = 0; 	/*steps taken with current h and k*/
  
-  update_linear_system_ndf15(&J, &A, hinvGak);
-  lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-	       error_message, error_message);
-  stepstat[4] += 1;
-  new_jacobian = _FALSE_;
-  havrate = _FALSE_; /*false*/
+    update_linear_system_ndf15(J, A, hinvGak);
+    /* A reused context keeps the ordering, but not the pivots of the last run: */
+    evolver_timed(options,_TIME_FACTORISE_,
+		  lasagna_call(linalg_factorise(linalg_workspace_A, 
+						(context->runs > 1 ? _LINALG_FROM_SCRATCH_ : new_jacobian),
+						error_message),
+			       error_message, error_message));
+    stepstat[4] += 1;
+    new_jacobian = _FALSE_;
+    havrate = _FALSE_; /*false*/
+  }
+
+
+  lasagna_call(evolver_progress_start(options, t, tfinal, y+1), error_message, error_message);
 
   /* Doing main loop: */
-  done = _FALSE_;
-  at_hmin = _FALSE_;
   while (done==_FALSE_){
     hmin = 16*DBL_EPSILON*fabs(t);
     maxtmp = max(hmin,absh);
@@ -410,11 +709,15 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
     }
     if (((fabs(absh-abshlast)/absh)>1e-6)||(k!=klast)){
       adjust_stepsize(dif,(absh/abshlast),neq,k);
+      if (tangent != NULL){
+	for (tv=0; tv<ntan; tv++) adjust_stepsize(difv+tv*neqp,(absh/abshlast),neq,k);
+      }
       hinvGak = h * invGa[k-1];
       nconhk = 0;
-      update_linear_system_ndf15(&J, &A, hinvGak);
-      lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-		   error_message, error_message);
+      update_linear_system_ndf15(J, A, hinvGak);
+      evolver_timed(options,_TIME_FACTORISE_,
+		    lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
+				 error_message, error_message));
       stepstat[4] += 1;
       new_jacobian = _FALSE_;
       havrate = _FALSE_;
@@ -424,67 +727,49 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
     for( ; ; ){
       gotynew = _FALSE_;	/* is ynew evaluated yet?*/
       while(gotynew==_FALSE_){
-	/*Compute the constant terms in the equation for ynew.
-	  Next FOR lop is just: psi = matmul(dif(:,1:k),(G(1:k) * invGa(k)))*/
-	for(ii=1;ii<=neq;ii++){
-	  psi[ii] = 0.0;
-	  for(jj=1;jj<=k;jj++){
-	    psi[ii] += dif[ii][jj]*G[jj-1]*invGa[k-1];
-	  }
-	}
-	/* Predict a solution at t+h. */
+	/*Compute the constant terms in the equation for ynew,
+	  psi = matmul(dif(:,1:k),(G(1:k) * invGa(k))).
+	  The prediction of ynew at t+h is formed in the same pass. */
+	ndf15_predict(dif,y,G,invGa[k-1],k,neq,psi,pred,ynew);
 	tnew = t + h;
 	if (done==_TRUE_){
 	  tnew = tfinal; /*Hit end point exactly. */
 	}
 	h = tnew - t; 		 /* Purify h. */
-	for(ii=1;ii<=neq;ii++){
-	  pred[ii] = y[ii];
-	  for(jj=1;jj<=k;jj++){
-	    pred[ii] +=dif[ii][jj];
-	  }
-	}
-	eqvec(pred,ynew,neq);
 							
 	/*The difference, difkp1, between pred and the final accepted
 	  ynew is equal to the backward difference of ynew of order
 	  k+1. Initialize to zero for the iteration to compute ynew.
 	*/
 							
-	minnrm = 0.0;
-	for(j=1;j<=neq;j++){
-	  difkp1[j] = 0.0;
-	  maxtmp = max(fabs(ynew[j]),fabs(y[j]));
-	  invwt[j] = 1.0 / max(maxtmp,threshold);
-	  maxtmp = 100*DBL_EPSILON*fabs(ynew[j]*invwt[j]);
-	  minnrm = max(minnrm,maxtmp);
-	}
+	minnrm = ndf15_weights(y,ynew,threshold,invwt,difkp1,neq);
 	/* Iterate with simplified Newton method. */
 	tooslow = _FALSE_;
+	have_secant = _FALSE_;
 	for(iter=1;iter<=maxit;iter++){
-	  for (ii=1;ii<=neq;ii++){
-	    tempvec1[ii]=(psi[ii]+difkp1[ii]);
-	  }
-	  lasagna_call((*derivs)(tnew,ynew+1,f0+1,parameters_and_workspace_for_derivs,error_message),
-		       error_message,error_message);
+	  evolver_timed(options,_TIME_DERIVS_,
+			lasagna_call((*derivs)(tnew,ynew+1,f0+1,parameters_and_workspace_for_derivs,error_message),
+				     error_message,error_message));
 	  stepstat[2] += 1;
-	  for(j=1;j<=neq;j++){
-	    rhs[j] = hinvGak*f0[j]-tempvec1[j];
+	  if (options->JacobianUpdates > 0){
+	    /* del still holds the last correction, the step from the previous iterate: */
+	    if (iter > 1){
+	      for(j=1;j<=neq;j++){
+		sec_s[j] = del[j];
+		sec_d[j] = f0[j]-fprev[j];
+	      }
+	      have_secant = _TRUE_;
+	    }
+	    eqvec(f0,fprev,neq);
 	  }
+	  ndf15_newton_rhs(psi,difkp1,f0,hinvGak,rhs,neq);
 								
 	  /*Solve the linear system A*x=del by using the LU decomposition stored in linalg_workspace.*/
-	  lasagna_call(linalg_solve(&RHS, &DEL, linalg_workspace_A, error_message),
-		       error_message, error_message);
+	  evolver_timed(options,_TIME_SOLVE_,
+			lasagna_call(linalg_solve(RHS, DEL, linalg_workspace_A, error_message),
+				     error_message, error_message));
 	  stepstat[5]+=1;
-	  newnrm = 0.0;
-	  for(j=1;j<=neq;j++){
-	    maxtmp = fabs(del[j]*invwt[j]);
-	    newnrm = max(newnrm,maxtmp);
-	  }
-	  for(j=1;j<=neq;j++){
-	    difkp1[j] += del[j];
-	    ynew[j] = pred[j] + difkp1[j];
-	  }
+	  newnrm = ndf15_newton_update(del,invwt,pred,difkp1,ynew,neq);
 	  if (newnrm <= minnrm){
 	    gotynew = _TRUE_;
 	    break; /* Break Newton loop */
@@ -527,20 +812,34 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 	if (tooslow==_TRUE_){
 	  stepstat[1] += 1;
 	  /*	! Speed up the iteration by forming new linearization or reducing h. */
-	  if (Jcurrent==_FALSE_){
-	    lasagna_call((*derivs)(t,y+1,f0+1,parameters_and_workspace_for_derivs,error_message),
-		       error_message,error_message);
+	  if ((Jcurrent==_FALSE_)&&(have_secant==_TRUE_)&&(secant_tried==_FALSE_)&&
+	      (jac_updates < options->JacobianUpdates)){
+	    /* Try a secant update of the old Jacobian before a new one: */
+	    ndf15_jacobian_secant(J, sec_s, sec_d, sec_w);
+	    stepstat[_STAT_JAC_UPDATE_] += 1;
+	    jac_updates++;
+	    secant_tried = _TRUE_;
+	    new_jacobian = _TRUE_;
+	  }
+	  else if (Jcurrent==_FALSE_){
+	    if (secant_tried == _TRUE_)
+	      stepstat[_STAT_JAC_UPDATE_FALLBACK_] += 1;
+	    jac_updates = 0;
+	    evolver_timed(options,_TIME_DERIVS_,
+			  lasagna_call((*derivs)(t,y+1,f0+1,parameters_and_workspace_for_derivs,error_message),
+				     error_message,error_message));
 	    nfenj=0;
-	    lasagna_call(numjac((*derivs),t,y,f0,&J,nj_ws,abstol,neq,
-			      &nfenj,parameters_and_workspace_for_derivs,error_message),
+	    lasagna_call(evolver_jacobian((*derivs),t,y,f0,J,nj_ws,abstol,neq,
+			      &nfenj,options,parameters_and_workspace_for_derivs,error_message),
 			 error_message,error_message);
 	    if(options->J_pointer_flag == _TRUE_){
 	      // Calling derivs and numjac to ensure a updated Jacobian.
-	      lasagna_call((*derivs)(t,y+1,f0+1, parameters_and_workspace_for_derivs,error_message),
-			   error_message,error_message);
+	      evolver_timed(options,_TIME_DERIVS_,
+			    lasagna_call((*derivs)(t,y+1,f0+1, parameters_and_workspace_for_derivs,error_message),
+					 error_message,error_message));
 	      stepstat[2] +=1;
-	      lasagna_call(numjac((*derivs),t,y,f0,&J,nj_ws,abstol,neq,
-				  &nfenj,parameters_and_workspace_for_derivs,error_message),
+	      lasagna_call(evolver_jacobian((*derivs),t,y,f0,J,nj_ws,abstol,neq,
+				  &nfenj,options,parameters_and_workspace_for_derivs,error_message),
 			   error_message,error_message);
 	      stepstat[3] += 1;
 	    }
@@ -548,6 +847,10 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 	    stepstat[2] += (nfenj + 1);
 	    Jcurrent = _TRUE_;
 	    new_jacobian = _TRUE_;
+	    if (record_jacobian == _TRUE_){
+	      memcpy(context->warm.Jval, context->Jval, sizeof(double)*nvals);
+	      record_jacobian = _FALSE_;
+	    }
 	  }
 	  else if (absh <= hmin){
 	    lasagna_test(absh <= hmin, error_message,
@@ -560,13 +863,17 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 	    h = tdir * absh;
 	    done = _FALSE_;
 	    adjust_stepsize(dif,(absh/abshlast),neq,k);
+	    if (tangent != NULL){
+	for (tv=0; tv<ntan; tv++) adjust_stepsize(difv+tv*neqp,(absh/abshlast),neq,k);
+      }
 	    hinvGak = h * invGa[k-1];
 	    nconhk = 0;
 	  }
 	  /* A new linearisation is needed in both cases */
-	  update_linear_system_ndf15(&J, &A, hinvGak);
-	  lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-		       error_message, error_message);
+	  update_linear_system_ndf15(J, A, hinvGak);
+	  evolver_timed(options,_TIME_FACTORISE_,
+			lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
+				     error_message, error_message));
 	  stepstat[4] += 1;
 	  new_jacobian = _FALSE_;
 	  havrate = _FALSE_;
@@ -621,11 +928,15 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 	  done = _FALSE_;
 	}
 	adjust_stepsize(dif,(absh/abshlast),neq,k);
+	if (tangent != NULL){
+	for (tv=0; tv<ntan; tv++) adjust_stepsize(difv+tv*neqp,(absh/abshlast),neq,k);
+      }
 	hinvGak = h * invGa[k-1];
 	nconhk = 0;
-	update_linear_system_ndf15(&J, &A, hinvGak);
-	lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-		     error_message, error_message);
+	update_linear_system_ndf15(J, A, hinvGak);
+	evolver_timed(options,_TIME_FACTORISE_,
+		      lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
+				   error_message, error_message));
 	stepstat[4] += 1;
 	new_jacobian = _FALSE_;
 	havrate = _FALSE_;
@@ -635,25 +946,75 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
       }
     }
     /* End of conditionless FOR loop */
+    if (tangent != NULL){
+      /* Tangent at tnew: with vnew = pred + difkp1 the NDF formula for
+	 v' = J v is (I - hinvGak J) difkp1 = hinvGak J pred - psi. Several
+	 tangents are the rows of one linalg_solve_many. */
+      for (tv=0; tv<ntan; tv++){
+	vt = (ntan > 1 ? tb+tv*neq : rhs);
+	for(ii=1;ii<=neq;ii++){
+	  psi[ii] = 0.0;
+	  vnew[tv*neqp+ii] = v[tv*neqp+ii];
+	  for(jj=1;jj<=k;jj++){
+	    psi[ii] += difv[tv*neqp+ii][jj]*G[jj-1]*invGa[k-1];
+	    vnew[tv*neqp+ii] += difv[tv*neqp+ii][jj];
+	  }
+	}
+	ndf15_jacobian_product(J, vnew+tv*neqp, vt);
+	for(ii=1;ii<=neq;ii++) vt[ii] = hinvGak*vt[ii]-psi[ii];
+      }
+      if (ntan == 1){
+	evolver_timed(options,_TIME_SOLVE_,
+		      lasagna_call(linalg_solve(RHS, DEL, linalg_workspace_A, error_message),
+				   error_message, error_message));
+      }
+      else{
+	evolver_timed(options,_TIME_SOLVE_,
+		      lasagna_call(linalg_solve_many(&TRHS, &TDEL, linalg_workspace_A, error_message),
+				   error_message, error_message));
+      }
+      stepstat[5]+=ntan;
+      for (tv=0; tv<ntan; tv++){
+	vt = (ntan > 1 ? tx+tv*neq : del);
+	for(ii=1;ii<=neq;ii++){
+	  tdifkp1[tv*neqp+ii] = vt[ii];
+	  vnew[tv*neqp+ii] += vt[ii];
+	}
+      }
+    }
     if (print_variables != NULL){
-      lasagna_call((*print_variables)(t,
-				      ynew+1,
-				      f0+1,
-				      parameters_and_workspace_for_derivs,
-				      error_message),
-		   error_message,error_message);
+      evolver_timed(options,_TIME_OUTPUT_,
+		    lasagna_call((*print_variables)(t,
+						    ynew+1,
+						    f0+1,
+						    parameters_and_workspace_for_derivs,
+						    error_message),
+				 error_message,error_message));
     }
     stepstat[0] += 1;
+    if ((options->WarmStart == _TRUE_)&&(stepstat[0] == 1))
+      context->warm.absh = absh;
 		 
     /* Update dif: */
-    for(jj=1;jj<=neq;jj++){
-      dif[jj][k+2] = difkp1[jj] - dif[jj][k+1];
-      dif[jj][k+1] = difkp1[jj];
+    ndf15_dif_update(dif,difkp1,k,neq);
+    if (tangent != NULL){
+      for (tv=0; tv<ntan; tv++)
+	ndf15_dif_update(difv+tv*neqp,tdifkp1+tv*neqp,k,neq);
     }
-    for(j=k;j>=1;j--){
-      for(ii=1;ii<=neq;ii++){
-	dif[ii][j] += dif[ii][j+1];
-      }
+    if (history_file != NULL){
+      lasagna_call(ndf15_history_step(history_file, tnew, h, k, ynew, dif, interpidx, neq,
+				      error_message),
+		   error_message, error_message);
+    }
+    /** Events on the step, output stops at a terminal one: **/
+    if (events.n > 0){
+      dense.tnew = tnew;
+      dense.h = h;
+      dense.k = k;
+      lasagna_call(evolver_events_locate(&events, options, t, tnew, ndf15_event_interp, &dense,
+					 parameters_and_workspace_for_derivs, &event_stop,
+					 error_message),
+		   error_message, error_message);
     }
     /** Output **/
     if (t_vec==NULL){
@@ -661,6 +1022,8 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
       for (jj=1; jj<tres; jj++){
 	//Interpolated outputs:
 	ti = tnew-(1.0-jj/((double) tres))*h;
+	if ((event_stop == _TRUE_)&&((ti-events.t_event)*tdir > 0.0))
+	  break;
 	interp_from_dif(ti,
 			tnew,
 			ynew,
@@ -673,39 +1036,55 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 			interpidx,
 			neq,
 			2);				
-	lasagna_call((*output)(ti,
-			       yinterp+1,
-			       ypinterp+1,
-			       jj,
-			       parameters_and_workspace_for_derivs,
-			       error_message),error_message,error_message);
+	for (tv=0; (tangent != NULL)&&(tv<ntan); tv++)
+	  ndf15_tangent_output(ti,tnew,vnew+tv*neqp,h,difv+tv*neqp,k,tidx,neq,
+			       options->tangent_output+tv*neq);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(ti,
+					     yinterp+1,
+					     ypinterp+1,
+					     jj,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+      }
+      for (tv=0; (tangent != NULL)&&(tv<ntan); tv++)
+	ndf15_tangent_output(tnew,tnew,vnew+tv*neqp,h,difv+tv*neqp,k,tidx,neq,
+			     options->tangent_output+tv*neq);
+      if (event_stop == _FALSE_){
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(tnew,
+					     ynew+1,
+					     f0+1,
+					     tres,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
       }
-      lasagna_call((*output)(tnew,
-			     ynew+1,
-			     f0+1,
-			     tres,
-			     parameters_and_workspace_for_derivs,
-			     error_message),error_message,error_message);
     }
     else {
       //Output at Tvec grid:
-      while ((next<tres)&&(tdir * (tnew - t_vec[next]) >= 0.0)){
+      while ((next<tres)&&(tdir * (tnew - t_vec[next]) >= 0.0)&&
+	     ((event_stop == _FALSE_)||(tdir * (events.t_event - t_vec[next]) >= 0.0))){
 	/* Do we need to write output? */
+	for (tv=0; (tangent != NULL)&&(tv<ntan); tv++)
+	  ndf15_tangent_output(t_vec[next],tnew,vnew+tv*neqp,h,difv+tv*neqp,k,tidx,neq,
+			       options->tangent_output+tv*neq);
 	if (tnew==t_vec[next]){
-	  lasagna_call((*output)(t_vec[next],
-				 ynew+1,
-				 f0+1,
-				 next,
-				 parameters_and_workspace_for_derivs,
-				 error_message),
-		       error_message,error_message);
+	  evolver_timed(options,_TIME_OUTPUT_,
+			lasagna_call((*output)(t_vec[next],
+					       ynew+1,
+					       f0+1,
+					       next,
+					       parameters_and_workspace_for_derivs,
+					       error_message),
+				     error_message,error_message));
 	  if (print_variables != NULL){
-	    lasagna_call((*print_variables)(t_vec[next],
-					    ynew+1,
-					    f0+1,
-					    parameters_and_workspace_for_derivs,
-					    error_message),
-			 error_message,error_message);
+	    evolver_timed(options,_TIME_OUTPUT_,
+			  lasagna_call((*print_variables)(t_vec[next],
+							  ynew+1,
+							  f0+1,
+							  parameters_and_workspace_for_derivs,
+							  error_message),
+				       error_message,error_message));
 	  }
 	}
 	else {
@@ -722,17 +1101,35 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
 			  interpidx,
 			  neq,
 			  2);				
-	  lasagna_call((*output)(t_vec[next],
-				 yinterp+1,
-				 ypinterp+1,
-				 next,
-				 parameters_and_workspace_for_derivs,
-				 error_message),error_message,error_message);
+	  evolver_timed(options,_TIME_OUTPUT_,
+			lasagna_call((*output)(t_vec[next],
+					       yinterp+1,
+					       ypinterp+1,
+					       next,
+					       parameters_and_workspace_for_derivs,
+					       error_message),error_message,error_message));
 	}
 	next++;	
       }
     }
     /** End of output **/
+    if (event_stop == _TRUE_){
+      /* End the integration at the event: */
+      tnew = events.t_event;
+      t = tnew;
+      for (jj=1; jj<=neq; jj++) ynew[jj] = events.y_event[jj-1];
+      eqvec(ynew,y,neq);
+      evolver_timed(options,_TIME_DERIVS_,
+		    lasagna_call((*derivs)(t,y+1,f0+1,parameters_and_workspace_for_derivs,error_message),
+				 error_message,error_message));
+      stepstat[2] += 1;
+      evolver_timed(options,_TIME_OUTPUT_,
+		    lasagna_call((*output)(t,y+1,f0+1,next,
+					   parameters_and_workspace_for_derivs,
+					   error_message),error_message,error_message));
+      printf("Event stop at t=%.16e...\n",t);
+      break;
+    }
     if (done==_TRUE_) {
       break;
     }
@@ -794,25 +1191,77 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
     /* Advance the integration one step. */
     t = tnew;
     eqvec(ynew,y,neq);
+    if (tangent != NULL){
+      for (tv=0; tv<ntan; tv++) eqvec(vnew+tv*neqp,v+tv*neqp,neq);
+      if ((options->TangentQR > 0)&&(stepstat[0]%options->TangentQR == 0))
+	ndf15_tangent_orthonormalise(v, difv, neq, ntan, options->tangent_weight, tnorm0,
+				     options->tangent_growth);
+      for (tv=0; tv<ntan; tv++)
+	ndf15_tangent_output(t,t,v+tv*neqp,h,difv+tv*neqp,k,tidx,neq,
+			     options->tangent_output+tv*neq);
+    }
     Jcurrent = _FALSE_;
+    secant_tried = _FALSE_;
 
+    if (options->ProgressInterval > 0.0)
+      evolver_progress(options, t, tfinal, h, k, y+1, _FALSE_);
     /* Perhaps use stop function: */
     if (stop_function != NULL){
       if ((stepstat[0]>500000000)||
 	  (stop_function(t,y+1,f0+1,parameters_and_workspace_for_derivs,
 			   error_message) == _TRUE_)){      //Stop condition
-	lasagna_call((*output)(t,y+1,f0+1,next,
-			       parameters_and_workspace_for_derivs,
-			       error_message),error_message,error_message);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(t,y+1,f0+1,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
 	printf("Stop condition met...\n");
 	break;
       }
     }
+    /* Perhaps write a checkpoint: */
+    if (evolver_checkpoint_due(options, stepstat[0], &last_checkpoint) == _TRUE_){
+      dstate[0] = t; dstate[1] = absh; dstate[2] = abshlast; dstate[3] = hinvGak; dstate[4] = rate;
+      istate[0] = k; istate[1] = klast; istate[2] = nconhk; istate[3] = havrate;
+      istate[4] = at_hmin; istate[5] = next; istate[6] = jac_updates;
+      lasagna_call(evolver_checkpoint_open(options, _CHECKPOINT_NDF15_, neq, _FALSE_,
+					   &checkpoint_file, error_message),
+		   error_message, error_message);
+      lasagna_call(ndf15_checkpoint(checkpoint_file, _FALSE_, context, options, dstate, istate,
+				    y, f0, dif, v, difv, error_message),
+		   error_message, error_message);
+      lasagna_call(evolver_checkpoint_close(options, checkpoint_file, _FALSE_,
+					    parameters_and_workspace_for_derivs, error_message),
+		   error_message, error_message);
+      update_linear_system_ndf15(J, A, hinvGak);
+      evolver_timed(options,_TIME_FACTORISE_,
+		    lasagna_call(linalg_factorise(linalg_workspace_A, _LINALG_FROM_SCRATCH_, error_message),
+				 error_message, error_message));
+      stepstat[4] += 1;
+      new_jacobian = _FALSE_;
+      lasagna_call(refresh_numjac_threads(nj_ws, options, parameters_and_workspace_for_derivs,
+					  error_message),
+		   error_message, error_message);
+    }
   }
 
+  if (history_file != NULL)
+    lasagna_test(fclose(history_file) != 0, error_message,
+		 "Could not write %s.",options->HistoryFile);
+  if (events.n > 0)
+    free(dense.index);
+  evolver_events_free(&events);
   /* a last call is compulsory to ensure that all quantitites in
      y,dy,parameters_and_workspace_for_derivs are updated to the
      last point in the covered range */
+  if (tangent != NULL){
+    for (tv=0; tv<ntan; tv++)
+      for(j=1;j<=neq;j++) tangent[tv*neq+j-1] = v[tv*neqp+j];
+    if (ntan > 1){
+      DestroyMultiMatrix(&TRHS);
+      DestroyMultiMatrix(&TDEL);
+    }
+    free(v);
+  }
   printf("Last call to derivs at t=%.16e.\n",tnew);
   lasagna_call(
 	     (*derivs)(tnew,
@@ -826,44 +1275,243 @@ int evolver_ndf15(int (*derivs)(double x,double * y,double * dy,
     printf("\n End of evolver. Next=%d, t=%e and tnew=%e.",next,t,tnew);
     printf("\n Statistics: [%d %d %d %d %d %d] \n",stepstat[0],stepstat[1],
 	   stepstat[2],stepstat[3],stepstat[4],stepstat[5]);
+    if ((verbose > 1)&&(stepstat[_STAT_REFACTOR_]+stepstat[_STAT_FULL_LU_]>0))
+      printf(" Refactorisations: %d, full decompositions: %d, rejected: %d.\n",
+	     stepstat[_STAT_REFACTOR_],stepstat[_STAT_FULL_LU_],
+	     stepstat[_STAT_REFACTOR_REJECTED_]);
+    if ((verbose > 1)&&(stepstat[_STAT_REFINE_]+stepstat[_STAT_REFINE_FALLBACK_]>0))
+      printf(" Refinement steps: %d, solves redone in double precision: %d.\n",
+	   stepstat[_STAT_REFINE_],stepstat[_STAT_REFINE_FALLBACK_]);
+    if ((verbose > 1)&&(options->JacobianUpdates > 0))
+      printf(" Jacobian updates: %d, Jacobians computed after an update: %d.\n",
+	     stepstat[_STAT_JAC_UPDATE_],stepstat[_STAT_JAC_UPDATE_FALLBACK_]);
   }
 	
-  /** Deallocate memory */
-
-  free(buffer);
-  DestroyMultiMatrix(&J);
-  DestroyMultiMatrix(&A);
-  DestroyMultiMatrix(&DEL);
-  DestroyMultiMatrix(&RHS);
-  lasagna_call(linalg_finalise(linalg_workspace_A, error_message),
-	       error_message, error_message);
-  free(Jval);
-  free(Aval);
-  /* 	free(f0); */
-  /* 	free(wt); */
-  /* 	free(ddfddt); */
-  /* 	free(pred); */
-  /* 	free(y); */
-  /* 	free(invwt); */
-  /* 	free(rhs); */
-  /* 	free(psi); */
-  /* 	free(difkp1); */
-  /* 	free(del); */
-  /* 	free(yinterp); */
-  /* 	free(ypinterp); */
-  /* 	free(yppinterp); */
-  /* 	free(tempvec1); */
-  /* 	free(tempvec2); */
-
-  /* 	free(interpidx); */
-  /* 	free(dif[1]); */
-  /* 	free(dif); */
-	
-  uninitialize_numjac_workspace(nj_ws);
   return _SUCCESS_;
 
 } /*End of program*/
 
+int ndf15_checkpoint(FILE *file,
+		     int restore,
+		     struct ndf15_context *context,
+		     EvolverOptions *options,
+		     double *dstate,
+		     int *istate,
+		     double *y,
+		     double *f0,
+		     double **dif,
+		     double *v,
+		     double **difv,
+		     ErrorMsg error_message){
+  /* Writes or reads the state of ndf15 at the end of a step: the scalars in
+     dstate[0..4] and istate[0..6], y, f0, the backward differences, the
+     statistics, the Jacobian and the numjac increments, and the tangents
+     with their differences if v is not NULL. With TangentQR, the norms at
+     t0 follow the differences, and then the growth of the tangents. */
+  size_t neq = context->neq;
+  int nnz, ntan = max(options->Tangents,1);
+
+  if (context->use_sparse == _TRUE_)
+    nnz = options->Ap[neq];
+  else
+    nnz = neq*neq+1;
+  lasagna_call(evolver_checkpoint_io(file, dstate, sizeof(double), 5, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, istate, sizeof(int), 7, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, y+1, sizeof(double), neq, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, f0+1, sizeof(double), neq, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, dif[1]+1, sizeof(double), 7*neq, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, options->Stats, sizeof(int), _EVOLVER_STATS_,
+				     restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, context->Jval, sizeof(double), nnz,
+				     restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, ((struct numjac_workspace*) context->nj_ws)->jacvec+1,
+				     sizeof(double), neq, restore, error_message),
+	       error_message, error_message);
+  if (v != NULL){
+    lasagna_call(evolver_checkpoint_io(file, v+1, sizeof(double), ntan*(neq+1)-1, restore,
+				       error_message),
+		 error_message, error_message);
+    lasagna_call(evolver_checkpoint_io(file, difv[1]+1, sizeof(double), ntan*7*neq+ntan, restore,
+				       error_message),
+		 error_message, error_message);
+    if (options->TangentQR > 0)
+      lasagna_call(evolver_checkpoint_io(file, options->tangent_growth, sizeof(double), ntan,
+					 restore, error_message),
+		   error_message, error_message);
+  }
+  return _SUCCESS_;
+}
+
+int ndf15_history_create(FILE **file,
+			 char *filename,
+			 int *index,
+			 size_t neq,
+			 double t0,
+			 ErrorMsg error_message){
+  /* Creates the history file, with the header: a magic string, the number
+     of components, their indices and t0. */
+  char magic[8]="LASAGNH";
+  int i, n=0;
+
+  *file = fopen(filename,"wb");
+  lasagna_test(*file == NULL, error_message,"Could not open %s.",filename);
+  for (i=1; i<=neq; i++){
+    if (index[i] == _TRUE_) n++;
+  }
+  fwrite(magic,1,8,*file);
+  fwrite(&n,sizeof(int),1,*file);
+  for (i=1; i<=neq; i++){
+    if (index[i] == _TRUE_){
+      n = i-1;
+      fwrite(&n,sizeof(int),1,*file);
+    }
+  }
+  lasagna_test(fwrite(&t0,sizeof(double),1,*file) != 1, error_message,
+	       "Could not write %s.",filename);
+  return _SUCCESS_;
+}
+
+int ndf15_history_step(FILE *file,
+		       double tnew,
+		       double h,
+		       int k,
+		       double *ynew,
+		       double **dif,
+		       int *index,
+		       size_t neq,
+		       ErrorMsg error_message){
+  /* Appends a step: tnew, h, k, then y and dif[1..k] of each component. */
+  int i;
+  fwrite(&tnew,sizeof(double),1,file);
+  fwrite(&h,sizeof(double),1,file);
+  fwrite(&k,sizeof(int),1,file);
+  for (i=1; i<=neq; i++){
+    if (index[i] == _TRUE_){
+      fwrite(ynew+i,sizeof(double),1,file);
+      fwrite(dif[i]+1,sizeof(double),k,file);
+    }
+  }
+  lasagna_test(ferror(file) != 0, error_message,"Could not write the step history.");
+  return _SUCCESS_;
+}
+
+int ndf15_history_open(struct ndf15_history *history,
+		       char *filename,
+		       ErrorMsg error_message){
+  /* Reads the header and indexes the steps of a history file. */
+  char magic[8]="LASAGNH", header[8];
+  int i, n, k, pass;
+  long start, end;
+  double step[2];
+
+  history->file = fopen(filename,"rb");
+  lasagna_test(history->file == NULL, error_message,"Could not open %s.",filename);
+  lasagna_test((fread(header,1,8,history->file) != 8)||(memcmp(header,magic,8) != 0)||
+	       (fread(&n,sizeof(int),1,history->file) != 1)||(n < 1),
+	       error_message,"%s is not a step history.",filename);
+  history->n = n;
+  lasagna_alloc(history->components,sizeof(int)*n,error_message);
+  lasagna_test((fread(history->components,sizeof(int),n,history->file) != n)||
+	       (fread(&(history->t0),sizeof(double),1,history->file) != 1),
+	       error_message,"%s is not a step history.",filename);
+  /* Count the complete steps, then index them: */
+  start = ftell(history->file);
+  fseek(history->file,0,SEEK_END);
+  end = ftell(history->file);
+  for (pass=0; pass<2; pass++){
+    fseek(history->file,start,SEEK_SET);
+    for (i=0; (fread(step,sizeof(double),2,history->file) == 2)&&
+	   (fread(&k,sizeof(int),1,history->file) == 1); i++){
+      lasagna_test((k < 1)||(k > 5), error_message,"Step %d of %s is damaged.",i,filename);
+      if (ftell(history->file)+(long) sizeof(double)*n*(1+k) > end)
+	break;
+      if (pass == 1){
+	history->tnew[i] = step[0];
+	history->h[i] = step[1];
+	history->k[i] = k;
+	history->offset[i] = ftell(history->file);
+      }
+      fseek(history->file,sizeof(double)*n*(1+k),SEEK_CUR);
+    }
+    history->steps = i;
+    lasagna_test(history->steps == 0, error_message,"%s has no steps.",filename);
+    if (pass == 0){
+      lasagna_alloc(history->tnew,sizeof(double)*i,error_message);
+      lasagna_alloc(history->h,sizeof(double)*i,error_message);
+      lasagna_alloc(history->k,sizeof(int)*i,error_message);
+      lasagna_alloc(history->offset,sizeof(long)*i,error_message);
+    }
+  }
+
+  lasagna_alloc(history->ynew,sizeof(double)*(n+1),error_message);
+  lasagna_alloc(history->dif,sizeof(double*)*(n+1)+sizeof(double)*7*n,error_message);
+  lasagna_alloc(history->index,sizeof(int)*(n+1),error_message);
+  history->dif[0] = NULL;
+  history->dif[1] = (double*)(history->dif+n+1);
+  for (i=2; i<=n; i++) history->dif[i] = history->dif[i-1]+7;
+  for (i=1; i<=n; i++) history->index[i] = _TRUE_;
+  history->current = -1;
+  return _SUCCESS_;
+}
+
+int ndf15_history_eval(struct ndf15_history *history,
+		       double t,
+		       double *y,
+		       double *dy,
+		       ErrorMsg error_message){
+  /* y[0..n-1] and dy[0..n-1] of the stored components at t, by the
+     interpolation evolver_ndf15 uses in the step that covers t. */
+  int lo, hi, mid, i, n=history->n, k;
+  double tdir = (history->tnew[0] > history->t0 ? 1.0 : -1.0);
+
+  lasagna_test((tdir*(t-history->t0) < 0.0)||(tdir*(t-history->tnew[history->steps-1]) > 0.0),
+	       error_message,"t=%g is outside the range [%g, %g] of the history.",
+	       t,history->t0,history->tnew[history->steps-1]);
+  /* First step with tdir*(tnew-t)>=0: */
+  lo = 0;
+  hi = history->steps-1;
+  while (lo < hi){
+    mid = (lo+hi)/2;
+    if (tdir*(history->tnew[mid]-t) >= 0.0)
+      hi = mid;
+    else
+      lo = mid+1;
+  }
+  k = history->k[lo];
+  if (history->current != lo){
+    fseek(history->file,history->offset[lo],SEEK_SET);
+    for (i=1; i<=n; i++){
+      lasagna_test((fread(history->ynew+i,sizeof(double),1,history->file) != 1)||
+		   (fread(history->dif[i]+1,sizeof(double),k,history->file) != k),
+		   error_message,"Could not read step %d of the history.",lo);
+    }
+    history->current = lo;
+  }
+  interp_from_dif(t,history->tnew[lo],history->ynew,history->h[lo],history->dif,k,
+		  y-1,dy-1,NULL,history->index,n,2);
+  return _SUCCESS_;
+}
+
+int ndf15_history_close(struct ndf15_history *history){
+  fclose(history->file);
+  free(history->components);
+  free(history->tnew);
+  free(history->h);
+  free(history->k);
+  free(history->offset);
+  free(history->ynew);
+  free(history->dif);
+  free(history->index);
+  return _SUCCESS_;
+}
+
 /**********************************************************************/
 /* Here are some small routines used in evolver_ndf15:                */
 /* "interp_from_dif", "eqvec", "adjust_stepsize", "calc_C",           */
@@ -877,6 +1525,83 @@ void eqvec(double *datavec,double *emptyvec, int n){
   }
 }
 
+/** Vector kernels of the step. Each one fuses the passes over the state
+    that the step made one after the other, in the 1-based layout of the
+    rest of the file. The arithmetic of each entry is unchanged, and the
+    norms are max reductions, so the results are the same bit for bit. */
+void ndf15_predict(double **dif, double *y, double *G, double invGak, int k, size_t neq,
+		   double *psi, double *pred, double *ynew){
+  /** psi = dif(:,1:k)*(G(1:k)*invGa(k)) and pred = ynew = y + sum(dif(:,1:k)). */
+  int i, j;
+  double *d, s, p;
+  for (i=1; i<=neq; i++){
+    d = dif[i];
+    s = 0.0;
+    p = y[i];
+    for (j=1; j<=k; j++){
+      s += d[j]*G[j-1]*invGak;
+      p += d[j];
+    }
+    psi[i] = s;
+    pred[i] = p;
+    ynew[i] = p;
+  }
+}
+
+double ndf15_weights(double *y, double *ynew, double threshold, double *invwt,
+		     double *difkp1, size_t neq){
+  /** Sets the inverse weights, clears difkp1 and returns the smallest
+      norm the Newton iteration can resolve. */
+  int i;
+  double w, minnrm=0.0;
+#pragma omp simd reduction(max:minnrm) private(w)
+  for (i=1; i<=neq; i++){
+    difkp1[i] = 0.0;
+    w = 1.0 / max(max(fabs(ynew[i]),fabs(y[i])),threshold);
+    invwt[i] = w;
+    minnrm = max(minnrm,100*DBL_EPSILON*fabs(ynew[i]*w));
+  }
+  return minnrm;
+}
+
+void ndf15_newton_rhs(double *psi, double *difkp1, double *f0, double hinvGak,
+		      double *rhs, size_t neq){
+  /** rhs = hinvGak*f0 - (psi + difkp1). */
+  int i;
+#pragma omp simd
+  for (i=1; i<=neq; i++)
+    rhs[i] = hinvGak*f0[i]-(psi[i]+difkp1[i]);
+}
+
+double ndf15_newton_update(double *del, double *invwt, double *pred, double *difkp1,
+			   double *ynew, size_t neq){
+  /** Adds the correction del to difkp1 and ynew, and returns its weighted
+      max norm. */
+  int i;
+  double nrm=0.0;
+#pragma omp simd reduction(max:nrm)
+  for (i=1; i<=neq; i++){
+    nrm = max(nrm,fabs(del[i]*invwt[i]));
+    difkp1[i] += del[i];
+    ynew[i] = pred[i] + difkp1[i];
+  }
+  return nrm;
+}
+
+void ndf15_dif_update(double **dif, double *difkp1, int k, size_t neq){
+  /** Moves the differences to the accepted step, one component at a time
+      instead of one pass over the state for each order. */
+  int i, j;
+  double *d;
+  for (i=1; i<=neq; i++){
+    d = dif[i];
+    d[k+2] = difkp1[i] - d[k+1];
+    d[k+1] = difkp1[i];
+    for (j=k; j>=1; j--)
+      d[j] += d[j+1];
+  }
+}
+
 /* Subroutine that interpolates from information stored in dif */
 int interp_from_dif(double tinterp,double tnew,double *ynew,double h,double **dif,int k, double *yinterp,
 		    double *ypinterp, double *yppinterp, int* index, size_t neq, int output){
@@ -999,8 +1724,8 @@ int update_linear_system_ndf15(MultiMatrix *J,
 			       MultiMatrix *A, 
 			       double hinvGak){
   size_t neq=J->ncol;
-  double luparity, *Ax, *Jx;
-  int i,j,*Ap,*Ai,funcreturn;
+  double *Ax, *Jx;
+  int i,j,*Ap,*Ai;
   SCCformat *JStoreSCC,*AStoreSCC;
   DNRformat *JStoreDNR,*AStoreDNR;
   double **Jmat, **Amat;
@@ -1037,5 +1762,134 @@ int update_linear_system_ndf15(MultiMatrix *J,
   return _SUCCESS_;
 }
 
+int ndf15_jacobian_product(MultiMatrix *J, double *x, double *Jx){
+  /* Jx = J x, with the unit offset of the ndf15 work vectors. */
+  size_t neq=J->ncol;
+  int i,j,*Ap,*Ai;
+  double *Ax, **Jmat;
+  SCCformat *StoreSCC;
+  DNRformat *StoreDNR;
+  switch(J->Stype){
+  case(L_SCC):
+    StoreSCC = J->Store;
+    Ap = StoreSCC->Ap; Ai = StoreSCC->Ai; Ax = StoreSCC->Ax;
+    for(i=1;i<=neq;i++) Jx[i] = 0.0;
+    for(j=0;j<neq;j++){
+      for(i=Ap[j];i<Ap[j+1];i++) Jx[Ai[i]+1] += Ax[i]*x[j+1];
+    }
+    break;
+  case(L_DNR):
+    StoreDNR = J->Store;
+    Jmat = (double **) StoreDNR->Matrix;
+    for(i=1;i<=neq;i++){
+      Jx[i] = 0.0;
+      for(j=1;j<=neq;j++) Jx[i] += Jmat[i][j]*x[j];
+    }
+    break;
+  }
+  return _SUCCESS_;
+}
+
+int ndf15_jacobian_secant(MultiMatrix *J, double *s, double *d, double *work){
+  /* Schubert's sparse Broyden update: row i of J gets the smallest change
+     on its pattern that makes J s = d in that row. With s_i the part of s
+     in the pattern of row i, J_i += (d_i - J_i s) s_i^T / (s_i^T s_i). Rows
+     with s_i = 0 are kept. For a dense J this is the Broyden update. d is
+     overwritten with d - J s, and all vectors have the unit offset. */
+  size_t neq=J->ncol;
+  int i,j,*Ap,*Ai;
+  double *Ax, **Jmat, ss;
+  SCCformat *StoreSCC;
+  DNRformat *StoreDNR;
+
+  ndf15_jacobian_product(J, s, work);
+  for(i=1;i<=neq;i++) d[i] -= work[i];
+  switch(J->Stype){
+  case(L_SCC):
+    StoreSCC = J->Store;
+    Ap = StoreSCC->Ap; Ai = StoreSCC->Ai; Ax = StoreSCC->Ax;
+    for(i=1;i<=neq;i++) work[i] = 0.0;
+    for(j=0;j<neq;j++){
+      for(i=Ap[j];i<Ap[j+1];i++) work[Ai[i]+1] += s[j+1]*s[j+1];
+    }
+    for(j=0;j<neq;j++){
+      for(i=Ap[j];i<Ap[j+1];i++){
+	if (work[Ai[i]+1] > 0.0)
+	  Ax[i] += d[Ai[i]+1]*s[j+1]/work[Ai[i]+1];
+      }
+    }
+    break;
+  case(L_DNR):
+    StoreDNR = J->Store;
+    Jmat = (double **) StoreDNR->Matrix;
+    ss = 0.0;
+    for(j=1;j<=neq;j++) ss += s[j]*s[j];
+    if (ss > 0.0){
+      for(i=1;i<=neq;i++){
+	for(j=1;j<=neq;j++) Jmat[i][j] += d[i]*s[j]/ss;
+      }
+    }
+    break;
+  }
+  return _SUCCESS_;
+}
+
+int ndf15_tangent_output(double tinterp, double tnew, double *vnew, double h, double **difv,
+			 int k, int *index, size_t neq, double *tangent_output){
+  /* Tangent at tinterp for the output routines, zero indexed. */
+  int i;
+  if (tinterp == tnew){
+    for(i=1;i<=neq;i++) tangent_output[i-1] = vnew[i];
+    return _SUCCESS_;
+  }
+  return interp_from_dif(tinterp,tnew,vnew,h,difv,k,tangent_output-1,NULL,NULL,
+			 index,neq,1);
+}
+
+int ndf15_event_interp(double t, double *y, void *dense){
+  /* y at t on the step in dense, zero indexed. */
+  struct ndf15_dense *d = dense;
+  return interp_from_dif(t,d->tnew,d->ynew,d->h,d->dif,d->k,y-1,NULL,NULL,
+			 d->index,d->neq,1);
+}
+
+double ndf15_tangent_dot(double *x, double *y, double *weight, size_t neq){
+  /* sum_i w_i^2 x_i y_i, unit offset, w_i = 1 if weight is NULL. */
+  int i;
+  double dot=0.0;
+  for(i=1;i<=neq;i++)
+    dot += (weight == NULL ? x[i]*y[i] : weight[i-1]*weight[i-1]*x[i]*y[i]);
+  return dot;
+}
+
+int ndf15_tangent_orthonormalise(double *v, double **difv, size_t neq, int tangents,
+				 double *weight, double *norm0, double *growth){
+  /* Modified Gram-Schmidt of the tangents v+tv*(neq+1) in the weighted
+     inner product, applied to the backward differences as well. Tangent
+     tv is then scaled back to norm0[tv], and log of the scale factor is
+     added to growth[tv]. */
+  size_t neqp=neq+1;
+  int tv, s, i, j;
+  double c, nrm;
+  for (tv=0; tv<tangents; tv++){
+    for (s=0; s<tv; s++){
+      c = ndf15_tangent_dot(v+tv*neqp, v+s*neqp, weight, neq)/(norm0[s]*norm0[s]);
+      for(i=1;i<=neq;i++){
+	v[tv*neqp+i] -= c*v[s*neqp+i];
+	for(j=1;j<=7;j++) difv[tv*neqp+i][j] -= c*difv[s*neqp+i][j];
+      }
+    }
+    nrm = sqrt(ndf15_tangent_dot(v+tv*neqp, v+tv*neqp, weight, neq));
+    if (nrm == 0.0) continue;
+    growth[tv] += log(nrm/norm0[tv]);
+    c = norm0[tv]/nrm;
+    for(i=1;i<=neq;i++){
+      v[tv*neqp+i] *= c;
+      for(j=1;j<=7;j++) difv[tv*neqp+i][j] *= c;
+    }
+  }
+  return _SUCCESS_;
+}
+
 /** Helper functions */
 
@@ -8,6 +8,9 @@
    stepstat[3] = Number of Jacobians computed.
    stepstat[4] = Number of LU decompositions.
    stepstat[5] = Number of linear solves.
+   The sparse linalg wrapper also counts its factorisations in
+   stepstat[6-8], see _STAT_REFACTOR_ in evolver_common.h.
+   With options->Events, stepstat[_STAT_EVENTS_] counts the events found.
 */
 int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 				 void * parameters_and_workspace, ErrorMsg error_message),
@@ -18,13 +21,225 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 		   size_t neq, 
 		   EvolverOptions *options,
 		   ErrorMsg error_message){
+  /* One integration with a private context. */
+  struct radau5_context *context;
+
+  lasagna_call(radau5_context_create(&context, neq, options, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_radau5_context(derivs, parameters_and_workspace_for_derivs,
+				      t_ini, t_final, y0, neq, options, context,
+				      error_message),
+	       error_message, error_message);
+  lasagna_call(radau5_context_destroy(context, error_message),
+	       error_message, error_message);
+  return _SUCCESS_;
+}
+
+int radau5_context_create(struct radau5_context **context,
+			  size_t neq,
+			  EvolverOptions *options,
+			  ErrorMsg error_message){
+  /* Allocates the work vectors, the real and complex iteration matrices with
+     their linalg workspaces and the numjac workspace for systems of size neq
+     with the pattern and linalg wrapper in options. */
+  struct radau5_context *ctx;
+  int *Ai, *Ap, nnz, j, p, q;
+
+  lasagna_alloc(ctx, sizeof(struct radau5_context), error_message);
+  ctx->neq = neq;
+  ctx->use_sparse = options->use_sparse;
+  ctx->real_form = options->ComplexAsReal;
+  ctx->Zval = NULL;
+  ctx->Zr_Ai = NULL;
+  ctx->Zr_Ap = NULL;
+  ctx->Zr_val = NULL;
+  ctx->linalg_initialise = options->linalg_initialise;
+  ctx->linalg_finalise = options->linalg_finalise;
+  ctx->runs = 0;
+
+  lasagna_alloc(ctx->W, 3*neq*sizeof(double), error_message);
+  lasagna_alloc(ctx->dW_buf, (3*neq+1)*sizeof(double), error_message);
+  lasagna_alloc(ctx->Y0pZ, 3*neq*sizeof(double), error_message);
+  lasagna_alloc(ctx->Fi, 3*neq*sizeof(double), error_message);
+  lasagna_alloc(ctx->Zlast, 3*neq*sizeof(double), error_message);
+  lasagna_alloc(ctx->rhs_buf, (3*neq+1)*sizeof(double), error_message);
+  lasagna_alloc(ctx->err_buf, (neq+1)*sizeof(double), error_message);
+  lasagna_alloc(ctx->diff_buf, (neq+1)*sizeof(double), error_message);
+  /* xtemp, ytemp, ynew, f0, ylast, ftmp, dfdt and delta_w: */
+  lasagna_alloc(ctx->vec_buf, 8*neq*sizeof(double), error_message);
+  lasagna_alloc(ctx->rhs_cx_buf, (neq+1)*sizeof(double complex), error_message);
+  lasagna_alloc(ctx->delta_w_cx_buf, (neq+1)*sizeof(double complex), error_message);
+
+  /** Initialise MultiMatrix J, A, Z and the linear method: */
+  if (options->use_sparse == _TRUE_){
+    printf("Use Sparse\n");
+    Ai=options->Ai; Ap=options->Ap;
+    nnz = Ap[neq];
+
+    lasagna_calloc(ctx->Jval, nnz, sizeof(double), error_message);
+    lasagna_alloc(ctx->Aval, sizeof(double)*nnz, error_message);
+    lasagna_call(CreateMatrix_SCC(&(ctx->J),L_DBL,neq, neq, nnz, Ai, Ap, ctx->Jval, error_message),
+		 error_message, error_message);
+    lasagna_call(CreateMatrix_SCC(&(ctx->A),L_DBL,neq, neq, nnz, Ai, Ap, ctx->Aval, error_message),
+		 error_message, error_message);
+    if (ctx->real_form == _TRUE_){
+      /** Column j has the pattern of J and beta at row neq+j, column neq+j
+	  has -beta at row j and the pattern of J moved down by neq: */
+      lasagna_alloc(ctx->Zr_Ap, sizeof(int)*(2*neq+1), error_message);
+      lasagna_alloc(ctx->Zr_Ai, sizeof(int)*(2*nnz+2*neq), error_message);
+      lasagna_alloc(ctx->Zr_val, sizeof(double)*(2*nnz+2*neq), error_message);
+      for (j=0, q=0; j<neq; j++){
+	ctx->Zr_Ap[j] = q;
+	for (p=Ap[j]; p<Ap[j+1]; p++)
+	  ctx->Zr_Ai[q++] = Ai[p];
+	ctx->Zr_Ai[q++] = neq+j;
+      }
+      for (j=0; j<neq; j++){
+	ctx->Zr_Ap[neq+j] = q;
+	ctx->Zr_Ai[q++] = j;
+	for (p=Ap[j]; p<Ap[j+1]; p++)
+	  ctx->Zr_Ai[q++] = neq+Ai[p];
+      }
+      ctx->Zr_Ap[2*neq] = q;
+      lasagna_call(CreateMatrix_SCC(&(ctx->Z),L_DBL,2*neq, 2*neq, q, ctx->Zr_Ai, ctx->Zr_Ap,
+				    ctx->Zr_val, error_message),
+		   error_message, error_message);
+    }
+    else{
+      lasagna_alloc(ctx->Zval, sizeof(double complex)*nnz, error_message);
+      lasagna_call(CreateMatrix_SCC(&(ctx->Z),L_DBL_CX,neq, neq, nnz, Ai, Ap, ctx->Zval, error_message),
+		   error_message, error_message);
+    }
+  }
+  else{
+    printf("Use dense\n");
+    lasagna_calloc(ctx->Jval, (neq*neq+1), sizeof(double), error_message);
+    lasagna_alloc(ctx->Aval, sizeof(double)*(neq*neq+1), error_message);
+    lasagna_call(CreateMatrix_DNR(&(ctx->J),L_DBL,neq, neq, ctx->Jval, error_message),
+		 error_message, error_message);
+    lasagna_call(CreateMatrix_DNR(&(ctx->A),L_DBL,neq, neq, ctx->Aval, error_message),
+		 error_message, error_message);
+    if (ctx->real_form == _TRUE_){
+      lasagna_calloc(ctx->Zr_val, (4*neq*neq+1), sizeof(double), error_message);
+      lasagna_call(CreateMatrix_DNR(&(ctx->Z),L_DBL,2*neq, 2*neq, ctx->Zr_val, error_message),
+		   error_message, error_message);
+    }
+    else{
+      lasagna_alloc(ctx->Zval, sizeof(double complex)*(neq*neq+1), error_message);
+      lasagna_call(CreateMatrix_DNR(&(ctx->Z),L_DBL_CX,neq, neq, ctx->Zval, error_message),
+		   error_message, error_message);
+    }
+  }
+  lasagna_call(ctx->linalg_initialise(&(ctx->A), options, &(ctx->linalg_workspace_A),error_message),
+	       error_message, error_message);
+  lasagna_call(ctx->linalg_initialise(&(ctx->Z), options, &(ctx->linalg_workspace_Z),error_message),
+	       error_message, error_message);
+
+  lasagna_call(CreateMatrix_DNR(&(ctx->RHS), L_DBL, 1, neq, ctx->rhs_buf, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&(ctx->DW), L_DBL, 1, neq, ctx->dW_buf, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&(ctx->DIFF), L_DBL, 1, neq, ctx->diff_buf, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&(ctx->ERR), L_DBL, 1, neq, ctx->err_buf, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&(ctx->RHS_CX), L_DBL_CX, 1, neq, ctx->rhs_cx_buf, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&(ctx->DW_CX), L_DBL_CX, 1, neq, ctx->delta_w_cx_buf, error_message),
+	       error_message, error_message);
+  if (ctx->real_form == _TRUE_){
+    lasagna_alloc(ctx->rhs_re_buf, (2*neq+1)*sizeof(double), error_message);
+    lasagna_alloc(ctx->dw_re_buf, (2*neq+1)*sizeof(double), error_message);
+    lasagna_call(CreateMatrix_DNR(&(ctx->RHS_RE), L_DBL, 1, 2*neq, ctx->rhs_re_buf, error_message),
+		 error_message, error_message);
+    lasagna_call(CreateMatrix_DNR(&(ctx->DW_RE), L_DBL, 1, 2*neq, ctx->dw_re_buf, error_message),
+		 error_message, error_message);
+  }
+
+  /* Initialize workspace for numjac: */
+  lasagna_call(initialize_numjac_workspace(&(ctx->J), &(ctx->nj_ws),error_message),
+	       error_message,error_message);
+  *context = ctx;
+  return _SUCCESS_;
+}
+
+int radau5_context_reset(struct radau5_context *context,
+			 EvolverOptions *options,
+			 void * parameters_and_workspace_for_derivs,
+			 ErrorMsg error_message){
+  /* Prepares the context for a new integration: numjac forgets its
+     increments and takes fresh thread copies of the derivs workspace. */
+  lasagna_test((context->use_sparse != options->use_sparse)||
+	       (context->linalg_initialise != options->linalg_initialise)||
+	       (context->real_form != options->ComplexAsReal),
+	       error_message,
+	       "The radau5 context was created for a different linalg wrapper.");
+  lasagna_call(reset_numjac_workspace(context->nj_ws, options,
+				      parameters_and_workspace_for_derivs,
+				      error_message),
+	       error_message,error_message);
+  return _SUCCESS_;
+}
+
+int radau5_context_destroy(struct radau5_context *context,
+			   ErrorMsg error_message){
+  uninitialize_numjac_workspace(context->nj_ws);
+  DestroyMultiMatrix(&(context->J));
+  DestroyMultiMatrix(&(context->A));
+  DestroyMultiMatrix(&(context->Z));
+  lasagna_call(context->linalg_finalise(context->linalg_workspace_A,error_message),
+	       error_message,error_message);
+  lasagna_call(context->linalg_finalise(context->linalg_workspace_Z,error_message),
+	       error_message,error_message);
+  DestroyMultiMatrix(&(context->RHS_CX));
+  DestroyMultiMatrix(&(context->RHS));
+  DestroyMultiMatrix(&(context->DW_CX));
+  DestroyMultiMatrix(&(context->DW));
+  DestroyMultiMatrix(&(context->DIFF));
+  DestroyMultiMatrix(&(context->ERR));
+  if (context->real_form == _TRUE_){
+    DestroyMultiMatrix(&(context->RHS_RE));
+    DestroyMultiMatrix(&(context->DW_RE));
+    free(context->rhs_re_buf);
+    free(context->dw_re_buf);
+  }
+
+  free(context->Jval);
+  free(context->Aval);
+  free(context->Zval);
+  free(context->Zr_Ai);
+  free(context->Zr_Ap);
+  free(context->Zr_val);
+
+  free(context->W);
+  free(context->dW_buf);
+  free(context->Y0pZ);
+  free(context->Fi);
+  free(context->Zlast);
+  free(context->rhs_buf);
+  free(context->err_buf);
+  free(context->diff_buf);
+  free(context->vec_buf);
+  free(context->rhs_cx_buf);
+  free(context->delta_w_cx_buf);
+  free(context);
+  return _SUCCESS_;
+}
+
+int evolver_radau5_context(int (*derivs)(double x,double * y,double * dy,
+					 void * parameters_and_workspace, ErrorMsg error_message),
+			   void * parameters_and_workspace_for_derivs,
+			   double t_ini,
+			   double t_final,
+			   double * y0, 
+			   size_t neq, 
+			   EvolverOptions *options,
+			   struct radau5_context *context,
+			   ErrorMsg error_message){
 	
   /** Handle options: */
   int *interpidx, *stepstat, verbose, tres; 
   double abstol, rtol, *t_vec;
-  int (*linalg_initialise)(MultiMatrix *, EvolverOptions *, void **, ErrorMsg);
-  int (*linalg_finalise)(void *, ErrorMsg);
-  int (*linalg_factorise)(void *, int, ErrorMsg);
   int (*linalg_solve)(MultiMatrix *, MultiMatrix *, void *, ErrorMsg);
   int (*output)(double t, double *y, double *dy, int i, void *p, ErrorMsg err);
   int (*print_variables)(double t, double *y, double *dy, void *p, ErrorMsg err);
@@ -32,11 +247,11 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
   interpidx = options->used_in_output; stepstat = &(options->Stats[0]);
   verbose = options->EvolverVerbose; tres = options->tres; abstol = options->AbsTol; 
   rtol = options->RelTol; t_vec = options->t_vec; 
-  linalg_initialise = options->linalg_initialise; linalg_finalise = options->linalg_finalise;
-  linalg_factorise = options->linalg_factorise; linalg_solve = options->linalg_solve;
+  linalg_solve = options->linalg_solve;
   output = options->output; print_variables=options->print_variables; 
   stop_function = options->stop_function;
-  int *Ai, *Ap, nnz;
+  lasagna_test(options->tangent != NULL, error_message,
+	       "The tangent-linear mode is only implemented in ndf15.");
 
   /* Constants: */
   double Tinv[9]= 
@@ -76,23 +291,29 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
   double z1,z2,z3,tau;
 
   int first_step = _TRUE_, Newton_converged, got_ynew, J_current, new_jacobian;
-  int reuse_stepsize, reuse_jacobian, last_failed=_TRUE_;
+  int reuse_stepsize, reuse_jacobian, last_failed=_TRUE_, event_stop=_FALSE_;
 
   double (*error_norm)(double *y, double *err_y, double threshold, size_t neq);
 
+  /* Checkpoints: */
+  double dstate[6];
+  int istate[4], last_checkpoint;
+  FILE *checkpoint_file;
+
+  /* Events: */
+  struct evolver_events events;
+  struct radau5_dense dense;
+
   int i, j;
 
   double *W, *dW, *Y0pZ, *rhs, *Fi, *Zlast;
   double *err, *diff, *xtemp, *ytemp, *ynew, *f0, *ylast, *ftmp, *dfdt;
-  double *delta_w;
   double *dW_buf, *rhs_buf, *err_buf, *diff_buf;
   double complex *rhs_cx, *rhs_cx_buf, *delta_w_cx, *delta_w_cx_buf;
   
   /* Matrices for jacobian and linearisation: */
-  MultiMatrix J, A, Z, RHS, RHS_CX, DIFF, DW, DW_CX, ERR;
-  double *Jval, *Aval;
-  double complex *Zval;
-  void *linalg_workspace_A, *linalg_workspace_Z, *nj_ws;
+  MultiMatrix *J, *DIFF, *ERR;
+  void *linalg_workspace_A, *nj_ws;
   double **Matrix;
   DNRformat *StoreDNR;
  
@@ -122,29 +343,40 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
   printf("ci = [%g %g %g]\n",ci[0],ci[1],ci[2]);
   */
 
-  W = malloc(3*neq*sizeof(double));
-  dW_buf = malloc((3*neq+1)*sizeof(double));
+  /** Take the storage from the context: */
+  lasagna_test(neq != context->neq, error_message,
+	       "The radau5 context is for %zu equations, not %zu.",context->neq,neq);
+  lasagna_call(radau5_context_reset(context, options, parameters_and_workspace_for_derivs,
+				    error_message),
+	       error_message, error_message);
+  context->runs++;
+  J = &(context->J);
+  DIFF = &(context->DIFF); ERR = &(context->ERR);
+  linalg_workspace_A = context->linalg_workspace_A;
+  nj_ws = context->nj_ws;
+
+  W = context->W;
+  dW_buf = context->dW_buf;
   dW = dW_buf+1;
-  Y0pZ = malloc(3*neq*sizeof(double));
-  Fi = malloc(3*neq*sizeof(double));
-  Zlast = malloc(3*neq*sizeof(double));
-  rhs_buf = malloc((3*neq+1)*sizeof(double));
+  Y0pZ = context->Y0pZ;
+  Fi = context->Fi;
+  Zlast = context->Zlast;
+  rhs_buf = context->rhs_buf;
   rhs = rhs_buf +1;
-  err_buf = malloc((neq+1)*sizeof(double));
+  err_buf = context->err_buf;
   err = err_buf+1;
-  diff_buf = malloc((neq+1)*sizeof(double));
+  diff_buf = context->diff_buf;
   diff = diff_buf+1;
-  xtemp = malloc(neq*sizeof(double));
-  ytemp = malloc(neq*sizeof(double));
-  ynew = malloc(neq*sizeof(double));
-  f0 = malloc(neq*sizeof(double));
-  ylast = malloc(neq*sizeof(double));
-  ftmp = malloc(neq*sizeof(double));
-  dfdt = malloc(neq*sizeof(double));
-  delta_w = malloc(neq*sizeof(double));
-  rhs_cx_buf = malloc((neq+1)*sizeof(double complex));
+  xtemp = context->vec_buf;
+  ytemp = xtemp+neq;
+  ynew = ytemp+neq;
+  f0 = ynew+neq;
+  ylast = f0+neq;
+  ftmp = ylast+neq;
+  dfdt = ftmp+neq;
+  rhs_cx_buf = context->rhs_cx_buf;
   rhs_cx = rhs_cx_buf +1;
-  delta_w_cx_buf = malloc((neq+1)*sizeof(double complex));
+  delta_w_cx_buf = context->delta_w_cx_buf;
   delta_w_cx = delta_w_cx_buf + 1;
 
   error_norm = norm_inf;
@@ -161,166 +393,154 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
     }
   }
 
-  /** Initialise linalg and multi matrices: */
-    /** Initialise MultiMatrix J, A and the linear method: */
-  if (options->use_sparse == _TRUE_){
-    printf("Use Sparse\n");
-    Ai=options->Ai; Ap=options->Ap;
-    nnz = Ap[neq];
+  if(options->J_pointer_flag ==  _TRUE_) options->J_pointer = J;
 
-    lasagna_calloc(Jval, nnz, sizeof(double), error_message);
-    lasagna_alloc(Aval, sizeof(double)*nnz, error_message);
-    lasagna_alloc(Zval, sizeof(double complex)*nnz, error_message);
-    lasagna_call(CreateMatrix_SCC(&(J),L_DBL,neq, neq, nnz, Ai, Ap, Jval, error_message),
-		 error_message, error_message);
-    lasagna_call(CreateMatrix_SCC(&(A),L_DBL,neq, neq, nnz, Ai, Ap, Aval, error_message),
+  lasagna_call(evolver_events_init(&events, options, neq, error_message),
+	       error_message, error_message);
+  dense.y0 = y0;
+  dense.Z = Y0pZ;
+  dense.neq = neq;
+
+  last_checkpoint = 0;
+  if (options->Restart == _TRUE_){
+    /* Continue from the end of a step of an earlier run: */
+    lasagna_call(evolver_checkpoint_open(options, _CHECKPOINT_RADAU5_, neq, _TRUE_,
+					 &checkpoint_file, error_message),
 		 error_message, error_message);
-    lasagna_call(CreateMatrix_SCC(&(Z),L_DBL_CX,neq, neq, nnz, Ai, Ap, Zval, error_message),
+    lasagna_call(radau5_checkpoint(checkpoint_file, _TRUE_, context, options, dstate, istate,
+				   y0, f0, ylast, error_message),
 		 error_message, error_message);
-  }
-  else{
-    printf("Use dense\n");
-    lasagna_calloc(Jval, (neq*neq+1), sizeof(double), error_message);
-    lasagna_alloc(Aval, sizeof(double)*(neq*neq+1), error_message);
-    lasagna_alloc(Zval, sizeof(double complex)*(neq*neq+1), error_message);
-    lasagna_call(CreateMatrix_DNR(&(J),L_DBL,neq, neq, Jval, error_message),
+    lasagna_call(evolver_checkpoint_close(options, checkpoint_file, _TRUE_,
+					  parameters_and_workspace_for_derivs, error_message),
 		 error_message, error_message);
-    lasagna_call(CreateMatrix_DNR(&(A),L_DBL,neq, neq, Aval, error_message),
+    t = dstate[0]; absh = dstate[1]; abshlast = dstate[2]; h = dstate[3];
+    theta_k_old = dstate[4]; norm_dW_old = dstate[5];
+    first_step = istate[0]; last_failed = istate[1]; J_current = istate[2]; next = istate[3];
+    last_checkpoint = stepstat[0];
+    lasagna_call(refresh_numjac_threads(nj_ws, options, parameters_and_workspace_for_derivs,
+					error_message),
 		 error_message, error_message);
-    lasagna_call(CreateMatrix_DNR(&(Z),L_DBL_CX,neq, neq, Zval, error_message),
+    lasagna_call(radau5_factorise(context, h, _LINALG_FROM_SCRATCH_, options, error_message),
 		 error_message, error_message);
+    new_jacobian = _FALSE_;
+    stepstat[4] +=1;
   }
-  lasagna_call(linalg_initialise(&A, options, &linalg_workspace_A,error_message),
-	       error_message, error_message);
-  lasagna_call(linalg_initialise(&Z, options, &linalg_workspace_Z,error_message),
-	       error_message, error_message);
+  else{
+    t = t_ini;
+  
+    /** Find the initial step: */
+    evolver_timed(options,_TIME_DERIVS_,
+		  lasagna_call((*derivs)(t,
+					 y0,
+					 f0,
+					 parameters_and_workspace_for_derivs,error_message),
+			       error_message,
+			       error_message));
+    stepstat[2]++;
+  
+    rh = error_norm(f0, y0, threshold, neq);
+    rh *=1.25/rtol;
 
-  lasagna_call(CreateMatrix_DNR(&(RHS), L_DBL, 1, neq, rhs_buf, error_message),
-	       error_message, error_message);
-  lasagna_call(CreateMatrix_DNR(&(DW), L_DBL, 1, neq, dW_buf, error_message),
-	       error_message, error_message);
-  lasagna_call(CreateMatrix_DNR(&(DIFF), L_DBL, 1, neq, diff_buf, error_message),
-	       error_message, error_message);
-  lasagna_call(CreateMatrix_DNR(&(ERR), L_DBL, 1, neq, err_buf, error_message),
-	       error_message, error_message);
-  lasagna_call(CreateMatrix_DNR(&(RHS_CX), L_DBL_CX, 1, neq, rhs_cx_buf, error_message),
-	       error_message, error_message);
-  lasagna_call(CreateMatrix_DNR(&(DW_CX), L_DBL_CX, 1, neq, delta_w_cx_buf, error_message),
-	       error_message, error_message);
-  if(options->J_pointer_flag ==  _TRUE_) options->J_pointer = &(J);
+    abshmin = 16.0*fabs(t)*DBL_EPSILON;
+    absh = 0.1*fabs(t_final-t_ini);
+    if (absh * rh > 1.0) 
+      absh = 1.0 / rh;
+    absh = max(absh, abshmin);
 
-  
-  /* Initialize workspace for numjac: */
-  lasagna_call(initialize_numjac_workspace(&J, &nj_ws,error_message),
-	       error_message,error_message);
+    h = tdir * absh;
+    tdel = (t + tdir*min(sqrt(DBL_EPSILON)*max(fabs(t),fabs(t+h)),absh)) - t;
 
-  t = t_ini;
-  
-  /** Find the initial step: */
-  lasagna_call((*derivs)(t,
-			 y0,
-			 f0,
-			 parameters_and_workspace_for_derivs,error_message),
-	       error_message,
-	       error_message);
-  stepstat[2]++;
-  
-  rh = error_norm(f0, y0, threshold, neq);
-  rh *=1.25/rtol;
-
-  abshmin = 16.0*fabs(t)*DBL_EPSILON;
-  absh = 0.1*fabs(t_final-t_ini);
-  if (absh * rh > 1.0) 
-    absh = 1.0 / rh;
-  absh = max(absh, abshmin);
-
-  h = tdir * absh;
-  tdel = (t + tdir*min(sqrt(DBL_EPSILON)*max(fabs(t),fabs(t+h)),absh)) - t;
-
-  lasagna_call((*derivs)(t+tdel,
-		       y0,
-		       ftmp,
-		       parameters_and_workspace_for_derivs,
-		       error_message),
-	     error_message,
-	     error_message);
-  stepstat[2] += 1;
-
-  nfenj=0;
-  lasagna_call(numjac((*derivs),
-		      t,
-		      y0-1,
-		      f0-1,
-		      &J,
-		      nj_ws,
-		      abstol,
-		      neq,
-		      &nfenj,
-		      parameters_and_workspace_for_derivs,
-		      error_message),
-	       error_message,
-	       error_message);  
-  if(options->J_pointer_flag == _TRUE_){
-    // Setting jacvec to default value.
-    for(j=1;j<=neq;j++) ((struct numjac_workspace*) nj_ws)->jacvec[j]=1.490116119384765597872e-8;
-    // Calling derivs and numjac to ensure a updated Jacobian.
-    lasagna_call((*derivs)(t,
-			   y0,
-			   f0,
-			   parameters_and_workspace_for_derivs,
-			   error_message),
-		 error_message,error_message);
-    stepstat[2] +=1;
-    lasagna_call(numjac((*derivs),
+    evolver_timed(options,_TIME_DERIVS_,
+		  lasagna_call((*derivs)(t+tdel,
+				       y0,
+				       ftmp,
+				       parameters_and_workspace_for_derivs,
+				       error_message),
+			     error_message,
+			     error_message));
+    stepstat[2] += 1;
+
+    nfenj=0;
+    lasagna_call(evolver_jacobian((*derivs),
 			t,
 			y0-1,
 			f0-1,
-			&J,
+			J,
 			nj_ws,
 			abstol,
 			neq,
 			&nfenj,
+			options,
 			parameters_and_workspace_for_derivs,
 			error_message),
-		 error_message,error_message);
+		 error_message,
+		 error_message);  
+    if(options->J_pointer_flag == _TRUE_){
+      // Setting jacvec to default value.
+      for(j=1;j<=neq;j++) ((struct numjac_workspace*) nj_ws)->jacvec[j]=1.490116119384765597872e-8;
+      // Calling derivs and numjac to ensure a updated Jacobian.
+      evolver_timed(options,_TIME_DERIVS_,
+		    lasagna_call((*derivs)(t,
+					   y0,
+					   f0,
+					   parameters_and_workspace_for_derivs,
+					   error_message),
+				 error_message,error_message));
+      stepstat[2] +=1;
+      lasagna_call(evolver_jacobian((*derivs),
+			  t,
+			  y0-1,
+			  f0-1,
+			  J,
+			  nj_ws,
+			  abstol,
+			  neq,
+			  &nfenj,
+			  options,
+			  parameters_and_workspace_for_derivs,
+			  error_message),
+		   error_message,error_message);
+      stepstat[3] += 1;
+    }
     stepstat[3] += 1;
-  }
-  stepstat[3] += 1;
-  stepstat[2] += nfenj;
-  J_current = _TRUE_;
-  new_jacobian = _TRUE_;
-
-  switch(J.Stype){
-  case(L_DNR):
-    StoreDNR = (DNRformat *) J.Store;
-    Matrix = (double **) StoreDNR->Matrix;
-    for(i=0; i<neq; i++){
-      dfdt[i]=0.0;
-      for(j=0; j<neq; j++){
-	dfdt[i] += ((Matrix[i+1][j+1])*f0[j]+
-		    (ftmp[i] - f0[i]) / tdel);
+    stepstat[2] += nfenj;
+    J_current = _TRUE_;
+    new_jacobian = _TRUE_;
+
+    switch(J->Stype){
+    case(L_DNR):
+      StoreDNR = (DNRformat *) J->Store;
+      Matrix = (double **) StoreDNR->Matrix;
+      for(i=0; i<neq; i++){
+	dfdt[i]=0.0;
+	for(j=0; j<neq; j++){
+	  dfdt[i] += ((Matrix[i+1][j+1])*f0[j]+
+		      (ftmp[i] - f0[i]) / tdel);
+	}
       }
-    }
-    rh = error_norm(y0, dfdt, threshold, neq);
-    rh = 1.25*sqrt(0.5*rh/rtol);
+      rh = error_norm(y0, dfdt, threshold, neq);
+      rh = 1.25*sqrt(0.5*rh/rtol);
   
-    absh = fabs(t_final-t_ini);
-    if (absh * rh > 1.0) 
-      absh = 1.0 / rh;
-    absh = max(absh, abshmin);
+      absh = fabs(t_final-t_ini);
+      if (absh * rh > 1.0) 
+	absh = 1.0 / rh;
+      absh = max(absh, abshmin);
   
-    h = tdir * absh;
-    break;
+      h = tdir * absh;
+      break;
+    case(L_SCC):
+      /* No second derivative estimate, keep the step found above. */
+      break;
+    }
+     /* Done calculating initial step
+       Get ready to do the loop:*/
+    lasagna_call(radau5_factorise(context, h, new_jacobian, options, error_message),
+		 error_message, error_message);
+    new_jacobian = _FALSE_;
+    stepstat[4] +=1;
   }
-   /* Done calculating initial step
-     Get ready to do the loop:*/
-  update_linear_system_radau5(&J, &A, &Z, h);
-  lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-	       error_message, error_message);
-  lasagna_call(linalg_factorise(linalg_workspace_Z, new_jacobian, error_message),
-	       error_message, error_message);
-  new_jacobian = _FALSE_;
-  stepstat[4] +=1;
+
+  lasagna_call(evolver_progress_start(options, t, t_final, y0), error_message, error_message);
 
   //Main loop:
   while ((t_final-t)*tdir>0.0){
@@ -376,12 +596,13 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	}
 	//Call the function at the 3 nodes:
 	for (i=0; i<3; i++){
-	  lasagna_call((*derivs)(t+ci[i]*h,
-				 Y0pZ+i*neq,
-				 Fi+i*neq,
-				 parameters_and_workspace_for_derivs,error_message),
-		       error_message,
-		       error_message);
+	  evolver_timed(options,_TIME_DERIVS_,
+			lasagna_call((*derivs)(t+ci[i]*h,
+					       Y0pZ+i*neq,
+					       Fi+i*neq,
+					       parameters_and_workspace_for_derivs,error_message),
+				     error_message,
+				     error_message));
 	}
 	stepstat[2] += 3;
 	//Start forming the right hand side by doing transformation on Fi:
@@ -392,9 +613,7 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	    I*(rhs[2*neq+i]-beta*W[neq+i]-alpha*W[2*neq+i]);
 	}
 	//Use backsubstitution to calculate delta W:
-	lasagna_call(linalg_solve(&RHS, &DW, linalg_workspace_A, error_message),
-		     error_message, error_message);
-	lasagna_call(linalg_solve(&RHS_CX, &DW_CX, linalg_workspace_Z, error_message),
+	lasagna_call(radau5_solve_stages(context, options, error_message),
 		     error_message, error_message);
 	stepstat[5]+=1;
 	//Form dW:
@@ -451,38 +670,41 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	if (J_current == _FALSE_){
 	  //Recompute jacobian and try again
 	  nfenj=0;
-	  lasagna_call(numjac((*derivs),
+	  lasagna_call(evolver_jacobian((*derivs),
 			      t,
 			      y0-1,
 			      f0-1,
-			      &J,
+			      J,
 			      nj_ws,
 			      abstol,
 			      neq,
 			      &nfenj,
+			      options,
 			      parameters_and_workspace_for_derivs,
 			      error_message),
 		       error_message,
 		       error_message);
 	  if(options->J_pointer_flag == _TRUE_){
 	    // Calling derivs and numjac to ensure a updated Jacobian.
-	    lasagna_call((*derivs)(t,
-				   y0,
-				   f0,
-				   parameters_and_workspace_for_derivs,
-				   error_message),
-			 error_message,error_message);
+	    evolver_timed(options,_TIME_DERIVS_,
+			  lasagna_call((*derivs)(t,
+						 y0,
+						 f0,
+						 parameters_and_workspace_for_derivs,
+						 error_message),
+				       error_message,error_message));
 	    stepstat[2] +=1;
 
-	    lasagna_call(numjac((*derivs),
+	    lasagna_call(evolver_jacobian((*derivs),
 				t,
 				y0-1,
 				f0-1,
-				&J,
+				J,
 				nj_ws,
 				abstol,
 				neq,
 				&nfenj,
+				options,
 				parameters_and_workspace_for_derivs,
 				error_message),
 			 error_message,
@@ -498,10 +720,7 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	absh = abshnew;
 	h = tdir*absh;
 	//We need a new linearisation:
-	update_linear_system_radau5(&J, &A, &Z, h);
-	lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-		     error_message, error_message);
-	lasagna_call(linalg_factorise(linalg_workspace_Z, new_jacobian, error_message),
+	lasagna_call(radau5_factorise(context, h, new_jacobian, options, error_message),
 		     error_message, error_message);
 	new_jacobian = _FALSE_;
 	stepstat[4] +=1;
@@ -517,8 +736,9 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	}
 	got_ynew = _TRUE_;
 	// Solve for error err:
-	lasagna_call(linalg_solve(&DIFF, &ERR, linalg_workspace_A, error_message),
-		     error_message, error_message);
+	evolver_timed(options,_TIME_SOLVE_,
+		      lasagna_call(linalg_solve(DIFF, ERR, linalg_workspace_A, error_message),
+				   error_message, error_message));
 	//stepstat[5]+=1;
 	norm_err = error_norm(ynew, err, threshold, neq);
 	if ((norm_err>=rtol)&&(last_failed == _TRUE_)){
@@ -526,20 +746,22 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	  for (i=0; i<neq; i++){
 	    ytemp[i] = err[i]+y0[i];
 	  }
-	  lasagna_call((*derivs)(t,
-				 ytemp,
-				 ftmp,
-				 parameters_and_workspace_for_derivs,
-				 error_message),
-		       error_message,
-		       error_message);
+	  evolver_timed(options,_TIME_DERIVS_,
+			lasagna_call((*derivs)(t,
+					       ytemp,
+					       ftmp,
+					       parameters_and_workspace_for_derivs,
+					       error_message),
+				     error_message,
+				     error_message));
 	  stepstat[2]++;
 	  for (i=0; i<neq; i++){
 	    diff[i] += (ftmp[i]-f0[i]);
 	  }
 	  //Solve for err again:
-	  lasagna_call(linalg_solve(&DIFF, &ERR, linalg_workspace_A, error_message),
-		       error_message, error_message);
+	  evolver_timed(options,_TIME_SOLVE_,
+			lasagna_call(linalg_solve(DIFF, ERR, linalg_workspace_A, error_message),
+				     error_message, error_message));
 	  //stepstat[5]+=1;
 	  norm_err = error_norm(ynew, err, threshold, neq);
 	}
@@ -561,38 +783,41 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
       if (J_current == _FALSE_){
 	//Recalculate jacobian:
 	  nfenj=0;
-	  lasagna_call(numjac((*derivs),
+	  lasagna_call(evolver_jacobian((*derivs),
 			      t,
 			      y0-1,
 			      f0-1,
-			      &J,
+			      J,
 			      nj_ws,
 			      abstol,
 			      neq,
 			      &nfenj,
+			      options,
 			      parameters_and_workspace_for_derivs,
 			      error_message),
 		       error_message,
 		       error_message);
 	  if(options->J_pointer_flag == _TRUE_){
 	    // Calling derivs and numjac to ensure a updated Jacobian.
-	    lasagna_call((*derivs)(t,
-				   y0,
-				   f0,
-				   parameters_and_workspace_for_derivs,
-				   error_message),
-			 error_message,error_message);
+	    evolver_timed(options,_TIME_DERIVS_,
+			  lasagna_call((*derivs)(t,
+						 y0,
+						 f0,
+						 parameters_and_workspace_for_derivs,
+						 error_message),
+				       error_message,error_message));
 	    stepstat[2] +=1;
 	    
-	    lasagna_call(numjac((*derivs),
+	    lasagna_call(evolver_jacobian((*derivs),
 				t,
 				y0-1,
 				f0-1,
-				&J,
+				J,
 				nj_ws,
 				abstol,
 				neq,
 				&nfenj,
+				options,
 				parameters_and_workspace_for_derivs,
 				error_message),
 			 error_message,
@@ -604,10 +829,7 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	  J_current = _TRUE_;
 	  new_jacobian = _TRUE_;
       }
-      update_linear_system_radau5(&J, &A, &Z, h);
-      lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-		   error_message, error_message);
-      lasagna_call(linalg_factorise(linalg_workspace_Z, new_jacobian, error_message),
+      lasagna_call(radau5_factorise(context, h, new_jacobian, options, error_message),
 		   error_message, error_message);
       new_jacobian = _FALSE_;
       stepstat[4] +=1;
@@ -622,12 +844,23 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
       first_step = _FALSE_;
       last_failed = _FALSE_;
       abshlast = absh;
+      /** Events on the step, output stops at a terminal one: */
+      if (events.n > 0){
+	dense.t = t;
+	dense.h = h;
+	lasagna_call(evolver_events_locate(&events, options, t, t+h, radau5_event_interp, &dense,
+					   parameters_and_workspace_for_derivs, &event_stop,
+					   error_message),
+		     error_message, error_message);
+      }
       /**  Output:  */
       if (t_vec==NULL){
 	//Refinement output:
 	for (i=1; i<=tres; i++){
 	  //Interpolated (and endpoint) outputs:
 	  ti = t+i/((double) tres)*h;
+	  if ((event_stop == _TRUE_)&&((ti-events.t_event)*tdir > 0.0))
+	    break;
 	  dense_output_radau5(ti,
 			      ytemp,
 			      t,
@@ -636,13 +869,15 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 			      Y0pZ,
 			      interpidx,
 			      neq);
-	  lasagna_call((*output)(ti,ytemp,f0,next,
-				 parameters_and_workspace_for_derivs,
-				 error_message),error_message,error_message);
+	  evolver_timed(options,_TIME_OUTPUT_,
+			lasagna_call((*output)(ti,ytemp,f0,next,
+					       parameters_and_workspace_for_derivs,
+					       error_message),error_message,error_message));
 	}
       }
       else{
-	while((next<tres)&&((t+h-t_vec[next])*tdir >= 0.0)){
+	while((next<tres)&&((t+h-t_vec[next])*tdir >= 0.0)&&
+	      ((event_stop == _FALSE_)||((events.t_event-t_vec[next])*tdir >= 0.0))){
 	
 	  dense_output_radau5(t_vec[next],
 			      ytemp,
@@ -654,14 +889,35 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 			      neq);
 	
 	  //We are not interpolating the derivative at the moment..
-	  lasagna_call((*output)(t_vec[next],ytemp,f0,next,
-				 parameters_and_workspace_for_derivs,
-				 error_message),error_message,error_message);
+	  evolver_timed(options,_TIME_OUTPUT_,
+			lasagna_call((*output)(t_vec[next],ytemp,f0,next,
+					       parameters_and_workspace_for_derivs,
+					       error_message),error_message,error_message));
 	
 	  //printf("%.16e %.16e %.16e\n",t+h,ynew[0],ynew[1]);
 	  next++;
 	}
       }
+      if (event_stop == _TRUE_){
+	/* End the integration at the event: */
+	t = events.t_event;
+	for (i=0; i<neq; i++)
+	  y0[i] = events.y_event[i];
+	evolver_timed(options,_TIME_DERIVS_,
+		      lasagna_call((*derivs)(t,
+					     y0,
+					     f0,
+					     parameters_and_workspace_for_derivs,error_message),
+				   error_message,
+				   error_message));
+	stepstat[2]++;
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(t,y0,f0,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+	printf("Event stop at t=%.16e...\n",t);
+	break;
+      }
       //Update parameters:
       t += h;
       for (i=0; i<neq; i++){
@@ -671,21 +927,23 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
       for (i=0; i<3*neq; i++){
 	Zlast[i] = Y0pZ[i];
       }
-      lasagna_call((*derivs)(t,
-			     y0,
-			     f0,
-			     parameters_and_workspace_for_derivs,error_message),
-		   error_message,
-		   error_message);
+      evolver_timed(options,_TIME_DERIVS_,
+		    lasagna_call((*derivs)(t,
+					   y0,
+					   f0,
+					   parameters_and_workspace_for_derivs,error_message),
+				 error_message,
+				 error_message));
       stepstat[2]++;
 
       if (print_variables != NULL){
-	lasagna_call((*print_variables)(t,
-					y0,
-					f0,
-					parameters_and_workspace_for_derivs,
-					error_message),
-		     error_message,error_message);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*print_variables)(t,
+						      y0,
+						      f0,
+						      parameters_and_workspace_for_derivs,
+						      error_message),
+				   error_message,error_message));
       }
 
       
@@ -708,38 +966,41 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
       else{
 	//Recalculate jacobian:
 	nfenj=0;
-	lasagna_call(numjac((*derivs),
+	lasagna_call(evolver_jacobian((*derivs),
 			    t,
 			    y0-1,
 			    f0-1,
-			    &J,
+			    J,
 			    nj_ws,
 			    abstol,
 			    neq,
 			    &nfenj,
+			    options,
 			    parameters_and_workspace_for_derivs,
 			    error_message),
 		     error_message,
 		     error_message);
 	if(options->J_pointer_flag == _TRUE_){
 	  // Calling derivs and numjac to ensure a updated Jacobian.
-	  lasagna_call((*derivs)(t,
-				 y0,
-				 f0,
-				 parameters_and_workspace_for_derivs,
-				 error_message),
-		       error_message,error_message);
+	  evolver_timed(options,_TIME_DERIVS_,
+			lasagna_call((*derivs)(t,
+					       y0,
+					       f0,
+					       parameters_and_workspace_for_derivs,
+					       error_message),
+				     error_message,error_message));
 	  stepstat[2] +=1;
 
-	  lasagna_call(numjac((*derivs),
+	  lasagna_call(evolver_jacobian((*derivs),
 			      t,
 			      y0-1,
 			      f0-1,
-			      &J,
+			      J,
 			      nj_ws,
 			      abstol,
 			      neq,
 			      &nfenj,
+			      options,
 			      parameters_and_workspace_for_derivs,
 			      error_message),
 		       error_message,
@@ -759,69 +1020,199 @@ int evolver_radau5(int (*derivs)(double x,double * y,double * dy,
 	//Change step size and do a new linearisation:
 	absh = abshnew;
 	h = tdir*absh;
-	update_linear_system_radau5(&J, &A, &Z, h);
-	lasagna_call(linalg_factorise(linalg_workspace_A, new_jacobian, error_message),
-		     error_message, error_message);
-	lasagna_call(linalg_factorise(linalg_workspace_Z, new_jacobian, error_message),
+	lasagna_call(radau5_factorise(context, h, new_jacobian, options, error_message),
 		     error_message, error_message);
 	new_jacobian = _FALSE_;
 	stepstat[4] +=1;	
       }
     }
+    if (event_stop == _TRUE_)
+      break;
+    if (options->ProgressInterval > 0.0)
+      evolver_progress(options, t, t_final, h, 5, y0, _FALSE_);
     /* Perhaps use stop function: */
     if (stop_function != NULL){
       if (stop_function(t,y0,f0,parameters_and_workspace_for_derivs,
 			error_message) == _TRUE_){      //Stop condition
-	lasagna_call((*output)(t,y0,f0,next,
-			       parameters_and_workspace_for_derivs,
-			       error_message),error_message,error_message);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(t,y0,f0,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
 	printf("Stop condition met...\n");
 	break;
       }
     }
+    /* Perhaps write a checkpoint: */
+    if (evolver_checkpoint_due(options, stepstat[0], &last_checkpoint) == _TRUE_){
+      dstate[0] = t; dstate[1] = absh; dstate[2] = abshlast; dstate[3] = h;
+      dstate[4] = theta_k_old; dstate[5] = norm_dW_old;
+      istate[0] = first_step; istate[1] = last_failed; istate[2] = J_current; istate[3] = next;
+      lasagna_call(evolver_checkpoint_open(options, _CHECKPOINT_RADAU5_, neq, _FALSE_,
+					   &checkpoint_file, error_message),
+		   error_message, error_message);
+      lasagna_call(radau5_checkpoint(checkpoint_file, _FALSE_, context, options, dstate, istate,
+				     y0, f0, ylast, error_message),
+		   error_message, error_message);
+      lasagna_call(evolver_checkpoint_close(options, checkpoint_file, _FALSE_,
+					    parameters_and_workspace_for_derivs, error_message),
+		   error_message, error_message);
+      lasagna_call(radau5_factorise(context, h, _LINALG_FROM_SCRATCH_, options, error_message),
+		   error_message, error_message);
+      new_jacobian = _FALSE_;
+      stepstat[4] +=1;
+      lasagna_call(refresh_numjac_threads(nj_ws, options, parameters_and_workspace_for_derivs,
+					  error_message),
+		   error_message, error_message);
+    }
   }
+  evolver_events_free(&events);
   printf("\n End of evolver. Next=%d, t=%e and tnew=%e.",next,t,t+h);
   printf("\n Statistics: [%d %d %d %d %d %d] \n",stepstat[0],stepstat[1],
 	 stepstat[2],stepstat[3],stepstat[4],stepstat[5]);
+  if ((verbose > 1)&&(stepstat[_STAT_REFACTOR_]+stepstat[_STAT_FULL_LU_]>0))
+    printf(" Refactorisations: %d, full decompositions: %d, rejected: %d.\n",
+	   stepstat[_STAT_REFACTOR_],stepstat[_STAT_FULL_LU_],
+	   stepstat[_STAT_REFACTOR_REJECTED_]);
+  if ((verbose > 1)&&(stepstat[_STAT_REFINE_]+stepstat[_STAT_REFINE_FALLBACK_]>0))
+    printf(" Refinement steps: %d, solves redone in double precision: %d.\n",
+	 stepstat[_STAT_REFINE_],stepstat[_STAT_REFINE_FALLBACK_]);
 	
-  /** Deallocate memory */
-  uninitialize_numjac_workspace(nj_ws);
-  DestroyMultiMatrix(&J);
-  DestroyMultiMatrix(&A);
-  DestroyMultiMatrix(&Z);
-  lasagna_call(linalg_finalise(linalg_workspace_A,error_message),error_message,error_message);
-  lasagna_call(linalg_finalise(linalg_workspace_Z,error_message),error_message,error_message);
-  DestroyMultiMatrix(&RHS_CX);
-  DestroyMultiMatrix(&RHS);
-  DestroyMultiMatrix(&DW_CX);
-  DestroyMultiMatrix(&DW);
-  DestroyMultiMatrix(&DIFF);
-  DestroyMultiMatrix(&ERR);
-
-  free(Jval);
-  free(Aval);
-  free(Zval);
-
-  free(W);
-  free(dW_buf);
-  free(Y0pZ);
-  free(Fi);
-  free(Zlast);
-  free(rhs_buf);
-  free(err_buf);
-  free(diff_buf);
-  free(xtemp);
-  free(ytemp);
-  free(ynew);
-  free(f0);
-  free(ylast);
-  free(ftmp);
-  free(dfdt);
-  free(delta_w);
-  free(rhs_cx_buf);
-  free(delta_w_cx_buf);
+  return _SUCCESS_;
+}
 
+int radau5_checkpoint(FILE *file,
+		      int restore,
+		      struct radau5_context *context,
+		      EvolverOptions *options,
+		      double *dstate,
+		      int *istate,
+		      double *y0,
+		      double *f0,
+		      double *ylast,
+		      ErrorMsg error_message){
+  /* Writes or reads the state of radau5 at the end of a step: the scalars in
+     dstate[0..5] and istate[0..3], y0, f0, ylast and Zlast for the starting
+     values of the Newton iteration, the statistics, the Jacobian and the
+     numjac increments. */
+  size_t neq = context->neq;
+  int nnz;
 
+  if (context->use_sparse == _TRUE_)
+    nnz = options->Ap[neq];
+  else
+    nnz = neq*neq+1;
+  lasagna_call(evolver_checkpoint_io(file, dstate, sizeof(double), 6, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, istate, sizeof(int), 4, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, y0, sizeof(double), neq, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, f0, sizeof(double), neq, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, ylast, sizeof(double), neq, restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, context->Zlast, sizeof(double), 3*neq,
+				     restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, options->Stats, sizeof(int), _EVOLVER_STATS_,
+				     restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, context->Jval, sizeof(double), nnz,
+				     restore, error_message),
+	       error_message, error_message);
+  lasagna_call(evolver_checkpoint_io(file, ((struct numjac_workspace*) context->nj_ws)->jacvec+1,
+				     sizeof(double), neq, restore, error_message),
+	       error_message, error_message);
+  return _SUCCESS_;
+}
+
+static int radau5_concurrent(EvolverOptions *options){
+  /** Are the two systems done on two threads? Only if the run has more
+      than one core and the machine has them too: on one processor the
+      second thread spin-waits and takes time from the first. */
+#ifdef _OPENMP
+  return ((options->Cores > 1)&&(omp_get_num_procs() > 1));
+#else
+  return _FALSE_;
+#endif
+}
+
+int radau5_factorise(struct radau5_context *context,
+		     double h,
+		     int flag,
+		     EvolverOptions *options,
+		     ErrorMsg error_message){
+  /** Forms A and Z for the step h and factorises them. The two
+      factorisations are independent, so with more than one core they are
+      done at the same time, one on each of two threads (see
+      radau5_concurrent). At t_final the step is 0 and there is nothing
+      left to factorise. */
+  int abort = _FALSE_;
+  ErrorMsg message_A, message_Z;
+  double t0;
+
+  if (h == 0.0)
+    return _SUCCESS_;
+  t0 = evolver_tic(options->Timing);
+  if (context->real_form == _TRUE_)
+    update_linear_system_radau5_real(&(context->J), &(context->A), &(context->Z), h);
+  else
+    update_linear_system_radau5(&(context->J), &(context->A), &(context->Z), h);
+#pragma omp parallel sections num_threads(2) if(radau5_concurrent(options))
+  {
+#pragma omp section
+    lasagna_call_parallel(options->linalg_factorise(context->linalg_workspace_A, flag, message_A),
+			  message_A, error_message);
+#pragma omp section
+    lasagna_call_parallel(options->linalg_factorise(context->linalg_workspace_Z, flag, message_Z),
+			  message_Z, error_message);
+  }
+  evolver_toc(options->Timing,options->Time[_TIME_FACTORISE_],
+	      options->TimeCalls[_TIME_FACTORISE_],t0);
+  if (abort == _TRUE_) return _FAILURE_;
+  return _SUCCESS_;
+}
+
+int radau5_solve_stages(struct radau5_context *context,
+			EvolverOptions *options,
+			ErrorMsg error_message){
+  /** Solves A DW = RHS and Z DW_CX = RHS_CX of a Newton iteration, at the
+      same time as the factorisations in radau5_factorise. In the real form,
+      RHS_CX is solved as [Re; Im] through RHS_RE and DW_RE. */
+  MultiMatrix *RHS_Z=&(context->RHS_CX), *DW_Z=&(context->DW_CX);
+  double *rhs_re, *dw_re;
+  size_t i, neq=context->neq;
+  int abort = _FALSE_;
+  ErrorMsg message_A, message_Z;
+  double t0 = evolver_tic(options->Timing);
+
+  if (context->real_form == _TRUE_){
+    rhs_re = context->rhs_re_buf+1;
+    for (i=0; i<neq; i++){
+      rhs_re[i] = creal(context->rhs_cx_buf[i+1]);
+      rhs_re[neq+i] = cimag(context->rhs_cx_buf[i+1]);
+    }
+    RHS_Z = &(context->RHS_RE);
+    DW_Z = &(context->DW_RE);
+  }
+#pragma omp parallel sections num_threads(2) if(radau5_concurrent(options))
+  {
+#pragma omp section
+    lasagna_call_parallel(options->linalg_solve(&(context->RHS), &(context->DW),
+						context->linalg_workspace_A, message_A),
+			  message_A, error_message);
+#pragma omp section
+    lasagna_call_parallel(options->linalg_solve(RHS_Z, DW_Z, context->linalg_workspace_Z, message_Z),
+			  message_Z, error_message);
+  }
+  evolver_toc(options->Timing,options->Time[_TIME_SOLVE_],
+	      options->TimeCalls[_TIME_SOLVE_],t0);
+  if (abort == _TRUE_) return _FAILURE_;
+  if (context->real_form == _TRUE_){
+    dw_re = context->dw_re_buf+1;
+    for (i=0; i<neq; i++)
+      context->delta_w_cx_buf[i+1] = dw_re[i]+I*dw_re[neq+i];
+  }
   return _SUCCESS_;
 }
 
@@ -837,9 +1228,9 @@ int update_linear_system_radau5(MultiMatrix *J,
   double gamma = gamma_hat/hnew;
   double complex alpha_ibeta = alpha_hat/hnew+I*(beta_hat/hnew);
 
-  double luparity, *Ax, *Jx;
+  double *Ax, *Jx;
   double complex *Az;
-  int i,j,*Ap,*Ai,funcreturn;
+  int i,j,*Ap,*Ai;
 
   SCCformat *JStoreSCC,*AStoreSCC,*ZStoreSCC;
   DNRformat *JStoreDNR,*AStoreDNR,*ZStoreDNR;
@@ -890,6 +1281,74 @@ int update_linear_system_radau5(MultiMatrix *J,
 }
 
 
+int update_linear_system_radau5_real(MultiMatrix *J,
+				     MultiMatrix *A,
+				     MultiMatrix *Z,
+				     double hnew){
+  /** As update_linear_system_radau5, with Z the real matrix
+      [alpha/h-J -beta/h; beta/h alpha/h-J] of 2neq equations, in the
+      pattern built by radau5_context_create. */
+  size_t neq=J->ncol;
+  double gamma_hat = 3.0-pow(3.0,1.0/3.0)+pow(3.0,2.0/3.0);
+  double alpha_hat = 0.5*(6.0+pow(3.0,1.0/3.0)-pow(3.0,2.0/3.0));
+  double beta_hat = 0.5*pow(3.0,1.0/6.0)*(3.0+pow(3.0,2.0/3.0));
+  double gamma = gamma_hat/hnew;
+  double alpha = alpha_hat/hnew;
+  double beta = beta_hat/hnew;
+
+  double *Ax, *Jx, *Zx;
+  int i,j,q,*Ap,*Ai,*Zp;
+
+  SCCformat *JStoreSCC,*AStoreSCC,*ZStoreSCC;
+  DNRformat *JStoreDNR,*AStoreDNR,*ZStoreDNR;
+  double **Jmat, **Amat, **Zmat;
+  switch(J->Stype){
+  case(L_SCC):
+    JStoreSCC = J->Store; AStoreSCC = A->Store; ZStoreSCC = Z->Store;
+    Ap = AStoreSCC->Ap; Ai = AStoreSCC->Ai; 
+    Ax = AStoreSCC->Ax; Jx = JStoreSCC->Ax;
+    Zp = ZStoreSCC->Ap; Zx = ZStoreSCC->Ax;
+    for(j=0;j<neq;j++){
+      q = Zp[neq+j];
+      Zx[q++] = -beta;
+      for(i=Ap[j];i<Ap[j+1];i++){
+	if(Ai[i]==j){
+	  Ax[i] = gamma-Jx[i];
+	  Zx[Zp[j]+i-Ap[j]] = alpha-Jx[i];
+	}
+	else{
+	  Ax[i] = -Jx[i];
+	  Zx[Zp[j]+i-Ap[j]] = -Jx[i];
+	}
+	Zx[q++] = Zx[Zp[j]+i-Ap[j]];
+      }
+      Zx[Zp[j+1]-1] = beta;
+    }
+    break;
+  case (L_DNR):
+    JStoreDNR = J->Store; AStoreDNR = A->Store; ZStoreDNR = Z->Store;
+    Jmat = (double **) JStoreDNR->Matrix;
+    Amat = (double **) AStoreDNR->Matrix;
+    Zmat = (double **) ZStoreDNR->Matrix;
+    for(i=1;i<=neq;i++){
+      for(j=1;j<=neq;j++){
+	Amat[i][j] = -Jmat[i][j];
+	Zmat[i][j] = -Jmat[i][j];
+	Zmat[neq+i][neq+j] = -Jmat[i][j];
+	Zmat[i][neq+j] = 0.0;
+	Zmat[neq+i][j] = 0.0;
+      }
+      Amat[i][i] += gamma;
+      Zmat[i][i] += alpha;
+      Zmat[neq+i][neq+i] += alpha;
+      Zmat[i][neq+i] = -beta;
+      Zmat[neq+i][i] = beta;
+    }
+    break;
+  }
+  return _SUCCESS_;
+}
+
 int transform_C_tensor_I(double *C, 
 			 int s,
 			 double *vec_in,
@@ -985,6 +1444,12 @@ int dense_output_radau5(double tinterp,
   return _SUCCESS_;
 }
        
+int radau5_event_interp(double t, double *y, void *dense){
+  /* y at t on the step in dense. */
+  struct radau5_dense *d = dense;
+  return dense_output_radau5(t,y,d->t,d->h,d->y0,d->Z,NULL,d->neq);
+}
+
 double norm_inf(double *y, 
 		double *err_y, 
 		double threshold,
@@ -992,6 +1457,7 @@ double norm_inf(double *y,
   int i;
   double wt,max_tmp=0.0;
   
+#pragma omp simd reduction(max:max_tmp) private(wt)
   for (i=0; i<neq; i++){
     wt = max(threshold, fabs(y[i]));
     max_tmp = max(max_tmp,fabs(err_y[i]/wt));
@@ -1007,6 +1473,7 @@ double norm_L2(double *y,
   int i;
   double t, wt, sum = 0.0;
   
+#pragma omp simd reduction(+:sum) private(t,wt)
   for (i=0; i<neq; i++){
     wt = max(threshold, fabs(y[i]));
     t = fabs(err_y[i]/wt);
@@ -10,14 +10,13 @@ int evolver_rk45(int (*derivs)(double x,double * y,double * dy,
 		 ErrorMsg error_message){
 	
   /** Handle options: */
-  int *interpidx, *stats, verbose, t_res; 
-  double abstol, rtol, *t_vec;
+  int *stats, verbose, t_res; 
+  double rtol, *t_vec;
   int (*output)(double t, double *y, double *dy, int i, void *p, ErrorMsg err);
-  int (*print_variables)(double t, double *y, double *dy, void *p, ErrorMsg err);
-  interpidx = options->used_in_output; stats = &(options->Stats[0]);
-  verbose = options->EvolverVerbose; t_res = options->tres; abstol = options->AbsTol; 
+  stats = &(options->Stats[0]);
+  verbose = options->EvolverVerbose; t_res = options->tres;
   rtol = options->RelTol; t_vec = options->t_vec; 
-  output = options->output; print_variables=options->print_variables; 
+  output = options->output;
  
   double *dy,*err,*ynew,*ytemp, *ki;
   double h,errmax,errtemp,hmin,hnew;
@@ -115,9 +114,9 @@ int evolver_rk45(int (*derivs)(double x,double * y,double * dy,
   }
   ki = malloc(sizeof(double)*s*neq);
   t = x_ini;
-  derivs(t,y_inout,dy,ppaw, error_message);
+  evolver_timed(options,_TIME_DERIVS_,derivs(t,y_inout,dy,ppaw, error_message));
   stats[2]++;
-  output(t,y_inout,dy,0,ppaw, error_message);
+  evolver_timed(options,_TIME_OUTPUT_,output(t,y_inout,dy,0,ppaw, error_message));
   //
   hmin = 100.0*DBL_MIN*fabs(t);
   hmax = fabs(x_final-x_ini)/10.0;
@@ -175,7 +174,7 @@ int evolver_rk45(int (*derivs)(double x,double * y,double * dy,
 	  printf("y_inout = [%g,%g]. ytemp = [%g,%g]\n",
 		 y_inout[0],y_inout[1],ytemp[0],ytemp[1]);
 	}
-	derivs(t+ci[i]*h,ytemp,ki+i*neq,ppaw, error_message);
+	evolver_timed(options,_TIME_DERIVS_,derivs(t+ci[i]*h,ytemp,ki+i*neq,ppaw, error_message));
 	stats[2]++;
 	// Update ynew and err:
 	for (k=0; k<neq; k++){  
@@ -218,8 +217,8 @@ int evolver_rk45(int (*derivs)(double x,double * y,double * dy,
       }
     }
     // Store values at this point:
-    derivs(t,y_inout,dy,ppaw, error_message);
-    output(t,y_inout,dy,idx,ppaw, error_message);
+    evolver_timed(options,_TIME_DERIVS_,derivs(t,y_inout,dy,ppaw, error_message));
+    evolver_timed(options,_TIME_OUTPUT_,output(t,y_inout,dy,idx,ppaw, error_message));
   }
   if (verbose>0)
     printf(" Successful steps: %d\n Failed steps: %d\n Function evaluations: %d\n",
@@ -256,6 +255,10 @@ int evolver_rkdp45(int (*derivs)(double x,
   rtol = options->RelTol; t_vec = options->t_vec; 
   output = options->output; print_variables=options->print_variables; 
   stop_function = options->stop_function;
+  lasagna_test(options->tangent != NULL, error_message,
+	       "The tangent-linear mode is only implemented in ndf15.");
+  lasagna_test(options->Events > 0, error_message,
+	       "Events are only located by ndf15 and radau5.");
 
   double *dy,*err,*ynew,*ytemp, *ki;
   double h,absh,hmax,errmax,errtemp,hmin,hnew;
@@ -314,7 +317,7 @@ int evolver_rkdp45(int (*derivs)(double x,
 
   t = t_ini;
   //initialise ki
-  derivs(t,y_inout,ki,ppaw, error_message);
+  evolver_timed(options,_TIME_DERIVS_,derivs(t,y_inout,ki,ppaw, error_message));
   stats[2]++;
   hmin = 100.0*DBL_MIN*fabs(t);
   hmax = fabs(t_final-t_ini)/10.0;
@@ -345,6 +348,7 @@ int evolver_rkdp45(int (*derivs)(double x,
     for(idx = 0; (t_vec[idx]-t)*tdir<0.0; idx++);
   }
   nofailed = _TRUE_;
+  lasagna_call(evolver_progress_start(options, t, t_final, y_inout), error_message, error_message);
   
   while ((t-t_final)*tdir<0.0){
     h = hnew;
@@ -378,7 +382,7 @@ int evolver_rkdp45(int (*derivs)(double x,
 	printf("y_inout = [%g,%g]. ytemp = [%g,%g]\n",
 	       y_inout[0],y_inout[1],ytemp[0],ytemp[1]);
       }
-      derivs(t+ci[i]*h,ytemp,ki+i*neq,ppaw, error_message);
+      evolver_timed(options,_TIME_DERIVS_,derivs(t+ci[i]*h,ytemp,ki+i*neq,ppaw, error_message));
       stats[2]++;
       // Update ynew and err:
       for (k=0; k<neq; k++){  
@@ -414,7 +418,7 @@ int evolver_rkdp45(int (*derivs)(double x,
       //Step accepted.
       stats[0]++;
       if (print_variables!=NULL){
-	print_variables(t+h,ynew,ki+6*neq,ppaw,error_message); 
+	evolver_timed(options,_TIME_OUTPUT_,print_variables(t+h,ynew,ki+6*neq,ppaw,error_message));
       }
       if (verbose>1)
 	printf("Step accepted. t=%g, h=%g\n",t,h);
@@ -448,15 +452,15 @@ int evolver_rkdp45(int (*derivs)(double x,
 	      }
 	    }
 	  }
-	  output(ti,yinterp,dyinterp,idx,ppaw, error_message);
+	  evolver_timed(options,_TIME_OUTPUT_,output(ti,yinterp,dyinterp,idx,ppaw, error_message));
 	}
-	output(tnew,ynew,ki+6*neq,tres,ppaw, error_message);
+	evolver_timed(options,_TIME_OUTPUT_,output(tnew,ynew,ki+6*neq,tres,ppaw, error_message));
       }
       else{
 	for(; (idx<tres)&&((tnew-t_vec[idx])*tdir>=0.0); idx++){
 	  if (tnew==t_vec[idx]){
 	    //We have hit the point exactly. Use ynew and dy=ki+6*neq
-	    output(tnew,ynew,ki+6*neq,idx,ppaw, error_message);
+	    evolver_timed(options,_TIME_OUTPUT_,output(tnew,ynew,ki+6*neq,idx,ppaw, error_message));
 	  }
 	  else{
 	    //Interpolate to get output using the information in the ki-matrix:
@@ -482,14 +486,16 @@ int evolver_rkdp45(int (*derivs)(double x,
 		}
 	      }
 	    }
-	    output(ti,yinterp,dyinterp,idx,ppaw, error_message);
+	    evolver_timed(options,_TIME_OUTPUT_,output(ti,yinterp,dyinterp,idx,ppaw, error_message));
 	  }
 	}
       }
+      if (options->ProgressInterval > 0.0)
+	evolver_progress(options, tnew, t_final, h, 5, ynew, _FALSE_);
       /* Perhaps use stop function: */
       if (stop_function != NULL){
 	if (stop_function(tnew,ynew,ki+6*neq, ppaw, error_message)==_TRUE_){
-	  output(tnew,ynew,ki+6*neq,idx,ppaw, error_message);
+	  evolver_timed(options,_TIME_OUTPUT_,output(tnew,ynew,ki+6*neq,idx,ppaw, error_message));
 	  printf("Stop condition met...\n");
 	  break;
 	}
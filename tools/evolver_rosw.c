@@ -0,0 +1,521 @@
+#include "evolver_rosw.h"
+/**
+   Linearly implicit Rosenbrock-W method ROS34PW2 of Rang and Angermann
+   (2005): 4 stages, order 3 with an embedded method of order 2. Each step
+   needs one LU decomposition of I/(h*gamma)-J and 4 solves, and no Newton
+   iteration. As a W-method it keeps its order with any approximation J of
+   the Jacobian, so J and df/dt are only computed again after a rejected
+   step, and the factorisation is kept while h is.
+
+   The stages are solved for u_i = sum_j gamma_ij k_j (Hairer and Wanner,
+   section IV.7), so that J is never multiplied with a vector:
+     (I/(h*gamma)-J) u_i = f(t+alpha_i*h, y+sum_j a_ij u_j)
+                           + sum_j c_ij/h u_j + h*gamma_i*df/dt.
+   Statistics are counted as in evolver_radau5.
+
+   IMEX mode: with options->derivs_split, J is the Jacobian of the implicit
+   part only, from options->jacobian_implicit, so the explicit part enters
+   through the stage values alone. The W-property keeps order 3, and the
+   explicit part then limits the step size by its own stability.
+*/
+
+static void rosw_coefficients(double *gamma,
+			      double a[_ROSW_STAGES_][_ROSW_STAGES_],
+			      double c[_ROSW_STAGES_][_ROSW_STAGES_],
+			      double *alpha,
+			      double *gamma_i,
+			      double *m,
+			      double *e){
+  /** The coefficients of the u_i form from the tableau of ROS34PW2. */
+  double A[_ROSW_STAGES_][_ROSW_STAGES_]=
+    {{0.0, 0.0, 0.0, 0.0},
+     {8.7173304301691801e-01, 0.0, 0.0, 0.0},
+     {8.4457060015369423e-01, -1.1299064236484185e-01, 0.0, 0.0},
+     {0.0, 0.0, 1.0, 0.0}};
+  double G[_ROSW_STAGES_][_ROSW_STAGES_]=
+    {{4.3586652150845900e-01, 0.0, 0.0, 0.0},
+     {-8.7173304301691801e-01, 4.3586652150845900e-01, 0.0, 0.0},
+     {-9.0338057013044082e-01, 5.4180672388095326e-02, 4.3586652150845900e-01, 0.0},
+     {2.4212380706095346e-01, -1.2232505839045147e+00, 5.4526025533510214e-01,
+      4.3586652150845900e-01}};
+  double b[_ROSW_STAGES_]=
+    {2.4212380706095346e-01, -1.2232505839045147e+00, 1.5452602553351020e+00,
+     4.3586652150845900e-01};
+  double bhat[_ROSW_STAGES_]=
+    {3.7810903145819369e-01, -9.6042292212423178e-02, 5.0000000000000000e-01,
+     2.1793326075422950e-01};
+  double Ginv[_ROSW_STAGES_][_ROSW_STAGES_];
+  int i, j, k, s=_ROSW_STAGES_;
+
+  *gamma = G[0][0];
+  //Inverse of the lower triangular G:
+  for (i=0; i<s; i++){
+    for (j=0; j<s; j++)
+      Ginv[i][j] = 0.0;
+    Ginv[i][i] = 1.0/G[i][i];
+    for (j=i-1; j>=0; j--){
+      for (k=j; k<i; k++)
+	Ginv[i][j] -= G[i][k]*Ginv[k][j];
+      Ginv[i][j] /= G[i][i];
+    }
+  }
+  for (i=0; i<s; i++){
+    alpha[i] = 0.0;
+    gamma_i[i] = 0.0;
+    m[i] = 0.0;
+    e[i] = 0.0;
+    for (j=0; j<s; j++){
+      alpha[i] += A[i][j];
+      if (j <= i)
+	gamma_i[i] += G[i][j];
+      a[i][j] = 0.0;
+      for (k=0; k<s; k++)
+	a[i][j] += A[i][k]*Ginv[k][j];
+      c[i][j] = (j < i ? -Ginv[i][j] : 0.0);
+      m[i] += b[j]*Ginv[j][i];
+      e[i] += (b[j]-bhat[j])*Ginv[j][i];
+    }
+  }
+}
+
+static int rosw_jacobian(int (*derivs)(double x,double * y,double * dy,
+				       void * parameters_and_workspace, ErrorMsg error_message),
+			 void * parameters_and_workspace_for_derivs,
+			 double t,
+			 double absh,
+			 int tdir,
+			 double *y,
+			 double *f0,
+			 double *ftmp,
+			 double *dfdt,
+			 MultiMatrix *J,
+			 void *nj_ws,
+			 size_t neq,
+			 EvolverOptions *options,
+			 ErrorMsg error_message){
+  /** J and df/dt at (t,y), f0 is f(t,y). In IMEX mode, J is the Jacobian
+      of the implicit part, which is first put in ftmp. */
+  int i, nfenj=0;
+  double tdel;
+
+  if (options->derivs_split != NULL){
+    evolver_timed(options,_TIME_DERIVS_,
+		  lasagna_call(options->derivs_split(t,
+						     y,
+						     ftmp,
+						     dfdt,
+						     parameters_and_workspace_for_derivs,
+						     error_message),
+			       error_message, error_message));
+    evolver_timed(options,_TIME_JACOBIAN_,
+		  lasagna_call(options->jacobian_implicit(t,
+							  y,
+							  ftmp,
+							  J,
+							  &nfenj,
+							  parameters_and_workspace_for_derivs,
+							  error_message),
+			       error_message, error_message));
+    nfenj++;
+  }
+  else{
+    lasagna_call(evolver_jacobian(derivs,
+				  t,
+				  y-1,
+				  f0-1,
+				  J,
+				  nj_ws,
+				  options->AbsTol,
+				  neq,
+				  &nfenj,
+				  options,
+				  parameters_and_workspace_for_derivs,
+				  error_message),
+		 error_message, error_message);
+  }
+  options->Stats[3] += 1;
+  options->Stats[2] += nfenj;
+  tdel = (t + tdir*min(sqrt(DBL_EPSILON)*max(fabs(t),fabs(t+tdir*absh)),absh)) - t;
+  evolver_timed(options,_TIME_DERIVS_,
+		lasagna_call((*derivs)(t+tdel,
+				       y,
+				       ftmp,
+				       parameters_and_workspace_for_derivs,
+				       error_message),
+			     error_message, error_message));
+  options->Stats[2] += 1;
+  for (i=0; i<neq; i++)
+    dfdt[i] = (ftmp[i]-f0[i])/tdel;
+  return _SUCCESS_;
+}
+
+int evolver_rosw(int (*derivs)(double x,double * y,double * dy,
+			       void * parameters_and_workspace, ErrorMsg error_message),
+		 void * parameters_and_workspace_for_derivs,
+		 double t0,
+		 double tfinal,
+		 double * y_inout,
+		 size_t neq,
+		 EvolverOptions *options,
+		 ErrorMsg error_message){
+
+  /** Handle options: */
+  int *interpidx, *stepstat, verbose, tres;
+  double abstol, rtol, *t_vec;
+  int (*linalg_factorise)(void *, int, ErrorMsg);
+  int (*linalg_solve)(MultiMatrix *, MultiMatrix *, void *, ErrorMsg);
+  int (*output)(double t, double *y, double *dy, int i, void *p, ErrorMsg err);
+  int (*print_variables)(double t, double *y, double *dy, void *p, ErrorMsg err);
+  int (*stop_function)(double t, double *y, double *dy, void *p, ErrorMsg err);
+  interpidx = options->used_in_output; stepstat = &(options->Stats[0]);
+  verbose = options->EvolverVerbose; tres = options->tres; abstol = options->AbsTol;
+  rtol = options->RelTol; t_vec = options->t_vec;
+  linalg_factorise = options->linalg_factorise; linalg_solve = options->linalg_solve;
+  output = options->output; print_variables=options->print_variables;
+  stop_function = options->stop_function;
+  lasagna_test(options->tangent != NULL, error_message,
+	       "The tangent-linear mode is only implemented in ndf15.");
+  lasagna_test(options->Events > 0, error_message,
+	       "Events are only located by ndf15 and radau5.");
+  lasagna_test(options->J_pointer_flag == _TRUE_, error_message,
+	       "The Lyapunov vector is not implemented in the Rosenbrock-W evolver.");
+  lasagna_test((options->CheckpointInterval > 0)||(options->Restart == _TRUE_),
+	       error_message,"The Rosenbrock-W evolver does not write checkpoints.");
+  lasagna_test((options->derivs_split != NULL)&&(options->jacobian_implicit == NULL),
+	       error_message,"The IMEX mode needs the Jacobian of the implicit part.");
+
+  /* Method: */
+  double gamma, a[_ROSW_STAGES_][_ROSW_STAGES_], c[_ROSW_STAGES_][_ROSW_STAGES_];
+  double alpha[_ROSW_STAGES_], gamma_i[_ROSW_STAGES_], m[_ROSW_STAGES_], e[_ROSW_STAGES_];
+
+  /* Step size control: */
+  double safety=0.9, fac_min=0.2, fac_max=5.0, hold_max=1.2;
+  double threshold = abstol/rtol;
+
+  int tdir, next=0, i, j, k, J_current, new_jacobian, last_failed=_FALSE_;
+  double t, h, absh, abshmin, h_factorised=0.0, ti, rh, norm_err, fac;
+  double *f0, *f1, *ynew, *ytemp, *ftmp, *dfdt, *err, *U, *F, *rhs, *du, *swap;
+  double *vec_buf, *rhs_buf, *du_buf, *Jval, *Aval;
+  MultiMatrix J, A, RHS, DU;
+  void *linalg_workspace, *nj_ws;
+  int *Ai, *Ap, nnz;
+
+  rosw_coefficients(&gamma, a, c, alpha, gamma_i, m, e);
+
+  /* f0, f1, ynew, ytemp, ftmp, dfdt, err and the stages U: */
+  lasagna_alloc(vec_buf, sizeof(double)*(7+_ROSW_STAGES_)*neq, error_message);
+  lasagna_alloc(rhs_buf, sizeof(double)*(neq+1), error_message);
+  lasagna_alloc(du_buf, sizeof(double)*(neq+1), error_message);
+  f0 = vec_buf; f1 = f0+neq; ynew = f1+neq; ytemp = ynew+neq; ftmp = ytemp+neq;
+  dfdt = ftmp+neq; err = dfdt+neq; U = err+neq;
+  rhs = rhs_buf+1;
+  du = du_buf+1;
+
+  /** Initialise MultiMatrix J, A and the linear method: */
+  if (options->use_sparse == _TRUE_){
+    Ai=options->Ai; Ap=options->Ap;
+    nnz = Ap[neq];
+    lasagna_calloc(Jval, nnz, sizeof(double), error_message);
+    lasagna_alloc(Aval, sizeof(double)*nnz, error_message);
+    lasagna_call(CreateMatrix_SCC(&J,L_DBL,neq, neq, nnz, Ai, Ap, Jval, error_message),
+		 error_message, error_message);
+    lasagna_call(CreateMatrix_SCC(&A,L_DBL,neq, neq, nnz, Ai, Ap, Aval, error_message),
+		 error_message, error_message);
+  }
+  else{
+    lasagna_calloc(Jval, (neq*neq+1), sizeof(double), error_message);
+    lasagna_alloc(Aval, sizeof(double)*(neq*neq+1), error_message);
+    lasagna_call(CreateMatrix_DNR(&J,L_DBL,neq, neq, Jval, error_message),
+		 error_message, error_message);
+    lasagna_call(CreateMatrix_DNR(&A,L_DBL,neq, neq, Aval, error_message),
+		 error_message, error_message);
+  }
+  lasagna_call(options->linalg_initialise(&A, options, &linalg_workspace, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&RHS, L_DBL, 1, neq, rhs_buf, error_message),
+	       error_message, error_message);
+  lasagna_call(CreateMatrix_DNR(&DU, L_DBL, 1, neq, du_buf, error_message),
+	       error_message, error_message);
+  nj_ws = NULL;
+  if (options->derivs_split == NULL){
+    lasagna_call(initialize_numjac_workspace(&J, &nj_ws, error_message),
+		 error_message, error_message);
+    lasagna_call(reset_numjac_workspace(nj_ws, options, parameters_and_workspace_for_derivs,
+					error_message),
+		 error_message, error_message);
+  }
+  for (i=0; i<_EVOLVER_STATS_; i++) stepstat[i] = 0;
+
+  if ((tfinal-t0)>0)
+    tdir = 1;
+  else
+    tdir = -1;
+  t = t0;
+  evolver_timed(options,_TIME_DERIVS_,
+		lasagna_call((*derivs)(t,
+				       y_inout,
+				       f0,
+				       parameters_and_workspace_for_derivs,
+				       error_message),
+			     error_message, error_message));
+  stepstat[2]++;
+  if (t_vec != NULL){
+    //Output at t_vec, the first point may be t0:
+    for (next=0; (next<tres)&&((t_vec[next]-t0)*tdir<0.0); next++);
+    if ((next<tres)&&(t_vec[next] == t0)){
+      evolver_timed(options,_TIME_OUTPUT_,
+		    lasagna_call((*output)(t0,y_inout,f0,next,
+					   parameters_and_workspace_for_derivs,
+					   error_message),error_message,error_message));
+      next++;
+    }
+  }
+
+  /** Initial step from the size of f: */
+  absh = 0.1*fabs(tfinal-t0);
+  rh = norm_inf(y_inout, f0, threshold, neq)/(0.8*pow(rtol,1.0/3.0));
+  if (absh*rh > 1.0)
+    absh = 1.0/rh;
+  absh = max(absh, 16.0*fabs(t)*DBL_EPSILON);
+  lasagna_call(rosw_jacobian(derivs, parameters_and_workspace_for_derivs, t, absh, tdir,
+			     y_inout, f0, ftmp, dfdt, &J, nj_ws, neq, options, error_message),
+	       error_message, error_message);
+  J_current = _TRUE_;
+  new_jacobian = _TRUE_;
+
+  lasagna_call(evolver_progress_start(options, t, tfinal, y_inout), error_message, error_message);
+
+  //Main loop:
+  while ((tfinal-t)*tdir>0.0){
+    abshmin = 16.0*fabs(t)*DBL_EPSILON;
+    lasagna_test(absh<abshmin, error_message,
+		 "Step size too small in evolver_rosw at t=%g!. |h|=%g < |hmin|=%g",
+		 t, absh, abshmin);
+    /* Stretch the step if within 10% of tfinal-t. */
+    if (1.1*absh >= fabs(tfinal-t))
+      absh = fabs(tfinal-t);
+    h = tdir*absh;
+    if ((new_jacobian == _TRUE_)||(h != h_factorised)){
+      update_linear_system_rosw(&J, &A, 1.0/(h*gamma));
+      evolver_timed(options,_TIME_FACTORISE_,
+		    lasagna_call(linalg_factorise(linalg_workspace, new_jacobian, error_message),
+				 error_message, error_message));
+      stepstat[4] += 1;
+      new_jacobian = _FALSE_;
+      h_factorised = h;
+    }
+    /** The stages: */
+    for (i=0; i<_ROSW_STAGES_; i++){
+      if (i == 0)
+	F = f0;
+      else{
+	for (k=0; k<neq; k++){
+	  ytemp[k] = y_inout[k];
+	  for (j=0; j<i; j++)
+	    ytemp[k] += a[i][j]*U[j*neq+k];
+	}
+	evolver_timed(options,_TIME_DERIVS_,
+		      lasagna_call((*derivs)(t+alpha[i]*h,
+					     ytemp,
+					     ftmp,
+					     parameters_and_workspace_for_derivs,
+					     error_message),
+				   error_message, error_message));
+	stepstat[2]++;
+	F = ftmp;
+      }
+      for (k=0; k<neq; k++){
+	rhs[k] = F[k]+h*gamma_i[i]*dfdt[k];
+	for (j=0; j<i; j++)
+	  rhs[k] += c[i][j]/h*U[j*neq+k];
+      }
+      evolver_timed(options,_TIME_SOLVE_,
+		    lasagna_call(linalg_solve(&RHS, &DU, linalg_workspace, error_message),
+				 error_message, error_message));
+      stepstat[5] += 1;
+      memcpy(U+i*neq, du, sizeof(double)*neq);
+    }
+    for (k=0; k<neq; k++){
+      ynew[k] = y_inout[k];
+      err[k] = 0.0;
+      for (j=0; j<_ROSW_STAGES_; j++){
+	ynew[k] += m[j]*U[j*neq+k];
+	err[k] += e[j]*U[j*neq+k];
+      }
+    }
+    norm_err = norm_inf(ynew, err, threshold, neq);
+    fac = safety*pow(rtol/max(norm_err,1e-10*rtol),1.0/3.0);
+    if (norm_err > rtol){
+      //Step rejected, with a new Jacobian if it was old:
+      stepstat[1]++;
+      last_failed = _TRUE_;
+      absh *= max(fac_min,min(fac,0.9));
+      if (J_current == _FALSE_){
+	lasagna_call(rosw_jacobian(derivs, parameters_and_workspace_for_derivs, t, absh, tdir,
+				   y_inout, f0, ftmp, dfdt, &J, nj_ws, neq, options,
+				   error_message),
+		     error_message, error_message);
+	J_current = _TRUE_;
+	new_jacobian = _TRUE_;
+      }
+      continue;
+    }
+    //Step accepted:
+    stepstat[0]++;
+    if (verbose>1)
+      printf("%.16e %.16e\n",t,h);
+    evolver_timed(options,_TIME_DERIVS_,
+		  lasagna_call((*derivs)(t+h,
+					 ynew,
+					 f1,
+					 parameters_and_workspace_for_derivs,
+					 error_message),
+			       error_message, error_message));
+    stepstat[2]++;
+    /**  Output:  */
+    if (t_vec==NULL){
+      //Refinement output:
+      for (i=1; i<=tres; i++){
+	ti = t+i/((double) tres)*h;
+	dense_output_rosw(ti, ytemp, t, h, y_inout, f0, ynew, f1, interpidx, neq);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(ti,ytemp,f1,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+      }
+    }
+    else{
+      while((next<tres)&&((t+h-t_vec[next])*tdir >= 0.0)){
+	dense_output_rosw(t_vec[next], ytemp, t, h, y_inout, f0, ynew, f1, interpidx, neq);
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(t_vec[next],ytemp,f1,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+	next++;
+      }
+    }
+    t += h;
+    memcpy(y_inout, ynew, sizeof(double)*neq);
+    swap = f0; f0 = f1; f1 = swap;
+    J_current = _FALSE_;
+    if (print_variables != NULL){
+      evolver_timed(options,_TIME_OUTPUT_,
+		    lasagna_call((*print_variables)(t,
+						    y_inout,
+						    f0,
+						    parameters_and_workspace_for_derivs,
+						    error_message),
+				 error_message,error_message));
+    }
+    /** Next step size. Small increases keep h, and so the factorisation: */
+    fac = max(fac_min,min(fac,(last_failed == _TRUE_ ? 1.0 : fac_max)));
+    if ((fac < 1.0)||(fac > hold_max))
+      absh *= fac;
+    last_failed = _FALSE_;
+    if (options->ProgressInterval > 0.0)
+      evolver_progress(options, t, tfinal, tdir*absh, 3, y_inout, _FALSE_);
+    /* Perhaps use stop function: */
+    if (stop_function != NULL){
+      if (stop_function(t,y_inout,f0,parameters_and_workspace_for_derivs,
+			error_message) == _TRUE_){      //Stop condition
+	evolver_timed(options,_TIME_OUTPUT_,
+		      lasagna_call((*output)(t,y_inout,f0,next,
+					     parameters_and_workspace_for_derivs,
+					     error_message),error_message,error_message));
+	printf("Stop condition met...\n");
+	break;
+      }
+    }
+  }
+  printf("\n End of evolver. Next=%d, t=%e.",next,t);
+  printf("\n Statistics: [%d %d %d %d %d %d] \n",stepstat[0],stepstat[1],
+	 stepstat[2],stepstat[3],stepstat[4],stepstat[5]);
+  if ((verbose > 1)&&(stepstat[_STAT_REFACTOR_]+stepstat[_STAT_FULL_LU_]>0))
+    printf(" Refactorisations: %d, full decompositions: %d, rejected: %d.\n",
+	   stepstat[_STAT_REFACTOR_],stepstat[_STAT_FULL_LU_],
+	   stepstat[_STAT_REFACTOR_REJECTED_]);
+
+  if (nj_ws != NULL)
+    uninitialize_numjac_workspace(nj_ws);
+  lasagna_call(options->linalg_finalise(linalg_workspace, error_message),
+	       error_message, error_message);
+  DestroyMultiMatrix(&J);
+  DestroyMultiMatrix(&A);
+  DestroyMultiMatrix(&RHS);
+  DestroyMultiMatrix(&DU);
+  free(Jval);
+  free(Aval);
+  free(vec_buf);
+  free(rhs_buf);
+  free(du_buf);
+  return _SUCCESS_;
+}
+
+int update_linear_system_rosw(MultiMatrix *J,
+			      MultiMatrix *A,
+			      double diagonal){
+  /** A = diagonal*I-J. */
+  size_t neq=J->ncol;
+  double *Ax, *Jx;
+  int i, j, *Ap, *Ai;
+  SCCformat *JStoreSCC, *AStoreSCC;
+  DNRformat *JStoreDNR, *AStoreDNR;
+  double **Jmat, **Amat;
+
+  switch(J->Stype){
+  case(L_SCC):
+    JStoreSCC = J->Store; AStoreSCC = A->Store;
+    Ap = AStoreSCC->Ap; Ai = AStoreSCC->Ai;
+    Ax = AStoreSCC->Ax; Jx = JStoreSCC->Ax;
+    for(j=0;j<neq;j++){
+      for(i=Ap[j];i<Ap[j+1];i++){
+	if(Ai[i]==j)
+	  Ax[i] = diagonal-Jx[i];
+	else
+	  Ax[i] = -Jx[i];
+      }
+    }
+    break;
+  case (L_DNR):
+    JStoreDNR = J->Store; AStoreDNR = A->Store;
+    Jmat = (double **) JStoreDNR->Matrix;
+    Amat = (double **) AStoreDNR->Matrix;
+    for(i=1;i<=neq;i++){
+      for(j=1;j<=neq;j++){
+	Amat[i][j] = -Jmat[i][j];
+	if(i==j)
+	  Amat[i][j] += diagonal;
+      }
+    }
+    break;
+  }
+  return _SUCCESS_;
+}
+
+int dense_output_rosw(double tinterp,
+		      double *yi,
+		      double t0,
+		      double h,
+		      double *y0,
+		      double *f0,
+		      double *y1,
+		      double *f1,
+		      int *interpidx,
+		      size_t neq){
+  /** Cubic Hermite interpolation on the step from t0 to t0+h, which has
+      the order of the method. */
+  double theta, h00, h10, h01, h11;
+  int i;
+
+  theta = (tinterp-t0)/h;
+  h00 = (1.0+2.0*theta)*(1.0-theta)*(1.0-theta);
+  h10 = theta*(1.0-theta)*(1.0-theta)*h;
+  h01 = theta*theta*(3.0-2.0*theta);
+  h11 = theta*theta*(theta-1.0)*h;
+  for (i=0; i<neq; i++){
+    if ((interpidx != NULL)&&(interpidx[i] == 0))
+      continue;
+    yi[i] = h00*y0[i]+h10*f0[i]+h01*y1[i]+h11*f1[i];
+  }
+  return _SUCCESS_;
+}
@@ -48,19 +48,10 @@ int linalg_initialise_SuperLU(MultiMatrix *A,
 			      ErrorMsg error_message){
   SCCformat *Store=A->Store;
   SLU_structure *workspace;
-  void *data;
   DataType Dtype;
-  int ncol, nrow, j;
-  int *Aw;
+  int ncol, nrow, j, lnz;
+  int *Aw, *Cp, *Ci;
   int Alen;
-  //SuperLU parameters:
-  int panel_size, relax;
-  trans_t trans;
-  fact_t   fact;
-  yes_no_t refact, usepr;
-  double diag_pivot_thresh, drop_tol;
-  void *work;
-  int lwork;
 
   printf("Linalg Wrapper: SuperLU. Number of cores: %d\n",options->Cores);
   ncol = A->ncol; nrow = A->nrow; Dtype = A->Dtype;
@@ -122,45 +113,97 @@ int linalg_initialise_SuperLU(MultiMatrix *A,
 	       "colamd failed!");
   free(Aw);
 
-  /** Set SuperLU parameters: 
-      ------------------------*/
-  fact               = DOFACT;
-  refact             = NO;
-  trans              = NOTRANS;
-  panel_size         = sp_ienv(1);
-  relax              = sp_ienv(2);
-  diag_pivot_thresh  = 1.0;
-  usepr              = NO;
-  drop_tol           = 0.0;
-  work               = NULL;
-  lwork              = 0;
-  /** --------------------- */
+  /** Symbolic pass: the fill of the Cholesky factor of A+A^T in the column
+      ordering sizes the storage of L and U, instead of the fixed fill 
+      factors of sp_ienv. Supernodes store L in dense blocks, so L gets more
+      room. If it is still too small, the first factorisation doubles it. */
+  lasagna_call(get_pattern_A_plus_AT(Store->Ap, Store->Ai, ncol, &Cp, &Ci, error_message),
+	       error_message, error_message);
+  lasagna_alloc(Aw,sizeof(int)*4*ncol,error_message);
+  lnz = sp_symbolic_fill(Cp, Ci, ncol, workspace->perm_c, Aw);
+  free(Aw);
+  free(Cp);
+  free(Ci);
+  workspace->Memory[0] = 4*lnz;
+  workspace->Memory[1] = 2*lnz;
+  workspace->Memory[2] = 2*lnz;
+
+  workspace->neq = nrow;
+  workspace->Cores = options->Cores;
+  workspace->Verbose = options->EvolverVerbose;
+  workspace->Stats = options->Stats;
+  workspace->Factorised = _FALSE_;
+  if (workspace->Verbose > 1)
+    printf("SuperLU: Estimated nnz(L) = %d for nnz(A) = %d.\n",lnz,Store->nnz);
 
-  StatAlloc(ncol, options->Cores, panel_size, relax, &workspace->Gstat);
+  StatAlloc(ncol, options->Cores, sp_ienv(1), sp_ienv(2), &workspace->Gstat);
   StatInit(ncol, options->Cores, &workspace->Gstat);
-  switch (A->Dtype){
-  case (L_DBL):
-    pdgstrf_init(options->Cores, fact, trans, refact, panel_size, relax,
-		 diag_pivot_thresh, usepr, drop_tol, 
-		 workspace->perm_c, workspace->perm_r,
-		 work, lwork, &(workspace->A), &(workspace->AC), 
-		 &(workspace->superlumt_options), &(workspace->Gstat));
-    break;
-  case (L_DBL_CX):
-    pzgstrf_init(options->Cores, fact, trans, refact, panel_size, relax,
-		 diag_pivot_thresh, usepr, drop_tol, 
-		 workspace->perm_c, workspace->perm_r,
-		 work, lwork, &(workspace->A), &(workspace->AC), 
-		 &(workspace->superlumt_options), &(workspace->Gstat));
-    break;
-  }
+  /** Threshold pivoting as in the sparse wrapper, so the row permutation
+      of a factorisation is mostly kept by the next ones: */
+  linalg_init_SuperLU(workspace, 0.1);
   
-  workspace->neq = nrow;
   *linalg_workspace = (void *) workspace;
   
   return _SUCCESS_;
 }
 
+int linalg_init_SuperLU(SLU_structure *ws, double diag_pivot_thresh){
+  /** Column permutation of A into AC and elimination tree, with no 
+      factorisation done yet. The threads are set here once for the run: 
+      with the OpenMP build of SuperLU_MT in SuperLUpatch.tar.gz they stay
+      alive between the factorisations. */
+  switch (ws->A.Dtype){
+  case (SLU_D):
+    pdgstrf_init(ws->Cores, DOFACT, NOTRANS, NO, sp_ienv(1), sp_ienv(2),
+		 diag_pivot_thresh, NO, 0.0, 
+		 ws->perm_c, ws->perm_r,
+		 NULL, 0, &(ws->A), &(ws->AC), 
+		 &(ws->superlumt_options), &(ws->Gstat));
+    break;
+  case (SLU_Z):
+    pzgstrf_init(ws->Cores, DOFACT, NOTRANS, NO, sp_ienv(1), sp_ienv(2),
+		 diag_pivot_thresh, NO, 0.0, 
+		 ws->perm_c, ws->perm_r,
+		 NULL, 0, &(ws->A), &(ws->AC), 
+		 &(ws->superlumt_options), &(ws->Gstat));
+    break;
+  }
+  return _SUCCESS_;
+}
+
+int linalg_gstrf_SuperLU(SLU_structure *ws){
+  /** One call of pdgstrf/pzgstrf. The storage of L and U is allocated by
+      the first call after linalg_init_SuperLU, which reads the sizes in 
+      ws->Memory through sp_ienv. sp_ienv_memory is global, hence the 
+      critical section. Later calls reuse the storage. */
+  if (ws->superlumt_options.refact == NO){
+#pragma omp critical(linalg_SuperLU_memory)
+    {
+      sp_ienv_memory[0] = ws->Memory[0];
+      sp_ienv_memory[1] = ws->Memory[1];
+      sp_ienv_memory[2] = ws->Memory[2];
+      if (ws->A.Dtype == SLU_D)
+	pdgstrf(&(ws->superlumt_options), &(ws->AC), ws->perm_r, 
+		&(ws->L), &(ws->U), &(ws->Gstat), &(ws->SLU_info));
+      else
+	pzgstrf(&(ws->superlumt_options), &(ws->AC), ws->perm_r, 
+		&(ws->L), &(ws->U), &(ws->Gstat), &(ws->SLU_info));
+      sp_ienv_memory[0] = 0;
+      sp_ienv_memory[1] = 0;
+      sp_ienv_memory[2] = 0;
+    }
+  }
+  else if (ws->A.Dtype == SLU_D){
+    pdgstrf(&(ws->superlumt_options), &(ws->AC), ws->perm_r, 
+	    &(ws->L), &(ws->U), &(ws->Gstat), &(ws->SLU_info));
+  }
+  else{
+    pzgstrf(&(ws->superlumt_options), &(ws->AC), ws->perm_r, 
+	    &(ws->L), &(ws->U), &(ws->Gstat), &(ws->SLU_info));
+  }
+  return _SUCCESS_;
+}
+
 int linalg_finalise_SuperLU(void *linalg_workspace,
 			    ErrorMsg error_message){
   
@@ -184,35 +227,60 @@ int linalg_factorise_SuperLU(void *linalg_workspace,
 			     int has_changed_significantly,
 			     ErrorMsg error_message){
   SLU_structure *ws= linalg_workspace;
+  int ncol=ws->neq, usepr;
   /** The actual data in ws->A is the same as in the MultiMatrix
       A which was passed to linalg_initialise_SuperLU. Thus, since
       AC has the same data as in A, we can just call the factorisation
       routine now, given that A has been modified accordingly outside.
+
+      After the first factorisation, refact = YES keeps the column 
+      permutation, the elimination tree and the storage of L and U, and 
+      usepr = YES starts from the row permutation of the last factorisation
+      (SamePattern_SameRowPerm). SuperLU_MT still pivots where a kept pivot
+      fails the threshold test. _LINALG_FROM_SCRATCH_ pivots from scratch.
   */
+  usepr = ((ws->Factorised == _TRUE_)&&(has_changed_significantly != _LINALG_FROM_SCRATCH_));
+  ws->superlumt_options.usepr = (usepr ? YES : NO);
+  linalg_gstrf_SuperLU(ws);
 
-  switch(ws->A.Dtype){
-  case (SLU_D):
-    pdgstrf(&(ws->superlumt_options), 
-	    &(ws->AC), 
-	    ws->perm_r, 
-	    &(ws->L), 
-	    &(ws->U), 
-	    &(ws->Gstat), 
-	    &(ws->SLU_info));
-    break;
-  case (SLU_Z):
-    pzgstrf(&(ws->superlumt_options), 
-	    &(ws->AC), 
-	    ws->perm_r, 
-	    &(ws->L), 
-	    &(ws->U), 
-	    &(ws->Gstat), 
-	    &(ws->SLU_info));
-    break;
+  /** Storage too small: start again with twice as much. */
+  while (ws->SLU_info > ncol){
+    lasagna_test(ws->Memory[0] > INT_MAX/2, error_message,
+		 "SuperLU: Out of memory after %d bytes.",ws->SLU_info-ncol);
+    ws->Memory[0] *= 2;
+    ws->Memory[1] *= 2;
+    ws->Memory[2] *= 2;
+    if (ws->Verbose > 1)
+      printf("SuperLU: Storage for L and U doubled to %d nonzeros.\n",ws->Memory[0]);
+    if (ws->L.Store != NULL) Destroy_SuperNode_SCP(&(ws->L));
+    if (ws->U.Store != NULL) Destroy_CompCol_NCP(&(ws->U));
+    ws->L.Store = NULL;
+    ws->U.Store = NULL;
+    pxgstrf_finalize(&(ws->superlumt_options), &(ws->AC));
+    linalg_init_SuperLU(ws, ws->superlumt_options.diag_pivot_thresh);
+    usepr = _FALSE_;
+    linalg_gstrf_SuperLU(ws);
   }
+  /** A kept pivot of zero: pivot from scratch. */
+  if ((ws->SLU_info > 0)&&(usepr == _TRUE_)){
+#pragma omp atomic
+    ws->Stats[_STAT_REFACTOR_REJECTED_]++;
+    ws->superlumt_options.usepr = NO;
+    usepr = _FALSE_;
+    linalg_gstrf_SuperLU(ws);
+  }
+  lasagna_test(ws->SLU_info > 0, error_message,
+	       "SuperLU: U(%d,%d) is exactly zero.",ws->SLU_info,ws->SLU_info);
+  if (usepr == _TRUE_)
+#pragma omp atomic
+    ws->Stats[_STAT_REFACTOR_]++;
+  else
+#pragma omp atomic
+    ws->Stats[_STAT_FULL_LU_]++;
   //Update superlu_mt_options structure:
   ws->superlumt_options.fact = FACTORED;
   ws->superlumt_options.refact = YES;
+  ws->Factorised = _TRUE_;
   return _SUCCESS_;
 }
 
@@ -263,3 +331,11 @@ int linalg_solve_SuperLU(MultiMatrix *B,
   
   return _SUCCESS_;
 }
+
+int linalg_solve_many_SuperLU(MultiMatrix *B, 
+			      MultiMatrix *X,
+			      void *linalg_workspace,
+			      ErrorMsg error_message){
+  /** dgstrs/zgstrs solve for all columns of ws->X in one call. */
+  return linalg_solve_SuperLU(B, X, linalg_workspace, error_message);
+}
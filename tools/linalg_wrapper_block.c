@@ -0,0 +1,219 @@
+#include "linalg_wrapper_block.h"
+
+/** Block diagonal wrapper with a border, see BL_structure. The blocks are
+    factorised and solved with dense_lu and dense_lu_solve, over
+    options->Cores threads, and the border adds one small dense LU of the
+    Schur complement. No global LU is needed. Takes SCC or DNR input with
+    real entries. */
+static void linalg_block_entry(BL_structure *ws,
+			       double *C,
+			       int i,
+			       int j,
+			       double a){
+  /** Sorts a_ij into the blocks, C, R or the border block D, which is
+      kept in S. */
+  int bi=ws->block_of[i], bj=ws->block_of[j];
+  int pi=ws->position[i], pj=ws->position[j];
+  int s=ws->size, m=ws->border;
+
+  if ((bi >= 0)&&(bj >= 0)){
+    if (bi == bj)
+      ws->B[bi*s*s+pi+pj*s] = a;
+  }
+  else if (bi >= 0)
+    C[bi*s*m+pi+pj*s] = a;
+  else if (bj >= 0)
+    ws->R[pi*ws->nblk+bj*s+pj] = a;
+  else
+    ws->S[pi+pj*m] = a;
+}
+
+int linalg_initialise_block(MultiMatrix *A,
+			    EvolverOptions *options,
+			    void **linalg_workspace,
+			    ErrorMsg error_message){
+  BL_structure *ws;
+  int i, k, n;
+  printf("Linalg Wrapper: Block diagonal with border\n");
+
+  n = A->nrow;
+  //Test input:
+  lasagna_test(A->ncol != A->nrow,
+	       error_message,
+	       "Matrix not square!");
+  lasagna_test(A->Dtype != L_DBL,
+	       error_message,
+	       "The block wrapper only supports real matrices.");
+  lasagna_test((A->Stype != L_SCC)&&(A->Stype != L_DNR),
+	       error_message,
+	       "Unknown storage type of A.");
+  lasagna_test((options->Blocks < 1)||(options->BlockSize < 1)||
+	       (options->BlockIndex == NULL)||(options->Blocks*options->BlockSize > n),
+	       error_message,
+	       "The block wrapper needs the blocks in options->Blocks, BlockSize and BlockIndex.");
+
+  //Allocate stuff:
+  lasagna_alloc(ws,sizeof(BL_structure),error_message);
+  ws->A = A;
+  ws->neq = n;
+  ws->blocks = options->Blocks;
+  ws->size = options->BlockSize;
+  ws->nblk = ws->blocks*ws->size;
+  ws->border = n-ws->nblk;
+  ws->threads = max(1,options->Cores);
+  lasagna_alloc(ws->index,sizeof(int)*ws->nblk,error_message);
+  lasagna_alloc(ws->border_index,sizeof(int)*max(1,ws->border),error_message);
+  lasagna_alloc(ws->block_of,sizeof(int)*n,error_message);
+  lasagna_alloc(ws->position,sizeof(int)*n,error_message);
+  memcpy(ws->index,options->BlockIndex,sizeof(int)*ws->nblk);
+  for (i=0; i<n; i++)
+    ws->block_of[i] = -1;
+  for (k=0; k<ws->nblk; k++){
+    i = ws->index[k];
+    lasagna_test((i < 0)||(i >= n)||(ws->block_of[i] != -1),
+		 error_message,
+		 "Equation %d is outside the system or in two blocks.",i);
+    ws->block_of[i] = k/ws->size;
+    ws->position[i] = k%ws->size;
+  }
+  for (i=0, k=0; i<n; i++){
+    if (ws->block_of[i] == -1){
+      ws->border_index[k] = i;
+      ws->position[i] = k;
+      k++;
+    }
+  }
+  lasagna_alloc(ws->B,sizeof(double)*ws->nblk*ws->size,error_message);
+  lasagna_alloc(ws->ipiv,sizeof(int)*ws->nblk,error_message);
+  lasagna_alloc(ws->Z,sizeof(double)*max(1,ws->nblk*ws->border),error_message);
+  lasagna_alloc(ws->R,sizeof(double)*max(1,ws->nblk*ws->border),error_message);
+  lasagna_alloc(ws->S,sizeof(double)*max(1,ws->border*ws->border),error_message);
+  lasagna_alloc(ws->spiv,sizeof(int)*max(1,ws->border),error_message);
+  lasagna_alloc(ws->w,sizeof(double)*ws->nblk,error_message);
+  lasagna_alloc(ws->g,sizeof(double)*max(1,ws->border),error_message);
+  printf("%d blocks of %d equations and a border of %d.\n",
+	 ws->blocks,ws->size,ws->border);
+  *linalg_workspace = (void *) ws;
+
+  return _SUCCESS_;
+}
+
+int linalg_finalise_block(void *linalg_workspace,
+			  ErrorMsg error_message){
+  BL_structure *ws = linalg_workspace;
+  free(ws->index);
+  free(ws->border_index);
+  free(ws->block_of);
+  free(ws->position);
+  free(ws->B);
+  free(ws->ipiv);
+  free(ws->Z);
+  free(ws->R);
+  free(ws->S);
+  free(ws->spiv);
+  free(ws->w);
+  free(ws->g);
+  free(ws);
+  return _SUCCESS_;
+}
+
+int linalg_factorise_block(void *linalg_workspace,
+			   int has_changed_significantly,
+			   ErrorMsg error_message){
+  /** Z = B^{-1} C is stored in place of C, so that a solve only needs
+      the factors, R and Z. */
+  BL_structure *ws = linalg_workspace;
+  SCCformat *StoreSCC;
+  DNRformat *StoreDNR;
+  double *a, *Ax;
+  int *Ap, *Ai;
+  int b, i, j, k, p, r, c;
+  int n=ws->neq, s=ws->size, m=ws->border, nblk=ws->nblk;
+  double sum;
+
+  memset(ws->B,0,sizeof(double)*nblk*s);
+  memset(ws->Z,0,sizeof(double)*max(1,nblk*m));
+  memset(ws->R,0,sizeof(double)*max(1,nblk*m));
+  memset(ws->S,0,sizeof(double)*max(1,m*m));
+  if (ws->A->Stype == L_SCC){
+    StoreSCC = ws->A->Store;
+    Ap = StoreSCC->Ap; Ai = StoreSCC->Ai; Ax = StoreSCC->Ax;
+    for (j=0; j<n; j++)
+      for (p=Ap[j]; p<Ap[j+1]; p++)
+	linalg_block_entry(ws,ws->Z,Ai[p],j,Ax[p]);
+  }
+  else{
+    StoreDNR = ws->A->Store;
+    a = ((double *) StoreDNR->Data)+1;
+    for (i=0; i<n; i++)
+      for (j=0; j<n; j++)
+	if (a[i*n+j] != 0.0)
+	  linalg_block_entry(ws,ws->Z,i,j,a[i*n+j]);
+  }
+
+  /** The blocks are independent: */
+#pragma omp parallel for num_threads(ws->threads) if(ws->threads>1) schedule(static)
+  for (b=0; b<ws->blocks; b++){
+    dense_lu(ws->B+b*s*s, s, ws->ipiv+b*s);
+    if (m > 0)
+      dense_lu_solve(ws->B+b*s*s, s, ws->ipiv+b*s, ws->Z+b*s*m, m);
+  }
+  /** S = D - R Z: */
+  for (c=0; c<m; c++){
+    for (r=0; r<m; r++){
+      sum = 0.0;
+      for (b=0; b<ws->blocks; b++)
+	for (k=0; k<s; k++)
+	  sum += ws->R[r*nblk+b*s+k]*ws->Z[b*s*m+k+c*s];
+      ws->S[r+c*m] -= sum;
+    }
+  }
+  if (m > 0)
+    dense_lu(ws->S, m, ws->spiv);
+  return _SUCCESS_;
+}
+
+int linalg_solve_block(MultiMatrix *B,
+		       MultiMatrix *X,
+		       void *linalg_workspace,
+		       ErrorMsg error_message){
+  /** x_B = B^{-1} b_B - Z x_D with x_D = S^{-1}(b_D - R B^{-1} b_B), for
+      each row of B. */
+  BL_structure *ws = linalg_workspace;
+  DNRformat *StoreB=B->Store;
+  DNRformat *StoreX=X->Store;
+  double *x, *w=ws->w, *g=ws->g;
+  int b, k, q, r, n=ws->neq, s=ws->size, m=ws->border, nblk=ws->nblk;
+
+  lasagna_test(B->Dtype != L_DBL,
+	       error_message,
+	       "The block wrapper only supports real right hand sides.");
+  memcpy(StoreX->Data,
+	 StoreB->Data,
+	 GetByteSize(B->Dtype)*((B->nrow)*(B->ncol)+1));
+  for (q=0; q<B->nrow; q++){
+    x = ((double *) StoreX->Data)+1+q*n;
+    for (k=0; k<nblk; k++)
+      w[k] = x[ws->index[k]];
+#pragma omp parallel for num_threads(ws->threads) if(ws->threads>1) schedule(static)
+    for (b=0; b<ws->blocks; b++)
+      dense_lu_solve(ws->B+b*s*s, s, ws->ipiv+b*s, w+b*s, 1);
+    if (m > 0){
+      for (r=0; r<m; r++){
+	g[r] = x[ws->border_index[r]];
+	for (k=0; k<nblk; k++)
+	  g[r] -= ws->R[r*nblk+k]*w[k];
+      }
+      dense_lu_solve(ws->S, m, ws->spiv, g, 1);
+      for (r=0; r<m; r++){
+	x[ws->border_index[r]] = g[r];
+	for (b=0; b<ws->blocks; b++)
+	  for (k=0; k<s; k++)
+	    w[b*s+k] -= ws->Z[b*s*m+k+r*s]*g[r];
+      }
+    }
+    for (k=0; k<nblk; k++)
+      x[ws->index[k]] = w[k];
+  }
+  return _SUCCESS_;
+}
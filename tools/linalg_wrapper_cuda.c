@@ -0,0 +1,564 @@
+#include "linalg_wrapper_cuda.h"
+
+/** Wrapper for GPU factorisations with cusolverRf, see linalg_wrapper_sparse.c
+    for the interface. cusolverRf refactorises a matrix on the pattern of L
+    and U of an earlier LU with pivoting, which is the same strategy as
+    sp_refactor in the sparse wrapper: the pivot sequence comes from
+    sp_ludcmp on the host, with the AMD ordering of A+A^T, and is only
+    recomputed for _LINALG_FROM_SCRATCH_ or when a pivot becomes zero.
+    The pattern, the permutations and the factors stay on the device, so
+    a factorisation only uploads the values of A and a solve only moves
+    the right hand side.
+
+    Each matrix is a member of a struct linalg_cuda_batch. If
+    options->LinAlgShared is set, the members are the runs of a sweep, and
+    the runs which factorise or solve at the same time are done in one
+    batched call. Otherwise the batch only has the one matrix.
+
+    cusolverRf is real only, so complex matrices (the second matrix of
+    radau5) are passed on to the sparse wrapper.
+*/
+int linalg_initialise_cuda(MultiMatrix *A,
+			   EvolverOptions *options,
+			   void **linalg_workspace,
+			   ErrorMsg error_message){
+  SCCformat *Store=A->Store;
+  CUDA_structure *ws;
+  ErrorMsg join_message;
+
+  printf("Linalg Wrapper: GPU\n");
+  lasagna_test(A->ncol != A->nrow,
+	       error_message,
+	       "Matrix not square!");
+  lasagna_test((A->Dtype!=L_DBL)&&(A->Dtype!=L_DBL_CX),
+	       error_message,
+	       "Unknown datatype in A.");
+  lasagna_test(A->Stype!=L_SCC,
+	       error_message,
+	       "This wrapper only supports sparse input matrix.");
+
+  lasagna_alloc(ws,sizeof(CUDA_structure),error_message);
+  ws->Stats = options->Stats;
+  ws->batch = NULL;
+  ws->own_batch = _FALSE_;
+  ws->slot = 0;
+  ws->complex_ws = NULL;
+  *linalg_workspace = (void *) ws;
+  if (A->Dtype == L_DBL_CX){
+    lasagna_call(linalg_initialise_sparse(A, options, &(ws->complex_ws), error_message),
+		 error_message,error_message);
+    return _SUCCESS_;
+  }
+  if (options->LinAlgShared != NULL){
+    ws->batch = options->LinAlgShared;
+    if (linalg_cuda_batch_join(ws->batch, Store, A->ncol, &(ws->slot), join_message) == _FAILURE_){
+      if (options->EvolverVerbose > 1)
+	printf("GPU: Using a batch of one, since\n=>%s\n",join_message);
+      ws->batch = NULL;
+    }
+  }
+  if (ws->batch == NULL){
+    lasagna_call(linalg_cuda_batch_alloc(&(ws->batch), 1, error_message),
+		 error_message,error_message);
+    ws->own_batch = _TRUE_;
+    lasagna_call(linalg_cuda_batch_join(ws->batch, Store, A->ncol, &(ws->slot), error_message),
+		 error_message,error_message);
+  }
+  ws->batch->verbose = options->EvolverVerbose;
+  return _SUCCESS_;
+}
+
+int linalg_finalise_cuda(void *linalg_workspace,
+			 ErrorMsg error_message){
+  CUDA_structure *ws=linalg_workspace;
+  struct linalg_cuda_batch *batch=ws->batch;
+
+  if (ws->complex_ws != NULL){
+    lasagna_call(linalg_finalise_sparse(ws->complex_ws, error_message),
+		 error_message,error_message);
+  }
+  else{
+    /** The slot keeps its values, so the factors of the other members
+	stay what they were: */
+    pthread_mutex_lock(&(batch->lock));
+    batch->taken[ws->slot] = _FALSE_;
+    batch->Ax[ws->slot] = NULL;
+    pthread_mutex_unlock(&(batch->lock));
+    if (ws->own_batch == _TRUE_)
+      linalg_cuda_batch_free(batch);
+  }
+  free(ws);
+  return _SUCCESS_;
+}
+
+int linalg_factorise_cuda(void *linalg_workspace,
+			  int has_changed_significantly,
+			  ErrorMsg error_message){
+  CUDA_structure *ws=linalg_workspace;
+  int request=_CUDA_REFACTOR_, fr;
+
+  if (ws->complex_ws != NULL)
+    return linalg_factorise_sparse(ws->complex_ws, has_changed_significantly, error_message);
+  if (has_changed_significantly == _LINALG_FROM_SCRATCH_)
+    request |= _CUDA_SCRATCH_;
+  fr = linalg_cuda_batch_request(ws->batch, ws->slot, request, error_message);
+  if (ws->batch->new_pivots[ws->slot] == _TRUE_)
+#pragma omp atomic
+    ws->Stats[_STAT_FULL_LU_]++;
+  else
+#pragma omp atomic
+    ws->Stats[_STAT_REFACTOR_]++;
+  return fr;
+}
+
+int linalg_solve_cuda(MultiMatrix *B,
+		      MultiMatrix *X,
+		      void *linalg_workspace,
+		      ErrorMsg error_message){
+  CUDA_structure *ws=linalg_workspace;
+  struct linalg_cuda_batch *batch=ws->batch;
+  DNRformat *StoreB=B->Store;
+  DNRformat *StoreX=X->Store;
+  double **MatB, **MatX;
+  int i;
+
+  if (ws->complex_ws != NULL)
+    return linalg_solve_sparse(B, X, ws->complex_ws, error_message);
+  MatB = (double **) StoreB->Matrix;
+  MatX = (double **) StoreX->Matrix;
+  /** cusolverRfBatchSolve takes one right hand side per member: */
+  for (i=1; i<=B->nrow; i++){
+    memcpy(batch->x[ws->slot], MatB[i]+1, batch->n*sizeof(double));
+    lasagna_call(linalg_cuda_batch_request(batch, ws->slot, _CUDA_SOLVE_, error_message),
+		 error_message,error_message);
+    memcpy(MatX[i]+1, batch->x[ws->slot], batch->n*sizeof(double));
+  }
+  return _SUCCESS_;
+}
+
+int linalg_solve_many_cuda(MultiMatrix *B,
+			   MultiMatrix *X,
+			   void *linalg_workspace,
+			   ErrorMsg error_message){
+  CUDA_structure *ws=linalg_workspace;
+
+  if (ws->complex_ws != NULL)
+    return linalg_solve_many_sparse(B, X, ws->complex_ws, error_message);
+  return linalg_solve_cuda(B, X, linalg_workspace, error_message);
+}
+
+/** Batch of at most capacity members. The pattern, and everything on the
+    device, is set when the first member joins. */
+int linalg_cuda_batch_alloc(struct linalg_cuda_batch **batch,
+			    int capacity,
+			    ErrorMsg error_message){
+  struct linalg_cuda_batch *b;
+
+  lasagna_calloc(b,1,sizeof(struct linalg_cuda_batch),error_message);
+  pthread_mutex_init(&(b->lock),NULL);
+  pthread_cond_init(&(b->done),NULL);
+  b->capacity = capacity;
+  b->busy = _FALSE_;
+  b->setup = _FALSE_;
+  b->n = 0;
+  b->verbose = 1;
+  *batch = b;
+  return _SUCCESS_;
+}
+
+int linalg_cuda_batch_free(struct linalg_cuda_batch *batch){
+  int k;
+
+  if (batch->n > 0){
+    cusolverRfDestroy(batch->handle);
+    for (k=0; k<batch->capacity; k++){
+      cudaFree(batch->d_values[k]);
+      cudaFree(batch->d_x[k]);
+      free(batch->values[k]);
+      free(batch->x[k]);
+    }
+    cudaFree(batch->d_Rp);
+    cudaFree(batch->d_Rj);
+    cudaFree(batch->d_P);
+    cudaFree(batch->d_Q);
+    cudaFree(batch->d_work);
+    sp_num_free(batch->N);
+    sp_mat_free(batch->A);
+    free(batch->Rp);
+    free(batch->Rj);
+    free(batch->map);
+    free(batch->taken);
+    free(batch->request);
+    free(batch->running);
+    free(batch->status);
+    free(batch->new_pivots);
+    free(batch->invalid);
+    free(batch->has_values);
+    free(batch->position);
+    free(batch->Ax);
+    free(batch->values);
+    free(batch->x);
+    free(batch->d_values);
+    free(batch->d_x);
+  }
+  pthread_mutex_destroy(&(batch->lock));
+  pthread_cond_destroy(&(batch->done));
+  free(batch);
+  return _SUCCESS_;
+}
+
+/** Set the pattern of the batch from its first member: the CSR pattern and
+    the map from it to the CSC values of the members, the AMD ordering, the
+    cusolverRf handle and the device arrays. */
+int linalg_cuda_batch_pattern(struct linalg_cuda_batch *batch,
+			      SCCformat *Store,
+			      int n,
+			      ErrorMsg error_message){
+  int k, nnz=Store->nnz, cap=batch->capacity;
+  int *Cp, *Ci, *w;
+
+  lasagna_call(sp_num_alloc(&(batch->N), n, error_message),
+	       error_message,error_message);
+  lasagna_call(sp_mat_alloc(&(batch->A), n, n, nnz, error_message),
+	       error_message,error_message);
+  memcpy(batch->A->Ap, Store->Ap, (n+1)*sizeof(int));
+  memcpy(batch->A->Ai, Store->Ai, nnz*sizeof(int));
+  batch->Ap = batch->A->Ap;
+  batch->Ai = batch->A->Ai;
+  lasagna_call(get_pattern_A_plus_AT(Store->Ap, Store->Ai, n, &Cp, &Ci, error_message),
+	       error_message,error_message);
+  sp_amd(Cp, Ci, n, Cp[n], batch->N->q, batch->N->wamd);
+  free(Cp);
+  free(Ci);
+
+  lasagna_alloc(batch->Rp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc(batch->Rj,nnz*sizeof(int),error_message);
+  lasagna_alloc(batch->map,nnz*sizeof(int),error_message);
+  lasagna_alloc(w,n*sizeof(int),error_message);
+  linalg_cuda_csc_to_csr(n, Store->Ap, Store->Ai, NULL, batch->Rp, batch->Rj, NULL, batch->map, w);
+  free(w);
+
+  lasagna_calloc(batch->taken,cap,sizeof(int),error_message);
+  lasagna_calloc(batch->request,cap,sizeof(int),error_message);
+  lasagna_calloc(batch->running,cap,sizeof(int),error_message);
+  lasagna_calloc(batch->status,cap,sizeof(int),error_message);
+  lasagna_calloc(batch->new_pivots,cap,sizeof(int),error_message);
+  lasagna_calloc(batch->invalid,cap,sizeof(int),error_message);
+  lasagna_calloc(batch->has_values,cap,sizeof(int),error_message);
+  lasagna_alloc(batch->position,cap*sizeof(int),error_message);
+  lasagna_calloc(batch->Ax,cap,sizeof(double*),error_message);
+  lasagna_alloc(batch->values,cap*sizeof(double*),error_message);
+  lasagna_alloc(batch->x,cap*sizeof(double*),error_message);
+  lasagna_alloc(batch->d_values,cap*sizeof(double*),error_message);
+  lasagna_alloc(batch->d_x,cap*sizeof(double*),error_message);
+  for (k=0; k<cap; k++){
+    lasagna_calloc(batch->values[k],nnz,sizeof(double),error_message);
+    lasagna_alloc(batch->x[k],n*sizeof(double),error_message);
+    lasagna_test(cudaMalloc((void **) &(batch->d_values[k]),nnz*sizeof(double)) != cudaSuccess,
+		 error_message,"Could not allocate %d values on the device.",nnz);
+    lasagna_test(cudaMalloc((void **) &(batch->d_x[k]),n*sizeof(double)) != cudaSuccess,
+		 error_message,"Could not allocate %d values on the device.",n);
+  }
+  lasagna_test(cudaMalloc((void **) &(batch->d_Rp),(n+1)*sizeof(int)) != cudaSuccess,
+	       error_message,"Could not allocate the pattern on the device.");
+  lasagna_test(cudaMalloc((void **) &(batch->d_Rj),nnz*sizeof(int)) != cudaSuccess,
+	       error_message,"Could not allocate the pattern on the device.");
+  lasagna_test(cudaMalloc((void **) &(batch->d_P),n*sizeof(int)) != cudaSuccess,
+	       error_message,"Could not allocate the permutations on the device.");
+  lasagna_test(cudaMalloc((void **) &(batch->d_Q),n*sizeof(int)) != cudaSuccess,
+	       error_message,"Could not allocate the permutations on the device.");
+  lasagna_test(cudaMalloc((void **) &(batch->d_work),2*cap*n*sizeof(double)) != cudaSuccess,
+	       error_message,"Could not allocate the solve workspace on the device.");
+  lasagna_test(cudaMemcpy(batch->d_Rp, batch->Rp, (n+1)*sizeof(int),
+			  cudaMemcpyHostToDevice) != cudaSuccess,
+	       error_message,"Could not copy the pattern to the device.");
+  lasagna_test(cudaMemcpy(batch->d_Rj, batch->Rj, nnz*sizeof(int),
+			  cudaMemcpyHostToDevice) != cudaSuccess,
+	       error_message,"Could not copy the pattern to the device.");
+
+  lasagna_test(cusolverRfCreate(&(batch->handle)) != CUSOLVER_STATUS_SUCCESS,
+	       error_message,"Could not create the cusolverRf handle.");
+  lasagna_test(cusolverRfSetMatrixFormat(batch->handle, CUSOLVERRF_MATRIX_FORMAT_CSR,
+					 CUSOLVERRF_UNIT_DIAGONAL_STORED_L) != CUSOLVER_STATUS_SUCCESS,
+	       error_message,"cusolverRfSetMatrixFormat failed.");
+  /** Only the values change between factorisations: */
+  lasagna_test(cusolverRfSetResetValuesFastMode(batch->handle, CUSOLVERRF_RESET_VALUES_FAST_MODE_ON)
+	       != CUSOLVER_STATUS_SUCCESS,
+	       error_message,"cusolverRfSetResetValuesFastMode failed.");
+  batch->nnz = nnz;
+  batch->n = n;
+  return _SUCCESS_;
+}
+
+/** Take a free slot of the batch for the matrix in Store. Fails if the
+    batch is full or has another pattern. */
+int linalg_cuda_batch_join(struct linalg_cuda_batch *batch,
+			   SCCformat *Store,
+			   int n,
+			   int *slot,
+			   ErrorMsg error_message){
+  int k, fr=_SUCCESS_;
+
+  pthread_mutex_lock(&(batch->lock));
+  if (batch->n == 0)
+    fr = linalg_cuda_batch_pattern(batch, Store, n, error_message);
+  else if ((batch->n != n)||(batch->nnz != Store->nnz)||
+	   (memcmp(batch->Ap, Store->Ap, (n+1)*sizeof(int)) != 0)||
+	   (memcmp(batch->Ai, Store->Ai, Store->nnz*sizeof(int)) != 0)){
+    sprintf(error_message,"The pattern differs from the one of the batch.");
+    fr = _FAILURE_;
+  }
+  if (fr == _SUCCESS_){
+    for (k=0; (k<batch->capacity)&&(batch->taken[k] == _TRUE_); k++);
+    if (k == batch->capacity){
+      sprintf(error_message,"All %d slots of the batch are taken.",batch->capacity);
+      fr = _FAILURE_;
+    }
+    else{
+      batch->taken[k] = _TRUE_;
+      batch->Ax[k] = (double *) Store->Ax;
+      batch->request[k] = 0;
+      *slot = k;
+    }
+  }
+  pthread_mutex_unlock(&(batch->lock));
+  return fr;
+}
+
+/** Post a request for the slot and wait until it is done. A waiting member
+    that finds the batch idle does all pending requests in one batch, while
+    the other members keep posting theirs for the next one. */
+int linalg_cuda_batch_request(struct linalg_cuda_batch *batch,
+			      int slot,
+			      int request,
+			      ErrorMsg error_message){
+  int k, fr;
+
+  pthread_mutex_lock(&(batch->lock));
+  batch->request[slot] |= request;
+  while (batch->request[slot] != 0){
+    if (batch->busy == _TRUE_){
+      pthread_cond_wait(&(batch->done),&(batch->lock));
+      continue;
+    }
+    batch->busy = _TRUE_;
+    for (k=0; k<batch->capacity; k++){
+      batch->running[k] = batch->request[k];
+      batch->request[k] = 0;
+    }
+    /** The members of the batch are all waiting, so their values and right
+	hand sides do not change while the lock is released: */
+    pthread_mutex_unlock(&(batch->lock));
+    fr = linalg_cuda_batch_run(batch, batch->running, batch->message);
+    pthread_mutex_lock(&(batch->lock));
+    for (k=0; k<batch->capacity; k++){
+      if ((batch->running[k] != 0)&&(fr == _FAILURE_))
+	batch->status[k] = _FAILURE_;
+    }
+    batch->busy = _FALSE_;
+    pthread_cond_broadcast(&(batch->done));
+  }
+  fr = batch->status[slot];
+  if (fr == _FAILURE_)
+    sprintf(error_message,"%s",batch->message);
+  pthread_mutex_unlock(&(batch->lock));
+  return fr;
+}
+
+/** Do the requests of a batch: upload the values of the members to refactorise,
+    refactorise all members, and solve for the members with a right hand side.
+    The other members are refactorised from their unchanged values, so their
+    factors stay the same. A zero pivot gives a new pivot sequence from the
+    host LU of that member, once per batch, and then fails the member. */
+int linalg_cuda_batch_run(struct linalg_cuda_batch *batch,
+			  int *requests,
+			  ErrorMsg error_message){
+  int k, i, n=batch->n, nnz=batch->nnz, cap=batch->capacity;
+  int refactor=_FALSE_, solve=_FALSE_, scratch=-1, zero, setups=0;
+  cusolverStatus_t status;
+
+  for (k=0; k<cap; k++){
+    if (requests[k] == 0)
+      continue;
+    batch->status[k] = _SUCCESS_;
+    if (requests[k] & _CUDA_REFACTOR_){
+      refactor = _TRUE_;
+      batch->new_pivots[k] = _FALSE_;
+      for (i=0; i<nnz; i++)
+	batch->values[k][i] = batch->Ax[k][batch->map[i]];
+      batch->has_values[k] = _TRUE_;
+      batch->invalid[k] = _FALSE_;
+      if ((scratch < 0)&&((requests[k] & _CUDA_SCRATCH_)||(batch->setup == _FALSE_)))
+	scratch = k;
+    }
+    else if ((requests[k] & _CUDA_SOLVE_)&&(batch->invalid[k] == _TRUE_)){
+      /** Factors with a zero pivot from the batch of another member: */
+      refactor = _TRUE_;
+      if (scratch < 0)
+	scratch = k;
+    }
+    if (requests[k] & _CUDA_SOLVE_)
+      solve = _TRUE_;
+  }
+
+  if (refactor == _TRUE_){
+    for (;;){
+      if (scratch >= 0){
+	lasagna_call(linalg_cuda_setup(batch, scratch, error_message),
+		     error_message,error_message);
+	setups++;
+      }
+      else{
+	for (k=0; k<cap; k++){
+	  if (requests[k] & _CUDA_REFACTOR_)
+	    lasagna_test(cudaMemcpy(batch->d_values[k], batch->values[k], nnz*sizeof(double),
+				    cudaMemcpyHostToDevice) != cudaSuccess,
+			 error_message,"Could not copy the values of member %d to the device.",k);
+	}
+	lasagna_test(cusolverRfBatchResetValues(cap, n, nnz, batch->d_Rp, batch->d_Rj,
+						batch->d_values, batch->d_P, batch->d_Q,
+						batch->handle) != CUSOLVER_STATUS_SUCCESS,
+		     error_message,"cusolverRfBatchResetValues failed.");
+      }
+      lasagna_test(cusolverRfBatchRefactor(batch->handle) != CUSOLVER_STATUS_SUCCESS,
+		   error_message,"cusolverRfBatchRefactor failed.");
+      status = cusolverRfBatchZeroPivot(batch->handle, batch->position);
+      lasagna_test((status != CUSOLVER_STATUS_SUCCESS)&&(status != CUSOLVER_STATUS_ZERO_PIVOT),
+		   error_message,"cusolverRfBatchZeroPivot failed.");
+      zero = -1;
+      if (status == CUSOLVER_STATUS_ZERO_PIVOT){
+	for (k=0; (k<cap)&&(zero<0); k++){
+	  if ((batch->has_values[k] == _TRUE_)&&(batch->position[k] >= 0))
+	    zero = k;
+	}
+      }
+      if ((zero < 0)||(zero == scratch)||(setups >= 2))
+	break;
+      if (batch->verbose > 2)
+	printf("GPU: Zero pivot in row %d of member %d, new pivot sequence.\n",
+	       batch->position[zero],zero);
+      scratch = zero;
+    }
+    for (k=0; k<cap; k++){
+      if (requests[k] & _CUDA_REFACTOR_)
+	batch->new_pivots[k] = (setups > 0);
+      batch->invalid[k] = ((status == CUSOLVER_STATUS_ZERO_PIVOT)&&(batch->has_values[k] == _TRUE_)&&
+			   (batch->position[k] >= 0));
+      if ((requests[k] != 0)&&(batch->invalid[k] == _TRUE_)){
+	batch->status[k] = _FAILURE_;
+	sprintf(error_message,"Zero pivot in row %d of the matrix.",batch->position[k]);
+      }
+    }
+  }
+
+  if (solve == _TRUE_){
+    for (k=0; k<cap; k++){
+      if (requests[k] & _CUDA_SOLVE_)
+	lasagna_test(cudaMemcpy(batch->d_x[k], batch->x[k], n*sizeof(double),
+				cudaMemcpyHostToDevice) != cudaSuccess,
+		     error_message,"Could not copy the right hand side of member %d to the device.",k);
+    }
+    lasagna_test(cusolverRfBatchSolve(batch->handle, batch->d_P, batch->d_Q, 1, batch->d_work, n,
+				      batch->d_x, n) != CUSOLVER_STATUS_SUCCESS,
+		 error_message,"cusolverRfBatchSolve failed.");
+    for (k=0; k<cap; k++){
+      if (requests[k] & _CUDA_SOLVE_)
+	lasagna_test(cudaMemcpy(batch->x[k], batch->d_x[k], n*sizeof(double),
+				cudaMemcpyDeviceToHost) != cudaSuccess,
+		     error_message,"Could not copy the solution of member %d from the device.",k);
+    }
+  }
+  return _SUCCESS_;
+}
+
+/** New pivot sequence from sp_ludcmp of the values of member slot, with
+    P*A*Q = L*U for P = N->p and Q = N->q. The factors are set up for all
+    members, and those without values yet get the values of slot. */
+int linalg_cuda_setup(struct linalg_cuda_batch *batch,
+		      int slot,
+		      ErrorMsg error_message){
+  sp_num *N=batch->N;
+  int k, i, n=batch->n, nnz=batch->nnz, lnz, unz, fr;
+  int *Lp, *Lj, *Up, *Uj, *w;
+  double *Lx, *Ux;
+  cusolverStatus_t status;
+
+  for (i=0; i<nnz; i++)
+    batch->A->Ax[batch->map[i]] = batch->values[slot][i];
+  lasagna_test(sp_ludcmp(N, batch->A, 0.1) == _FAILURE_,
+	       error_message,"Host LU of member %d failed.",slot);
+  for (k=0; k<batch->capacity; k++){
+    if (batch->has_values[k] == _FALSE_)
+      memcpy(batch->values[k], batch->values[slot], nnz*sizeof(double));
+  }
+  lnz = N->L->Ap[n];
+  unz = N->U->Ap[n];
+  if (batch->verbose > 2)
+    printf("GPU: Pivot sequence from member %d (nnz(L)=%d, nnz(U)=%d).\n",slot,lnz,unz);
+  lasagna_alloc(Lp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc(Lj,lnz*sizeof(int),error_message);
+  lasagna_alloc(Lx,lnz*sizeof(double),error_message);
+  lasagna_alloc(Up,(n+1)*sizeof(int),error_message);
+  lasagna_alloc(Uj,unz*sizeof(int),error_message);
+  lasagna_alloc(Ux,unz*sizeof(double),error_message);
+  lasagna_alloc(w,n*sizeof(int),error_message);
+  /** The row indices of L and U are pivot positions, and L stores its unit
+      diagonal, as CUSOLVERRF_UNIT_DIAGONAL_STORED_L expects: */
+  linalg_cuda_csc_to_csr(n, N->L->Ap, N->L->Ai, N->L->Ax, Lp, Lj, Lx, NULL, w);
+  linalg_cuda_csc_to_csr(n, N->U->Ap, N->U->Ai, N->U->Ax, Up, Uj, Ux, NULL, w);
+  status = cusolverRfBatchSetupHost(batch->capacity, n, nnz, batch->Rp, batch->Rj, batch->values,
+				    lnz, Lp, Lj, Lx, unz, Up, Uj, Ux, N->p, N->q, batch->handle);
+  if (status == CUSOLVER_STATUS_SUCCESS)
+    status = cusolverRfBatchAnalyze(batch->handle);
+  free(Lp); free(Lj); free(Lx);
+  free(Up); free(Uj); free(Ux);
+  free(w);
+  lasagna_test(status != CUSOLVER_STATUS_SUCCESS,
+	       error_message,"cusolverRfBatchSetupHost/Analyze failed (status %d).",(int) status);
+  /** cusolverRfBatchResetValues takes the values from the device arrays, so
+      they must have the values of every member: */
+  fr = _SUCCESS_;
+  for (k=0; k<batch->capacity; k++){
+    if (cudaMemcpy(batch->d_values[k], batch->values[k], nnz*sizeof(double),
+		   cudaMemcpyHostToDevice) != cudaSuccess)
+      fr = _FAILURE_;
+  }
+  if (cudaMemcpy(batch->d_P, N->p, n*sizeof(int), cudaMemcpyHostToDevice) != cudaSuccess)
+    fr = _FAILURE_;
+  if (cudaMemcpy(batch->d_Q, N->q, n*sizeof(int), cudaMemcpyHostToDevice) != cudaSuccess)
+    fr = _FAILURE_;
+  lasagna_test(fr == _FAILURE_,
+	       error_message,"Could not copy the values and permutations to the device.");
+  batch->setup = _TRUE_;
+  return _SUCCESS_;
+}
+
+/** Transpose the CSC matrix (Cp, Ci, Cx) into CSR (Rp, Rj, Rx), with the
+    column indices of each row in increasing order. If map is not NULL,
+    map[j] is the index in Ci of the j'th CSR entry. Cx and Rx may be NULL
+    for the pattern only. w is a work array of n ints. */
+int linalg_cuda_csc_to_csr(int n, int *Cp, int *Ci, double *Cx,
+			   int *Rp, int *Rj, double *Rx, int *map, int *w){
+  int i, j, p, q;
+
+  for (i=0; i<n; i++)
+    w[i] = 0;
+  for (p=0; p<Cp[n]; p++)
+    w[Ci[p]]++;
+  Rp[0] = 0;
+  for (i=0; i<n; i++){
+    Rp[i+1] = Rp[i]+w[i];
+    w[i] = Rp[i];
+  }
+  for (j=0; j<n; j++){
+    for (p=Cp[j]; p<Cp[j+1]; p++){
+      q = w[Ci[p]]++;
+      Rj[q] = j;
+      if (Rx != NULL)
+	Rx[q] = Cx[p];
+      if (map != NULL)
+	map[q] = p;
+    }
+  }
+  return _SUCCESS_;
+}
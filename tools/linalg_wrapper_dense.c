@@ -0,0 +1,352 @@
+#include "linalg_wrapper_dense.h"
+
+/** Dense wrapper with contiguous column-major storage. The factorisation
+    is a right-looking LU with partial pivoting, blocked in panels of 
+    _DENSE_NB_ columns, so that most of the work is the matrix-matrix 
+    update of the trailing matrix in dense_gemm_update. The LU factors 
+    and the row interchanges have the same layout as in LAPACK, and if
+    compiled with -D _LAPACK, dgetrf/zgetrf and dgetrs/zgetrs are used
+    instead. The input matrix is the same DNR matrix as for the NR 
+    wrapper, see linalg_wrapper_dense_NR.c for the interface.
+*/
+int linalg_initialise_dense(MultiMatrix *A, 
+			    EvolverOptions *options,
+			    void **linalg_workspace,
+			    ErrorMsg error_message){
+  DN_structure *ws;
+  int n;
+  printf("Linalg Wrapper: Dense blocked\n");
+
+  n = A->nrow;
+  //Test input:
+  lasagna_test(A->ncol != A->nrow, 
+	       error_message, 
+	       "Matrix not square!");
+  lasagna_test((A->Dtype!=L_DBL)&&(A->Dtype!=L_DBL_CX), 
+	       error_message,
+	       "Unknown datatype in A.");
+  lasagna_test(A->Stype!=L_DNR, 
+	       error_message,
+	       "This wrapper only supports dense input matrix.");
+  
+  //Allocate stuff:
+  lasagna_alloc(ws,sizeof(DN_structure),error_message);
+  lasagna_alloc(ws->ipiv,sizeof(int)*n,error_message);
+  lasagna_alloc(ws->LU,GetByteSize(A->Dtype)*n*n,error_message);
+  ws->A = A;
+  ws->Dtype = A->Dtype;
+  ws->neq = n;
+  *linalg_workspace = (void *) ws;
+
+  return _SUCCESS_;
+}
+
+int linalg_finalise_dense(void *linalg_workspace,
+			  ErrorMsg error_message){
+  DN_structure *ws = linalg_workspace;
+  free(ws->LU);
+  free(ws->ipiv);
+  free(ws);
+  return _SUCCESS_;
+}
+
+int linalg_factorise_dense(void *linalg_workspace,
+			   int has_changed_significantly,
+			   ErrorMsg error_message){
+  DN_structure *ws = linalg_workspace;
+  DNRformat *StoreA = ws->A->Store;
+  double *a, *lu;
+  double complex *a_cx, *lu_cx;
+  int i, j, n=ws->neq;
+#ifdef _LAPACK
+  int info;
+#endif
+
+  //Transpose the row-major A into the column-major LU:
+  switch(ws->Dtype){
+  case (L_DBL):
+    a = ((double *) StoreA->Data)+1; lu = ws->LU;
+    for (i=0; i<n; i++)
+      for (j=0; j<n; j++) lu[i+j*n] = a[i*n+j];
+#ifdef _LAPACK
+    dgetrf_(&n, &n, lu, &n, ws->ipiv, &info);
+    lasagna_test(info < 0, error_message, "Invalid argument to dgetrf.");
+#else
+    dense_lu(lu, n, ws->ipiv);
+#endif
+    break;
+  case (L_DBL_CX):
+    a_cx = ((double complex *) StoreA->Data)+1; lu_cx = ws->LU;
+    for (i=0; i<n; i++)
+      for (j=0; j<n; j++) lu_cx[i+j*n] = a_cx[i*n+j];
+#ifdef _LAPACK
+    zgetrf_(&n, &n, lu_cx, &n, ws->ipiv, &info);
+    lasagna_test(info < 0, error_message, "Invalid argument to zgetrf.");
+#else
+    dense_lu_cx(lu_cx, n, ws->ipiv);
+#endif
+    break;
+  }
+  return _SUCCESS_;
+}
+
+int linalg_solve_dense(MultiMatrix *B, 
+		       MultiMatrix *X,
+		       void *linalg_workspace,
+		       ErrorMsg error_message){
+  DN_structure *ws = linalg_workspace;
+  DNRformat *StoreB=B->Store;
+  DNRformat *StoreX=X->Store;
+  int n=ws->neq, nrhs=B->nrow;
+#ifdef _LAPACK
+  int info;
+  char trans='N';
+#endif
+
+  /** The rows of X are the solutions, so X+1 is column-major with one
+      right hand side per column, and all of them are solved together: */
+  memcpy(StoreX->Data, 
+	 StoreB->Data, 
+	 GetByteSize(B->Dtype)*((B->nrow)*(B->ncol)+1));
+  switch(B->Dtype){
+  case (L_DBL):
+#ifdef _LAPACK
+    dgetrs_(&trans, &n, &nrhs, ws->LU, &n, ws->ipiv, 
+	    ((double *) StoreX->Data)+1, &n, &info);
+#else
+    dense_lu_solve(ws->LU, n, ws->ipiv, ((double *) StoreX->Data)+1, nrhs);
+#endif
+    break;
+  case (L_DBL_CX):
+#ifdef _LAPACK
+    zgetrs_(&trans, &n, &nrhs, ws->LU, &n, ws->ipiv, 
+	    ((double complex *) StoreX->Data)+1, &n, &info);
+#else
+    dense_lu_solve_cx(ws->LU, n, ws->ipiv, ((double complex *) StoreX->Data)+1, nrhs);
+#endif
+    break;
+  }
+  return _SUCCESS_;
+}
+
+int linalg_solve_many_dense(MultiMatrix *B, 
+			    MultiMatrix *X,
+			    void *linalg_workspace,
+			    ErrorMsg error_message){
+  /** linalg_solve_dense already uses every column of the factors once for
+      all rows of B. */
+  return linalg_solve_dense(B, X, linalg_workspace, error_message);
+}
+
+//Local functions:
+
+void dense_gemm_update(int m, int n, int k, double *A, int lda, 
+		       double *B, int ldb, double *C, int ldc){
+  /* C -= A*B with C [m x n], all column-major. Tiles of _DENSE_MC_ rows of
+     A stay in cache while all columns of B pass, and blocks of eight rows
+     and four columns are accumulated in a small array with simd loops 
+     over the rows, as in sp_dense_update. */
+  int r0, r1, r, c, p, i, jc;
+  double *Ap, bk;
+  for (r0=0; r0<m; r0+=_DENSE_MC_){
+    r1 = min(r0+_DENSE_MC_,m);
+    for (c=0; c+3<n; c+=4){
+      for (r=r0; r+7<r1; r+=8){
+	double a[4][8];
+	for (jc=0; jc<4; jc++)
+	  for (i=0; i<8; i++) a[jc][i] = 0.0;
+	for (p=0; p<k; p++){
+	  Ap = A+p*lda+r;
+	  for (jc=0; jc<4; jc++){
+	    bk = B[(c+jc)*ldb+p];
+#pragma omp simd
+	    for (i=0; i<8; i++) a[jc][i] += Ap[i]*bk;
+	  }
+	}
+	for (jc=0; jc<4; jc++)
+	  for (i=0; i<8; i++) C[r+i+(c+jc)*ldc] -= a[jc][i];
+      }
+      for (jc=0; jc<4; jc++)
+	for (p=0; p<k; p++){
+	  bk = B[(c+jc)*ldb+p];
+	  for (i=r; i<r1; i++) C[i+(c+jc)*ldc] -= A[i+p*lda]*bk;
+	}
+    }
+    for ( ; c<n; c++)
+      for (p=0; p<k; p++){
+	bk = B[c*ldb+p];
+#pragma omp simd
+	for (i=r0; i<r1; i++) C[i+c*ldc] -= A[i+p*lda]*bk;
+      }
+  }
+}
+
+int dense_lu(double *A, int n, int *ipiv){
+  /* PA = LU in place, L unit lower triangular. Each panel of _DENSE_NB_
+     columns is factorised column by column, then U12 = L11^{-1} A12 and 
+     A22 -= L21 U12. Zero pivots are replaced by TINY as in ludcmp. */
+  int k0, kb, j, i, c, p, e;
+  double big, t, piv, ajc;
+  for (k0=0; k0<n; k0+=_DENSE_NB_){
+    kb = min(_DENSE_NB_,n-k0);
+    e = k0+kb;
+    for (j=k0; j<e; j++){
+      p = j; big = fabs(A[j+j*n]);
+      for (i=j+1; i<n; i++)
+	if ((t=fabs(A[i+j*n])) > big){
+	  big = t;
+	  p = i;
+	}
+      ipiv[j] = p;
+      if (p != j)
+	for (c=0; c<n; c++){
+	  t = A[j+c*n];
+	  A[j+c*n] = A[p+c*n];
+	  A[p+c*n] = t;
+	}
+      if (A[j+j*n] == 0.0) A[j+j*n] = TINY;
+      piv = 1.0/A[j+j*n];
+#pragma omp simd
+      for (i=j+1; i<n; i++) A[i+j*n] *= piv;
+      for (c=j+1; c<e; c++){
+	ajc = A[j+c*n];
+#pragma omp simd
+	for (i=j+1; i<n; i++) A[i+c*n] -= A[i+j*n]*ajc;
+      }
+    }
+    if (e == n) break;
+    for (c=e; c<n; c++)
+      for (j=k0; j<e; j++){
+	ajc = A[j+c*n];
+#pragma omp simd
+	for (i=j+1; i<e; i++) A[i+c*n] -= A[i+j*n]*ajc;
+      }
+    dense_gemm_update(n-e, n-e, kb, A+e+k0*n, n, A+k0+e*n, n, A+e+e*n, n);
+  }
+  return _SUCCESS_;
+}
+
+int dense_lu_solve(double *LU, int n, int *ipiv, double *X, int nrhs){
+  /* Solve A X = B in place for the nrhs columns of X, leading dimension n.
+     The columns of the factors are used once for all right hand sides. */
+  int i, j, r;
+  double *x, t;
+  for (r=0; r<nrhs; r++){
+    x = X+r*n;
+    for (j=0; j<n; j++)
+      if (ipiv[j] != j){
+	t = x[j];
+	x[j] = x[ipiv[j]];
+	x[ipiv[j]] = t;
+      }
+  }
+  for (j=0; j<n; j++)
+    for (r=0; r<nrhs; r++){
+      x = X+r*n;
+      t = x[j];
+#pragma omp simd
+      for (i=j+1; i<n; i++) x[i] -= LU[i+j*n]*t;
+    }
+  for (j=n-1; j>=0; j--)
+    for (r=0; r<nrhs; r++){
+      x = X+r*n;
+      x[j] /= LU[j+j*n];
+      t = x[j];
+#pragma omp simd
+      for (i=0; i<j; i++) x[i] -= LU[i+j*n]*t;
+    }
+  return _SUCCESS_;
+}
+
+void dense_gemm_update_cx(int m, int n, int k, double complex *A, int lda, 
+			  double complex *B, int ldb, double complex *C, int ldc){
+  /* Complex products are written out in real arithmetic, which avoids the 
+     inf/nan checks of the complex multiplication and lets the loop over 
+     the interleaved real and imaginary parts vectorise: */
+  int r0, r1, c, p, i;
+  double br, bi, *Ar, *Cr;
+  for (r0=0; r0<m; r0+=_DENSE_MC_){
+    r1 = min(r0+_DENSE_MC_,m);
+    for (c=0; c<n; c++){
+      Cr = (double *) (C+c*ldc);
+      for (p=0; p<k; p++){
+	br = creal(B[c*ldb+p]);
+	bi = cimag(B[c*ldb+p]);
+	Ar = (double *) (A+p*lda);
+#pragma omp simd
+	for (i=r0; i<r1; i++){
+	  Cr[2*i] -= Ar[2*i]*br-Ar[2*i+1]*bi;
+	  Cr[2*i+1] -= Ar[2*i]*bi+Ar[2*i+1]*br;
+	}
+      }
+    }
+  }
+}
+
+int dense_lu_cx(double complex *A, int n, int *ipiv){
+  int k0, kb, j, i, c, p, e;
+  double big, t;
+  double complex tz, piv, ajc;
+  for (k0=0; k0<n; k0+=_DENSE_NB_){
+    kb = min(_DENSE_NB_,n-k0);
+    e = k0+kb;
+    for (j=k0; j<e; j++){
+      p = j; big = cabs(A[j+j*n]);
+      for (i=j+1; i<n; i++)
+	if ((t=cabs(A[i+j*n])) > big){
+	  big = t;
+	  p = i;
+	}
+      ipiv[j] = p;
+      if (p != j)
+	for (c=0; c<n; c++){
+	  tz = A[j+c*n];
+	  A[j+c*n] = A[p+c*n];
+	  A[p+c*n] = tz;
+	}
+      if (cabs(A[j+j*n]) == 0.0) A[j+j*n] = TINY;
+      piv = 1.0/A[j+j*n];
+      for (i=j+1; i<n; i++) A[i+j*n] *= piv;
+      for (c=j+1; c<e; c++){
+	ajc = A[j+c*n];
+	for (i=j+1; i<n; i++) A[i+c*n] -= A[i+j*n]*ajc;
+      }
+    }
+    if (e == n) break;
+    for (c=e; c<n; c++)
+      for (j=k0; j<e; j++){
+	ajc = A[j+c*n];
+	for (i=j+1; i<e; i++) A[i+c*n] -= A[i+j*n]*ajc;
+      }
+    dense_gemm_update_cx(n-e, n-e, kb, A+e+k0*n, n, A+k0+e*n, n, A+e+e*n, n);
+  }
+  return _SUCCESS_;
+}
+
+int dense_lu_solve_cx(double complex *LU, int n, int *ipiv, double complex *X, int nrhs){
+  int i, j, r;
+  double complex *x, t;
+  for (r=0; r<nrhs; r++){
+    x = X+r*n;
+    for (j=0; j<n; j++)
+      if (ipiv[j] != j){
+	t = x[j];
+	x[j] = x[ipiv[j]];
+	x[ipiv[j]] = t;
+      }
+  }
+  for (j=0; j<n; j++)
+    for (r=0; r<nrhs; r++){
+      x = X+r*n;
+      t = x[j];
+      for (i=j+1; i<n; i++) x[i] -= LU[i+j*n]*t;
+    }
+  for (j=n-1; j>=0; j--)
+    for (r=0; r<nrhs; r++){
+      x = X+r*n;
+      x[j] /= LU[j+j*n];
+      t = x[j];
+      for (i=0; i<j; i++) x[i] -= LU[i+j*n]*t;
+    }
+  return _SUCCESS_;
+}
@@ -0,0 +1,170 @@
+#include "linalg_wrapper_gmres.h"
+
+
+/** Iterative wrapper: the iteration matrices of ndf15 and radau5 are
+    solved by restarted GMRES, right preconditioned by an incomplete LU
+    factorisation ILU(k) of the same matrix. The pattern of the ILU(k)
+    factors is found once in linalg_initialise_gmres, and factorising is
+    only a numerical ILU. There is no LU fill-in, so the memory is a few 
+    times the memory of the Jacobian itself. The operator is the stored 
+    matrix, see sp_gmres in sparse.c.
+*/
+int linalg_initialise_gmres(MultiMatrix *A, 
+			    EvolverOptions *options,
+			    void **linalg_workspace,
+			    ErrorMsg error_message){
+  SCCformat *Store=A->Store;
+  GM_structure *ws;
+  sp_mat *spmat_dbl;
+  sp_mat_cx *spmat_dbl_cx;
+  int nnz;
+  int ncol, nrow;
+
+  printf("Linalg Wrapper: GMRES\n");
+
+  ncol = A->ncol; nrow = A->nrow;
+  //Test input:
+  lasagna_test(A->ncol != A->nrow, 
+	       error_message, 
+	       "Matrix not square!");
+  lasagna_test((A->Dtype!=L_DBL)&&(A->Dtype!=L_DBL_CX), 
+	       error_message,
+	       "Unknown datatype in A.");
+  lasagna_test(A->Stype!=L_SCC, 
+	       error_message,
+	       "This wrapper only supports sparse input matrix.");
+  
+  nnz = Store->nnz;
+  lasagna_alloc(ws,sizeof(GM_structure),error_message);
+  /** Set options for solver: */
+  ws->Dtype = A->Dtype;
+  ws->FillLevel = 0;
+  ws->Restart = 30;
+  ws->MaxIter = 300;
+  ws->Tolerance = 1e-10;
+  ws->Solves = 0;
+  ws->Unconverged = 0;
+  ws->Iterations = 0;
+  ws->Verbose = options->EvolverVerbose;
+  ws->Factorised = _FALSE_;
+  switch (A->Dtype){
+  case (L_DBL):
+    lasagna_alloc(ws->A,sizeof(sp_mat),error_message);
+    spmat_dbl = (sp_mat *) ws->A;
+    spmat_dbl->ncols = ncol;
+    spmat_dbl->nrows = nrow;
+    spmat_dbl->maxnz = nnz;
+    spmat_dbl->Ai = Store->Ai;
+    spmat_dbl->Ap = Store->Ap;
+    spmat_dbl->Ax = (double *) Store->Ax;
+    lasagna_alloc(ws->Work,_SP_GMRES_WORK_(ncol,ws->Restart)*sizeof(double),
+		  error_message);
+    break;
+  case (L_DBL_CX):
+    lasagna_alloc(ws->A,sizeof(sp_mat_cx),error_message);
+    spmat_dbl_cx = (sp_mat_cx *) ws->A;
+    spmat_dbl_cx->ncols = ncol;
+    spmat_dbl_cx->nrows = nrow;
+    spmat_dbl_cx->maxnz = nnz;
+    spmat_dbl_cx->Ai = Store->Ai;
+    spmat_dbl_cx->Ap = Store->Ap;
+    spmat_dbl_cx->Ax = (double complex*) Store->Ax;
+    lasagna_alloc(ws->Work,_SP_GMRES_WORK_(ncol,ws->Restart)*sizeof(double complex),
+		  error_message);
+    break;
+  }
+  lasagna_call(sp_ilu_symbolic(&(ws->Preconditioner), ncol, Store->Ap, Store->Ai,
+			       ws->FillLevel, (A->Dtype == L_DBL_CX), error_message),
+	       error_message,error_message);
+  if (ws->Verbose > 1)
+    printf("GMRES: ILU(%d) has %d entries for %d entries in A.\n",
+	   ws->FillLevel,ws->Preconditioner->nnz,nnz);
+  *linalg_workspace = (void *) ws;
+  
+  return _SUCCESS_;
+}
+
+int linalg_finalise_gmres(void *linalg_workspace,
+			  ErrorMsg error_message){
+  
+  GM_structure *ws=linalg_workspace;  
+  if (ws->Verbose > 1)
+    printf("GMRES: %d solves, %.1f iterations per solve, %d not converged.\n",
+	   ws->Solves,ws->Iterations/(double) max(ws->Solves,1),ws->Unconverged);
+  sp_ilu_free(ws->Preconditioner);
+  free(ws->Work);
+  free(ws->A);
+  free(ws);
+  return _SUCCESS_;
+}
+
+int linalg_factorise_gmres(void *linalg_workspace,
+			   int has_changed_significantly,
+			   ErrorMsg error_message){
+  GM_structure *ws= linalg_workspace;
+  int fr=_FAILURE_;
+
+  /** The pattern is fixed, so every factorisation is a new numerical ILU: */
+  switch(ws->Dtype){
+  case (L_DBL):
+    fr = sp_ilu_factor(ws->Preconditioner,((sp_mat *) ws->A)->Ax);
+    break;
+  case (L_DBL_CX):
+    fr = sp_ilu_factor_cx(ws->Preconditioner,((sp_mat_cx *) ws->A)->Ax);
+    break;
+  }
+  /** radau5 also factorises the unused matrix of a zero last step, so a
+      breakdown is only an error if the factors are used in a solve: */
+  ws->Factorised = (fr == _SUCCESS_);
+  return _SUCCESS_;
+}
+
+int linalg_solve_gmres(MultiMatrix *B, 
+		       MultiMatrix *X,
+		       void *linalg_workspace,
+		       ErrorMsg error_message){
+  GM_structure *ws= linalg_workspace;
+  DNRformat *StoreB=B->Store;
+  DNRformat *StoreX=X->Store;
+  double **MatB_dbl;
+  double **MatX_dbl;
+  double complex **MatB_dbl_cx;
+  double complex **MatX_dbl_cx;
+  int i,fr,iter;
+
+  lasagna_test(ws->Factorised == _FALSE_,
+	       error_message,
+	       "Zero pivot in incomplete LU factorisation.");
+
+  /** A solve that does not reach the tolerance returns the last iterate,
+      and the Newton iteration of the evolver decides if it is good enough. */
+  switch(B->Dtype){
+  case (L_DBL):
+    for(i=1; i<=B->nrow; i++){ 
+      MatX_dbl = (double **) StoreX->Matrix;
+      MatB_dbl = (double **) StoreB->Matrix;
+      //Compensate for zero indexing scheme and solve:
+      fr = sp_gmres((sp_mat *) ws->A, ws->Preconditioner,
+		    MatB_dbl[i]+1, MatX_dbl[i]+1, ws->Restart, ws->MaxIter,
+		    ws->Tolerance, (double *) ws->Work, &iter);
+      ws->Solves++;
+      ws->Iterations += iter;
+      if (fr == _FAILURE_) ws->Unconverged++;
+    }	
+    break;
+  case (L_DBL_CX):
+    for(i=1; i<=B->nrow; i++){ 
+      MatX_dbl_cx = (double complex **) StoreX->Matrix;
+      MatB_dbl_cx = (double complex **) StoreB->Matrix;
+      //Compensate for zero indexing scheme and solve:
+      fr = sp_gmres_cx((sp_mat_cx *) ws->A, ws->Preconditioner,
+		       MatB_dbl_cx[i]+1, MatX_dbl_cx[i]+1, ws->Restart, ws->MaxIter,
+		       ws->Tolerance, (double complex *) ws->Work, &iter);
+      ws->Solves++;
+      ws->Iterations += iter;
+      if (fr == _FAILURE_) ws->Unconverged++;
+    }      
+    break;
+  }
+  return _SUCCESS_;
+}
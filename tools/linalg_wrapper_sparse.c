@@ -39,6 +39,14 @@
     -- Solve A X^T = B^T. X and B are dense, and we using row-major
        storage which explains the transpositions, ^T.
 
+    int linalg_solve_many(MultiMatrix *B, 
+                          MultiMatrix *X,
+                          void *linalg_workspace,
+		          ErrorMsg error_message)
+    -- Same as linalg_solve, but for many rows in B. Wrappers which can
+       solve all right hand sides in one pass over the factors should do
+       so here, otherwise this may simply be linalg_solve.
+
     The names of these 4 functions could in principle be anything, but
     I suggest to use the names above and append _"NAME_OF_WRAPPER".
 */
@@ -52,8 +60,8 @@ int linalg_initialise_sparse(MultiMatrix *A,
   sp_mat_cx *spmat_dbl_cx;
   int nnz;
   int *Cp, *Ci;
-  int *perm_c, *wamd;
-  int ncol, nrow;
+  int *perm_c, *wamd, *pinv, *pvec, *topvec, **xi;
+  int ncol, nrow, lnz, unz, **xipack, *xicap;
 
   printf("Linalg Wrapper: Sparse\n");
 
@@ -71,14 +79,25 @@ int linalg_initialise_sparse(MultiMatrix *A,
   
   nnz = Store->nnz;
   lasagna_alloc(ws,sizeof(SP_structure),error_message);
+  /** With LowMemory, the factors start with room for a diagonal and are
+      sized below, from the symbolic analysis: */
+  ws->LowMemory = options->LowMemory;
+  lnz = (ws->LowMemory == _TRUE_ ? ncol : 0);
   switch (A->Dtype){
   case (L_DBL):
-    lasagna_call(sp_num_alloc(((sp_num **) &ws->SparseNumerical), 
-			      ncol, 
-			      error_message),
+    lasagna_call(sp_num_alloc_sized(((sp_num **) &ws->SparseNumerical), 
+				    ncol, 
+				    lnz,
+				    error_message),
 		 error_message,error_message);
     perm_c = ((sp_num *) ws->SparseNumerical)->q;
     wamd = ((sp_num *) ws->SparseNumerical)->wamd;
+    pinv = ((sp_num *) ws->SparseNumerical)->pinv;
+    pvec = ((sp_num *) ws->SparseNumerical)->p;
+    topvec = ((sp_num *) ws->SparseNumerical)->topvec;
+    xi = ((sp_num *) ws->SparseNumerical)->xi;
+    xipack = &(((sp_num *) ws->SparseNumerical)->xipack);
+    xicap = &(((sp_num *) ws->SparseNumerical)->xicap);
     lasagna_alloc(ws->A,sizeof(sp_mat),error_message);
     spmat_dbl = (sp_mat *) ws->A;
     spmat_dbl->ncols = ncol;
@@ -89,12 +108,19 @@ int linalg_initialise_sparse(MultiMatrix *A,
     spmat_dbl->Ax = (double *) Store->Ax;
     break;
   case (L_DBL_CX):
-    lasagna_call(sp_num_alloc_cx(((sp_num_cx **) &ws->SparseNumerical), 
-				 ncol, 
-				 error_message),
+    lasagna_call(sp_num_alloc_sized_cx(((sp_num_cx **) &ws->SparseNumerical), 
+				       ncol, 
+				       lnz,
+				       error_message),
 		 error_message,error_message);
     perm_c = ((sp_num_cx *) ws->SparseNumerical)->q;
     wamd = ((sp_num_cx *) ws->SparseNumerical)->wamd;
+    pinv = ((sp_num_cx *) ws->SparseNumerical)->pinv;
+    pvec = ((sp_num_cx *) ws->SparseNumerical)->p;
+    topvec = ((sp_num_cx *) ws->SparseNumerical)->topvec;
+    xi = ((sp_num_cx *) ws->SparseNumerical)->xi;
+    xipack = &(((sp_num_cx *) ws->SparseNumerical)->xipack);
+    xicap = &(((sp_num_cx *) ws->SparseNumerical)->xicap);
     lasagna_alloc(ws->A,sizeof(sp_mat_cx),error_message);
     spmat_dbl_cx = (sp_mat_cx *) ws->A;
     spmat_dbl_cx->ncols = ncol;
@@ -105,25 +131,107 @@ int linalg_initialise_sparse(MultiMatrix *A,
     spmat_dbl_cx->Ax = (double complex*) Store->Ax;
     break;
   }
-  //Calculate sparsity pattern of C = A + A^T for use with AMD:
-  lasagna_call(get_pattern_A_plus_AT(Store->Ap, 
-				     Store->Ai, 
-				     ncol, 
-				     &(Cp), 
-				     &(Ci), 
-				     error_message), 
-	       error_message,error_message);
-  
-  /* Calculate the optimal ordering: */
-  sp_amd(Cp, Ci, ncol, Cp[ncol],perm_c,wamd);
-  free(Cp);
-  free(Ci);
   /** Set options for solver: */
   ws->Dtype = A->Dtype;
   ws->PivotTolerance = 0.1;
   ws->RefactorCount = 0;
   ws->RefactorMax = 10;
+  ws->RefactorPivotTolerance = 0.01;
+  ws->RefactorGrowth = 1e2;
+  ws->GrowthRef = 1.0;
+  ws->Stats = options->Stats;
+  ws->ManyWork = NULL;
+  ws->ManyWorkSize = 0;
   ws->Factorised = _FALSE_;
+  ws->CachedPivots = _FALSE_;
+  ws->WriteCache = _FALSE_;
+  ws->CacheFile[0] = '\0';
+  /** The ordering and pivot sequence only depend on the pattern, so they
+      can be taken from an earlier run with the same pattern: */
+  if (options->SymbolicCache != NULL){
+    ws->PatternHash = sp_pattern_hash(ncol, Store->Ap, Store->Ai);
+    sprintf(ws->CacheFile,"%s/sparse_%s_%08x.dat",options->SymbolicCache,
+	    (A->Dtype == L_DBL) ? "dbl" : "cx",ws->PatternHash);
+    if (sp_symbolic_read(ws->CacheFile, ws->PatternHash, ncol, nnz, perm_c, pinv, pvec,
+			 topvec, xi, (ws->LowMemory == _TRUE_ ? xipack : NULL),
+			 (ws->LowMemory == _TRUE_ ? xicap : NULL), &lnz, &unz) == _SUCCESS_){
+      ws->CachedPivots = _TRUE_;
+      ws->Factorised = _TRUE_;
+      if (options->EvolverVerbose > 1)
+	printf("Sparse: Symbolic analysis read from %s (nnz(L)=%d, nnz(U)=%d).\n",
+	       ws->CacheFile,lnz,unz);
+    }
+    else{
+      ws->WriteCache = _TRUE_;
+    }
+  }
+  if (ws->CachedPivots == _FALSE_){
+    //Calculate sparsity pattern of C = A + A^T for use with AMD:
+    lasagna_call(get_pattern_A_plus_AT(Store->Ap, 
+				       Store->Ai, 
+				       ncol, 
+				       &(Cp), 
+				       &(Ci), 
+				       error_message), 
+		 error_message,error_message);
+  
+    /* Calculate the optimal ordering: */
+    sp_amd(Cp, Ci, ncol, Cp[ncol],perm_c,wamd);
+    free(Cp);
+    free(Ci);
+    if (ws->LowMemory == _TRUE_){
+      /** The fill of the Cholesky factor of A+A^T in this ordering, which
+	  sp_amd has used up the pattern of: */
+      lasagna_call(get_pattern_A_plus_AT(Store->Ap, Store->Ai, ncol, &(Cp), &(Ci), 
+					 error_message), 
+		   error_message,error_message);
+      lnz = sp_symbolic_fill(Cp, Ci, ncol, perm_c, wamd);
+      unz = lnz;
+      free(Cp);
+      free(Ci);
+      lasagna_test(sp_reach_reserve(ncol, 0, topvec, xi, xipack, xicap, 2*lnz-ncol) == _FAILURE_,
+		   error_message, "Could not allocate the reach sets of the sparse LU.");
+    }
+  }
+  if (ws->LowMemory == _TRUE_){
+    lasagna_test(((A->Dtype == L_DBL)&&
+		  (sp_num_reserve((sp_num *) ws->SparseNumerical, lnz, unz) == _FAILURE_))||
+		 ((A->Dtype == L_DBL_CX)&&
+		  (sp_num_reserve_cx((sp_num_cx *) ws->SparseNumerical, lnz, unz) == _FAILURE_)),
+		 error_message, "Could not allocate the sparse LU factors.");
+    if (options->EvolverVerbose > 1)
+      printf("Sparse: Factors sized for nnz(L)=%d, nnz(U)=%d.\n",lnz,unz);
+  }
+  /** Level scheduled solves need threads: */
+  ws->Levels = NULL;
+  ws->UseLevels = _FALSE_;
+  ws->Verbose = options->EvolverVerbose;
+  ws->Cores = options->Cores;
+#ifndef _OPENMP
+  ws->Cores = 1;
+#endif
+  /** Mixed precision solves. They are serial, so no level sets: */
+  ws->RefineMax = max(0,options->MixedPrecision);
+  ws->RefineTol = 1e-12;
+  ws->Lsgl = NULL;
+  ws->Usgl = NULL;
+  ws->SglSize = 0;
+  ws->RefineWork = NULL;
+  /** Complex factors are refactorised and solved with split real and
+      imaginary parts, except by the mixed precision solves: */
+  ws->Split = NULL;
+  if ((A->Dtype == L_DBL_CX)&&(ws->RefineMax == 0)&&(ws->LowMemory == _FALSE_))
+    lasagna_call(sp_split_alloc_cx(&(ws->Split),ncol,nnz,error_message),
+		 error_message,error_message);
+  if (ws->RefineMax > 0){
+    lasagna_alloc(ws->RefineWork,2*ncol*GetByteSize(A->Dtype),error_message);
+    if (ws->Verbose > 1)
+      printf("Sparse: Single precision factors, at most %d refinement steps.\n",
+	     ws->RefineMax);
+  }
+  else if ((ws->Dtype == L_DBL)&&(ws->Cores > 1)&&(ws->LowMemory == _FALSE_))
+    lasagna_call(sp_lev_alloc(&(ws->Levels),ncol,error_message),
+		 error_message,error_message);
   *linalg_workspace = (void *) ws;
   
   return _SUCCESS_;
@@ -136,11 +244,19 @@ int linalg_finalise_sparse(void *linalg_workspace,
   switch (ws->Dtype){
   case (L_DBL):
     sp_num_free((sp_num *) ws->SparseNumerical);
+    if (ws->Levels != NULL)
+      sp_lev_free(ws->Levels);
     break;
   case (L_DBL_CX):
     sp_num_free_cx((sp_num_cx *) ws->SparseNumerical);
+    if (ws->Split != NULL)
+      sp_split_free_cx(ws->Split);
     break;
   }
+  free(ws->ManyWork);
+  free(ws->Lsgl);
+  free(ws->Usgl);
+  free(ws->RefineWork);
   free(ws->A);
   free(ws);
   return _SUCCESS_;
@@ -149,47 +265,263 @@ int linalg_finalise_sparse(void *linalg_workspace,
 int linalg_factorise_sparse(void *linalg_workspace,
 			    int has_changed_significantly,
 			    ErrorMsg error_message){
-  SP_structure *ws= linalg_workspace;
-  int fr;
-  /** The actual data in ws->A is the same as in the MultiMatrix
-      A which was passed to linalg_initialise_sparse.
+  /** The pivot sequence of the last sp_ludcmp is kept by sp_refactor as long
+      as the factors stay stable: the pivot ratio 1/max|L_ij| must be above 
+      RefactorPivotTolerance and the pivot growth max|U_ij|/max|A_ij| may not 
+      exceed RefactorGrowth times the growth of the last sp_ludcmp. Otherwise
+      the matrix is decomposed again with pivot search. The choice does not 
+      depend on has_changed_significantly, since the pattern is fixed, but
+      _LINALG_FROM_SCRATCH_ always gives a decomposition with pivot search.
+      The actual data in ws->A is the same as in the MultiMatrix A which was 
+      passed to linalg_initialise_sparse.
   */
+  SP_structure *ws= linalg_workspace;
+  sp_num *N;
+  sp_num_cx *Ncx;
+  int fr=_FAILURE_, n, nnz;
+  double growth, ratio;
 
   switch(ws->Dtype){
   case (L_DBL):
-    //    if ((ws->Factorised==_TRUE_)&&(ws->RefactorCount < ws->RefactorMax)){
-    if ((ws->Factorised==_TRUE_)&&(has_changed_significantly==_FALSE_)){
-      fr = sp_refactor((sp_num *) ws->SparseNumerical, 
-		       (sp_mat *) ws->A);
-      ws->RefactorCount++;
+    N = (sp_num *) ws->SparseNumerical;
+    if (has_changed_significantly == _LINALG_FROM_SCRATCH_)
+      ws->CachedPivots = _FALSE_;
+    else if (ws->Factorised==_TRUE_){
+      fr = sp_refactor(N, (sp_mat *) ws->A);
+      if (fr == _SUCCESS_)
+	fr = sp_factor_stability(N, (sp_mat *) ws->A, &growth, &ratio);
+      if ((fr == _SUCCESS_)&&(ws->CachedPivots == _TRUE_)){
+	/** Cached pivots must satisfy the threshold of sp_ludcmp: */
+	ws->GrowthRef = growth;
+	if (ratio < ws->PivotTolerance) fr = _FAILURE_;
+      }
+      if ((fr == _SUCCESS_)&&(ratio >= ws->RefactorPivotTolerance)&&
+	  (growth <= ws->RefactorGrowth*ws->GrowthRef)){
+	if (ws->CachedPivots == _TRUE_){
+	  ws->CachedPivots = _FALSE_;
+	  lasagna_call(linalg_levels_sparse(ws,error_message),
+		       error_message,error_message);
+	}
+	else if (ws->Levels != NULL){
+	  sp_lev_update(ws->Levels,N);
+	}
+	ws->RefactorCount++;
+#pragma omp atomic
+	ws->Stats[_STAT_REFACTOR_]++;
+	return linalg_demote_sparse(ws,error_message);
+      }
+#pragma omp atomic
+      ws->Stats[_STAT_REFACTOR_REJECTED_]++;
+      if (ws->Verbose > 1){
+	if (ws->CachedPivots == _TRUE_)
+	  printf("Sparse: Cached pivot sequence rejected, factorising from scratch.\n");
+	else if (ws->Verbose > 2)
+	  printf("Sparse: Refactorisation rejected (growth %g, pivot ratio %g).\n",
+		 growth,ratio);
+      }
+      if (ws->CachedPivots == _TRUE_){
+	ws->CachedPivots = _FALSE_;
+	ws->WriteCache = _TRUE_;
+      }
     }
-    else{
-      fr = sp_ludcmp((sp_num *) ws->SparseNumerical, 
-		     (sp_mat *) ws->A, 
-		     ws->PivotTolerance);
-      ws->Factorised = _TRUE_;
-      ws->RefactorCount = 0;
+    fr = sp_ludcmp(N, (sp_mat *) ws->A, ws->PivotTolerance);
+    if (fr == _SUCCESS_){
+      sp_factor_stability(N, (sp_mat *) ws->A, &(ws->GrowthRef), &ratio);
+      //New pivot sequence, so the level sets are recomputed:
+      lasagna_call(linalg_levels_sparse(ws,error_message),
+		   error_message,error_message);
+      if (ws->WriteCache == _TRUE_){
+	ws->WriteCache = _FALSE_;
+	n = N->n; nnz = ((sp_mat *) ws->A)->Ap[n];
+	if (sp_symbolic_write(ws->CacheFile, ws->PatternHash, n, nnz, N->q, N->pinv,
+			      N->p, N->topvec, N->xi, N->L->Ap[n], N->U->Ap[n]) != _SUCCESS_)
+	  printf("Sparse: Warning, could not write %s.\n",ws->CacheFile);
+      }
     }
     break;
   case (L_DBL_CX):
-    //    if ((ws->Factorised==_TRUE_)&&(ws->RefactorCount < ws->RefactorMax)){
-    if ((ws->Factorised==_TRUE_)&&(has_changed_significantly==_FALSE_)){
-      fr = sp_refactor_cx((sp_num_cx *) ws->SparseNumerical, 
-			  (sp_mat_cx *) ws->A);
-      ws->RefactorCount++;
+    Ncx = (sp_num_cx *) ws->SparseNumerical;
+    if (has_changed_significantly == _LINALG_FROM_SCRATCH_)
+      ws->CachedPivots = _FALSE_;
+    else if (ws->Factorised==_TRUE_){
+      if ((ws->Split != NULL)&&(ws->CachedPivots == _FALSE_)){
+	fr = sp_refactor_split_cx(ws->Split, Ncx, (sp_mat_cx *) ws->A);
+	if (fr == _SUCCESS_)
+	  fr = sp_factor_stability_split_cx(ws->Split, Ncx, &growth, &ratio);
+      }
+      else{
+	/** Cached pivots come without the pattern of L and U, which the
+	    first refactorisation on the interleaved values makes: */
+	fr = sp_refactor_cx(Ncx, (sp_mat_cx *) ws->A);
+	if (fr == _SUCCESS_)
+	  fr = sp_factor_stability_cx(Ncx, (sp_mat_cx *) ws->A, &growth, &ratio);
+	if ((fr == _SUCCESS_)&&(ws->Split != NULL))
+	  lasagna_call(sp_split_from_cx(ws->Split, Ncx, error_message),
+		       error_message,error_message);
+      }
+      if ((fr == _SUCCESS_)&&(ws->CachedPivots == _TRUE_)){
+	ws->GrowthRef = growth;
+	if (ratio < ws->PivotTolerance) fr = _FAILURE_;
+      }
+      if ((fr == _SUCCESS_)&&(ratio >= ws->RefactorPivotTolerance)&&
+	  (growth <= ws->RefactorGrowth*ws->GrowthRef)){
+	ws->CachedPivots = _FALSE_;
+	ws->RefactorCount++;
+#pragma omp atomic
+	ws->Stats[_STAT_REFACTOR_]++;
+	return linalg_demote_sparse(ws,error_message);
+      }
+#pragma omp atomic
+      ws->Stats[_STAT_REFACTOR_REJECTED_]++;
+      if (ws->Verbose > 1){
+	if (ws->CachedPivots == _TRUE_)
+	  printf("Sparse: Cached pivot sequence rejected, factorising from scratch.\n");
+	else if (ws->Verbose > 2)
+	  printf("Sparse: Refactorisation rejected (growth %g, pivot ratio %g).\n",
+		 growth,ratio);
+      }
+      if (ws->CachedPivots == _TRUE_){
+	ws->CachedPivots = _FALSE_;
+	ws->WriteCache = _TRUE_;
+      }
     }
-    else{
-      fr = sp_ludcmp_cx((sp_num_cx *) ws->SparseNumerical, 
-			(sp_mat_cx *) ws->A, 
-			ws->PivotTolerance);
-      ws->Factorised = _TRUE_;
-      ws->RefactorCount = 0;
+    fr = sp_ludcmp_cx(Ncx, (sp_mat_cx *) ws->A, ws->PivotTolerance);
+    if (fr == _SUCCESS_){
+      sp_factor_stability_cx(Ncx, (sp_mat_cx *) ws->A, &(ws->GrowthRef), &ratio);
+      if (ws->Split != NULL)
+	lasagna_call(sp_split_from_cx(ws->Split, Ncx, error_message),
+		     error_message,error_message);
+      if (ws->WriteCache == _TRUE_){
+	ws->WriteCache = _FALSE_;
+	n = Ncx->n; nnz = ((sp_mat_cx *) ws->A)->Ap[n];
+	if (sp_symbolic_write(ws->CacheFile, ws->PatternHash, n, nnz, Ncx->q, Ncx->pinv,
+			      Ncx->p, Ncx->topvec, Ncx->xi, Ncx->L->Ap[n], Ncx->U->Ap[n]) != _SUCCESS_)
+	  printf("Sparse: Warning, could not write %s.\n",ws->CacheFile);
+      }
     }
     break;
   }
+#pragma omp atomic
+  ws->Stats[_STAT_FULL_LU_]++;
+  ws->Factorised = _TRUE_;
+  ws->RefactorCount = 0;
+  if (fr == _SUCCESS_)
+    lasagna_call(linalg_demote_sparse(ws,error_message),
+		 error_message,error_message);
   return fr;
 }
 
+int linalg_demote_sparse(SP_structure *ws, ErrorMsg error_message){
+  /** Single precision copy of the new factors, if mixed precision solves
+      are used. The double precision factors are kept for sp_refactor and
+      for solves where the refinement does not converge. */
+  sp_num *N=NULL;
+  sp_num_cx *Ncx=NULL;
+  size_t size;
+  int n;
+
+  if (ws->RefineMax == 0)
+    return _SUCCESS_;
+  if (ws->Dtype == L_DBL){
+    N = (sp_num *) ws->SparseNumerical; n = N->n;
+    size = max(N->L->Ap[n],N->U->Ap[n]);
+  }
+  else{
+    Ncx = (sp_num_cx *) ws->SparseNumerical; n = Ncx->n;
+    size = max(Ncx->L->Ap[n],Ncx->U->Ap[n]);
+  }
+  if (size > ws->SglSize){
+    free(ws->Lsgl);
+    free(ws->Usgl);
+    lasagna_alloc(ws->Lsgl,size*GetByteSize(ws->Dtype)/2,error_message);
+    lasagna_alloc(ws->Usgl,size*GetByteSize(ws->Dtype)/2,error_message);
+    ws->SglSize = size;
+  }
+  if (ws->Dtype == L_DBL)
+    sp_lu_demote(N, (float *) ws->Lsgl, (float *) ws->Usgl);
+  else
+    sp_lu_demote_cx(Ncx, (float complex *) ws->Lsgl, (float complex *) ws->Usgl);
+  return _SUCCESS_;
+}
+
+int linalg_refine_sparse(SP_structure *ws, void *b, void *x){
+  /** Solve A x = b with the single precision factors, then correct x by 
+      x += A^-1 (b - A x) with the residual in double precision. Each step
+      multiplies the error by about cond(A) times the single precision 
+      epsilon. If max|dx_i| has not dropped below RefineTol*max|x_i| after
+      RefineMax steps, x is recomputed with the double precision factors. */
+  sp_num *N;
+  sp_num_cx *Ncx;
+  double *xd, *bd, *r, *d, xmax, dmax;
+  double complex *xz, *bz, *rz, *dz;
+  int i, it, n;
+
+  if (ws->Dtype == L_DBL){
+    N = (sp_num *) ws->SparseNumerical; n = N->n;
+    xd = (double *) x; bd = (double *) b;
+    r = (double *) ws->RefineWork; d = r+n;
+    sp_lusolve_sgl(N, (float *) ws->Lsgl, (float *) ws->Usgl, bd, xd);
+    for (it=0; it<ws->RefineMax; it++){
+      sp_residual((sp_mat *) ws->A, xd, bd, r);
+      sp_lusolve_sgl(N, (float *) ws->Lsgl, (float *) ws->Usgl, r, d);
+#pragma omp atomic
+      ws->Stats[_STAT_REFINE_]++;
+      xmax = 0.0; dmax = 0.0;
+      for (i=0; i<n; i++){
+	xd[i] += d[i];
+	xmax = max(xmax,fabs(xd[i]));
+	dmax = max(dmax,fabs(d[i]));
+      }
+      if (dmax <= ws->RefineTol*xmax)
+	return _SUCCESS_;
+    }
+#pragma omp atomic
+    ws->Stats[_STAT_REFINE_FALLBACK_]++;
+    return sp_lusolve(N, bd, xd);
+  }
+  Ncx = (sp_num_cx *) ws->SparseNumerical; n = Ncx->n;
+  xz = (double complex *) x; bz = (double complex *) b;
+  rz = (double complex *) ws->RefineWork; dz = rz+n;
+  sp_lusolve_sgl_cx(Ncx, (float complex *) ws->Lsgl, (float complex *) ws->Usgl, bz, xz);
+  for (it=0; it<ws->RefineMax; it++){
+    sp_residual_cx((sp_mat_cx *) ws->A, xz, bz, rz);
+    sp_lusolve_sgl_cx(Ncx, (float complex *) ws->Lsgl, (float complex *) ws->Usgl, rz, dz);
+#pragma omp atomic
+    ws->Stats[_STAT_REFINE_]++;
+    xmax = 0.0; dmax = 0.0;
+    for (i=0; i<n; i++){
+      xz[i] += dz[i];
+      xmax = max(xmax,cabs(xz[i]));
+      dmax = max(dmax,cabs(dz[i]));
+    }
+    if (dmax <= ws->RefineTol*xmax)
+      return _SUCCESS_;
+  }
+#pragma omp atomic
+  ws->Stats[_STAT_REFINE_FALLBACK_]++;
+  return sp_lusolve_cx(Ncx, bz, xz);
+}
+
+int linalg_levels_sparse(SP_structure *ws, ErrorMsg error_message){
+  /** Level sets for the parallel solves, after a factorisation with a
+      new pivot sequence: */
+  int first;
+  if (ws->Levels == NULL)
+    return _SUCCESS_;
+  first = (ws->Levels->nlevL == 0);
+  lasagna_call(sp_lev_analyse(ws->Levels,
+			      (sp_num *) ws->SparseNumerical,
+			      error_message),
+	       error_message,error_message);
+  ws->UseLevels = (ws->Levels->n >= _SP_LEVEL_WIDTH_*ws->Cores*
+		   max(ws->Levels->nlevL,ws->Levels->nlevU));
+  if ((ws->Verbose > 1)&&(first))
+    printf("Sparse: %d levels in L and %d in U for %d rows, %s.\n",
+	   ws->Levels->nlevL,ws->Levels->nlevU,ws->Levels->n,
+	   ws->UseLevels == _TRUE_ ? "solving in parallel" : "solving serially");
+  return _SUCCESS_;
+}
+
 int linalg_solve_sparse(MultiMatrix *B, 
 			MultiMatrix *X,
 			void *linalg_workspace,
@@ -201,7 +533,7 @@ int linalg_solve_sparse(MultiMatrix *B,
   double **MatX_dbl;
   double complex **MatB_dbl_cx;
   double complex **MatX_dbl_cx;
-  int i,fr;
+  int i,fr=_SUCCESS_;
 
   switch(B->Dtype){
   case (L_DBL):
@@ -209,8 +541,15 @@ int linalg_solve_sparse(MultiMatrix *B,
       MatX_dbl = (double **) StoreX->Matrix;
       MatB_dbl = (double **) StoreB->Matrix;
       //Compensate for zero indexing scheme and solve:
-      fr = sp_lusolve((sp_num *) ws->SparseNumerical, 
-		      MatB_dbl[i]+1, MatX_dbl[i]+1);
+      if (ws->RefineMax > 0)
+	fr = linalg_refine_sparse(ws, MatB_dbl[i]+1, MatX_dbl[i]+1);
+      else if (ws->UseLevels == _TRUE_)
+	fr = sp_lusolve_levels(ws->Levels,
+			       (sp_num *) ws->SparseNumerical, 
+			       MatB_dbl[i]+1, MatX_dbl[i]+1, ws->Cores);
+      else
+	fr = sp_lusolve((sp_num *) ws->SparseNumerical, 
+			MatB_dbl[i]+1, MatX_dbl[i]+1);
     }	
     break;
   case (L_DBL_CX):
@@ -218,10 +557,65 @@ int linalg_solve_sparse(MultiMatrix *B,
       MatX_dbl_cx = (double complex **) StoreX->Matrix;
       MatB_dbl_cx = (double complex **) StoreB->Matrix;
       //Compensate for zero indexing scheme and solve:
-      fr = sp_lusolve_cx((sp_num_cx *) ws->SparseNumerical, 
-			 MatB_dbl_cx[i]+1, MatX_dbl_cx[i]+1);
+      if (ws->RefineMax > 0)
+	fr = linalg_refine_sparse(ws, MatB_dbl_cx[i]+1, MatX_dbl_cx[i]+1);
+      else if (ws->Split == NULL)
+	fr = sp_lusolve_cx((sp_num_cx *) ws->SparseNumerical, 
+			   MatB_dbl_cx[i]+1, MatX_dbl_cx[i]+1);
+      else
+	fr = sp_lusolve_split_cx(ws->Split, (sp_num_cx *) ws->SparseNumerical, 
+				 MatB_dbl_cx[i]+1, MatX_dbl_cx[i]+1);
     }      
     break;
   }
   return fr;
 }
+
+int linalg_solve_many_sparse(MultiMatrix *B, 
+			     MultiMatrix *X,
+			     void *linalg_workspace,
+			     ErrorMsg error_message){
+  /** The rows of B are interleaved, so one pass over L and U solves all
+      of them. Level scheduling is only used for a single right hand side,
+      and mixed precision solves refine one row at a time, as do complex
+      solves with split factors. */
+  SP_structure *ws= linalg_workspace;
+  DNRformat *StoreB=B->Store;
+  DNRformat *StoreX=X->Store;
+  double **MatB_dbl, **MatX_dbl, *b, *x;
+  double complex **MatB_dbl_cx, **MatX_dbl_cx, *b_cx, *x_cx;
+  int i, r, n=B->ncol, k=B->nrow, fr=_SUCCESS_;
+  size_t size;
+
+  if ((k == 1)||(ws->RefineMax > 0)||(ws->Split != NULL))
+    return linalg_solve_sparse(B, X, linalg_workspace, error_message);
+  size = 3*((size_t) n)*k*GetByteSize(B->Dtype);
+  if (size > ws->ManyWorkSize){
+    free(ws->ManyWork);
+    lasagna_alloc(ws->ManyWork, size, error_message);
+    ws->ManyWorkSize = size;
+  }
+  switch(B->Dtype){
+  case (L_DBL):
+    MatB_dbl = (double **) StoreB->Matrix;
+    MatX_dbl = (double **) StoreX->Matrix;
+    b = (double *) ws->ManyWork; x = b+n*k;
+    for (r=0; r<k; r++)
+      for (i=0; i<n; i++) b[i*k+r] = MatB_dbl[r+1][i+1];
+    fr = sp_lusolve_many((sp_num *) ws->SparseNumerical, b, x, x+n*k, k);
+    for (r=0; r<k; r++)
+      for (i=0; i<n; i++) MatX_dbl[r+1][i+1] = x[i*k+r];
+    break;
+  case (L_DBL_CX):
+    MatB_dbl_cx = (double complex **) StoreB->Matrix;
+    MatX_dbl_cx = (double complex **) StoreX->Matrix;
+    b_cx = (double complex *) ws->ManyWork; x_cx = b_cx+n*k;
+    for (r=0; r<k; r++)
+      for (i=0; i<n; i++) b_cx[i*k+r] = MatB_dbl_cx[r+1][i+1];
+    fr = sp_lusolve_many_cx((sp_num_cx *) ws->SparseNumerical, b_cx, x_cx, x_cx+n*k, k);
+    for (r=0; r<k; r++)
+      for (i=0; i<n; i++) MatX_dbl_cx[r+1][i+1] = x_cx[i*k+r];
+    break;
+  }
+  return fr;
+}
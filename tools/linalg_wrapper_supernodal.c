@@ -0,0 +1,210 @@
+#include "linalg_wrapper_supernodal.h"
+
+
+/** Supernodal variant of linalg_wrapper_sparse. The pivoting 
+    factorisation is done by sp_ludcmp exactly as in the sparse 
+    wrapper, after which sp_super_symbolic collects the factors into 
+    supernodes. Refactorisations with the same pivots and all solves
+    then use the dense supernode blocks, see sparse.c. Complex matrices
+    (radau5) are passed on to the ordinary complex sparse routines.
+*/
+int linalg_initialise_supernodal(MultiMatrix *A, 
+				 EvolverOptions *options,
+				 void **linalg_workspace,
+				 ErrorMsg error_message){
+  SCCformat *Store=A->Store;
+  SN_structure *ws;
+  sp_mat *spmat_dbl;
+  sp_mat_cx *spmat_dbl_cx;
+  int nnz;
+  int *Cp, *Ci;
+  int *perm_c, *wamd;
+  int ncol, nrow;
+
+  printf("Linalg Wrapper: Supernodal\n");
+
+  ncol = A->ncol; nrow = A->nrow;
+  //Test input:
+  lasagna_test(A->ncol != A->nrow, 
+	       error_message, 
+	       "Matrix not square!");
+  lasagna_test((A->Dtype!=L_DBL)&&(A->Dtype!=L_DBL_CX), 
+	       error_message,
+	       "Unknown datatype in A.");
+  lasagna_test(A->Stype!=L_SCC, 
+	       error_message,
+	       "This wrapper only supports sparse input matrix.");
+  
+  nnz = Store->nnz;
+  lasagna_alloc(ws,sizeof(SN_structure),error_message);
+  ws->Supernodal = NULL;
+  switch (A->Dtype){
+  case (L_DBL):
+    lasagna_call(sp_num_alloc(((sp_num **) &ws->SparseNumerical), 
+			      ncol, 
+			      error_message),
+		 error_message,error_message);
+    lasagna_call(sp_super_alloc(&(ws->Supernodal),ncol,error_message),
+		 error_message,error_message);
+    perm_c = ((sp_num *) ws->SparseNumerical)->q;
+    wamd = ((sp_num *) ws->SparseNumerical)->wamd;
+    lasagna_alloc(ws->A,sizeof(sp_mat),error_message);
+    spmat_dbl = (sp_mat *) ws->A;
+    spmat_dbl->ncols = ncol;
+    spmat_dbl->nrows = nrow;
+    spmat_dbl->maxnz = nnz;
+    spmat_dbl->Ai = Store->Ai;
+    spmat_dbl->Ap = Store->Ap;
+    spmat_dbl->Ax = (double *) Store->Ax;
+    break;
+  case (L_DBL_CX):
+    lasagna_call(sp_num_alloc_cx(((sp_num_cx **) &ws->SparseNumerical), 
+				 ncol, 
+				 error_message),
+		 error_message,error_message);
+    perm_c = ((sp_num_cx *) ws->SparseNumerical)->q;
+    wamd = ((sp_num_cx *) ws->SparseNumerical)->wamd;
+    lasagna_alloc(ws->A,sizeof(sp_mat_cx),error_message);
+    spmat_dbl_cx = (sp_mat_cx *) ws->A;
+    spmat_dbl_cx->ncols = ncol;
+    spmat_dbl_cx->nrows = nrow;
+    spmat_dbl_cx->maxnz = nnz;
+    spmat_dbl_cx->Ai = Store->Ai;
+    spmat_dbl_cx->Ap = Store->Ap;
+    spmat_dbl_cx->Ax = (double complex*) Store->Ax;
+    break;
+  }
+  //Calculate sparsity pattern of C = A + A^T for use with AMD:
+  lasagna_call(get_pattern_A_plus_AT(Store->Ap, 
+				     Store->Ai, 
+				     ncol, 
+				     &(Cp), 
+				     &(Ci), 
+				     error_message), 
+	       error_message,error_message);
+  
+  /* Calculate the optimal ordering: */
+  sp_amd(Cp, Ci, ncol, Cp[ncol],perm_c,wamd);
+  free(Cp);
+  free(Ci);
+  /** Set options for solver: */
+  ws->Dtype = A->Dtype;
+  ws->PivotTolerance = 0.1;
+  ws->MaxSupernode = 64;
+  ws->SupernodeRelax = 0.2;
+  ws->RefactorCount = 0;
+  ws->Factorised = _FALSE_;
+  ws->Verbose = options->EvolverVerbose;
+  *linalg_workspace = (void *) ws;
+  
+  return _SUCCESS_;
+}
+
+int linalg_finalise_supernodal(void *linalg_workspace,
+			       ErrorMsg error_message){
+  
+  SN_structure *ws=linalg_workspace;  
+  switch (ws->Dtype){
+  case (L_DBL):
+    sp_num_free((sp_num *) ws->SparseNumerical);
+    sp_super_free(ws->Supernodal);
+    break;
+  case (L_DBL_CX):
+    sp_num_free_cx((sp_num_cx *) ws->SparseNumerical);
+    break;
+  }
+  free(ws->A);
+  free(ws);
+  return _SUCCESS_;
+}
+
+int linalg_factorise_supernodal(void *linalg_workspace,
+				int has_changed_significantly,
+				ErrorMsg error_message){
+  SN_structure *ws= linalg_workspace;
+  int fr=_FAILURE_;
+
+  switch(ws->Dtype){
+  case (L_DBL):
+    fr = _FAILURE_;
+    if ((ws->Factorised==_TRUE_)&&(has_changed_significantly==_FALSE_)){
+      fr = sp_super_refactor(ws->Supernodal,
+			     (sp_num *) ws->SparseNumerical, 
+			     (sp_mat *) ws->A);
+      ws->RefactorCount++;
+    }
+    //Zero pivot on refactorisation also gives a new pivoting factorisation:
+    if (fr == _FAILURE_){
+      fr = sp_ludcmp((sp_num *) ws->SparseNumerical, 
+		     (sp_mat *) ws->A, 
+		     ws->PivotTolerance);
+      if (fr == _FAILURE_)
+	return fr;
+      lasagna_call(sp_super_symbolic(ws->Supernodal,
+				     (sp_num *) ws->SparseNumerical,
+				     ws->MaxSupernode,
+				     ws->SupernodeRelax,
+				     error_message),
+		   error_message,error_message);
+      if ((ws->Verbose > 1)&&(ws->Factorised==_FALSE_))
+	printf("Supernodal: %d supernodes for %d columns, %d entries in L blocks.\n",
+	       ws->Supernodal->nsuper,ws->Supernodal->n,
+	       ws->Supernodal->Lxp[ws->Supernodal->nsuper]);
+      ws->Factorised = _TRUE_;
+      ws->RefactorCount = 0;
+    }
+    break;
+  case (L_DBL_CX):
+    if ((ws->Factorised==_TRUE_)&&(has_changed_significantly==_FALSE_)){
+      fr = sp_refactor_cx((sp_num_cx *) ws->SparseNumerical, 
+			  (sp_mat_cx *) ws->A);
+      ws->RefactorCount++;
+    }
+    else{
+      fr = sp_ludcmp_cx((sp_num_cx *) ws->SparseNumerical, 
+			(sp_mat_cx *) ws->A, 
+			ws->PivotTolerance);
+      ws->Factorised = _TRUE_;
+      ws->RefactorCount = 0;
+    }
+    break;
+  }
+  return fr;
+}
+
+int linalg_solve_supernodal(MultiMatrix *B, 
+			    MultiMatrix *X,
+			    void *linalg_workspace,
+			    ErrorMsg error_message){
+  SN_structure *ws= linalg_workspace;
+  DNRformat *StoreB=B->Store;
+  DNRformat *StoreX=X->Store;
+  double **MatB_dbl;
+  double **MatX_dbl;
+  double complex **MatB_dbl_cx;
+  double complex **MatX_dbl_cx;
+  int i,fr=_SUCCESS_;
+
+  switch(B->Dtype){
+  case (L_DBL):
+    for(i=1; i<=B->nrow; i++){ 
+      MatX_dbl = (double **) StoreX->Matrix;
+      MatB_dbl = (double **) StoreB->Matrix;
+      //Compensate for zero indexing scheme and solve:
+      fr = sp_super_lusolve(ws->Supernodal,
+			    (sp_num *) ws->SparseNumerical, 
+			    MatB_dbl[i]+1, MatX_dbl[i]+1);
+    }	
+    break;
+  case (L_DBL_CX):
+    for(i=1; i<=B->nrow; i++){ 
+      MatX_dbl_cx = (double complex **) StoreX->Matrix;
+      MatB_dbl_cx = (double complex **) StoreB->Matrix;
+      //Compensate for zero indexing scheme and solve:
+      fr = sp_lusolve_cx((sp_num_cx *) ws->SparseNumerical, 
+			 MatB_dbl_cx[i]+1, MatX_dbl_cx[i]+1);
+    }      
+    break;
+  }
+  return fr;
+}
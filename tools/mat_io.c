@@ -24,7 +24,8 @@ int mat_create_file(char *filename){
   fwrite(&version, 2, 1, mat_file);
   fwrite(&endian, 2, 1, mat_file);
   fclose(mat_file);
-  return _SUCCESS_;
+  //Start an empty index:
+  return mat_toc_create(filename);
 }
   
 int mat_add_matrix(char *filename, 
@@ -44,9 +45,11 @@ int mat_add_matrix(char *filename,
   int32_t int32_tmp;
   uint32_t uint32_tmp;
   uint64_t uint64_tmp;
+  int start_data_element;
 
-  //Open file in append mode:
-  mat_file = fopen(filename,"ab");
+  //Open file and go to the end:
+  mat_file = fopen(filename,"r+b");
+  fseek(mat_file,0,SEEK_END);
   switch(data_type){
   case miSINGLE:
     array_class = mxSINGLE_CLASS;
@@ -90,6 +93,7 @@ int mat_add_matrix(char *filename,
 	 name_length,name_length_padded,data_byte_size,data_byte_size_padded);
   */
   //Write the tag of the MATLAB array:
+  start_data_element = ftell(mat_file);
   uint32_tmp = miMATRIX;
   fwrite(&uint32_tmp,4,1,mat_file);
   //Total size has been calculated:
@@ -144,64 +148,201 @@ int mat_add_matrix(char *filename,
   //Data
   //Set handle do data-part:
   *handle = ftell(mat_file);
-  //Fill with zeros:
+  //Fill with zeros. Skipped bytes read as zeros, so only the last 8 are written:
   uint64_tmp = 0;
-  for (i=0; i<(data_byte_size+7)/8; i++)
+  if (data_byte_size_padded > 0){
+    fseek(mat_file, data_byte_size_padded-8, SEEK_CUR);
     fwrite(&uint64_tmp, 8, 1, mat_file);
+  }
   
   fclose(mat_file);
+  mat_toc_add(filename,matrix_name,start_data_element,data_type,rows,cols);
   return _SUCCESS_;
 }
 
 int mat_goto_matrix(FILE *mat_file,
+		    char *filename,
 		    char *matrix_name,
 		    int *beginning_of_matrix){
-  uint32_t matrix_size, name_size;
-  int bytes_from_matrix_size_to_name_size = 36;
-  int i,matrix_found=_FALSE_,start_data_element;
-  int8_t int8_tmp;
-  int read_status;
+  uint32_t matrix_size;
+  int matrix_found=_FALSE_,start_data_element;
 
   /** This small helper routine finds the start of a matrix with a
-      specific name */
-  //Skip directly to the size of the first data element:
-  fseek(mat_file,128,SEEK_SET);
-  start_data_element = ftell(mat_file);
-
+      specific name. The index of filename is tried first, and the file
+      is scanned if the index is missing or out of date. */
+  if ((filename != NULL)&&
+      (mat_toc_lookup(filename,matrix_name,&start_data_element) == _SUCCESS_)&&
+      (mat_match_matrix(mat_file,matrix_name,start_data_element,
+			&matrix_found,&matrix_size) == _SUCCESS_)&&
+      (matrix_found == _TRUE_)){
+    *beginning_of_matrix = start_data_element;
+    return _SUCCESS_;
+  }
+  //Skip directly to the first data element:
+  start_data_element = 128;
   while (matrix_found==_FALSE_){
-    fseek(mat_file,4,SEEK_CUR);
-    lasagna_fread(&matrix_size, 4, 1, mat_file);
-  
-    //Skip to the size of array name:
-    fseek(mat_file, bytes_from_matrix_size_to_name_size, SEEK_CUR);
-    lasagna_fread(&name_size, 4, 1, mat_file);
- 
-    //Is this the correct matrix?
-    //Test for correct length, and if true, correct name:
-    if (strlen(matrix_name)!=name_size){
-      matrix_found = _FALSE_;
-    }
-    else{
-      matrix_found=_TRUE_;
-      for (i=0; i<name_size; i++){
-	lasagna_fread(&int8_tmp,1,1,mat_file);
-	if (int8_tmp!=((int8_t) matrix_name[i])){
-	  matrix_found = _FALSE_;
-	  break;
-	}
-      }
-    }
+    //The end of the file means there is no such matrix:
+    if (mat_match_matrix(mat_file,matrix_name,start_data_element,
+			 &matrix_found,&matrix_size) == _FAILURE_)
+      return _FAILURE_;
     if (matrix_found == _FALSE_){
       //Try to jump to next matrix:
       start_data_element +=(8+matrix_size);
-      fseek(mat_file, start_data_element, SEEK_SET);
     }
-    else{
-      *beginning_of_matrix = start_data_element;
-      return _SUCCESS_;
+  }
+  *beginning_of_matrix = start_data_element;
+  fseek(mat_file, start_data_element, SEEK_SET);
+  return _SUCCESS_;
+}
+
+int mat_match_matrix(FILE *mat_file,
+		     char *matrix_name,
+		     int start_data_element,
+		     int *matrix_found,
+		     uint32_t *matrix_size){
+  /** Does the element at start_data_element have the name matrix_name?
+      Fails if there is no element there. */
+  uint32_t element_type, name_size;
+  int bytes_from_matrix_size_to_name_size = 36;
+  int i;
+  int8_t int8_tmp;
+  char *header;
+
+  fseek(mat_file,start_data_element,SEEK_SET);
+  if ((fread(&element_type, 4, 1, mat_file) != 1)||
+      (fread(matrix_size, 4, 1, mat_file) != 1))
+    return _FAILURE_;
+  if (element_type == miCOMPRESSED){
+    //Inflate the header up to the end of the name:
+    name_size = strlen(matrix_name);
+    header = malloc(48+name_size);
+    *matrix_found = 
+      (mat_inflate_element(mat_file,start_data_element,header,
+			   48+name_size) == _SUCCESS_)&&
+      (memcmp(header+44,&name_size,4) == 0)&&
+      (memcmp(header+48,matrix_name,name_size) == 0);
+    free(header);
+    return _SUCCESS_;
+  }
+  //Skip to the size of array name:
+  fseek(mat_file, bytes_from_matrix_size_to_name_size, SEEK_CUR);
+  if (fread(&name_size, 4, 1, mat_file) != 1)
+    return _FAILURE_;
+  //Test for correct length, and if true, correct name:
+  *matrix_found = _FALSE_;
+  if (strlen(matrix_name)==name_size){
+    *matrix_found = _TRUE_;
+    for (i=0; i<name_size; i++){
+      if ((fread(&int8_tmp,1,1,mat_file) != 1)||
+	  (int8_tmp!=((int8_t) matrix_name[i]))){
+	*matrix_found = _FALSE_;
+	break;
+      }
     }
   }
-  return _FAILURE_;
+  return _SUCCESS_;
+}
+
+int mat_toc_create(char *filename){
+  /** Start an empty index <filename>.toc. */
+  FILE *toc_file;
+  char *toc_name=malloc(strlen(filename)+5);
+  sprintf(toc_name,"%s.toc",filename);
+  toc_file = fopen(toc_name,"w");
+  free(toc_name);
+  if (toc_file == NULL)
+    return _FAILURE_;
+  fclose(toc_file);
+  return _SUCCESS_;
+}
+
+int mat_toc_add(char *filename,
+		char *matrix_name,
+		int start_data_element,
+		int data_type,
+		int rows,
+		int cols){
+  /** Add a line "name offset type rows cols" to the index. */
+  FILE *toc_file;
+  char *toc_name=malloc(strlen(filename)+5);
+  sprintf(toc_name,"%s.toc",filename);
+  toc_file = fopen(toc_name,"a");
+  free(toc_name);
+  if (toc_file == NULL)
+    return _FAILURE_;
+  fprintf(toc_file,"%s %d %d %d %d\n",matrix_name,start_data_element,
+	  data_type,rows,cols);
+  fclose(toc_file);
+  return _SUCCESS_;
+}
+
+int mat_toc_lookup(char *filename,
+		   char *matrix_name,
+		   int *beginning_of_matrix){
+  /** Find the offset of a matrix in the index. Fails if there is no
+      index or no such entry. */
+  FILE *toc_file;
+  char *toc_name=malloc(strlen(filename)+5);
+  char *name=malloc(strlen(matrix_name)+2);
+  char format[32];
+  int offset, status=_FAILURE_;
+  sprintf(toc_name,"%s.toc",filename);
+  toc_file = fopen(toc_name,"r");
+  free(toc_name);
+  if (toc_file != NULL){
+    //Longer names are split, and do not match:
+    sprintf(format,"%%%ds %%d %%*[^\n]",(int) strlen(matrix_name)+1);
+    while (fscanf(toc_file,format,name,&offset) == 2){
+      if (strcmp(name,matrix_name) == 0){
+	*beginning_of_matrix = offset;
+	status = _SUCCESS_;
+	break;
+      }
+    }
+    fclose(toc_file);
+  }
+  free(name);
+  return status;
+}
+
+int mat_inflate_element(FILE *mat_file,
+			int start_data_element,
+			char *buffer,
+			size_t bytes){
+  /** Inflates the first bytes bytes of the miCOMPRESSED element at 
+      start_data_element into buffer. */
+  z_stream zs;
+  uint32_t compressed_size;
+  unsigned char in[16384];
+  size_t left;
+  int zstatus=Z_OK, read_status;
+
+  fseek(mat_file,start_data_element+4,SEEK_SET);
+  lasagna_fread(&compressed_size,4,1,mat_file);
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  zs.avail_in = 0;
+  zs.next_in = Z_NULL;
+  if (inflateInit(&zs) != Z_OK)
+    return _FAILURE_;
+  zs.next_out = (Bytef *) buffer;
+  zs.avail_out = bytes;
+  left = compressed_size;
+  while ((zs.avail_out > 0)&&(zstatus == Z_OK)){
+    if (zs.avail_in == 0){
+      zs.avail_in = fread(in,1,min(left,sizeof(in)),mat_file);
+      if (zs.avail_in == 0)
+	break;
+      left -= zs.avail_in;
+      zs.next_in = in;
+    }
+    zstatus = inflate(&zs,Z_NO_FLUSH);
+  }
+  inflateEnd(&zs);
+  if (zs.avail_out > 0)
+    return _FAILURE_;
+  return _SUCCESS_;
 }
 
 int mat_write_data(char *filename, 
@@ -210,6 +351,7 @@ int mat_write_data(char *filename,
 		   int start_entry,
 		   int entries){
   uint32_t array_size, data_type, name_size, name_size_padded;
+  uint32_t element_type;
   int type_byte_size;
   int start_data_element;
   FILE *mat_file;
@@ -222,12 +364,21 @@ int mat_write_data(char *filename,
       exists in file, and return handle:
   */
   func_return = mat_goto_matrix(mat_file,
+				  filename,
 				  matrix_name,
 				  &start_data_element);
   if (func_return == _FAILURE_){
     fclose(mat_file);
     return _FAILURE_;
   }
+  //Compressed matrices cannot be written in place:
+  fseek(mat_file,start_data_element,SEEK_SET);
+  lasagna_fread(&element_type,4,1,mat_file);
+  if (element_type == miCOMPRESSED){
+    printf("Error: Matrix %s is compressed! \n",matrix_name);
+    fclose(mat_file);
+    return _FAILURE_;
+  }
   name_size = strlen(matrix_name);
   if ((name_size%8)==0)
     name_size_padded = name_size;
@@ -275,13 +426,65 @@ int mat_read_data(char *filename,
 		  int *cols,
 		  int *rows,
 		  int *data_type){
+  /** Reads a matrix, and appends the columns of the blocks 
+      <matrix_name>_1, <matrix_name>_2,... written by a chunked 
+      mat_writer. */
+  void *block;
+  char *block_name;
+  int k, block_cols, block_rows, block_type, type_byte_size;
+  if (mat_read_element(filename,matrix_name,data_ptr,
+		       cols,rows,data_type) == _FAILURE_)
+    return _FAILURE_;
+  type_byte_size = mat_type_byte_size(*data_type);
+  block_name = malloc(strlen(matrix_name)+16);
+  for (k=1; ; k++){
+    sprintf(block_name,"%s_%d",matrix_name,k);
+    if (mat_read_element(filename,block_name,&block,
+			 &block_cols,&block_rows,&block_type) == _FAILURE_)
+      break;
+    if ((block_rows != *rows)||(block_type != *data_type)){
+      free(block);
+      break;
+    }
+    *data_ptr = realloc(*data_ptr,type_byte_size*(*rows)*(*cols+block_cols));
+    memcpy((char *)(*data_ptr)+type_byte_size*(*rows)*(*cols),block,
+	   type_byte_size*(*rows)*block_cols);
+    *cols += block_cols;
+    free(block);
+  }
+  free(block_name);
+  return _SUCCESS_;
+}
+
+int mat_type_byte_size(int data_type){
+  switch(data_type){
+  case miSINGLE:
+  case miINT32:
+    return 4;
+  case miDOUBLE:
+    return 8;
+  case miINT8:
+    return 1;
+  default:
+    return 8;
+  }
+}
+
+int mat_read_element(char *filename, 
+		     char *matrix_name, 
+		     void **data_ptr,
+		     int *cols,
+		     int *rows,
+		     int *data_type){
   uint32_t array_size, name_size, name_size_padded;
+  uint32_t element_type, tag[2];
   int32_t int32_tmp;
   int type_byte_size;
   int start_data_element;
   FILE *mat_file;
   int func_return, read_status;
   int entries;
+  char *element;
   //Open file for reading:
   mat_file = fopen(filename,"rb");
   if (mat_file == NULL){
@@ -289,6 +492,7 @@ int mat_read_data(char *filename,
   }
   //If matrix name exists in file, get the beginning of the matrix data element:
   func_return = mat_goto_matrix(mat_file,
+				filename,
 				matrix_name,
 				&start_data_element);
   if (func_return == _FAILURE_){
@@ -300,6 +504,34 @@ int mat_read_data(char *filename,
     name_size_padded = name_size;
   else
     name_size_padded = name_size + 8-name_size%8;
+  //A compressed matrix is inflated and read from memory:
+  fseek(mat_file,start_data_element,SEEK_SET);
+  lasagna_fread(&element_type,4,1,mat_file);
+  if (element_type == miCOMPRESSED){
+    if (mat_inflate_element(mat_file,start_data_element,
+			    (char *) tag,8) == _FAILURE_){
+      fclose(mat_file);
+      return _FAILURE_;
+    }
+    element = malloc(8+tag[1]);
+    if (mat_inflate_element(mat_file,start_data_element,
+			    element,8+tag[1]) == _FAILURE_){
+      free(element);
+      fclose(mat_file);
+      return _FAILURE_;
+    }
+    memcpy(&int32_tmp,element+4*8,4);
+    *rows = int32_tmp;
+    memcpy(&int32_tmp,element+4*8+4,4);
+    *cols = int32_tmp;
+    memcpy(data_type,element+6*8+name_size_padded,4);
+    memcpy(&array_size,element+6*8+name_size_padded+4,4);
+    *data_ptr = malloc(array_size);
+    memcpy(*data_ptr,element+7*8+name_size_padded,array_size);
+    free(element);
+    fclose(mat_file);
+    return _SUCCESS_;
+  }
   //Get dimension:
   fseek(mat_file,start_data_element+4*8,SEEK_SET);
   lasagna_fread(&int32_tmp,4,1,mat_file);
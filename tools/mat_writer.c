@@ -0,0 +1,683 @@
+#include "mat_writer.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+int mat_writer_open(mat_writer *writer,
+		    char *filename,
+		    int slots,
+		    int max_segments,
+		    size_t max_bytes,
+		    int mode,
+		    int level,
+		    ErrorMsg error_message){
+  /** Open an existing MAT file for the time slices. A slice holds at most
+      max_segments segments of max_bytes bytes in total. In the mmap and
+      compressed modes the file must already have its final layout, as
+      after mat_add_matrix. level is the zlib level of the compressed mode. */
+  int i;
+  struct stat file_stat;
+  char spool_name[_FILENAMESIZE_+8];
+  lasagna_open(writer->mat_file,filename,"r+b",error_message);
+  writer->mode = mode;
+  strncpy(writer->filename,filename,_FILENAMESIZE_-1);
+  writer->filename[_FILENAMESIZE_-1] = '\0';
+  writer->map = NULL;
+  writer->map_size = 0;
+  writer->level = level;
+  writer->spool = NULL;
+  writer->nstreams = 0;
+  writer->stream = NULL;
+  writer->zbuf = NULL;
+  writer->block_start = 128;
+  writer->blocks = 1;
+  writer->file_end = 128;
+  writer->slots = max(slots,0);
+  writer->max_segments = max_segments;
+  writer->max_bytes = max_bytes;
+  writer->head = 0;
+  writer->tail = 0;
+  writer->count = 0;
+  writer->stop = _FALSE_;
+  writer->status = _SUCCESS_;
+  if (mode == _MAT_WRITER_MMAP_){
+    writer->slots = 0;
+    lasagna_test(fstat(fileno(writer->mat_file),&file_stat)!=0,error_message,
+		 "Could not stat %s.",filename);
+    writer->map_size = file_stat.st_size;
+    writer->map = mmap(NULL,writer->map_size,PROT_READ|PROT_WRITE,MAP_SHARED,
+		       fileno(writer->mat_file),0);
+    if (writer->map == MAP_FAILED){
+      writer->map = NULL;
+      fclose(writer->mat_file);
+      writer->mat_file = NULL;
+      lasagna_test(_TRUE_,error_message,"Could not map %s.",filename);
+    }
+    madvise(writer->map,writer->map_size,MADV_WILLNEED);
+  }
+  else if (mode == _MAT_WRITER_COMPRESSED_){
+    lasagna_call(mat_writer_scan(writer,error_message),
+		 error_message,error_message);
+    lasagna_alloc(writer->zbuf,_MAT_WRITER_CHUNK_,error_message);
+    sprintf(spool_name,"%s.spool",writer->filename);
+    lasagna_open(writer->spool,spool_name,"w+b",error_message);
+    writer->spool_size = 0;
+  }
+  else if (mode == _MAT_WRITER_CHUNKED_){
+    lasagna_call(mat_writer_scan(writer,error_message),
+		 error_message,error_message);
+  }
+  if (writer->slots == 0)
+    return _SUCCESS_;
+
+  lasagna_alloc(writer->data,writer->slots*max_bytes,error_message);
+  lasagna_alloc(writer->seg_offset,sizeof(long)*writer->slots*max_segments,
+		error_message);
+  lasagna_alloc(writer->seg_size,sizeof(size_t)*writer->slots*max_segments,
+		error_message);
+  lasagna_alloc(writer->nseg,sizeof(int)*writer->slots,error_message);
+  lasagna_alloc(writer->used,sizeof(size_t)*writer->slots,error_message);
+  for (i=0; i<writer->slots; i++){
+    writer->nseg[i] = 0;
+    writer->used[i] = 0;
+  }
+  pthread_mutex_init(&(writer->lock),NULL);
+  pthread_cond_init(&(writer->cond_data),NULL);
+  pthread_cond_init(&(writer->cond_space),NULL);
+  if (pthread_create(&(writer->thread),NULL,mat_writer_thread,writer) != 0){
+    //No thread, so write the slices in the caller:
+    free(writer->data);
+    free(writer->seg_offset);
+    free(writer->seg_size);
+    free(writer->nseg);
+    free(writer->used);
+    writer->slots = 0;
+  }
+  return _SUCCESS_;
+}
+
+int mat_writer_scan(mat_writer *writer, ErrorMsg error_message){
+  /** Set up one stream per element of the uncompressed file. */
+  FILE *mat_file=writer->mat_file;
+  uint32_t tag[2], name_size, data_tag[2];
+  int32_t dims[2];
+  long start=128;
+  int n=0, nmax=32;
+  mat_stream *ms;
+
+  lasagna_alloc(writer->stream,sizeof(mat_stream)*nmax,error_message);
+  fseek(mat_file,start,SEEK_SET);
+  while (fread(tag,4,2,mat_file) == 2){
+    lasagna_test(tag[0]!=miMATRIX,error_message,
+		 "Element at %ld of %s is not a matrix.",start,writer->filename);
+    fseek(mat_file,start+32,SEEK_SET);
+    lasagna_test((fread(dims,4,2,mat_file)!=2)||
+		 (fseek(mat_file,start+44,SEEK_SET)!=0)||
+		 (fread(&name_size,4,1,mat_file)!=1),error_message,
+		 "Could not read %s.",writer->filename);
+    if (n == nmax){
+      nmax *= 2;
+      writer->stream = realloc(writer->stream,sizeof(mat_stream)*nmax);
+      lasagna_test(writer->stream==NULL,error_message,
+		   "Could not allocate the streams.");
+    }
+    ms = writer->stream+n;
+    ms->start = start;
+    ms->data = start+7*8+8*((name_size+7)/8);
+    ms->end = start+8+tag[1];
+    lasagna_alloc(ms->name,name_size+1,error_message);
+    lasagna_test((fread(ms->name,1,name_size,mat_file)!=name_size)||
+		 (fseek(mat_file,ms->data-8,SEEK_SET)!=0)||
+		 (fread(data_tag,4,2,mat_file)!=2),error_message,
+		 "Could not read %s.",writer->filename);
+    ms->name[name_size] = '\0';
+    ms->data_type = data_tag[0];
+    ms->size = data_tag[1];
+    ms->rows = dims[0];
+    ms->cols = dims[1];
+    ms->written = 0;
+    ms->next = -1;
+    ms->block = 0;
+    ms->position = -1;
+    ms->chunks = 0;
+    ms->chunks_max = 0;
+    ms->chunk_offset = NULL;
+    ms->chunk_size = NULL;
+    ms->compressed = 0;
+    n++;
+    start = ms->end;
+    fseek(mat_file,start,SEEK_SET);
+  }
+  writer->nstreams = n;
+  writer->file_end = start;
+  return _SUCCESS_;
+}
+
+int mat_writer_begin(mat_writer *writer){
+  /** Start a new slice. Blocks only when all slots are waiting. */
+  int status;
+  if (writer->slots == 0)
+    return writer->status;
+  pthread_mutex_lock(&(writer->lock));
+  while (writer->count == writer->slots)
+    pthread_cond_wait(&(writer->cond_space),&(writer->lock));
+  status = writer->status;
+  pthread_mutex_unlock(&(writer->lock));
+  writer->nseg[writer->head] = 0;
+  writer->used[writer->head] = 0;
+  return status;
+}
+
+int mat_writer_put(mat_writer *writer,
+		   void *ptr,
+		   int *handle,
+		   int size_element,
+		   int entries){
+  /** Add entries elements at ptr to the slice at the file offset *handle,
+      and advance *handle like mat_write_fast. */
+  size_t size=(size_t)size_element*entries;
+  int slot=writer->head;
+  int seg;
+  if ((writer->mode == _MAT_WRITER_CHUNKED_)&&
+      (mat_writer_chunk(writer,handle,size) == _FAILURE_)){
+    writer->status = _FAILURE_;
+    return _FAILURE_;
+  }
+  if (writer->map != NULL){
+    if ((*handle < 0)||(*handle+size > writer->map_size)){
+      writer->status = _FAILURE_;
+      return _FAILURE_;
+    }
+    memcpy(writer->map+*handle,ptr,size);
+  }
+  else if (writer->slots == 0){
+    if (mat_writer_segment(writer,*handle,ptr,size) == _FAILURE_){
+      writer->status = _FAILURE_;
+      return _FAILURE_;
+    }
+  }
+  else{
+    seg = slot*writer->max_segments+writer->nseg[slot];
+    if ((writer->nseg[slot] == writer->max_segments)||
+	(writer->used[slot]+size > writer->max_bytes)){
+      writer->status = _FAILURE_;
+      return _FAILURE_;
+    }
+    memcpy(writer->data+slot*writer->max_bytes+writer->used[slot],ptr,size);
+    writer->seg_offset[seg] = *handle;
+    writer->seg_size[seg] = size;
+    writer->nseg[slot]++;
+    writer->used[slot] += size;
+  }
+  *handle += size;
+  return _SUCCESS_;
+}
+
+int mat_writer_commit(mat_writer *writer){
+  /** Hand the slice to the output thread. Returns _FAILURE_ if an earlier
+      write has failed. */
+  int status;
+  if (writer->map != NULL){
+    if (msync(writer->map,writer->map_size,MS_ASYNC) != 0)
+      writer->status = _FAILURE_;
+    return writer->status;
+  }
+  if (writer->slots == 0){
+    if (writer->mode == _MAT_WRITER_FILE_)
+      fflush(writer->mat_file);
+    return writer->status;
+  }
+  pthread_mutex_lock(&(writer->lock));
+  writer->head = (writer->head+1)%writer->slots;
+  writer->count++;
+  status = writer->status;
+  pthread_cond_signal(&(writer->cond_data));
+  pthread_mutex_unlock(&(writer->lock));
+  return status;
+}
+
+int mat_writer_sync(mat_writer *writer){
+  /** Wait until the committed slices are written and push them to disk,
+      so that the file holds every output point handed to the writer. */
+  if (writer->slots > 0){
+    pthread_mutex_lock(&(writer->lock));
+    while (writer->count > 0)
+      pthread_cond_wait(&(writer->cond_space),&(writer->lock));
+    pthread_mutex_unlock(&(writer->lock));
+  }
+  if ((writer->map != NULL)&&(msync(writer->map,writer->map_size,MS_SYNC) != 0))
+    writer->status = _FAILURE_;
+  if ((fflush(writer->mat_file) != 0)||(fsync(fileno(writer->mat_file)) != 0))
+    writer->status = _FAILURE_;
+  return writer->status;
+}
+
+int mat_writer_segment(mat_writer *writer, long offset, char *data, size_t size){
+  /** Write size bytes at offset, or feed them to the stream of the
+      element they belong to. The segments of an element must arrive in
+      increasing order of offset. */
+  int i;
+  mat_stream *ms=NULL;
+  if (writer->mode != _MAT_WRITER_COMPRESSED_){
+    fseek(writer->mat_file,offset,SEEK_SET);
+    if (fwrite(data,1,size,writer->mat_file) != size)
+      return _FAILURE_;
+    return _SUCCESS_;
+  }
+  for (i=0; i<writer->nstreams; i++){
+    ms = writer->stream+i;
+    if ((offset >= ms->data)&&(offset+size <= ms->end))
+      break;
+  }
+  if (i == writer->nstreams)
+    return _FAILURE_;
+  if (ms->position < 0){
+    //Start the stream with the tag and header of the element:
+    ms->zs.zalloc = Z_NULL;
+    ms->zs.zfree = Z_NULL;
+    ms->zs.opaque = Z_NULL;
+    if (deflateInit(&(ms->zs),writer->level) != Z_OK)
+      return _FAILURE_;
+    ms->position = ms->start;
+    if (mat_writer_deflate_file(writer,ms,ms->data) == _FAILURE_)
+      return _FAILURE_;
+  }
+  if (offset < ms->position)
+    return _FAILURE_;
+  if (mat_writer_deflate_zeros(writer,ms,offset) == _FAILURE_)
+    return _FAILURE_;
+  ms->position += size;
+  return mat_writer_deflate(writer,ms,data,size,Z_NO_FLUSH);
+}
+
+int mat_writer_deflate(mat_writer *writer,
+		       mat_stream *ms,
+		       char *data,
+		       size_t size,
+		       int flush){
+  /** Deflate size bytes into the stream, and append the output to the
+      spool file. */
+  size_t have;
+  ms->zs.next_in = (Bytef *) data;
+  ms->zs.avail_in = size;
+  do {
+    ms->zs.next_out = writer->zbuf;
+    ms->zs.avail_out = _MAT_WRITER_CHUNK_;
+    if (deflate(&(ms->zs),flush) == Z_STREAM_ERROR)
+      return _FAILURE_;
+    have = _MAT_WRITER_CHUNK_-ms->zs.avail_out;
+    if (have > 0){
+      if (ms->chunks == ms->chunks_max){
+	ms->chunks_max = max(2*ms->chunks_max,16);
+	ms->chunk_offset = realloc(ms->chunk_offset,sizeof(long)*ms->chunks_max);
+	ms->chunk_size = realloc(ms->chunk_size,sizeof(size_t)*ms->chunks_max);
+	if ((ms->chunk_offset == NULL)||(ms->chunk_size == NULL))
+	  return _FAILURE_;
+      }
+      fseek(writer->spool,writer->spool_size,SEEK_SET);
+      if (fwrite(writer->zbuf,1,have,writer->spool) != have)
+	return _FAILURE_;
+      ms->chunk_offset[ms->chunks] = writer->spool_size;
+      ms->chunk_size[ms->chunks] = have;
+      ms->chunks++;
+      ms->compressed += have;
+      writer->spool_size += have;
+    }
+  } while (ms->zs.avail_out == 0);
+  return _SUCCESS_;
+}
+
+int mat_writer_deflate_file(mat_writer *writer, mat_stream *ms, long end){
+  /** Deflate the bytes of the uncompressed file from ms->position to end. */
+  char buffer[16384];
+  size_t size;
+  while (ms->position < end){
+    size = min(end-ms->position,(long) sizeof(buffer));
+    fseek(writer->mat_file,ms->position,SEEK_SET);
+    if (fread(buffer,1,size,writer->mat_file) != size)
+      return _FAILURE_;
+    if (mat_writer_deflate(writer,ms,buffer,size,Z_NO_FLUSH) == _FAILURE_)
+      return _FAILURE_;
+    ms->position += size;
+  }
+  return _SUCCESS_;
+}
+
+int mat_writer_deflate_zeros(mat_writer *writer, mat_stream *ms, long end){
+  /** Deflate zeros from ms->position to end, for columns not written. */
+  char buffer[16384];
+  size_t size;
+  memset(buffer,0,sizeof(buffer));
+  while (ms->position < end){
+    size = min(end-ms->position,(long) sizeof(buffer));
+    if (mat_writer_deflate(writer,ms,buffer,size,Z_NO_FLUSH) == _FAILURE_)
+      return _FAILURE_;
+    ms->position += size;
+  }
+  return _SUCCESS_;
+}
+
+int mat_writer_finish(mat_writer *writer){
+  /** End all streams and replace the file by the MAT header followed by
+      one miCOMPRESSED element per matrix. Elements that got no slices,
+      like the parameters, are deflated from the file. The uncompressed
+      file is kept if anything fails. */
+  char header[128], tmp_name[_FILENAMESIZE_+8], spool_name[_FILENAMESIZE_+8];
+  char *buffer=(char *) writer->zbuf;
+  uint32_t tag[2];
+  int i, k, status=_SUCCESS_;
+  long start;
+  mat_stream *ms;
+  FILE *out;
+
+  sprintf(tmp_name,"%s.tmp",writer->filename);
+  sprintf(spool_name,"%s.spool",writer->filename);
+  for (i=0; (i<writer->nstreams)&&(status==_SUCCESS_); i++){
+    ms = writer->stream+i;
+    if (ms->position < 0){
+      ms->zs.zalloc = Z_NULL;
+      ms->zs.zfree = Z_NULL;
+      ms->zs.opaque = Z_NULL;
+      if (deflateInit(&(ms->zs),writer->level) != Z_OK){
+	status = _FAILURE_;
+	break;
+      }
+      ms->position = ms->start;
+      status = mat_writer_deflate_file(writer,ms,ms->end);
+    }
+    else{
+      status = mat_writer_deflate_zeros(writer,ms,ms->end);
+    }
+    if (status == _SUCCESS_)
+      status = mat_writer_deflate(writer,ms,NULL,0,Z_FINISH);
+    deflateEnd(&(ms->zs));
+  }
+  //Streams that were started but not finished above:
+  for (k=i+1; k<writer->nstreams; k++){
+    if (writer->stream[k].position >= 0)
+      deflateEnd(&(writer->stream[k].zs));
+  }
+
+  out = fopen(tmp_name,"wb");
+  if (out == NULL)
+    status = _FAILURE_;
+  if (status == _SUCCESS_){
+    fseek(writer->mat_file,0,SEEK_SET);
+    if ((fread(header,1,128,writer->mat_file) != 128)||
+	(fwrite(header,1,128,out) != 128))
+      status = _FAILURE_;
+  }
+  for (i=0, start=128; (i<writer->nstreams)&&(status==_SUCCESS_); i++){
+    ms = writer->stream+i;
+    ms->start = start;
+    start += 8+ms->compressed;
+    tag[0] = miCOMPRESSED;
+    tag[1] = ms->compressed;
+    if (fwrite(tag,4,2,out) != 2)
+      status = _FAILURE_;
+    //Copy the chunks back from the spool file, zbuf is free by now:
+    for (k=0; (k<ms->chunks)&&(status==_SUCCESS_); k++){
+      fseek(writer->spool,ms->chunk_offset[k],SEEK_SET);
+      if ((fread(buffer,1,ms->chunk_size[k],writer->spool) != ms->chunk_size[k])||
+	  (fwrite(buffer,1,ms->chunk_size[k],out) != ms->chunk_size[k]))
+	status = _FAILURE_;
+    }
+  }
+  if ((out != NULL)&&(fclose(out) != 0))
+    status = _FAILURE_;
+  fclose(writer->spool);
+  remove(spool_name);
+  if (status == _SUCCESS_)
+    status = mat_writer_toc(writer);
+  for (i=0; i<writer->nstreams; i++){
+    free(writer->stream[i].chunk_offset);
+    free(writer->stream[i].chunk_size);
+    free(writer->stream[i].name);
+  }
+  free(writer->stream);
+  free(writer->zbuf);
+  writer->spool = NULL;
+  writer->stream = NULL;
+  writer->zbuf = NULL;
+  fclose(writer->mat_file);
+  writer->mat_file = NULL;
+  if (status == _SUCCESS_){
+    if (rename(tmp_name,writer->filename) != 0)
+      status = _FAILURE_;
+  }
+  else{
+    remove(tmp_name);
+  }
+  return status;
+}
+
+int mat_writer_chunk(mat_writer *writer, int *handle, size_t size){
+  /** Move *handle to the next block of columns when the block it points
+      into is full, and count the bytes written to the element. */
+  int i;
+  mat_stream *ms;
+  //Handles are in the last blocks, so search from the end:
+  for (i=writer->nstreams-1; i>=0; i--){
+    ms = writer->stream+i;
+    if ((*handle >= ms->data)&&(*handle <= ms->data+ms->size))
+      break;
+  }
+  if (i < 0)
+    return _FAILURE_;
+  if ((*handle == ms->data+ms->size)&&(size > 0)){
+    if ((ms->next < 0)&&(mat_writer_grow(writer) == _FAILURE_))
+      return _FAILURE_;
+    ms = writer->stream+writer->stream[i].next;
+    *handle = ms->data;
+  }
+  if (*handle+size > ms->data+ms->size)
+    return _FAILURE_;
+  ms->written = max(ms->written,*handle+size-ms->data);
+  return _SUCCESS_;
+}
+
+int mat_writer_grow(mat_writer *writer){
+  /** Append a block of columns for every element of the last block that
+      has been written to. The output thread is idle while the file grows. */
+  int i, n=writer->nstreams, handle;
+  char name[_FILENAMESIZE_];
+  mat_stream *ms;
+  if (writer->slots > 0){
+    pthread_mutex_lock(&(writer->lock));
+    while (writer->count > 0)
+      pthread_cond_wait(&(writer->cond_space),&(writer->lock));
+    pthread_mutex_unlock(&(writer->lock));
+  }
+  fflush(writer->mat_file);
+  for (i=0; i<n; i++){
+    if ((writer->stream[i].start < writer->block_start)||
+	(writer->stream[i].written == 0))
+      continue;
+    if (writer->nstreams%32 == 0){
+      writer->stream = realloc(writer->stream,
+			       sizeof(mat_stream)*(writer->nstreams+32));
+      if (writer->stream == NULL)
+	return _FAILURE_;
+    }
+    ms = writer->stream+writer->nstreams;
+    *ms = writer->stream[i];
+    ms->name = malloc(strlen(writer->stream[i].name)+1);
+    if (ms->name == NULL)
+      return _FAILURE_;
+    strcpy(ms->name,writer->stream[i].name);
+    ms->block = writer->blocks;
+    sprintf(name,"%s_%d",ms->name,ms->block);
+    if (mat_add_matrix(writer->filename,name,ms->data_type,
+		       ms->cols,ms->rows,&handle) == _FAILURE_)
+      return _FAILURE_;
+    ms->start = writer->file_end;
+    ms->data = handle;
+    ms->end = ms->data+(ms->end-writer->stream[i].data);
+    ms->written = 0;
+    ms->next = -1;
+    writer->stream[i].next = writer->nstreams;
+    writer->file_end = ms->end;
+    writer->nstreams++;
+  }
+  writer->block_start = writer->stream[n].start;
+  writer->blocks++;
+  return _SUCCESS_;
+}
+
+int mat_writer_trim(mat_writer *writer){
+  /** Drop the columns of the last block that were never written, and
+      truncate the file. Elements are moved towards the start of the
+      file, so each is read in full before it is written back. */
+  int i, status=_SUCCESS_;
+  long position=writer->block_start, bytes, padded, cols;
+  uint32_t uint32_tmp;
+  int32_t int32_tmp;
+  char *element;
+  mat_stream *ms;
+  for (i=0; (i<writer->nstreams)&&(status==_SUCCESS_); i++){
+    ms = writer->stream+i;
+    if (ms->start < writer->block_start)
+      continue;
+    bytes = ms->end-ms->start;
+    element = malloc(bytes);
+    if (element == NULL)
+      return _FAILURE_;
+    fseek(writer->mat_file,ms->start,SEEK_SET);
+    if (fread(element,1,bytes,writer->mat_file) != bytes)
+      status = _FAILURE_;
+    if ((ms->written > 0)&&(ms->written < ms->size)){
+      cols = (ms->written*ms->cols+ms->size-1)/ms->size;
+      uint32_tmp = ms->size/ms->cols*cols;
+      padded = 8*((uint32_tmp+7)/8);
+      bytes = ms->data-ms->start+padded;
+      memcpy(element+ms->data-ms->start-4,&uint32_tmp,4);
+      int32_tmp = cols;
+      memcpy(element+4*8+4,&int32_tmp,4);
+      uint32_tmp = bytes-8;
+      memcpy(element+4,&uint32_tmp,4);
+      ms->cols = cols;
+    }
+    ms->data += position-ms->start;
+    ms->start = position;
+    ms->end = position+bytes;
+    fseek(writer->mat_file,position,SEEK_SET);
+    if (fwrite(element,1,bytes,writer->mat_file) != bytes)
+      status = _FAILURE_;
+    position += bytes;
+    free(element);
+  }
+  fflush(writer->mat_file);
+  if (ftruncate(fileno(writer->mat_file),position) != 0)
+    status = _FAILURE_;
+  if (status == _SUCCESS_)
+    status = mat_writer_toc(writer);
+  return status;
+}
+
+int mat_writer_toc(mat_writer *writer){
+  /** Write the index of the file from the elements, after they have
+      been moved. */
+  int i;
+  char name[_FILENAMESIZE_];
+  mat_stream *ms;
+  if (mat_toc_create(writer->filename) == _FAILURE_)
+    return _FAILURE_;
+  for (i=0; i<writer->nstreams; i++){
+    ms = writer->stream+i;
+    if (ms->block == 0)
+      strcpy(name,ms->name);
+    else
+      sprintf(name,"%s_%d",ms->name,ms->block);
+    if (mat_toc_add(writer->filename,name,ms->start,ms->data_type,
+		    ms->rows,ms->cols) == _FAILURE_)
+      return _FAILURE_;
+  }
+  return _SUCCESS_;
+}
+
+int mat_writer_write_slot(mat_writer *writer, int slot){
+  /** Write the segments of one slot in the order they were added, so the
+      last segment reaches the file last. */
+  int k, seg, status=_SUCCESS_;
+  char *data=writer->data+slot*writer->max_bytes;
+  for (k=0; k<writer->nseg[slot]; k++){
+    seg = slot*writer->max_segments+k;
+    if (mat_writer_segment(writer,writer->seg_offset[seg],data,
+			   writer->seg_size[seg]) == _FAILURE_)
+      status = _FAILURE_;
+    data += writer->seg_size[seg];
+  }
+  if (writer->mode == _MAT_WRITER_FILE_)
+    fflush(writer->mat_file);
+  return status;
+}
+
+void *mat_writer_thread(void *arg){
+  /** Write committed slices until the writer is closed and the ring
+      buffer is empty. */
+  mat_writer *writer=arg;
+  int status;
+  pthread_mutex_lock(&(writer->lock));
+  for (;;){
+    while ((writer->count == 0)&&(writer->stop == _FALSE_))
+      pthread_cond_wait(&(writer->cond_data),&(writer->lock));
+    if (writer->count == 0)
+      break;
+    pthread_mutex_unlock(&(writer->lock));
+    status = mat_writer_write_slot(writer,writer->tail);
+    pthread_mutex_lock(&(writer->lock));
+    if (status == _FAILURE_)
+      writer->status = _FAILURE_;
+    writer->tail = (writer->tail+1)%writer->slots;
+    writer->count--;
+    pthread_cond_signal(&(writer->cond_space));
+  }
+  pthread_mutex_unlock(&(writer->lock));
+  return NULL;
+}
+
+int mat_writer_close(mat_writer *writer){
+  /** Write the remaining slices and close the file. In the compressed
+      mode this is where the compressed file is written. Safe to call on
+      a writer that is already closed. */
+  int i;
+  if (writer->mat_file == NULL)
+    return writer->status;
+  if (writer->slots > 0){
+    pthread_mutex_lock(&(writer->lock));
+    writer->stop = _TRUE_;
+    pthread_cond_signal(&(writer->cond_data));
+    pthread_mutex_unlock(&(writer->lock));
+    pthread_join(writer->thread,NULL);
+    pthread_mutex_destroy(&(writer->lock));
+    pthread_cond_destroy(&(writer->cond_data));
+    pthread_cond_destroy(&(writer->cond_space));
+    free(writer->data);
+    free(writer->seg_offset);
+    free(writer->seg_size);
+    free(writer->nseg);
+    free(writer->used);
+  }
+  if (writer->map != NULL){
+    if (msync(writer->map,writer->map_size,MS_SYNC) != 0)
+      writer->status = _FAILURE_;
+    munmap(writer->map,writer->map_size);
+    writer->map = NULL;
+  }
+  if (writer->mode == _MAT_WRITER_COMPRESSED_){
+    if (mat_writer_finish(writer) == _FAILURE_)
+      writer->status = _FAILURE_;
+    return writer->status;
+  }
+  if (writer->mode == _MAT_WRITER_CHUNKED_){
+    if (mat_writer_trim(writer) == _FAILURE_)
+      writer->status = _FAILURE_;
+    for (i=0; i<writer->nstreams; i++)
+      free(writer->stream[i].name);
+    free(writer->stream);
+    writer->stream = NULL;
+  }
+  if (fclose(writer->mat_file) != 0)
+    writer->status = _FAILURE_;
+  writer->mat_file = NULL;
+  return writer->status;
+}
@@ -44,8 +44,8 @@ int CreateMatrix_DNR(MultiMatrix *A,
 		     void *data,
 		     ErrorMsg error_message){
   DNRformat *Store;
-  double *x_dbl,**p2p_dbl;
-  double complex *x_dbl_cx,**p2p_dbl_cx;
+  double **p2p_dbl;
+  double complex **p2p_dbl_cx;
   int i;
 
   /** Important: data is assumed to be allocated and of size nrow*ncol+1.
@@ -98,7 +98,6 @@ int DestroyMultiMatrix(MultiMatrix *A){
       CreateMatrix_xxx. If the pointers to the actual
       storage Ax, Ai, Ap, data,... is not available,
       they should be freed before to avoid memory leak. */
-  int i;
   DNRformat *StoreDNR;
   if (A->Stype == L_DNR){
     StoreDNR = (DNRformat *) A->Store;
@@ -143,7 +142,7 @@ int PrintMultiMatrix(MultiMatrix *A, char* name){
 	  break;
 	case (L_DBL_CX):
 	  Mat_dbl_cx = StoreDNR->Matrix;
-	  if(Mat_dbl[j][i] == 0) printf("  0   ");
+	  if(Mat_dbl_cx[j][i] == 0) printf("  0   ");
 	  else printf("%6.0e+i%6.0e ",creal(Mat_dbl_cx[j][i]),cimag(Mat_dbl_cx[j][i]));
 	  break;
 	}
@@ -190,3 +189,59 @@ int PrintMultiMatrix(MultiMatrix *A, char* name){
   return _SUCCESS_;
 }
 
+int ZeroMultiMatrix(MultiMatrix *A){
+  /** Sets all stored values of a real matrix to zero. */
+  int i,n;
+  DNRformat *StoreDNR;
+  SCCformat *StoreSCC;
+  double *Ax;
+  switch(A->Stype){
+  case (L_DNR):
+    StoreDNR = A->Store;
+    Ax = StoreDNR->Data;
+    n = A->nrow*A->ncol+1;
+    break;
+  case (L_SCC):
+    StoreSCC = A->Store;
+    Ax = StoreSCC->Ax;
+    n = StoreSCC->Ap[A->ncol];
+    break;
+  default:
+    return _FAILURE_;
+  }
+  for (i=0; i<n; i++) Ax[i] = 0.0;
+  return _SUCCESS_;
+}
+
+int AddToMultiMatrixEntry(MultiMatrix *A, int row, int col, double value){
+  /** Adds value to the (0-based) entry (row,col) of a real matrix.
+      For L_SCC the row indices of each column must be sorted, and
+      entries outside the sparsity pattern are dropped, since they are
+      structurally zero. Returns _FALSE_ if the entry was dropped.*/
+  int lo,hi,mid;
+  DNRformat *StoreDNR;
+  SCCformat *StoreSCC;
+  switch(A->Stype){
+  case (L_DNR):
+    StoreDNR = A->Store;
+    ((double **) StoreDNR->Matrix)[row+1][col+1] += value;
+    return _TRUE_;
+  case (L_SCC):
+    StoreSCC = A->Store;
+    lo = StoreSCC->Ap[col];
+    hi = StoreSCC->Ap[col+1]-1;
+    while (lo<=hi){
+      mid = (lo+hi) >> 1;
+      if (StoreSCC->Ai[mid] < row)
+	lo = mid+1;
+      else if (StoreSCC->Ai[mid] > row)
+	hi = mid-1;
+      else{
+	((double *) StoreSCC->Ax)[mid] += value;
+	return _TRUE_;
+      }
+    }
+    break;
+  }
+  return _FALSE_;
+}
@@ -14,7 +14,6 @@ int Newton(int (*vecfun)(double * y, double * Fy, void *param),
   int i,*indx,err_idx=-1;
   int converged=_TRUE_;
   double reldif;
-  double abstol=1e-15;
 
   Fval = malloc(sizeof(double)*neq);
   vv = malloc(sizeof(double)*(neq+1));
@@ -84,6 +83,182 @@ int Newton(int (*vecfun)(double * y, double * Fy, void *param),
   }
 }
 
+int Newton_sparse(int (*vecfun)(double * y, double * Fy, void *param),
+		  int (*jacfun)(double * y, double * Jx, void *param),
+		  double *y0,
+		  void *param,
+		  double *maxstep,
+		  double rtol,
+		  int *iter,
+		  int maxiter,
+		  struct newton_workspace *ws,
+		  ErrorMsg error_message){
+  /** Newton's method for F(y)=0 with a sparse Jacobian. jacfun writes the
+      values of J in ws->J->Ax, on the pattern given to
+      newton_workspace_alloc. The LU of J is kept while J changes by less
+      than _NEWTON_REUSE_ relative to the J it was made from, and the step
+      is then a chord step. maxstep limits each component of the step as
+      in Newton, and a step that is limited is taken as it is. Otherwise a
+      step that does not decrease |F|^2 enough is halved, up to
+      _NEWTON_BACKTRACK_ times, after the LU has been renewed if it was an
+      old one. The iteration stops when the Newton step is below rtol
+      relative to y, as in Newton.
+
+      Every call starts with a decomposition with pivot search, so that the
+      result only depends on y0 and not on the calls before it. Nothing is
+      allocated. */
+  int n=ws->n, i, ls, fresh, limited, descent=_FALSE_, converged=_FALSE_;
+  double *F=ws->F, *Ftrial=ws->Ftrial, *dy=ws->dy, *ytrial=ws->ytrial, *tmp;
+  double fnorm, ftrial=0.0, lambda, reldif=0.0, change, jmax;
+
+  ws->pivots = _FALSE_;
+  vecfun(y0,F,param);
+  for (i=0, fnorm=0.0; i<n; i++) fnorm += F[i]*F[i];
+  for (*iter=1; *iter<=maxiter; (*iter)++){
+    if (fnorm == 0.0){
+      converged = _TRUE_;
+      break;
+    }
+    jacfun(y0,ws->J->Ax,param);
+    fresh = _TRUE_;
+    if (ws->pivots == _TRUE_){
+      change = 0.0; jmax = 0.0;
+      for (i=0; i<ws->J->Ap[n]; i++){
+	change = max(change,fabs(ws->J->Ax[i]-ws->Jlu[i]));
+	jmax = max(jmax,fabs(ws->Jlu[i]));
+      }
+      fresh = (change > _NEWTON_REUSE_*jmax);
+    }
+    for (;;){
+      if (fresh == _TRUE_){
+	lasagna_call(newton_factorise(ws,error_message),error_message,error_message);
+      }
+      else{
+	ws->reused++;
+      }
+      sp_lusolve(ws->N,F,dy);
+      limited = _FALSE_;
+      if (maxstep!=NULL){
+	for(i=0; i<n; i++){
+	  if (fabs(dy[i]) > maxstep[i]){
+	    dy[i] = (dy[i] > 0.0 ? maxstep[i] : -maxstep[i]);
+	    limited = _TRUE_;
+	  }
+	}
+      }
+      reldif = 0.0;
+      for (i=0; i<n; i++)
+	reldif = max(reldif,fabs(dy[i]/(y0[i]-dy[i]+DBL_MIN)));
+      if ((reldif < rtol)||(limited == _TRUE_))
+	break;
+      //Line search on |F|^2:
+      lambda = 1.0;
+      for (ls=0; ls<_NEWTON_BACKTRACK_; ls++){
+	for (i=0; i<n; i++) ytrial[i] = y0[i]-lambda*dy[i];
+	vecfun(ytrial,Ftrial,param);
+	for (i=0, ftrial=0.0; i<n; i++) ftrial += Ftrial[i]*Ftrial[i];
+	descent = (ftrial <= (1.0-2.0*_NEWTON_ARMIJO_*lambda)*fnorm);
+	if ((descent == _TRUE_)||(fresh == _FALSE_))
+	  break;
+	lambda *= 0.5;
+      }
+      if ((descent == _TRUE_)||(fresh == _TRUE_))
+	break;
+      //The old LU did not give a descent direction:
+      fresh = _TRUE_;
+    }
+    if (reldif < rtol){
+      //Converged, the last step is taken in full as in Newton:
+      for (i=0; i<n; i++) y0[i] -= dy[i];
+      converged = _TRUE_;
+      break;
+    }
+    if ((limited == _TRUE_)||(descent == _FALSE_)){
+      /** Without a line search, or without descent, which happens when |F|
+	  is at the level of the rounding errors, the full step is taken. */
+      for (i=0; i<n; i++) ytrial[i] = y0[i]-dy[i];
+      vecfun(ytrial,Ftrial,param);
+      for (i=0, ftrial=0.0; i<n; i++) ftrial += Ftrial[i]*Ftrial[i];
+    }
+    for (i=0; i<n; i++) y0[i] = ytrial[i];
+    tmp = F; F = Ftrial; Ftrial = tmp;
+    fnorm = ftrial;
+  }
+  ws->F = F;
+  ws->Ftrial = Ftrial;
+  lasagna_test(converged == _FALSE_, error_message,
+	       "Newton_sparse did not converge in %d iterations, max|dy/y|=%g.",
+	       maxiter,reldif);
+  return _SUCCESS_;
+}
+
+int newton_factorise(struct newton_workspace *ws,
+		     ErrorMsg error_message){
+  /** LU of ws->J. Within a call of Newton_sparse the pivot sequence of
+      its first decomposition is reused by sp_refactor while the pivots
+      stay stable, otherwise the pivots are searched again. */
+  double growth, ratio;
+  int n=ws->n;
+
+  if ((ws->pivots == _FALSE_)||
+      (sp_refactor(ws->N,ws->J) == _FAILURE_)||
+      (sp_factor_stability(ws->N,ws->J,&growth,&ratio) == _FAILURE_)||
+      (ratio < _NEWTON_PIVOT_RATIO_)){
+    lasagna_test(sp_ludcmp(ws->N,ws->J,0.1) == _FAILURE_, error_message,
+		 "The Jacobian of Newton_sparse is singular.");
+    ws->pivots = _TRUE_;
+  }
+  memcpy(ws->Jlu,ws->J->Ax,sizeof(double)*ws->J->Ap[n]);
+  ws->lu++;
+  return _SUCCESS_;
+}
+
+int newton_workspace_alloc(struct newton_workspace **ws,
+			   int n,
+			   int *Ap,
+			   int *Ai,
+			   ErrorMsg error_message){
+  /** Workspace of Newton_sparse for n equations with the Jacobian pattern
+      Ap, Ai in compressed columns. The columns are ordered by sp_amd on
+      the pattern of J+J^T. */
+  int nnz=Ap[n], *Cp, *Ci;
+
+  lasagna_alloc(*ws,sizeof(struct newton_workspace),error_message);
+  (*ws)->n = n;
+  (*ws)->pivots = _FALSE_;
+  (*ws)->lu = 0;
+  (*ws)->reused = 0;
+  lasagna_call(sp_mat_alloc(&((*ws)->J),n,n,nnz,error_message),
+	       error_message,error_message);
+  memcpy((*ws)->J->Ap,Ap,sizeof(int)*(n+1));
+  memcpy((*ws)->J->Ai,Ai,sizeof(int)*nnz);
+  lasagna_call(sp_num_alloc(&((*ws)->N),n,error_message),
+	       error_message,error_message);
+  lasagna_call(get_pattern_A_plus_AT(Ap,Ai,n,&Cp,&Ci,error_message),
+	       error_message,error_message);
+  sp_amd(Cp,Ci,n,Cp[n],(*ws)->N->q,(*ws)->N->wamd);
+  free(Cp);
+  free(Ci);
+  lasagna_alloc((*ws)->Jlu,sizeof(double)*nnz,error_message);
+  lasagna_alloc((*ws)->F,sizeof(double)*n,error_message);
+  lasagna_alloc((*ws)->Ftrial,sizeof(double)*n,error_message);
+  lasagna_alloc((*ws)->dy,sizeof(double)*n,error_message);
+  lasagna_alloc((*ws)->ytrial,sizeof(double)*n,error_message);
+  return _SUCCESS_;
+}
+
+int newton_workspace_free(struct newton_workspace *ws){
+  sp_mat_free(ws->J);
+  sp_num_free(ws->N);
+  free(ws->Jlu);
+  free(ws->F);
+  free(ws->Ftrial);
+  free(ws->dy);
+  free(ws->ytrial);
+  free(ws);
+  return _SUCCESS_;
+}
+
 int jacobian_for_Newton(int (*vecfun)(double * y, double * Fy, void *param),
 			double *y0,
 			double *Fval,
@@ -620,3 +620,229 @@ int parser_cat(
   return _SUCCESS_;
 
 }
+
+int parser_sweep_values(
+			char * value,
+			int * size,
+			double ** pointer_to_list,
+			short * logarithmic,
+			int * found,
+			ErrorMsg errmsg
+			) {
+  char * names[3] = {"logspace(","linspace(","values("};
+  char * string;
+  char * substring;
+  FileArg list;
+  double sign = 1.0, a, b;
+  int kind, n, i;
+
+  /* intialize the 'found' flag to false */
+
+  * found = _FALSE_;
+
+  /* check if the value is one of the sweep forms */
+
+  string = value;
+  if (string[0] == '-') {
+    sign = -1.0;
+    string++;
+  }
+  for (kind=0; kind < 3; kind++) {
+    if (strncmp(string,names[kind],strlen(names[kind])) == 0)
+      break;
+  }
+  if (kind == 3)
+    return _SUCCESS_;
+
+  string += strlen(names[kind]);
+  lasagna_test(strchr(string,')') == NULL,
+	     errmsg,
+	     "missing ')' in sweep %s\n",value);
+  strcpy(list,string);
+  *strchr(list,')') = '\0';
+
+  if (kind < 2) {
+
+    /* logspace(a,b,n) or linspace(a,b,n) */
+
+    lasagna_test((sscanf(list,"%lg , %lg , %d",&a,&b,&n) != 3) || (n < 1),
+	       errmsg,
+	       "could not read sweep %s, expected a, b and a positive number of values\n",value);
+    lasagna_alloc(*pointer_to_list,n*sizeof(double),errmsg);
+    for (i=0; i < n; i++) {
+      (*pointer_to_list)[i] = (n > 1 ? a+i*(b-a)/(n-1.0) : a);
+      if (kind == 0)
+	(*pointer_to_list)[i] = pow(10.0,(*pointer_to_list)[i]);
+      (*pointer_to_list)[i] *= sign;
+    }
+  }
+  else {
+
+    /* values(x1,x2,...) */
+
+    n = 1;
+    for (i=0; list[i] != '\0'; i++)
+      if (list[i] == ',') n++;
+    lasagna_alloc(*pointer_to_list,n*sizeof(double),errmsg);
+    substring = strtok(list,",");
+    for (i=0; i < n; i++) {
+      lasagna_test((substring == NULL) || (sscanf(substring,"%lg",&a) != 1),
+		 errmsg,
+		 "could not read value %d of sweep %s\n",i+1,value);
+      (*pointer_to_list)[i] = sign*a;
+      substring = strtok(NULL,",");
+    }
+  }
+
+  * size = n;
+  * logarithmic = (kind == 0 ? _TRUE_ : _FALSE_);
+  * found = _TRUE_;
+
+  return _SUCCESS_;
+
+}
+
+int parser_sweep_init(
+		      struct file_content * pfc,
+		      struct sweep_content * psw,
+		      ErrorMsg errmsg
+		      ) {
+  int i, found, size;
+  short logarithmic;
+  double * list;
+
+  /* count the swept parameters */
+
+  psw->dimensions = 0;
+  psw->runs = 1;
+  psw->refine = 0;
+  for (i=0; i < pfc->size; i++) {
+    lasagna_call(parser_sweep_values(pfc->value[i],&size,&list,&logarithmic,&found,errmsg),errmsg,errmsg);
+    if (found == _TRUE_) {
+      psw->dimensions++;
+      free(list);
+    }
+  }
+
+  lasagna_alloc(psw->entry,(psw->dimensions+1)*sizeof(int),errmsg);
+  lasagna_alloc(psw->size,(psw->dimensions+1)*sizeof(int),errmsg);
+  lasagna_alloc(psw->values,(psw->dimensions+1)*sizeof(double*),errmsg);
+  lasagna_alloc(psw->logarithmic,(psw->dimensions+1)*sizeof(short),errmsg);
+
+  /* keep their values */
+
+  psw->dimensions = 0;
+  for (i=0; i < pfc->size; i++) {
+    lasagna_call(parser_sweep_values(pfc->value[i],&size,&list,&logarithmic,&found,errmsg),errmsg,errmsg);
+    if (found == _TRUE_) {
+      psw->entry[psw->dimensions] = i;
+      psw->size[psw->dimensions] = size;
+      psw->values[psw->dimensions] = list;
+      psw->logarithmic[psw->dimensions] = logarithmic;
+      psw->runs *= size;
+      psw->dimensions++;
+    }
+  }
+
+  return _SUCCESS_;
+
+}
+
+int parser_sweep_run(
+		     const struct file_content * pfc,
+		     const struct sweep_content * psw,
+		     int run,
+		     struct file_content * pfc_run,
+		     ErrorMsg errmsg
+		     ) {
+  int i, d, stride;
+
+  lasagna_test((run < 0) || (run >= psw->runs),
+	     errmsg,
+	     "run %d is not one of the %d runs of the sweep\n",run,psw->runs);
+
+  /* copy the file_content, with the values of this run */
+
+  pfc_run->size = 0;
+  if (pfc->size == 0)
+    return _SUCCESS_;
+  lasagna_alloc(pfc_run->filename,(strlen(pfc->filename)+1)*sizeof(char),errmsg);
+  strcpy(pfc_run->filename,pfc->filename);
+  lasagna_call(parser_init(pfc_run,pfc->size,errmsg),errmsg,errmsg);
+  for (i=0; i < pfc->size; i++) {
+    strcpy(pfc_run->name[i],pfc->name[i]);
+    strcpy(pfc_run->value[i],pfc->value[i]);
+    pfc_run->read[i]=_FALSE_;
+  }
+
+  stride = 1;
+  for (d=0; d < psw->dimensions; d++) {
+    sprintf(pfc_run->value[psw->entry[d]],"%.17g",
+	    psw->values[d][(run/stride)%psw->size[d]]);
+    stride *= psw->size[d];
+  }
+
+  return _SUCCESS_;
+
+}
+
+int parser_sweep_refine(
+			struct sweep_content * psw,
+			int levels,
+			ErrorMsg errmsg
+			) {
+  int d, i, j, size, parts;
+  double * list;
+  double a, b;
+
+  lasagna_test((levels < 0) || (levels > 10),
+	     errmsg,
+	     "sweep refinement of %d levels, expected 0 to 10\n",levels);
+
+  /* put 2^levels-1 values between neighbouring values of each sweep, 
+     evenly spaced in the logarithm for logspace */
+
+  parts = 1 << levels;
+  psw->runs = 1;
+  for (d=0; d < psw->dimensions; d++) {
+    if (psw->size[d] > 1) {
+      size = (psw->size[d]-1)*parts+1;
+      lasagna_alloc(list,size*sizeof(double),errmsg);
+      for (i=0; i < psw->size[d]-1; i++) {
+	a = psw->values[d][i];
+	b = psw->values[d][i+1];
+	for (j=0; j < parts; j++) {
+	  if (psw->logarithmic[d] == _TRUE_)
+	    list[i*parts+j] = a*pow(b/a,j/(double)parts);
+	  else
+	    list[i*parts+j] = a+(b-a)*j/parts;
+	}
+      }
+      list[size-1] = psw->values[d][psw->size[d]-1];
+      free(psw->values[d]);
+      psw->values[d] = list;
+      psw->size[d] = size;
+    }
+    psw->runs *= psw->size[d];
+  }
+  psw->refine = levels;
+
+  return _SUCCESS_;
+
+}
+
+int parser_sweep_free(
+		      struct sweep_content * psw
+		      ) {
+  int d;
+
+  for (d=0; d < psw->dimensions; d++)
+    free(psw->values[d]);
+  free(psw->entry);
+  free(psw->size);
+  free(psw->values);
+  free(psw->logarithmic);
+
+  return _SUCCESS_;
+
+}
@@ -14,6 +14,7 @@
 
 #include "common.h"
 #include "sparse.h"
+#include <unistd.h>
 int sp_mat_alloc(sp_mat** A, int ncols, int nrows, int maxnz, ErrorMsg error_message){
   int ncp =  ncols+1;
   lasagna_alloc((*A),sizeof(sp_mat),error_message);
@@ -35,26 +36,45 @@ int sp_mat_free(sp_mat *A){
 }
 
 int sp_num_alloc(sp_num** N, int n, ErrorMsg error_message){
+  return sp_num_alloc_sized(N, n, 0, error_message);
+}
+
+int sp_num_alloc_sized(sp_num** N, int n, int lnz, ErrorMsg error_message){
+  /* With lnz<=0, L and U have room for n*(n+1)/2 entries each and xi for
+     n*n indices, enough for any matrix. Otherwise the storage is compact: 
+     L and U start with room for lnz entries, e.g. from sp_symbolic_fill,
+     the reach sets are packed, and sp_ludcmp makes room for more when the
+     pivoting needs it. */
   int maxnz, k;
   lasagna_alloc((*N),sizeof(sp_num),error_message);
-  maxnz = n*(n+1);
-  maxnz /=2;
+  maxnz = (lnz > 0 ? max(lnz,n) : (int) (((long) n*(n+1))/2));
   (*N)->n = n;
   lasagna_call(sp_mat_alloc(&((*N)->L), n, n, maxnz, error_message),
 	       error_message,error_message);
   lasagna_call(sp_mat_alloc(&((*N)->U), n, n, maxnz, error_message),
 	       error_message,error_message);
   lasagna_alloc((*N)->xi,n*sizeof(int*),error_message); 
-  /* I really want xi to be a vector of pointers to vectors. */
-  lasagna_alloc((*N)->xi[0],n*n*sizeof(int),error_message);
-  for (k=1;k<n;k++)	(*N)->xi[k] = (*N)->xi[k-1]+n; 
-  /*Assign pointers to rows.*/
+  if (lnz > 0){
+    (*N)->xicap = max(2*maxnz-n,n);
+    lasagna_alloc((*N)->xipack,(*N)->xicap*sizeof(int),error_message);
+    lasagna_alloc((*N)->xiwork,n*sizeof(int),error_message);
+    for (k=0;k<n;k++)	(*N)->xi[k] = (*N)->xipack;
+  }
+  else{
+    /* I really want xi to be a vector of pointers to vectors. */
+    (*N)->xicap = 0;
+    (*N)->xiwork = NULL;
+    lasagna_alloc((*N)->xipack,((size_t) n)*n*sizeof(int),error_message);
+    for (k=0;k<n;k++)	(*N)->xi[k] = (*N)->xipack+((size_t) k)*n; 
+    /*Assign pointers to rows.*/
+  }
   lasagna_alloc((*N)->topvec,n*sizeof(int),error_message);
   lasagna_alloc((*N)->pinv,n*sizeof(int),error_message);
   lasagna_alloc((*N)->p,n*sizeof(int),error_message);
   /* Has to be n+1 because sp_amd uses it for storage:*/
   lasagna_alloc((*N)->q,(n+1)*sizeof(int),error_message); 
   lasagna_alloc((*N)->w,n*sizeof(double),error_message);
+  lasagna_alloc((*N)->rs,n*sizeof(double),error_message);
   lasagna_alloc((*N)->wamd,(8*(n+1))*sizeof(int),error_message);	
   return _SUCCESS_;
 }
@@ -62,18 +82,84 @@ int sp_num_alloc(sp_num** N, int n, ErrorMsg error_message){
 int sp_num_free(sp_num *N){
   sp_mat_free(N->L);
   sp_mat_free(N->U);
-  free(N->xi[0]);
+  free(N->xipack);
+  free(N->xiwork);
   free(N->xi);
   free(N->topvec);
   free(N->pinv);
   free(N->p);
   if (N->q != NULL) free(N->q);
   free(N->w);
+  free(N->rs);
   free(N->wamd);
   free(N);
   return _SUCCESS_;
 }
 
+int sp_grow(int size, int need, int most){
+  /* New size of an array of size entries that needs need: at least half
+     as large again, but at most most. */
+  long grown = size+size/2;
+  return ((int) max((long) need,min(grown,(long) most)));
+}
+
+int sp_num_reserve(sp_num *N, int lnz, int unz){
+  /* Room for lnz entries in L and unz in U of a compact sp_num. The
+     entries already in L and U are kept. */
+  int most = (int) min(((long) N->n*(N->n+1))/2,(long) INT_MAX);
+  if (lnz > N->L->maxnz){
+    lnz = sp_grow(N->L->maxnz, lnz, most);
+    if (sp_mat_grow((void **) &(N->L->Ax), (void **) &(N->L->Ai), sizeof(double), lnz) == _FAILURE_)
+      return _FAILURE_;
+    N->L->maxnz = lnz;
+  }
+  if (unz > N->U->maxnz){
+    unz = sp_grow(N->U->maxnz, unz, most);
+    if (sp_mat_grow((void **) &(N->U->Ax), (void **) &(N->U->Ai), sizeof(double), unz) == _FAILURE_)
+      return _FAILURE_;
+    N->U->maxnz = unz;
+  }
+  return _SUCCESS_;
+}
+
+int sp_mat_grow(void **Ax, void **Ai, size_t size, int maxnz){
+  void *p;
+  p = realloc(*Ax, maxnz*size);
+  if (p == NULL) return _FAILURE_;
+  *Ax = p;
+  p = realloc(*Ai, maxnz*sizeof(int));
+  if (p == NULL) return _FAILURE_;
+  *Ai = p;
+  return _SUCCESS_;
+}
+
+void sp_reach_pack(int n, int ncols, int *topvec, int **xi, int *xipack){
+  /* Points xi[k], k<ncols, into xipack, which holds the reach sets 
+     xi[k][topvec[k]..n-1] one after the other. As with the 1-offset 
+     vectors elsewhere, xi[k] itself may point before xipack. */
+  int k;
+  long off=0;
+  for (k=0; k<ncols; k++){
+    xi[k] = xipack+off-topvec[k];
+    off += n-topvec[k];
+  }
+}
+
+int sp_reach_reserve(int n, int ncols, int *topvec, int **xi, int **xipack, 
+		     int *xicap, int need){
+  /* Room for need indices in the packed reach sets of a compact sp_num or
+     sp_num_cx, keeping the sets of the first ncols columns. */
+  int *p, cap;
+  if (need <= *xicap) return _SUCCESS_;
+  cap = sp_grow(*xicap, need, (int) min((long) n*n,(long) INT_MAX));
+  p = realloc(*xipack, cap*sizeof(int));
+  if (p == NULL) return _FAILURE_;
+  *xipack = p;
+  *xicap = cap;
+  sp_reach_pack(n, ncols, topvec, xi, p);
+  return _SUCCESS_;
+}
+
 int reachr(int Gncols, int *Bp, int *Bi, int *Gp, int *Gi, int k, int *xik,int *pinv){
   int p, top;
   top = Gncols;
@@ -127,17 +213,30 @@ int sp_splsolve(sp_mat *G, sp_mat *B, int k, int*xik, int top, double *x, int *p
 }
 
 int sp_ludcmp(sp_num *N, sp_mat *A, double pivtol){
-  double pivot, *Lx, *Ux, *x, a, t;
-  int *Lp, *Li, *Up, *Ui, *pinv, *pvec, *q;
-  int n, ipiv, k, top, p, i, col, lnz, unz;
+  /* With compact storage, the reach of column k is found in N->xiwork and
+     packed after the column. It fails if there is no room for the 
+     factors, as well as for a singular matrix. The entries of a column are
+     compared relative to the largest entry of their row in A, as in the
+     ludcmp of the dense wrapper, so that the rows with small entries keep
+     their accuracy next to rows that are larger by many orders of
+     magnitude. The diagonal is the pivot if it is at least pivtol times
+     the largest of them. */
+  double pivot, *Lx, *Ux, *x, *rs, a, t;
+  int *Lp, *Li, *Up, *Ui, *pinv, *pvec, *q, *xik;
+  int n, ipiv, k, top, p, i, col, lnz, unz, xnz;
   n = A->ncols; q = N->q;
   Li = N->L->Ai; Lp = N->L->Ap; Lx = N->L->Ax;
   Ui = N->U->Ai; Up = N->U->Ap; Ux = N->U->Ax;
-  lnz = 0; unz = 0;
-  x = N->w; pinv = N->pinv; pvec = N->p;
+  lnz = 0; unz = 0; xnz = 0;
+  x = N->w; pinv = N->pinv; pvec = N->p; rs = N->rs;
   for (i=0; i<n; i++) x[i]=0;
   for (i=0; i<n; i++) pinv[i] = -1;
   for (k=0; k<=n; k++) Lp[k] = 0;
+  for (i=0; i<n; i++) rs[i] = 0.0;
+  for (k=0; k<n; k++)
+    for (p=A->Ap[k]; p<A->Ap[k+1]; p++)
+      rs[A->Ai[p]] = max(rs[A->Ai[p]],fabs(A->Ax[p]));
+  for (i=0; i<n; i++) rs[i] = (rs[i] > 0.0 ? 1.0/rs[i] : 1.0);
 	
   for(k=0; k<n; k++){
     /* Triangular solve: */
@@ -145,16 +244,25 @@ int sp_ludcmp(sp_num *N, sp_mat *A, double pivtol){
     Up[k] = unz;
     col = q ? (q[k]) : k;
 		
-    top = reachr(N->L->ncols, A->Ap, A->Ai, N->L->Ap, N->L->Ai, col, N->xi[k], pinv);
+    xik = (N->xiwork != NULL ? N->xiwork : N->xi[k]);
+    top = reachr(N->L->ncols, A->Ap, A->Ai, N->L->Ap, N->L->Ai, col, xik, pinv);
     N->topvec[k] = top;
-    sp_splsolve(N->L, A, col, N->xi[k], top, x, pinv);
+    if (N->xiwork != NULL){
+      if ((sp_num_reserve(N, lnz+n-top+1, unz+n-top+1) == _FAILURE_)||
+	  (sp_reach_reserve(n, k, N->topvec, N->xi, &(N->xipack), &(N->xicap), 
+			    xnz+n-top) == _FAILURE_))
+	return _FAILURE_;
+      Li = N->L->Ai; Lx = N->L->Ax;
+      Ui = N->U->Ai; Ux = N->U->Ax;
+    }
+    sp_splsolve(N->L, A, col, xik, top, x, pinv);
     /* Find pivot: */
     ipiv = -1;
     a = -1;
     for(p=top; p<n; p++){
-      i = N->xi[k][p];
+      i = xik[p];
       if (pinv[i]<0){
-	t = fabs(x[i]);
+	t = fabs(x[i])*rs[i];
 	if (t>a){
 	  a = t;
 	  ipiv = i;
@@ -167,7 +275,7 @@ int sp_ludcmp(sp_num *N, sp_mat *A, double pivtol){
       }
     }
     if ((ipiv == -1)||(a<=0)) return _FAILURE_;
-    if ((pinv[col]<0) && (fabs(x[col])>=a*pivtol)) ipiv = col;
+    if ((pinv[col]<0) && (fabs(x[col])*rs[col]>=a*pivtol)) ipiv = col;
     /* Divide by pivot: */
     pivot = x[ipiv];
     Ui[unz] = k;
@@ -179,7 +287,7 @@ int sp_ludcmp(sp_num *N, sp_mat *A, double pivtol){
     Lx[lnz] = 1.0;
     lnz++;
     for (p=top; p<n; p++){
-      i = N->xi[k][p];
+      i = xik[p];
       if (pinv[i]<0){
 	Li[lnz] = i;
 	Lx[lnz] = x[i]/pivot;
@@ -187,6 +295,11 @@ int sp_ludcmp(sp_num *N, sp_mat *A, double pivtol){
       }
       x[i] = 0;
     }
+    if (N->xiwork != NULL){
+      memcpy(N->xipack+xnz, xik+top, (n-top)*sizeof(int));
+      N->xi[k] = N->xipack+xnz-top;
+      xnz += n-top;
+    }
   }
   /* Finalize: */
   Lp[n] = lnz;
@@ -226,6 +339,48 @@ int sp_lusolve(sp_num *N, double *b, double *x){
   return _SUCCESS_;
 }
 
+int sp_lusolve_many(sp_num *N, double *b, double *x, double *w, int k){
+  /* Solves for k right hand sides stored interleaved, b[i*k+r] is entry i
+     of vector r, so every entry of L and U is loaded once for all of them.
+     w is a work vector of length n*k, which is only used if N->q!=NULL. */
+  int p, j, r, n, *Ap, *Ai;
+  double *Ax, *xj, *xi, a;
+  n=N->n;
+  /* permute b and initialize x:*/
+  for (j=0; j<n; j++)
+    for (r=0; r<k; r++) x[N->pinv[j]*k+r] = b[j*k+r];
+  /* lower solve: */
+  Ap = N->L->Ap; Ai = N->L->Ai; Ax = N->L->Ax;
+  for (j=0; j<n; j++){
+    xj = x+j*k;
+    a = Ax[Ap[j]];
+    for (r=0; r<k; r++) xj[r] /= a;
+    for (p=Ap[j]+1; p<Ap[j+1]; p++){
+      xi = x+Ai[p]*k; a = Ax[p];
+#pragma omp simd
+      for (r=0; r<k; r++) xi[r] -= a*xj[r];
+    }
+  }
+  /* upper solve: */
+  Ap = N->U->Ap; Ai = N->U->Ai; Ax = N->U->Ax;
+  for (j=n-1; j>=0; j--){
+    xj = x+j*k;
+    a = Ax[Ap[j+1]-1];
+    for (r=0; r<k; r++) xj[r] /= a;
+    for (p=Ap[j];p<Ap[j+1]-1; p++){
+      xi = x+Ai[p]*k; a = Ax[p];
+#pragma omp simd
+      for (r=0; r<k; r++) xi[r] -= a*xj[r];
+    }
+  }
+  if (N->q!=NULL){
+    for(j=0;j<n*k;j++) w[j] = x[j];
+    for(j=0; j<n; j++)
+      for (r=0; r<k; r++) x[N->q[j]*k+r] = w[j*k+r];
+  }
+  return _SUCCESS_;
+}
+
 int sp_refactor(sp_num *N, sp_mat *A){
   double pivot, *Lx, *Ux, *x;
   int *Lp, *Li, *Up, *Ui, *pinv, *pvec, *q;
@@ -245,6 +400,10 @@ int sp_refactor(sp_num *N, sp_mat *A){
     col = q ? (q[k]) : k;
 		
     top = N->topvec[k];
+    /* Rows with pinv >= k see an empty column in sp_splsolve, starting at
+       Lx[Lp[k]] or Lx[0]. Set the unit diagonal first, so the old values 
+       in L are not needed: */
+    Lx[lnz] = 1;
     sp_splsolve(N->L, A, col, N->xi[k], top, x, pinv);
     /* Assign values to U and L: */
     ipiv = pvec[k];
@@ -276,6 +435,1018 @@ int sp_refactor(sp_num *N, sp_mat *A){
   return _SUCCESS_;
 }
 
+int sp_pivots_ok(sp_num *N, double pivtol){
+  /* Check that the factors satisfy the threshold pivoting rule of
+     sp_ludcmp, |L_ij| <= 1/pivtol, with finite non-zero pivots. Used when 
+     sp_refactor is run with a pivot sequence from another matrix. */
+  int j, n=N->n, *Up=N->U->Ap;
+  double *Lx=N->L->Ax, *Ux=N->U->Ax, d;
+  for (j=0; j<n; j++){
+    d = fabs(Ux[Up[j+1]-1]);
+    if ((d == 0.0)||(!isfinite(d))) return _FAILURE_;
+  }
+  for (j=0; j<N->L->Ap[n]; j++)
+    if (!(fabs(Lx[j])*pivtol <= 1.0)) return _FAILURE_;
+  return _SUCCESS_;
+}
+
+int sp_factor_stability(sp_num *N, sp_mat *A, double *growth, double *pivot_ratio){
+  /* Stability of the factors after sp_refactor. growth is max|U_ij|/max|A_ij|
+     and pivot_ratio is 1/max|L_ij|, which is the smallest ratio between a 
+     pivot and the largest entry below it. Fails for zero or non-finite 
+     pivots. */
+  int j, n=N->n, *Up=N->U->Ap;
+  double *Lx=N->L->Ax, *Ux=N->U->Ax, d, amax=0.0, umax=0.0, lmax=1.0;
+  for (j=0; j<n; j++){
+    d = fabs(Ux[Up[j+1]-1]);
+    if ((d == 0.0)||(!isfinite(d))) return _FAILURE_;
+  }
+  for (j=0; j<A->Ap[n]; j++) amax = max(amax,fabs(A->Ax[j]));
+  for (j=0; j<Up[n]; j++) umax = max(umax,fabs(Ux[j]));
+  for (j=0; j<N->L->Ap[n]; j++) lmax = max(lmax,fabs(Lx[j]));
+  if (!(isfinite(umax)&&isfinite(lmax))) return _FAILURE_;
+  *growth = (amax > 0.0) ? umax/amax : 1.0;
+  *pivot_ratio = 1.0/lmax;
+  return _SUCCESS_;
+}
+
+/* Single precision copies of the factors, for mixed precision solves. The
+   pattern is shared with N, so Lx and Ux need N->L->Ap[n] and N->U->Ap[n]
+   entries. */
+int sp_lu_demote(sp_num *N, float *Lx, float *Ux){
+  int p, n=N->n;
+  double *Ldx=N->L->Ax, *Udx=N->U->Ax;
+  for (p=0; p<N->L->Ap[n]; p++) Lx[p] = (float) Ldx[p];
+  for (p=0; p<N->U->Ap[n]; p++) Ux[p] = (float) Udx[p];
+  return _SUCCESS_;
+}
+
+int sp_lusolve_sgl(sp_num *N, float *Lx, float *Ux, double *b, double *x){
+  /* Same as sp_lusolve with the factor values from sp_lu_demote. The
+     vectors stay in double precision. */
+  int p, j, n, *Ap, *Ai;
+  double *w;
+  n=N->n;
+  for (j=0; j<n; j++) x[N->pinv[j]] = b[j];
+  Ap = N->L->Ap; Ai = N->L->Ai;
+  for (j=0; j<n; j++){
+    x[j] /=Lx[Ap[j]];
+    for (p=Ap[j]+1; p<Ap[j+1]; p++){
+      x[Ai[p]] -=Lx[p]*x[j];
+    }
+  }
+  Ap = N->U->Ap; Ai = N->U->Ai;
+  for (j=n-1; j>=0; j--){
+    x[j] /=Ux[Ap[j+1]-1];
+    for (p=Ap[j];p<Ap[j+1]-1; p++){
+      x[Ai[p]] -= Ux[p]*x[j];
+    }
+  }
+  if (N->q!=NULL){
+    w = N->w;
+    for(j=0;j<n;j++) w[j] = x[j];
+    for(j=0; j<n; j++) x[N->q[j]] = w[j];
+  }
+  return _SUCCESS_;
+}
+
+int sp_residual(sp_mat *A, double *x, double *b, double *r){
+  /* r = b - A x */
+  int j, p, n=A->ncols, *Ap=A->Ap, *Ai=A->Ai;
+  double *Ax=A->Ax, xj;
+  for (j=0; j<n; j++) r[j] = b[j];
+  for (j=0; j<n; j++){
+    xj = x[j];
+    for (p=Ap[j]; p<Ap[j+1]; p++) r[Ai[p]] -= Ax[p]*xj;
+  }
+  return _SUCCESS_;
+}
+
+/* Symbolic-analysis cache. The column ordering and the pivot sequence of
+   a sp_ludcmp depend only on the sparsity pattern (as long as the pivots
+   stay acceptable), so they can be stored in a file and reused by later
+   runs with the same pattern. sp_pattern_hash is the key, and the file
+   holds everything sp_refactor needs: q, pinv, p, topvec and the reach
+   sets xi[k][topvec[k]..n-1]. */
+unsigned int sp_pattern_hash(int n, int *Ap, int *Ai){
+  /* 32 bit FNV-1a of n, Ap and Ai: */
+  unsigned int h=2166136261u;
+  int j;
+  h = (h^((unsigned int) n))*16777619u;
+  for (j=0; j<=n; j++) h = (h^((unsigned int) Ap[j]))*16777619u;
+  for (j=0; j<Ap[n]; j++) h = (h^((unsigned int) Ai[j]))*16777619u;
+  return h;
+}
+
+int sp_symbolic_write(char *filename, unsigned int hash, int n, int nnz, 
+		      int *q, int *pinv, int *p, int *topvec, int **xi, 
+		      int lnz, int unz){
+  FILE *fid;
+  char tmpname[_FILENAMESIZE_+64];
+  int header[6], k, fail;
+  /* Write to a private file and rename it, so that concurrent runs never 
+     see a partial cache file: */
+  sprintf(tmpname,"%s.%d",filename,(int) getpid());
+  fid = fopen(tmpname,"wb");
+  if (fid == NULL) return _FAILURE_;
+  header[0] = _SP_CACHE_VERSION_; header[1] = (int) hash; header[2] = n;
+  header[3] = nnz; header[4] = lnz; header[5] = unz;
+  fail = (fwrite(header,sizeof(int),6,fid) != 6);
+  fail = fail || (fwrite(q,sizeof(int),n,fid) != n);
+  fail = fail || (fwrite(pinv,sizeof(int),n,fid) != n);
+  fail = fail || (fwrite(p,sizeof(int),n,fid) != n);
+  fail = fail || (fwrite(topvec,sizeof(int),n,fid) != n);
+  for (k=0; (k<n)&&(!fail); k++)
+    fail = (fwrite(xi[k]+topvec[k],sizeof(int),n-topvec[k],fid) != n-topvec[k]);
+  fail = (fclose(fid) != 0) || fail;
+  if ((fail)||(rename(tmpname,filename) != 0)){
+    remove(tmpname);
+    return _FAILURE_;
+  }
+  return _SUCCESS_;
+}
+
+int sp_symbolic_read(char *filename, unsigned int hash, int n, int nnz, 
+		     int *q, int *pinv, int *p, int *topvec, int **xi, 
+		     int **xipack, int *xicap, int *lnz, int *unz){
+  /* For compact storage xipack and xicap are those of the sp_num, and the
+     reach sets are packed there. Otherwise they are NULL. */
+  FILE *fid;
+  int header[6], k, fail;
+  long size;
+  fid = fopen(filename,"rb");
+  if (fid == NULL) return _FAILURE_;
+  fail = (fread(header,sizeof(int),6,fid) != 6);
+  fail = fail || (header[0] != _SP_CACHE_VERSION_) || (header[1] != (int) hash);
+  fail = fail || (header[2] != n) || (header[3] != nnz);
+  fail = fail || (fread(q,sizeof(int),n,fid) != n);
+  fail = fail || (fread(pinv,sizeof(int),n,fid) != n);
+  fail = fail || (fread(p,sizeof(int),n,fid) != n);
+  fail = fail || (fread(topvec,sizeof(int),n,fid) != n);
+  for (k=0, size=0; (k<n)&&(!fail); k++){
+    fail = (topvec[k]<0)||(topvec[k]>n);
+    size += n-topvec[k];
+  }
+  if ((!fail)&&(xipack != NULL)){
+    fail = (size > INT_MAX)||
+      (sp_reach_reserve(n, 0, topvec, xi, xipack, xicap, (int) size) == _FAILURE_);
+    if (!fail) sp_reach_pack(n, n, topvec, xi, *xipack);
+  }
+  for (k=0; (k<n)&&(!fail); k++)
+    fail = (fread(xi[k]+topvec[k],sizeof(int),n-topvec[k],fid) != n-topvec[k]);
+  fclose(fid);
+  if (fail) return _FAILURE_;
+  *lnz = header[4];
+  *unz = header[5];
+  return _SUCCESS_;
+}
+
+/* Level scheduled triangular solves. sp_lev_analyse computes the level 
+   sets of L and U after sp_ludcmp: every row in a level depends only on 
+   rows in earlier levels, so the rows of one level can be solved in 
+   parallel. The factors are also stored by rows, so that each row is a 
+   gather from x without write conflicts. The pattern is unchanged by 
+   sp_refactor, and sp_lev_update only has to copy the new values. */
+int sp_lev_alloc(sp_lev** V, int n, ErrorMsg error_message){
+  lasagna_alloc((*V),sizeof(sp_lev),error_message);
+  (*V)->n = n;
+  (*V)->nlevL = 0;
+  (*V)->nlevU = 0;
+  lasagna_alloc((*V)->Llev_p,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*V)->Llev_i,n*sizeof(int),error_message);
+  lasagna_alloc((*V)->Ulev_p,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*V)->Ulev_i,n*sizeof(int),error_message);
+  lasagna_alloc((*V)->Lrp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*V)->Urp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*V)->Udiag,n*sizeof(double),error_message);
+  lasagna_alloc((*V)->level,n*sizeof(int),error_message);
+  (*V)->Lrj = NULL; (*V)->Lrx = NULL; (*V)->Lmap = NULL;
+  (*V)->Urj = NULL; (*V)->Urx = NULL; (*V)->Umap = NULL;
+  (*V)->Lcap = 0; (*V)->Ucap = 0;
+  return _SUCCESS_;
+}
+
+int sp_lev_free(sp_lev *V){
+  free(V->Llev_p);
+  free(V->Llev_i);
+  free(V->Ulev_p);
+  free(V->Ulev_i);
+  free(V->Lrp);
+  free(V->Urp);
+  free(V->Udiag);
+  free(V->level);
+  if (V->Lrj != NULL) free(V->Lrj);
+  if (V->Lrx != NULL) free(V->Lrx);
+  if (V->Lmap != NULL) free(V->Lmap);
+  if (V->Urj != NULL) free(V->Urj);
+  if (V->Urx != NULL) free(V->Urx);
+  if (V->Umap != NULL) free(V->Umap);
+  free(V);
+  return _SUCCESS_;
+}
+
+int sp_lev_sets(int n, int nlev, int *level, int *lev_p, int *lev_i){
+  /* Sort the rows by level using a counting sort. */
+  int i, l;
+  for (l=0; l<=nlev; l++) lev_p[l] = 0;
+  for (i=0; i<n; i++) lev_p[level[i]+1]++;
+  for (l=0; l<nlev; l++) lev_p[l+1] += lev_p[l];
+  for (i=0; i<n; i++) lev_i[lev_p[level[i]]++] = i;
+  for (l=nlev; l>0; l--) lev_p[l] = lev_p[l-1];
+  lev_p[0] = 0;
+  return _SUCCESS_;
+}
+
+int sp_lev_analyse(sp_lev *V, sp_num *N, ErrorMsg error_message){
+  /* N must hold a factorization from sp_ludcmp. */
+  int n, i, j, p, pos, lnz, unz, *level;
+  int *Lp, *Li, *Up, *Ui;
+  n = V->n; level = V->level;
+  Lp = N->L->Ap; Li = N->L->Ai;
+  Up = N->U->Ap; Ui = N->U->Ai;
+  lnz = Lp[n]-n;
+  unz = Up[n]-n;
+  if (lnz > V->Lcap){
+    V->Lrj = realloc(V->Lrj,(lnz+1)*sizeof(int));
+    lasagna_test(V->Lrj==NULL,error_message,"Reallocate failed.");
+    V->Lrx = realloc(V->Lrx,(lnz+1)*sizeof(double));
+    lasagna_test(V->Lrx==NULL,error_message,"Reallocate failed.");
+    V->Lmap = realloc(V->Lmap,(lnz+1)*sizeof(int));
+    lasagna_test(V->Lmap==NULL,error_message,"Reallocate failed.");
+    V->Lcap = lnz;
+  }
+  if (unz > V->Ucap){
+    V->Urj = realloc(V->Urj,(unz+1)*sizeof(int));
+    lasagna_test(V->Urj==NULL,error_message,"Reallocate failed.");
+    V->Urx = realloc(V->Urx,(unz+1)*sizeof(double));
+    lasagna_test(V->Urx==NULL,error_message,"Reallocate failed.");
+    V->Umap = realloc(V->Umap,(unz+1)*sizeof(int));
+    lasagna_test(V->Umap==NULL,error_message,"Reallocate failed.");
+    V->Ucap = unz;
+  }
+  /* Levels of L. The diagonal is the first entry of each column: */
+  V->nlevL = 0;
+  for (i=0; i<n; i++) level[i] = 0;
+  for (j=0; j<n; j++){
+    V->nlevL = max(V->nlevL,level[j]+1);
+    for (p=Lp[j]+1; p<Lp[j+1]; p++)
+      level[Li[p]] = max(level[Li[p]],level[j]+1);
+  }
+  sp_lev_sets(n,V->nlevL,level,V->Llev_p,V->Llev_i);
+  /* Levels of U. The diagonal is the last entry of each column: */
+  V->nlevU = 0;
+  for (i=0; i<n; i++) level[i] = 0;
+  for (j=n-1; j>=0; j--){
+    V->nlevU = max(V->nlevU,level[j]+1);
+    for (p=Up[j]; p<Up[j+1]-1; p++)
+      level[Ui[p]] = max(level[Ui[p]],level[j]+1);
+  }
+  sp_lev_sets(n,V->nlevU,level,V->Ulev_p,V->Ulev_i);
+
+  /* Row storage of the off-diagonal parts, using level as counter: */
+  for (i=0; i<=n; i++) V->Lrp[i] = 0;
+  for (j=0; j<n; j++)
+    for (p=Lp[j]+1; p<Lp[j+1]; p++) V->Lrp[Li[p]+1]++;
+  for (i=0; i<n; i++) V->Lrp[i+1] += V->Lrp[i];
+  for (i=0; i<n; i++) level[i] = V->Lrp[i];
+  for (j=0; j<n; j++){
+    for (p=Lp[j]+1; p<Lp[j+1]; p++){
+      pos = level[Li[p]]++;
+      V->Lrj[pos] = j;
+      V->Lmap[pos] = p;
+    }
+  }
+  for (i=0; i<=n; i++) V->Urp[i] = 0;
+  for (j=0; j<n; j++)
+    for (p=Up[j]; p<Up[j+1]-1; p++) V->Urp[Ui[p]+1]++;
+  for (i=0; i<n; i++) V->Urp[i+1] += V->Urp[i];
+  for (i=0; i<n; i++) level[i] = V->Urp[i];
+  for (j=0; j<n; j++){
+    for (p=Up[j]; p<Up[j+1]-1; p++){
+      pos = level[Ui[p]]++;
+      V->Urj[pos] = j;
+      V->Umap[pos] = p;
+    }
+  }
+  sp_lev_update(V,N);
+  return _SUCCESS_;
+}
+
+int sp_lev_update(sp_lev *V, sp_num *N){
+  /* Copy the values of the factors in N. */
+  int n, j, p;
+  double *Lx, *Ux;
+  n = V->n;
+  Lx = N->L->Ax; Ux = N->U->Ax;
+  for (p=0; p<V->Lrp[n]; p++) V->Lrx[p] = Lx[V->Lmap[p]];
+  for (p=0; p<V->Urp[n]; p++) V->Urx[p] = Ux[V->Umap[p]];
+  for (j=0; j<n; j++) V->Udiag[j] = Ux[N->U->Ap[j+1]-1];
+  return _SUCCESS_;
+}
+
+int sp_lusolve_levels(sp_lev *V, sp_num *N, double *b, double *x, int threads){
+  /* Same as sp_lusolve, but the rows in each level are distributed over
+     threads. L has unit diagonal. */
+  int n, j, l, q, i, p;
+  double sum, *w;
+  n = V->n;
+  /* permute b and initialize x:*/
+  for (j=0; j<n; j++) x[N->pinv[j]] = b[j];
+#pragma omp parallel num_threads(threads) private(l,q,i,p,sum)
+  {
+    /* lower solve: */
+    for (l=0; l<V->nlevL; l++){
+#pragma omp for schedule(static)
+      for (q=V->Llev_p[l]; q<V->Llev_p[l+1]; q++){
+	i = V->Llev_i[q];
+	sum = x[i];
+	for (p=V->Lrp[i]; p<V->Lrp[i+1]; p++) sum -= V->Lrx[p]*x[V->Lrj[p]];
+	x[i] = sum;
+      }
+    }
+    /* upper solve: */
+    for (l=0; l<V->nlevU; l++){
+#pragma omp for schedule(static)
+      for (q=V->Ulev_p[l]; q<V->Ulev_p[l+1]; q++){
+	i = V->Ulev_i[q];
+	sum = x[i];
+	for (p=V->Urp[i]; p<V->Urp[i+1]; p++) sum -= V->Urx[p]*x[V->Urj[p]];
+	x[i] = sum/V->Udiag[i];
+      }
+    }
+  }
+  if (N->q!=NULL){
+    /* We must permute once more..*/
+    w = N->w;
+    for(j=0;j<n;j++) w[j] = x[j];
+    for(j=0; j<n; j++) x[N->q[j]] = w[j];
+  }
+  return _SUCCESS_;
+}
+
+/* Supernodal refactorization and solve. After sp_ludcmp has chosen the 
+   pivots and the structure of L and U, sp_super_symbolic groups consecutive
+   columns of L with identical structure below a dense diagonal block into
+   supernodes, and stores each of them as a dense column major block. The 
+   left-looking updates in sp_super_refactor and the forward substitution 
+   in sp_super_lusolve then work on contiguous dense blocks instead of 
+   scattered column entries. */
+int sp_super_alloc(sp_super** S, int n, ErrorMsg error_message){
+  lasagna_alloc((*S),sizeof(sp_super),error_message);
+  (*S)->n = n;
+  (*S)->nsuper = 0;
+  lasagna_alloc((*S)->super,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*S)->col_super,n*sizeof(int),error_message);
+  lasagna_alloc((*S)->Rp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*S)->Lxp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*S)->Up,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*S)->Udiag,n*sizeof(double),error_message);
+  lasagna_alloc((*S)->Segp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*S)->mark,n*sizeof(int),error_message);
+  lasagna_alloc((*S)->w,n*sizeof(double),error_message);
+  (*S)->Ri = NULL; (*S)->Lx = NULL;
+  (*S)->Ui = NULL; (*S)->Ux = NULL;
+  (*S)->Seg_s = NULL; (*S)->Seg_k = NULL;
+  (*S)->W = NULL;
+  (*S)->maxcols = 0;
+  (*S)->Ricap = 0; (*S)->Lxcap = 0; (*S)->Ucap = 0; (*S)->Segcap = 0; (*S)->Wcap = 0;
+  return _SUCCESS_;
+}
+
+int sp_super_free(sp_super *S){
+  free(S->super);
+  free(S->col_super);
+  free(S->Rp);
+  free(S->Lxp);
+  free(S->Up);
+  free(S->Udiag);
+  free(S->Segp);
+  free(S->mark);
+  free(S->w);
+  if (S->Ri != NULL) free(S->Ri);
+  if (S->Lx != NULL) free(S->Lx);
+  if (S->Ui != NULL) free(S->Ui);
+  if (S->Ux != NULL) free(S->Ux);
+  if (S->Seg_s != NULL) free(S->Seg_s);
+  if (S->Seg_k != NULL) free(S->Seg_k);
+  if (S->W != NULL) free(S->W);
+  free(S);
+  return _SUCCESS_;
+}
+
+int sp_super_symbolic(sp_super *S, sp_num *N, int maxsuper, double relax, ErrorMsg error_message){
+  /* N must hold a factorization from sp_ludcmp or sp_refactor. A supernode
+     is allowed to have a fraction relax of explicit zeros in its block. */
+  int n, j, k, p, r, c, s, t, f, l, ns, nr, nri, nlx, nseg, lnz, added, merge, idx;
+  int *Lp, *Li, *Up, *Ui, *mark, *pos, *Tp, *Ti, *R;
+  double *Lx, *Ux, *Tx, *B, block;
+  n = N->n; mark = S->mark;
+  Lp = N->L->Ap; Li = N->L->Ai; Lx = N->L->Ax;
+  Up = N->U->Ap; Ui = N->U->Ai; Ux = N->U->Ax;
+
+  /* Find supernodes. Column j joins the supernode s of column j-1 if
+     this adds few explicit zeros to the dense block of s (relaxed 
+     supernodes). While s is the last supernode, mark[i] == s if row i is
+     in the block of s, and Rp[s] holds the number of rows in the block.*/
+  for (j=0; j<n; j++) mark[j] = -1;
+  S->nsuper = 0;
+  lnz = 0;
+  for (j=0; j<n; j++){
+    s = S->nsuper-1;
+    merge = _FALSE_;
+    if ((j > 0)&&(j-S->super[s] < maxsuper)){
+      ns = j-S->super[s];
+      added = (mark[j] == s) ? 0 : 1;
+      for (p=Lp[j]; p<Lp[j+1]; p++){
+	if ((Li[p] != j)&&(mark[Li[p]] != s)) added++;
+      }
+      nr = S->Rp[s]+added;
+      block = (ns+1.0)*nr-0.5*ns*(ns+1.0);
+      if (block-(lnz+Lp[j+1]-Lp[j]) <= relax*block)
+	merge = _TRUE_;
+    }
+    if (merge == _TRUE_){
+      S->Rp[s] = nr;
+      lnz += Lp[j+1]-Lp[j];
+    }
+    else{
+      s = S->nsuper++;
+      S->super[s] = j;
+      S->Rp[s] = Lp[j+1]-Lp[j];
+      lnz = Lp[j+1]-Lp[j];
+    }
+    for (p=Lp[j]; p<Lp[j+1]; p++) mark[Li[p]] = s;
+    S->col_super[j] = s;
+  }
+  S->super[S->nsuper] = n;
+
+  /* Row structure and size of the dense blocks: */
+  nri = 0; nlx = 0;
+  for (s=0; s<S->nsuper; s++){
+    ns = S->super[s+1]-S->super[s];
+    nri += S->Rp[s];
+    nlx += S->Rp[s]*ns;
+  }
+  if (nri > S->Ricap){
+    S->Ri = realloc(S->Ri,nri*sizeof(int));
+    lasagna_test(S->Ri==NULL,error_message,"Reallocate failed.");
+    S->Ricap = nri;
+  }
+  if (nlx > S->Lxcap){
+    S->Lx = realloc(S->Lx,nlx*sizeof(double));
+    lasagna_test(S->Lx==NULL,error_message,"Reallocate failed.");
+    S->Lxcap = nlx;
+  }
+  lasagna_alloc(pos,n*sizeof(int),error_message);
+  for (j=0; j<n; j++) mark[j] = -1;
+  nri = 0; nlx = 0;
+  for (s=0; s<S->nsuper; s++){
+    f = S->super[s]; l = S->super[s+1]; ns = l-f;
+    nr = S->Rp[s];
+    S->Rp[s] = nri;
+    S->Lxp[s] = nlx;
+    /* Diagonal block first, then the rows below it: */
+    R = S->Ri+nri;
+    for (r=0; r<ns; r++){
+      R[r] = f+r;
+      mark[f+r] = s;
+      pos[f+r] = r;
+    }
+    r = ns;
+    for (p=Lp[f]; p<Lp[l]; p++){
+      if (mark[Li[p]] != s){
+	R[r] = Li[p];
+	mark[Li[p]] = s;
+	pos[Li[p]] = r;
+	r++;
+      }
+    }
+    lasagna_test(r != nr,error_message,"Inconsistent supernode structure.");
+    nri += nr;
+    /* Copy the values of L into the block: */
+    B = S->Lx+nlx;
+    for (c=0; c<ns; c++){
+      for (r=0; r<nr; r++) B[r+c*nr] = 0.0;
+      B[c+c*nr] = 1.0;
+      for (p=Lp[f+c]; p<Lp[f+c+1]; p++){
+	if (Li[p] != f+c) B[pos[Li[p]]+c*nr] = Lx[p];
+      }
+    }
+    nlx += nr*ns;
+  }
+  S->Rp[S->nsuper] = nri;
+  S->Lxp[S->nsuper] = nlx;
+  
+  /* Strictly upper part of U with sorted row indices, by transposing
+     twice. The diagonal is the last entry of each column of N->U. */
+  k = Up[n]-n;
+  if (k > S->Ucap){
+    S->Ui = realloc(S->Ui,k*sizeof(int));
+    lasagna_test(S->Ui==NULL,error_message,"Reallocate failed.");
+    S->Ux = realloc(S->Ux,k*sizeof(double));
+    lasagna_test(S->Ux==NULL,error_message,"Reallocate failed.");
+    S->Ucap = k;
+  }
+  lasagna_alloc(Tp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc(Ti,(k+1)*sizeof(int),error_message);
+  lasagna_alloc(Tx,(k+1)*sizeof(double),error_message);
+  for (j=0; j<=n; j++) Tp[j] = 0;
+  for (j=0; j<n; j++){
+    for (p=Up[j]; p<Up[j+1]-1; p++) Tp[Ui[p]+1]++;
+    S->Udiag[j] = Ux[Up[j+1]-1];
+  }
+  for (j=0; j<n; j++) Tp[j+1] += Tp[j];
+  for (j=0; j<n; j++) mark[j] = Tp[j];
+  for (j=0; j<n; j++){
+    for (p=Up[j]; p<Up[j+1]-1; p++){
+      idx = mark[Ui[p]]++;
+      Ti[idx] = j;
+      Tx[idx] = Ux[p];
+    }
+  }
+  for (j=0; j<=n; j++) S->Up[j] = 0;
+  for (p=0; p<k; p++) S->Up[Ti[p]+1]++;
+  for (j=0; j<n; j++) S->Up[j+1] += S->Up[j];
+  for (j=0; j<n; j++) mark[j] = S->Up[j];
+  for (r=0; r<n; r++){
+    for (p=Tp[r]; p<Tp[r+1]; p++){
+      idx = mark[Ti[p]]++;
+      S->Ui[idx] = r;
+      S->Ux[idx] = Tx[p];
+    }
+  }
+  free(Tp);
+  free(Ti);
+  free(Tx);
+
+  /* Supernodes updating each supernode t, in ascending order, together 
+     with the first column used. If U(k,j) is nonzero for k in supernode
+     s, the entries U(k',j) for k<k'<super[s+1] are either in the pattern
+     or are computed as exact zeros, so using the smallest such k for all
+     columns j in t is safe. pos is used for the first columns. */
+  for (s=0; s<S->nsuper; s++) mark[s] = -1;
+  nseg = 0;
+  for (idx=0; idx<2; idx++){
+    nseg = 0;
+    for (t=0; t<S->nsuper; t++){
+      if (idx == 1) S->Segp[t] = nseg;
+      for (j=S->super[t]; j<S->super[t+1]; j++){
+	for (p=S->Up[j]; p<S->Up[j+1]; p++){
+	  k = S->Ui[p];
+	  s = S->col_super[k];
+	  if (s == t) continue;
+	  if (mark[s] != t+idx*S->nsuper){
+	    mark[s] = t+idx*S->nsuper;
+	    pos[s] = k;
+	  }
+	  else if (k < pos[s])
+	    pos[s] = k;
+	}
+      }
+      for (s=0; s<t; s++){
+	if (mark[s] == t+idx*S->nsuper){
+	  if (idx == 1){
+	    S->Seg_s[nseg] = s;
+	    S->Seg_k[nseg] = pos[s];
+	  }
+	  nseg++;
+	}
+      }
+    }
+    if ((idx == 0)&&(nseg > S->Segcap)){
+      S->Seg_s = realloc(S->Seg_s,(nseg+1)*sizeof(int));
+      lasagna_test(S->Seg_s==NULL,error_message,"Reallocate failed.");
+      S->Seg_k = realloc(S->Seg_k,(nseg+1)*sizeof(int));
+      lasagna_test(S->Seg_k==NULL,error_message,"Reallocate failed.");
+      S->Segcap = nseg;
+    }
+  }
+  S->Segp[S->nsuper] = nseg;
+  free(pos);
+
+  /* Dense panels for the columns of one supernode: */
+  S->maxcols = 0;
+  for (s=0; s<S->nsuper; s++)
+    S->maxcols = max(S->maxcols,S->super[s+1]-S->super[s]);
+  if (n*S->maxcols > S->Wcap){
+    S->W = realloc(S->W,n*S->maxcols*sizeof(double));
+    lasagna_test(S->W==NULL,error_message,"Reallocate failed.");
+    S->Wcap = n*S->maxcols;
+  }
+  return _SUCCESS_;
+}
+
+void sp_dense_update(int nrow, int ncol, int nk, double *B, int ldb, 
+		     double *X, int ldx, double *Y, int *R, int ldy){
+  /* Y[R[r]+c*ldy] -= sum_k B[r+k*ldb]*X[k+c*ldx] for r<nrow, c<ncol. 
+     Blocks of eight rows and four columns are accumulated in a small 
+     array, with simd inner loops over the rows so the compiler keeps it
+     in vector registers. The rows of B in a block stay in cache while all
+     columns are processed. */
+  int r, c, k, i, jc;
+  double *Bk, xk, sum;
+  for (r=0; r+7<nrow; r+=8){
+    for (c=0; c+3<ncol; c+=4){
+      double a[4][8];
+      for (jc=0; jc<4; jc++)
+	for (i=0; i<8; i++) a[jc][i] = 0.0;
+      for (k=0; k<nk; k++){
+	Bk = B+k*ldb+r;
+	for (jc=0; jc<4; jc++){
+	  xk = X[(c+jc)*ldx+k];
+#pragma omp simd
+	  for (i=0; i<8; i++) a[jc][i] += Bk[i]*xk;
+	}
+      }
+      for (jc=0; jc<4; jc++)
+	for (i=0; i<8; i++) Y[R[r+i]+(c+jc)*ldy] -= a[jc][i];
+    }
+    for ( ; c<ncol; c++){
+      double b[8];
+      for (i=0; i<8; i++) b[i] = 0.0;
+      for (k=0; k<nk; k++){
+	Bk = B+k*ldb+r;
+	xk = X[c*ldx+k];
+#pragma omp simd
+	for (i=0; i<8; i++) b[i] += Bk[i]*xk;
+      }
+      for (i=0; i<8; i++) Y[R[r+i]+c*ldy] -= b[i];
+    }
+  }
+  for ( ; r<nrow; r++){
+    for (c=0; c<ncol; c++){
+      sum = 0.0;
+      for (k=0; k<nk; k++) sum += B[k*ldb+r]*X[c*ldx+k];
+      Y[R[r]+c*ldy] -= sum;
+    }
+  }
+}
+
+int sp_super_refactor(sp_super *S, sp_num *N, sp_mat *A){
+  /* Refactor A using the pivots in N and the structure in S. The columns
+     of each supernode t are computed together in the dense panel W, and 
+     each supernode s updating t is applied as a dense triangular solve 
+     followed by a dense matrix-matrix product. */
+  double *W, *Wc, *B, *Bc, *Bt, xc, pivot;
+  int *pinv, *q, *R, *Rt;
+  int n, j, p, col, g, s, t, f, ft, ns, nt, nr, nrt, c, c0, cs, r;
+  n = S->n; W = S->W;
+  pinv = N->pinv; q = N->q;
+  for (p=0; p<n*S->maxcols; p++) W[p] = 0.0;
+  for (t=0; t<S->nsuper; t++){
+    ft = S->super[t];
+    nt = S->super[t+1]-ft;
+    nrt = S->Rp[t+1]-S->Rp[t];
+    Rt = S->Ri+S->Rp[t];
+    Bt = S->Lx+S->Lxp[t];
+    for (c=0; c<nt; c++){
+      col = q ? (q[ft+c]) : ft+c;
+      Wc = W+c*n;
+      for (p=A->Ap[col]; p<A->Ap[col+1]; p++) Wc[pinv[A->Ai[p]]] = A->Ax[p];
+    }
+    /* Updates from the supernodes to the left: */
+    for (g=S->Segp[t]; g<S->Segp[t+1]; g++){
+      s = S->Seg_s[g];
+      f = S->super[s];
+      ns = S->super[s+1]-f;
+      nr = S->Rp[s+1]-S->Rp[s];
+      R = S->Ri+S->Rp[s];
+      B = S->Lx+S->Lxp[s];
+      c0 = S->Seg_k[g]-f;
+      /* Dense unit lower triangular solve with the diagonal block: */
+      for (c=0; c<nt; c++){
+	Wc = W+c*n+f;
+	for (cs=c0; cs<ns; cs++){
+	  xc = Wc[cs];
+	  if (xc == 0.0) continue;
+	  Bc = B+cs*nr;
+	  for (r=cs+1; r<ns; r++) Wc[r] -= Bc[r]*xc;
+	}
+      }
+      if (nr == ns) continue;
+      /* Dense product with the rows below: */
+      sp_dense_update(nr-ns,nt,ns-c0,B+c0*nr+ns,nr,W+f+c0,n,W,R+ns,n);
+    }
+    /* Factorise the panel itself, column by column: */
+    for (c=0; c<nt; c++){
+      j = ft+c;
+      Wc = W+c*n;
+      for (cs=0; cs<c; cs++){
+	xc = Wc[ft+cs];
+	if (xc == 0.0) continue;
+	Bc = Bt+cs*nrt;
+	for (r=cs+1; r<c; r++) Wc[ft+r] -= Bc[r]*xc;
+      }
+      if (c > 0)
+	sp_dense_update(nrt-c,1,c,Bt+c,nrt,Wc+ft,n,Wc,Rt+c,n);
+      pivot = Wc[j];
+      if (pivot == 0.0) return _FAILURE_;
+      S->Udiag[j] = pivot;
+      Bc = Bt+c*nrt;
+      for (r=c+1; r<nrt; r++) Bc[r] = Wc[Rt[r]]/pivot;
+    }
+    /* Assign values to U and clean up the panel: */
+    for (c=0; c<nt; c++){
+      j = ft+c;
+      Wc = W+c*n;
+      for (p=S->Up[j]; p<S->Up[j+1]; p++){
+	S->Ux[p] = Wc[S->Ui[p]];
+	Wc[S->Ui[p]] = 0.0;
+      }
+      for (r=0; r<nrt; r++) Wc[Rt[r]] = 0.0;
+    }
+  }
+  return _SUCCESS_;
+}
+
+int sp_super_lusolve(sp_super *S, sp_num *N, double *b, double *x){
+  int n, j, p, s, f, ns, nr, c, r, *R;
+  double *B, *Bc, *w, xc;
+  n = S->n;
+  /* permute b and initialize x:*/
+  for (j=0; j<n; j++) x[N->pinv[j]] = b[j];
+  /* lower solve, one supernode at a time: */
+  for (s=0; s<S->nsuper; s++){
+    f = S->super[s];
+    ns = S->super[s+1]-f;
+    nr = S->Rp[s+1]-S->Rp[s];
+    R = S->Ri+S->Rp[s];
+    B = S->Lx+S->Lxp[s];
+    for (c=0; c<ns; c++){
+      xc = x[f+c];
+      Bc = B+c*nr;
+      for (r=c+1; r<ns; r++) x[f+r] -= Bc[r]*xc;
+    }
+    if (nr > ns)
+      sp_dense_update(nr-ns,1,ns,B+ns,nr,x+f,n,x,R+ns,n);
+  }
+  /* upper solve: */
+  for (j=n-1; j>=0; j--){
+    x[j] /= S->Udiag[j];
+    xc = x[j];
+    for (p=S->Up[j]; p<S->Up[j+1]; p++) x[S->Ui[p]] -= S->Ux[p]*xc;
+  }
+  if (N->q!=NULL){
+    /* We must permute once more..*/
+    w = S->w;
+    for(j=0;j<n;j++) w[j] = x[j];
+    for(j=0; j<n; j++) x[N->q[j]] = w[j];
+  }
+  return _SUCCESS_;
+}
+
+/* Incomplete LU factorization and preconditioned GMRES. sp_ilu_symbolic 
+   finds the pattern of ILU(k) for the pattern Ap/Ai by the level of fill
+   rule: entries of A have level 0, and eliminating with row m gives entry
+   (i,j) the level lev(i,m)+lev(m,j)+1, which is kept if it is at most k.
+   The factors are stored by rows, with L unit lower triangular. Amap 
+   points back to the CSC entries of A, so sp_ilu_factor only needs the 
+   new values. There is no fill beyond the level k pattern, so the memory
+   is a small multiple of nnz(A). */
+int sp_ilu_symbolic(sp_ilu **M, int n, int *Ap, int *Ai, int fill, 
+		    int is_complex, ErrorMsg error_message){
+  int *Cp, *Cj, *Cmap, *next, *lev, *amap, *Rlev;
+  int i, j, m, p, r, nl, cap, nz, prev;
+  lasagna_alloc((*M),sizeof(sp_ilu),error_message);
+  (*M)->n = n;
+  /* Row form of the pattern of A with the diagonal always present. Rows
+     receive their columns in increasing order: */
+  lasagna_calloc(Cp,n+1,sizeof(int),error_message);
+  lasagna_alloc(Cj,(Ap[n]+n)*sizeof(int),error_message);
+  lasagna_alloc(Cmap,(Ap[n]+n)*sizeof(int),error_message);
+  for (j=0; j<n; j++){
+    Cp[j+1]++;
+    for (p=Ap[j]; p<Ap[j+1]; p++)
+      if (Ai[p] != j) Cp[Ai[p]+1]++;
+  }
+  for (i=0; i<n; i++) Cp[i+1] += Cp[i];
+  lasagna_alloc(next,(n+1)*sizeof(int),error_message);
+  for (i=0; i<n; i++) next[i] = Cp[i];
+  for (j=0; j<n; j++){
+    Cj[next[j]] = j;
+    Cmap[next[j]] = -1;
+    for (p=Ap[j]; p<Ap[j+1]; p++){
+      i = Ai[p];
+      if (i == j){
+	Cmap[next[j]] = p;
+	continue;
+      }
+      Cj[next[i]] = j;
+      Cmap[next[i]] = p;
+      next[i]++;
+    }
+    next[j]++;
+  }
+  /* Rows of the factors. next is a sorted linked list of the columns in 
+     the current row, terminated by n, and lev[j] is the level of column j
+     (fill+1 if not in the row): */
+  cap = 2*Cp[n];
+  lasagna_alloc((*M)->Rp,(n+1)*sizeof(int),error_message);
+  lasagna_alloc((*M)->diag,n*sizeof(int),error_message);
+  lasagna_alloc((*M)->Rj,cap*sizeof(int),error_message);
+  lasagna_alloc((*M)->Amap,cap*sizeof(int),error_message);
+  lasagna_alloc(Rlev,cap*sizeof(int),error_message);
+  lasagna_alloc(lev,n*sizeof(int),error_message);
+  lasagna_alloc(amap,n*sizeof(int),error_message);
+  for (j=0; j<n; j++) lev[j] = fill+1;
+  nz = 0;
+  for (i=0; i<n; i++){
+    (*M)->Rp[i] = nz;
+    prev = n;
+    for (p=Cp[i+1]-1; p>=Cp[i]; p--){
+      j = Cj[p];
+      next[j] = prev;
+      prev = j;
+      lev[j] = 0;
+      amap[j] = Cmap[p];
+    }
+    next[n] = prev;
+    /* Eliminate with the rows m<i in increasing order: */
+    for (m=next[n]; m<i; m=next[m]){
+      r = m;
+      for (p=(*M)->diag[m]+1; p<(*M)->Rp[m+1]; p++){
+	j = (*M)->Rj[p];
+	nl = lev[m]+Rlev[p]+1;
+	if (nl > fill) continue;
+	if (lev[j] > fill){
+	  /* Insert the fill entry j after r; the columns only increase: */
+	  while (next[r] < j) r = next[r];
+	  next[j] = next[r];
+	  next[r] = j;
+	  lev[j] = nl;
+	  amap[j] = -1;
+	}
+	else if (nl < lev[j])
+	  lev[j] = nl;
+	r = j;
+      }
+    }
+    /* Store the row and reset lev: */
+    for (j=next[n]; j<n; j=next[j]){
+      if (nz == cap){
+	cap *= 2;
+	(*M)->Rj = realloc((*M)->Rj,cap*sizeof(int));
+	lasagna_test((*M)->Rj==NULL,error_message,"Reallocate failed.");
+	(*M)->Amap = realloc((*M)->Amap,cap*sizeof(int));
+	lasagna_test((*M)->Amap==NULL,error_message,"Reallocate failed.");
+	Rlev = realloc(Rlev,cap*sizeof(int));
+	lasagna_test(Rlev==NULL,error_message,"Reallocate failed.");
+      }
+      if (j == i) (*M)->diag[i] = nz;
+      (*M)->Rj[nz] = j;
+      (*M)->Amap[nz] = amap[j];
+      Rlev[nz] = lev[j];
+      lev[j] = fill+1;
+      nz++;
+    }
+  }
+  (*M)->Rp[n] = nz;
+  (*M)->nnz = nz;
+  (*M)->Rx = NULL;
+  (*M)->Rz = NULL;
+  if (is_complex == _TRUE_){
+    lasagna_alloc((*M)->Rz,nz*sizeof(double complex),error_message);
+  }
+  else{
+    lasagna_alloc((*M)->Rx,nz*sizeof(double),error_message);
+  }
+  lasagna_alloc((*M)->iw,n*sizeof(int),error_message);
+  for (j=0; j<n; j++) (*M)->iw[j] = -1;
+  free(Cp); free(Cj); free(Cmap); free(next); free(lev); free(amap); free(Rlev);
+  return _SUCCESS_;
+}
+
+int sp_ilu_free(sp_ilu *M){
+  free(M->Rp);
+  free(M->Rj);
+  free(M->diag);
+  free(M->Amap);
+  free(M->iw);
+  if (M->Rx != NULL) free(M->Rx);
+  if (M->Rz != NULL) free(M->Rz);
+  free(M);
+  return _SUCCESS_;
+}
+
+int sp_ilu_factor(sp_ilu *M, double *Ax){
+  /* Row by row (IKJ) elimination restricted to the pattern of M: */
+  int i, j, p, r, n=M->n, *Rp=M->Rp, *Rj=M->Rj, *diag=M->diag, *iw=M->iw;
+  double *Rx=M->Rx, lik;
+  for (p=0; p<M->nnz; p++)
+    Rx[p] = (M->Amap[p] >= 0) ? Ax[M->Amap[p]] : 0.0;
+  for (i=0; i<n; i++){
+    for (p=Rp[i]; p<Rp[i+1]; p++) iw[Rj[p]] = p;
+    for (p=Rp[i]; p<diag[i]; p++){
+      j = Rj[p];
+      lik = Rx[p]/Rx[diag[j]];
+      Rx[p] = lik;
+      for (r=diag[j]+1; r<Rp[j+1]; r++)
+	if (iw[Rj[r]] >= 0) Rx[iw[Rj[r]]] -= lik*Rx[r];
+    }
+    for (p=Rp[i]; p<Rp[i+1]; p++) iw[Rj[p]] = -1;
+    if ((Rx[diag[i]] == 0.0)||(!isfinite(Rx[diag[i]]))) return _FAILURE_;
+  }
+  return _SUCCESS_;
+}
+
+int sp_ilu_solve(sp_ilu *M, double *x){
+  /* Solve (LU) x = b in place: */
+  int i, p, n=M->n, *Rp=M->Rp, *Rj=M->Rj, *diag=M->diag;
+  double *Rx=M->Rx, s;
+  for (i=0; i<n; i++){
+    s = x[i];
+    for (p=Rp[i]; p<diag[i]; p++) s -= Rx[p]*x[Rj[p]];
+    x[i] = s;
+  }
+  for (i=n-1; i>=0; i--){
+    s = x[i];
+    for (p=diag[i]+1; p<Rp[i+1]; p++) s -= Rx[p]*x[Rj[p]];
+    x[i] = s/Rx[diag[i]];
+  }
+  return _SUCCESS_;
+}
+
+int sp_gmres(sp_mat *A, sp_ilu *M, double *b, double *x, int m, int maxit, 
+	     double tol, double *work, int *iter){
+  /* Restarted GMRES(m) for A x = b, right preconditioned by M and started
+     from x=0. Converged when |b-Ax| <= tol*|b|, at most maxit iterations.
+     work must hold _SP_GMRES_WORK_(n,m) doubles. */
+  int n=A->ncols, i, j, k, p, it=0;
+  double *V, *H, *g, *c, *s, *y, *w, *z, beta, bnrm, h, t, d;
+  V = work; w = V+(m+1)*n; z = w+n; H = z+n; g = H+(m+1)*m; 
+  c = g+m+1; s = c+m; y = s+m;
+  for (i=0; i<n; i++) x[i] = 0.0;
+  for (bnrm=0.0, i=0; i<n; i++) bnrm += b[i]*b[i];
+  bnrm = sqrt(bnrm);
+  *iter = 0;
+  if (bnrm == 0.0) return _SUCCESS_;
+  /* The residual of x = 0, in case maxit is 0: */
+  beta = bnrm;
+  while (it < maxit){
+    /* r = b - A x: */
+    for (i=0; i<n; i++) V[i] = b[i];
+    for (j=0; j<n; j++)
+      for (p=A->Ap[j]; p<A->Ap[j+1]; p++) V[A->Ai[p]] -= A->Ax[p]*x[j];
+    for (beta=0.0, i=0; i<n; i++) beta += V[i]*V[i];
+    beta = sqrt(beta);
+    if (beta <= tol*bnrm) break;
+    for (i=0; i<n; i++) V[i] /= beta;
+    for (i=0; i<=m; i++) g[i] = 0.0;
+    g[0] = beta;
+    for (k=0; (k<m)&&(it<maxit); k++, it++){
+      /* w = A M^{-1} v_k, orthogonalised against V by modified Gram-Schmidt: */
+      for (i=0; i<n; i++) z[i] = V[k*n+i];
+      sp_ilu_solve(M,z);
+      for (i=0; i<n; i++) w[i] = 0.0;
+      for (j=0; j<n; j++)
+	for (p=A->Ap[j]; p<A->Ap[j+1]; p++) w[A->Ai[p]] += A->Ax[p]*z[j];
+      for (j=0; j<=k; j++){
+	for (h=0.0, i=0; i<n; i++) h += V[j*n+i]*w[i];
+	for (i=0; i<n; i++) w[i] -= h*V[j*n+i];
+	H[j*m+k] = h;
+      }
+      for (h=0.0, i=0; i<n; i++) h += w[i]*w[i];
+      h = sqrt(h);
+      if (h > 0.0) 
+	for (i=0; i<n; i++) V[(k+1)*n+i] = w[i]/h;
+      /* Apply the previous rotations and make a new one for H[k+1][k]=h: */
+      for (j=0; j<k; j++){
+	t = c[j]*H[j*m+k]+s[j]*H[(j+1)*m+k];
+	H[(j+1)*m+k] = -s[j]*H[j*m+k]+c[j]*H[(j+1)*m+k];
+	H[j*m+k] = t;
+      }
+      d = sqrt(H[k*m+k]*H[k*m+k]+h*h);
+      if (d == 0.0) return _FAILURE_;
+      c[k] = H[k*m+k]/d;
+      s[k] = h/d;
+      H[k*m+k] = d;
+      g[k+1] = -s[k]*g[k];
+      g[k] = c[k]*g[k];
+      if ((fabs(g[k+1]) <= tol*bnrm)||(h == 0.0)){
+	k++; it++;
+	break;
+      }
+    }
+    /* Solve the triangular system and update x += M^{-1} V y: */
+    for (j=k-1; j>=0; j--){
+      t = g[j];
+      for (i=j+1; i<k; i++) t -= H[j*m+i]*y[i];
+      y[j] = t/H[j*m+j];
+    }
+    for (i=0; i<n; i++) w[i] = 0.0;
+    for (j=0; j<k; j++)
+      for (i=0; i<n; i++) w[i] += y[j]*V[j*n+i];
+    sp_ilu_solve(M,w);
+    for (i=0; i<n; i++) x[i] += w[i];
+    if (fabs(g[k]) <= tol*bnrm){
+      *iter = it;
+      return _SUCCESS_;
+    }
+  }
+  *iter = it;
+  return (beta <= tol*bnrm) ? _SUCCESS_ : _FAILURE_;
+}
+
 int column_grouping(sp_mat *G, int *col_g, int *filled){
   int curcol,testcol,groupnum,fitted;
   size_t neq;
@@ -720,6 +1891,50 @@ int sp_tdfs(int j, int k, int *head, const int *next, int *post, int *stack){
   return (k);
 }
 
+int sp_symbolic_fill(int *Cp, int *Ci, int n, int *P, int *W){
+  /** Number of nonzeros, diagonal included, of the Cholesky factor of 
+      C(P,P) for a pattern C with both triangles, e.g. from 
+      get_pattern_A_plus_AT. It is an estimate of nnz(L) and nnz(U) of an 
+      LU decomposition with column ordering P. W is a work array of 4*n. */
+  return (sp_symbolic_colcount(Cp, Ci, n, P, W, NULL));
+}
+
+int sp_symbolic_colcount(int *Cp, int *Ci, int n, int *P, int *W, int *count){
+  /** As sp_symbolic_fill, and if count!=NULL, count[k] is the number of
+      nonzeros in column k of the factor, diagonal included. An LU 
+      decomposition with these counts in L and U costs 
+      sum_k (count[k]-1)*(2*count[k]-1) flops. */
+  int *parent=W, *ancestor=W+n, *mark=W+2*n, *pinv=W+3*n;
+  int i, k, p, inext, lnz=n;
+  for (k=0; k<n; k++) pinv[P[k]] = k;
+  if (count != NULL)
+    for (k=0; k<n; k++) count[k] = 1;
+  //Elimination tree by path compression:
+  for (k=0; k<n; k++){
+    parent[k] = -1;
+    ancestor[k] = -1;
+    for (p=Cp[P[k]]; p<Cp[P[k]+1]; p++){
+      for (i=pinv[Ci[p]]; (i!=-1)&&(i<k); i=inext){
+	inext = ancestor[i];
+	ancestor[i] = k;
+	if (inext == -1) parent[i] = k;
+      }
+    }
+  }
+  //Row k of the factor is the subtree of the etree reached from row k of C:
+  for (k=0; k<n; k++){
+    mark[k] = k;
+    for (p=Cp[P[k]]; p<Cp[P[k]+1]; p++){
+      for (i=pinv[Ci[p]]; (i<k)&&(mark[i]!=k); i=parent[i]){
+	mark[i] = k;
+	lnz++;
+	if (count != NULL) count[i]++;
+      }
+    }
+  }
+  return (lnz);
+}
+
 	
 //Complex versions:
 int sp_mat_alloc_cx(sp_mat_cx** A, 
@@ -749,26 +1964,42 @@ int sp_mat_free_cx(sp_mat_cx *A){
 int sp_num_alloc_cx(sp_num_cx** N, 
 		    int n, 
 		    ErrorMsg error_message){
+  return sp_num_alloc_sized_cx(N, n, 0, error_message);
+}
+
+int sp_num_alloc_sized_cx(sp_num_cx** N, 
+			  int n, 
+			  int lnz,
+			  ErrorMsg error_message){
+  /* As sp_num_alloc_sized. */
   int maxnz, k;
   lasagna_alloc((*N),sizeof(sp_num_cx),error_message);
-  maxnz = n*(n+1);
-  maxnz /=2;
+  maxnz = (lnz > 0 ? max(lnz,n) : (int) (((long) n*(n+1))/2));
   (*N)->n = n;
   lasagna_call(sp_mat_alloc_cx(&((*N)->L), n, n, maxnz, error_message),
 	       error_message,error_message);
   lasagna_call(sp_mat_alloc_cx(&((*N)->U), n, n, maxnz, error_message),
 	       error_message,error_message);
   lasagna_alloc((*N)->xi,n*sizeof(int*),error_message); 
-  /* I really want xi to be a vector of pointers to vectors. */
-  lasagna_alloc((*N)->xi[0],n*n*sizeof(int),error_message);
-  for (k=1;k<n;k++)	(*N)->xi[k] = (*N)->xi[k-1]+n; 
-  /*Assign pointers to rows.*/
+  if (lnz > 0){
+    (*N)->xicap = max(2*maxnz-n,n);
+    lasagna_alloc((*N)->xipack,(*N)->xicap*sizeof(int),error_message);
+    lasagna_alloc((*N)->xiwork,n*sizeof(int),error_message);
+    for (k=0;k<n;k++)	(*N)->xi[k] = (*N)->xipack;
+  }
+  else{
+    (*N)->xicap = 0;
+    (*N)->xiwork = NULL;
+    lasagna_alloc((*N)->xipack,((size_t) n)*n*sizeof(int),error_message);
+    for (k=0;k<n;k++)	(*N)->xi[k] = (*N)->xipack+((size_t) k)*n; 
+  }
   lasagna_alloc((*N)->topvec,n*sizeof(int),error_message);
   lasagna_alloc((*N)->pinv,n*sizeof(int),error_message);
   lasagna_alloc((*N)->p,n*sizeof(int),error_message);
   /* Has to be n+1 because sp_amd uses it for storage:*/
   lasagna_alloc((*N)->q,(n+1)*sizeof(int),error_message); 
   lasagna_alloc((*N)->w,n*sizeof(double complex),error_message);
+  lasagna_alloc((*N)->rs,n*sizeof(double),error_message);
   lasagna_alloc((*N)->wamd,(8*(n+1))*sizeof(int),error_message);	
   return _SUCCESS_;
 }
@@ -776,18 +2007,40 @@ int sp_num_alloc_cx(sp_num_cx** N,
 int sp_num_free_cx(sp_num_cx *N){
   sp_mat_free_cx(N->L);
   sp_mat_free_cx(N->U);
-  free(N->xi[0]);
+  free(N->xipack);
+  free(N->xiwork);
   free(N->xi);
   free(N->topvec);
   free(N->pinv);
   free(N->p);
   if (N->q != NULL) free(N->q);
   free(N->w);
+  free(N->rs);
   free(N->wamd);
   free(N);
   return _SUCCESS_;
 }
 
+int sp_num_reserve_cx(sp_num_cx *N, int lnz, int unz){
+  /* As sp_num_reserve. */
+  int most = (int) min(((long) N->n*(N->n+1))/2,(long) INT_MAX);
+  if (lnz > N->L->maxnz){
+    lnz = sp_grow(N->L->maxnz, lnz, most);
+    if (sp_mat_grow((void **) &(N->L->Ax), (void **) &(N->L->Ai), sizeof(double complex), 
+		    lnz) == _FAILURE_)
+      return _FAILURE_;
+    N->L->maxnz = lnz;
+  }
+  if (unz > N->U->maxnz){
+    unz = sp_grow(N->U->maxnz, unz, most);
+    if (sp_mat_grow((void **) &(N->U->Ax), (void **) &(N->U->Ai), sizeof(double complex), 
+		    unz) == _FAILURE_)
+      return _FAILURE_;
+    N->U->maxnz = unz;
+  }
+  return _SUCCESS_;
+}
+
 int sp_splsolve_cx(sp_mat_cx *G, 
 		sp_mat_cx *B, 
 		int k, 
@@ -820,18 +2073,24 @@ int sp_splsolve_cx(sp_mat_cx *G,
 int sp_ludcmp_cx(sp_num_cx *N, 
 		 sp_mat_cx *A, 
 		 double pivtol){
+  /* As sp_ludcmp. */
   double complex pivot, *Lx, *Ux, *x; 
-  double a, t;
-  int *Lp, *Li, *Up, *Ui, *pinv, *pvec, *q;
-  int n, ipiv, k, top, p, i, col, lnz, unz;
+  double a, t, *rs;
+  int *Lp, *Li, *Up, *Ui, *pinv, *pvec, *q, *xik;
+  int n, ipiv, k, top, p, i, col, lnz, unz, xnz;
   n = A->ncols; q = N->q;
   Li = N->L->Ai; Lp = N->L->Ap; Lx = N->L->Ax;
   Ui = N->U->Ai; Up = N->U->Ap; Ux = N->U->Ax;
-  lnz = 0; unz = 0;
-  x = N->w; pinv = N->pinv; pvec = N->p;
+  lnz = 0; unz = 0; xnz = 0;
+  x = N->w; pinv = N->pinv; pvec = N->p; rs = N->rs;
   for (i=0; i<n; i++) x[i]=0;
   for (i=0; i<n; i++) pinv[i] = -1;
   for (k=0; k<=n; k++) Lp[k] = 0;
+  for (i=0; i<n; i++) rs[i] = 0.0;
+  for (k=0; k<n; k++)
+    for (p=A->Ap[k]; p<A->Ap[k+1]; p++)
+      rs[A->Ai[p]] = max(rs[A->Ai[p]],cabs(A->Ax[p]));
+  for (i=0; i<n; i++) rs[i] = (rs[i] > 0.0 ? 1.0/rs[i] : 1.0);
 	
   for(k=0; k<n; k++){
     /* Triangular solve: */
@@ -839,16 +2098,25 @@ int sp_ludcmp_cx(sp_num_cx *N,
     Up[k] = unz;
     col = q ? (q[k]) : k;
 		
-    top = reachr(N->L->ncols, A->Ap, A->Ai, N->L->Ap, N->L->Ai, col, N->xi[k], pinv);
+    xik = (N->xiwork != NULL ? N->xiwork : N->xi[k]);
+    top = reachr(N->L->ncols, A->Ap, A->Ai, N->L->Ap, N->L->Ai, col, xik, pinv);
     N->topvec[k] = top;
-    sp_splsolve_cx(N->L, A, col, N->xi[k], top, x, pinv);
+    if (N->xiwork != NULL){
+      if ((sp_num_reserve_cx(N, lnz+n-top+1, unz+n-top+1) == _FAILURE_)||
+	  (sp_reach_reserve(n, k, N->topvec, N->xi, &(N->xipack), &(N->xicap), 
+			    xnz+n-top) == _FAILURE_))
+	return _FAILURE_;
+      Li = N->L->Ai; Lx = N->L->Ax;
+      Ui = N->U->Ai; Ux = N->U->Ax;
+    }
+    sp_splsolve_cx(N->L, A, col, xik, top, x, pinv);
     /* Find pivot: */
     ipiv = -1;
     a = -1;
     for(p=top; p<n; p++){
-      i = N->xi[k][p];
+      i = xik[p];
       if (pinv[i]<0){
-	t = cabs(x[i]);
+	t = cabs(x[i])*rs[i];
 	if (t>a){
 	  a = t;
 	  ipiv = i;
@@ -861,7 +2129,7 @@ int sp_ludcmp_cx(sp_num_cx *N,
       }
     }
     if ((ipiv == -1)||(a<=0)) return _FAILURE_;
-    if ((pinv[col]<0) && (cabs(x[col])>=a*pivtol)) ipiv = col;
+    if ((pinv[col]<0) && (cabs(x[col])*rs[col]>=a*pivtol)) ipiv = col;
     /* Divide by pivot: */
     pivot = x[ipiv];
     Ui[unz] = k;
@@ -873,7 +2141,7 @@ int sp_ludcmp_cx(sp_num_cx *N,
     Lx[lnz] = 1.0;
     lnz++;
     for (p=top; p<n; p++){
-      i = N->xi[k][p];
+      i = xik[p];
       if (pinv[i]<0){
 	Li[lnz] = i;
 	Lx[lnz] = x[i]/pivot;
@@ -881,6 +2149,11 @@ int sp_ludcmp_cx(sp_num_cx *N,
       }
       x[i] = 0;
     }
+    if (N->xiwork != NULL){
+      memcpy(N->xipack+xnz, xik+top, (n-top)*sizeof(int));
+      N->xi[k] = N->xipack+xnz-top;
+      xnz += n-top;
+    }
   }
   /* Finalize: */
   Lp[n] = lnz;
@@ -922,6 +2195,43 @@ int sp_lusolve_cx(sp_num_cx *N,
   return _SUCCESS_;
 }
 
+int sp_lusolve_many_cx(sp_num_cx *N, double complex *b, double complex *x,
+		       double complex *w, int k){
+  int p, j, r, n, *Ap, *Ai;
+  double complex *Ax, *xj, *xi, a;
+  n=N->n;
+  for (j=0; j<n; j++)
+    for (r=0; r<k; r++) x[N->pinv[j]*k+r] = b[j*k+r];
+  Ap = N->L->Ap; Ai = N->L->Ai; Ax = N->L->Ax;
+  for (j=0; j<n; j++){
+    xj = x+j*k;
+    a = Ax[Ap[j]];
+    for (r=0; r<k; r++) xj[r] /= a;
+    for (p=Ap[j]+1; p<Ap[j+1]; p++){
+      xi = x+Ai[p]*k; a = Ax[p];
+#pragma omp simd
+      for (r=0; r<k; r++) xi[r] -= a*xj[r];
+    }
+  }
+  Ap = N->U->Ap; Ai = N->U->Ai; Ax = N->U->Ax;
+  for (j=n-1; j>=0; j--){
+    xj = x+j*k;
+    a = Ax[Ap[j+1]-1];
+    for (r=0; r<k; r++) xj[r] /= a;
+    for (p=Ap[j];p<Ap[j+1]-1; p++){
+      xi = x+Ai[p]*k; a = Ax[p];
+#pragma omp simd
+      for (r=0; r<k; r++) xi[r] -= a*xj[r];
+    }
+  }
+  if (N->q!=NULL){
+    for(j=0;j<n*k;j++) w[j] = x[j];
+    for(j=0; j<n; j++)
+      for (r=0; r<k; r++) x[N->q[j]*k+r] = w[j*k+r];
+  }
+  return _SUCCESS_;
+}
+
 int sp_refactor_cx(sp_num_cx *N, 
 		   sp_mat_cx *A){
   double complex pivot, *Lx, *Ux, *x;
@@ -942,6 +2252,7 @@ int sp_refactor_cx(sp_num_cx *N,
     col = q ? (q[k]) : k;
 		
     top = N->topvec[k];
+    Lx[lnz] = 1;
     sp_splsolve_cx(N->L, A, col, N->xi[k], top, x, pinv);
     /* Assign values to U and L: */
     ipiv = pvec[k];
@@ -973,6 +2284,367 @@ int sp_refactor_cx(sp_num_cx *N,
   return _SUCCESS_;
 }
 
+int sp_pivots_ok_cx(sp_num_cx *N, double pivtol){
+  int j, n=N->n, *Up=N->U->Ap;
+  double complex *Lx=N->L->Ax, *Ux=N->U->Ax;
+  double d;
+  for (j=0; j<n; j++){
+    d = cabs(Ux[Up[j+1]-1]);
+    if ((d == 0.0)||(!isfinite(d))) return _FAILURE_;
+  }
+  for (j=0; j<N->L->Ap[n]; j++)
+    if (!(cabs(Lx[j])*pivtol <= 1.0)) return _FAILURE_;
+  return _SUCCESS_;
+}
+
+int sp_factor_stability_cx(sp_num_cx *N, sp_mat_cx *A, double *growth, double *pivot_ratio){
+  int j, n=N->n, *Up=N->U->Ap;
+  double complex *Lx=N->L->Ax, *Ux=N->U->Ax;
+  double d, amax=0.0, umax=0.0, lmax=1.0;
+  for (j=0; j<n; j++){
+    d = cabs(Ux[Up[j+1]-1]);
+    if ((d == 0.0)||(!isfinite(d))) return _FAILURE_;
+  }
+  for (j=0; j<A->Ap[n]; j++) amax = max(amax,cabs(A->Ax[j]));
+  for (j=0; j<Up[n]; j++) umax = max(umax,cabs(Ux[j]));
+  for (j=0; j<N->L->Ap[n]; j++) lmax = max(lmax,cabs(Lx[j]));
+  if (!(isfinite(umax)&&isfinite(lmax))) return _FAILURE_;
+  *growth = (amax > 0.0) ? umax/amax : 1.0;
+  *pivot_ratio = 1.0/lmax;
+  return _SUCCESS_;
+}
+
+/* Complex factors with split real and imaginary parts. sp_ludcmp_cx does the
+   pivot search on the interleaved values in N, and sp_split_from_cx copies
+   its factors to S. sp_refactor_split_cx and sp_lusolve_split_cx then only
+   use the pattern of N, and their inner loops are real multiply-adds over
+   unit stride values, which vectorise. */
+int sp_split_alloc_cx(sp_split_cx **S, int n, int nnz, ErrorMsg error_message){
+  lasagna_alloc((*S),sizeof(sp_split_cx),error_message);
+  (*S)->n = n;
+  (*S)->nnz = nnz;
+  (*S)->size = 0;
+  (*S)->Lre = NULL; (*S)->Lim = NULL;
+  (*S)->Ure = NULL; (*S)->Uim = NULL;
+  (*S)->amax = 0.0;
+  lasagna_alloc((*S)->Are,max(nnz,1)*sizeof(double),error_message);
+  lasagna_alloc((*S)->Aim,max(nnz,1)*sizeof(double),error_message);
+  /* Zero on entry to and exit from the factorisations and solves: */
+  lasagna_calloc((*S)->wre,n,sizeof(double),error_message);
+  lasagna_calloc((*S)->wim,n,sizeof(double),error_message);
+  return _SUCCESS_;
+}
+
+int sp_split_free_cx(sp_split_cx *S){
+  free(S->Lre); free(S->Lim);
+  free(S->Ure); free(S->Uim);
+  free(S->Are); free(S->Aim);
+  free(S->wre); free(S->wim);
+  free(S);
+  return _SUCCESS_;
+}
+
+int sp_split_from_cx(sp_split_cx *S, sp_num_cx *N, ErrorMsg error_message){
+  /* Copy the factors of the last sp_ludcmp_cx or sp_refactor_cx: */
+  int p, n=N->n, lnz=N->L->Ap[n], unz=N->U->Ap[n];
+  if (max(lnz,unz) > S->size){
+    free(S->Lre); free(S->Lim);
+    free(S->Ure); free(S->Uim);
+    S->size = max(lnz,unz);
+    lasagna_alloc(S->Lre,S->size*sizeof(double),error_message);
+    lasagna_alloc(S->Lim,S->size*sizeof(double),error_message);
+    lasagna_alloc(S->Ure,S->size*sizeof(double),error_message);
+    lasagna_alloc(S->Uim,S->size*sizeof(double),error_message);
+  }
+  for (p=0; p<lnz; p++){
+    S->Lre[p] = creal(N->L->Ax[p]);
+    S->Lim[p] = cimag(N->L->Ax[p]);
+  }
+  for (p=0; p<unz; p++){
+    S->Ure[p] = creal(N->U->Ax[p]);
+    S->Uim[p] = cimag(N->U->Ax[p]);
+  }
+  return _SUCCESS_;
+}
+
+int sp_refactor_split_cx(sp_split_cx *S, sp_num_cx *N, sp_mat_cx *A){
+  /* As sp_refactor_cx, with the pivot sequence and the pattern of the factors
+     in N. The work is done in the permuted row order of L, so column k of U
+     lists the columns of L to eliminate in topological order, and the rows
+     reached by column k are exactly those of column k of L and U. */
+  int *Lp=N->L->Ap, *Li=N->L->Ai, *Up=N->U->Ap, *Ui=N->U->Ai;
+  int *Ap=A->Ap, *Ai=A->Ai, *pinv=N->pinv, *q=N->q;
+  double *Lre=S->Lre, *Lim=S->Lim, *Ure=S->Ure, *Uim=S->Uim;
+  double *Are=S->Are, *Aim=S->Aim, *xr=S->wre, *xi=S->wim;
+  double ar, ai, pr, pi, d, amax=0.0;
+  int n=N->n, nnz=Ap[n], k, j, p, t, i, col;
+
+  for (p=0; p<nnz; p++){
+    Are[p] = creal(A->Ax[p]);
+    Aim[p] = cimag(A->Ax[p]);
+  }
+  for (p=0; p<nnz; p++)
+    amax = max(amax,Are[p]*Are[p]+Aim[p]*Aim[p]);
+  S->amax = sqrt(amax);
+  for (k=0; k<n; k++){
+    col = q ? (q[k]) : k;
+    for (p=Ap[col]; p<Ap[col+1]; p++){
+      i = pinv[Ai[p]];
+      xr[i] = Are[p];
+      xi[i] = Aim[p];
+    }
+    /* Column k of U, the last entry is the pivot: */
+    for (p=Up[k]; p<Up[k+1]-1; p++){
+      j = Ui[p];
+      ar = xr[j]; ai = xi[j];
+      Ure[p] = ar; Uim[p] = ai;
+      xr[j] = 0.0; xi[j] = 0.0;
+#pragma omp simd
+      for (t=Lp[j]+1; t<Lp[j+1]; t++){
+	xr[Li[t]] -= Lre[t]*ar-Lim[t]*ai;
+	xi[Li[t]] -= Lre[t]*ai+Lim[t]*ar;
+      }
+    }
+    pr = xr[k]; pi = xi[k];
+    Ure[p] = pr; Uim[p] = pi;
+    xr[k] = 0.0; xi[k] = 0.0;
+    /* Column k of L, divided by the pivot. A zero pivot gives non-finite
+       values, which sp_factor_stability_split_cx rejects: */
+    d = pr*pr+pi*pi;
+    pr /= d; pi = -pi/d;
+    Lre[Lp[k]] = 1.0; Lim[Lp[k]] = 0.0;
+#pragma omp simd
+    for (t=Lp[k]+1; t<Lp[k+1]; t++){
+      Lre[t] = xr[Li[t]]*pr-xi[Li[t]]*pi;
+      Lim[t] = xr[Li[t]]*pi+xi[Li[t]]*pr;
+      xr[Li[t]] = 0.0; xi[Li[t]] = 0.0;
+    }
+  }
+  return _SUCCESS_;
+}
+
+int sp_factor_stability_split_cx(sp_split_cx *S, sp_num_cx *N, double *growth,
+				 double *pivot_ratio){
+  /* As sp_factor_stability_cx, for the factors in S: */
+  int j, n=N->n, *Up=N->U->Ap;
+  double d, umax=0.0, lmax=1.0;
+  for (j=0; j<n; j++){
+    d = S->Ure[Up[j+1]-1]*S->Ure[Up[j+1]-1]+S->Uim[Up[j+1]-1]*S->Uim[Up[j+1]-1];
+    if ((d == 0.0)||(!isfinite(d))) return _FAILURE_;
+  }
+  for (j=0; j<Up[n]; j++) umax = max(umax,S->Ure[j]*S->Ure[j]+S->Uim[j]*S->Uim[j]);
+  for (j=0; j<N->L->Ap[n]; j++) lmax = max(lmax,S->Lre[j]*S->Lre[j]+S->Lim[j]*S->Lim[j]);
+  if (!(isfinite(umax)&&isfinite(lmax))) return _FAILURE_;
+  *growth = (S->amax > 0.0) ? sqrt(umax)/S->amax : 1.0;
+  *pivot_ratio = 1.0/sqrt(lmax);
+  return _SUCCESS_;
+}
+
+int sp_lusolve_split_cx(sp_split_cx *S, sp_num_cx *N, double complex *b,
+			double complex *x){
+  /* As sp_lusolve_cx, with the factors in S. b and x may be the same. */
+  int *Lp=N->L->Ap, *Li=N->L->Ai, *Up=N->U->Ap, *Ui=N->U->Ai;
+  double *Lre=S->Lre, *Lim=S->Lim, *Ure=S->Ure, *Uim=S->Uim;
+  double *xr=S->wre, *xi=S->wim, ar, ai, d;
+  int n=N->n, j, p;
+
+  for (j=0; j<n; j++){
+    xr[N->pinv[j]] = creal(b[j]);
+    xi[N->pinv[j]] = cimag(b[j]);
+  }
+  /* L has a unit diagonal: */
+  for (j=0; j<n; j++){
+    ar = xr[j]; ai = xi[j];
+#pragma omp simd
+    for (p=Lp[j]+1; p<Lp[j+1]; p++){
+      xr[Li[p]] -= Lre[p]*ar-Lim[p]*ai;
+      xi[Li[p]] -= Lre[p]*ai+Lim[p]*ar;
+    }
+  }
+  for (j=n-1; j>=0; j--){
+    p = Up[j+1]-1;
+    d = Ure[p]*Ure[p]+Uim[p]*Uim[p];
+    ar = (xr[j]*Ure[p]+xi[j]*Uim[p])/d;
+    ai = (xi[j]*Ure[p]-xr[j]*Uim[p])/d;
+    xr[j] = ar; xi[j] = ai;
+#pragma omp simd
+    for (p=Up[j]; p<Up[j+1]-1; p++){
+      xr[Ui[p]] -= Ure[p]*ar-Uim[p]*ai;
+      xi[Ui[p]] -= Ure[p]*ai+Uim[p]*ar;
+    }
+  }
+  for (j=0; j<n; j++){
+    x[N->q ? N->q[j] : j] = xr[j]+I*xi[j];
+    xr[j] = 0.0; xi[j] = 0.0;
+  }
+  return _SUCCESS_;
+}
+
+int sp_lu_demote_cx(sp_num_cx *N, float complex *Lx, float complex *Ux){
+  int p, n=N->n;
+  double complex *Ldx=N->L->Ax, *Udx=N->U->Ax;
+  for (p=0; p<N->L->Ap[n]; p++) Lx[p] = (float complex) Ldx[p];
+  for (p=0; p<N->U->Ap[n]; p++) Ux[p] = (float complex) Udx[p];
+  return _SUCCESS_;
+}
+
+int sp_lusolve_sgl_cx(sp_num_cx *N, float complex *Lx, float complex *Ux,
+		      double complex *b, double complex *x){
+  int p, j, n, *Ap, *Ai;
+  double complex *w;
+  n=N->n;
+  for (j=0; j<n; j++) x[N->pinv[j]] = b[j];
+  Ap = N->L->Ap; Ai = N->L->Ai;
+  for (j=0; j<n; j++){
+    x[j] /=Lx[Ap[j]];
+    for (p=Ap[j]+1; p<Ap[j+1]; p++){
+      x[Ai[p]] -=Lx[p]*x[j];
+    }
+  }
+  Ap = N->U->Ap; Ai = N->U->Ai;
+  for (j=n-1; j>=0; j--){
+    x[j] /=Ux[Ap[j+1]-1];
+    for (p=Ap[j];p<Ap[j+1]-1; p++){
+      x[Ai[p]] -= Ux[p]*x[j];
+    }
+  }
+  if (N->q!=NULL){
+    w = N->w;
+    for(j=0;j<n;j++) w[j] = x[j];
+    for(j=0; j<n; j++) x[N->q[j]] = w[j];
+  }
+  return _SUCCESS_;
+}
+
+int sp_residual_cx(sp_mat_cx *A, double complex *x, double complex *b,
+		   double complex *r){
+  int j, p, n=A->ncols, *Ap=A->Ap, *Ai=A->Ai;
+  double complex *Ax=A->Ax, xj;
+  for (j=0; j<n; j++) r[j] = b[j];
+  for (j=0; j<n; j++){
+    xj = x[j];
+    for (p=Ap[j]; p<Ap[j+1]; p++) r[Ai[p]] -= Ax[p]*xj;
+  }
+  return _SUCCESS_;
+}
+
+int sp_ilu_factor_cx(sp_ilu *M, double complex *Ax){
+  int i, j, p, r, n=M->n, *Rp=M->Rp, *Rj=M->Rj, *diag=M->diag, *iw=M->iw;
+  double complex *Rx=M->Rz, lik;
+  for (p=0; p<M->nnz; p++)
+    Rx[p] = (M->Amap[p] >= 0) ? Ax[M->Amap[p]] : 0.0;
+  for (i=0; i<n; i++){
+    for (p=Rp[i]; p<Rp[i+1]; p++) iw[Rj[p]] = p;
+    for (p=Rp[i]; p<diag[i]; p++){
+      j = Rj[p];
+      lik = Rx[p]/Rx[diag[j]];
+      Rx[p] = lik;
+      for (r=diag[j]+1; r<Rp[j+1]; r++)
+	if (iw[Rj[r]] >= 0) Rx[iw[Rj[r]]] -= lik*Rx[r];
+    }
+    for (p=Rp[i]; p<Rp[i+1]; p++) iw[Rj[p]] = -1;
+    if ((Rx[diag[i]] == 0.0)||(!isfinite(cabs(Rx[diag[i]])))) return _FAILURE_;
+  }
+  return _SUCCESS_;
+}
+
+int sp_ilu_solve_cx(sp_ilu *M, double complex *x){
+  int i, p, n=M->n, *Rp=M->Rp, *Rj=M->Rj, *diag=M->diag;
+  double complex *Rx=M->Rz, s;
+  for (i=0; i<n; i++){
+    s = x[i];
+    for (p=Rp[i]; p<diag[i]; p++) s -= Rx[p]*x[Rj[p]];
+    x[i] = s;
+  }
+  for (i=n-1; i>=0; i--){
+    s = x[i];
+    for (p=diag[i]+1; p<Rp[i+1]; p++) s -= Rx[p]*x[Rj[p]];
+    x[i] = s/Rx[diag[i]];
+  }
+  return _SUCCESS_;
+}
+
+int sp_gmres_cx(sp_mat_cx *A, sp_ilu *M, double complex *b, double complex *x, 
+		int m, int maxit, double tol, double complex *work, int *iter){
+  /* As sp_gmres, with rotations [c s;-conj(s) c] for real c: */
+  int n=A->ncols, i, j, k, p, it=0;
+  double complex *V, *H, *g, *s, *y, *w, *z, h, t;
+  double *c, beta, bnrm, hn, d;
+  V = work; w = V+(m+1)*n; z = w+n; H = z+n; g = H+(m+1)*m; 
+  s = g+m+1; y = s+m; c = (double *) (y+m);
+  for (i=0; i<n; i++) x[i] = 0.0;
+  for (bnrm=0.0, i=0; i<n; i++) bnrm += creal(conj(b[i])*b[i]);
+  bnrm = sqrt(bnrm);
+  *iter = 0;
+  if (bnrm == 0.0) return _SUCCESS_;
+  /* The residual of x = 0, in case maxit is 0: */
+  beta = bnrm;
+  while (it < maxit){
+    /* r = b - A x: */
+    for (i=0; i<n; i++) V[i] = b[i];
+    for (j=0; j<n; j++)
+      for (p=A->Ap[j]; p<A->Ap[j+1]; p++) V[A->Ai[p]] -= A->Ax[p]*x[j];
+    for (beta=0.0, i=0; i<n; i++) beta += creal(conj(V[i])*V[i]);
+    beta = sqrt(beta);
+    if (beta <= tol*bnrm) break;
+    for (i=0; i<n; i++) V[i] /= beta;
+    for (i=0; i<=m; i++) g[i] = 0.0;
+    g[0] = beta;
+    for (k=0; (k<m)&&(it<maxit); k++, it++){
+      /* w = A M^{-1} v_k, orthogonalised against V by modified Gram-Schmidt: */
+      for (i=0; i<n; i++) z[i] = V[k*n+i];
+      sp_ilu_solve_cx(M,z);
+      for (i=0; i<n; i++) w[i] = 0.0;
+      for (j=0; j<n; j++)
+	for (p=A->Ap[j]; p<A->Ap[j+1]; p++) w[A->Ai[p]] += A->Ax[p]*z[j];
+      for (j=0; j<=k; j++){
+	for (h=0.0, i=0; i<n; i++) h += conj(V[j*n+i])*w[i];
+	for (i=0; i<n; i++) w[i] -= h*V[j*n+i];
+	H[j*m+k] = h;
+      }
+      for (hn=0.0, i=0; i<n; i++) hn += creal(conj(w[i])*w[i]);
+      hn = sqrt(hn);
+      if (hn > 0.0) 
+	for (i=0; i<n; i++) V[(k+1)*n+i] = w[i]/hn;
+      /* Apply the previous rotations and make a new one for H[k+1][k]=h: */
+      for (j=0; j<k; j++){
+	t = c[j]*H[j*m+k]+s[j]*H[(j+1)*m+k];
+	H[(j+1)*m+k] = -conj(s[j])*H[j*m+k]+c[j]*H[(j+1)*m+k];
+	H[j*m+k] = t;
+      }
+      d = sqrt(creal(conj(H[k*m+k])*H[k*m+k])+hn*hn);
+      if (d == 0.0) return _FAILURE_;
+      c[k] = cabs(H[k*m+k])/d;
+      t = (c[k] > 0.0) ? H[k*m+k]/cabs(H[k*m+k]) : 1.0;
+      s[k] = t*hn/d;
+      H[k*m+k] = t*d;
+      g[k+1] = -conj(s[k])*g[k];
+      g[k] = c[k]*g[k];
+      if ((cabs(g[k+1]) <= tol*bnrm)||(hn == 0.0)){
+	k++; it++;
+	break;
+      }
+    }
+    /* Solve the triangular system and update x += M^{-1} V y: */
+    for (j=k-1; j>=0; j--){
+      t = g[j];
+      for (i=j+1; i<k; i++) t -= H[j*m+i]*y[i];
+      y[j] = t/H[j*m+j];
+    }
+    for (i=0; i<n; i++) w[i] = 0.0;
+    for (j=0; j<k; j++)
+      for (i=0; i<n; i++) w[i] += y[j]*V[j*n+i];
+    sp_ilu_solve_cx(M,w);
+    for (i=0; i<n; i++) x[i] += w[i];
+    if (cabs(g[k]) <= tol*bnrm){
+      *iter = it;
+      return _SUCCESS_;
+    }
+  }
+  *iter = it;
+  return (beta <= tol*bnrm) ? _SUCCESS_ : _FAILURE_;
+}
+
 int get_pattern_A_plus_AT(int *Ap, 
 			  int *Ai, 
 			  int n, 